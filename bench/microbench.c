@@ -0,0 +1,907 @@
+/****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/**
+ * @file   microbench.c
+ *
+ * @brief  microbenchmarks for the decode, payload encoding and lookup
+ *         primitives (make microbench, see doc/README.bench)
+ *
+ * Linked against the same objects as squirrel itself (squirrel.c is
+ * rebuilt without main()), so every benchmark times the code that ships.
+ * Each benchmark runs its loop for a fixed iteration count per sample;
+ * the count is calibrated once to a target sample time unless given with
+ * -i, so CI runs can pin it and stay comparable across builds.  Results
+ * go out as JSON, a one line summary per benchmark goes to stderr.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+
+/* decode.c's include order, the Packet layout depends on it */
+#include "decode.h"
+#include "squirrel.h"
+#include "util.h"
+#include "mstring.h"
+#include "map.h"
+#include "sfxhash.h"
+#include "output-plugins/spo_database.h"
+
+#define MB_SAMPLES_DEFAULT      10
+#define MB_TARGET_MS_DEFAULT    20
+#define MB_PAYLOAD_DEFAULT      1460
+#define MB_PAYLOAD_MAX          65535
+#define MB_FRAME_MAX            2048
+#define MB_SIGS                 20000       /* a large ruleset */
+#define MB_CLASSES              40
+#define MB_LOOKUP_KEYS          4096        /* power of 2 */
+#define MB_HASH_NODES           65536
+
+typedef struct _MicroBench
+{
+    const char *name;
+    void *(*setup)(void);
+    void (*run)(void *, uint64_t);
+    void (*teardown)(void *);
+    uint64_t (*bytes)(void *);      /* input bytes per op, NULL if none */
+} MicroBench;
+
+typedef struct _MicroResult
+{
+    uint64_t iterations;
+    double min, median, mean, max, stddev;  /* ns per op */
+    uint64_t bytes;
+} MicroResult;
+
+/* results are folded in here so the loops are not optimised away */
+static volatile uint64_t mb_sink;
+
+static unsigned mb_payload_len = MB_PAYLOAD_DEFAULT;
+
+static uint64_t MbRand (uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ULL;
+}
+
+static uint64_t MbNow (void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/*
+ * Payloads: printable text with the odd character every encoder has to
+ * treat specially, which is what alert payloads mostly look like.
+ */
+static uint8_t *MbPayload (unsigned len)
+{
+    static const char special[] = "'\"\\<>&\n\r";
+    uint8_t *p = SnortAlloc(len + 1);
+    uint64_t s = 42;
+    unsigned i;
+
+    for ( i = 0; i < len; i++ )
+    {
+        uint64_t r = MbRand(&s);
+
+        if ( r % 32 == 0 )
+            p[i] = special[(r >> 8) % (sizeof(special) - 1)];
+        else if ( r % 32 == 1 )
+            p[i] = (uint8_t)(r >> 16);
+        else
+            p[i] = (uint8_t)(' ' + (r >> 16) % 95);
+    }
+
+    return p;
+}
+
+/*
+ * Decode
+ */
+typedef struct _MbFrame
+{
+    uint8_t data[MB_FRAME_MAX];
+    uint32_t len;
+    struct pcap_pkthdr pkth;
+    Packet p;
+} MbFrame;
+
+static uint8_t *MbEth (uint8_t *f, uint16_t type)
+{
+    memcpy(f, "\x00\x16\x3e\x00\x00\x02\x00\x16\x3e\x00\x00\x01", 12);
+    f[12] = type >> 8;
+    f[13] = type & 0xff;
+    return f + 14;
+}
+
+static uint8_t *MbIp4 (uint8_t *ip, uint8_t proto, uint16_t payload)
+{
+    uint32_t sum = 0;
+    int i;
+
+    memset(ip, 0, 20);
+    ip[0] = 0x45;
+    ip[2] = (20 + payload) >> 8;
+    ip[3] = (20 + payload) & 0xff;
+    ip[8] = 64;
+    ip[9] = proto;
+    memcpy(ip + 12, "\x0a\x00\x00\x01\x0a\x01\x00\x02", 8);
+    for ( i = 0; i < 20; i += 2 )
+        sum += (ip[i] << 8) | ip[i + 1];
+    while ( sum >> 16 )
+        sum = (sum & 0xffff) + (sum >> 16);
+    ip[10] = (~sum >> 8) & 0xff;
+    ip[11] = ~sum & 0xff;
+    return ip + 20;
+}
+
+static uint8_t *MbIp6 (uint8_t *ip, uint8_t proto, uint16_t payload)
+{
+    memset(ip, 0, 40);
+    ip[0] = 0x60;
+    ip[4] = payload >> 8;
+    ip[5] = payload & 0xff;
+    ip[6] = proto;
+    ip[7] = 64;
+    ip[8] = 0xfd; ip[23] = 1;
+    ip[24] = 0xfd; ip[39] = 2;
+    return ip + 40;
+}
+
+static uint8_t *MbTcp (uint8_t *tcp, unsigned payload)
+{
+    memset(tcp, 0, 20);
+    tcp[0] = 0x9c; tcp[1] = 0x40;       /* 40000 */
+    tcp[3] = 80;
+    tcp[7] = 1;
+    tcp[12] = 5 << 4;
+    tcp[13] = 0x18;
+    tcp[14] = 0x20;
+    memset(tcp + 20, 'A', payload);
+    return tcp + 20 + payload;
+}
+
+static uint8_t *MbUdp (uint8_t *udp, uint16_t dport, uint16_t payload)
+{
+    memset(udp, 0, 8);
+    udp[0] = 0x9c; udp[1] = 0x40;
+    udp[2] = dport >> 8;
+    udp[3] = dport & 0xff;
+    udp[4] = (8 + payload) >> 8;
+    udp[5] = (8 + payload) & 0xff;
+    return udp + 8;
+}
+
+#define MB_DECODE_PAYLOAD   512
+
+static void *MbFrameNew (void)
+{
+    MbFrame *fr = SnortAlloc(sizeof(MbFrame));
+
+    fr->pkth.ts.tv_sec = 1;
+    return fr;
+}
+
+static void MbFrameDone (MbFrame *fr, uint8_t *end)
+{
+    fr->len = (uint32_t)(end - fr->data);
+    fr->pkth.caplen = fr->pkth.len = fr->len;
+}
+
+static void *SetupEthIp4Tcp (void)
+{
+    MbFrame *fr = MbFrameNew();
+    uint8_t *q = MbEth(fr->data, 0x0800);
+
+    q = MbIp4(q, IPPROTO_TCP, 20 + MB_DECODE_PAYLOAD);
+    MbFrameDone(fr, MbTcp(q, MB_DECODE_PAYLOAD));
+    return fr;
+}
+
+static void *SetupVlanIp4Udp (void)
+{
+    MbFrame *fr = MbFrameNew();
+    uint8_t *q = MbEth(fr->data, 0x8100);
+
+    q[0] = 0x00; q[1] = 100;            /* vid 100 */
+    q[2] = 0x08; q[3] = 0x00;
+    q = MbIp4(q + 4, IPPROTO_UDP, 8 + MB_DECODE_PAYLOAD);
+    q = MbUdp(q, 53, MB_DECODE_PAYLOAD);
+    memset(q, 'A', MB_DECODE_PAYLOAD);
+    MbFrameDone(fr, q + MB_DECODE_PAYLOAD);
+    return fr;
+}
+
+#ifdef MPLS
+static void *SetupMplsIp4Tcp (void)
+{
+    MbFrame *fr = MbFrameNew();
+    uint8_t *q = MbEth(fr->data, 0x8847);
+
+    q[0] = 0x00; q[1] = 0x01; q[2] = 0x01; q[3] = 64;  /* label 16, bottom */
+    q = MbIp4(q + 4, IPPROTO_TCP, 20 + MB_DECODE_PAYLOAD);
+    MbFrameDone(fr, MbTcp(q, MB_DECODE_PAYLOAD));
+    return fr;
+}
+#endif
+
+static void *SetupEthIp6Tcp (void)
+{
+    MbFrame *fr = MbFrameNew();
+    uint8_t *q = MbEth(fr->data, 0x86dd);
+
+    q = MbIp6(q, IPPROTO_TCP, 20 + MB_DECODE_PAYLOAD);
+    MbFrameDone(fr, MbTcp(q, MB_DECODE_PAYLOAD));
+    return fr;
+}
+
+static void *SetupGreIp4Tcp (void)
+{
+    MbFrame *fr = MbFrameNew();
+    uint8_t *q = MbEth(fr->data, 0x0800);
+
+    q = MbIp4(q, IPPROTO_GRE, 4 + 20 + 20 + MB_DECODE_PAYLOAD);
+    q[0] = 0; q[1] = 0; q[2] = 0x08; q[3] = 0x00;
+    q = MbIp4(q + 4, IPPROTO_TCP, 20 + MB_DECODE_PAYLOAD);
+    MbFrameDone(fr, MbTcp(q, MB_DECODE_PAYLOAD));
+    return fr;
+}
+
+static void *SetupGtpIp4Tcp (void)
+{
+    MbFrame *fr = MbFrameNew();
+    uint16_t inner = 20 + 20 + MB_DECODE_PAYLOAD;
+    uint8_t *q = MbEth(fr->data, 0x0800);
+
+    q = MbIp4(q, IPPROTO_UDP, 8 + 8 + inner);
+    q = MbUdp(q, 2152, 8 + inner);
+    q[0] = 0x30; q[1] = 0xff;           /* GTPv1-U, T-PDU */
+    q[2] = inner >> 8; q[3] = inner & 0xff;
+    q[4] = 0; q[5] = 0; q[6] = 0; q[7] = 1;
+    q = MbIp4(q + 8, IPPROTO_TCP, 20 + MB_DECODE_PAYLOAD);
+    MbFrameDone(fr, MbTcp(q, MB_DECODE_PAYLOAD));
+    return fr;
+}
+
+/* the spooler's spoolerRetrievePktData(): clear the Packet, decode */
+static void RunDecode (void *arg, uint64_t n)
+{
+    MbFrame *fr = arg;
+    uint64_t i, acc = 0;
+
+    for ( i = 0; i < n; i++ )
+    {
+        memset(&fr->p, 0, sizeof(Packet));
+        DecodePacket(DLT_EN10MB, &fr->p, (DAQ_PktHdr_t *)&fr->pkth, fr->data);
+        acc += fr->p.dsize;
+    }
+
+    mb_sink += acc;
+}
+
+static uint64_t BytesFrame (void *arg)
+{
+    return ((MbFrame *)arg)->len;
+}
+
+/*
+ * Payload encoders
+ */
+typedef struct _MbEncode
+{
+    uint8_t *payload;
+    char *str;                      /* payload as a C string, for escaping */
+    char *out;                      /* MAX_QUERY_LENGTH */
+    DatabaseData *db;
+} MbEncode;
+
+static void *SetupEncode (void)
+{
+    MbEncode *e = SnortAlloc(sizeof(MbEncode));
+    unsigned i;
+
+    e->payload = MbPayload(mb_payload_len);
+    e->str = SnortAlloc(mb_payload_len + 1);
+    for ( i = 0; i < mb_payload_len; i++ )
+        e->str[i] = e->payload[i] ? (char)e->payload[i] : ' ';
+    e->out = SnortAlloc(MAX_QUERY_LENGTH);
+    e->db = SnortAlloc(sizeof(DatabaseData));
+    e->db->dbtype_id = DB_MYSQL;
+    return e;
+}
+
+static void TeardownEncode (void *arg)
+{
+    MbEncode *e = arg;
+
+    free(e->payload);
+    free(e->str);
+    free(e->out);
+    free(e->db);
+    free(e);
+}
+
+static uint64_t BytesPayload (void *arg)
+{
+    return mb_payload_len;
+}
+
+static void RunFasthex (void *arg, uint64_t n)
+{
+    MbEncode *e = arg;
+    uint64_t i;
+    char *s;
+
+    for ( i = 0; i < n; i++ )
+    {
+        s = fasthex(e->payload, mb_payload_len);
+        mb_sink += (uint8_t)s[0];
+        free(s);
+    }
+}
+
+static void RunFasthexStatic (void *arg, uint64_t n)
+{
+    MbEncode *e = arg;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        fasthex_STATIC(e->payload, mb_payload_len, e->out);
+        mb_sink += (uint8_t)e->out[0];
+    }
+}
+
+static void RunBase64Static (void *arg, uint64_t n)
+{
+    MbEncode *e = arg;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        base64_STATIC(e->payload, mb_payload_len, e->out);
+        mb_sink += (uint8_t)e->out[0];
+    }
+}
+
+static void RunAsciiStatic (void *arg, uint64_t n)
+{
+    MbEncode *e = arg;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        ascii_STATIC(e->payload, mb_payload_len, e->out);
+        mb_sink += (uint8_t)e->out[0];
+    }
+}
+
+static void RunEncodeHex (void *arg, uint64_t n)
+{
+    MbEncode *e = arg;
+    uint32_t len;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        EncodeHex(e->payload, mb_payload_len, e->out, MAX_QUERY_LENGTH, &len);
+        mb_sink += len;
+    }
+}
+
+static void RunEncodeBase64 (void *arg, uint64_t n)
+{
+    MbEncode *e = arg;
+    uint32_t len;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        EncodeBase64(e->payload, mb_payload_len, e->out, MAX_QUERY_LENGTH, &len);
+        mb_sink += len;
+    }
+}
+
+/* length known, so no strlen() and nothing written back */
+static void RunEscapeBuffer (void *arg, uint64_t n)
+{
+    MbEncode *e = arg;
+    uint32_t len;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        snort_escape_buffer(e->str, mb_payload_len, e->out, MAX_QUERY_LENGTH, &len, e->db);
+        mb_sink += len;
+    }
+}
+
+static void RunEscapeStatic (void *arg, uint64_t n)
+{
+    MbEncode *e = arg;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        snort_escape_string_STATIC(e->str, e->out, mb_payload_len + 1, e->db);
+        mb_sink += (uint8_t)e->out[0];
+    }
+}
+
+/*
+ * Tokenizers, on a classification config line with an escaped separator
+ */
+#define MB_SPLIT_LINE   "web-application-attack,Web Application Attack\\, misc,1"
+
+static void *SetupSplit (void)
+{
+    return SnortStrdup(MB_SPLIT_LINE);
+}
+
+static void RunSplit (void *arg, uint64_t n)
+{
+    char **toks;
+    int num_toks;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        toks = mSplit(arg, ",", 3, &num_toks, '\\');
+        mb_sink += num_toks + (uint8_t)toks[1][0];
+        mSplitFree(&toks, num_toks);
+    }
+}
+
+/* views only, nothing allocated or written */
+static void RunSplitSpan (void *arg, uint64_t n)
+{
+    MSpan toks[3];
+    size_t len = strlen(arg);
+    int num_toks;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        num_toks = mSplitSpan(arg, len, ",", 3, toks, 3, '\\', 0);
+        mb_sink += num_toks + (uint8_t)toks[1].ptr[0];
+    }
+}
+
+/*
+ * Signature and classification lookups, against a sid map and
+ * classification config the size of a full ruleset
+ */
+typedef struct _MbLookup
+{
+    uint32_t sids[MB_LOOKUP_KEYS];
+    int classes[MB_LOOKUP_KEYS];
+} MbLookup;
+
+static void *SetupLookup (void)
+{
+    MbLookup *l = SnortAlloc(sizeof(MbLookup));
+    char line[128];
+    uint64_t s = 7;
+    int i;
+
+    /* published once, as the outputs see them */
+    if ( MapSnapshotCurrent() == NULL )
+    {
+        for ( i = 0; i < MB_SIGS; i++ )
+        {
+            snprintf(line, sizeof(line), "%d || BENCH signature %d", 1000000 + i, i);
+            ParseSidMapLine(barnyard2_conf, line);
+        }
+
+        for ( i = 0; i < MB_CLASSES; i++ )
+        {
+            snprintf(line, sizeof(line), "bench-class-%d,Bench class %d,%d", i, i, 1 + i % 4);
+            ParseClassificationConfig(barnyard2_conf, line);
+        }
+
+        MapPublish(barnyard2_conf);
+    }
+
+    for ( i = 0; i < MB_LOOKUP_KEYS; i++ )
+    {
+        l->sids[i] = 1000000 + (uint32_t)(MbRand(&s) % MB_SIGS);
+        l->classes[i] = 1 + (int)(MbRand(&s) % MB_CLASSES);
+    }
+
+    return l;
+}
+
+static void RunGetSigByGidSid (void *arg, uint64_t n)
+{
+    MbLookup *l = arg;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+        mb_sink += GetSigByGidSid(1, l->sids[i & (MB_LOOKUP_KEYS - 1)], 1)->id;
+}
+
+/* loading a sid map: MB_SIGS lines with references, then start over */
+static void *SetupLoad (void)
+{
+    Barnyard2Config *bc = SnortAlloc(sizeof(Barnyard2Config));
+
+    bc->sidmap_version = SIDMAPV1;
+    return bc;
+}
+
+static void RunParseSidMapLine (void *arg, uint64_t n)
+{
+    Barnyard2Config *bc = arg;
+    char line[160];
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        if ( bc->map_arena && bc->map_arena->sig_count == MB_SIGS )
+        {
+            bc->sigHead = NULL;
+            MapArenaFree(&bc->map_arena);
+        }
+
+        snprintf(line, sizeof(line), "%u || BENCH signature %u || url,www.example.com/%u || cve,2024-%u",
+                 1000000 + (unsigned)(i % MB_SIGS), (unsigned)(i % MB_SIGS),
+                 (unsigned)(i % 64), (unsigned)(i % 512));
+        ParseSidMapLine(bc, line);
+    }
+}
+
+static void TeardownLoad (void *arg)
+{
+    Barnyard2Config *bc = arg;
+
+    bc->sigHead = NULL;
+    MapArenaFree(&bc->map_arena);
+    FreeReferences(&bc->references);
+    free(bc);
+}
+
+static void RunClassTypeLookupById (void *arg, uint64_t n)
+{
+    MbLookup *l = arg;
+    ClassType *ct;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        ct = ClassTypeLookupById(barnyard2_conf, l->classes[i & (MB_LOOKUP_KEYS - 1)]);
+        mb_sink += ct ? ct->priority : 0;
+    }
+}
+
+/*
+ * sfxhash, keyed like the flow and cache tables: two addresses and ports
+ */
+typedef struct _MbHashKey
+{
+    uint32_t sip, dip;
+    uint16_t sp, dp;
+    uint32_t pad;
+} MbHashKey;
+
+typedef struct _MbHash
+{
+    SFXHASH *h;
+    MbHashKey keys[MB_HASH_NODES];
+    MbHashKey misses[MB_LOOKUP_KEYS];
+} MbHash;
+
+static void *SetupHash (void)
+{
+    MbHash *mh = SnortAlloc(sizeof(MbHash));
+    uint64_t s = 11, data;
+    int i;
+
+    mh->h = sfxhash_new(MB_HASH_NODES, sizeof(MbHashKey), sizeof(uint64_t),
+                        0, 0, NULL, NULL, 1);
+    if ( mh->h == NULL )
+        FatalError("microbench: sfxhash_new failed\n");
+
+    for ( i = 0; i < MB_HASH_NODES; i++ )
+    {
+        mh->keys[i].sip = (uint32_t)MbRand(&s);
+        mh->keys[i].dip = (uint32_t)MbRand(&s);
+        mh->keys[i].sp = (uint16_t)i;
+        mh->keys[i].dp = 80;
+        data = i;
+        sfxhash_add(mh->h, &mh->keys[i], &data);
+    }
+
+    for ( i = 0; i < MB_LOOKUP_KEYS; i++ )
+    {
+        mh->misses[i] = mh->keys[i];
+        mh->misses[i].dp = 443;
+    }
+
+    return mh;
+}
+
+static void TeardownHash (void *arg)
+{
+    MbHash *mh = arg;
+
+    sfxhash_delete(mh->h);
+    free(mh);
+}
+
+static void RunHashFindHit (void *arg, uint64_t n)
+{
+    MbHash *mh = arg;
+    uint64_t i, *d;
+
+    for ( i = 0; i < n; i++ )
+    {
+        d = sfxhash_find(mh->h, &mh->keys[(i * 40503) & (MB_HASH_NODES - 1)]);
+        mb_sink += d ? *d : 0;
+    }
+}
+
+static void RunHashFindMiss (void *arg, uint64_t n)
+{
+    MbHash *mh = arg;
+    uint64_t i;
+
+    for ( i = 0; i < n; i++ )
+        mb_sink += sfxhash_find(mh->h, &mh->misses[i & (MB_LOOKUP_KEYS - 1)]) != NULL;
+}
+
+/* one node out and back in, so the table stays the same size */
+static void RunHashRemoveAdd (void *arg, uint64_t n)
+{
+    MbHash *mh = arg;
+    MbHashKey *k;
+    uint64_t i, data = 0;
+
+    for ( i = 0; i < n; i++ )
+    {
+        k = &mh->keys[(i * 40503) & (MB_HASH_NODES - 1)];
+        sfxhash_remove(mh->h, k);
+        mb_sink += sfxhash_add(mh->h, k, &data);
+    }
+}
+
+static void TeardownFree (void *arg)
+{
+    free(arg);
+}
+
+static MicroBench micro_benches[] =
+{
+    { "decode/eth_ipv4_tcp",        SetupEthIp4Tcp,  RunDecode, TeardownFree, BytesFrame },
+    { "decode/vlan_ipv4_udp",       SetupVlanIp4Udp, RunDecode, TeardownFree, BytesFrame },
+#ifdef MPLS
+    { "decode/mpls_ipv4_tcp",       SetupMplsIp4Tcp, RunDecode, TeardownFree, BytesFrame },
+#endif
+    { "decode/eth_ipv6_tcp",        SetupEthIp6Tcp,  RunDecode, TeardownFree, BytesFrame },
+    { "decode/gre_ipv4_tcp",        SetupGreIp4Tcp,  RunDecode, TeardownFree, BytesFrame },
+    { "decode/gtp_ipv4_tcp",        SetupGtpIp4Tcp,  RunDecode, TeardownFree, BytesFrame },
+    { "util/fasthex",               SetupEncode, RunFasthex,       TeardownEncode, BytesPayload },
+    { "util/fasthex_STATIC",        SetupEncode, RunFasthexStatic, TeardownEncode, BytesPayload },
+    { "util/base64_STATIC",         SetupEncode, RunBase64Static,  TeardownEncode, BytesPayload },
+    { "util/ascii_STATIC",          SetupEncode, RunAsciiStatic,   TeardownEncode, BytesPayload },
+    { "util/EncodeHex",             SetupEncode, RunEncodeHex,     TeardownEncode, BytesPayload },
+    { "util/EncodeBase64",          SetupEncode, RunEncodeBase64,  TeardownEncode, BytesPayload },
+    { "util/mSplit",                SetupSplit,  RunSplit,         TeardownFree, NULL },
+    { "util/mSplitSpan",            SetupSplit,  RunSplitSpan,     TeardownFree, NULL },
+    { "database/snort_escape_string_STATIC", SetupEncode, RunEscapeStatic, TeardownEncode, BytesPayload },
+    { "database/snort_escape_buffer", SetupEncode, RunEscapeBuffer, TeardownEncode, BytesPayload },
+    { "map/GetSigByGidSid",         SetupLookup, RunGetSigByGidSid,      TeardownFree, NULL },
+    { "map/ClassTypeLookupById",    SetupLookup, RunClassTypeLookupById, TeardownFree, NULL },
+    { "map/ParseSidMapLine",        SetupLoad,   RunParseSidMapLine,     TeardownLoad, NULL },
+    { "sfxhash/find_hit",           SetupHash, RunHashFindHit,   TeardownHash, NULL },
+    { "sfxhash/find_miss",          SetupHash, RunHashFindMiss,  TeardownHash, NULL },
+    { "sfxhash/remove_add",         SetupHash, RunHashRemoveAdd, TeardownHash, NULL },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+static int CmpDouble (const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*-------------------------------------------------------------------
+ * MicroRun: calibrate (unless iterations are fixed), one warm up
+ * sample, then the timed samples
+ *-------------------------------------------------------------------
+ */
+static void MicroRun (MicroBench *mb, uint64_t iterations, int samples,
+    uint64_t target_ns, MicroResult *res)
+{
+    void *ctx = mb->setup();
+    double *ns = SnortAlloc(sizeof(double) * samples);
+    uint64_t t0, t1;
+    double sum = 0, sq = 0;
+    int i;
+
+    if ( iterations == 0 )
+    {
+        iterations = 1;
+        for ( ;; )
+        {
+            t0 = MbNow();
+            mb->run(ctx, iterations);
+            t1 = MbNow();
+            if ( t1 - t0 >= target_ns || iterations >= (1ULL << 40) )
+                break;
+            iterations *= 2;
+        }
+    }
+    else
+        mb->run(ctx, iterations);
+
+    for ( i = 0; i < samples; i++ )
+    {
+        t0 = MbNow();
+        mb->run(ctx, iterations);
+        t1 = MbNow();
+        ns[i] = (double)(t1 - t0) / (double)iterations;
+        sum += ns[i];
+    }
+
+    res->iterations = iterations;
+    res->mean = sum / samples;
+    for ( i = 0; i < samples; i++ )
+        sq += (ns[i] - res->mean) * (ns[i] - res->mean);
+    res->stddev = samples > 1 ? sqrt(sq / (samples - 1)) : 0;
+
+    qsort(ns, samples, sizeof(double), CmpDouble);
+    res->min = ns[0];
+    res->max = ns[samples - 1];
+    res->median = samples % 2 ? ns[samples / 2]
+                              : (ns[samples / 2 - 1] + ns[samples / 2]) / 2;
+    res->bytes = mb->bytes ? mb->bytes(ctx) : 0;
+
+    free(ns);
+    mb->teardown(ctx);
+}
+
+static void Usage (const char *prog)
+{
+    fprintf(stderr,
+        "USAGE: %s [-options]\n"
+        "\n"
+        "  -i <num>    iterations per sample (default: calibrated to -t)\n"
+        "  -n <num>    samples per benchmark (default: %d)\n"
+        "  -t <ms>     calibration target per sample (default: %d)\n"
+        "  -s <bytes>  payload length for the encoders (default: %d)\n"
+        "  -f <text>   only benchmarks whose name contains <text>\n"
+        "  -c <cpu>    pin to cpu\n"
+        "  -o <file>   JSON to <file> (default: stdout)\n"
+        "  -e <level>  limit the payload encoders to scalar, sse2, ssse3 or avx2\n"
+        "  -l          list the benchmarks\n"
+        "\n", prog, MB_SAMPLES_DEFAULT, MB_TARGET_MS_DEFAULT, MB_PAYLOAD_DEFAULT);
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    uint64_t iterations = 0, target_ns = MB_TARGET_MS_DEFAULT * 1000000ULL;
+    int samples = MB_SAMPLES_DEFAULT, cpu = -1, first = 1, c;
+    const char *filter = NULL, *outfile = NULL;
+    MicroBench *mb;
+    MicroResult res;
+    FILE *out = stdout;
+
+    while ( (c = getopt(argc, argv, "i:n:t:s:f:c:o:e:lh")) != -1 )
+    {
+        switch ( c )
+        {
+            case 'i': iterations = strtoull(optarg, NULL, 10); break;
+            case 'n': samples = atoi(optarg); break;
+            case 't': target_ns = strtoull(optarg, NULL, 10) * 1000000ULL; break;
+            case 's': mb_payload_len = (unsigned)atoi(optarg); break;
+            case 'f': filter = optarg; break;
+            case 'c': cpu = atoi(optarg); break;
+            case 'o': outfile = optarg; break;
+            case 'e':
+                if ( EncodeSimdSet(optarg) < 0 )
+                    Usage(argv[0]);
+                break;
+            case 'l':
+                for ( mb = micro_benches; mb->name; mb++ )
+                    printf("%s\n", mb->name);
+                return 0;
+            default: Usage(argv[0]);
+        }
+    }
+
+    if ( samples < 1 || mb_payload_len == 0 || mb_payload_len > MB_PAYLOAD_MAX )
+        Usage(argv[0]);
+
+    if ( cpu >= 0 )
+    {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if ( sched_setaffinity(0, sizeof(set), &set) )
+            fprintf(stderr, "microbench: unable to pin to cpu %d\n", cpu);
+    }
+
+    if ( outfile && (out = fopen(outfile, "w")) == NULL )
+    {
+        fprintf(stderr, "microbench: unable to create %s\n", outfile);
+        return 1;
+    }
+
+    barnyard2_conf = Barnyard2ConfNew();
+    barnyard2_conf->logging_flags |= LOGGING_FLAG__QUIET;
+    barnyard2_conf->sidmap_version = SIDMAPV1;
+
+    fprintf(out, "{\n  \"suite\": \"squirrel-microbench\",\n  \"version\": \"%s\",\n"
+            "  \"timestamp\": %lu,\n  \"samples\": %d,\n  \"payload_bytes\": %u,\n"
+            "  \"encode_simd\": \"%s\",\n  \"benchmarks\": [", VERSION,
+            (unsigned long)time(NULL), samples, mb_payload_len, EncodeSimdName());
+
+    for ( mb = micro_benches; mb->name; mb++ )
+    {
+        if ( filter && strstr(mb->name, filter) == NULL )
+            continue;
+
+        MicroRun(mb, iterations, samples, target_ns, &res);
+
+        fprintf(out, "%s\n    { \"name\": \"%s\", \"iterations\": %llu, "
+                "\"ns_per_op\": { \"min\": %.3f, \"median\": %.3f, \"mean\": %.3f, "
+                "\"max\": %.3f, \"stddev\": %.3f }", first ? "" : ",", mb->name,
+                (unsigned long long)res.iterations, res.min, res.median, res.mean,
+                res.max, res.stddev);
+        if ( res.bytes )
+            fprintf(out, ", \"bytes_per_op\": %llu, \"mb_per_sec\": %.1f",
+                    (unsigned long long)res.bytes, (double)res.bytes * 1000.0 / res.median);
+        fprintf(out, " }");
+        first = 0;
+
+        fprintf(stderr, "%-40s %12.1f ns/op  (min %.1f, max %.1f, %llu x %d)\n",
+                mb->name, res.median, res.min, res.max,
+                (unsigned long long)res.iterations, samples);
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if ( out != stdout )
+        fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,273 @@
+#!/bin/bash
+#
+# run_bench.sh - squirrel throughput, latency and per thread CPU against
+#                synthetic unified2 spools (see doc/README.bench)
+#
+# For each output, in a scratch directory:
+#   1. u2gen writes a backlog of events (and their packets) into the
+#      spool directories and squirrel is started on them; records/sec is
+#      how fast the outputs drain that backlog, measured from the
+#      squirrel_ring_records_output_total counters, and the CPU each
+#      thread used while doing so comes from /proc/<pid>/task.
+#   2. u2gen then writes events at a fixed rate, stamped with the time
+#      they were written, while squirrel runs; p50/p99 are read from the
+#      squirrel_event_output_lag_seconds histogram over that phase only.
+#
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+
+SQUIRREL=${SQUIRREL:-$BENCH_DIR/../src/squirrel}
+U2GEN=${U2GEN:-$BENCH_DIR/u2gen}
+RINGS=${BENCH_RINGS:-4}
+EVENTS=${BENCH_EVENTS:-100000}
+RATE=${BENCH_RATE:-1000}
+SECONDS_LIVE=${BENCH_SECONDS:-10}
+OUTPUTS=${BENCH_OUTPUTS:-"alert_fast alert_csv log_null database"}
+PORT=${BENCH_PORT:-19117}
+TIMEOUT=${BENCH_TIMEOUT:-600}
+GENARGS=${BENCH_GENARGS:-}
+KEEP=0
+
+usage()
+{
+    cat <<EOF
+USAGE: $0 [-options]
+
+  -s <path>     squirrel binary (default: $SQUIRREL)
+  -g <path>     u2gen binary (default: $U2GEN)
+  -r <num>      spool directories / rings (default: $RINGS)
+  -n <num>      backlog events per ring (default: $EVENTS)
+  -R <rate>     live events per second per ring (default: $RATE)
+  -t <secs>     live phase length (default: $SECONDS_LIVE)
+  -o <list>     outputs to run (default: "$OUTPUTS")
+  -a <args>     extra u2gen options, eg "-6 50 -x 20" (default: none)
+  -p <port>     metrics port (default: $PORT)
+  -k            keep the scratch directories
+
+  The database output needs BENCH_MYSQL set to the connection options
+  of a scratch database loaded with schemas/create_mysql, eg
+  BENCH_MYSQL="user=bench password=bench dbname=bench host=localhost".
+EOF
+    exit 1
+}
+
+while getopts "s:g:r:n:R:t:o:a:p:kh" opt; do
+    case $opt in
+        s) SQUIRREL=$OPTARG ;;
+        g) U2GEN=$OPTARG ;;
+        r) RINGS=$OPTARG ;;
+        n) EVENTS=$OPTARG ;;
+        R) RATE=$OPTARG ;;
+        t) SECONDS_LIVE=$OPTARG ;;
+        o) OUTPUTS=$OPTARG ;;
+        a) GENARGS=$OPTARG ;;
+        p) PORT=$OPTARG ;;
+        k) KEEP=1 ;;
+        *) usage ;;
+    esac
+done
+
+for bin in "$SQUIRREL" "$U2GEN"; do
+    if [ ! -x "$bin" ]; then
+        echo "run_bench: $bin not found, build it first" >&2
+        exit 1
+    fi
+done
+
+CLK_TCK=$(getconf CLK_TCK)
+
+now()
+{
+    date +%s.%N
+}
+
+# metrics over the bash tcp redirection, so no curl is needed
+scrape()
+{
+    exec 3<>/dev/tcp/127.0.0.1/$PORT || return 1
+    printf 'GET /metrics HTTP/1.0\r\n\r\n' >&3
+    cat <&3
+    exec 3<&- 3>&-
+}
+
+records_out()
+{
+    scrape 2>/dev/null | awk '/^squirrel_ring_records_output_total\{/ { n += $2 } END { printf "%d\n", n }'
+}
+
+lag_buckets()
+{
+    scrape 2>/dev/null | awk '/^squirrel_event_output_lag_seconds_bucket\{/ {
+        le = $1; sub(/.*le="/, "", le); sub(/".*/, "", le); print le, $2 }'
+}
+
+# tid comm ticks, comm may not hold spaces once the threads are named
+thread_ticks()
+{
+    local stat
+    for stat in /proc/$1/task/*/stat; do
+        awk '{ c = $0; sub(/^[^(]*\(/, "", c); sub(/\)[^)]*$/, "", c); gsub(/ /, "_", c);
+               n = split($0, f, ") "); split(f[n], g, " ");
+               print $1, c, g[12] + g[13] }' "$stat" 2>/dev/null
+    done
+}
+
+# wait until n records are out; prints the count it reached
+wait_for()
+{
+    local want=$1 deadline=$2 got=0
+    while :; do
+        got=$(records_out)
+        [ -n "$got" ] && [ "$got" -ge "$want" ] && break
+        if [ "$(date +%s)" -ge "$deadline" ] || ! kill -0 $PID 2>/dev/null; then
+            echo "run_bench: only $got of $want records output" >&2
+            break
+        fi
+        sleep 0.1
+    done
+    echo ${got:-0}
+}
+
+# p-th quantile from two cumulative "le count" bucket lists
+quantile()
+{
+    awk -v q=$1 '
+        FILENAME == ARGV[1] { base[$1] = $2; next }
+        { le[n] = $1; cum[n] = $2 - base[$1]; n++ }
+        END {
+            total = cum[n-1]
+            if (total == 0) { print "-"; exit }
+            want = q * total; lo = 0; prev = 0
+            for (i = 0; i < n; i++) {
+                if (cum[i] >= want) {
+                    if (le[i] == "+Inf") { printf ">%.6g\n", lo; exit }
+                    hi = le[i] + 0
+                    frac = cum[i] > prev ? (want - prev) / (cum[i] - prev) : 1
+                    printf "%.6g\n", lo + (hi - lo) * frac
+                    exit
+                }
+                if (le[i] != "+Inf") lo = le[i] + 0
+                prev = cum[i]
+            }
+        }' "$2" "$3"
+}
+
+write_conf()
+{
+    local work=$1 output=$2 i
+    {
+        echo "config logdir: $work/log"
+        echo "config waldo_file: $work/waldo"
+        echo "config sid_file: $work/sid-msg.map"
+        echo "config spoolfilebase: bench.u2"
+        echo "config event_cache_size: 65536"
+        echo "config metrics: 127.0.0.1:$PORT"
+        echo "config log_rate_limit: 0"
+        for ((i = 0; i < RINGS; i++)); do
+            printf "config spooldir: %s/spool%02d tid=%d\n" $work $i $i
+        done
+        case $output in
+            alert_fast) echo "output alert_fast: $work/log/alert.fast" ;;
+            alert_csv)  echo "output alert_csv: $work/log/alert.csv default" ;;
+            log_null)   echo "output log_null" ;;
+            database)   echo "output database: log, mysql, $BENCH_MYSQL" ;;
+        esac
+    } > $work/squirrel.conf
+}
+
+stop_squirrel()
+{
+    local i
+
+    kill -TERM $PID 2>/dev/null
+    for ((i = 0; i < 100; i++)); do
+        kill -0 $PID 2>/dev/null || break
+        sleep 0.1
+    done
+    kill -KILL $PID 2>/dev/null
+    wait $PID 2>/dev/null
+}
+
+run_one()
+{
+    local output=$1 work dirs i gen total live got got0 tl t0 t1 rps p50 p99 deadline
+
+    if [ "$output" = database ] && [ -z "$BENCH_MYSQL" ]; then
+        printf "%-12s skipped, BENCH_MYSQL is not set\n" $output
+        return
+    fi
+
+    work=$(mktemp -d ${TMPDIR:-/tmp}/squirrel-bench.XXXXXX)
+    mkdir -p $work/log
+    dirs=""
+    for ((i = 0; i < RINGS; i++)); do
+        mkdir -p $(printf "%s/spool%02d" $work $i)
+        dirs="$dirs $(printf "%s/spool%02d" $work $i)"
+    done
+
+    gen=$("$U2GEN" -b bench.u2 -n $EVENTS -m $work/sid-msg.map $GENARGS $dirs) || return
+    total=$(echo "$gen" | sed -n 's/.* records \([0-9]*\).*/\1/p')
+
+    write_conf $work $output
+    tl=$(now)
+    "$SQUIRREL" -q -c $work/squirrel.conf > $work/squirrel.out 2>&1 &
+    PID=$!
+
+    # backlog: from the first record out to the last
+    deadline=$(( $(date +%s) + TIMEOUT ))
+    while got0=$(records_out); [ "${got0:-0}" -eq 0 ]; do
+        if [ "$(date +%s)" -ge "$deadline" ] || ! kill -0 $PID 2>/dev/null; then
+            echo "run_bench: $output: no records output, see $work/squirrel.out" >&2
+            stop_squirrel
+            return
+        fi
+        sleep 0.05
+    done
+    t0=$(now)
+    thread_ticks $PID > $work/cpu.0
+
+    got=$(wait_for $total $deadline)
+    t1=$(now)
+    thread_ticks $PID > $work/cpu.1
+    # drained before the first scrape, so count from the start
+    if [ "$got" -le "$got0" ]; then
+        t0=$tl
+        got0=0
+    fi
+    rps=$(echo "$t0 $t1 ${got0:-0} $got" | awk '{ d = $2 - $1; printf "%.0f", (d > 0 ? ($4 - $3) / d : 0) }')
+
+    # live: latency of events written while squirrel keeps up
+    lag_buckets > $work/lag.0
+    live=$("$U2GEN" -b bench.u2 -n $((RATE * SECONDS_LIVE)) -r $RATE $GENARGS $dirs)
+    live=$(echo "$live" | sed -n 's/.* records \([0-9]*\).*/\1/p')
+    wait_for $((total + live)) $(( $(date +%s) + TIMEOUT )) > /dev/null
+    lag_buckets > $work/lag.1
+    p50=$(quantile 0.50 $work/lag.0 $work/lag.1)
+    p99=$(quantile 0.99 $work/lag.0 $work/lag.1)
+
+    stop_squirrel
+
+    printf "%-12s records %-10s records/sec %-10s p50 %-10s p99 %s\n" \
+        $output $got $rps "${p50}s" "${p99}s"
+    echo "$t0 $t1" | awk -v tck=$CLK_TCK '
+        FNR == 1 && NR == 1 { wall = $2 - $1; next }
+        FILENAME ~ /cpu.0$/ { base[$1] = $3; next }
+        { use[$2] += ($3 - base[$1]) / tck }
+        END {
+            for (c in use)
+                printf "    %-16s cpu %7.2fs %6.1f%%\n", c, use[c], (wall > 0 ? 100 * use[c] / wall : 0)
+        }' - $work/cpu.0 $work/cpu.1 | sort
+
+    if [ $KEEP -eq 1 ]; then
+        echo "    kept $work"
+    else
+        rm -rf $work
+    fi
+}
+
+echo "squirrel bench: $RINGS rings, $EVENTS backlog events per ring," \
+     "$RATE/s per ring for ${SECONDS_LIVE}s live${GENARGS:+, u2gen $GENARGS}"
+
+for output in $OUTPUTS; do
+    run_one $output
+done
@@ -0,0 +1,510 @@
+/****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/**
+ * @file   u2gen.c
+ *
+ * @brief  synthetic unified2 spool writer for the benchmarks
+ *
+ * Writes IDS events (IPv4 and IPv6) each followed, as snort does, by the
+ * packets that raised them into one or more spool directories, named
+ * <filebase>.<timestamp> so the spooler picks them up in order.  The mix
+ * comes from a seeded generator, so the same options always produce the
+ * same records; only the event timestamps, which are the wall clock at
+ * the time of writing, differ.  With a rate the records are written as
+ * they are generated, one write(2) per event, so a running squirrel sees
+ * them arrive as it would from snort.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* unified2.h declares the archive helpers, which take the spooler's Waldo */
+typedef struct _Waldo Waldo;
+#include "unified2.h"
+
+#define U2GEN_DIRS_MAX      16
+#define U2GEN_BUF_SIZE      (256*1024)
+#define U2GEN_PAYLOAD_MAX   1400
+#define U2GEN_SID_BASE      1000000
+
+#define ETH_HLEN            14
+#define IP4_HLEN            20
+#define IP6_HLEN            40
+#define TCP_HLEN            20
+#define DLT_ETHERNET        1
+
+typedef struct _U2GenOpts
+{
+    const char *filebase;
+    const char *sidmap;
+    uint64_t events;            /* per directory */
+    uint64_t per_file;
+    double rate;                /* events per second per directory, 0 as fast as possible */
+    unsigned v6_pct;
+    unsigned pkt_pct;
+    unsigned extra_pkt_pct;
+    unsigned sigs;
+    unsigned payload;
+    uint64_t seed;
+} U2GenOpts;
+
+typedef struct _U2GenSpool
+{
+    const char *dir;
+    int fd;
+    uint32_t ext;
+    uint64_t in_file;
+    uint32_t event_id;
+    uint64_t rng;
+    size_t len;
+    uint8_t buf[U2GEN_BUF_SIZE];
+} U2GenSpool;
+
+typedef struct _U2GenStats
+{
+    uint64_t events;
+    uint64_t events6;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t files;
+} U2GenStats;
+
+static void Usage(const char *prog)
+{
+    fprintf(stderr,
+        "USAGE: %s [-options] <spooldir> [<spooldir> ...]\n"
+        "\n"
+        "  -b <base>   spool file base (default: bench.u2)\n"
+        "  -n <num>    events per spool directory (default: 100000)\n"
+        "  -f <num>    events per spool file (default: 50000)\n"
+        "  -r <rate>   events per second per directory, 0 for no limit (default: 0)\n"
+        "  -6 <pct>    percent of events that are IPv6 (default: 20)\n"
+        "  -p <pct>    percent of events followed by their packet (default: 100)\n"
+        "  -x <pct>    percent of those with a second packet (default: 0)\n"
+        "  -S <num>    distinct signatures, sids from %u (default: 1000)\n"
+        "  -l <bytes>  packet payload length (default: 64)\n"
+        "  -s <seed>   seed for the record mix (default: 1)\n"
+        "  -m <file>   also write a sid-msg.map for the signatures\n"
+        "\n", prog, U2GEN_SID_BASE);
+    exit(1);
+}
+
+/* xorshift64*, plenty for picking a mix */
+static uint64_t Rand (uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ULL;
+}
+
+static unsigned RandPct (uint64_t *s)
+{
+    return (unsigned)(Rand(s) % 100);
+}
+
+static double Now (void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+static void Flush (U2GenSpool *sp, U2GenStats *st)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while ( off < sp->len )
+    {
+        if ( (n = write(sp->fd, sp->buf + off, sp->len - off)) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            fprintf(stderr, "u2gen: write to %s: %s\n", sp->dir, strerror(errno));
+            exit(1);
+        }
+        off += n;
+    }
+
+    st->bytes += sp->len;
+    sp->len = 0;
+}
+
+/*-------------------------------------------------------------------
+ * NextExtension: a timestamp extension newer than every spool file
+ * already in the directory, so a second run is read after the first
+ *-------------------------------------------------------------------
+ */
+static uint32_t NextExtension (const char *dir, const char *base)
+{
+    uint32_t ext = (uint32_t)time(NULL);
+    size_t blen = strlen(base);
+    struct dirent *de;
+    unsigned long e;
+    char *end;
+    DIR *d;
+
+    if ( (d = opendir(dir)) == NULL )
+    {
+        fprintf(stderr, "u2gen: unable to open %s: %s\n", dir, strerror(errno));
+        exit(1);
+    }
+
+    while ( (de = readdir(d)) != NULL )
+    {
+        if ( strncmp(de->d_name, base, blen) != 0 || de->d_name[blen] != '.' )
+            continue;
+
+        e = strtoul(de->d_name + blen + 1, &end, 10);
+        if ( *end == '\0' && e >= ext )
+            ext = (uint32_t)e + 1;
+    }
+
+    closedir(d);
+    return ext;
+}
+
+static void OpenSpoolFile (U2GenSpool *sp, const U2GenOpts *o, U2GenStats *st)
+{
+    char path[4096];
+
+    if ( sp->fd >= 0 )
+    {
+        Flush(sp, st);
+        close(sp->fd);
+        sp->ext++;
+    }
+    else
+        sp->ext = NextExtension(sp->dir, o->filebase);
+
+    snprintf(path, sizeof(path), "%s/%s.%u", sp->dir, o->filebase, sp->ext);
+    if ( (sp->fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0 )
+    {
+        fprintf(stderr, "u2gen: unable to create %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    sp->in_file = 0;
+    st->files++;
+}
+
+static uint16_t IpChecksum (const uint8_t *p, int len)
+{
+    uint32_t sum = 0;
+
+    for ( ; len > 1; p += 2, len -= 2 )
+        sum += (p[0] << 8) | p[1];
+    while ( sum >> 16 )
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return htons((uint16_t)~sum);
+}
+
+/*-------------------------------------------------------------------
+ * BuildFrame: ethernet + IPv4/IPv6 + TCP + payload matching the event
+ *-------------------------------------------------------------------
+ */
+static uint32_t BuildFrame (uint8_t *f, const Unified2IDSEventIPv6 *ev6,
+    const Unified2IDSEvent *ev4, unsigned payload)
+{
+    uint8_t *ip = f + ETH_HLEN, *tcp;
+    uint16_t sport, dport;
+    uint32_t i;
+
+    memset(f, 0, ETH_HLEN + IP6_HLEN + TCP_HLEN);
+    memcpy(f, "\x00\x16\x3e\x00\x00\x02\x00\x16\x3e\x00\x00\x01", 12);
+
+    if ( ev6 )
+    {
+        f[12] = 0x86; f[13] = 0xdd;
+        ip[0] = 0x60;
+        *(uint16_t *)(ip + 4) = htons(TCP_HLEN + payload);
+        ip[6] = IPPROTO_TCP;
+        ip[7] = 64;
+        memcpy(ip + 8, &ev6->ip_source, 16);
+        memcpy(ip + 24, &ev6->ip_destination, 16);
+        tcp = ip + IP6_HLEN;
+        sport = ev6->sport_itype;
+        dport = ev6->dport_icode;
+    }
+    else
+    {
+        f[12] = 0x08; f[13] = 0x00;
+        ip[0] = 0x45;
+        *(uint16_t *)(ip + 2) = htons(IP4_HLEN + TCP_HLEN + payload);
+        *(uint16_t *)(ip + 4) = (uint16_t)ev4->event_id;
+        ip[8] = 64;
+        ip[9] = IPPROTO_TCP;
+        memcpy(ip + 12, &ev4->ip_source, 4);
+        memcpy(ip + 16, &ev4->ip_destination, 4);
+        *(uint16_t *)(ip + 10) = IpChecksum(ip, IP4_HLEN);
+        tcp = ip + IP4_HLEN;
+        sport = ev4->sport_itype;
+        dport = ev4->dport_icode;
+    }
+
+    memset(tcp, 0, TCP_HLEN);
+    *(uint16_t *)(tcp + 0) = sport;
+    *(uint16_t *)(tcp + 2) = dport;
+    *(uint32_t *)(tcp + 4) = htonl(0x1000);
+    tcp[12] = (TCP_HLEN / 4) << 4;
+    tcp[13] = 0x18;                             /* PSH ACK */
+    *(uint16_t *)(tcp + 14) = htons(8192);
+
+    for ( i = 0; i < payload; i++ )
+        tcp[TCP_HLEN + i] = (uint8_t)('A' + i % 26);
+
+    return (uint32_t)(tcp + TCP_HLEN + payload - f);
+}
+
+static void *Reserve (U2GenSpool *sp, U2GenStats *st, uint32_t type, uint32_t len)
+{
+    Unified2RecordHeader *hdr;
+
+    if ( sp->len + sizeof(*hdr) + len > sizeof(sp->buf) )
+        Flush(sp, st);
+
+    hdr = (Unified2RecordHeader *)(sp->buf + sp->len);
+    hdr->type = htonl(type);
+    hdr->length = htonl(len);
+    sp->len += sizeof(*hdr) + len;
+
+    return hdr + 1;
+}
+
+static void WritePacket (U2GenSpool *sp, U2GenStats *st, const U2GenOpts *o,
+    uint32_t event_id, uint32_t sec, uint32_t usec,
+    const Unified2IDSEventIPv6 *ev6, const Unified2IDSEvent *ev4)
+{
+    uint8_t frame[ETH_HLEN + IP6_HLEN + TCP_HLEN + U2GEN_PAYLOAD_MAX];
+    uint32_t flen = BuildFrame(frame, ev6, ev4, o->payload);
+    Unified2Packet *pkt;
+
+    pkt = Reserve(sp, st, UNIFIED2_PACKET, sizeof(Unified2Packet) - 4 + flen);
+    pkt->sensor_id = 0;
+    pkt->event_id = htonl(event_id);
+    pkt->event_second = htonl(sec);
+    pkt->packet_second = htonl(sec);
+    pkt->packet_microsecond = htonl(usec);
+    pkt->linktype = htonl(DLT_ETHERNET);
+    pkt->packet_length = htonl(flen);
+    memcpy(pkt->packet_data, frame, flen);
+
+    st->packets++;
+}
+
+/*-------------------------------------------------------------------
+ * WriteEvent: one event and, following it, its packets
+ *-------------------------------------------------------------------
+ */
+static void WriteEvent (U2GenSpool *sp, U2GenStats *st, const U2GenOpts *o, int last)
+{
+    Unified2IDSEventIPv6 *ev6 = NULL;
+    Unified2IDSEvent *ev4 = NULL;
+    uint32_t sid, sec, usec, event_id = ++sp->event_id;
+    uint64_t r = Rand(&sp->rng);
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    sec = (uint32_t)now.tv_sec;
+    usec = (uint32_t)(now.tv_nsec / 1000);
+    sid = U2GEN_SID_BASE + (uint32_t)(r % o->sigs);
+
+    if ( RandPct(&sp->rng) < o->v6_pct )
+    {
+        ev6 = Reserve(sp, st, UNIFIED2_IDS_EVENT_IPV6_VLAN, sizeof(*ev6));
+        memset(ev6, 0, sizeof(*ev6));
+        ev6->sensor_id = 0;
+        ev6->event_id = htonl(event_id);
+        ev6->event_second = htonl(sec);
+        ev6->event_microsecond = htonl(usec);
+        ev6->signature_id = htonl(sid);
+        ev6->generator_id = htonl(1);
+        ev6->signature_revision = htonl(1);
+        ev6->classification_id = htonl(1 + (uint32_t)(r >> 32) % 30);
+        ev6->priority_id = htonl(1 + (uint32_t)(r >> 40) % 3);
+        ev6->ip_source.s6_addr[0] = 0xfd;
+        ev6->ip_source.s6_addr[15] = (uint8_t)(r >> 8);
+        ev6->ip_destination.s6_addr[0] = 0xfd;
+        ev6->ip_destination.s6_addr[15] = (uint8_t)(r >> 16);
+        ev6->sport_itype = htons(1024 + (uint16_t)(r >> 24) % 60000);
+        ev6->dport_icode = htons(80);
+        ev6->protocol = IPPROTO_TCP;
+        st->events6++;
+    }
+    else
+    {
+        ev4 = Reserve(sp, st, UNIFIED2_IDS_EVENT_VLAN, sizeof(*ev4));
+        memset(ev4, 0, sizeof(*ev4));
+        ev4->sensor_id = 0;
+        ev4->event_id = htonl(event_id);
+        ev4->event_second = htonl(sec);
+        ev4->event_microsecond = htonl(usec);
+        ev4->signature_id = htonl(sid);
+        ev4->generator_id = htonl(1);
+        ev4->signature_revision = htonl(1);
+        ev4->classification_id = htonl(1 + (uint32_t)(r >> 32) % 30);
+        ev4->priority_id = htonl(1 + (uint32_t)(r >> 40) % 3);
+        ev4->ip_source = htonl(0x0a000000 | (uint32_t)(r & 0xffff));
+        ev4->ip_destination = htonl(0x0a010000 | (uint32_t)((r >> 16) & 0xffff));
+        ev4->sport_itype = htons(1024 + (uint16_t)(r >> 24) % 60000);
+        ev4->dport_icode = htons(80);
+        ev4->protocol = IPPROTO_TCP;
+    }
+    st->events++;
+
+    /* the spooler holds the newest event back until the next record
+     * shows whether a packet follows, so a spool always ends in one */
+    if ( last || RandPct(&sp->rng) < o->pkt_pct )
+    {
+        WritePacket(sp, st, o, event_id, sec, usec, ev6, ev4);
+        if ( RandPct(&sp->rng) < o->extra_pkt_pct )
+            WritePacket(sp, st, o, event_id, sec, usec, ev6, ev4);
+    }
+}
+
+static void WriteSidMap (const U2GenOpts *o)
+{
+    FILE *fp;
+    unsigned i;
+
+    if ( (fp = fopen(o->sidmap, "w")) == NULL )
+    {
+        fprintf(stderr, "u2gen: unable to create %s: %s\n", o->sidmap, strerror(errno));
+        exit(1);
+    }
+
+    for ( i = 0; i < o->sigs; i++ )
+        fprintf(fp, "%u || BENCH synthetic signature %u || url,example.com/%u\n",
+                U2GEN_SID_BASE + i, i, i);
+
+    fclose(fp);
+}
+
+int main (int argc, char **argv)
+{
+    U2GenOpts o = { "bench.u2", NULL, 100000, 50000, 0, 20, 100, 0, 1000, 64, 1 };
+    U2GenSpool *sp[U2GEN_DIRS_MAX];
+    U2GenStats st;
+    double start, elapsed, ahead;
+    uint64_t i;
+    int ndirs, d, c;
+
+    while ( (c = getopt(argc, argv, "b:n:f:r:6:p:x:S:l:s:m:h")) != -1 )
+    {
+        switch ( c )
+        {
+            case 'b': o.filebase = optarg; break;
+            case 'n': o.events = strtoull(optarg, NULL, 10); break;
+            case 'f': o.per_file = strtoull(optarg, NULL, 10); break;
+            case 'r': o.rate = strtod(optarg, NULL); break;
+            case '6': o.v6_pct = (unsigned)atoi(optarg); break;
+            case 'p': o.pkt_pct = (unsigned)atoi(optarg); break;
+            case 'x': o.extra_pkt_pct = (unsigned)atoi(optarg); break;
+            case 'S': o.sigs = (unsigned)atoi(optarg); break;
+            case 'l': o.payload = (unsigned)atoi(optarg); break;
+            case 's': o.seed = strtoull(optarg, NULL, 10); break;
+            case 'm': o.sidmap = optarg; break;
+            default: Usage(argv[0]);
+        }
+    }
+
+    ndirs = argc - optind;
+    if ( ndirs < 1 || ndirs > U2GEN_DIRS_MAX || o.per_file == 0 || o.sigs == 0
+            || o.payload > U2GEN_PAYLOAD_MAX )
+        Usage(argv[0]);
+
+    if ( o.sidmap )
+        WriteSidMap(&o);
+
+    memset(&st, 0, sizeof(st));
+    for ( d = 0; d < ndirs; d++ )
+    {
+        if ( (sp[d] = calloc(1, sizeof(U2GenSpool))) == NULL )
+        {
+            fprintf(stderr, "u2gen: out of memory\n");
+            return 1;
+        }
+        sp[d]->dir = argv[optind + d];
+        sp[d]->fd = -1;
+        /* a seed of 0 would stick at 0 */
+        sp[d]->rng = (o.seed + 1) * 0x9e3779b97f4a7c15ULL + d;
+        OpenSpoolFile(sp[d], &o, &st);
+    }
+
+    start = Now();
+    for ( i = 0; i < o.events; i++ )
+    {
+        for ( d = 0; d < ndirs; d++ )
+        {
+            if ( sp[d]->in_file == o.per_file )
+                OpenSpoolFile(sp[d], &o, &st);
+
+            WriteEvent(sp[d], &st, &o, i + 1 == o.events);
+            sp[d]->in_file++;
+
+            if ( o.rate > 0 )
+                Flush(sp[d], &st);
+        }
+
+        if ( o.rate > 0 && (ahead = start + (i + 1) / o.rate - Now()) > 0.001 )
+        {
+            struct timespec t;
+
+            t.tv_sec = (time_t)ahead;
+            t.tv_nsec = (long)((ahead - (double)t.tv_sec) * 1e9);
+            nanosleep(&t, NULL);
+        }
+    }
+
+    for ( d = 0; d < ndirs; d++ )
+    {
+        Flush(sp[d], &st);
+        close(sp[d]->fd);
+        free(sp[d]);
+    }
+
+    elapsed = Now() - start;
+    printf("dirs %d files %llu events %llu events_ipv6 %llu packets %llu "
+           "records %llu bytes %llu seconds %.3f\n", ndirs,
+           (unsigned long long)st.files, (unsigned long long)st.events,
+           (unsigned long long)st.events6, (unsigned long long)st.packets,
+           (unsigned long long)(st.events + st.packets),
+           (unsigned long long)st.bytes, elapsed);
+
+    return 0;
+}
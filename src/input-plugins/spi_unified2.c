@@ -499,8 +499,10 @@ int Unified2ReadRecord(void *sph)
             return BARNYARD2_READ_PARTIAL;
         }
 
+        /* sensor ids, the output thread translates them to cids */
         ernCache->type = record_type;
         ernCache->event_id = ntohl(((Unified2CacheCommon*)ernCache->data)->event_id);
+        ernCache->event_second = ntohl(((Unified2CacheCommon*)ernCache->data)->event_second);
 
         switch (record_type) {
         case UNIFIED2_PACKET:   //Packet
@@ -518,37 +520,20 @@ int Unified2ReadRecord(void *sph)
         case UNIFIED2_IDS_EVENT_VLAN:
         case UNIFIED2_IDS_EVENT_IPV6_VLAN:
             {
-    			/* Ready to throw record into ring, if e_id is smaller than expect from Database, move forward. */
-            	if ( RING_PRE_ON == spooler->spara->sring->r_switch ) {	//Let's Roll
-            		if ( (spooler->spara->sring->base_eventid+ernCache->event_id)
-            				<= spooler->spara->sring->rollon_cid ) {
-            			spooler->spara->sring->base_eventid =
-            					spooler->spara->sring->rollon_cid - ernCache->event_id + 1;
-                		LogMessage("%s: promote(rollon) base_eventid to %lu, cur %lu, rollon %lu\n", __func__,
-                				spooler->spara->sring->base_eventid, ernCache->event_id, spooler->spara->sring->rollon_cid);
-            		}
-            		spooler->spara->sring->r_switch = RING_ON;
-            	}
-                else {
-                    /* Check if it's new start of record id, move forward to match [WILD] packet event id */
-                    if ( 1 == ernCache->event_id ) {
-                        spooler->spara->sring->base_eventid += spooler->spara->sring->prev_eventid;
-                        LogMessage("%s: promote base_eventid to %lu\n", __func__, spooler->spara->sring->base_eventid);
-                    }
-                    else if ( ernCache->event_id <= spooler->spara->sring->prev_eventid ) {
-                        spooler->spara->sring->base_eventid +=
-                                (spooler->spara->sring->prev_eventid - ernCache->event_id) + 1;
-                        LogMessage("%s: promote(jump) base_eventid to %lu, prev %lu, cur %lu\n", __func__,
-                                spooler->spara->sring->base_eventid, spooler->spara->sring->prev_eventid, ernCache->event_id);
-                    }
-                }
-            	/* Save previous event id */
-                spooler->spara->sring->prev_eventid = ernCache->event_id;
-
                 record_valid = 1;
             }
             break;
         case UNIFIED2_EXTRA_DATA:
+            {
+                /* joins its event's group, keyed past the extra data header */
+                Unified2ExtraData *xd = (Unified2ExtraData *)(ernCache->data + sizeof(Unified2ExtraDataHdr));
+
+                if ( record_length >= sizeof(Unified2ExtraDataHdr) + sizeof(Unified2ExtraData) ) {
+                    ernCache->event_id = ntohl(xd->event_id);
+                    ernCache->event_second = ntohl(xd->event_second);
+                    record_valid = 1;
+                }
+            }
             break;
         default:
             break;
@@ -558,10 +543,8 @@ int Unified2ReadRecord(void *sph)
             ernCache->type = UNIFIED2_INVALID_REC;
         }
 
-        ernCache->event_id += spooler->spara->sring->base_eventid;
-        DEBUG_U_WRAP_DEEP(LogMessage("%s: Proceed with evnet_id=%u, ms_cid[%d] %u, prev_eid %u\n", __func__,
-                ernCache->event_id, spooler->spara->rid,
-                spooler->spara->sring->base_eventid, spooler->spara->sring->prev_eventid));
+        DEBUG_U_WRAP_DEEP(LogMessage("%s: Proceed with event_id=%lu, second %u, rid %d\n", __func__,
+                ernCache->event_id, ernCache->event_second, spooler->spara->rid));
 
 #endif
 
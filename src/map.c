@@ -45,7 +45,15 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #ifdef SOLARIS
     #include <strings.h>
 #endif
@@ -58,11 +66,263 @@
 
 #include "squirrel.h"
 #include "parser.h"
+#include "jhash.h"
 
 #include <string.h>
 #include <stdlib.h>
 
 
+/***************************** Map Arena **************************************/
+
+#define MAP_ARENA_CHUNK     (64 * 1024)
+#define MAP_ARENA_STR_MIN   1024
+#define MAP_ARENA_SIG_MIN   1024
+
+static MapArena *MapArenaGet(Barnyard2Config *bc)
+{
+    if (bc->map_arena == NULL)
+        bc->map_arena = (MapArena *)SnortAlloc(sizeof(MapArena));
+
+    return bc->map_arena;
+}
+
+/* zeroed, as SnortAlloc() */
+static void *MapArenaAllocAlign(MapArena *a, size_t len, size_t align)
+{
+    MapArenaChunk *c = a->chunk;
+    size_t off = 0;
+
+    if (c != NULL)
+        off = (c->used + align - 1) & ~(align - 1);
+
+    if ((c == NULL) || (off + len > c->size))
+    {
+        c = (MapArenaChunk *)SnortAlloc(sizeof(MapArenaChunk) +
+                                        (len > MAP_ARENA_CHUNK ? len : MAP_ARENA_CHUNK));
+        c->size = (len > MAP_ARENA_CHUNK ? len : MAP_ARENA_CHUNK);
+        a->bytes += c->size;
+
+        /* an oversized one goes behind the chunk being filled */
+        if ((len > MAP_ARENA_CHUNK) && (a->chunk != NULL))
+        {
+            c->next = a->chunk->next;
+            a->chunk->next = c;
+        }
+        else
+        {
+            c->next = a->chunk;
+            a->chunk = c;
+        }
+        off = 0;
+    }
+
+    c->used = off + len;
+    return c->data + off;
+}
+
+static void *MapArenaAlloc(MapArena *a, size_t len)
+{
+    return MapArenaAllocAlign(a, len, sizeof(void *));
+}
+
+static char *MapArenaStrndup(MapArena *a, const char *str, size_t len)
+{
+    char *p = (char *)MapArenaAllocAlign(a, len + 1, 1);
+
+    memcpy(p, str, len);
+    return p;
+}
+
+static char *MapArenaStrdup(MapArena *a, const char *str)
+{
+    return MapArenaStrndup(a, str, strlen(str));
+}
+
+/*
+ * MapArenaIntern: one copy of each distinct string per arena, str need
+ * not be terminated
+ */
+static char *MapArenaInternLen(MapArena *a, const char *str, size_t len)
+{
+    char **old, *p;
+    uint32_t size, i, j;
+
+    if ((a->str_count + 1) * 2 > a->str_mask + 1 || a->str == NULL)
+    {
+        old = a->str;
+        size = a->str ? (a->str_mask + 1) : 0;
+
+        a->str_mask = (size ? size * 2 : MAP_ARENA_STR_MIN) - 1;
+        a->str = (char **)SnortAlloc((a->str_mask + 1) * sizeof(char *));
+
+        for (j = 0; j < size; j++)
+        {
+            if (old[j] == NULL)
+                continue;
+
+            i = jhash(old[j], strlen(old[j]), 0) & a->str_mask;
+            while (a->str[i] != NULL)
+                i = (i + 1) & a->str_mask;
+            a->str[i] = old[j];
+        }
+
+        if (old)
+            free(old);
+    }
+
+    i = jhash(str, len, 0) & a->str_mask;
+    while ((p = a->str[i]) != NULL)
+    {
+        if ((strncmp(p, str, len) == 0) && (p[len] == '\0'))
+            return p;
+        i = (i + 1) & a->str_mask;
+    }
+
+    a->str[i] = p = MapArenaStrndup(a, str, len);
+    a->str_count++;
+    return p;
+}
+
+static char *MapArenaIntern(MapArena *a, const char *str)
+{
+    return MapArenaInternLen(a, str, strlen(str));
+}
+
+/* move the chunks of src into dst, the strings and nodes stay where they are */
+static void MapArenaAbsorb(MapArena *dst, MapArena **srcp)
+{
+    MapArena *src = *srcp;
+    MapArenaChunk *c;
+
+    if (src == NULL)
+        return;
+
+    if ((c = src->chunk) != NULL)
+    {
+        while (c->next != NULL)
+            c = c->next;
+
+        /* behind the chunk dst is filling */
+        if (dst->chunk != NULL)
+        {
+            c->next = dst->chunk->next;
+            dst->chunk->next = src->chunk;
+        }
+        else
+            dst->chunk = src->chunk;
+
+        dst->bytes += src->bytes;
+        src->chunk = NULL;
+    }
+
+    MapArenaFree(srcp);
+}
+
+/* append index i to its gid/sid chain, so chains stay in list order */
+static void MapArenaSigChain(MapArena *a, uint32_t i)
+{
+    uint32_t *np;
+
+    np = &a->sig_bucket[jhash_2words(a->sig[i]->generator, a->sig[i]->id, 0) & a->sig_mask];
+    while (*np != 0)
+        np = &a->sig_next[*np - 1];
+
+    a->sig_next[i] = 0;
+    *np = i + 1;
+}
+
+static void MapArenaSigAdd(MapArena *a, SigNode *sn)
+{
+    uint32_t i;
+
+    if (a->sig_count == a->sig_size)
+    {
+        a->sig_size = a->sig_size ? a->sig_size * 2 : MAP_ARENA_SIG_MIN;
+
+        if (((a->sig = (SigNode **)realloc(a->sig, a->sig_size * sizeof(SigNode *))) == NULL) ||
+            ((a->sig_next = (uint32_t *)realloc(a->sig_next, a->sig_size * sizeof(uint32_t))) == NULL))
+        {
+            FatalError("[%s()], unable to grow the signature index to [%u]\n",
+                       __FUNCTION__, a->sig_size);
+        }
+
+        /* one bucket per node at most */
+        if (a->sig_bucket)
+            free(a->sig_bucket);
+        a->sig_mask = a->sig_size - 1;
+        a->sig_bucket = (uint32_t *)SnortAlloc(a->sig_size * sizeof(uint32_t));
+
+        for (i = 0; i < a->sig_count; i++)
+            MapArenaSigChain(a, i);
+    }
+
+    i = a->sig_count++;
+    a->sig[i] = sn;
+    MapArenaSigChain(a, i);
+}
+
+/*
+ * MapArenaSigFind: first node in list order with this gid/sid, from
+ * source_file (0 for any) and, with match_rev, this revision
+ */
+static SigNode *MapArenaSigFind(MapArena *a, uint32_t gid, uint32_t sid, uint32_t rev,
+                                u_int8_t source_file, int match_rev)
+{
+    SigNode *sn;
+    uint32_t n;
+
+    if ((a == NULL) || (a->sig_count == 0))
+        return NULL;
+
+    for (n = a->sig_bucket[jhash_2words(gid, sid, 0) & a->sig_mask]; n != 0; n = a->sig_next[n - 1])
+    {
+        sn = a->sig[n - 1];
+
+        if ((sn->generator != gid) || (sn->id != sid))
+            continue;
+
+        if ((source_file != 0) && (sn->source_file != source_file))
+            continue;
+
+        if (match_rev && (sn->rev != rev))
+            continue;
+
+        return sn;
+    }
+
+    return NULL;
+}
+
+void MapArenaFree(MapArena **ap)
+{
+    MapArena *a = *ap;
+    MapArenaChunk *c, *next;
+
+    if (a == NULL)
+        return;
+
+    for (c = a->chunk; c != NULL; c = next)
+    {
+        next = c->next;
+        free(c);
+    }
+
+    if (a->str)
+        free(a->str);
+    if (a->sig)
+        free(a->sig);
+    if (a->sig_next)
+        free(a->sig_next);
+    if (a->sig_bucket)
+        free(a->sig_bucket);
+
+    free(a);
+    *ap = NULL;
+}
+
+/************************** End of Map Arena **********************************/
+
+
 /********************* Reference Implementation *******************************/
 
 ReferenceNode * AddReference(Barnyard2Config *bc, ReferenceNode **head, char *system, char *id)
@@ -75,15 +335,15 @@ ReferenceNode * AddReference(Barnyard2Config *bc, ReferenceNode **head, char *sy
         return NULL;
     }
 
-    /* create the new node */
-    node = (ReferenceNode *)SnortAlloc(sizeof(ReferenceNode));
+    /* create the new node, with the signatures in the map arena */
+    node = (ReferenceNode *)MapArenaAlloc(MapArenaGet(bc), sizeof(ReferenceNode));
     
     /* lookup the reference system */
     node->system = ReferenceSystemLookup(bc->references, system);
     if (node->system == NULL)
         node->system = ReferenceSystemAdd(&bc->references, system, NULL);
 
-    node->id = SnortStrdup(id);
+    node->id = MapArenaIntern(bc->map_arena, id);
     
     /* Add the node to the front of the list */
     node->next = *head;
@@ -117,35 +377,57 @@ void FPrintReference(FILE *fp, ReferenceNode *ref_node)
     }
 }
 
-void ParseReference(Barnyard2Config *bc, char *args, SigNode *sn)
+static ReferenceSystemNode *MapReferenceSystemFind(ReferenceSystemNode *head, const char *name, size_t len)
 {
-    char **toks, *system, *id;
-    int num_toks;
+    for (; head != NULL; head = head->next)
+    {
+        if ((strncasecmp(head->name, name, len) == 0) && (head->name[len] == '\0'))
+            break;
+    }
+
+    return head;
+}
+
+/*
+ * MapReferenceSpan: a "system,id" reference from the view args, which
+ * is not written to.  The node and its id come from the map arena.
+ */
+static void MapReferenceSpan(Barnyard2Config *bc, char *args, size_t len, SigNode *sn)
+{
+    MSpan toks[2];
+    ReferenceNode *node;
+    ReferenceSystemNode *system;
+    char *name;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_MAPS_DEEP, "map: parsing reference %.*s\n", (int)len, args););
 
-    DEBUG_WRAP(DebugMessage(DEBUG_MAPS_DEEP, "map: parsing reference %s\n", args););
-    
     /* 2 tokens: system, id */
-    toks = mSplit(args, ",", 2, &num_toks, 0);
-    if(num_toks != 2)
+    if(mSplitSpan(args, len, ",", 2, toks, 2, 0, 0) != 2)
     {
-        LogMessage("WARNING: invalid Reference spec '%s'. Ignored\n", args);
+        LogMessage("WARNING: invalid Reference spec '%.*s'. Ignored\n", (int)len, args);
+        return;
     }
-    else
-    {
-        system = toks[0];
-        while ( isspace((int) *system) )
-            system++;
 
-        id = toks[1];
-        while ( isspace((int) *id) )
-            id++;
-            
-        sn->refs = AddReference(bc, &sn->refs, system, id);
+    node = (ReferenceNode *)MapArenaAlloc(MapArenaGet(bc), sizeof(ReferenceNode));
+
+    if((system = MapReferenceSystemFind(bc->references, toks[0].ptr, toks[0].len)) == NULL)
+    {
+        name = SnortStrndup(toks[0].ptr, toks[0].len);
+        system = ReferenceSystemAdd(&bc->references, name, NULL);
+        free(name);
     }
 
-    mSplitFree(&toks, num_toks);
+    node->system = system;
+    node->id = MapArenaInternLen(bc->map_arena, toks[1].ptr, toks[1].len);
 
-    return;
+    /* Add the node to the front of the list */
+    node->next = sn->refs;
+    sn->refs = node;
+}
+
+void ParseReference(Barnyard2Config *bc, char *args, SigNode *sn)
+{
+    MapReferenceSpan(bc, args, strlen(args), sn);
 }
 
 
@@ -217,25 +499,19 @@ void DeleteReferenceSystems(Barnyard2Config *bc)
 
 void ParseReferenceSystemConfig(Barnyard2Config *bc, char *args)
 {
-    char **toks;
-    char *name = NULL;
+    MSpan toks[2];
     char *url = NULL;
     int num_toks;
 
     /* 2 tokens: name <url> */
-    toks = mSplit(args, " ", 2, &num_toks, 0);
-    name = toks[0];
+    num_toks = mSplitSpan(args, strlen(args), " ", 2, toks, 2, 0, MSPLIT_TERMINATE);
+    if(num_toks < 1)
+        return;
+
     if(num_toks == 2)
-    {
-        url = toks[1];
-        while(isspace((int)*url))
-            url++;
-        if(url[0] == '\0')
-            url = NULL;
-    }
-    ReferenceSystemAdd(&bc->references, name, url);
+        url = toks[1].ptr;
 
-    mSplitFree(&toks, num_toks);
+    ReferenceSystemAdd(&bc->references, toks[0].ptr, url);
     return;
 }
 
@@ -244,7 +520,7 @@ int ReadReferenceFile(Barnyard2Config *bc, const char *file)
     FILE        *fd;
     char        buf[BUFFER_SIZE];
     char        *index;
-    char        **toks;
+    MSpan       toks[2];
     int         num_toks;
   int         count = 0;
 
@@ -271,15 +547,13 @@ int ReadReferenceFile(Barnyard2Config *bc, const char *file)
         /* if it's not a comment or a <CR>, send it to the parser */
         if ( (*index != '#') && (*index != 0x0a) && (index != NULL) )
         {
-            toks = mSplit(index, ":", 2, &num_toks, 0);
+            num_toks = mSplitSpan(index, strlen(index), ":", 2, toks, 2, 0, MSPLIT_TERMINATE);
             
             if(num_toks > 1)
             {
-                ParseReferenceSystemConfig(bc, toks[1]);
+                ParseReferenceSystemConfig(bc, toks[1].ptr);
 		count++;
             }
-
-            mSplitFree(&toks, num_toks);
         }
     }
 
@@ -346,10 +620,20 @@ ClassType * ClassTypeLookupByTypePure(ClassType *node, char *type)
 ClassType * ClassTypeLookupById(Barnyard2Config *bc, int id)
 {
     ClassType *node;
+    MapSnapshot *m;
 
     if (bc == NULL)
         FatalError("Barnyard2 config is NULL.\n");
 
+    /* the running maps, once published */
+    if ((bc == barnyard2_conf) && ((m = MapSnapshotCurrent()) != NULL))
+    {
+        if ((id < 0) || ((uint32_t)id > m->class_max))
+            return NULL;
+
+        return m->class_by_id[id];
+    }
+
     node = bc->classifications;
 
     while (node != NULL)
@@ -390,12 +674,12 @@ int AddClassificationConfig(Barnyard2Config *bc, ClassType *newNode)
 
 void ParseClassificationConfig(Barnyard2Config *bc, char *args)
 {
-    char **toks;
+    MSpan toks[3];
     int num_toks;
-    char *data;
     ClassType *newNode;
 
-    toks = mSplit(args, ",", 3, &num_toks, '\\');
+    /* views, args is left as it is for the error */
+    num_toks = mSplitSpan(args, strlen(args), ",", 3, toks, 3, '\\', 0);
 
     if(num_toks != 3)
     {
@@ -406,21 +690,11 @@ void ParseClassificationConfig(Barnyard2Config *bc, char *args)
         /* create the new node */
         newNode = (ClassType *)SnortAlloc(sizeof(ClassType));
 
-        data = toks[0];
-        while(isspace((int)*data)) 
-            data++;
-        newNode->type = SnortStrdup(data);   /* XXX: oom check */
+        newNode->type = mSpanDup(&toks[0], ",", '\\');
+        newNode->name = mSpanDup(&toks[1], ",", '\\');
 
-        data = toks[1];
-        while(isspace((int)*data))
-            data++;
-        newNode->name = SnortStrdup(data);   /* XXX: oom check */
-
-        data = toks[2];
-        while(isspace((int)*data))
-            data++;
         /* XXX: error checking needed */
-        newNode->priority = atoi(data); /* XXX: oom check */
+        newNode->priority = atoi(toks[2].ptr);
 
         if(AddClassificationConfig(bc, newNode) == -1)
         {
@@ -438,7 +712,6 @@ void ParseClassificationConfig(Barnyard2Config *bc, char *args)
         }
     }
 
-    mSplitFree(&toks, num_toks);
     return;
 }
 
@@ -466,7 +739,7 @@ int ReadClassificationFile(Barnyard2Config *bc)
     FILE        *fd;
     char        buf[BUFFER_SIZE];
     char        *index;
-    char        **toks;
+    MSpan       toks[2];
     int         num_toks;
     int         count = 0;
     
@@ -500,15 +773,13 @@ int ReadClassificationFile(Barnyard2Config *bc)
         /* if it's not a comment or a <CR>, send it to the parser */
         if ( (*index != '#') && (*index != 0x0a) && (index != NULL) )
         {
-            toks = mSplit(index, ":", 2, &num_toks, 0);
+            num_toks = mSplitSpan(index, strlen(index), ":", 2, toks, 2, 0, MSPLIT_TERMINATE);
             
             if(num_toks > 1)
             {
-                ParseClassificationConfig(bc, toks[1]);
+                ParseClassificationConfig(bc, toks[1].ptr);
 		count++;
             }
-
-            mSplitFree(&toks, num_toks);
         }
     }
 
@@ -523,6 +794,8 @@ int ReadClassificationFile(Barnyard2Config *bc)
 
 /************************* Sid/Gid Map Implementation *************************/
 
+static SigNode *MapSigRuntime(uint32_t, uint32_t, uint32_t);
+
 
 
 /*
@@ -632,11 +905,8 @@ int SignatureResolveClassification(ClassType *class,SigNode *sig,char *sid_msg_f
 	    }
 	}
     	
-	if(sig->classLiteral)
-	{
-	    free(sig->classLiteral);
-	    sig->classLiteral = NULL;
-	}
+	/* interned in the map arena, freed with it */
+	sig->classLiteral = NULL;
 	
 	sig = sig->next;
     }
@@ -676,6 +946,8 @@ u_int32_t SigLookup(SigNode *head,u_int32_t gid,u_int32_t sid,u_int8_t source_fi
 
 
 
+static int MapSidLoadMapped(Barnyard2Config *);
+
 int ReadSidFile(Barnyard2Config *bc)
 {
     FILE *fd;
@@ -697,6 +969,11 @@ int ReadSidFile(Barnyard2Config *bc)
 			    __FUNCTION__,
 			    bc->sid_msg_file););   
 
+    if(MapSidLoadMapped(bc) == 0)
+    {
+	return 0;
+    }
+
     if( (fd = fopen(bc->sid_msg_file, "r")) == NULL )
     {
         LogMessage("ERROR: Unable to open SID file '%s' (%s)\n", 
@@ -757,296 +1034,588 @@ int ReadSidFile(Barnyard2Config *bc)
 
 
 
-void ParseSidMapLine(Barnyard2Config *bc, char *data)
+/*
+ * Map lines are split with mSplitSpecialSpan(): a field is a view into
+ * the line and only what is kept is copied, into the map arena.  The
+ * loaders over an mmap of the file rely on that, they never write to it.
+ */
+
+/* strip() and the leading blanks, and strtrim() with trim, as the fields were cleaned */
+static void MapSpanClean(MSpan *f, int trim)
 {
+    size_t i;
 
-    SigNode *sn = NULL;
-    SigNode t_sn = {0}; 
+    while (trim && (f->len > 0) && isspace((int)f->ptr[f->len - 1]))
+        f->len--;
 
-    char **toks = NULL;
-    char *idx = NULL;
-    
-    int num_toks = 0;
-    int min_toks = 0;
-    int i = 0;
-    
-    toks = mSplitSpecial(data, "||", 32, &num_toks, '\0');
-    
-    switch(bc->sidmap_version)
+    for (i = 0; i < f->len; i++)
     {
-    case SIDMAPV1:
-	min_toks = 2;
-	break;
-
-    case SIDMAPV2:
-	min_toks = 6;
-	break;
-	
-    default:
-	FatalError("[%s()]: Unknown sidmap file version [%d] \n",
-		   __FUNCTION__,
-		   bc->sidmap_version);
+        if ((f->ptr[i] == '\n') || (f->ptr[i] == '\r'))
+        {
+            f->len = i;
+            break;
+        }
     }
-    
-    if(num_toks < min_toks)
+
+    while ((f->len > 0) && ((*f->ptr == ' ') || (*f->ptr == '\t')))
     {
-        LogMessage("WARNING: Ignoring bad line in SID file: '%s'\n", data);
+        f->ptr++;
+        f->len--;
     }
-    else
-    {
-        DEBUG_WRAP(DebugMessage(DEBUG_MAPS_DEEP, "map: creating new node\n"););
+}
 
-	
-        for(i = 0; i<num_toks; i++)
-        { 
-            strtrim(toks[i]);
-            strip(toks[i]);
-            idx = toks[i];
-            while(*idx == ' ') idx++;
-
-	    if( (idx == NULL) ||
-		(strlen(idx) == 0))
-	    {
-		LogMessage("\n");
-		FatalError("[%s()], File [%s],\nError in map definition [%s] for value [%s] \n\n",
-			   __FUNCTION__,
-			   bc->sid_msg_file,
-			   data,
-			   idx);
-	    }
+/* strtoul(, NULL, 10) on a view */
+static uint32_t MapSpanToU32(const MSpan *f)
+{
+    const char *p = f->ptr, *end = f->ptr + f->len;
+    unsigned long v = 0;
+    int neg = 0;
 
-	    switch(bc->sidmap_version)
-	    {
-	    case SIDMAPV1:
-	        switch(i)
-	        {
-	        case 0: /* sid */
-	            t_sn.generator = 1;
-	            if( (t_sn.id = strtoul(idx, NULL, 10)) == ULONG_MAX) {
-	                FatalError("[%s()], error converting integer [%s] for line [%s] \n",
-	                        __FUNCTION__,
-	                        strerror(errno),
-	                        data);
-	            }
-	            break;
-	        case 1: /* rev */
-	            if( (t_sn.rev = strtoul(idx, NULL, 10)) == ULONG_MAX) {
-	                FatalError("[%s()], error converting integer [%s] for line [%s] \n",
-	                        __FUNCTION__,
-	                        strerror(errno),
-	                        data);
-	            }
-	            break;
-	        case 2: /* msg */
-	            if( (t_sn.msg = SnortStrdup(idx)) == NULL) {
-	                FatalError("[%s()], error converting string for line [%s] \n",
-	                        __FUNCTION__,
-	                        data);
-	            }
-	            break;
-	        default: /* reference data */
-	            ParseReference(bc, idx, &t_sn);
-	            break;
-	        }
-	        break;
-	    case SIDMAPV2:
-
-		switch(i)
-		{
+    while ((p < end) && isspace((int)*p))
+        p++;
 
-		case 0: /*gid */
-		    if( (t_sn.generator = strtoul(idx,NULL,10)) == ULONG_MAX)
-		    {
-                        FatalError("[%s()], error converting integer [%s] for line [%s] \n",
-                                   __FUNCTION__,
-                                   strerror(errno),
-                                   data);
-                    }
+    if ((p < end) && ((*p == '+') || (*p == '-')))
+        neg = (*p++ == '-');
 
-		    break;
+    while ((p < end) && isdigit((int)*p))
+        v = v * 10 + (unsigned long)(*p++ - '0');
 
-		case 1: /* sid */
-		    if( (t_sn.id = strtoul(idx, NULL, 10)) == ULONG_MAX)
-		    {
-                        FatalError("[%s()], error converting integer [%s] for line [%s] \n",
-                                   __FUNCTION__,
-                                   strerror(errno),
-                                   data);
-                    }
-		    break;
-
-		case 2: /* revision */
-		    if( (t_sn.rev = strtoul(idx, NULL, 10)) == ULONG_MAX)
-		    {
-                        FatalError("[%s()], error converting integer [%s] for line [%s] \n",
-                                   __FUNCTION__,
-                                   strerror(errno),
-                                   data);
-                    }
-		    break;
-		    
-		case 3: /* classification */
-		    if( (t_sn.classLiteral = SnortStrdup(idx)) == NULL)
-		    {
-			FatalError("[%s()], error converting string for line [%s] \n",
-				   __FUNCTION__,
-				   data);
-		    }
-		    break;
-
-		case 4: /* priority */
-		    
-		    if( (t_sn.priority = strtoul(idx, NULL, 10)) == ULONG_MAX)
-		    {
-                        FatalError("[%s()], error converting integer [%s] for line [%s] \n",
-                                   __FUNCTION__,
-                                   strerror(errno),
-                                   data);
-                    }
-		    break;
-
-		case 5: /* msg */
-		    if( (t_sn.msg = SnortStrdup(idx)) == NULL)
-		    {
-			FatalError("[%s()], error converting string for line [%s] \n",
-				   __FUNCTION__,
-				   data);
-		    }
-		    break;
-		    
-		default: /* reference data */
-		    ParseReference(bc, idx, &t_sn);
-		    break;
-		}
-		break;
-	    }
-	}
-    }
-    
-    sn = (SigNode *)*BcGetSigNodeHead();
-    
-    /* Look if we have a brother inserted from sid map file */
-    sig_lookup_continue:
-    if(SigLookup(sn,t_sn.generator,t_sn.id,SOURCE_SID_MSG,&sn))
-    {
-	if(t_sn.rev == sn->rev)
-	{
-	    DEBUG_WRAP(DebugMessage(DEBUG_MAPS,
-				    "[%s()],Item not inserted [ gid:[%d] sid:[%d] rev:[%d] msg:[%s] class:[%d] prio:[%d] ] in signature list \n"
- 				    "\t Item already present  [ gid:[%d] sid:[%d] rev:[%d] msg:[%s] class:[%d] prio:[%d] ] \n",
-				    __FUNCTION__,
-				    t_sn.generator,t_sn.id,t_sn.rev,t_sn.msg,t_sn.class_id,t_sn.priority, /* revision,class_id and priority are hardcoded for generator */
-				    sn->generator,sn->id,sn->rev,sn->msg,sn->class_id,sn->priority););
-	}
-	else
-	{
-	    /* Continue to traverse the list to be sure */
-	    sn = sn->next;
-	    goto sig_lookup_continue;
-	}
-    }
-    else
-    {
-        if( (sn = CreateSigNode(BcGetSigNodeHead(),SOURCE_SID_MSG)) == NULL)
-        {
-            FatalError("[%s()], CreateSigNode() returned a NULL node, bailing \n",
-                       __FUNCTION__);
-        }
+    return (uint32_t)(neg ? -v : v);
+}
 
-        memcpy(sn,&t_sn,sizeof(SigNode));
+/* a message, tabs become spaces as strip() did */
+static char *MapSpanMessage(MapArena *a, const MSpan *f)
+{
+    char *msg = MapArenaStrndup(a, f->ptr, f->len), *p;
 
-	sn->source_file = SOURCE_SID_MSG;
+    for (p = msg; *p; p++)
+    {
+        if (*p == '\t')
+            *p = ' ';
     }
 
-    mSplitFree(&toks, num_toks);
-    
-    return;
+    return msg;
 }
 
-SigNode *GetSigByGidSid(u_int32_t gid, u_int32_t sid,u_int32_t revision)
+/*
+ * MapSidLineParse: one sid-msg.map line into t_sn, with its strings and
+ * references from the arena of bc.  1 when a field is empty.
+ */
+static int MapSidLineParse(Barnyard2Config *bc, const char *data, size_t len, SigNode *t_sn)
 {
-    /* set temp node pointer to the Sid map list head */
-    SigNode **sh = BcGetSigNodeHead();
-    SigNode *sn = *sh;
-    
-    switch(BcSidMapVersion())
-    {
-    case SIDMAPV1:
-	/* The comment below is not true anymore with  sidmapv2 files generated by pulled pork */
-	
-	/* a snort general rule (gid=1) and a snort dynamic rule (gid=3) use the  */
-	/* the same sids and thus can be considered one in the same. */
-	if (gid == 3)
-	{
-	    gid = 1;
-	}
-	
-	/* find any existing Snort ID's that match */
-	while (sn != NULL)
-	{
-	    if (sn->generator == gid && sn->id == sid)
-	    {
-		return sn;
-	    }
-	    
-	    sn = sn->next;
-	}
-	break;
-	
-    case SIDMAPV2:
-	while (sn != NULL)
-        {
-            if ( (sn->generator == gid) && 
-		 (sn->id == sid) &&
-		 (sn->rev == revision))
-            {
-                return sn;
-            }
-	    
-            sn = sn->next;
-        }
-	break;
-    }
-    
-    /* create a default message since we didn't find any match */
-    sn = CreateSigNode(BcGetSigNodeHead(),SOURCE_GEN_RUNTIME);
-    sn->generator = gid;
-    sn->id = sid;
-    sn->rev = revision;
-    sn->msg = (char *)SnortAlloc(42);
-    snprintf(sn->msg, 42, "Snort Alert [%u:%u:%u]", gid, sid, revision);
- 
-    return sn;
-}
+    MapArena *a = MapArenaGet(bc);
+    MSpan toks[32];
+    int num_toks, min_toks, i;
 
+    memset(t_sn, 0, sizeof(SigNode));
 
+    num_toks = mSplitSpecialSpan(data, len, "||", 32, toks);
+    min_toks = (bc->sidmap_version == SIDMAPV2) ? 6 : 2;
 
-SigNode *CreateSigNode(SigNode **head,const u_int8_t source_file)
-{
-    SigNode       *sn = NULL;
-    
-    if (*head == NULL)
+    if(num_toks < min_toks)
     {
-        *head = (SigNode *) SnortAlloc(sizeof(SigNode));
-	sn = *head;
-	sn->source_file = source_file;
-        return *head;
+        LogMessage("WARNING: Ignoring bad line in SID file: '%.*s'\n", (int)len, data);
+        return 0;
     }
-    else
+
+    DEBUG_WRAP(DebugMessage(DEBUG_MAPS_DEEP, "map: creating new node\n"););
+
+    for(i = 0; i < num_toks; i++)
     {
-        sn = *head;
-	
-        while (sn->next != NULL) 
-	    sn = sn->next;
-	
-        sn->next = (SigNode *) SnortAlloc(sizeof(SigNode));
-	sn->next->source_file = source_file;
-        return sn->next;
-    }
-    
-    /* XXX */
-    return NULL;
-}
+        MapSpanClean(&toks[i], 1);
+
+        if(toks[i].len == 0)
+        {
+            return 1;
+        }
+
+        switch(bc->sidmap_version)
+        {
+        case SIDMAPV1:
+            switch(i)
+            {
+            case 0: /* sid */
+                t_sn->generator = 1;
+                t_sn->id = MapSpanToU32(&toks[i]);
+                break;
+            case 1: /* rev */
+                t_sn->rev = MapSpanToU32(&toks[i]);
+                break;
+            case 2: /* msg */
+                t_sn->msg = MapSpanMessage(a, &toks[i]);
+                break;
+            default: /* reference data */
+                MapReferenceSpan(bc, toks[i].ptr, toks[i].len, t_sn);
+                break;
+            }
+            break;
+
+        case SIDMAPV2:
+            switch(i)
+            {
+            case 0: /*gid */
+                t_sn->generator = MapSpanToU32(&toks[i]);
+                break;
+            case 1: /* sid */
+                t_sn->id = MapSpanToU32(&toks[i]);
+                break;
+            case 2: /* revision */
+                t_sn->rev = MapSpanToU32(&toks[i]);
+                break;
+            case 3: /* classification */
+                t_sn->classLiteral = MapArenaInternLen(a, toks[i].ptr, toks[i].len);
+                break;
+            case 4: /* priority */
+                t_sn->priority = MapSpanToU32(&toks[i]);
+                break;
+            case 5: /* msg */
+                t_sn->msg = MapSpanMessage(a, &toks[i]);
+                break;
+            default: /* reference data */
+                MapReferenceSpan(bc, toks[i].ptr, toks[i].len, t_sn);
+                break;
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/* Look if we have a brother inserted from sid map file */
+static SigNode *MapSidBrother(MapArena *a, SigNode *t_sn)
+{
+    SigNode *sn;
+
+    if( (sn = MapArenaSigFind(a,t_sn->generator,t_sn->id,t_sn->rev,SOURCE_SID_MSG,1)) != NULL)
+    {
+	DEBUG_WRAP(DebugMessage(DEBUG_MAPS,
+				"[%s()],Item not inserted [ gid:[%d] sid:[%d] rev:[%d] msg:[%s] class:[%d] prio:[%d] ] in signature list \n"
+				"\t Item already present  [ gid:[%d] sid:[%d] rev:[%d] msg:[%s] class:[%d] prio:[%d] ] \n",
+				__FUNCTION__,
+				t_sn->generator,t_sn->id,t_sn->rev,t_sn->msg,t_sn->class_id,t_sn->priority, /* revision,class_id and priority are hardcoded for generator */
+				sn->generator,sn->id,sn->rev,sn->msg,sn->class_id,sn->priority););
+    }
+
+    return sn;
+}
+
+void ParseSidMapLine(Barnyard2Config *bc, char *data)
+{
+    SigNode t_sn;
+
+    if( (bc->sidmap_version != SIDMAPV1) &&
+	(bc->sidmap_version != SIDMAPV2))
+    {
+	FatalError("[%s()]: Unknown sidmap file version [%d] \n",
+		   __FUNCTION__,
+		   bc->sidmap_version);
+    }
+
+    if(MapSidLineParse(bc, data, strlen(data), &t_sn))
+    {
+	LogMessage("\n");
+	FatalError("[%s()], File [%s],\nError in map definition [%s] for value [] \n\n",
+		   __FUNCTION__,
+		   bc->sid_msg_file,
+		   data);
+    }
+
+    if(MapSidBrother(MapArenaGet(bc), &t_sn) == NULL)
+    {
+        if(CreateSigNode(bc,&t_sn,SOURCE_SID_MSG) == NULL)
+        {
+            FatalError("[%s()], CreateSigNode() returned a NULL node, bailing \n",
+                       __FUNCTION__);
+        }
+    }
+
+    return;
+}
+
+/*
+ * MapSigAppend: an arena node on the end of the signature list and in its
+ * index
+ */
+static void MapSigAppend(Barnyard2Config *bc, SigNode *sn)
+{
+    MapArena *a = MapArenaGet(bc);
+
+    sn->next = NULL;
+
+    if (a->sig_count == 0)
+        bc->sigHead = sn;
+    else
+        a->sig[a->sig_count - 1]->next = sn;
+
+    MapArenaSigAdd(a, sn);
+}
+
+/*
+ * Parallel sid-msg.map load.  The file is mapped and cut into chunks on
+ * line boundaries, one per thread.  Each thread parses its chunk into a
+ * scratch config of its own, nodes and strings in its own arena, and
+ * references to systems it has not seen into its own list in front of
+ * the shared one, which it only reads.  The chunks are then taken in
+ * file order: arenas absorbed, systems adopted, and the nodes appended
+ * with the same duplicate check as ParseSidMapLine(), so the list and
+ * its index are what a serial load gives.
+ */
+#define MAP_LOAD_THREADS_MAX    16
+#define MAP_LOAD_CHUNK_MIN      (256 * 1024)
+
+typedef struct _MapLoadChunk
+{
+    pthread_t tid;
+    int running;
+    Barnyard2Config scratch;    /* arena, references and version only */
+    ReferenceSystemNode *shared;    /* where the shared systems start */
+    const char *start;
+    const char *end;
+    SigNode *head;
+    SigNode *tail;
+    const char *bad;            /* first line with an empty field */
+    size_t bad_len;
+} MapLoadChunk;
+
+/* the systems a chunk added, oldest first, into bc or onto the one bc has */
+static void MapLoadChunkSystems(Barnyard2Config *bc, MapLoadChunk *c)
+{
+    ReferenceSystemNode **local, **global, *rs;
+    ReferenceNode *ref;
+    SigNode *sn;
+    int n = 0, i, moved = 0;
+
+    for (rs = c->scratch.references; rs != c->shared; rs = rs->next)
+        n++;
+
+    if (n == 0)
+        return;
+
+    local = (ReferenceSystemNode **)SnortAlloc(n * sizeof(ReferenceSystemNode *));
+    global = (ReferenceSystemNode **)SnortAlloc(n * sizeof(ReferenceSystemNode *));
+
+    for (i = n - 1, rs = c->scratch.references; i >= 0; i--, rs = rs->next)
+        local[i] = rs;
+
+    for (i = 0; i < n; i++)
+    {
+        if ((global[i] = ReferenceSystemLookup(bc->references, local[i]->name)) != NULL)
+        {
+            moved++;
+            continue;
+        }
+
+        local[i]->next = bc->references;
+        bc->references = local[i];
+    }
+
+    if (moved)
+    {
+        for (sn = c->head; sn != NULL; sn = sn->next)
+        {
+            for (ref = sn->refs; ref != NULL; ref = ref->next)
+            {
+                for (i = 0; i < n; i++)
+                {
+                    if ((ref->system == local[i]) && (global[i] != NULL))
+                    {
+                        ref->system = global[i];
+                        break;
+                    }
+                }
+            }
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            if (global[i] != NULL)
+            {
+                local[i]->next = NULL;
+                FreeReferences(&local[i]);
+            }
+        }
+    }
+
+    c->scratch.references = NULL;
+    free(local);
+    free(global);
+}
+
+static void MapLoadChunkParse(MapLoadChunk *c)
+{
+    MapArena *a = MapArenaGet(&c->scratch);
+    const char *p = c->start, *eol, *index;
+    SigNode t_sn, *sn;
+
+    while (p < c->end)
+    {
+        if ((eol = memchr(p, '\n', c->end - p)) == NULL)
+            eol = c->end;
+
+        index = p;
+        p = eol + 1;
+
+        /* advance through any whitespace at the beginning of the line */
+        while ((index < eol) && ((*index == ' ') || (*index == '\t')))
+            index++;
+
+        /* if it's not a comment or a <CR>, send it to the parser */
+        if ((index == eol) || (*index == '#'))
+            continue;
+
+        if (MapSidLineParse(&c->scratch, index, eol - index, &t_sn))
+        {
+            c->bad = index;
+            c->bad_len = eol - index;
+            break;
+        }
+
+        sn = (SigNode *)MapArenaAlloc(a, sizeof(SigNode));
+        memcpy(sn, &t_sn, sizeof(SigNode));
+        sn->source_file = SOURCE_SID_MSG;
+
+        if (c->tail == NULL)
+            c->head = sn;
+        else
+            c->tail->next = sn;
+        c->tail = sn;
+    }
+}
+
+static void *MapLoadChunkThread(void *arg)
+{
+    SetThreadName("map-load");
+    MapLoadChunkParse((MapLoadChunk *)arg);
+
+    return NULL;
+}
+
+/*
+ * MapSidLoadMapped: bc->sid_msg_file over an mmap, in parallel.  -1 when
+ * the file is left to the stdio loader: not a regular file, or a first
+ * line that is a comment but not the version.
+ */
+static int MapSidLoadMapped(Barnyard2Config *bc)
+{
+    MapLoadChunk *chunks, *c;
+    MapArena *a;
+    SigNode *sn, *next;
+    struct stat st;
+    const char *map, *p, *end, *eol, *index, *cut;
+    size_t size;
+    long ncpu;
+    int fd, n, i;
+
+    if ((fd = open(bc->sid_msg_file, O_RDONLY)) < 0)
+        return -1;
+
+    if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) || (st.st_size == 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    size = (size_t)st.st_size;
+    map = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return -1;
+
+    p = map;
+    end = map + size;
+
+    /* the version line, as ReadSidFile() takes it */
+    while ((p < end) && (bc->sidmap_version == 0))
+    {
+        if ((eol = memchr(p, '\n', end - p)) == NULL)
+            eol = end;
+
+        index = p;
+        while ((index < eol) && ((*index == ' ') || (*index == '\t')))
+            index++;
+
+        if ((index == eol) || (*index != '#'))
+        {
+            bc->sidmap_version = SIDMAPV1;
+            break;
+        }
+
+        index++;
+        if (((size_t)(eol - index) >= strlen(SIDMAPV1STRING)) &&
+            (strncasecmp(index, SIDMAPV1STRING, strlen(SIDMAPV1STRING)) == 0))
+        {
+            bc->sidmap_version = SIDMAPV1;
+        }
+        else if (((size_t)(eol - index) >= strlen(SIDMAPV2STRING)) &&
+                 (strncasecmp(index, SIDMAPV2STRING, strlen(SIDMAPV2STRING)) == 0))
+        {
+            bc->sidmap_version = SIDMAPV2;
+        }
+        else
+        {
+            munmap((void *)map, size);
+            return -1;
+        }
+
+        p = eol + 1;
+    }
+
+    if ((ncpu = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        ncpu = 1;
+
+    n = (p < end) ? (int)((end - p) / MAP_LOAD_CHUNK_MIN) : 0;
+    if (n > ncpu)
+        n = (int)ncpu;
+    if (n > MAP_LOAD_THREADS_MAX)
+        n = MAP_LOAD_THREADS_MAX;
+    if (n < 1)
+        n = 1;
+
+    chunks = (MapLoadChunk *)SnortAlloc(n * sizeof(MapLoadChunk));
+
+    /* cut after the newline nearest each nth of the rest */
+    for (i = 0, cut = p; i < n; i++)
+    {
+        c = &chunks[i];
+        c->start = cut;
+
+        if (i == n - 1)
+            cut = end;
+        else
+        {
+            cut = p + (size_t)(end - p) * (i + 1) / n;
+            if (cut < c->start)
+                cut = c->start;
+            if ((eol = memchr(cut, '\n', end - cut)) == NULL)
+                cut = end;
+            else
+                cut = eol + 1;
+        }
+
+        c->end = cut;
+        c->scratch.sid_msg_file = bc->sid_msg_file;
+        c->scratch.sidmap_version = bc->sidmap_version;
+        c->scratch.references = c->shared = bc->references;
+    }
+
+    for (i = 1; i < n; i++)
+    {
+        if (pthread_create(&chunks[i].tid, NULL, MapLoadChunkThread, &chunks[i]) == 0)
+            chunks[i].running = 1;
+    }
+
+    /* the first chunk, and any a thread could not be had for, here */
+    for (i = 0; i < n; i++)
+    {
+        if (!chunks[i].running)
+            MapLoadChunkParse(&chunks[i]);
+    }
+
+    for (i = 1; i < n; i++)
+    {
+        if (chunks[i].running)
+            pthread_join(chunks[i].tid, NULL);
+    }
+
+    a = MapArenaGet(bc);
+
+    for (i = 0; i < n; i++)
+    {
+        c = &chunks[i];
+
+        if (c->bad != NULL)
+        {
+            LogMessage("\n");
+            FatalError("[%s()], File [%s],\nError in map definition [%.*s] for value [] \n\n",
+                       __FUNCTION__,
+                       bc->sid_msg_file,
+                       (int)c->bad_len, c->bad);
+        }
+
+        MapLoadChunkSystems(bc, c);
+        MapArenaAbsorb(a, &c->scratch.map_arena);
+
+        for (sn = c->head; sn != NULL; sn = next)
+        {
+            next = sn->next;
+
+            if (MapSidBrother(a, sn) == NULL)
+                MapSigAppend(bc, sn);
+        }
+    }
+
+    DEBUG_WRAP(DebugMessage(DEBUG_MAPS, "[%s()] map: %u signatures from %s in %d chunks\n",
+                            __FUNCTION__, a->sig_count, bc->sid_msg_file, n););
+
+    free(chunks);
+    munmap((void *)map, size);
+
+    return 0;
+}
+
+SigNode *GetSigByGidSid(u_int32_t gid, u_int32_t sid,u_int32_t revision)
+{
+    SigNode t_sn = {0};
+    SigNode *sn = NULL;
+
+    /* The comment below is not true anymore with  sidmapv2 files generated by pulled pork */
+
+    /* a snort general rule (gid=1) and a snort dynamic rule (gid=3) use the  */
+    /* the same sids and thus can be considered one in the same. */
+    if( (BcSidMapVersion() == SIDMAPV1) && (gid == 3) )
+    {
+	gid = 1;
+    }
+
+    /* once the maps are published, their index, and a list of our own for the rest */
+    if(MapSnapshotCurrent() != NULL)
+    {
+	if( (sn = MapSigFind(gid, sid, revision)) != NULL)
+	{
+	    return sn;
+	}
+
+	return MapSigRuntime(gid, sid, revision);
+    }
+
+    /* before that, the maps being loaded */
+    if( (sn = MapArenaSigFind(barnyard2_conf->map_arena, gid, sid, revision, 0,
+			      BcSidMapVersion() == SIDMAPV2)) != NULL)
+    {
+	return sn;
+    }
+    
+    /* create a default message since we didn't find any match */
+    t_sn.generator = gid;
+    t_sn.id = sid;
+    t_sn.rev = revision;
+    t_sn.msg = (char *)MapArenaAllocAlign(MapArenaGet(barnyard2_conf), 42, 1);
+    snprintf(t_sn.msg, 42, "Snort Alert [%u:%u:%u]", gid, sid, revision);
+
+    return CreateSigNode(barnyard2_conf, &t_sn, SOURCE_GEN_RUNTIME);
+}
+
+
+
+/*
+ * CreateSigNode: a copy of t_sn from the map arena, on the end of the
+ * signature list and in its index
+ */
+SigNode *CreateSigNode(Barnyard2Config *bc, const SigNode *t_sn, const u_int8_t source_file)
+{
+    MapArena *a = MapArenaGet(bc);
+    SigNode *sn;
+
+    sn = (SigNode *)MapArenaAlloc(a, sizeof(SigNode));
+    memcpy(sn, t_sn, sizeof(SigNode));
+    sn->source_file = source_file;
+
+    MapSigAppend(bc, sn);
+
+    return sn;
+}
 
 int ReadGenFile(Barnyard2Config *bc)
 {
@@ -1086,7 +1655,7 @@ int ReadGenFile(Barnyard2Config *bc)
         /* if it's not a comment or a <CR>, send it to the parser */
         if( (*index != '#') && (*index != 0x0a) && (index != NULL) )
         {
-            ParseGenMapLine(index);
+            ParseGenMapLine(bc, index);
 	    count++;
         }
     }
@@ -1100,117 +1669,103 @@ int ReadGenFile(Barnyard2Config *bc)
 }
 
 
-void ParseGenMapLine(char *data)
+/*
+ * MapGenLineParse: gid, sid and message of one gen-msg.map line into
+ * t_sn, the message from the arena of bc.  1 for a line that is ignored.
+ */
+static int MapGenLineParse(Barnyard2Config *bc, const char *data, size_t len, SigNode *t_sn)
 {
-    char **toks = NULL;
-    char *idx = NULL;
+    MSpan toks[32];
+    int num_toks, i;
 
-    SigNode *sn = NULL; 
-    SigNode t_sn = {0};  /* used for temp storage before lookup */
-    
-    int num_toks = 0;
-    int i = 0;
+    memset(t_sn, 0, sizeof(SigNode));
+
+    num_toks = mSplitSpecialSpan(data, len, "||", 32, toks);
 
-    toks = mSplitSpecial(data, "||", 32, &num_toks, '\0');
-    
     if(num_toks < 2)
     {
-        LogMessage("WARNING: Ignoring bad line in SID file: \"%s\"\n", data);
-	return;
+        LogMessage("WARNING: Ignoring bad line in SID file: \"%.*s\"\n", (int)len, data);
+	return 1;
     }
-    
+
     for(i=0; i<num_toks; i++)
     {
-        strip(toks[i]);
-        idx = toks[i];
-        while(*idx == ' ') idx++;
-        
+        MapSpanClean(&toks[i], 0);
+
         switch(i)
         {
 	case 0: /* gen */
-	    if( (t_sn.generator = strtoul(idx, NULL, 10)) == ULONG_MAX)
-	    {
-		FatalError("[%s()], error converting integer [%s] for line [%s] \n",
-			   __FUNCTION__,
-			   strerror(errno),
-			   data);
-	    }
+	    t_sn->generator = MapSpanToU32(&toks[i]);
 	    break;
-	    
+
 	case 1: /* sid */
-	    if( (t_sn.id = strtoul(idx, NULL, 10)) == ULONG_MAX)
-	    {
-		FatalError("[%s()], error converting integer [%s] for line [%s] \n",
-			   __FUNCTION__,
-			   strerror(errno),
-			   data);
-	    }
+	    t_sn->id = MapSpanToU32(&toks[i]);
 	    break;
-	    
+
 	case 2: /* msg */
-	    if( (t_sn.msg = SnortStrdup(idx)) == NULL)
-	    {
-		FatalError("[%s()], error converting string for line [%s] \n",
-			   __FUNCTION__,
-			   data);
-	    }
+	    t_sn->msg = MapSpanMessage(MapArenaGet(bc), &toks[i]);
 	    break;
-	    
-	default: 
+
+	default:
 	    break;
         }
     }
-    
-    switch(BcSidMapVersion())
+
+    return 0;
+}
+
+/*
+ * MapGenInsert: the generator defaults for the sid-msg.map version, then
+ * the message onto a sid-msg.map node with the same gid/sid, or a node of
+ * its own when there is neither that nor an earlier gen-msg.map one
+ */
+static void MapGenInsert(Barnyard2Config *bc, SigNode *t_sn)
+{
+    SigNode *sn = NULL;
+    MapArena *a = MapArenaGet(bc);
+
+    switch(bc->sidmap_version)
     {
         case SIDMAPV1:
-           t_sn.rev = 1;
-           t_sn.priority = 0;
-           t_sn.classLiteral = strdup("NOCLASS"); /* default */
-           t_sn.class_id = 0;
+           t_sn->rev = 1;
+           t_sn->priority = 0;
+           t_sn->classLiteral = MapArenaIntern(a, "NOCLASS"); /* default */
+           t_sn->class_id = 0;
            break;
 
         case SIDMAPV2:
            /*
               Generators have pre-defined revision,classification and priority
            */
-           t_sn.rev = 1;
-           t_sn.classLiteral = strdup("NOCLASS"); /* default */
-           t_sn.class_id = 0;
-           t_sn.priority = 3;
+           t_sn->rev = 1;
+           t_sn->classLiteral = MapArenaIntern(a, "NOCLASS"); /* default */
+           t_sn->class_id = 0;
+           t_sn->priority = 3;
            break;
     }
     
     /* Look if we have a brother inserted from sid map file */
-    if(SigLookup((SigNode *)*BcGetSigNodeHead(),t_sn.generator,t_sn.id,SOURCE_SID_MSG,&sn))
+    if( (sn = MapArenaSigFind(a,t_sn->generator,t_sn->id,0,SOURCE_SID_MSG,0)) != NULL)
     {
 
 	DEBUG_WRAP(DebugMessage(DEBUG_MAPS,
 				"[%s()],Item not inserted [ gid:[%d] sid:[%d] rev:[%d] msg:[%s] class:[%d] prio:[%d] ] in signature list \n"
 				"\t Item already present  [ gid:[%d] sid:[%d] rev:[%d] msg:[%s] class:[%d] prio:[%d] ] \n",
 				__FUNCTION__,
-				t_sn.generator,t_sn.id,t_sn.rev,t_sn.msg,t_sn.class_id,t_sn.priority, /* revision,class_id and priority are hardcoded for generator */
+				t_sn->generator,t_sn->id,t_sn->rev,t_sn->msg,t_sn->class_id,t_sn->priority, /* revision,class_id and priority are hardcoded for generator */
 				sn->generator,sn->id,sn->rev,sn->msg,sn->class_id,sn->priority););
 
 	/* 
 	   This is a quick hack for now to put sweet gid-msg.map messages up there 
 	*/
-	if(t_sn.msg)
+	if(t_sn->msg)
 	{
 	    DEBUG_WRAP(DebugMessage(DEBUG_MAPS,"[%s()], swapping message [%s] for [%s] \n",
 				    __FUNCTION__,
 				    sn->msg,
-				    t_sn.msg););
-	    free(sn->msg);
-	    sn->msg = NULL;
-	    sn->msg = t_sn.msg;
-	    t_sn.msg = NULL;
-	}
-
-	if(t_sn.classLiteral)
-	{
-	    free(t_sn.classLiteral);
-	    t_sn.classLiteral = NULL;
+				    t_sn->msg););
+	    sn->msg = t_sn->msg;
+	    t_sn->msg = NULL;
 	}
 	
 	DEBUG_WRAP(DebugMessage(DEBUG_MAPS,"\n"););
@@ -1218,17 +1773,13 @@ void ParseGenMapLine(char *data)
     }
     else
     {
-	if(SigLookup((SigNode *)*BcGetSigNodeHead(),t_sn.generator,t_sn.id,SOURCE_GEN_MSG,&sn) == 0)
+	if( (sn = MapArenaSigFind(a,t_sn->generator,t_sn->id,0,SOURCE_GEN_MSG,0)) == NULL)
 	{
-	    if( (sn = CreateSigNode(BcGetSigNodeHead(),SOURCE_GEN_MSG)) == NULL)
+	    if( (sn = CreateSigNode(bc,t_sn,SOURCE_GEN_MSG)) == NULL)
 	    {
 		FatalError("[%s()], CreateSigNode() returned a NULL node, bailing \n",
 			   __FUNCTION__);
 	    }
-	 
-	    memcpy(sn,&t_sn,sizeof(SigNode));
-	    
-	    sn->source_file = SOURCE_GEN_MSG;
 	}
 	else
 	{
@@ -1237,27 +1788,132 @@ void ParseGenMapLine(char *data)
 				    "[%s()],Item not inserted [ gid:[%d] sid:[%d] rev:[%d] msg:[%s] class:[%d] prio:[%d] ] in signature list \n"
 				    "\t Item already present  [ gid:[%d] sid:[%d] rev:[%d] msg:[%s] class:[%d] prio:[%d] ] \n\n",
 				    __FUNCTION__,
-				    t_sn.generator,t_sn.id,t_sn.rev,t_sn.msg,t_sn.class_id,t_sn.priority, /* revision,class_id and priority are hardcoded for generator */
+				    t_sn->generator,t_sn->id,t_sn->rev,t_sn->msg,t_sn->class_id,t_sn->priority, /* revision,class_id and priority are hardcoded for generator */
 				    sn->generator,sn->id,sn->rev,sn->msg,sn->class_id,sn->priority););
-	    
-	    if(t_sn.msg)
-	    {
-		free(t_sn.msg);
-		t_sn.msg = NULL;
-	    }
-	    
-	    if(t_sn.classLiteral)
-	    {
-		free(t_sn.classLiteral);
-		t_sn.classLiteral = NULL;
-	    }
+	}
+    }
+}
+
+void ParseGenMapLine(Barnyard2Config *bc, char *data)
+{
+    SigNode t_sn;  /* used for temp storage before lookup */
+
+    if(MapGenLineParse(bc, data, strlen(data), &t_sn) == 0)
+        MapGenInsert(bc, &t_sn);
+
+    return;
+}
+
+/*
+ * gen-msg.map is read on a thread of its own while sid-msg.map loads,
+ * into a scratch arena; the entries go in once the sid-msg.map version
+ * they take their defaults from is known.
+ */
+typedef struct _MapGenLoad
+{
+    pthread_t tid;
+    Barnyard2Config scratch;    /* arena and gen_msg_file only */
+    SigNode *head;
+    SigNode *tail;
+    int error;
+} MapGenLoad;
+
+static void *MapGenLoadThread(void *arg)
+{
+    MapGenLoad *g = (MapGenLoad *)arg;
+    FILE *fd;
+    char buf[BUFFER_SIZE];
+    char *index;
+    SigNode t_sn, *sn;
+
+    SetThreadName("map-load-gen");
+
+    if ( (fd = fopen(g->scratch.gen_msg_file, "r")) == NULL )
+    {
+	LogMessage("ERROR: Unable to open Generator file \"%s\": %s\n", 
+		   g->scratch.gen_msg_file, 
+		   strerror(errno));
+	g->error = 1;
+	return NULL;
+    }
+
+    while( fgets(buf, BUFFER_SIZE, fd) != NULL )
+    {
+        index = buf;
+
+        /* advance through any whitespace at the beginning of the line */
+        while (*index == ' ' || *index == '\t')
+            index++;
+
+        /* if it's not a comment or a <CR>, send it to the parser */
+        if( (*index == '#') || (*index == 0x0a) )
+            continue;
+
+        if( MapGenLineParse(&g->scratch, index, strlen(index), &t_sn) )
+            continue;
+
+        sn = (SigNode *)MapArenaAlloc(MapArenaGet(&g->scratch), sizeof(SigNode));
+        memcpy(sn, &t_sn, sizeof(SigNode));
+
+        if (g->tail == NULL)
+            g->head = sn;
+        else
+            g->tail->next = sn;
+        g->tail = sn;
+    }
+
+    fclose(fd);
+
+    return NULL;
+}
+
+/*
+ * ReadMapFiles: sid-msg.map and gen-msg.map, the two at once.  0, or the
+ * SOURCE_ of the file that could not be read.
+ */
+int ReadMapFiles(Barnyard2Config *bc)
+{
+    MapGenLoad g;
+    SigNode *sn, *next;
+    int started = 0, ret = 0;
+
+    memset(&g, 0, sizeof(g));
 
-	}
+    if ((bc->sid_msg_file != NULL) && (bc->gen_msg_file != NULL))
+    {
+        g.scratch.gen_msg_file = bc->gen_msg_file;
+        started = (pthread_create(&g.tid, NULL, MapGenLoadThread, &g) == 0);
     }
-	
-    mSplitFree(&toks, num_toks);
 
-    return;
+    if (ReadSidFile(bc))
+        ret = SOURCE_SID_MSG;
+
+    if (started)
+    {
+        pthread_join(g.tid, NULL);
+
+        if ((ret == 0) && g.error)
+            ret = SOURCE_GEN_MSG;
+
+        if (ret == 0)
+        {
+            MapArenaAbsorb(MapArenaGet(bc), &g.scratch.map_arena);
+
+            for (sn = g.head; sn != NULL; sn = next)
+            {
+                next = sn->next;
+                MapGenInsert(bc, sn);
+            }
+        }
+
+        MapArenaFree(&g.scratch.map_arena);
+    }
+    else if ((ret == 0) && ReadGenFile(bc))
+    {
+        ret = SOURCE_GEN_MSG;
+    }
+
+    return ret;
 }
 
 /* 
@@ -1266,6 +1922,7 @@ void ParseGenMapLine(char *data)
  *
  */
 
+/* a list allocated node by node, the map files' lists go with MapArenaFree() */
 void FreeSigNodes(SigNode **sigHead)
 {
     SigNode *sn = NULL, *snn = NULL;
@@ -1378,3 +2035,585 @@ void FreeSigSuppression(SigSuppress_list **i_head)
 
     *i_head = NULL;
 }
+
+/****************************** Map Snapshots *********************************/
+
+/*
+ * The maps the output path reads are published as one MapSnapshot.  A
+ * SIGHUP builds a new one from the files on the map-reload thread and
+ * swaps the pointer; the spooler threads never wait on it.
+ *
+ * Readers are tracked with epochs: MapReadLock() records the generation
+ * current when the outermost lock is taken and MapReadUnlock() clears it.
+ * A replaced snapshot is retired at the generation that replaced it and
+ * freed once no reader holds an epoch older than that.
+ */
+
+#define MAP_RELOAD_POLL_MS  200
+
+typedef struct _MapReader
+{
+    uint64_t epoch;             /* 0 when outside a read section */
+    uint32_t nest;
+    struct _MapReader *next;
+} MapReader;
+
+static MapSnapshot *map_current = NULL;
+static uint64_t map_generation = 1;
+
+static __thread MapReader *map_reader = NULL;
+
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+static MapReader *map_readers = NULL;     /* never unlinked */
+static SigNode *map_runtime = NULL;       /* default messages, live until exit */
+static MapSnapshot *map_retired = NULL;
+
+static pthread_t map_tid;
+static int map_running = 0;
+static volatile int map_stop = 0;
+static volatile sig_atomic_t map_reload_pending = 0;
+
+static MapReader *MapReaderGet(void)
+{
+    MapReader *r = (MapReader *)SnortAlloc(sizeof(MapReader));
+
+    pthread_mutex_lock(&map_lock);
+    r->next = map_readers;
+    map_readers = r;
+    pthread_mutex_unlock(&map_lock);
+
+    map_reader = r;
+    return r;
+}
+
+/*-------------------------------------------------------------------
+ * MapReadLock / MapReadUnlock: a read section on the calling thread,
+ * they nest and never block
+ *-------------------------------------------------------------------
+ */
+void MapReadLock(void)
+{
+    MapReader *r = map_reader;
+
+    if (r == NULL)
+        r = MapReaderGet();
+
+    if (r->nest++ == 0)
+        __atomic_store_n(&r->epoch, __atomic_load_n(&map_generation, __ATOMIC_SEQ_CST),
+                         __ATOMIC_SEQ_CST);
+}
+
+void MapReadUnlock(void)
+{
+    MapReader *r = map_reader;
+
+    if ((r == NULL) || (r->nest == 0))
+        return;
+
+    if (--r->nest == 0)
+        __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+MapSnapshot *MapSnapshotCurrent(void)
+{
+    return __atomic_load_n(&map_current, __ATOMIC_SEQ_CST);
+}
+
+static void MapSnapshotFree(MapSnapshot *m)
+{
+    if (m == NULL)
+        return;
+
+    m->sigHead = NULL;
+    MapArenaFree(&m->arena);
+    FreeClassifications(&m->classifications);
+    FreeReferences(&m->references);
+
+    if (m->class_by_id)
+        free(m->class_by_id);
+
+    free(m);
+}
+
+static uint32_t MapSigCount(MapSnapshot *m)
+{
+    return m->arena ? m->arena->sig_count : 0;
+}
+
+/*-------------------------------------------------------------------
+ * MapSnapshotBuild: take the lists of a load, the snapshot owns them
+ * and uses the arena's gid/sid index
+ *-------------------------------------------------------------------
+ */
+static MapSnapshot *MapSnapshotBuild(Barnyard2Config *bc)
+{
+    MapSnapshot *m;
+    ClassType *ct;
+
+    m = (MapSnapshot *)SnortAlloc(sizeof(MapSnapshot));
+    m->sigHead = bc->sigHead;
+    m->arena = bc->map_arena;
+    m->classifications = bc->classifications;
+    m->references = bc->references;
+    m->sidmap_version = bc->sidmap_version;
+
+    bc->sigHead = NULL;
+    bc->map_arena = NULL;
+    bc->classifications = NULL;
+    bc->references = NULL;
+
+    for (ct = m->classifications; ct != NULL; ct = ct->next)
+    {
+        if (ct->id > m->class_max)
+            m->class_max = ct->id;
+    }
+
+    m->class_by_id = (ClassType **)SnortAlloc((m->class_max + 1) * sizeof(ClassType *));
+
+    /* first in the list wins, as ClassTypeLookupById() */
+    for (ct = m->classifications; ct != NULL; ct = ct->next)
+    {
+        if (m->class_by_id[ct->id] == NULL)
+            m->class_by_id[ct->id] = ct;
+    }
+
+    return m;
+}
+
+/*-------------------------------------------------------------------
+ * MapSigFind: gid/sid (and rev for sid-msg.map v2) in the current
+ * snapshot, NULL when it has none
+ *-------------------------------------------------------------------
+ */
+SigNode *MapSigFind(uint32_t gid, uint32_t sid, uint32_t revision)
+{
+    MapSnapshot *m = MapSnapshotCurrent();
+
+    if (m == NULL)
+        return NULL;
+
+    if ((m->sidmap_version == SIDMAPV1) && (gid == 3))
+        gid = 1;
+
+    return MapArenaSigFind(m->arena, gid, sid, revision, 0,
+                           m->sidmap_version == SIDMAPV2);
+}
+
+/*-------------------------------------------------------------------
+ * MapSigRuntime: the default message for a signature no map knows.
+ * These outlive reloads, so they are kept apart from the snapshots.
+ *-------------------------------------------------------------------
+ */
+static SigNode *MapSigRuntime(uint32_t gid, uint32_t sid, uint32_t revision)
+{
+    SigNode *sn;
+
+    pthread_mutex_lock(&map_lock);
+    for (sn = map_runtime; sn != NULL; sn = sn->next)
+    {
+        if ((sn->generator == gid) && (sn->id == sid) &&
+            ((BcSidMapVersion() != SIDMAPV2) || (sn->rev == revision)))
+            break;
+    }
+
+    if (sn == NULL)
+    {
+        sn = (SigNode *)SnortAlloc(sizeof(SigNode));
+        sn->source_file = SOURCE_GEN_RUNTIME;
+        sn->generator = gid;
+        sn->id = sid;
+        sn->rev = revision;
+        sn->msg = (char *)SnortAlloc(42);
+        snprintf(sn->msg, 42, "Snort Alert [%u:%u:%u]", gid, sid, revision);
+
+        sn->next = map_runtime;
+        map_runtime = sn;
+    }
+    pthread_mutex_unlock(&map_lock);
+
+    return sn;
+}
+
+static uint32_t MapClassCount(MapSnapshot *m)
+{
+    ClassType *ct;
+    uint32_t n = 0;
+
+    for (ct = m->classifications; ct != NULL; ct = ct->next)
+        n++;
+
+    return n;
+}
+
+static void MapSwap(MapSnapshot *m)
+{
+    MapSnapshot *old;
+    uint64_t gen;
+
+    old = __atomic_exchange_n(&map_current, m, __ATOMIC_SEQ_CST);
+    gen = __atomic_add_fetch(&map_generation, 1, __ATOMIC_SEQ_CST);
+    m->generation = gen;
+
+    if (old != NULL)
+    {
+        old->generation = gen;
+
+        pthread_mutex_lock(&map_lock);
+        old->next = map_retired;
+        map_retired = old;
+        pthread_mutex_unlock(&map_lock);
+    }
+}
+
+/*-------------------------------------------------------------------
+ * MapReclaim: free the retired snapshots no reader can still see
+ *-------------------------------------------------------------------
+ */
+static void MapReclaim(void)
+{
+    MapSnapshot **mp, *m;
+    MapReader *r;
+    uint64_t oldest = UINT64_MAX, epoch;
+
+    pthread_mutex_lock(&map_lock);
+    if (map_retired == NULL)
+    {
+        pthread_mutex_unlock(&map_lock);
+        return;
+    }
+
+    for (r = map_readers; r != NULL; r = r->next)
+    {
+        epoch = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+        if ((epoch != 0) && (epoch < oldest))
+            oldest = epoch;
+    }
+
+    mp = &map_retired;
+    while ((m = *mp) != NULL)
+    {
+        if (oldest >= m->generation)
+        {
+            *mp = m->next;
+            MapSnapshotFree(m);
+        }
+        else
+            mp = &m->next;
+    }
+    pthread_mutex_unlock(&map_lock);
+}
+
+/*-------------------------------------------------------------------
+ * MapPublish: hand the maps parsed at startup to the output path
+ *-------------------------------------------------------------------
+ */
+void MapPublish(Barnyard2Config *bc)
+{
+    MapSnapshot *m;
+
+    if (bc == NULL)
+        return;
+
+    m = MapSnapshotBuild(bc);
+
+    LogMessage("map: published %u signatures, %u classifications, %lu KB\n",
+               MapSigCount(m), MapClassCount(m),
+               m->arena ? (unsigned long)(m->arena->bytes / 1024) : 0UL);
+
+    MapSwap(m);
+}
+
+static void MapCopyLists(Barnyard2Config *bc, MapSnapshot *cur)
+{
+    ClassType *ct, *nct, **ctp = &bc->classifications;
+    ReferenceSystemNode *rs, *nrs, **rsp = &bc->references;
+
+    for (ct = cur->classifications; ct != NULL; ct = ct->next)
+    {
+        nct = (ClassType *)SnortAlloc(sizeof(ClassType));
+        nct->type = SnortStrdup(ct->type);
+        nct->name = SnortStrdup(ct->name);
+        nct->id = ct->id;
+        nct->priority = ct->priority;
+
+        *ctp = nct;
+        ctp = &nct->next;
+    }
+
+    for (rs = cur->references; rs != NULL; rs = rs->next)
+    {
+        nrs = (ReferenceSystemNode *)SnortAlloc(sizeof(ReferenceSystemNode));
+        nrs->name = SnortStrdup(rs->name);
+        if (rs->url != NULL)
+            nrs->url = SnortStrdup(rs->url);
+
+        *rsp = nrs;
+        rsp = &nrs->next;
+    }
+}
+
+/*-------------------------------------------------------------------
+ * MapMergeFiles: the classification and reference files over the lists
+ * copied from the running maps.  Classification ids are what the
+ * outputs (and the database) know them by, so a type keeps its id and
+ * new types are numbered after the last one.
+ *-------------------------------------------------------------------
+ */
+static int MapMergeFiles(Barnyard2Config *bc)
+{
+    Barnyard2Config *fc;
+    ClassType *ct, *found, *nct;
+    ReferenceSystemNode *rs, *prev = NULL, *next, *rfound;
+    uint32_t id, max_id = 0;
+
+    fc = (Barnyard2Config *)SnortAlloc(sizeof(Barnyard2Config));
+
+    if (bc->class_file != NULL)
+    {
+        fc->class_file = bc->class_file;
+        if (ReadClassificationFile(fc) != 0)
+            goto fail;
+
+        for (ct = fc->classifications; ct != NULL; ct = ct->next)
+        {
+            if (ct->id > max_id)
+                max_id = ct->id;
+        }
+
+        /* in file order, which is id order */
+        for (id = 1; id <= max_id; id++)
+        {
+            for (ct = fc->classifications; ct != NULL; ct = ct->next)
+            {
+                if (ct->id == id)
+                    break;
+            }
+
+            if (ct == NULL)
+                continue;
+
+            if ((found = ClassTypeLookupByTypePure(bc->classifications, ct->type)) != NULL)
+            {
+                free(found->name);
+                found->name = SnortStrdup(ct->name);
+                found->priority = ct->priority;
+                continue;
+            }
+
+            nct = (ClassType *)SnortAlloc(sizeof(ClassType));
+            nct->type = SnortStrdup(ct->type);
+            nct->name = SnortStrdup(ct->name);
+            nct->priority = ct->priority;
+            AddClassificationConfig(bc, nct);
+        }
+    }
+
+    if (bc->reference_file != NULL)
+    {
+        if (ReadReferenceFile(fc, bc->reference_file) != 0)
+            goto fail;
+
+        /* newest first as read, put it back in file order */
+        for (rs = fc->references; rs != NULL; rs = next)
+        {
+            next = rs->next;
+            rs->next = prev;
+            prev = rs;
+        }
+        fc->references = prev;
+
+        for (rs = fc->references; rs != NULL; rs = rs->next)
+        {
+            if ((rfound = ReferenceSystemLookup(bc->references, rs->name)) != NULL)
+            {
+                if (rfound->url != NULL)
+                    free(rfound->url);
+                rfound->url = (rs->url != NULL) ? SnortStrdup(rs->url) : NULL;
+            }
+            else
+                ReferenceSystemAdd(&bc->references, rs->name, rs->url);
+        }
+    }
+
+    FreeClassifications(&fc->classifications);
+    FreeReferences(&fc->references);
+    free(fc);
+    return 0;
+
+fail:
+    FreeClassifications(&fc->classifications);
+    FreeReferences(&fc->references);
+    free(fc);
+    return 1;
+}
+
+/*-------------------------------------------------------------------
+ * MapSnapshotLoad: read the map files again into a new snapshot.  Only
+ * the scratch config is written, the running maps are left alone.
+ *-------------------------------------------------------------------
+ */
+static MapSnapshot *MapSnapshotLoad(MapSnapshot *cur)
+{
+    Barnyard2Config *bc;
+    MapSnapshot *m = NULL;
+
+    bc = (Barnyard2Config *)SnortAlloc(sizeof(Barnyard2Config));
+
+    /* borrowed, never freed here */
+    bc->sid_msg_file = barnyard2_conf->sid_msg_file;
+    bc->gen_msg_file = barnyard2_conf->gen_msg_file;
+    bc->class_file = barnyard2_conf->class_file;
+    bc->reference_file = barnyard2_conf->reference_file;
+
+    MapCopyLists(bc, cur);
+
+    if (MapMergeFiles(bc))
+        goto done;
+
+    switch (ReadMapFiles(bc))
+    {
+    case SOURCE_SID_MSG:
+        ErrorMessage("map: failed while processing [%s]\n", bc->sid_msg_file);
+        goto done;
+
+    case SOURCE_GEN_MSG:
+        ErrorMessage("map: failed while processing [%s]\n", bc->gen_msg_file);
+        goto done;
+    }
+
+    if (bc->sidmap_version != cur->sidmap_version)
+    {
+        ErrorMessage("map: [%s] changed sid-msg.map version, a restart is needed\n",
+                     bc->sid_msg_file);
+        goto done;
+    }
+
+    if ((bc->sidmap_version == SIDMAPV2) &&
+        SignatureResolveClassification(bc->classifications, bc->sigHead,
+                                       bc->sid_msg_file, bc->class_file))
+    {
+        ErrorMessage("map: unable to resolve the signature classifications\n");
+        goto done;
+    }
+
+    m = MapSnapshotBuild(bc);
+
+done:
+    bc->sigHead = NULL;
+    MapArenaFree(&bc->map_arena);
+    FreeClassifications(&bc->classifications);
+    FreeReferences(&bc->references);
+    free(bc);
+
+    return m;
+}
+
+static void MapReload(void)
+{
+    MapSnapshot *cur = MapSnapshotCurrent(), *m;
+    struct timeval t0, t1;
+
+    if (cur == NULL)
+        return;
+
+    LogMessage("map: reloading the signature, classification and reference maps\n");
+    gettimeofday(&t0, NULL);
+
+    if ((m = MapSnapshotLoad(cur)) == NULL)
+    {
+        ErrorMessage("map: reload failed, keeping the maps in use\n");
+        return;
+    }
+
+    gettimeofday(&t1, NULL);
+    LogMessage("map: reloaded %u signatures, %u classifications in %.3fs\n",
+               MapSigCount(m), MapClassCount(m),
+               (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_usec - t0.tv_usec) / 1000000.0);
+
+    MapSwap(m);
+}
+
+static void *MapReloadThread(void *arg)
+{
+    struct timespec t = { 0, MAP_RELOAD_POLL_MS * 1000000 };
+    sigset_t mask;
+
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    SetThreadName("map-reload");
+
+    while (!map_stop)
+    {
+        nanosleep(&t, NULL);
+
+        if (map_reload_pending)
+        {
+            map_reload_pending = 0;
+            MapReload();
+        }
+
+        MapReclaim();
+    }
+
+    return NULL;
+}
+
+/*-------------------------------------------------------------------
+ * MapReloadRequest: from the SIGHUP handler, the thread does the work
+ *-------------------------------------------------------------------
+ */
+void MapReloadRequest(void)
+{
+    map_reload_pending = 1;
+}
+
+void MapReloadStart(void)
+{
+    if (map_running)
+        return;
+
+    map_stop = 0;
+    map_reload_pending = 0;
+
+    if (pthread_create(&map_tid, NULL, MapReloadThread, NULL))
+    {
+        ErrorMessage("map: unable to start the reload thread, SIGHUP will not reload the maps\n");
+        return;
+    }
+
+    map_running = 1;
+}
+
+void MapReloadStop(void)
+{
+    if (!map_running)
+        return;
+
+    map_stop = 1;
+    pthread_join(map_tid, NULL);
+    map_running = 0;
+}
+
+/*-------------------------------------------------------------------
+ * MapSnapshotsFree: at exit, once the readers are gone
+ *-------------------------------------------------------------------
+ */
+void MapSnapshotsFree(void)
+{
+    MapSnapshot *m;
+
+    MapSnapshotFree(__atomic_exchange_n(&map_current, NULL, __ATOMIC_SEQ_CST));
+
+    pthread_mutex_lock(&map_lock);
+    while ((m = map_retired) != NULL)
+    {
+        map_retired = m->next;
+        MapSnapshotFree(m);
+    }
+
+    FreeSigNodes(&map_runtime);
+    pthread_mutex_unlock(&map_lock);
+}
+
+/*************************** End of Map Snapshots *****************************/
@@ -106,6 +106,55 @@ typedef struct _SigNode
 } SigNode;
 
 
+/* Everything one load of the map files allocates for its signatures: the
+ * nodes, their messages and references.  Repeated strings (reference ids
+ * and urls, classification names) are stored once.  Nodes are also kept by
+ * a 32-bit index in load order, with a gid/sid hash chained by index, so
+ * the loader and the lookups never walk the list.  Freed as a whole. */
+typedef struct _MapArenaChunk
+{
+    struct _MapArenaChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} MapArenaChunk;
+
+typedef struct _MapArena
+{
+    MapArenaChunk *chunk;       /* the one being filled first */
+    size_t bytes;
+
+    char **str;                 /* interned strings, open addressing */
+    uint32_t str_mask;
+    uint32_t str_count;
+
+    SigNode **sig;              /* by index, in list order */
+    uint32_t *sig_bucket;       /* first index + 1 of a gid/sid chain, 0 empty */
+    uint32_t *sig_next;         /* next index + 1 in the chain, list order */
+    uint32_t sig_mask;
+    uint32_t sig_count;
+    uint32_t sig_size;
+} MapArena;
+
+/* Maps published for the output path.  A snapshot is never changed once
+ * published; a reload builds a new one and swaps the pointer.  SigNode and
+ * ClassType pointers from the lookups stay valid until MapReadUnlock(),
+ * CallOutputPlugins() holds the read side around every output function. */
+typedef struct _MapSnapshot
+{
+    SigNode *sigHead;
+    MapArena *arena;            /* holds sigHead and its index */
+    ClassType *classifications;
+    ReferenceSystemNode *references;
+    short sidmap_version;
+
+    ClassType **class_by_id;
+    uint32_t class_max;
+
+    uint64_t generation;        /* published as, then retired at */
+    struct _MapSnapshot *next;  /* retired list */
+} MapSnapshot;
+
 #define SS_SINGLE 0x0001
 #define SS_RANGE  0x0002
 
@@ -126,7 +175,7 @@ ReferenceSystemNode * ReferenceSystemLookup(ReferenceSystemNode *, char *);
 ReferenceNode * AddReference(struct _Barnyard2Config *, ReferenceNode **, char *, char *);
 
 SigNode *GetSigByGidSid(uint32_t, uint32_t, uint32_t);
-SigNode *CreateSigNode(SigNode **,u_int8_t);
+SigNode *CreateSigNode(struct _Barnyard2Config *,const SigNode *,u_int8_t);
 
 ClassType * ClassTypeLookupByType(struct _Barnyard2Config *, char *);
 ClassType * ClassTypeLookupById(struct _Barnyard2Config *, int);
@@ -135,6 +184,7 @@ int ReadReferenceFile(struct _Barnyard2Config *, const char *);
 int ReadClassificationFile(struct _Barnyard2Config *);
 int ReadSidFile(struct _Barnyard2Config *);
 int ReadGenFile(struct _Barnyard2Config *);
+int ReadMapFiles(struct _Barnyard2Config *);
 int SignatureResolveClassification(ClassType *class,SigNode *sig,char *sid_map_file,char *classification_file);
 
 void DeleteReferenceSystems(struct _Barnyard2Config *);
@@ -143,13 +193,24 @@ void DeleteReferences(struct _Barnyard2Config *);
 void ParseReferenceSystemConfig(struct _Barnyard2Config *, char *args);
 void ParseClassificationConfig(struct _Barnyard2Config *, char *args);
 void ParseSidMapLine(struct _Barnyard2Config *, char *);
-void ParseGenMapLine(char *);
+void ParseGenMapLine(struct _Barnyard2Config *, char *);
 
 /* Destructors */
 void FreeSigNodes(SigNode **);
 void FreeClassifications(ClassType **);
 void FreeReferences(ReferenceSystemNode **);
 void FreeSigSuppression(SigSuppress_list **);
+void MapArenaFree(MapArena **);
+
+void MapReadLock(void);
+void MapReadUnlock(void);
+MapSnapshot *MapSnapshotCurrent(void);
+SigNode *MapSigFind(uint32_t, uint32_t, uint32_t);
+void MapPublish(struct _Barnyard2Config *);
+void MapReloadRequest(void);
+void MapReloadStart(void);
+void MapReloadStop(void);
+void MapSnapshotsFree(void);
 
 
 #endif  /* __MAP_H__ */
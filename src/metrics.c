@@ -0,0 +1,573 @@
+/****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/**
+ * @file   metrics.c
+ *
+ * @brief  metrics registry and the listener serving it
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "squirrel.h"
+#include "util.h"
+#include "metrics.h"
+
+#define METRICS_DEFAULT_HOST  "127.0.0.1"
+#define METRICS_POLL_MS       500
+#define METRICS_REQ_TIMEOUT   2
+
+typedef struct _MetricsSource
+{
+    MetricsFunc func;
+    void *arg;
+    struct _MetricsSource *next;
+} MetricsSource;
+
+int metrics_enabled = 0;
+
+static MetricsSource *metrics_sources = NULL;
+static MetricsSource **metrics_tail = &metrics_sources;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t metrics_tid;
+static int metrics_fd = -1;
+static char *metrics_unix_path = NULL;
+static volatile int metrics_stop = 0;
+static time_t metrics_start_time;
+static uint64_t metrics_scrapes = 0;
+
+static void MetricsBuiltin(MetricsBuf *, void *);
+
+/*-------------------------------------------------------------------
+ * MetricsRegister: add a source to every scrape, in registration order
+ *-------------------------------------------------------------------
+ */
+void MetricsRegister (MetricsFunc func, void *arg)
+{
+    MetricsSource *src = (MetricsSource *)SnortAlloc(sizeof(MetricsSource));
+
+    src->func = func;
+    src->arg = arg;
+
+    pthread_mutex_lock(&metrics_lock);
+    *metrics_tail = src;
+    metrics_tail = &src->next;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/*-------------------------------------------------------------------
+ * buffer helpers
+ *-------------------------------------------------------------------
+ */
+void MetricsPrintf (MetricsBuf *buf, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    for ( ; ; )
+    {
+        va_start(ap, fmt);
+        n = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+        va_end(ap);
+
+        if ( n < 0 )
+            return;
+
+        if ( (size_t)n < buf->size - buf->len )
+        {
+            buf->len += n;
+            return;
+        }
+
+        buf->size = (buf->size + n + 1) * 2;
+        buf->data = (char *)realloc(buf->data, buf->size);
+
+        if ( buf->data == NULL )
+            FatalError("metrics: out of memory for a %lu byte scrape\n",
+                (unsigned long)buf->size);
+    }
+}
+
+void MetricsHeader (MetricsBuf *buf, const char *name, const char *type, const char *help)
+{
+    MetricsPrintf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void MetricsSample (MetricsBuf *buf, const char *name, const char *labels, uint64_t v)
+{
+    if ( labels && *labels )
+        MetricsPrintf(buf, "%s{%s} %llu\n", name, labels, (unsigned long long)v);
+    else
+        MetricsPrintf(buf, "%s %llu\n", name, (unsigned long long)v);
+}
+
+void MetricsSampleDouble (MetricsBuf *buf, const char *name, const char *labels, double v)
+{
+    if ( labels && *labels )
+        MetricsPrintf(buf, "%s{%s} %.9g\n", name, labels, v);
+    else
+        MetricsPrintf(buf, "%s %.9g\n", name, v);
+}
+
+/*-------------------------------------------------------------------
+ * MetricsHistogramSample: write h as cumulative buckets; unit scales
+ * the observed values into the exported unit (1e-6 for usecs -> secs)
+ *-------------------------------------------------------------------
+ */
+void MetricsHistogramSample (MetricsBuf *buf, const char *name, const char *labels,
+    const MetricsHistogram *h, double unit)
+{
+    const char *sep = (labels && *labels) ? "," : "";
+    uint64_t cum = 0;
+    int b;
+
+    if ( labels == NULL )
+        labels = "";
+
+    for ( b = 0; b < METRICS_HIST_BUCKETS - 1; b++ )
+    {
+        cum += h->buckets[b];
+        MetricsPrintf(buf, "%s_bucket{%s%sle=\"%.9g\"} %llu\n", name, labels, sep,
+            (double)(1ULL << b) * unit, (unsigned long long)cum);
+    }
+
+    cum += h->buckets[b];
+    MetricsPrintf(buf, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+        (unsigned long long)cum);
+
+    if ( *labels )
+    {
+        MetricsPrintf(buf, "%s_sum{%s} %.9g\n", name, labels, (double)h->sum * unit);
+        MetricsPrintf(buf, "%s_count{%s} %llu\n", name, labels, (unsigned long long)cum);
+    }
+    else
+    {
+        MetricsPrintf(buf, "%s_sum %.9g\n", name, (double)h->sum * unit);
+        MetricsPrintf(buf, "%s_count %llu\n", name, (unsigned long long)cum);
+    }
+}
+
+/*-------------------------------------------------------------------
+ * MetricsBuiltin: process wide counters
+ *-------------------------------------------------------------------
+ */
+static void MetricsBuiltin (MetricsBuf *buf, void *arg)
+{
+    PacketCount stats;
+
+    PacketCountSnapshot(&stats);
+
+    MetricsHeader(buf, "squirrel_start_time_seconds", "gauge",
+        "Unix time the metrics listener was started.");
+    MetricsSample(buf, "squirrel_start_time_seconds", NULL, (uint64_t)metrics_start_time);
+
+    MetricsHeader(buf, "squirrel_metrics_scrapes_total", "counter",
+        "Scrapes served by this listener.");
+    MetricsSample(buf, "squirrel_metrics_scrapes_total", NULL, metrics_scrapes);
+
+    MetricsHeader(buf, "squirrel_records_total", "counter",
+        "Unified2 records read, by outcome.");
+    MetricsSample(buf, "squirrel_records_total", "type=\"record\"", stats.total_records);
+    MetricsSample(buf, "squirrel_records_total", "type=\"event\"", stats.total_events);
+    MetricsSample(buf, "squirrel_records_total", "type=\"packet\"", stats.total_packets);
+    MetricsSample(buf, "squirrel_records_total", "type=\"extra_data\"", stats.total_extra_data);
+    MetricsSample(buf, "squirrel_records_total", "type=\"processed\"", stats.total_processed);
+    MetricsSample(buf, "squirrel_records_total", "type=\"unknown\"", stats.total_unknown);
+    MetricsSample(buf, "squirrel_records_total", "type=\"suppressed\"", stats.total_suppressed);
+
+    MetricsHeader(buf, "squirrel_decoded_packets_total", "counter",
+        "Packets decoded, by protocol.");
+    MetricsSample(buf, "squirrel_decoded_packets_total", "proto=\"eth\"", stats.eth);
+    MetricsSample(buf, "squirrel_decoded_packets_total", "proto=\"vlan\"", stats.vlan);
+    MetricsSample(buf, "squirrel_decoded_packets_total", "proto=\"ip4\"", stats.ip);
+    MetricsSample(buf, "squirrel_decoded_packets_total", "proto=\"ip6\"", stats.ipv6);
+    MetricsSample(buf, "squirrel_decoded_packets_total", "proto=\"tcp\"", stats.tcp + stats.tcp6);
+    MetricsSample(buf, "squirrel_decoded_packets_total", "proto=\"udp\"", stats.udp + stats.udp6);
+    MetricsSample(buf, "squirrel_decoded_packets_total", "proto=\"icmp\"", stats.icmp + stats.icmp6);
+    MetricsSample(buf, "squirrel_decoded_packets_total", "proto=\"arp\"", stats.arp);
+    MetricsSample(buf, "squirrel_decoded_packets_total", "proto=\"frag6\"", stats.frag6);
+    MetricsSample(buf, "squirrel_decoded_packets_total", "proto=\"other\"", stats.other);
+
+    MetricsHeader(buf, "squirrel_discarded_packets_total", "counter",
+        "Packets the decoder could not parse, by protocol.");
+    MetricsSample(buf, "squirrel_discarded_packets_total", "proto=\"eth\"", stats.ethdisc);
+    MetricsSample(buf, "squirrel_discarded_packets_total", "proto=\"ip4\"", stats.ipdisc);
+    MetricsSample(buf, "squirrel_discarded_packets_total", "proto=\"ip6\"", stats.ipv6disc);
+    MetricsSample(buf, "squirrel_discarded_packets_total", "proto=\"tcp\"", stats.tdisc);
+    MetricsSample(buf, "squirrel_discarded_packets_total", "proto=\"udp\"", stats.udisc);
+    MetricsSample(buf, "squirrel_discarded_packets_total", "proto=\"icmp\"", stats.icmpdisc);
+}
+
+/*-------------------------------------------------------------------
+ * MetricsCollect: run every source into buf
+ *-------------------------------------------------------------------
+ */
+static void MetricsCollect (MetricsBuf *buf)
+{
+    MetricsSource *src;
+
+    buf->len = 0;
+    if ( buf->data )
+        buf->data[0] = '\0';
+
+    metrics_scrapes++;
+
+    MetricsBuiltin(buf, NULL);
+
+    pthread_mutex_lock(&metrics_lock);
+    for ( src = metrics_sources; src; src = src->next )
+        src->func(buf, src->arg);
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+/*-------------------------------------------------------------------
+ * MetricsWriteAll: write n bytes, giving up on a stalled client
+ *-------------------------------------------------------------------
+ */
+static int MetricsWriteAll (int fd, const char *p, size_t n)
+{
+    ssize_t w;
+
+    while ( n > 0 )
+    {
+        w = send(fd, p, n, MSG_NOSIGNAL);
+
+        if ( w < 0 && errno == EINTR )
+            continue;
+
+        if ( w <= 0 )
+            return -1;
+
+        p += w;
+        n -= w;
+    }
+
+    return 0;
+}
+
+/*-------------------------------------------------------------------
+ * MetricsServe: answer one connection.  Anything that starts like an
+ * HTTP request gets an HTTP/1.0 response, a bare connect just gets
+ * the text (so "nc -U <path>" works).
+ *-------------------------------------------------------------------
+ */
+static void MetricsServe (int fd, MetricsBuf *buf)
+{
+    struct timeval tv = { METRICS_REQ_TIMEOUT, 0 };
+    struct pollfd pfd;
+    char req[1024];
+    char head[256];
+    size_t rlen = 0;
+    ssize_t r;
+    int http = 0;
+    int head_only = 0;
+    int n;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    /* a client that says nothing for a moment is a bare reader */
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    if ( poll(&pfd, 1, 100) > 0 )
+    {
+        /* read the request head, we only care about its first line */
+        while ( rlen < sizeof(req) - 1 )
+        {
+            r = recv(fd, req + rlen, sizeof(req) - 1 - rlen, 0);
+
+            if ( r < 0 && errno == EINTR )
+                continue;
+
+            if ( r <= 0 )
+                break;
+
+            rlen += r;
+            req[rlen] = '\0';
+
+            if ( strstr(req, "\r\n\r\n") || strstr(req, "\n\n") )
+                break;
+        }
+        req[rlen] = '\0';
+
+        if ( strncmp(req, "GET ", 4) == 0 )
+            http = 1;
+        else if ( strncmp(req, "HEAD ", 5) == 0 )
+            http = head_only = 1;
+        else if ( rlen > 0 && strchr(req, ' ') && strstr(req, "HTTP/") )
+        {
+            n = snprintf(head, sizeof(head),
+                "HTTP/1.0 405 Method Not Allowed\r\n"
+                "Allow: GET, HEAD\r\n"
+                "Content-Length: 0\r\n"
+                "Connection: close\r\n\r\n");
+            MetricsWriteAll(fd, head, n);
+            return;
+        }
+    }
+
+    MetricsCollect(buf);
+
+    if ( http )
+    {
+        n = snprintf(head, sizeof(head),
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %lu\r\n"
+            "Connection: close\r\n\r\n",
+            (unsigned long)buf->len);
+
+        if ( MetricsWriteAll(fd, head, n) || head_only )
+            return;
+    }
+
+    MetricsWriteAll(fd, buf->data, buf->len);
+}
+
+/*-------------------------------------------------------------------
+ * MetricsThread: accept loop, one scrape at a time
+ *-------------------------------------------------------------------
+ */
+static void *MetricsThread (void *arg)
+{
+    MetricsBuf buf;
+    struct pollfd pfd;
+    sigset_t mask;
+    int fd;
+
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    memset(&buf, 0, sizeof(buf));
+    buf.size = 16384;
+    buf.data = (char *)SnortAlloc(buf.size);
+
+    pfd.fd = metrics_fd;
+    pfd.events = POLLIN;
+
+    while ( !metrics_stop )
+    {
+        if ( poll(&pfd, 1, METRICS_POLL_MS) <= 0 )
+            continue;
+
+        fd = accept(metrics_fd, NULL, NULL);
+
+        if ( fd < 0 )
+            continue;
+
+        MetricsServe(fd, &buf);
+        close(fd);
+    }
+
+    free(buf.data);
+    return NULL;
+}
+
+/*-------------------------------------------------------------------
+ * MetricsListen: open the listening socket for spec
+ *-------------------------------------------------------------------
+ */
+static int MetricsListen (const char *spec)
+{
+    int fd = -1;
+    int one = 1;
+
+    if ( strncasecmp(spec, "unix:", 5) == 0 )
+    {
+        struct sockaddr_un sun;
+        const char *path = spec + 5;
+
+        if ( *path == '\0' || strlen(path) >= sizeof(sun.sun_path) )
+        {
+            ErrorMessage("metrics: bad unix socket path \"%s\"\n", path);
+            return -1;
+        }
+
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+
+        /* a socket left behind by an earlier run */
+        unlink(path);
+
+        if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+             bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+             listen(fd, 8) < 0 )
+        {
+            ErrorMessage("metrics: unable to listen on %s: %s\n", path, strerror(errno));
+            if ( fd >= 0 )
+                close(fd);
+            return -1;
+        }
+
+        metrics_unix_path = SnortStrdup(path);
+    }
+    else
+    {
+        struct addrinfo hints, *res = NULL;
+        char host[256];
+        const char *port = spec;
+        const char *colon = strrchr(spec, ':');
+        int rval;
+
+        strncpy(host, METRICS_DEFAULT_HOST, sizeof(host));
+
+        if ( colon )
+        {
+            size_t hlen = colon - spec;
+
+            if ( hlen >= sizeof(host) )
+                hlen = sizeof(host) - 1;
+
+            /* [v6addr]:port */
+            if ( hlen >= 2 && spec[0] == '[' && spec[hlen - 1] == ']' )
+            {
+                memcpy(host, spec + 1, hlen - 2);
+                host[hlen - 2] = '\0';
+            }
+            else
+            {
+                memcpy(host, spec, hlen);
+                host[hlen] = '\0';
+            }
+
+            port = colon + 1;
+        }
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+        if ( (rval = getaddrinfo(host, port, &hints, &res)) != 0 )
+        {
+            ErrorMessage("metrics: bad listen address \"%s\": %s\n", spec, gai_strerror(rval));
+            return -1;
+        }
+
+        if ( (fd = socket(res->ai_family, SOCK_STREAM, 0)) < 0 ||
+             setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+             bind(fd, res->ai_addr, res->ai_addrlen) < 0 ||
+             listen(fd, 8) < 0 )
+        {
+            ErrorMessage("metrics: unable to listen on %s: %s\n", spec, strerror(errno));
+            if ( fd >= 0 )
+                close(fd);
+            freeaddrinfo(res);
+            return -1;
+        }
+
+        freeaddrinfo(res);
+    }
+
+    return fd;
+}
+
+/*-------------------------------------------------------------------
+ * MetricsStart: start the listener if "config metrics" was given.
+ * Called before privileges are dropped so low ports and socket paths
+ * under /var/run work.
+ *-------------------------------------------------------------------
+ */
+void MetricsStart (const char *spec)
+{
+    if ( spec == NULL || metrics_enabled )
+        return;
+
+    if ( (metrics_fd = MetricsListen(spec)) < 0 )
+    {
+        ErrorMessage("metrics: listener disabled\n");
+        return;
+    }
+
+    metrics_stop = 0;
+    metrics_start_time = time(NULL);
+
+    if ( pthread_create(&metrics_tid, NULL, MetricsThread, NULL) )
+    {
+        ErrorMessage("metrics: unable to start the listener thread\n");
+        close(metrics_fd);
+        metrics_fd = -1;
+        return;
+    }
+
+    metrics_enabled = 1;
+    LogMessage("metrics: serving on %s\n", spec);
+}
+
+/*-------------------------------------------------------------------
+ * MetricsStop: stop the listener and forget every source; plugins
+ * register again when they are re-initialised after a restart.
+ *-------------------------------------------------------------------
+ */
+void MetricsStop (void)
+{
+    MetricsSource *src, *next;
+
+    if ( metrics_enabled )
+    {
+        metrics_stop = 1;
+        pthread_join(metrics_tid, NULL);
+        metrics_enabled = 0;
+
+        close(metrics_fd);
+        metrics_fd = -1;
+
+        if ( metrics_unix_path )
+        {
+            unlink(metrics_unix_path);
+            free(metrics_unix_path);
+            metrics_unix_path = NULL;
+        }
+
+        LogMessage("metrics: %llu scrapes served\n", (unsigned long long)metrics_scrapes);
+    }
+
+    pthread_mutex_lock(&metrics_lock);
+    for ( src = metrics_sources; src; src = next )
+    {
+        next = src->next;
+        free(src);
+    }
+    metrics_sources = NULL;
+    metrics_tail = &metrics_sources;
+    pthread_mutex_unlock(&metrics_lock);
+}
@@ -0,0 +1,93 @@
+/****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/**
+ * @file   metrics.h
+ *
+ * @brief  live metrics in the Prometheus text format
+ *
+ * "config metrics: <[addr:]port|unix:path>" starts a listener thread
+ * that answers every connection (HTTP GET or a bare connect) with the
+ * current metrics.  Nothing is computed ahead of a scrape: each part of
+ * squirrel registers a MetricsFunc that reads its own counters and
+ * writes them out with the Metrics*() helpers when asked.
+ *
+ * Counters written from a hot path should be plain per-thread (or
+ * single writer) uint64_t's; the scrape reads them without locking.
+ * MetricsHistogram is the exception, it may be updated from several
+ * threads.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* power of 2 buckets, 1 to 2^(n-2) of the observed unit, then +Inf */
+#define METRICS_HIST_BUCKETS  26
+
+typedef struct _MetricsHistogram
+{
+    uint64_t buckets[METRICS_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+} MetricsHistogram;
+
+typedef struct _MetricsBuf
+{
+    char *data;
+    size_t len;
+    size_t size;
+} MetricsBuf;
+
+typedef void (*MetricsFunc)(MetricsBuf *, void *);
+
+/* set while a listener is running, for code that times itself */
+extern int metrics_enabled;
+
+void MetricsRegister(MetricsFunc, void *);
+void MetricsStart(const char *);
+void MetricsStop(void);
+
+void MetricsPrintf(MetricsBuf *, const char *, ...);
+void MetricsHeader(MetricsBuf *, const char *name, const char *type, const char *help);
+void MetricsSample(MetricsBuf *, const char *name, const char *labels, uint64_t);
+void MetricsSampleDouble(MetricsBuf *, const char *name, const char *labels, double);
+void MetricsHistogramSample(MetricsBuf *, const char *name, const char *labels,
+    const MetricsHistogram *, double unit);
+
+/*-------------------------------------------------------------------
+ * MetricsObserve: count v (in the histogram's unit) in its bucket
+ *-------------------------------------------------------------------
+ */
+static inline void MetricsObserve (MetricsHistogram *h, uint64_t v)
+{
+    int b = 0;
+
+    while ( b < METRICS_HIST_BUCKETS - 1 && v > (1ULL << b) )
+        b++;
+
+    __sync_fetch_and_add(&h->buckets[b], 1);
+    __sync_fetch_and_add(&h->count, 1);
+    __sync_fetch_and_add(&h->sum, v);
+}
+
+#endif /* __METRICS_H__ */
+
@@ -430,7 +430,7 @@ char **mSplitSpecial(char *str, const char *sep, int max_toks,
     end = str + strlen(str);
 
     /* remove trailing whitespace */
-    while(isspace((int) *(end - 1)) && ((end - 1) >= str))
+    while(((end - 1) >= str) && isspace((int) *(end - 1)))
         *(--end) = '\0';    /* -1 because of NULL */
 
     /* set our indexing pointers */
@@ -638,8 +638,10 @@ static char * mSplitAddTok(const char *str, const int len, const char *sep_chars
         tok_len++;
     }
 
-    /* Allocate it and fill it in */
+    /* Allocate it and fill it in.  A trailing meta char left got_meta
+     * set, and was not counted */
     tok = (char *)SnortAlloc(tok_len + 1);
+    got_meta = 0;
     for (i = 0, k = 0; (int)i < len; i++)
     {
         if (!got_meta)
@@ -710,6 +712,305 @@ void mSplitFree(char ***pbuf, int num_toks)
     *pbuf = NULL;
 }
 
+/****************************************************************
+ *
+ *  Function: mSplitSpan()
+ *
+ *  Purpose: Splits a string into tokens as mSplit() does, without
+ *           allocating.  The tokens are views into the string.
+ *
+ *  Parameters:
+ *      char *str => the string to be split, need not be NUL terminated
+ *      size_t len => its length
+ *      char *sep_chars => the separator characters, NULL for whitespace
+ *      int max_toks => as for mSplit(), 0 for as many as toks holds
+ *      MSpan *toks => where the tokens go
+ *      int toks_size => how many toks holds
+ *      char meta_char => the "escape metacharacter", as for mSplit()
+ *      int flags => MSPLIT_TERMINATE to NUL terminate each token in
+ *                   place, taking the escape characters out of it as
+ *                   mSplit() does; str[len] must then be writable
+ *
+ *  Without MSPLIT_TERMINATE str is not written to, and tokens keep
+ *  their escape characters (mSpanDup() takes them out).  With it, str
+ *  is only written to once the split has succeeded.
+ *
+ *  Returns:
+ *      the number of tokens, 0 where mSplit() would return NULL, -1
+ *      if there are more than toks_size
+ *
+ ****************************************************************/
+static INLINE int mSplitSpanIsSep(const char c, const char *sep_chars, size_t sep_len)
+{
+    size_t i;
+
+    /* one or two separators, a call to memchr() costs more */
+    for (i = 0; i < sep_len; i++)
+    {
+        if (sep_chars[i] == c)
+            return 1;
+    }
+
+    return 0;
+}
+
+int mSplitSpan(char *str, size_t len, const char *sep_chars, const int max_toks,
+               MSpan *toks, const int toks_size, const char meta_char, const int flags)
+{
+    size_t sep_len, tok_start, i, j, k;
+    int cur_tok = 0;
+    int escaped = 0;
+    int rest = 0;       /* the last tok is the rest of the string */
+    char c;
+
+    if ((str == NULL) || (len == 0) || (toks == NULL) || (toks_size < 1) ||
+        ((sep_chars != NULL) && (*sep_chars == '\0')))
+    {
+        return 0;
+    }
+
+    if (sep_chars == NULL)
+        sep_chars = " \t";
+
+    sep_len = strlen(sep_chars);
+
+    /* Meta char cannot also be a separator char */
+    if (mSplitSpanIsSep(meta_char, sep_chars, sep_len))
+        return 0;
+
+    /* Move past initial separator characters and whitespace */
+    for (i = 0; i < len; i++)
+    {
+        if (!mSplitSpanIsSep(str[i], sep_chars, sep_len) && !isspace((int)str[i]))
+            break;
+    }
+
+    if (i == len)
+        return 0;
+
+    /* Only one tok wanted, it is the rest of the string as it is */
+    if (max_toks == 1)
+    {
+        toks[0].ptr = &str[i];
+        toks[0].len = len - i;
+        cur_tok = 1;
+        rest = 1;
+        goto done;
+    }
+
+    tok_start = i;
+    for (; i < len; i++)
+    {
+        if (escaped)
+        {
+            escaped = 0;
+            continue;
+        }
+
+        if (str[i] == meta_char)
+        {
+            escaped = 1;
+            continue;
+        }
+
+        if (!mSplitSpanIsSep(str[i], sep_chars, sep_len))
+            continue;
+
+        /* Trim off whitespace previous to the separator */
+        for (j = i; j > tok_start; j--)
+        {
+            if (!isspace((int)str[j - 1]))
+                break;
+        }
+
+        if (cur_tok == toks_size)
+            return -1;
+
+        toks[cur_tok].ptr = &str[tok_start];
+        toks[cur_tok].len = j - tok_start;
+        cur_tok++;
+
+        /* Move past any more separator characters or whitespace */
+        for (; i < len; i++)
+        {
+            if (!mSplitSpanIsSep(str[i], sep_chars, sep_len) && !isspace((int)str[i]))
+                break;
+        }
+
+        if (i == len)
+            goto done;
+
+        if ((max_toks != 0) && ((cur_tok + 1) == max_toks))
+        {
+            /* Rest of string as last tok, trailing whitespace trimmed */
+            for (j = len; j > i; j--)
+            {
+                if (!isspace((int)str[j - 1]))
+                    break;
+            }
+
+            if (cur_tok == toks_size)
+                return -1;
+
+            toks[cur_tok].ptr = &str[i];
+            toks[cur_tok].len = j - i;
+            cur_tok++;
+            rest = 1;
+            goto done;
+        }
+
+        /* the loop steps over the first character, as mSplit() does */
+        tok_start = i;
+    }
+
+    /* Last character was an escape character */
+    if (escaped)
+        return 0;
+
+    /* Trim whitespace at end of last tok */
+    for (j = len; j > tok_start; j--)
+    {
+        if (!isspace((int)str[j - 1]))
+            break;
+    }
+
+    if (cur_tok == toks_size)
+        return -1;
+
+    toks[cur_tok].ptr = &str[tok_start];
+    toks[cur_tok].len = j - tok_start;
+    cur_tok++;
+
+done:
+    if (flags & MSPLIT_TERMINATE)
+    {
+        for (i = 0; i < (size_t)cur_tok; i++)
+        {
+            /* escapes come out of every tok but the rest of the string */
+            if (!rest || (i + 1 < (size_t)cur_tok))
+            {
+                for (j = 0, k = 0, escaped = 0; j < toks[i].len; j++)
+                {
+                    c = toks[i].ptr[j];
+
+                    if (!escaped)
+                    {
+                        if (c == meta_char)
+                        {
+                            escaped = 1;
+                            continue;
+                        }
+                    }
+                    else
+                    {
+                        /* the meta char stays before a non-separator */
+                        if (!mSplitSpanIsSep(c, sep_chars, sep_len))
+                            toks[i].ptr[k++] = meta_char;
+
+                        escaped = 0;
+                    }
+
+                    toks[i].ptr[k++] = c;
+                }
+
+                toks[i].len = k;
+            }
+
+            toks[i].ptr[toks[i].len] = '\0';
+        }
+    }
+
+    return cur_tok;
+}
+
+/****************************************************************
+ *
+ *  Function: mSplitSpecialSpan()
+ *
+ *  Purpose: The tokens mSplitSpecial() would return, with no escape
+ *           metacharacter, as views into the string.  str is not
+ *           written to and need not be NUL terminated.
+ *
+ *  Parameters:
+ *      char *str => the string to be split
+ *      size_t len => its length
+ *      char *sep => the token separator
+ *      int max_toks => how many tokens toks holds, the last takes
+ *                      the rest of the string
+ *      MSpan *toks => where the tokens go
+ *
+ *  Returns:
+ *      the number of tokens
+ *
+ ****************************************************************/
+int mSplitSpecialSpan(const char *str, size_t len, const char *sep,
+                      int max_toks, MSpan *toks)
+{
+    const char *idx = str, *end = str + len;
+    size_t sep_len = strlen(sep), tok_len = 0;
+    int cur = 0;
+
+    if ((str == NULL) || (toks == NULL) || (max_toks < 1))
+        return 0;
+
+    /* remove trailing whitespace */
+    while ((end > str) && isspace((int)*(end - 1)))
+        end--;
+
+    max_toks--;
+
+    while (idx < end)
+    {
+        /* a separator only counts with something after it */
+        if ((*idx == *sep) && (idx + sep_len < end) &&
+            (strncmp(idx, sep, sep_len) == 0))
+        {
+            if (tok_len > 0)
+            {
+                toks[cur].ptr = (char *)(idx - tok_len);
+                toks[cur].len = tok_len;
+                cur++;
+                idx += sep_len;
+
+                if (cur >= max_toks)
+                {
+                    while ((idx < end) && isspace((int)*idx))
+                        idx++;
+
+                    toks[cur].ptr = (char *)idx;
+                    toks[cur].len = end - idx;
+                    return cur + 1;
+                }
+            }
+            else
+            {
+                idx += sep_len;
+            }
+
+            tok_len = 0;
+        }
+
+        /* the character after a separator always starts the next token */
+        tok_len++;
+        idx++;
+    }
+
+    if (tok_len > 0)
+    {
+        toks[cur].ptr = (char *)(idx - tok_len);
+        toks[cur].len = tok_len;
+        cur++;
+    }
+
+    return cur;
+}
+
+/* a copy of a token from mSplitSpan(), escapes taken out as mSplit() does */
+char *mSpanDup(const MSpan *tok, const char *sep_chars, const char meta_char)
+{
+    return mSplitAddTok(tok->ptr, (int)tok->len, (sep_chars != NULL) ? sep_chars : " \t", meta_char);
+}
+
 /****************************************************************
  *
  *  Function: mContainsSubstr(char *, int, char *, int)
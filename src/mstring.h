@@ -23,14 +23,29 @@
 #ifndef __MSTRING_H__
 #define __MSTRING_H__
 
+#include <stddef.h>
+
 /*  D E F I N E S  *******************************************************/
 #define TOKS_BUF_SIZE   100
 
+#define MSPLIT_TERMINATE    0x01    /* NUL terminate the tokens in place */
+
+/*  D A T A   S T R U C T U R E S  ***************************************/
+/* a token as a view into the string it was split from */
+typedef struct _MSpan
+{
+    char *ptr;
+    size_t len;
+} MSpan;
+
 
 /*  P R O T O T Y P E S  *************************************************/
 char ** mSplit(const char *, const char *, const int, int *, const char);
 char **mSplitSpecial(char *, const char *, int, int *, const char);
 void mSplitFree(char ***toks, int numtoks);
+int mSplitSpan(char *, size_t, const char *, const int, MSpan *, const int, const char, const int);
+int mSplitSpecialSpan(const char *, size_t, const char *, int, MSpan *);
+char *mSpanDup(const MSpan *, const char *, const char);
 int mContainsSubstr(const char *, int, const char *, int);
 int mSearch(const char *, int, const char *, int, int *, int *);
 int mSearchCI(const char *, int, const char *, int, int *, int *);
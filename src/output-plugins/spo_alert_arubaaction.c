@@ -20,17 +20,21 @@
 /* $Id$ */
 
 /* spo_alert_arubaaction
- * 
+ *
  * Purpose: output plugin for dynamically changing station access status on
  *          an Aruba switch.
  *
- * Arguments:  switch secret_type secret action
+ * Arguments:  switch secret_type secret action [window=<secs>] [batch=<n>]
  * 	switch		IP address of the Aruba switch
  * 	secret_type	How secret is represented, one of "sha1", "md5" or
  * 			"cleartext"
  *	secret		The shared secret configured on the Aruba switch
  *	action		The action the switch should take with the target user
- *   
+ *	window		Seconds a host is not actioned again after the switch
+ *			accepted it (default 60, 0 sends every alert)
+ *	batch		Most commands written to the switch before reading
+ *			the answers (default 8, 1 waits for every answer)
+ *
  * Effect:
  *
  * When an alert is passed to this output plugin, the plugin connects to the
@@ -39,6 +43,12 @@
  * administrator to establish rules that will dynamically blacklist a user,
  * allowing the administrator to define rules that take action based on the
  * power of the Snort rules language.
+ *
+ * Alerts only queue the source address; a worker thread keeps one HTTP/1.1
+ * keep-alive connection to the switch and pipelines whatever is queued,
+ * reconnecting when the switch closes it.  The XML API takes a single
+ * address per command, so a burst of alerts becomes a burst of requests on
+ * one connection rather than a connection per alert.
  */
 
 /* output plugin header file */
@@ -63,6 +73,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
 
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
@@ -70,12 +84,36 @@
 
 #ifndef WIN32
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #endif /* !WIN32 */
 
 #include <sys/types.h>
 
+#define MAX_XML_PAYLOAD_LEN 512
+#define MAX_POST_LEN 1024
+#define MAX_RESPONSE_LEN 4096
+
+#define ARUBA_PORT 80
+#define ARUBA_TIMEOUT 5			/* connect/send/recv, seconds */
+#define ARUBA_ADDR_LEN 46		/* INET6_ADDRSTRLEN */
+#define ARUBA_QUEUE_SIZE 1024
+#define ARUBA_RECENT_SIZE 4096		/* power of 2 */
+#define ARUBA_WINDOW 60
+#define ARUBA_BATCH 8
+#define ARUBA_BATCH_MAX 64
+#define ARUBA_RETRY_MIN 1
+#define ARUBA_RETRY_MAX 60
+
+/* a host recently handed to the switch, direct mapped by address */
+typedef struct _ArubaRecent
+{
+	char		addr[ARUBA_ADDR_LEN];
+	time_t		when;
+	uint8_t		pending;		/* queued, switch hasn't answered */
+} ArubaRecent;
+
 typedef struct _SpoAlertArubaActionData
 {
 	char		*secret;
@@ -88,12 +126,43 @@ typedef struct _SpoAlertArubaActionData
 	struct in_addr aswitch;
 #endif
 	int		fd;
-} SpoAlertArubaActionData;
-
 
-#define MAX_XML_PAYLOAD_LEN 512
-#define MAX_POST_LEN 1024
-#define MAX_RESPONSE_LEN MAX_POST_LEN
+	char		host[ARUBA_ADDR_LEN];	/* switch address as text */
+	char		*http_head;		/* request line and fixed headers */
+	char		*xml_head;		/* command up to <ipaddr> */
+	char		*xml_tail;		/* </ipaddr> through </aruba> */
+	size_t		xml_len;		/* head + tail */
+
+	time_t		window;
+	int		batch;
+	ArubaRecent	*recent;
+
+	/* alerts -> worker */
+	pthread_t	worker_tid;
+	pthread_mutex_t	queue_lock;
+	pthread_cond_t	queue_cond;
+	char		queue[ARUBA_QUEUE_SIZE][ARUBA_ADDR_LEN];
+	uint32_t	queue_head;
+	uint32_t	queue_cnt;
+	int		worker_on;
+	int		stop;
+	int		queue_full;
+
+	/* worker only */
+	char		*post;
+	char		response[MAX_RESPONSE_LEN];
+	size_t		response_len;
+
+	/* alert side counters are guarded by queue_lock */
+	uint32_t	alerts;
+	uint32_t	deduped;
+	uint32_t	dropped;
+	uint32_t	sent;
+	uint32_t	refused;
+	uint32_t	requests;
+	uint32_t	connects;
+	uint32_t	batches;
+} SpoAlertArubaActionData;
 
 typedef struct _ArubaSecretType {
 	uint8_t	type;
@@ -126,7 +195,7 @@ const ArubaActionType action_lookup[] = {
 };
 
 
-#define ArubaResponseCode ArubaSecretType 
+#define ArubaResponseCode ArubaSecretType
 
 #define ARUBA_RESP_SUCCESS 0
 #define ARUBA_RESP_UNKN_USER 1
@@ -145,7 +214,7 @@ const ArubaResponseCode response_lookup[] = {
 	{ ARUBA_RESP_UNKN_EXT_AGENT,   "unknown external agent" },
 	{ ARUBA_RESP_AUTH_FAILED,      "authentication failed" },
 	{ ARUBA_RESP_INVAL_CMD,        "invalid command" },
-	{ ARUBA_RESP_INVAL_AUTH_METHOD, 
+	{ ARUBA_RESP_INVAL_AUTH_METHOD,
 			"invalid message authentication method" },
 	{ ARUBA_RESP_INVAL_MSG_DGST,   "invalid message digest" },
 	{ ARUBA_RESP_MSSNG_MSG_AUTH,   "missing message authentication" },
@@ -158,14 +227,18 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *);
 void AlertArubaActionCleanExitFunc(int, void *);
 void AlertArubaActionRestartFunc(int, void *);
 void AlertArubaAction(Packet *, void *, uint32_t, void *);
+void *ArubaActionWorker(void *);
 int ArubaSwitchConnect(SpoAlertArubaActionData *data);
+void ArubaSwitchClose(SpoAlertArubaActionData *data);
+int ArubaSwitchPost(SpoAlertArubaActionData *data, char (*hosts)[ARUBA_ADDR_LEN],
+		uint8_t *accepted, int cnt);
 int ArubaSwitchSend(SpoAlertArubaActionData *data, uint8_t *post, int len);
-int ArubaSwitchRecv(SpoAlertArubaActionData *data, uint8_t *recv, int maxlen);
+int ArubaSwitchRecv(SpoAlertArubaActionData *data, int *code, int *keepalive);
 
 /*
  * Function: SetupAlertArubaAction()
  *
- * Purpose: Registers the output plugin keyword and initialization 
+ * Purpose: Registers the output plugin keyword and initialization
  *          function into the output plugin list.  This is the function that
  *          gets called from InitOutputPlugins() in plugbase.c.
  *
@@ -176,7 +249,7 @@ int ArubaSwitchRecv(SpoAlertArubaActionData *data, uint8_t *recv, int maxlen);
  */
 void AlertArubaActionSetup(void)
 {
-	/* link the preprocessor keyword to the init function in 
+	/* link the preprocessor keyword to the init function in
 	   the preproc list */
     RegisterOutputPlugin("alert_aruba_action", OUTPUT_TYPE_FLAG__ALERT,
                          AlertArubaActionInit);
@@ -200,6 +273,7 @@ void AlertArubaActionSetup(void)
 void AlertArubaActionInit(char *args)
 {
 	SpoAlertArubaActionData *data;
+	int err;
 
 	DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Output: AlertArubaAction "
 			"Initialized\n"););
@@ -207,326 +281,570 @@ void AlertArubaActionInit(char *args)
 	/* parse the argument list from the rules file */
 	data = ParseAlertArubaActionArgs(args);
 
+	data->fd = -1;
+	data->post = (char *)SnortAlloc(data->batch * MAX_POST_LEN);
+
+	if (data->window)
+		data->recent = (ArubaRecent *)SnortAlloc(ARUBA_RECENT_SIZE *
+				sizeof(ArubaRecent));
+
+	pthread_mutex_init(&data->queue_lock, NULL);
+	pthread_cond_init(&data->queue_cond, NULL);
+
+	err = pthread_create(&data->worker_tid, NULL, ArubaActionWorker, data);
+	if (err != 0) {
+		FatalError("aruba_action: Can't create worker thread: [%s]\n",
+				strerror(err));
+	}
+	data->worker_on = 1;
+
 	DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Linking AlertArubaAction functions "
 			"to call lists...\n"););
-	
+
 	/* Set the preprocessor function into the function list */
 	AddFuncToOutputList(AlertArubaAction, OUTPUT_TYPE__ALERT, data);
 	AddFuncToCleanExitList(AlertArubaActionCleanExitFunc, data);
 	AddFuncToRestartList(AlertArubaActionRestartFunc, data);
 }
 
-void AlertArubaAction(Packet *p, void *event, uint32_t event_type, void *arg)
+/*
+ * Function: ArubaRecentHash(char *)
+ *
+ * Purpose: FNV-1a over the address text, picks the slot in the recent
+ *          host table.
+ */
+static uint32_t ArubaRecentHash(const char *addr)
 {
-	char cmdbuf[MAX_XML_PAYLOAD_LEN], post[MAX_POST_LEN];
-	char response[MAX_RESPONSE_LEN];
-	char *cmdbufp, *responsecode, *responsemsg;
-	int postlen, xmllenrem, i, responsecodei;
+	uint32_t h = 2166136261u;
 
-	if ( p == NULL || arg == NULL )
-	{
-		return;
+	while (*addr) {
+		h ^= (uint8_t)*addr++;
+		h *= 16777619u;
 	}
 
-	SpoAlertArubaActionData *data = (SpoAlertArubaActionData *)arg;
-	cmdbufp = cmdbuf;
+	return h & (ARUBA_RECENT_SIZE - 1);
+}
 
-	/* Establish a connection to the switch */
-	data->fd = ArubaSwitchConnect(data);
-	if (data->fd < 0) {
-		ErrorMessage("Unable to connect to Aruba switch at %s\n",
-#ifdef SUP_IP6
-				inet_ntoa(&data->aswitch));
-#else
-				inet_ntoa(data->aswitch));
-#endif
+/*
+ * Function: ArubaRecentSeen(SpoAlertArubaActionData *, char *, time_t)
+ *
+ * Purpose: Tells whether addr is still queued for the switch, or was
+ *          accepted by it within the window.  The table is direct mapped,
+ *          so a colliding host only costs a repeated (harmless) command.
+ *          Called with queue_lock held.
+ */
+static int ArubaRecentSeen(SpoAlertArubaActionData *data, const char *addr,
+		time_t now)
+{
+	ArubaRecent *r;
+
+	if (data->recent == NULL)
+		return 0;
+
+	r = &data->recent[ArubaRecentHash(addr)];
+
+	return r->when && (r->pending || now - r->when < data->window) &&
+			strcmp(r->addr, addr) == 0;
+}
+
+/*
+ * Function: ArubaRecentQueued(SpoAlertArubaActionData *, char *, time_t)
+ *
+ * Purpose: Remembers addr once it is queued; the window counts from the
+ *          alert.  Called with queue_lock held.
+ */
+static void ArubaRecentQueued(SpoAlertArubaActionData *data, const char *addr,
+		time_t now)
+{
+	ArubaRecent *r;
+
+	if (data->recent == NULL)
 		return;
-	}
 
-	xmllenrem = MAX_XML_PAYLOAD_LEN;
+	r = &data->recent[ArubaRecentHash(addr)];
 
-	switch(data->action_type) {
-		case ARUBA_ACTION_BLACKLIST:
-		snprintf(cmdbufp, xmllenrem, "xml=<aruba "
-				"command=user_blacklist>");
-		break;
+	strncpy(r->addr, addr, ARUBA_ADDR_LEN - 1);
+	r->addr[ARUBA_ADDR_LEN - 1] = '\0';
+	r->when = now;
+	r->pending = 1;
+}
 
-		case ARUBA_ACTION_SETROLE:
-		snprintf(cmdbufp, xmllenrem, "xml=<aruba command=user_add>"
-				"<role>%s</role>", data->role_name);
-		break;
+/*
+ * Function: ArubaRecentDone(SpoAlertArubaActionData *, char *, int)
+ *
+ * Purpose: Settles a queued addr.  Only a host the switch accepted is
+ *          suppressed for the rest of the window, a refused or dropped
+ *          one may be sent again by the next alert.  Called with
+ *          queue_lock held.
+ */
+static void ArubaRecentDone(SpoAlertArubaActionData *data, const char *addr,
+		int accepted)
+{
+	ArubaRecent *r;
 
-		default: /* The parser prevents this from happening */
-		ErrorMessage("aruba_action: invalid action type specified");
+	if (data->recent == NULL)
 		return;
-		break;
-	}
 
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+	r = &data->recent[ArubaRecentHash(addr)];
 
-	if (xmllenrem < 1) {
-		ErrorMessage("aruba_action: configuration parameters too "
-				"long\n");
-		FatalError("Unable to parse configuration parameters for Aruba"
-				"Action output plugin.\n");
+	if (!r->pending || strcmp(r->addr, addr) != 0)
 		return;
-	}
 
-	snprintf(cmdbufp, xmllenrem, "<ipaddr>%s</ipaddr>",
-			inet_ntoa(GET_SRC_ADDR(p)));
+	r->pending = 0;
 
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+	if (!accepted)
+		r->when = 0;
+}
 
-	if (xmllenrem < 1) {
-		ErrorMessage("aruba_action: configuration parameters too "
-				"long\n");
-		FatalError("Unable to parse configuration parameters for Aruba"
-				"Action output plugin.\n");
+void AlertArubaAction(Packet *p, void *event, uint32_t event_type, void *arg)
+{
+	SpoAlertArubaActionData *data;
+	char addr[ARUBA_ADDR_LEN];
+	uint32_t slot;
+
+	if ( p == NULL || arg == NULL )
+	{
 		return;
 	}
 
-	switch(data->secret_type) {
-		case ARUBA_SECRET_SHA1:
-		snprintf(cmdbufp, xmllenrem, "<authentication>sha-1"
-				"</authentication>");
-		break;
+	data = (SpoAlertArubaActionData *)arg;
 
-		case ARUBA_SECRET_MD5:
-		snprintf(cmdbufp, xmllenrem, "<authentication>md5"
-				"</authentication>");
-		break;
+	strncpy(addr, inet_ntoa(GET_SRC_ADDR(p)), ARUBA_ADDR_LEN - 1);
+	addr[ARUBA_ADDR_LEN - 1] = '\0';
 
-		case ARUBA_SECRET_PLAIN:
-		snprintf(cmdbufp, xmllenrem, "<authentication>cleartext"
-				"</authentication>");
-		break;
+	pthread_mutex_lock(&data->queue_lock);
+	data->alerts++;
 
-		default: /* The parser prevents this from happening */
-		ErrorMessage("aruba_action: invalid secret type specified");
-		return;
-		break;
+	if (ArubaRecentSeen(data, addr, p->pkth->ts.tv_sec)) {
+		data->deduped++;
+	}
+	else if (data->queue_cnt == ARUBA_QUEUE_SIZE) {
+		/* the switch is not keeping up (or not answering) */
+		if (!data->queue_full) {
+			ErrorMessage("aruba_action: Queue for Aruba switch %s "
+					"is full, dropping actions\n",
+					data->host);
+			data->queue_full = 1;
+		}
+		data->dropped++;
+	}
+	else {
+		slot = (data->queue_head + data->queue_cnt) % ARUBA_QUEUE_SIZE;
+		memcpy(data->queue[slot], addr, ARUBA_ADDR_LEN);
+		data->queue_cnt++;
+		ArubaRecentQueued(data, addr, p->pkth->ts.tv_sec);
+		data->queue_full = 0;
+		pthread_cond_signal(&data->queue_cond);
 	}
 
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+	pthread_mutex_unlock(&data->queue_lock);
+}
 
-	if (xmllenrem < 1) {
-		ErrorMessage("aruba_action: configuration parameters too "
-				"long\n");
-		FatalError("Unable to parse configuration parameters for Aruba"
-				"Action output plugin.\n");
-		return;
-	}
+/*
+ * Function: ArubaActionWorker(void *)
+ *
+ * Purpose: Takes up to batch queued hosts at a time and posts them to the
+ *          switch.  Hosts stay queued until the switch has answered for
+ *          them, so an unreachable switch is retried with a backoff
+ *          instead of losing actions.  On exit whatever is queued is still
+ *          sent, unless the switch can't be reached.
+ */
+void *ArubaActionWorker(void *arg)
+{
+	SpoAlertArubaActionData *data = (SpoAlertArubaActionData *)arg;
+	char hosts[ARUBA_BATCH_MAX][ARUBA_ADDR_LEN];
+	uint8_t accepted[ARUBA_BATCH_MAX];
+	struct timespec until;
+	int backoff = ARUBA_RETRY_MIN;
+	int cnt, done, i;
+	sigset_t mask;
 
-	snprintf(cmdbufp, xmllenrem, "<key>%s</key>", data->secret);
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+	/* signals are for the main thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
 
-	if (xmllenrem < 1) {
-		ErrorMessage("aruba_action: configuration parameters too "
-				"long\n");
-		FatalError("Unable to parse configuration parameters for Aruba"
-				"Action output plugin.\n");
-		return;
-	}
+	pthread_mutex_lock(&data->queue_lock);
 
-	snprintf(cmdbufp, xmllenrem, "<version>1.0</version>");
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+	for (;;) {
+		while (data->queue_cnt == 0 && !data->stop)
+			pthread_cond_wait(&data->queue_cond, &data->queue_lock);
 
-	if (xmllenrem < 1) {
-		ErrorMessage("aruba_action: configuration parameters too "
-				"long\n");
-		FatalError("Unable to parse configuration parameters for Aruba"
-				"Action output plugin.\n");
-		return;
-	}
+		if (data->queue_cnt == 0)
+			break;
 
-	snprintf(cmdbufp, xmllenrem, "</aruba>");
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+		cnt = data->queue_cnt < (uint32_t)data->batch ?
+				(int)data->queue_cnt : data->batch;
 
-	cmdbufp = NULL;
+		for (i = 0; i < cnt; i++) {
+			memcpy(hosts[i], data->queue[(data->queue_head + i) %
+					ARUBA_QUEUE_SIZE], ARUBA_ADDR_LEN);
+		}
 
-	postlen = snprintf(post, MAX_POST_LEN-1,
-			"POST /auth/command.xml HTTP/1.0\r\n"
-			"User-Agent: snort\r\n"
-			"Host: %s\r\n"
-			"Pragma: no-cache\r\n"
-			"Content-Length: %lu\r\n"
-			"Content-Type: application/xml\r\n"
-			"\r\n"
-			"%s",
-#ifdef SUP_IP6
-			inet_ntoa(&data->aswitch),
-#else
-			inet_ntoa(data->aswitch),
-#endif
-			(unsigned long)strlen(cmdbuf), cmdbuf
-        );
-	
-	/* Send the action command to the switch */
-	if (ArubaSwitchSend(data, (uint8_t *)post, postlen) != postlen) {
-		ErrorMessage("aruba_action: Error sending data to Aruba "
-				"switch.\n");
-		close(data->fd);
-		return;
-	}
+		pthread_mutex_unlock(&data->queue_lock);
+		done = ArubaSwitchPost(data, hosts, accepted, cnt);
+		pthread_mutex_lock(&data->queue_lock);
 
-	/* Read the response from the switch */
-	if (ArubaSwitchRecv(data, (uint8_t *)response, MAX_RESPONSE_LEN) < 0) {
-		ErrorMessage("aruba_action: Error reading response from Aruba"
-				" switch\n");
-		close(data->fd);
-		return;
-	}
+		for (i = 0; i < done; i++)
+			ArubaRecentDone(data, hosts[i], accepted[i]);
 
-	/* Extract the result code from the response */
-	responsecode = strstr(response, "<code>");
-	if (responsecode == NULL) {
-		ErrorMessage("aruba_action: Error extracting response code "
-				"from Aruba switch\n");
-		close(data->fd);
-		return;
-	}
+		data->queue_head = (data->queue_head + done) % ARUBA_QUEUE_SIZE;
+		data->queue_cnt -= done;
 
-	/* Advance beyond "<code>" */
-	responsecode += (strlen("<code>"));
+		if (done == cnt) {
+			backoff = ARUBA_RETRY_MIN;
+			continue;
+		}
 
-	/* Lookup code message */
-	//responsecodei = 0;
-	if (sscanf(responsecode, "%d", &responsecodei) != 1) {
-		ErrorMessage("aruba_action: Invalid response code returned from"
-				" the Aruba switch.\n");
-		return;
+		if (data->stop) {
+			for (i = 0; i < (int)data->queue_cnt; i++) {
+				ArubaRecentDone(data, data->queue[(data->queue_head + i) %
+						ARUBA_QUEUE_SIZE], 0);
+			}
+			data->dropped += data->queue_cnt;
+			data->queue_cnt = 0;
+			break;
+		}
+
+		ErrorMessage("aruba_action: Unable to reach Aruba switch at %s, "
+				"retrying in %d seconds\n", data->host, backoff);
+
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += backoff;
+
+		while (!data->stop && pthread_cond_timedwait(&data->queue_cond,
+				&data->queue_lock, &until) != ETIMEDOUT)
+			;
+
+		if ((backoff *= 2) > ARUBA_RETRY_MAX)
+			backoff = ARUBA_RETRY_MAX;
 	}
 
-	if (responsecodei != 0) {
-		responsemsg = NULL;
-		for (i=0; response_lookup[i].name != NULL; i++) {
-			if (response_lookup[i].type == responsecodei) {
-				responsemsg = response_lookup[i].name;
+	pthread_mutex_unlock(&data->queue_lock);
+	ArubaSwitchClose(data);
+
+	return NULL;
+}
+
+/*
+ * Function: ArubaSwitchPost(SpoAlertArubaActionData *, char **, uint8_t *, int)
+ *
+ * Purpose: Writes one command per host in a single send and reads the
+ *          answers back in order.  A kept-alive connection the switch has
+ *          since dropped is replaced once; anything it didn't answer for
+ *          is simply sent again, the commands being idempotent.
+ *          accepted[i] tells whether the switch took hosts[i].
+ *
+ * Returns: the number of hosts answered for, from the front of hosts
+ */
+int ArubaSwitchPost(SpoAlertArubaActionData *data, char (*hosts)[ARUBA_ADDR_LEN],
+		uint8_t *accepted, int cnt)
+{
+	int done = 0, before, fresh, len, i, j, code, keepalive;
+	char *responsemsg;
+
+	while (done < cnt) {
+		before = done;
+		fresh = 0;
+
+		if (data->fd < 0) {
+			if (ArubaSwitchConnect(data) < 0)
 				break;
-			}
+			fresh = 1;
 		}
 
-		if (responsemsg == NULL) {
-			ErrorMessage("aruba_action: Switch returned error "
-					"status of %d \"unknown\"\n",
-					responsecodei);
-		} else {
-			ErrorMessage("aruba_action: Switch returned error "
-					"status of %d \"%s\"\n",
-					responsecodei, responsemsg);
+		for (len = 0, i = done; i < cnt; i++) {
+			len += snprintf(data->post + len, MAX_POST_LEN,
+					"%sContent-Length: %lu\r\n"
+					"Content-Type: application/xml\r\n"
+					"\r\n"
+					"%s%s%s",
+					data->http_head,
+					(unsigned long)(data->xml_len + strlen(hosts[i])),
+					data->xml_head, hosts[i], data->xml_tail);
 		}
 
-		close(data->fd);
-		return;
-	}
+		/* Send the action commands to the switch */
+		if (ArubaSwitchSend(data, (uint8_t *)data->post, len) != len) {
+			if (fresh)
+				ErrorMessage("aruba_action: Error sending data to "
+						"Aruba switch.\n");
+			ArubaSwitchClose(data);
+		}
+		else {
+			data->batches++;
+
+			for (i = done; i < cnt; i++) {
+				/* Read the response from the switch */
+				if (ArubaSwitchRecv(data, &code, &keepalive) < 0) {
+					ArubaSwitchClose(data);
+					break;
+				}
+
+				data->requests++;
+				done++;
+
+				accepted[i] = (code == 0);
+
+				if (code == 0) {
+					data->sent++;
+				}
+				else {
+					data->refused++;
+					responsemsg = NULL;
+
+					for (j = 0; code > 0 && response_lookup[j].name != NULL; j++) {
+						if (response_lookup[j].type == code) {
+							responsemsg = response_lookup[j].name;
+							break;
+						}
+					}
+
+					if (code < 0) {
+						ErrorMessage("aruba_action: Error extracting "
+								"response code for %s from Aruba "
+								"switch\n", hosts[i]);
+					} else {
+						ErrorMessage("aruba_action: Switch returned "
+								"error status of %d \"%s\" for %s\n",
+								code, responsemsg ? responsemsg :
+								"unknown", hosts[i]);
+					}
+				}
+
+				if (!keepalive) {
+					ArubaSwitchClose(data);
+					break;
+				}
+			}
+		}
 
+		/* a new connection that got nowhere means the switch is down */
+		if (done == before && fresh)
+			break;
+	}
 
-	close(data->fd);
-		
-	return;
+	return done;
 }
 
 int ArubaSwitchSend(SpoAlertArubaActionData *data, uint8_t *post, int len)
 {
-	return(write(data->fd, post, len));
+	int n, sent = 0;
+
+	while (sent < len) {
+		n = send(data->fd, post + sent, len - sent, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		sent += n;
+	}
+
+	return sent;
 }
 
-int ArubaSwitchRecv(SpoAlertArubaActionData *data, uint8_t *recv, int maxlen)
+/*
+ * Function: ArubaHeader(char *, char *)
+ *
+ * Purpose: Finds a response header by name (case insensitive), headers
+ *          being the nul terminated block up to the blank line.
+ *
+ * Returns: the start of the header's value or NULL
+ */
+static char *ArubaHeader(char *headers, const char *name)
 {
-	return(read(data->fd, recv, maxlen));
+	size_t len = strlen(name);
+	char *line = headers;
+
+	while ((line = strstr(line, "\r\n")) != NULL) {
+		line += 2;
+		if (strncasecmp(line, name, len) == 0 && line[len] == ':') {
+			line += len + 1;
+			while (*line == ' ' || *line == '\t')
+				line++;
+			return line;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Function: ArubaSwitchRecv(SpoAlertArubaActionData *, int *, int *)
+ *
+ * Purpose: Reads one response off the connection, framed by its
+ *          Content-Length, chunked encoding or the switch closing the
+ *          connection.  Bytes of the following responses are kept for the
+ *          next call.
+ *
+ * Returns: 0 with the <code> (-1 if there was none) and whether the
+ *          connection can be reused, -1 if the connection failed
+ */
+int ArubaSwitchRecv(SpoAlertArubaActionData *data, int *code, int *keepalive)
+{
+	char *buf = data->response, *body, *end, *hdr, *responsecode;
+	size_t hlen = 0, need = 0;
+	int framed = 0, until_close = 0, n;
+	char save;
+
+	for (;;) {
+		buf[data->response_len] = '\0';
+
+		if (hlen == 0 && (end = strstr(buf, "\r\n\r\n")) != NULL) {
+			hlen = end + 4 - buf;
+			*end = '\0';
+
+			*keepalive = strncmp(buf, "HTTP/1.0", 8) != 0;
+			if ((hdr = ArubaHeader(buf, "Connection")) != NULL)
+				*keepalive = strncasecmp(hdr, "close", 5) != 0;
+
+			if ((hdr = ArubaHeader(buf, "Content-Length")) != NULL) {
+				need = hlen + strtoul(hdr, NULL, 10);
+				framed = 1;
+			}
+			else if ((hdr = ArubaHeader(buf, "Transfer-Encoding")) != NULL &&
+					strncasecmp(hdr, "chunked", 7) == 0) {
+				framed = 2;
+			}
+			else {
+				until_close = 1;
+				*keepalive = 0;
+			}
+
+			*end = '\r';
+		}
+
+		if (framed == 1 && data->response_len >= need)
+			break;
+
+		if (framed == 2) {
+			/* the last chunk, in the body or right at its start */
+			if (strncmp(buf + hlen, "0\r\n\r\n", 5) == 0)
+				end = buf + hlen;
+			else
+				end = strstr(buf + hlen, "\r\n0\r\n\r\n");
+
+			if (end != NULL) {
+				need = end - buf + (end == buf + hlen ? 5 : 7);
+				break;
+			}
+		}
+
+		if (data->response_len >= MAX_RESPONSE_LEN - 1) {
+			ErrorMessage("aruba_action: Response from Aruba switch "
+					"too long\n");
+			return -1;
+		}
+
+		n = recv(data->fd, buf + data->response_len,
+				MAX_RESPONSE_LEN - 1 - data->response_len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n == 0 && until_close) {
+			need = data->response_len;
+			break;
+		}
+
+		if (n <= 0)
+			return -1;
+
+		data->response_len += n;
+	}
+
+	/* Extract the result code from the response */
+	body = buf + hlen;
+	save = buf[need];
+	buf[need] = '\0';
+
+	*code = -1;
+	if ((responsecode = strstr(body, "<code>")) != NULL) {
+		/* Advance beyond "<code>" */
+		responsecode += strlen("<code>");
+		if (sscanf(responsecode, "%d", code) != 1 || *code < 0)
+			*code = -1;
+	}
+
+	buf[need] = save;
+
+	memmove(buf, buf + need, data->response_len - need);
+	data->response_len -= need;
+
+	return 0;
 }
 
 int ArubaSwitchConnect(SpoAlertArubaActionData *data)
 {
 	struct sockaddr_in sa4;
 	struct sockaddr_in6 sa6;
+	struct sockaddr *sa;
+	socklen_t salen;
+	struct timeval tv;
+	int family = AF_INET;
+
+	memset(&sa4, 0, sizeof(sa4));
+	memset(&sa6, 0, sizeof(sa6));
+
+#ifdef SUP_IP6
+	if (data->aswitch.family != AF_INET) {
+		memcpy(&sa6.sin6_addr, data->aswitch.ip8, 16);
+		sa6.sin6_family = family = AF_INET6;
+		sa6.sin6_port = htons(ARUBA_PORT);
+		sa = (struct sockaddr *)&sa6;
+		salen = sizeof(sa6);
+	} else {
+		sa4.sin_addr.s_addr = data->aswitch.ip32[0];
+#else
+	{
+		sa4.sin_addr.s_addr = (unsigned int)(data->aswitch.s_addr);
+#endif
+		sa4.sin_family = AF_INET;
+		sa4.sin_port = htons(ARUBA_PORT);
+		sa = (struct sockaddr *)&sa4;
+		salen = sizeof(sa4);
+	}
 
-	data->fd = socket(AF_INET, SOCK_STREAM, 0);
+	data->fd = socket(family, SOCK_STREAM, 0);
 	if (data->fd < 0) {
 		ErrorMessage("aruba_action: socket error\n");
 		return -1;
 	}
 
-#ifdef SUP_IP6
-    if(data->aswitch.family == AF_INET) {
-	    sa4.sin_addr.s_addr = data->aswitch.ip32[0];
-#else
-	    sa4.sin_addr.s_addr = (unsigned int)(data->aswitch.s_addr);
-#endif
-    	sa4.sin_family = AF_INET;
-    	sa4.sin_port = htons(80);
-
-    	if (connect(data->fd, (struct sockaddr *)&sa4, sizeof(sa4)) < 0) {
-    		perror("connect");
-    		ErrorMessage("aruba_action: Unable to connect to switch\n");
-    		close(data->fd);
-    		return -1;
-    	}
-#ifdef SUP_IP6
-    } 
-    else {
-	    memcpy(&sa6.sin6_addr, data->aswitch.ip8, 16);
-    	sa6.sin6_family = AF_INET6;
-    	sa6.sin6_port = htons(80);
-
-       	if (connect(data->fd, (struct sockaddr *)&sa6, sizeof(sa6)) < 0) {
-    		perror("connect");
-    		ErrorMessage("aruba_action: Unable to connect to switch\n");
-    		close(data->fd);
-    		return -1;
-    	}
-    }  
-#endif
+	/* bounds connect() as well as every send and recv */
+	tv.tv_sec = ARUBA_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(data->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	setsockopt(data->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
+	if (connect(data->fd, sa, salen) < 0) {
+		ErrorMessage("aruba_action: Unable to connect to switch: %s\n",
+				strerror(errno));
+		close(data->fd);
+		data->fd = -1;
+		return -1;
+	}
 
+	data->connects++;
+	data->response_len = 0;
 
-#ifdef SUP_IP6
-    if(data->aswitch.family == AF_INET) {
-	    sa4.sin_addr.s_addr = data->aswitch.ip32[0];
-    	sa4.sin_family = AF_INET;
-    	sa4.sin_port = htons(80);
-
-    	if (connect(data->fd, (struct sockaddr *)&sa4, sizeof(sa4)) < 0) {
-    		perror("connect");
-    		ErrorMessage("aruba_action: Unable to connect to switch\n");
-    		close(data->fd);
-    		return -1;
-    	}
-    } 
-    else {
-	    memcpy(&sa6.sin6_addr, data->aswitch.ip8, 16);
-#else
-	    memcpy(&sa6.sin6_addr, &data->aswitch, 16);
-#endif
-    	sa6.sin6_family = AF_INET6;
-    	sa6.sin6_port = htons(80);
-
-       	if (connect(data->fd, (struct sockaddr *)&sa6, sizeof(sa6)) < 0) {
-    		perror("connect");
-    		ErrorMessage("aruba_action: Unable to connect to switch\n");
-    		close(data->fd);
-    		return -1;
-    	}
-#ifdef SUP_IP6
-    }  
-#endif
-     
 	return data->fd;
 }
 
+void ArubaSwitchClose(SpoAlertArubaActionData *data)
+{
+	if (data->fd >= 0)
+		close(data->fd);
+
+	data->fd = -1;
+	data->response_len = 0;
+}
+
 
 /*
  * Function: ParseAlertArubaActionArgs(char *)
  *
- * Purpose: Process the preprocessor arguments from the rules file and 
+ * Purpose: Process the preprocessor arguments from the rules file and
  *          initialize the preprocessor's data struct.  This function doesn't
- *          have to exist if it makes sense to parse the args in the init 
+ *          have to exist if it makes sense to parse the args in the init
  *          function.
  *
  * Arguments: args => argument list
@@ -539,8 +857,11 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 	char **toks, **action_toks;
 	int num_toks, num_action_toks, i;
 	SpoAlertArubaActionData *data;
+	char buf[MAX_XML_PAYLOAD_LEN];
 
 	data = (SpoAlertArubaActionData *)SnortAlloc(sizeof(SpoAlertArubaActionData));
+	data->window = ARUBA_WINDOW;
+	data->batch = ARUBA_BATCH;
 
 	if(args == NULL) {
 		ErrorMessage("aruba_action: you must specify arguments for the "
@@ -552,9 +873,9 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 	DEBUG_WRAP(DebugMessage(DEBUG_LOG, "ParseAlertArubaActionArgs: %s\n",
 			args););
 
-	toks = mSplit(args, " ", 4, &num_toks, 0);
+	toks = mSplit(args, " \t", 0, &num_toks, 0);
 
-	if (num_toks != 4) {
+	if (num_toks < 4) {
 		ErrorMessage("aruba_action: incorrect number of arguments "
 				"specified (%d)\n", num_toks);
 		FatalError("Invalid argument count\n");
@@ -562,9 +883,9 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 	}
 
 #ifdef SUP_IP6 // XXX could probably be changed to a macro
-	if (sfip_pton(toks[0], &data->aswitch) == 0) 
+	if (sfip_pton(toks[0], &data->aswitch) == 0)
 #else
-	if (inet_aton(toks[0], &data->aswitch) == 0) 
+	if (inet_aton(toks[0], &data->aswitch) == 0)
 #endif
     {
 		ErrorMessage("aruba_action: invalid Aruba switch address "
@@ -573,8 +894,14 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 		return NULL;
 	}
 
+#ifdef SUP_IP6
+	strncpy(data->host, inet_ntoa(&data->aswitch), ARUBA_ADDR_LEN - 1);
+#else
+	strncpy(data->host, inet_ntoa(data->aswitch), ARUBA_ADDR_LEN - 1);
+#endif
+
 	for (i=0; secret_lookup[i].name != NULL; i++) {
-		if (strncmp(toks[1], secret_lookup[i].name, 
+		if (strncmp(toks[1], secret_lookup[i].name,
 				strlen(secret_lookup[i].name)) == 0) {
 			data->secret_type = secret_lookup[i].type;
 			break;
@@ -593,7 +920,7 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 
 	/* action can be "blacklist" or "setrole:rolename", parse */
 	for (i=0; action_lookup[i].name != NULL; i++) {
-		if (strncmp(action_lookup[i].name, toks[3], 
+		if (strncmp(action_lookup[i].name, toks[3],
 				strlen(action_lookup[i].name)) == 0) {
 			data->action_type = action_lookup[i].type;
 			break;
@@ -615,37 +942,131 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 					"specification \"%s\"\n", toks[3]);
 			FatalError("Improperly formatted action\n");
 			return NULL;
-		} 
+		}
 
 		data->role_name = (char *)SnortAlloc(strlen(action_toks[1])+1);
-		strncpy(data->role_name, action_toks[1], 
+		strncpy(data->role_name, action_toks[1],
 				strlen(action_toks[1]));
-	}	
+		mSplitFree(&action_toks, num_action_toks);
+	}
+
+	for (i = 4; i < num_toks; i++) {
+		if (strncasecmp(toks[i], "window=", 7) == 0) {
+			data->window = strtol(toks[i] + 7, NULL, 10);
+			if (data->window < 0) {
+				FatalError("aruba_action: invalid window \"%s\"\n",
+						toks[i]);
+			}
+		}
+		else if (strncasecmp(toks[i], "batch=", 6) == 0) {
+			data->batch = atoi(toks[i] + 6);
+			if (data->batch < 1 || data->batch > ARUBA_BATCH_MAX) {
+				FatalError("aruba_action: batch must be 1 to %d "
+						"(\"%s\")\n", ARUBA_BATCH_MAX, toks[i]);
+			}
+		}
+		else {
+			FatalError("aruba_action: unknown option \"%s\"\n",
+					toks[i]);
+		}
+	}
 
 	/* free toks */
 	mSplitFree(&toks, num_toks);
 
+	/* Everything but the address is the same for every command */
+	if (data->action_type == ARUBA_ACTION_SETROLE) {
+		snprintf(buf, sizeof(buf), "xml=<aruba command=user_add>"
+				"<role>%s</role><ipaddr>", data->role_name);
+	} else {
+		snprintf(buf, sizeof(buf), "xml=<aruba "
+				"command=user_blacklist><ipaddr>");
+	}
+	data->xml_head = SnortStrdup(buf);
+
+	snprintf(buf, sizeof(buf), "</ipaddr><authentication>%s"
+			"</authentication><key>%s</key>"
+			"<version>1.0</version></aruba>",
+			data->secret_type == ARUBA_SECRET_SHA1 ? "sha-1" :
+			data->secret_type == ARUBA_SECRET_MD5 ? "md5" : "cleartext",
+			data->secret);
+	data->xml_tail = SnortStrdup(buf);
+
+	snprintf(buf, sizeof(buf), "POST /auth/command.xml HTTP/1.1\r\n"
+			"User-Agent: snort\r\n"
+			"Host: %s\r\n"
+			"Pragma: no-cache\r\n"
+			"Connection: keep-alive\r\n",
+			data->host);
+	data->http_head = SnortStrdup(buf);
+
+	data->xml_len = strlen(data->xml_head) + strlen(data->xml_tail);
+
+	/* room for the Content-* headers and the longest address */
+	if (strlen(data->http_head) + data->xml_len + 128 > MAX_POST_LEN ||
+			data->xml_len + ARUBA_ADDR_LEN > MAX_XML_PAYLOAD_LEN) {
+		ErrorMessage("aruba_action: configuration parameters too "
+				"long\n");
+		FatalError("Unable to parse configuration parameters for Aruba"
+				"Action output plugin.\n");
+	}
+
 	return data;
 }
 
-void AlertArubaActionCleanExitFunc(int signal, void *arg)
+/*
+ * Function: AlertArubaActionFree(SpoAlertArubaActionData *)
+ *
+ * Purpose: Lets the worker send what is queued, joins it and reports the
+ *          counters.
+ */
+static void AlertArubaActionFree(SpoAlertArubaActionData *data)
 {
-	SpoAlertArubaActionData *data = (SpoAlertArubaActionData *)arg;
+	if (data == NULL)
+		return;
+
+	if (data->worker_on) {
+		pthread_mutex_lock(&data->queue_lock);
+		data->stop = 1;
+		pthread_cond_signal(&data->queue_cond);
+		pthread_mutex_unlock(&data->queue_lock);
+
+		pthread_join(data->worker_tid, NULL);
+		data->worker_on = 0;
+
+		pthread_mutex_destroy(&data->queue_lock);
+		pthread_cond_destroy(&data->queue_cond);
+	}
+
+	LogMessage("aruba_action: %s: %u alerts, %u deduplicated, %u dropped, "
+			"%u actioned, %u refused, %u requests in %u batches over "
+			"%u connections\n", data->host, data->alerts, data->deduped,
+			data->dropped, data->sent, data->refused, data->requests,
+			data->batches, data->connects);
 
-	DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertArubaActionCleanExitFunc\n"););
 	free(data->secret);
 	free(data->role_name);
+	free(data->http_head);
+	free(data->xml_head);
+	free(data->xml_tail);
+	free(data->post);
+	free(data->recent);
 	free(data);
 }
 
+void AlertArubaActionCleanExitFunc(int signal, void *arg)
+{
+	SpoAlertArubaActionData *data = (SpoAlertArubaActionData *)arg;
+
+	DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertArubaActionCleanExitFunc\n"););
+	AlertArubaActionFree(data);
+}
+
 void AlertArubaActionRestartFunc(int signal, void *arg)
 {
 	SpoAlertArubaActionData *data = (SpoAlertArubaActionData *)arg;
-	
+
 	DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertArubaActionRestartFunc\n"););
-	free(data->secret);
-	free(data->role_name);
-	free(data);
+	AlertArubaActionFree(data);
 }
 
-
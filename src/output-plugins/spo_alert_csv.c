@@ -97,7 +97,7 @@ static void AlertCSV(Packet *, void *, uint32_t, void *);
 static void AlertCSVCleanExit(int, void *);
 static void AlertCSVRestart(int, void *);
 static void RealAlertCSV(
-    Packet*, void*, uint32_t, char **args, int numargs, TextLog*
+    Packet*, void*, uint32_t, EventEP*, char **args, int numargs, TextLog*
 );
 
 /*
@@ -278,7 +278,33 @@ static void AlertCSVRestart(int signal, void *arg)
 static void AlertCSV(Packet *p, void *event, uint32_t event_type, void *arg)
 {
     AlertCSVData *data = (AlertCSVData *)arg;
-    RealAlertCSV(p, event, event_type, data->args, data->numargs, data->log);
+    EventEP *eep = (EventEP *)event;
+
+    /* the unified2 event itself, none for a packet on its own */
+    RealAlertCSV(p, (eep && event_type != UNIFIED2_PACKET) ? eep->ee->data : NULL,
+        event_type, eep, data->args, data->numargs, data->log);
+}
+
+/*
+ * Function: AlertCSVAttr(TextLog *, EventEP *, uint32_t, uint32_t)
+ *
+ * Purpose: Write the event's first extra data of either type, quoted.
+ *          Left empty when the event has none.
+ */
+static void AlertCSVAttr(TextLog *log, EventEP *eep, uint32_t type, uint32_t alt)
+{
+    const EventAttr *attr;
+    char buf[LOG_BUFFER];
+
+    if ( eep == NULL )
+        return;
+
+    if ( (attr = EventAttrFind(eep, type)) == NULL
+            && (alt == 0 || (attr = EventAttrFind(eep, alt)) == NULL) )
+        return;
+
+    EventAttrPrint(attr, buf, sizeof(buf));
+    TextLog_Quote(log, buf);
 }
 
 /*
@@ -288,7 +314,8 @@ static void AlertCSV(Packet *p, void *event, uint32_t event_type, void *arg)
  * Purpose: Write a user defined CSV message
  *
  * Arguments:     p => packet. (could be NULL)
- *              msg => the message to send
+ *            event => unified2 event. (could be NULL)
+ *              eep => the event with its extra data. (could be NULL)
  *             args => CSV output arguements
  *          numargs => number of arguements
  *             log => Log
@@ -296,7 +323,7 @@ static void AlertCSV(Packet *p, void *event, uint32_t event_type, void *arg)
  *
  */
 static void RealAlertCSV(Packet * p, void *event, uint32_t event_type,
-        char **args, int numargs, TextLog* log)
+        EventEP *eep, char **args, int numargs, TextLog* log)
 {
     int num;
     SigNode             *sn;
@@ -533,6 +560,18 @@ static void RealAlertCSV(Packet * p, void *event, uint32_t event_type,
                 TextLog_Print(log, "%s", tcpFlags);
             }
         }
+        else if(!strncasecmp("xff", type, 3))
+        {
+            AlertCSVAttr(log, eep, EVENT_INFO_XFF_IPV4, EVENT_INFO_XFF_IPV6);
+        }
+        else if(!strncasecmp("http_uri", type, 8))
+        {
+            AlertCSVAttr(log, eep, EVENT_INFO_HTTP_URI, 0);
+        }
+        else if(!strncasecmp("http_hostname", type, 13))
+        {
+            AlertCSVAttr(log, eep, EVENT_INFO_HTTP_HOSTNAME, 0);
+        }
 	else if(!strncasecmp("interface",type,strlen("interface")))
         {
 	    if( barnyard2_conf->interface )
@@ -33,12 +33,21 @@
  *
  * See the SnortSam documentation for more information.
  *
+ * Each station is served by its own sender thread which checks in, keeps
+ * the connection and the TwoFish key, and re-keys or reconnects when the
+ * agent asks for it.  Alerts only queue the blocking request for it, so a
+ * slow or unreachable agent never stalls the spooler; requests are retried
+ * with a growing delay until the agent answers, or dropped once the queue
+ * is full.  Per-station counters are logged on exit.
+ *
  *
  * Output Plugin Parameters:
  ***************************
  *
- * output alert_fwsam: <SnortSam Station>:<port>/<key>
+ * output alert_fwsam: [dedup=<n>] <SnortSam Station>:<port>/<key>
  *
+ *  dedup=<n>:          Number of recent blocks remembered to suppress repeats
+ *              (default 4096).
  *  <FW Mgmt Station>:  IP address or host name of the host running SnortSam.
  *  <port>:         Port the remote SnortSam service listens on (default 898).
  *  <key>:              Key used for authentication (encryption really)
@@ -87,6 +96,10 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "squirrel.h"
 #include "decode.h"
@@ -108,6 +121,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <sys/ioctl.h>
 #include <netdb.h>
 
@@ -122,6 +136,8 @@ typedef int SOCKET;
 #endif
 
 #define waitms(x)               usleep((x)*1000)
+#define closesocket(x)          close(x)
+#define ioctlsocket(s,c,a)      ioctl(s,c,a)
 
 #endif
 
@@ -180,13 +196,23 @@ typedef int SOCKET;
 
 /* user adjustable defines */
 
-#define FWSAM_REPET_BLOCKS      10  /* Snort remembers this amount of last blocks and... */
-#define FWSAM_REPET_TIME        20  /* ...checks if they fall within this time. If so,... */
-                                    /* ...the blocking request is not send. */
+#define FWSAM_REPET_BLOCKS      4096    /* Snort remembers this amount of last blocks (dedup=) and... */
+#define FWSAM_REPET_TIME        20      /* ...checks if they fall within this time. If so,... */
+                                        /* ...the blocking request is not send. */
 
 #define FWSAM_NETWAIT           300     /* 100th of a second. 3 sec timeout for network connections */
 #define FWSAM_NETHOLD           6000    /* 100th of a second. 60 sec timeout for holding */
 
+#define FWSAM_QUEUE_SIZE        1024    /* blocking requests waiting per station */
+#define FWSAM_RETRY_MIN         1       /* seconds before a request is retried, doubling... */
+#define FWSAM_RETRY_MAX         60      /* ...up to this while the agent is unreachable */
+
+/* outcome of sending a request to a station */
+#define FWSAM_SENT              0
+#define FWSAM_RETRY             1   /* agent not reachable, try again later */
+#define FWSAM_DEAD              2   /* station is ignored from now on */
+#define FWSAM_AGAIN             3   /* checked in again, resend right away */
+
 #define SID_MAPFILE             "sid-block.map"
 #define SID_ALT_MAPFILE         "sid-fwsam.map"
 
@@ -195,6 +221,53 @@ typedef int SOCKET;
 
 /* vars */
 
+typedef struct _FWsamrepeatkey          /* what makes two blocking requests the same */
+{
+    uint32_t            srcip;          /* 0 unless blocking the source or the connection */
+    uint32_t            dstip;          /* 0 unless blocking the destination or the connection */
+    uint32_t            duration;
+    uint16_t            dstport;        /* 0 unless blocking a TCP/UDP connection */
+    unsigned char       protocol;       /* 0 unless blocking the connection */
+    unsigned char       mode;           /* how|who */
+}   FWsamRepeatKey;
+
+typedef struct _FWsamrepeat             /* a recently sent blocking request */
+{
+    FWsamRepeatKey      key;
+    time_t              time;
+    struct _FWsamrepeat *next;          /* hash row */
+    struct _FWsamrepeat *older;         /* age list, oldest first */
+    struct _FWsamrepeat *newer;
+}   FWsamRepeat;
+
+typedef struct _FWsamrepeattable        /* recently sent blocking requests */
+{
+    FWsamRepeat         **rows;
+    FWsamRepeat         *pool;
+    FWsamRepeat         *unused;
+    FWsamRepeat         *oldest;
+    FWsamRepeat         *newest;
+    unsigned int        mask;           /* rows-1, rows being a power of 2 */
+    unsigned int        size;
+    unsigned int        count;
+    unsigned long       hits;
+    unsigned long       misses;
+    unsigned long       evicted;        /* pushed out while still in their window */
+}   FWsamRepeatTable;
+
+typedef struct _FWsamblock              /* a queued blocking request */
+{
+    uint32_t            srcip;          /* network byte order */
+    uint32_t            dstip;
+    uint32_t            duration;
+    uint32_t            sig_id;
+    uint16_t            srcport;
+    uint16_t            dstport;
+    uint16_t            protocol;
+    unsigned char       fwmode;
+    struct timeval      queued;         /* for the latency counter */
+}   FWsamBlock;
+
 typedef struct _FWsamstation            /* structure of a mgmt station */
 {
     unsigned short      myseqno;
@@ -211,6 +284,31 @@ typedef struct _FWsamstation            /* structure of a mgmt station */
     char            stationkey[TwoFish_KEY_LENGTH+2];
     time_t          lastcontact;
 /*  time_t          sleepstart; */
+
+    /* owned by the sender thread */
+    SOCKET          stationsocket;      /* kept open between requests */
+
+    /* the queue, protected by queue_lock */
+    pthread_t       sender_tid;
+    pthread_mutex_t queue_lock;
+    pthread_cond_t  queue_cond;
+    FWsamBlock      *queue;
+    unsigned int    queue_head;
+    unsigned int    queue_cnt;
+    unsigned char   sender_on;
+    unsigned char   sender_stop;
+    unsigned char   queue_full;
+    unsigned char   station_dead;       /* agent is ignored from now on */
+
+    /* counters, also protected by queue_lock */
+    unsigned long   queued;
+    unsigned long   sent;
+    unsigned long   dropped;
+    unsigned long   retries;
+    unsigned long   connects;
+    unsigned int    queue_max;
+    uint64_t        latency_sum;        /* usec from alert to agent's answer */
+    uint64_t        latency_max;
 }   FWsamStation;
 
 typedef struct _FWsampacket         /* 2 blocks (3rd block is header from TwoFish) */
@@ -283,6 +381,21 @@ int FWsamReadLine(char *, unsigned long, FILE *);
 void FWsamParseLine(FWsamOptions *, char *);
 FWsamOptions *FWsamGetOption(unsigned long);
 int FWsamParseOption(FWsamOptions *, char *);
+FWsamStation *FWsamStationFind(FWsamStation *who, FWsamList *list);
+FWsamRepeatTable *FWsamRepeatNew(unsigned int size);
+void FWsamRepeatFree(FWsamRepeatTable *t);
+int FWsamRepeated(FWsamRepeatTable *t, FWsamRepeatKey *key, time_t now);
+void FWsamStartSender(FWsamStation *station);
+void FWsamStopSender(FWsamStation *station);
+void FWsamQueueBlock(FWsamStation *station, FWsamBlock *blk);
+void *FWsamSender(void *arg);
+int FWsamStationSend(FWsamStation *station, FWsamBlock *blk);
+int FWsamHandleReply(FWsamStation *station, char *encbuf, FWsamPacket *sampacket, int stationtry);
+int FWsamDecrypt(FWsamStation *station, char *encbuf, FWsamPacket *sampacket);
+int FWsamConnect(FWsamStation *station);
+int FWsamConnectionAlive(FWsamStation *station);
+void FWsamCloseConnection(FWsamStation *station);
+int FWsamRecvPacket(FWsamStation *station, char *buf, int len, int wait);
 
 
 /*
@@ -299,6 +412,8 @@ extern Barnyard2Config *barnyard2_conf;
 FWsamList *FWsamStationList=NULL;           /* Global (for all alert-types) list of snortsam stations */
 FWsamOptions *FWsamOptionField=NULL;
 unsigned long FWsamMaxOptions=0;
+FWsamRepeatTable *FWsamRepeats=NULL;        /* Global (for all alert-types) recent blocks */
+unsigned int FWsamRepeatSize=FWSAM_REPET_BLOCKS;
 
 
 /*
@@ -342,7 +457,7 @@ void AlertFWsamInit(char *args)
     char *ap;
     unsigned long statip,cnt,again,i;
     char *stathost, *statport, *statpass;
-    FWsamStation *station;
+    FWsamStation *station,*gstation;
     FWsamList *fwsamlist=NULL;  /* alert-type dependent list of snortsam stations  */
     FWsamList *listp,*newlistp;
     struct hostent *hoste;
@@ -426,6 +541,23 @@ void AlertFWsamInit(char *args)
     while(*ap && isspace(*ap)) ap++;
     while(*ap)
     {
+        if(!strncasecmp(ap,"dedup=",6))   /* size of the repeat table rather than a host */
+        {
+            statport=ap+6;
+            while(*ap && !isspace(*ap)) ap++;
+            if(*ap)
+            {
+                *ap++=0;
+                while(isspace(*ap)) ap++;
+            }
+
+            if(atoi(statport)>0)
+                FWsamRepeatSize=atoi(statport);
+            else
+                LogMessage("WARNING %s (%d) => [Alert_FWsam](AlertFWsamInit) Invalid dedup size '%s', using %u.\n",file_name,file_line,statport,FWsamRepeatSize);
+            continue;
+        }
+
         stathost=ap; /* first argument should be host */
         statport=NULL;
         statpass=NULL;
@@ -488,6 +620,8 @@ void AlertFWsamInit(char *args)
             if((station=(FWsamStation *)malloc(sizeof(FWsamStation)))==NULL)
                 FatalError("ERROR => [Alert_FWsam](AlertFWsamInit) malloc failed for station!\n");
 
+            memset(station,0,sizeof(FWsamStation));
+            station->stationsocket=INVALID_SOCKET;
             station->stationip.ip32[0] = statip; /* the IP address */
             if(statport!=NULL && atoi(statport)>0) /* if the user specified one */
                 station->stationport=atoi(statport); /* use users setting */
@@ -524,37 +658,35 @@ void AlertFWsamInit(char *args)
 
 
             /* If we don't have the station already in global list....*/
-            if(!FWsamStationExists(station,FWsamStationList))
+            if((gstation=FWsamStationFind(station,FWsamStationList))==NULL)
             {
-                if(FWsamCheckIn(station))           /* ...and we can talk to the agent...  */
-                {
-                    if((newlistp=(FWsamList *)malloc(sizeof(FWsamList)))==NULL)
-                        FatalError("ERROR => [Alert_FWsam](AlertFWsamInit) malloc failed for global newlistp!\n");
+                if((newlistp=(FWsamList *)malloc(sizeof(FWsamList)))==NULL)
+                    FatalError("ERROR => [Alert_FWsam](AlertFWsamInit) malloc failed for global newlistp!\n");
 
-                    newlistp->station=station;
-                    newlistp->next=NULL;
+                newlistp->station=station;
+                newlistp->next=NULL;
 
-                    if(!FWsamStationList)               /* ... add it to the global list/ */
-                        FWsamStationList=newlistp;
-                    else
-                    {
-                        listp=FWsamStationList;
-                        while(listp->next)
-                            listp=listp->next;
-                        listp->next=newlistp;
-                    }
-                }
+                if(!FWsamStationList)               /* ... add it to the global list/ */
+                    FWsamStationList=newlistp;
                 else
                 {
-                    TwoFishDestroy(station->stationfish); /* if not, we trash it. */
-                    free(station);
-                    station=NULL;
+                    listp=FWsamStationList;
+                    while(listp->next)
+                        listp=listp->next;
+                    listp->next=newlistp;
                 }
+
+                FWsamStartSender(station);          /* ...which checks in with the agent */
             }
-#ifdef FWSAMDEBUG
             else
-                LogMessage("DEBUG => [Alert_FWsam](AlertFWsamInit) Host %s:%i already in global list, skipping CheckIn.\n", sfip_ntoa(&station->stationip),station->stationport);
+            {
+#ifdef FWSAMDEBUG
+                LogMessage("DEBUG => [Alert_FWsam](AlertFWsamInit) Host %s:%i already in global list, sharing it.\n", sfip_ntoa(&station->stationip),station->stationport);
 #endif
+                TwoFishDestroy(station->stationfish); /* share the one (and its thread) we have */
+                free(station);
+                station=gstation;
+            }
 
             if(station)
             {
@@ -666,6 +798,24 @@ int FWsamStationExists(FWsamStation *who,FWsamList *list)
 }
 
 
+/*  Same as above, but returns the station found.
+*/
+FWsamStation *FWsamStationFind(FWsamStation *who,FWsamList *list)
+{
+    while(list)
+    {
+        if(list->station)
+        {
+            if( IP_EQUALITY(&who->stationip, &list->station->stationip) &&
+                who->stationport==list->station->stationport )
+            return list->station;
+        }
+        list=list->next;
+    }
+    return NULL;
+}
+
+
 /* Parses the duration of the argument, recognizing minutes, hours, etc..
 */
 unsigned long FWsamParseDuration(char *p)
@@ -960,22 +1110,9 @@ FWsamOptions *FWsamGetOption(unsigned long sid)
 void AlertFWsam(Packet *p, void *event, uint32_t event_type, void *arg)
 {
     FWsamOptions *optp;
-    FWsamPacket sampacket;
-    FWsamStation *station=NULL;
+    FWsamRepeatKey key;
+    FWsamBlock blk;
     FWsamList *fwsamlist;
-    SOCKET stationsocket;
-    int i,len,deletestation,stationtry=0;
-    char *encbuf,*decbuf;
-    static unsigned long lastbsip[FWSAM_REPET_BLOCKS];
-    static unsigned long lastbdip[FWSAM_REPET_BLOCKS];
-    static unsigned long lastbduration[FWSAM_REPET_BLOCKS];
-    static unsigned long lastbtime[FWSAM_REPET_BLOCKS];
-/*    static unsigned short lastbsp[FWSAM_REPET_BLOCKS];*/
-    static unsigned short lastbdp[FWSAM_REPET_BLOCKS];
-    static unsigned short lastbproto[FWSAM_REPET_BLOCKS];
-    static unsigned short lastbpointer;
-    static unsigned char lastbmode[FWSAM_REPET_BLOCKS];
-    static unsigned long btime=0;
 
 /*    SigNode     *sn = NULL;
     ClassType   *cn = NULL;*/
@@ -1029,15 +1166,6 @@ void AlertFWsam(Packet *p, void *event, uint32_t event_type, void *arg)
 
     if(optp)    /* if options specified for this rule */
     {
-        if(!btime)          /* if this is the first time this function is */
-        {
-            for(i=0;i<FWSAM_REPET_BLOCKS;i++)   /*  called, reset the time and protocol to 0. */
-            {
-                lastbproto[i]=0;
-                lastbtime[i]=0;
-            }
-        }
-
         fwsamlist=(FWsamList *)arg;
 
 #ifdef FWSAMDEBUG
@@ -1045,342 +1173,711 @@ void AlertFWsam(Packet *p, void *event, uint32_t event_type, void *arg)
         LogMessage("DEBUG => [Alert_FWsam] Alert -> Option: %s[%s],%lu.\n",(optp->who==FWSAM_WHO_SRC)?"src":"dst",(optp->how==FWSAM_HOW_IN)?"in":((optp->how==FWSAM_HOW_OUT)?"out":"either"),optp->duration);
 #endif
 
-        len=TRUE;
-        btime=(unsigned long)time(NULL);    /* get current time */
-        /* This is a cheap check to see if the blocking request matches any of the previous requests. */
-        for(i=0; i<FWSAM_REPET_BLOCKS && len; i++)
+        if(!FWsamRepeats)
+            FWsamRepeats=FWsamRepeatNew(FWsamRepeatSize);
+
+        /* Check if the blocking request matches any of the recent requests. */
+        memset(&key,0,sizeof(FWsamRepeatKey));
+        key.mode=optp->how|optp->who;
+        key.duration=optp->duration;
+        if(optp->how==FWSAM_HOW_THIS)       /* if blocking mode SERVICE, check for src and dst... */
         {
-            if( ( ( optp->how==FWSAM_HOW_THIS ) ?   /* if blocking mode SERVICE, check for src and dst    */
-		  ( lastbsip[i]==(unsigned long)GET_SRC_IP(p) && lastbdip[i]==(unsigned long)GET_DST_IP(p) && lastbproto[i]==GET_IPH_PROTO(p) &&
-		    ( IP_HAS_PORTS(p) ? /* check port only of TCP or UDP */
-/*                  ((optp->who==FWSAM_WHO_SRC)?(lastbsp[i]==record->sp):(lastbdp[i]==record->dp)):TRUE) ): */
-                        lastbdp[i]==p->dp : TRUE
-                      )
-                    ) :
-                    (
-                      ( optp->who==FWSAM_WHO_SRC) ?
-		      ( lastbsip[i]==(unsigned long)GET_SRC_IP(p) ) :
-		      ( lastbdip[i]==(unsigned long)GET_DST_IP(p) )
-                    )
-                 ) && /* otherwise if we block source, only compare source. Same for dest. */
-                 lastbduration[i]==optp->duration &&
-                 (lastbmode[i] & (FWSAM_HOW|FWSAM_WHO))==(optp->how|optp->who) &&
-                 ( btime-lastbtime[i]<((optp->duration>FWSAM_REPET_TIME) ? FWSAM_REPET_TIME : optp->duration))
-               )
-            {
-                len=FALSE;      /* If so, we don't need to block again. */
-            }
+            key.srcip=p->iph->ip_src.s_addr;
+            key.dstip=p->iph->ip_dst.s_addr;
+            key.protocol=p->iph->ip_proto;
+            if(IP_HAS_PORTS(p))             /* ...and port only of TCP or UDP */
+                key.dstport=p->dp;
         }
+        else if(optp->who==FWSAM_WHO_SRC)   /* otherwise if we block source, only compare source. Same for dest. */
+            key.srcip=p->iph->ip_src.s_addr;
+        else
+            key.dstip=p->iph->ip_dst.s_addr;
 
-        if(len)
+        if(!FWsamRepeated(FWsamRepeats,&key,time(NULL)))
         {
-            if(++lastbpointer>=FWSAM_REPET_BLOCKS)      /* increase repetitive check pointer */
-                lastbpointer=0;
-
-            lastbsip[lastbpointer]=(unsigned long)GET_SRC_IP(p);     /* and note packet details */
-            lastbdip[lastbpointer]=(unsigned long)GET_DST_IP(p);
-            lastbduration[lastbpointer]=optp->duration;
-            lastbmode[lastbpointer]=optp->how|optp->who|optp->loglevel;
-            lastbproto[lastbpointer]=GET_IPH_PROTO(p);
+            memset(&blk,0,sizeof(FWsamBlock));
+            blk.srcip=p->iph->ip_src.s_addr;                /* network byte order, as the agent wants it */
+            blk.dstip=p->iph->ip_dst.s_addr;
+            blk.protocol=p->iph->ip_proto;
             if(IP_HAS_PORTS(p))
-            {
-                /*lastbsp[lastbpointer]=p->sp;*/                   /* set ports if TCP or UDP */
-                lastbdp[lastbpointer]=p->dp;
+            {   blk.srcport=p->sp;
+                blk.dstport=p->dp;
             }
-            lastbtime[lastbpointer]=btime;
-
+            blk.duration=optp->duration;
+            blk.fwmode=optp->how|optp->who|optp->loglevel;
+            blk.sig_id=ntohl(((Unified2EventCommon *)event)->signature_id);
+            gettimeofday(&blk.queued,NULL);
 
+            /* the sender threads do the talking, we only hand the request over */
             while(fwsamlist!=NULL)
             {
-                station=fwsamlist->station;
-                //if(station->stationip.s_addr)
-                if(station->stationip.ip32[0])
-                {
-                    deletestation=FALSE;
-                    stationtry++;               /* first try */
-                    /* create a socket for the station */
-                    stationsocket=socket(PF_INET,SOCK_STREAM,IPPROTO_TCP);
-                    if(stationsocket==INVALID_SOCKET)
-                        FatalError("ERROR => [Alert_FWsam] Funky socket error (socket)!\n");
-                    if(bind(stationsocket,(struct sockaddr *)&(station->localsocketaddr),sizeof(struct sockaddr)))
-                        FatalError("ERROR => [Alert_FWsam] Could not bind socket!\n");
-
-                    /* let's connect to the agent */
-                    if(connect(stationsocket,(struct sockaddr *)&station->stationsocketaddr,sizeof(struct sockaddr)))
-                    {
-                        LogMessage("WARNING => [Alert_FWsam] Could not send block to host %s. Will try later.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                        closesocket(stationsocket);
-#else
-                        close(stationsocket);
-#endif
-                        stationtry=0;
-                    }
-                    else
-                    {
+                FWsamQueueBlock(fwsamlist->station,&blk);
+                fwsamlist=fwsamlist->next;
+            }
+        }
+        else
+        {
 #ifdef FWSAMDEBUG
-                        LogMessage("DEBUG => [Alert_FWsam] Connected to host %s.\n",sfip_ntoa(&station->stationip));
+            LogMessage("DEBUG => [Alert_FWsam] Skipping repetitive block.\n");
 #endif
-                        /* now build the packet */
-                        station->myseqno+=station->stationseqno; /* increase my seqno by adding agent seq no */
-                        sampacket.endiancheck=1;                        /* This is an endian indicator for Snortsam */
-                        sampacket.snortseqno[0]=(char)station->myseqno;
-                        sampacket.snortseqno[1]=(char)(station->myseqno>>8);
-                        sampacket.fwseqno[0]=(char)station->stationseqno;/* fill station seqno */
-                        sampacket.fwseqno[1]=(char)(station->stationseqno>>8);
-                        sampacket.status=FWSAM_STATUS_BLOCK;            /* set block mode */
-                        sampacket.version=FWSAM_PACKETVERSION;          /* set packet version */
-                        sampacket.duration[0]=(char)optp->duration;     /* set duration */
-                        sampacket.duration[1]=(char)(optp->duration>>8);
-                        sampacket.duration[2]=(char)(optp->duration>>16);
-                        sampacket.duration[3]=(char)(optp->duration>>24);
-                        sampacket.fwmode=optp->how|optp->who|optp->loglevel; /* set the mode */
-                        sampacket.dstip[0]=(char)p->iph->ip_dst.s_addr; /* destination IP */
-                        sampacket.dstip[1]=(char)(p->iph->ip_dst.s_addr>>8);
-                        sampacket.dstip[2]=(char)(p->iph->ip_dst.s_addr>>16);
-                        sampacket.dstip[3]=(char)(p->iph->ip_dst.s_addr>>24);
-                        sampacket.srcip[0]=(char)p->iph->ip_src.s_addr; /* source IP */
-                        sampacket.srcip[1]=(char)(p->iph->ip_src.s_addr>>8);
-                        sampacket.srcip[2]=(char)(p->iph->ip_src.s_addr>>16);
-                        sampacket.srcip[3]=(char)(p->iph->ip_src.s_addr>>24);
-                        sampacket.protocol[0]=(char)p->iph->ip_proto;   /* protocol */
-                        sampacket.protocol[1]=(char)(p->iph->ip_proto>>8);/* protocol */
-
-                        if(IP_HAS_PORTS(p))
-                        {   sampacket.srcport[0]=(char)p->sp;   /* set ports */
-                            sampacket.srcport[1]=(char)(p->sp>>8);
-                            sampacket.dstport[0]=(char)p->dp;
-                            sampacket.dstport[1]=(char)(p->dp>>8);
-                        }
-                        else
-                            sampacket.srcport[0]=sampacket.srcport[1]=sampacket.dstport[0]=sampacket.dstport[1]=0;
+        }
+    }
+}
 
-                        uint32_t sig_id = ntohl(((Unified2EventCommon *)event)->signature_id);
-                        sampacket.sig_id[0]=(char)sig_id;        /* set signature ID */
-                        sampacket.sig_id[1]=(char)(sig_id>>8);
-                        sampacket.sig_id[2]=(char)(sig_id>>16);
-                        sampacket.sig_id[3]=(char)(sig_id>>24);
+/*  Repeat table
+ *
+ *  Remembers the blocking requests sent in the last FWSAM_REPET_TIME
+ *  seconds so each one goes out only once per window, however many hosts
+ *  are being blocked. Entries live in a hash table and on an age list;
+ *  expired ones are reclaimed from the old end, and if the table is full
+ *  the oldest entry makes room even if it is still in its window.
+ */
+FWsamRepeatTable *FWsamRepeatNew(unsigned int size)
+{
+    FWsamRepeatTable *t;
+    unsigned int rows,i;
 
-#ifdef FWSAMDEBUG
-                        LogMessage("DEBUG => [Alert_FWsam] Sending BLOCK\n");
-                        LogMessage("DEBUG => [Alert_FWsam] Snort SeqNo:  %x\n",station->myseqno);
-                        LogMessage("DEBUG => [Alert_FWsam] Mgmt SeqNo :  %x\n",station->stationseqno);
-                        LogMessage("DEBUG => [Alert_FWsam] Status     :  %i\n",FWSAM_STATUS_BLOCK);
-                        LogMessage("DEBUG => [Alert_FWsam] Mode       :  %i\n",optp->how|optp->who|optp->loglevel);
-                        LogMessage("DEBUG => [Alert_FWsam] Duration   :  %li\n",optp->duration);
-                        LogMessage("DEBUG => [Alert_FWsam] Protocol   :  %i\n",GET_IPH_PROTO(p));
-#ifdef SUP_IP6
-                        LogMessage("DEBUG => [Alert_FWsam] Src IP     :  %s\n",sfip_ntoa(GET_SRC_IP(p)));
-                        LogMessage("DEBUG => [Alert_FWsam] Dest IP    :  %s\n",sfip_ntoa(GET_DST_IP(p)));
-#else
-                        LogMessage("DEBUG => [Alert_FWsam] Src IP     :  %s\n",inet_ntoa(GET_SRC_ADDR(p)));
-                        LogMessage("DEBUG => [Alert_FWsam] Dest IP    :  %s\n",inet_ntoa(GET_DST_ADDR(p)));
-#endif
-                        LogMessage("DEBUG => [Alert_FWsam] Src Port   :  %i\n",p->sp);
-                        LogMessage("DEBUG => [Alert_FWsam] Dest Port  :  %i\n",p->dp);
-                        LogMessage("DEBUG => [Alert_FWsam] Sig_ID     :  %lu\n",ntohl(((Unified2EventCommon *)event)->signature_id));
+    if(size<1)
+        size=1;
 
-#endif
+    for(rows=1; rows<size; rows<<=1)    /* one row per entry, rounded up */
+        ;
 
-                        encbuf=TwoFishAlloc(sizeof(FWsamPacket),FALSE,FALSE,station->stationfish); /* get the encryption buffer */
-                        len=TwoFishEncrypt((char *)&sampacket,&encbuf,sizeof(FWsamPacket),FALSE,station->stationfish); /* encrypt the packet with current key */
+    t=(FWsamRepeatTable *)SnortAlloc(sizeof(FWsamRepeatTable));
+    t->rows=(FWsamRepeat **)SnortAlloc(sizeof(FWsamRepeat *)*rows);
+    t->pool=(FWsamRepeat *)SnortAlloc(sizeof(FWsamRepeat)*size);
+    t->mask=rows-1;
+    t->size=size;
+
+    for(i=0; i<size; i++)               /* chain up the unused entries */
+    {
+        t->pool[i].next=t->unused;
+        t->unused=&t->pool[i];
+    }
+    return t;
+}
+
+void FWsamRepeatFree(FWsamRepeatTable *t)
+{
+    if(!t)
+        return;
+
+    LogMessage("INFO => [Alert_FWsam] Repeat table: %lu hits, %lu misses, %lu evicted, %u of %u entries in use\n",
+               t->hits,t->misses,t->evicted,t->count,t->size);
+
+    free(t->pool);
+    free(t->rows);
+    free(t);
+}
+
+static inline unsigned int FWsamRepeatHash(FWsamRepeatTable *t,FWsamRepeatKey *key)
+{
+    uint32_t h;
+
+    h=key->srcip*0x9e3779b1;
+    h^=key->dstip*0x85ebca77;
+    h^=(key->duration^((uint32_t)key->dstport<<16)^(key->protocol<<8)^key->mode)*0xc2b2ae3d;
+    h^=h>>16;
+
+    return h&t->mask;
+}
+
+/*  Takes an entry out of its row and off the age list. */
+static void FWsamRepeatUnlink(FWsamRepeatTable *t,FWsamRepeat *e)
+{
+    FWsamRepeat **pp=&t->rows[FWsamRepeatHash(t,&e->key)];
+
+    while(*pp!=e)
+        pp=&(*pp)->next;
+    *pp=e->next;
+
+    if(e->older)
+        e->older->newer=e->newer;
+    else
+        t->oldest=e->newer;
+
+    if(e->newer)
+        e->newer->older=e->older;
+    else
+        t->newest=e->older;
+
+    t->count--;
+}
+
+/*  Returns TRUE if the same block was requested within its window
+ *  (FWSAM_REPET_TIME, or the block's duration if that is shorter).
+ *  Otherwise notes the request and returns FALSE.
+ */
+int FWsamRepeated(FWsamRepeatTable *t,FWsamRepeatKey *key,time_t now)
+{
+    FWsamRepeat *e;
+    unsigned int row;
+    time_t window;
+
+    /* whatever is older than the longest window is of no use anymore */
+    while(t->oldest && now-t->oldest->time>=FWSAM_REPET_TIME)
+    {
+        e=t->oldest;
+        FWsamRepeatUnlink(t,e);
+        e->next=t->unused;
+        t->unused=e;
+    }
+
+    window=(key->duration>FWSAM_REPET_TIME) ? FWSAM_REPET_TIME : key->duration;
+    row=FWsamRepeatHash(t,key);
+
+    for(e=t->rows[row]; e; e=e->next)
+    {
+        if(!memcmp(&e->key,key,sizeof(FWsamRepeatKey)))
+            break;
+    }
+
+    if(e && now-e->time<window)
+    {
+        t->hits++;
+        return TRUE;
+    }
+    t->misses++;
+
+    if(!window)                         /* permanent blocks are always sent */
+        return FALSE;
+
+    if(e)                               /* seen before, but out of its window */
+        FWsamRepeatUnlink(t,e);
+    else if(t->unused)
+    {
+        e=t->unused;
+        t->unused=e->next;
+    }
+    else                                /* full, make room */
+    {
+        e=t->oldest;
+        FWsamRepeatUnlink(t,e);
+        t->evicted++;
+    }
+
+    e->key=*key;
+    e->time=now;
+    e->next=t->rows[row];
+    t->rows[row]=e;
+
+    e->newer=NULL;
+    e->older=t->newest;
+    if(t->newest)
+        t->newest->newer=e;
+    else
+        t->oldest=e;
+    t->newest=e;
+
+    t->count++;
+    return FALSE;
+}
+
+/*  Station manager
+ *
+ *  Every station in the global list has a sender thread which owns the
+ *  connection, sequence numbers and key of that station. AlertFWsam() only
+ *  puts blocking requests on the station's queue. The thread keeps the
+ *  connection open between requests; agents that close it after each
+ *  answer (as SnortSam does) are transparently reconnected to.
+ */
+void FWsamStartSender(FWsamStation *station)
+{
+    if((station->queue=(FWsamBlock *)malloc(sizeof(FWsamBlock)*FWSAM_QUEUE_SIZE))==NULL)
+        FatalError("ERROR => [Alert_FWsam](FWsamStartSender) malloc failed for queue!\n");
+
+    pthread_mutex_init(&station->queue_lock,NULL);
+    pthread_cond_init(&station->queue_cond,NULL);
+
+    if(pthread_create(&station->sender_tid,NULL,FWsamSender,station))
+        FatalError("ERROR => [Alert_FWsam](FWsamStartSender) Could not start sender for host %s!\n",sfip_ntoa(&station->stationip));
+
+    station->sender_on=TRUE;
+}
+
+/*  Lets the sender finish what is queued (as long as the agent answers),
+ *  joins it and reports the station's counters.
+ */
+void FWsamStopSender(FWsamStation *station)
+{
+    if(!station->sender_on)
+        return;
+
+    pthread_mutex_lock(&station->queue_lock);
+    station->sender_stop=TRUE;
+    pthread_cond_broadcast(&station->queue_cond);
+    pthread_mutex_unlock(&station->queue_lock);
+
+    pthread_join(station->sender_tid,NULL);
+    station->sender_on=FALSE;
+
+    FWsamCloseConnection(station);
+
+    LogMessage("INFO => [Alert_FWsam] Host %s: %lu blocks queued, %lu sent, %lu dropped, %lu retries, %lu connects, "
+               "queue max %u, latency avg %.1f ms max %.1f ms\n",
+               sfip_ntoa(&station->stationip),station->queued,station->sent,station->dropped,
+               station->retries,station->connects,station->queue_max,
+               station->sent ? (double)station->latency_sum/station->sent/1000.0 : 0.0,
+               (double)station->latency_max/1000.0);
+
+    pthread_cond_destroy(&station->queue_cond);
+    pthread_mutex_destroy(&station->queue_lock);
+    free(station->queue);
+    station->queue=NULL;
+}
+
+/*  Hands a blocking request over to the station's sender. Never waits for
+ *  the agent; if the queue is full the request is dropped, and nothing is
+ *  queued for a station the sender gave up on.
+ */
+void FWsamQueueBlock(FWsamStation *station,FWsamBlock *blk)
+{
+    pthread_mutex_lock(&station->queue_lock);
+
+    if(station->station_dead)
+    {
+        pthread_mutex_unlock(&station->queue_lock);
+        return;
+    }
+
+    if(station->queue_cnt>=FWSAM_QUEUE_SIZE)
+    {
+        station->dropped++;
+        if(!station->queue_full)
+            LogMessage("WARNING => [Alert_FWsam] Queue for host %s is full, dropping blocks.\n",sfip_ntoa(&station->stationip));
+        station->queue_full=TRUE;
+    }
+    else
+    {
+        station->queue[(station->queue_head+station->queue_cnt)%FWSAM_QUEUE_SIZE]=*blk;
+        station->queue_cnt++;
+        station->queued++;
+        station->queue_full=FALSE;
+
+        if(station->queue_cnt>station->queue_max)
+            station->queue_max=station->queue_cnt;
+
+        pthread_cond_signal(&station->queue_cond);
+    }
+
+    pthread_mutex_unlock(&station->queue_lock);
+}
+
+/*  The sender thread. A request stays at the head of the queue until the
+ *  agent took it, so the order of blocks is kept across outages.
+ */
+void *FWsamSender(void *arg)
+{
+    FWsamStation *station=(FWsamStation *)arg;
+    FWsamBlock blk;
+    sigset_t mask;
+    struct timeval now;
+    struct timespec until;
+    unsigned int backoff=FWSAM_RETRY_MIN;
+    uint64_t latency;
+    int result;
+
+    /* signals are for the main thread */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK,&mask,NULL);
+
+    result=FWsamCheckIn(station);
+
+    pthread_mutex_lock(&station->queue_lock);
+    if(!result)                             /* if we can't talk to the agent... */
+        station->station_dead=TRUE;         /* ...we ignore it */
+
+    while(1)
+    {
+        while(!station->queue_cnt && !station->sender_stop)
+            pthread_cond_wait(&station->queue_cond,&station->queue_lock);
+
+        if(!station->queue_cnt)
+            break;
+
+        blk=station->queue[station->queue_head];
+
+        if(station->station_dead)
+            result=FWSAM_DEAD;
+        else
+        {
+            pthread_mutex_unlock(&station->queue_lock);
+
+            result=FWsamStationSend(station,&blk);
+
+            if(result==FWSAM_DEAD)          /* If it went bad, we remove the station */
+                FWsamCloseConnection(station);
+
+            pthread_mutex_lock(&station->queue_lock);
+
+            if(result==FWSAM_DEAD)
+                station->station_dead=TRUE;
+        }
+
+        if(result==FWSAM_RETRY)
+        {
+            station->retries++;
+
+            if(station->sender_stop)        /* no time to wait for the agent on the way out */
+            {
+                station->dropped+=station->queue_cnt;
+                station->queue_cnt=0;
+                continue;
+            }
+
+            gettimeofday(&now,NULL);
+            until.tv_sec=now.tv_sec+backoff;
+            until.tv_nsec=now.tv_usec*1000;
+
+            while(!station->sender_stop &&
+                  pthread_cond_timedwait(&station->queue_cond,&station->queue_lock,&until)!=ETIMEDOUT)
+                ;
+
+            if((backoff*=2)>FWSAM_RETRY_MAX)
+                backoff=FWSAM_RETRY_MAX;
+            continue;
+        }
+
+        station->queue_head=(station->queue_head+1)%FWSAM_QUEUE_SIZE;
+        station->queue_cnt--;
+
+        if(result==FWSAM_SENT)
+        {
+            gettimeofday(&now,NULL);
+            latency=(uint64_t)(now.tv_sec-blk.queued.tv_sec)*1000000+now.tv_usec-blk.queued.tv_usec;
+
+            station->sent++;
+            station->latency_sum+=latency;
+            if(latency>station->latency_max)
+                station->latency_max=latency;
+
+            backoff=FWSAM_RETRY_MIN;
+        }
+        else
+            station->dropped++;
+    }
+    pthread_mutex_unlock(&station->queue_lock);
+
+    return NULL;
+}
+
+/*  Sends one blocking request and handles the agent's answer.
+ *  Returns FWSAM_SENT, FWSAM_RETRY if the agent could not be reached,
+ *  or FWSAM_DEAD if the station has to be ignored from now on.
+ */
+int FWsamStationSend(FWsamStation *station,FWsamBlock *blk)
+{
+    FWsamPacket sampacket;
+    char *encbuf;
+    int len,reused,stationtry,result;
+
+    for(stationtry=1; stationtry<=2; stationtry++)
+    {
+        if(!station->lastcontact)           /* not checked in yet, or the agent lost track of us */
+        {
+            if(!FWsamCheckIn(station))
+                return FWSAM_DEAD;
+            if(!station->lastcontact)       /* not reachable */
+                return FWSAM_RETRY;
+        }
+
+        reused=FWsamConnectionAlive(station);
+        if(!reused && !FWsamConnect(station))
+        {
+            LogMessage("WARNING => [Alert_FWsam] Could not send block to host %s. Will try later.\n",sfip_ntoa(&station->stationip));
+            return FWSAM_RETRY;
+        }
+
+        /* now build the packet */
+        memset(&sampacket,0,sizeof(FWsamPacket));
+        station->myseqno+=station->stationseqno; /* increase my seqno by adding agent seq no */
+        sampacket.endiancheck=1;                        /* This is an endian indicator for Snortsam */
+        sampacket.snortseqno[0]=(char)station->myseqno;
+        sampacket.snortseqno[1]=(char)(station->myseqno>>8);
+        sampacket.fwseqno[0]=(char)station->stationseqno;/* fill station seqno */
+        sampacket.fwseqno[1]=(char)(station->stationseqno>>8);
+        sampacket.status=FWSAM_STATUS_BLOCK;            /* set block mode */
+        sampacket.version=FWSAM_PACKETVERSION;          /* set packet version */
+        sampacket.duration[0]=(char)blk->duration;      /* set duration */
+        sampacket.duration[1]=(char)(blk->duration>>8);
+        sampacket.duration[2]=(char)(blk->duration>>16);
+        sampacket.duration[3]=(char)(blk->duration>>24);
+        sampacket.fwmode=blk->fwmode;                   /* set the mode */
+        sampacket.dstip[0]=(char)blk->dstip;            /* destination IP */
+        sampacket.dstip[1]=(char)(blk->dstip>>8);
+        sampacket.dstip[2]=(char)(blk->dstip>>16);
+        sampacket.dstip[3]=(char)(blk->dstip>>24);
+        sampacket.srcip[0]=(char)blk->srcip;            /* source IP */
+        sampacket.srcip[1]=(char)(blk->srcip>>8);
+        sampacket.srcip[2]=(char)(blk->srcip>>16);
+        sampacket.srcip[3]=(char)(blk->srcip>>24);
+        sampacket.protocol[0]=(char)blk->protocol;      /* protocol */
+        sampacket.protocol[1]=(char)(blk->protocol>>8);
+        sampacket.srcport[0]=(char)blk->srcport;        /* set ports (0 if not TCP or UDP) */
+        sampacket.srcport[1]=(char)(blk->srcport>>8);
+        sampacket.dstport[0]=(char)blk->dstport;
+        sampacket.dstport[1]=(char)(blk->dstport>>8);
+        sampacket.sig_id[0]=(char)blk->sig_id;          /* set signature ID */
+        sampacket.sig_id[1]=(char)(blk->sig_id>>8);
+        sampacket.sig_id[2]=(char)(blk->sig_id>>16);
+        sampacket.sig_id[3]=(char)(blk->sig_id>>24);
 
-                        if(send(stationsocket,encbuf,len,0)!=len) /* weird...could not send */
-                        {   LogMessage("WARNING => [Alert_FWsam] Could not send to host %s. Will try again later.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                            closesocket(stationsocket);
-#else
-                            close(stationsocket);
-#endif
-                            stationtry=0;
-                        }
-                        else
-                        {   i=FWSAM_NETWAIT;
-#ifdef WIN32
-                            ioctlsocket(stationsocket,FIONBIO,&i);  /* set non blocking and wait for  */
-#else
-                            ioctl(stationsocket,FIONBIO,&i);        /* set non blocking and wait for  */
-#endif
-                            while(i-- >1)                           /* the response packet   */
-                            {   waitms(10); /* wait for response (default maximum 3 secs */
-                                if(recv(stationsocket,encbuf,len,0)==len)
-                                    i=0; /* if we received packet we set the counter to 0. */
-                                         /* by the time we check with if, it's already dec'ed to -1 */
-                            }
-                            if(!i) /* id we timed out (i was one, then dec'ed)... */
-                            {   LogMessage("WARNING => [Alert_FWsam] Did not receive response from host %s. Will try again later.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                                closesocket(stationsocket);
-#else
-                                close(stationsocket);
-#endif
-                                stationtry=0;
-                            }
-                            else /* got a packet */
-                            {   decbuf=(char *)&sampacket; /* get the pointer to the packet struct */
-                                len=TwoFishDecrypt(encbuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try to decrypt the packet with current key */
-
-                                if(len!=sizeof(FWsamPacket)) /* invalid decryption */
-                                {   strcpy(station->stationkey,station->initialkey); /* try the intial key */
-                                    TwoFishDestroy(station->stationfish);
-                                    station->stationfish=TwoFishInit(station->stationkey); /* re-initialize the TwoFish with the intial key */
-                                    len=TwoFishDecrypt(encbuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try again to decrypt */
-                                    LogMessage("INFO => [Alert_FWsam] Had to use initial key!\n");
-                                }
-                                if(len==sizeof(FWsamPacket)) /* valid decryption */
-                                {   if(sampacket.version==FWSAM_PACKETVERSION)/* master speaks my language */
-                                    {   if(sampacket.status==FWSAM_STATUS_OK || sampacket.status==FWSAM_STATUS_NEWKEY
-                                        || sampacket.status==FWSAM_STATUS_RESYNC || sampacket.status==FWSAM_STATUS_HOLD)
-                                        {   station->stationseqno=sampacket.fwseqno[0] | (sampacket.fwseqno[1]<<8); /* get stations seqno */
-                                            station->lastcontact=(unsigned long)time(NULL); /* set the last contact time (not used yet) */
 #ifdef FWSAMDEBUG
-                                    LogMessage("DEBUG => [Alert_FWsam] Received %s\n",sampacket.status==FWSAM_STATUS_OK?"OK":
-                                                                           sampacket.status==FWSAM_STATUS_NEWKEY?"NEWKEY":
-                                                                           sampacket.status==FWSAM_STATUS_RESYNC?"RESYNC":
-                                                                           sampacket.status==FWSAM_STATUS_HOLD?"HOLD":"ERROR");
-                                    LogMessage("DEBUG => [Alert_FWsam] Snort SeqNo:  %x\n",sampacket.snortseqno[0]|(sampacket.snortseqno[1]<<8));
-                                    LogMessage("DEBUG => [Alert_FWsam] Mgmt SeqNo :  %x\n",station->stationseqno);
-                                    LogMessage("DEBUG => [Alert_FWsam] Status     :  %i\n",sampacket.status);
-                                    LogMessage("DEBUG => [Alert_FWsam] Version    :  %i\n",sampacket.version);
+        LogMessage("DEBUG => [Alert_FWsam] Sending BLOCK%s\n",reused?" (reusing connection)":"");
+        LogMessage("DEBUG => [Alert_FWsam] Snort SeqNo:  %x\n",station->myseqno);
+        LogMessage("DEBUG => [Alert_FWsam] Mgmt SeqNo :  %x\n",station->stationseqno);
+        LogMessage("DEBUG => [Alert_FWsam] Mode       :  %i\n",blk->fwmode);
+        LogMessage("DEBUG => [Alert_FWsam] Duration   :  %lu\n",(unsigned long)blk->duration);
+        LogMessage("DEBUG => [Alert_FWsam] Protocol   :  %i\n",blk->protocol);
+        LogMessage("DEBUG => [Alert_FWsam] Src Port   :  %i\n",blk->srcport);
+        LogMessage("DEBUG => [Alert_FWsam] Dest Port  :  %i\n",blk->dstport);
+        LogMessage("DEBUG => [Alert_FWsam] Sig_ID     :  %lu\n",(unsigned long)blk->sig_id);
 #endif
-                                            if(sampacket.status==FWSAM_STATUS_HOLD)
-                                            {   i=FWSAM_NETHOLD;            /* Stay on hold for a maximum of 60 secs (default) */
-                                                while(i-- >1)                           /* the response packet   */
-                                                {   waitms(10); /* wait for response  */
-                                                    if(recv(stationsocket,encbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,0)==sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE)
-                                                      i=0; /* if we received packet we set the counter to 0. */
-                                                }
-                                                if(!i) /* id we timed out (i was one, then dec'ed)... */
-                                                {   LogMessage("WARNING => [Alert_FWsam] Did not receive response from host %s. Will try again later.\n",sfip_ntoa(&station->stationip));
-                                                    stationtry=0;
-                                                    sampacket.status=FWSAM_STATUS_ERROR;
-                                                }
-                                                else /* got a packet */
-                                                {   decbuf=(char *)&sampacket; /* get the pointer to the packet struct */
-                                                    len=TwoFishDecrypt(encbuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try to decrypt the packet with current key */
-
-                                                    if(len!=sizeof(FWsamPacket)) /* invalid decryption */
-                                                    {   strcpy(station->stationkey,station->initialkey); /* try the intial key */
-                                                        TwoFishDestroy(station->stationfish);
-                                                        station->stationfish=TwoFishInit(station->stationkey); /* re-initialize the TwoFish with the intial key */
-                                                        len=TwoFishDecrypt(encbuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try again to decrypt */
-                                                        LogMessage("INFO => [Alert_FWsam] Had to use initial key again!\n");
-                                                    }
+
+        encbuf=TwoFishAlloc(sizeof(FWsamPacket),FALSE,FALSE,station->stationfish); /* get the encryption buffer */
+        len=TwoFishEncrypt((char *)&sampacket,&encbuf,sizeof(FWsamPacket),FALSE,station->stationfish); /* encrypt the packet with current key */
+
+        if(send(station->stationsocket,encbuf,len,0)!=len || !FWsamRecvPacket(station,encbuf,len,FWSAM_NETWAIT))
+        {
+            free(encbuf);
+            FWsamCloseConnection(station);
+
+            if(reused)                      /* the agent dropped the idle connection, */
+            {   stationtry--;               /* so once more on a fresh one */
+                continue;
+            }
+            LogMessage("WARNING => [Alert_FWsam] Did not receive response from host %s. Will try again later.\n",sfip_ntoa(&station->stationip));
+            return FWSAM_RETRY;
+        }
+
+        result=FWsamHandleReply(station,encbuf,&sampacket,stationtry);
+        free(encbuf); /* release of the TwoFishAlloc'ed encryption buffer */
+
+        if(result!=FWSAM_AGAIN)
+            return result;
+    }
+    return FWSAM_DEAD;
+}
+
+/*  Checks the agent's answer to a block and re-keys if asked to.
+ *  Returns FWSAM_AGAIN if we have to check in again and resend.
+ */
+int FWsamHandleReply(FWsamStation *station,char *encbuf,FWsamPacket *sampacket,int stationtry)
+{
+    if(!FWsamDecrypt(station,encbuf,sampacket)) /* if the intial key failed to decrypt as well, the keys are not configured the same */
+    {   ErrorMessage("ERROR => [Alert_FWsam] Password mismatch! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+        return FWSAM_DEAD;
+    }
+    if(sampacket->version!=FWSAM_PACKETVERSION) /* if the SnortSam agent uses a different packet version, we have no choice but to ignore it. */
+    {   ErrorMessage("ERROR => [Alert_FWsam] Protocol version error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+        return FWSAM_DEAD;
+    }
+    if(sampacket->status==FWSAM_STATUS_ERROR)   /* if SnortSam reports an error on second try, */
+    {
+        FWsamCloseConnection(station);
+        if(stationtry>1)                        /* something is messed up and we ignore that station. */
+        {   ErrorMessage("ERROR => [Alert_FWsam] Could not renegotiate key! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+            return FWSAM_DEAD;
+        }
+        station->lastcontact=0;                 /* if we get an error on the first try, we first check in again. */
+        return FWSAM_AGAIN;
+    }
+    if(sampacket->status!=FWSAM_STATUS_OK && sampacket->status!=FWSAM_STATUS_NEWKEY
+    && sampacket->status!=FWSAM_STATUS_RESYNC && sampacket->status!=FWSAM_STATUS_HOLD)
+    {   ErrorMessage("ERROR => [Alert_FWsam] Funky handshake error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+        return FWSAM_DEAD;
+    }
+
+    station->stationseqno=sampacket->fwseqno[0] | (sampacket->fwseqno[1]<<8); /* get stations seqno */
+    station->lastcontact=(unsigned long)time(NULL); /* set the last contact time */
+
 #ifdef FWSAMDEBUG
-                                    LogMessage("DEBUG => [Alert_FWsam] Received %s\n",sampacket.status==FWSAM_STATUS_OK?"OK":
-                                                                           sampacket.status==FWSAM_STATUS_NEWKEY?"NEWKEY":
-                                                                           sampacket.status==FWSAM_STATUS_RESYNC?"RESYNC":
-                                                                           sampacket.status==FWSAM_STATUS_HOLD?"HOLD":"ERROR");
-                                    LogMessage("DEBUG => [Alert_FWsam] Snort SeqNo:  %x\n",sampacket.snortseqno[0]|(sampacket.snortseqno[1]<<8));
-                                    LogMessage("DEBUG => [Alert_FWsam] Mgmt SeqNo :  %x\n",station->stationseqno);
-                                    LogMessage("DEBUG => [Alert_FWsam] Status     :  %i\n",sampacket.status);
-                                    LogMessage("DEBUG => [Alert_FWsam] Version    :  %i\n",sampacket.version);
+    LogMessage("DEBUG => [Alert_FWsam] Received %s\n",sampacket->status==FWSAM_STATUS_OK?"OK":
+                                           sampacket->status==FWSAM_STATUS_NEWKEY?"NEWKEY":
+                                           sampacket->status==FWSAM_STATUS_RESYNC?"RESYNC":"HOLD");
+    LogMessage("DEBUG => [Alert_FWsam] Snort SeqNo:  %x\n",sampacket->snortseqno[0]|(sampacket->snortseqno[1]<<8));
+    LogMessage("DEBUG => [Alert_FWsam] Mgmt SeqNo :  %x\n",station->stationseqno);
 #endif
-                                                    if(len!=sizeof(FWsamPacket)) /* invalid decryption */
-                                                    {   ErrorMessage("ERROR => [Alert_FWsam] Password mismatch! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-                                                        deletestation=TRUE;
-                                                        sampacket.status=FWSAM_STATUS_ERROR;
-                                                    }
-                                                    else if(sampacket.version!=FWSAM_PACKETVERSION) /* invalid protocol version */
-                                                    {   ErrorMessage("ERROR => [Alert_FWsam] Protocol version error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-                                                        deletestation=TRUE;
-                                                        sampacket.status=FWSAM_STATUS_ERROR;
-                                                    }
-                                                    else if(sampacket.status!=FWSAM_STATUS_OK && sampacket.status!=FWSAM_STATUS_NEWKEY && sampacket.status!=FWSAM_STATUS_RESYNC)
-                                                    {   ErrorMessage("ERROR => [Alert_FWsam] Funky handshake error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-                                                        deletestation=TRUE;
-                                                        sampacket.status=FWSAM_STATUS_ERROR;
-                                                    }
-                                                }
-                                            }
-                                            if(sampacket.status==FWSAM_STATUS_RESYNC)  /* if station want's to resync... */
-                                            {   strcpy(station->stationkey,station->initialkey); /* ...we use the intial key... */
-                                                memcpy(station->fwkeymod,sampacket.duration,4);  /* and note the random key modifier */
-                                            }
-                                            if(sampacket.status==FWSAM_STATUS_NEWKEY || sampacket.status==FWSAM_STATUS_RESYNC)
-                                            {
-                                                FWsamNewStationKey(station,&sampacket); /* generate new TwoFish keys */
+
+    if(sampacket->status==FWSAM_STATUS_HOLD)    /* Stay on hold for a maximum of 60 secs (default) */
+    {
+        if(!FWsamRecvPacket(station,encbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FWSAM_NETHOLD))
+        {   LogMessage("WARNING => [Alert_FWsam] Did not receive response from host %s. Will try again later.\n",sfip_ntoa(&station->stationip));
+            FWsamCloseConnection(station);
+            return FWSAM_RETRY;
+        }
+        if(!FWsamDecrypt(station,encbuf,sampacket))
+        {   ErrorMessage("ERROR => [Alert_FWsam] Password mismatch! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+            return FWSAM_DEAD;
+        }
+        if(sampacket->version!=FWSAM_PACKETVERSION)
+        {   ErrorMessage("ERROR => [Alert_FWsam] Protocol version error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+            return FWSAM_DEAD;
+        }
+        if(sampacket->status!=FWSAM_STATUS_OK && sampacket->status!=FWSAM_STATUS_NEWKEY && sampacket->status!=FWSAM_STATUS_RESYNC)
+        {   ErrorMessage("ERROR => [Alert_FWsam] Funky handshake error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+            return FWSAM_DEAD;
+        }
+    }
+
+    if(sampacket->status==FWSAM_STATUS_RESYNC)  /* if station want's to resync... */
+    {   strcpy(station->stationkey,station->initialkey); /* ...we use the intial key... */
+        memcpy(station->fwkeymod,sampacket->duration,4);  /* and note the random key modifier */
+    }
+    if(sampacket->status==FWSAM_STATUS_NEWKEY || sampacket->status==FWSAM_STATUS_RESYNC)
+    {
+        FWsamNewStationKey(station,sampacket); /* generate new TwoFish keys */
 #ifdef FWSAMDEBUG
-                                                    LogMessage("DEBUG => [Alert_FWsam] Generated new encryption key...\n");
-#endif
-                                            }
-#ifdef WIN32
-                                            closesocket(stationsocket);
-#else
-                                            close(stationsocket);
-#endif
-                                            stationtry=0;
-                                        }
-                                        else if(sampacket.status==FWSAM_STATUS_ERROR) /* if SnortSam reports an error on second try, */
-                                        {
-#ifdef WIN32
-                                            closesocket(stationsocket);               /* something is messed up and ... */
-#else
-                                            close(stationsocket);
-#endif
-                                            if(stationtry>1)                          /* we ignore that station. */
-                                            {   deletestation=TRUE;                   /* flag for deletion */
-                                                ErrorMessage("ERROR => [Alert_FWsam] Could not renegotiate key! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-                                            }
-                                            else                            /* if we get an error on the first try, */
-                                            {   if(!FWsamCheckIn(station))  /* we first try to check in again. */
-                                                {   deletestation=TRUE;
-                                                    ErrorMessage("ERROR => [Alert_FWsam] Password mismatch! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-                                                }
-                                            }
-                                        }
-                                        else /* an unknown status means trouble... */
-                                        {   ErrorMessage("ERROR => [Alert_FWsam] Funky handshake error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                                            closesocket(stationsocket);
-#else
-                                            close(stationsocket);
+        LogMessage("DEBUG => [Alert_FWsam] Generated new encryption key...\n");
 #endif
-                                            deletestation=TRUE;
-                                        }
-                                    }
-                                    else   /* if the SnortSam agent uses a different packet version, we have no choice but to ignore it. */
-                                    {   ErrorMessage("ERROR => [Alert_FWsam] Protocol version error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                                        closesocket(stationsocket);
-#else
-                                        close(stationsocket);
-#endif
-                                        deletestation=TRUE;
-                                    }
-                                }
-                                else /* if the intial key failed to decrypt as well, the keys are not configured the same, and we ignore that SnortSam station. */
-                                {   ErrorMessage("ERROR => [Alert_FWsam] Password mismatch! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                                    closesocket(stationsocket);
-#else
-                                    close(stationsocket);
-#endif
-                                    deletestation=TRUE;
-                                }
-                            }
-                        }
-                        free(encbuf); /* release of the TwoFishAlloc'ed encryption buffer */
-                    }
-                    if(stationtry==0 || deletestation)      /* if everything went real well, or real bad... */
-                    {   if(deletestation){                  /* If it went bad, we remove the station from the list by marking the IP */
-//                          station->stationip.s_addr=0;
-                            station->stationip.ip32[0]=0;
-                                                }
-                        fwsamlist=fwsamlist->next;
-                    }
-                }
-                else
-                    fwsamlist=fwsamlist->next;
-            }
+    }
+    return FWSAM_SENT;
+}
+
+/*  Decrypts an answer, falling back to the initial key if the agent
+ *  did (after a restart, for instance).
+ */
+int FWsamDecrypt(FWsamStation *station,char *encbuf,FWsamPacket *sampacket)
+{
+    char *decbuf=(char *)sampacket;
+    int len;
+
+    len=TwoFishDecrypt(encbuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try to decrypt the packet with current key */
+
+    if(len!=sizeof(FWsamPacket)) /* invalid decryption */
+    {   strcpy(station->stationkey,station->initialkey); /* try the intial key */
+        TwoFishDestroy(station->stationfish);
+        station->stationfish=TwoFishInit(station->stationkey); /* re-initialize the TwoFish with the intial key */
+        len=TwoFishDecrypt(encbuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try again to decrypt */
+        LogMessage("INFO => [Alert_FWsam] Had to use initial key!\n");
+    }
+    return len==sizeof(FWsamPacket);
+}
+
+/*  Opens the connection to the agent, giving up after FWSAM_NETWAIT.
+ */
+int FWsamConnect(FWsamStation *station)
+{
+    SOCKET stationsocket;
+    fd_set wfds;
+    struct timeval tv;
+    socklen_t errlen=sizeof(int);
+    int i,err=0;
+
+    stationsocket=socket(PF_INET,SOCK_STREAM,IPPROTO_TCP);
+    if(stationsocket==INVALID_SOCKET)
+        FatalError("ERROR => [Alert_FWsam](FWsamConnect) Funky socket error (socket)!\n");
+    if(bind(stationsocket,(struct sockaddr *)&(station->localsocketaddr),sizeof(struct sockaddr)))
+        FatalError("ERROR => [Alert_FWsam](FWsamConnect) Could not bind socket!\n");
+
+    i=TRUE;
+    ioctlsocket(stationsocket,FIONBIO,&i);  /* set non blocking for the connect */
+
+    if(connect(stationsocket,(struct sockaddr *)&station->stationsocketaddr,sizeof(struct sockaddr)))
+    {
+        if(errno==EINPROGRESS)
+        {
+            FD_ZERO(&wfds);
+            FD_SET(stationsocket,&wfds);
+            tv.tv_sec=FWSAM_NETWAIT/100;
+            tv.tv_usec=(FWSAM_NETWAIT%100)*10000;
+
+            if(select(stationsocket+1,NULL,&wfds,NULL,&tv)<=0 ||
+               getsockopt(stationsocket,SOL_SOCKET,SO_ERROR,(char *)&err,&errlen))
+                err=ETIMEDOUT;
         }
         else
-        {
+            err=errno;
+    }
+
+    if(err)
+    {
+        closesocket(stationsocket);
+        return FALSE;
+    }
+
+    i=FALSE;
+    ioctlsocket(stationsocket,FIONBIO,&i);
+    i=TRUE;
+    setsockopt(stationsocket,IPPROTO_TCP,TCP_NODELAY,(char *)&i,sizeof(i)); /* one small packet per request */
+
+    station->stationsocket=stationsocket;
+    station->connects++;
+
 #ifdef FWSAMDEBUG
-            LogMessage("DEBUG => [Alert_FWsam] Skipping repetitive block.\n");
+    LogMessage("DEBUG => [Alert_FWsam] Connected to host %s.\n",sfip_ntoa(&station->stationip));
 #endif
-        }
+    return TRUE;
+}
+
+/*  Returns TRUE if the connection is open and still usable. The agent
+ *  has nothing to say between requests, so anything readable means it
+ *  closed the connection (or is confused), either way we start over.
+ */
+int FWsamConnectionAlive(FWsamStation *station)
+{
+    fd_set rfds;
+    struct timeval tv;
+
+    if(station->stationsocket==INVALID_SOCKET)
+        return FALSE;
+
+    FD_ZERO(&rfds);
+    FD_SET(station->stationsocket,&rfds);
+    tv.tv_sec=tv.tv_usec=0;
+
+    if(select(station->stationsocket+1,&rfds,NULL,NULL,&tv)==0)
+        return TRUE;
+
+    FWsamCloseConnection(station);
+    return FALSE;
+}
+
+void FWsamCloseConnection(FWsamStation *station)
+{
+    if(station->stationsocket!=INVALID_SOCKET)
+    {
+        closesocket(station->stationsocket);
+        station->stationsocket=INVALID_SOCKET;
+    }
+}
+
+/*  Reads an answer of len bytes, waiting for it no longer than wait
+ *  100th of a second.
+ */
+int FWsamRecvPacket(FWsamStation *station,char *buf,int len,int wait)
+{
+    fd_set rfds;
+    struct timeval now,end,tv;
+    int got=0,n;
+
+    gettimeofday(&now,NULL);
+    tv.tv_sec=wait/100;
+    tv.tv_usec=(wait%100)*10000;
+    timeradd(&now,&tv,&end);
+
+    while(got<len)
+    {
+        gettimeofday(&now,NULL);
+        if(!timercmp(&now,&end,<))
+            return FALSE;
+        timersub(&end,&now,&tv);
+
+        FD_ZERO(&rfds);
+        FD_SET(station->stationsocket,&rfds);
+
+        n=select(station->stationsocket+1,&rfds,NULL,NULL,&tv);
+        if(n<0 && errno!=EINTR)
+            return FALSE;
+        if(n<=0)
+            continue;
+
+        n=recv(station->stationsocket,buf+got,len-got,0);
+        if(n<=0)                            /* closed by the agent */
+            return FALSE;
+        got+=n;
     }
+    return TRUE;
 }
 
 /*  FWsamCheckOut will be called when Snort exists. It de-registeres this snort sensor
@@ -1493,8 +1990,9 @@ void FWsamFree(FWsamList *list)
         next=list->next;
         if (list->station)
         {
-            if(list->station->stationip.ip32[0])
-            //if(list->station->stationip.s_addr)
+            FWsamStopSender(list->station); /* Flush the queue, */
+
+            if(!list->station->station_dead)
                 FWsamCheckOut(list->station); /* Send a Check-Out to SnortSam, */
 
             TwoFishDestroy(list->station->stationfish); /* toss the fish, */
@@ -1504,8 +2002,12 @@ void FWsamFree(FWsamList *list)
         list=next; /* and move to next. */
     }
     FWsamStationList=NULL;
+    FWsamRepeatFree(FWsamRepeats);
+    FWsamRepeats=NULL;
     if(FWsamOptionField)
         free(FWsamOptionField);
+    FWsamOptionField=NULL;      /* we get called once per alert_fwsam line */
+    FWsamMaxOptions=0;
 }
 
 void AlertFWsamCleanExitFunc(int signal, void *arg)
@@ -0,0 +1,1312 @@
+/*
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* $Id$ */
+
+/* spo_alert_json
+ *
+ * Purpose:  output plugin for NDJSON (EVE style) alerting
+ *
+ * Arguments:  file=<path> fields=default|<list> limit=<size> roll=<secs>
+ *             compress=none|gzip|zstd buffer=<size> flush=<ms>
+ *
+ * Effect:
+ *
+ * Every event and every packet is written as one JSON object per line.
+ * The field list is resolved once at startup; records are formatted with
+ * a JsonWriter into large buffers which a writer thread (optionally)
+ * compresses, writes and rolls on size or age.  Rolled files are renamed
+ * to <file>.<time>[.gz|.zst] like the other text loggers.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#ifndef WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif /* !WIN32 */
+
+#ifdef HAVE_STRINGS_H
+#include <strings.h>
+#endif
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include "decode.h"
+#include "plugbase.h"
+#include "parser.h"
+#include "debug.h"
+#include "mstring.h"
+#include "util.h"
+#include "log.h"
+#include "map.h"
+#include "unified2.h"
+#include "spooler.h"
+
+#include "squirrel.h"
+
+#include "sfutil/sf_textlog.h"
+#include "sfutil/sf_json.h"
+
+#define DEFAULT_JSON "timestamp,event_type,event_id,src_ip,src_port,dest_ip,dest_port,proto,alert,payload,extra"
+
+#define DEFAULT_FILE     "alert.json"
+#define DEFAULT_LIMIT    (128*M_BYTES)
+#define DEFAULT_BUF_SIZE (1*M_BYTES)
+#define MIN_BUF_SIZE     (64*K_BYTES)
+#define DEFAULT_BUF_CNT  4
+#define DEFAULT_FLUSH_MS 1000
+#define ZBUF_SIZE        (256*K_BYTES)
+
+typedef enum _AlertJSONField
+{
+    JSON_FIELD_TIMESTAMP,
+    JSON_FIELD_EVENT_TYPE,
+    JSON_FIELD_EVENT_ID,
+    JSON_FIELD_SENSOR_ID,
+    JSON_FIELD_SRC_IP,
+    JSON_FIELD_SRC_PORT,
+    JSON_FIELD_DEST_IP,
+    JSON_FIELD_DEST_PORT,
+    JSON_FIELD_PROTO,
+    JSON_FIELD_ALERT,
+    JSON_FIELD_VLAN,
+    JSON_FIELD_MPLS,
+    JSON_FIELD_TTL,
+    JSON_FIELD_TOS,
+    JSON_FIELD_IP_ID,
+    JSON_FIELD_IP_LEN,
+    JSON_FIELD_TCP_FLAGS,
+    JSON_FIELD_TCP_SEQ,
+    JSON_FIELD_TCP_ACK,
+    JSON_FIELD_TCP_WIN,
+    JSON_FIELD_ICMP_TYPE,
+    JSON_FIELD_ICMP_CODE,
+    JSON_FIELD_PAYLOAD,
+    JSON_FIELD_PACKET,
+    JSON_FIELD_INTERFACE,
+    JSON_FIELD_HOSTNAME,
+    JSON_FIELD_EXTRA,
+    JSON_FIELD_MAX
+} AlertJSONField;
+
+static const char *json_field_names[JSON_FIELD_MAX] =
+{
+    "timestamp", "event_type", "event_id", "sensor_id",
+    "src_ip", "src_port", "dest_ip", "dest_port", "proto",
+    "alert", "vlan", "mpls", "ttl", "tos", "ip_id", "ip_len",
+    "tcp_flags", "tcp_seq", "tcp_ack", "tcp_win",
+    "icmp_type", "icmp_code", "payload", "packet",
+    "interface", "hostname", "extra",
+};
+
+typedef enum _AlertJSONCompress
+{
+    JSON_COMPRESS_NONE,
+    JSON_COMPRESS_GZIP,
+    JSON_COMPRESS_ZSTD,
+} AlertJSONCompress;
+
+typedef struct _AlertJSONBuf
+{
+    char *data;
+    size_t len;
+    size_t size;                /* buf_size, more after an oversized record */
+    uint8_t sync;               /* compressor should flush after it */
+} AlertJSONBuf;
+
+/* what a record has to offer, extracted once before the fields */
+typedef struct _AlertJSONRecord
+{
+    Packet *p;
+    Unified2IDSEvent *event;            /* either of these for alerts */
+    Unified2IDSEventIPv6 *event6;
+    us_cid_t event_id;
+    uint8_t extended;                   /* has mpls_label and vlanId */
+    uint32_t sec;
+    uint32_t usec;
+    const EventAttr *attr;              /* the event's extra data */
+    uint16_t attr_cnt;
+} AlertJSONRecord;
+
+typedef struct _AlertJSONData
+{
+    char *file;                 /* current file, with compression suffix */
+    char *base;                 /* as configured */
+    size_t limit;
+    uint32_t roll_secs;
+    uint32_t flush_ms;
+    AlertJSONCompress compress;
+
+    AlertJSONField fields[JSON_FIELD_MAX];
+    int num_fields;
+
+    JsonWriter *json;
+
+    /* cached "YYYY-MM-DDTHH:MM:SS" for ts_sec and the zone suffix */
+    uint32_t ts_sec;
+    char ts_prefix[24];
+    char ts_zone[8];
+
+    /* output buffers, filled by the output thread */
+    size_t buf_size;
+    uint32_t buf_cnt;
+    AlertJSONBuf *bufs;
+    uint32_t buf_prod;
+    uint32_t buf_cons;
+    struct timeval buf_sealed;
+
+    pthread_t writer_tid;
+    pthread_mutex_t buf_lock;
+    pthread_cond_t buf_full;
+    pthread_cond_t buf_free;
+    uint8_t writer_on;
+    uint8_t writer_stop;
+
+    /* writer thread state */
+    int fd;
+    size_t size;
+    time_t opened;
+    char *zbuf;
+#ifdef HAVE_LIBZ
+    z_stream zs;
+#endif
+#ifdef HAVE_LIBZSTD
+    ZSTD_CCtx *zcctx;
+#endif
+
+    uint64_t events;
+    uint64_t packets;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint32_t files;
+} AlertJSONData;
+
+
+/* list of function prototypes for this preprocessor */
+static void AlertJSONInit(char *);
+static AlertJSONData *AlertJSONParseArgs(char *);
+static void AlertJSONInitFinalize(int, void *);
+static void AlertJSON(Packet *, void *, uint32_t, void *);
+static void AlertJSONCleanExit(int, void *);
+static void AlertJSONRestart(int, void *);
+static void *AlertJSONWriter_T(void *);
+
+/*
+ * Function: AlertJSONSetup()
+ *
+ * Purpose: Registers the output plugin keyword and initialization
+ *          function into the output plugin list.  This is the function that
+ *          gets called from InitOutputPlugins() in plugbase.c.
+ *
+ * Arguments: None.
+ *
+ * Returns: void function
+ *
+ */
+void AlertJSONSetup(void)
+{
+    /* link the preprocessor keyword to the init function in
+       the preproc list */
+    RegisterOutputPlugin("alert_json", OUTPUT_TYPE_FLAG__ALERT, AlertJSONInit);
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Output plugin: alert_json is setup...\n"););
+}
+
+/*
+ * Function: AlertJSONInit(char *)
+ *
+ * Purpose: Calls the argument parsing function, performs final setup on data
+ *          structs, links the preproc function into the function list.
+ *
+ * Arguments: args => ptr to argument string
+ *
+ * Returns: void function
+ *
+ */
+static void AlertJSONInit(char *args)
+{
+    AlertJSONData *data;
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Output: JSON Initialized\n"););
+
+    /* parse the argument list from the rules file */
+    data = AlertJSONParseArgs(args);
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Linking JSON functions to call lists...\n"););
+
+    /* Set the preprocessor function into the function list */
+    AddFuncToPostConfigList(AlertJSONInitFinalize, data);
+    AddFuncToOutputList(AlertJSON, OUTPUT_TYPE__ALERT, data);
+    SetOutputFuncGroups(AlertJSON, data);
+    AddFuncToOutputList(AlertJSON, OUTPUT_TYPE__FLUSH, data);
+    AddFuncToCleanExitList(AlertJSONCleanExit, data);
+    AddFuncToRestartList(AlertJSONRestart, data);
+}
+
+static size_t AlertJSONParseSize(const char *tok)
+{
+    char *end;
+    size_t size = strtoul(tok, &end, 10);
+
+    if ( tok == end )
+        FatalError("alert_json: error in %s(%i): %s\n",
+            file_name, file_line, tok);
+
+    if ( toupper(*end) == 'G' )
+        size <<= 30; /* GB */
+
+    else if ( toupper(*end) == 'M' )
+        size <<= 20; /* MB */
+
+    else if ( toupper(*end) == 'K' )
+        size <<= 10; /* KB */
+
+    return size;
+}
+
+static void AlertJSONParseFields(AlertJSONData *data, const char *list)
+{
+    char **toks;
+    int num_toks;
+    int i, f;
+
+    toks = mSplit(list, ",", JSON_FIELD_MAX, &num_toks, 0);
+
+    for ( i = 0; i < num_toks; i++ )
+    {
+        for ( f = 0; f < JSON_FIELD_MAX; f++ )
+        {
+            if ( !strcasecmp(toks[i], json_field_names[f]) )
+                break;
+        }
+
+        if ( f == JSON_FIELD_MAX )
+            FatalError("alert_json: unknown field \"%s\" in %s(%i)\n",
+                toks[i], file_name, file_line);
+
+        if ( data->num_fields == JSON_FIELD_MAX )
+            FatalError("alert_json: more than %d fields in %s(%i)\n",
+                JSON_FIELD_MAX, file_name, file_line);
+
+        data->fields[data->num_fields++] = (AlertJSONField)f;
+    }
+
+    mSplitFree(&toks, num_toks);
+}
+
+/*
+ * Function: AlertJSONParseArgs(char *)
+ *
+ * Purpose: Process the keyword args.  Syntax is:
+ * output alert_json: [file=<logpath>] [fields=default|<list>] [limit=<size>]
+ *                    [roll=<secs>] [compress=none|gzip|zstd]
+ *                    [buffer=<size>] [flush=<ms>]
+ * list ::= <field>(,<field>)*
+ * size ::= <number>('G'|'M'|K')
+ *
+ * Arguments: args => argument list
+ *
+ * Returns: void function
+ */
+static AlertJSONData *AlertJSONParseArgs(char *args)
+{
+    char **toks;
+    int num_toks;
+    AlertJSONData *data;
+    char *filename = NULL;
+    const char *fields = DEFAULT_JSON;
+    int i;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "AlertJSONParseArgs: %s\n", args););
+    data = (AlertJSONData *)SnortAlloc(sizeof(AlertJSONData));
+
+    data->limit = DEFAULT_LIMIT;
+    data->buf_size = DEFAULT_BUF_SIZE;
+    data->buf_cnt = DEFAULT_BUF_CNT;
+    data->flush_ms = DEFAULT_FLUSH_MS;
+    data->fd = -1;
+
+    if ( !args ) args = "";
+    toks = mSplit((char *)args, " \t", 0, &num_toks, '\\');
+
+    for ( i = 0; i < num_toks; i++ )
+    {
+        char **stoks;
+        int num_stoks;
+
+        stoks = mSplit(toks[i], "=", 2, &num_stoks, 0);
+
+        if ( num_stoks != 2 )
+            FatalError("alert_json: error in %s(%i): %s\n",
+                file_name, file_line, toks[i]);
+
+        if ( !strcasecmp(stoks[0], "file") )
+        {
+            if ( filename ) free(filename);
+            filename = ProcessFileOption(barnyard2_conf_for_parsing, stoks[1]);
+        }
+        else if ( !strcasecmp(stoks[0], "fields") )
+        {
+            if ( strcasecmp(stoks[1], "default") )
+                AlertJSONParseFields(data, stoks[1]);
+        }
+        else if ( !strcasecmp(stoks[0], "limit") )
+        {
+            data->limit = AlertJSONParseSize(stoks[1]);
+        }
+        else if ( !strcasecmp(stoks[0], "roll") )
+        {
+            data->roll_secs = strtoul(stoks[1], NULL, 10);
+        }
+        else if ( !strcasecmp(stoks[0], "buffer") )
+        {
+            data->buf_size = AlertJSONParseSize(stoks[1]);
+        }
+        else if ( !strcasecmp(stoks[0], "flush") )
+        {
+            data->flush_ms = strtoul(stoks[1], NULL, 10);
+        }
+        else if ( !strcasecmp(stoks[0], "compress") )
+        {
+            if ( !strcasecmp(stoks[1], "none") )
+                data->compress = JSON_COMPRESS_NONE;
+#ifdef HAVE_LIBZ
+            else if ( !strcasecmp(stoks[1], "gzip") )
+                data->compress = JSON_COMPRESS_GZIP;
+#endif
+#ifdef HAVE_LIBZSTD
+            else if ( !strcasecmp(stoks[1], "zstd") )
+                data->compress = JSON_COMPRESS_ZSTD;
+#endif
+            else
+                FatalError("alert_json: compression \"%s\" is not supported "
+                    "by this build in %s(%i)\n", stoks[1], file_name, file_line);
+        }
+        else
+        {
+            FatalError("alert_json: unknown option \"%s\" in %s(%i)\n",
+                stoks[0], file_name, file_line);
+        }
+
+        mSplitFree(&stoks, num_stoks);
+    }
+    mSplitFree(&toks, num_toks);
+
+    if ( data->num_fields == 0 )
+        AlertJSONParseFields(data, fields);
+
+    if ( !filename ) filename = ProcessFileOption(barnyard2_conf_for_parsing, DEFAULT_FILE);
+
+    if ( data->buf_size < MIN_BUF_SIZE ) data->buf_size = MIN_BUF_SIZE;
+    if ( data->limit < data->buf_size ) data->limit = data->buf_size;
+
+    data->base = filename;
+    data->file = (char *)SnortAlloc(strlen(filename) + 5);
+    sprintf(data->file, "%s%s", filename,
+        data->compress == JSON_COMPRESS_GZIP ? ".gz" :
+        data->compress == JSON_COMPRESS_ZSTD ? ".zst" : "");
+
+    DEBUG_WRAP(DebugMessage(
+        DEBUG_INIT, "alert_json: '%s' %d fields %lu\n", data->file, data->num_fields,
+        (unsigned long)data->limit
+    ););
+
+    return data;
+}
+
+/*
+ * Function: AlertJSONOpen(AlertJSONData *)
+ *
+ * Purpose: (Re)open the current file and start a compression stream.
+ *          Appending to an existing compressed file is fine, both gzip
+ *          members and zstd frames may be concatenated.
+ */
+static void AlertJSONOpen(AlertJSONData *data)
+{
+    struct stat sbuf;
+
+    data->fd = open(data->file, O_WRONLY | O_CREAT | O_APPEND,
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    if ( data->fd < 0 )
+    {
+        FatalError("alert_json: open(%s) failed: %s\n", data->file, strerror(errno));
+    }
+
+    data->size = fstat(data->fd, &sbuf) ? 0 : sbuf.st_size;
+    data->opened = time(NULL);
+    data->files++;
+
+#ifdef HAVE_LIBZ
+    if ( data->compress == JSON_COMPRESS_GZIP )
+    {
+        memset(&data->zs, 0, sizeof(data->zs));
+
+        /* 15 bit window + 16 selects the gzip wrapper */
+        if ( deflateInit2(&data->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                    15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK )
+            FatalError("alert_json: unable to initialize gzip stream\n");
+    }
+#endif
+#ifdef HAVE_LIBZSTD
+    if ( data->compress == JSON_COMPRESS_ZSTD )
+    {
+        if ( data->zcctx == NULL )
+            data->zcctx = ZSTD_createCCtx();
+
+        if ( data->zcctx == NULL )
+            FatalError("alert_json: unable to initialize zstd stream\n");
+
+        ZSTD_CCtx_reset(data->zcctx, ZSTD_reset_session_only);
+    }
+#endif
+}
+
+static void AlertJSONWrite(AlertJSONData *data, const char *buf, size_t len)
+{
+    ssize_t ret;
+
+    while ( len > 0 )
+    {
+        ret = write(data->fd, buf, len);
+
+        if ( ret < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            LogMessage("alert_json: write to %s failed: %s\n",
+                data->file, strerror(errno));
+            return;
+        }
+
+        buf += ret;
+        len -= ret;
+        data->size += ret;
+        data->bytes_out += ret;
+    }
+}
+
+/*
+ * Function: AlertJSONOutput(AlertJSONData *, const char *, size_t, int)
+ *
+ * Purpose: Push len bytes through the compressor, if any.  mode 0 just
+ *          feeds the stream, 1 makes everything so far decodable and 2
+ *          ends the stream.
+ */
+static void AlertJSONOutput(AlertJSONData *data, const char *in, size_t len, int mode)
+{
+    switch ( data->compress )
+    {
+#ifdef HAVE_LIBZ
+        case JSON_COMPRESS_GZIP:
+        {
+            int flush = mode == 2 ? Z_FINISH : mode == 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+
+            data->zs.next_in = (Bytef *)in;
+            data->zs.avail_in = len;
+
+            do
+            {
+                data->zs.next_out = (Bytef *)data->zbuf;
+                data->zs.avail_out = ZBUF_SIZE;
+
+                deflate(&data->zs, flush);
+
+                AlertJSONWrite(data, data->zbuf, ZBUF_SIZE - data->zs.avail_out);
+            } while ( data->zs.avail_out == 0 );
+
+            if ( mode == 2 )
+                deflateEnd(&data->zs);
+            break;
+        }
+#endif
+#ifdef HAVE_LIBZSTD
+        case JSON_COMPRESS_ZSTD:
+        {
+            ZSTD_EndDirective end = mode == 2 ? ZSTD_e_end : mode == 1 ? ZSTD_e_flush : ZSTD_e_continue;
+            ZSTD_inBuffer zin = { in, len, 0 };
+            size_t remaining;
+
+            do
+            {
+                ZSTD_outBuffer zout = { data->zbuf, ZBUF_SIZE, 0 };
+
+                remaining = ZSTD_compressStream2(data->zcctx, &zout, &zin, end);
+
+                if ( ZSTD_isError(remaining) )
+                {
+                    LogMessage("alert_json: zstd error: %s\n", ZSTD_getErrorName(remaining));
+                    return;
+                }
+
+                AlertJSONWrite(data, data->zbuf, zout.pos);
+            } while ( end == ZSTD_e_continue ? zin.pos < zin.size : remaining != 0 );
+            break;
+        }
+#endif
+        default:
+            AlertJSONWrite(data, in, len);
+            break;
+    }
+}
+
+/*
+ * Function: AlertJSONRoll(AlertJSONData *)
+ *
+ * Purpose: Close the current file and rename it to <base>.<time>[.gz|.zst]
+ */
+static void AlertJSONRoll(AlertJSONData *data)
+{
+    char newname[STD_BUF+1];
+    const char *ext;
+    time_t now = time(NULL);
+    struct stat sbuf;
+    int seq = 0;
+
+    AlertJSONOutput(data, NULL, 0, 2);
+    close(data->fd);
+
+    ext = data->compress == JSON_COMPRESS_GZIP ? ".gz" :
+          data->compress == JSON_COMPRESS_ZSTD ? ".zst" : "";
+
+    /* several rolls within a second get a sequence number */
+    SnortSnprintf(newname, sizeof(newname), "%s.%lu%s", data->base, (unsigned long)now, ext);
+
+    while ( !stat(newname, &sbuf) )
+        SnortSnprintf(newname, sizeof(newname), "%s.%lu.%d%s", data->base,
+            (unsigned long)now, ++seq, ext);
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Rolling json file: %s\n", newname););
+
+    if ( rename(data->file, newname) )
+    {
+        LogMessage("alert_json: rename(%s, %s) failed: %s\n",
+            data->file, newname, strerror(errno));
+    }
+
+    AlertJSONOpen(data);
+}
+
+static void AlertJSONInitFinalize(int unused, void *arg)
+{
+    AlertJSONData *data = (AlertJSONData *)arg;
+    uint32_t i;
+    int err;
+
+    data->json = JsonWriter_Init(4*K_BYTES);
+
+    if ( BcTestMode() )
+        return;
+
+    if ( data->compress != JSON_COMPRESS_NONE )
+        data->zbuf = (char *)SnortAlloc(ZBUF_SIZE);
+
+    AlertJSONOpen(data);
+
+    data->bufs = (AlertJSONBuf *)SnortAlloc(sizeof(AlertJSONBuf) * data->buf_cnt);
+
+    for ( i = 0; i < data->buf_cnt; i++ )
+    {
+        data->bufs[i].data = (char *)SnortAlloc(data->buf_size);
+        data->bufs[i].size = data->buf_size;
+    }
+
+    gettimeofday(&data->buf_sealed, NULL);
+
+    pthread_mutex_init(&data->buf_lock, NULL);
+    pthread_cond_init(&data->buf_full, NULL);
+    pthread_cond_init(&data->buf_free, NULL);
+
+    data->writer_on = 1;
+    err = pthread_create(&data->writer_tid, NULL, &AlertJSONWriter_T, data);
+    if ( 0 != err )
+    {
+        FatalError("alert_json: Can't create writer thread: [%s]\n", strerror(err));
+    }
+
+    LogMessage("alert_json: \"%s\", %d fields, %u buffers of %lu KB, roll %lu MB/%u s\n",
+        data->file, data->num_fields, data->buf_cnt, (unsigned long)(data->buf_size >> 10),
+        (unsigned long)(data->limit >> 20), data->roll_secs);
+}
+
+/*
+ * Function: AlertJSONSeal(AlertJSONData *, uint8_t)
+ *
+ * Purpose: Hand the current buffer to the writer.  Must be called with
+ *          buf_lock held.
+ */
+static void AlertJSONSeal(AlertJSONData *data, uint8_t sync)
+{
+    AlertJSONBuf *buf = &data->bufs[data->buf_prod];
+    uint32_t next;
+
+    if ( buf->len == 0 )
+        return;
+
+    next = (data->buf_prod + 1) % data->buf_cnt;
+
+    while ( next == data->buf_cons && data->writer_on )
+        pthread_cond_wait(&data->buf_free, &data->buf_lock);
+
+    if ( !data->writer_on )
+    {
+        buf->len = 0;
+        return;
+    }
+
+    buf->sync = sync;
+    data->buf_prod = next;
+    data->bufs[next].len = 0;
+
+    gettimeofday(&data->buf_sealed, NULL);
+    pthread_cond_signal(&data->buf_full);
+}
+
+/*
+ * Function: AlertJSONWriter_T(void *)
+ *
+ * Purpose: Writer thread, compresses and writes sealed buffers, seals the
+ *          current one when it has been idle for flush_ms and rolls the
+ *          file on size or age.
+ */
+static void *AlertJSONWriter_T(void *arg)
+{
+    AlertJSONData *data = (AlertJSONData *)arg;
+    AlertJSONBuf *buf;
+    struct timeval now;
+    struct timespec deadline;
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    pthread_mutex_lock(&data->buf_lock);
+
+    while ( 1 )
+    {
+        if ( data->buf_cons == data->buf_prod )
+        {
+            if ( data->writer_stop )
+                break;
+
+            /* without flush_ms a buffer goes out once it is full */
+            if ( !data->flush_ms )
+            {
+                pthread_cond_wait(&data->buf_full, &data->buf_lock);
+                continue;
+            }
+
+            /* buf_sealed only moves when a filled buffer is sealed, an
+             * interval that is over starts again from now */
+            gettimeofday(&now, NULL);
+            if ( (int64_t)(now.tv_sec - data->buf_sealed.tv_sec) * 1000
+                    + (now.tv_usec - data->buf_sealed.tv_usec) / 1000
+                    >= (int64_t)data->flush_ms )
+            {
+                AlertJSONSeal(data, 1);
+                data->buf_sealed = now;
+                continue;
+            }
+
+            deadline.tv_sec = data->buf_sealed.tv_sec + data->flush_ms / 1000;
+            deadline.tv_nsec = (data->buf_sealed.tv_usec + (data->flush_ms % 1000) * 1000) * 1000;
+            if ( deadline.tv_nsec >= 1000000000 )
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+
+            pthread_cond_timedwait(&data->buf_full, &data->buf_lock, &deadline);
+            continue;
+        }
+
+        buf = &data->bufs[data->buf_cons];
+        pthread_mutex_unlock(&data->buf_lock);
+
+        if ( data->size >= data->limit ||
+             ( data->roll_secs && time(NULL) - data->opened >= (time_t)data->roll_secs ) )
+            AlertJSONRoll(data);
+
+        AlertJSONOutput(data, buf->data, buf->len, buf->sync);
+
+        pthread_mutex_lock(&data->buf_lock);
+        data->buf_cons = (data->buf_cons + 1) % data->buf_cnt;
+        pthread_cond_signal(&data->buf_free);
+    }
+
+    /* nothing is written from here on, don't let a seal wait for it */
+    data->writer_on = 0;
+    pthread_cond_broadcast(&data->buf_free);
+    pthread_mutex_unlock(&data->buf_lock);
+
+    return NULL;
+}
+
+/*
+ * Function: AlertJSONTimestamp(AlertJSONData *, uint32_t, uint32_t)
+ *
+ * Purpose: ISO 8601 time with microseconds and zone; the broken down
+ *          part is only recomputed when the second changes.
+ */
+static void AlertJSONTimestamp(AlertJSONData *data, uint32_t sec, uint32_t usec)
+{
+    char ts[40];
+    struct tm tm;
+    time_t t = sec;
+    int i;
+
+    if ( sec != data->ts_sec || data->ts_prefix[0] == '\0' )
+    {
+        if ( BcOutputUseUtc() )
+            gmtime_r(&t, &tm);
+        else
+            localtime_r(&t, &tm);
+
+        strftime(data->ts_prefix, sizeof(data->ts_prefix), "%Y-%m-%dT%H:%M:%S", &tm);
+        strftime(data->ts_zone, sizeof(data->ts_zone), "%z", &tm);
+        data->ts_sec = sec;
+    }
+
+    memcpy(ts, data->ts_prefix, 19);
+    ts[19] = '.';
+    for ( i = 25; i > 19; i-- )
+    {
+        ts[i] = '0' + usec % 10;
+        usec /= 10;
+    }
+    strcpy(ts + 26, data->ts_zone);
+
+    JsonWriter_String(data->json, "timestamp", ts);
+}
+
+static void AlertJSONAlert(JsonWriter *json, AlertJSONRecord *rec)
+{
+    Unified2IDSEvent *ev = rec->event;
+    Unified2IDSEventIPv6 *ev6 = rec->event6;
+    uint32_t gid, sid, rev, class_id, prio;
+    SigNode *sn;
+    ClassType *cn;
+
+    if ( ev )
+    {
+        gid = ntohl(ev->generator_id);
+        sid = ntohl(ev->signature_id);
+        rev = ntohl(ev->signature_revision);
+        class_id = ntohl(ev->classification_id);
+        prio = ntohl(ev->priority_id);
+    }
+    else
+    {
+        gid = ntohl(ev6->generator_id);
+        sid = ntohl(ev6->signature_id);
+        rev = ntohl(ev6->signature_revision);
+        class_id = ntohl(ev6->classification_id);
+        prio = ntohl(ev6->priority_id);
+    }
+
+    sn = GetSigByGidSid(gid, sid, rev);
+    cn = ClassTypeLookupById(barnyard2_conf, class_id);
+
+    JsonWriter_Open(json, "alert");
+    JsonWriter_UInt(json, "gid", gid);
+    JsonWriter_UInt(json, "signature_id", sid);
+    JsonWriter_UInt(json, "rev", rev);
+    JsonWriter_String(json, "signature", sn != NULL ? sn->msg : "");
+    JsonWriter_String(json, "category", cn != NULL ? cn->type : "unknown");
+    JsonWriter_UInt(json, "severity", prio);
+    JsonWriter_UInt(json, "blocked", ev ? ev->blocked : ev6->blocked);
+    JsonWriter_Close(json);
+}
+
+static void AlertJSONProto(JsonWriter *json, uint8_t proto)
+{
+    switch ( proto )
+    {
+        case IPPROTO_TCP:
+            JsonWriter_String(json, "proto", "TCP");
+            break;
+        case IPPROTO_UDP:
+            JsonWriter_String(json, "proto", "UDP");
+            break;
+        case IPPROTO_ICMP:
+            JsonWriter_String(json, "proto", "ICMP");
+            break;
+        default:
+            JsonWriter_UInt(json, "proto", proto);
+            break;
+    }
+}
+
+/* "extra": one key per extra data record, written from the ring slot */
+static void AlertJSONExtra(JsonWriter *json, AlertJSONRecord *rec)
+{
+    const EventAttr *attr;
+    char addr[INET6_ADDRSTRLEN];
+    uint16_t i;
+
+    JsonWriter_Open(json, "extra");
+    for ( i = 0; i < rec->attr_cnt; i++ )
+    {
+        attr = &rec->attr[i];
+
+        switch ( attr->type )
+        {
+            case EVENT_INFO_XFF_IPV4:
+            case EVENT_INFO_XFF_IPV6:
+            case EVENT_INFO_IPV6_SRC:
+            case EVENT_INFO_IPV6_DST:
+                EventAttrPrint(attr, addr, sizeof(addr));
+                JsonWriter_String(json, EventAttrName(attr->type), addr);
+                break;
+
+            case EVENT_INFO_GZIP_DATA:
+                JsonWriter_Base64(json, EventAttrName(attr->type), attr->data, attr->len);
+                break;
+
+            default:
+                JsonWriter_StringN(json, EventAttrName(attr->type),
+                    (const char *)attr->data, attr->len);
+                break;
+        }
+    }
+    JsonWriter_Close(json);
+}
+
+/*
+ * Function: AlertJSONFormat(AlertJSONData *, AlertJSONRecord *)
+ *
+ * Purpose: Walk the field layout for one record.  Fields the record
+ *          can't provide are left out rather than written as null.
+ */
+static void AlertJSONFormat(AlertJSONData *data, AlertJSONRecord *rec)
+{
+    JsonWriter *json = data->json;
+    Unified2IDSEvent *ev = rec->event;
+    Unified2IDSEventIPv6 *ev6 = rec->event6;
+    Packet *p = rec->p;
+    char addr[INET6_ADDRSTRLEN];
+    char tcpFlags[9];
+    int i;
+
+    JsonWriter_Reset(json);
+    JsonWriter_Open(json, NULL);
+
+    for ( i = 0; i < data->num_fields; i++ )
+    {
+        switch ( data->fields[i] )
+        {
+            case JSON_FIELD_TIMESTAMP:
+                AlertJSONTimestamp(data, rec->sec, rec->usec);
+                break;
+
+            case JSON_FIELD_EVENT_TYPE:
+                JsonWriter_String(json, "event_type", (ev || ev6) ? "alert" : "packet");
+                break;
+
+            case JSON_FIELD_EVENT_ID:
+                JsonWriter_UInt(json, "event_id", rec->event_id);
+                break;
+
+            case JSON_FIELD_SENSOR_ID:
+                if ( ev || ev6 )
+                    JsonWriter_UInt(json, "sensor_id", ntohl(ev ? ev->sensor_id : ev6->sensor_id));
+                break;
+
+            case JSON_FIELD_SRC_IP:
+                if ( ev )
+                    inet_ntop(AF_INET, &ev->ip_source, addr, sizeof(addr));
+                else if ( ev6 )
+                    inet_ntop(AF_INET6, &ev6->ip_source, addr, sizeof(addr));
+                else if ( p && p->iph )
+                    inet_ntop(AF_INET, &p->iph->ip_src, addr, sizeof(addr));
+                else
+                    break;
+                JsonWriter_String(json, "src_ip", addr);
+                break;
+
+            case JSON_FIELD_DEST_IP:
+                if ( ev )
+                    inet_ntop(AF_INET, &ev->ip_destination, addr, sizeof(addr));
+                else if ( ev6 )
+                    inet_ntop(AF_INET6, &ev6->ip_destination, addr, sizeof(addr));
+                else if ( p && p->iph )
+                    inet_ntop(AF_INET, &p->iph->ip_dst, addr, sizeof(addr));
+                else
+                    break;
+                JsonWriter_String(json, "dest_ip", addr);
+                break;
+
+            case JSON_FIELD_SRC_PORT:
+                if ( ev )
+                    JsonWriter_UInt(json, "src_port", ntohs(ev->sport_itype));
+                else if ( ev6 )
+                    JsonWriter_UInt(json, "src_port", ntohs(ev6->sport_itype));
+                else if ( p && (p->tcph || p->udph) )
+                    JsonWriter_UInt(json, "src_port", p->sp);
+                break;
+
+            case JSON_FIELD_DEST_PORT:
+                if ( ev )
+                    JsonWriter_UInt(json, "dest_port", ntohs(ev->dport_icode));
+                else if ( ev6 )
+                    JsonWriter_UInt(json, "dest_port", ntohs(ev6->dport_icode));
+                else if ( p && (p->tcph || p->udph) )
+                    JsonWriter_UInt(json, "dest_port", p->dp);
+                break;
+
+            case JSON_FIELD_PROTO:
+                if ( ev )
+                    AlertJSONProto(json, ev->protocol);
+                else if ( ev6 )
+                    AlertJSONProto(json, ev6->protocol);
+                else if ( p && p->iph )
+                    AlertJSONProto(json, p->iph->ip_proto);
+                break;
+
+            case JSON_FIELD_ALERT:
+                if ( ev || ev6 )
+                    AlertJSONAlert(json, rec);
+                break;
+
+            case JSON_FIELD_VLAN:
+                if ( !rec->extended )
+                    break;
+                if ( ev && ev->vlanId )
+                    JsonWriter_UInt(json, "vlan", ntohs(ev->vlanId));
+                else if ( ev6 && ev6->vlanId )
+                    JsonWriter_UInt(json, "vlan", ntohs(ev6->vlanId));
+                break;
+
+            case JSON_FIELD_MPLS:
+                if ( !rec->extended )
+                    break;
+                if ( ev && ev->mpls_label )
+                    JsonWriter_UInt(json, "mpls", ntohl(ev->mpls_label));
+                else if ( ev6 && ev6->mpls_label )
+                    JsonWriter_UInt(json, "mpls", ntohl(ev6->mpls_label));
+                break;
+
+            case JSON_FIELD_TTL:
+                if ( p && p->iph )
+                    JsonWriter_UInt(json, "ttl", p->iph->ip_ttl);
+                break;
+
+            case JSON_FIELD_TOS:
+                if ( p && p->iph )
+                    JsonWriter_UInt(json, "tos", p->iph->ip_tos);
+                break;
+
+            case JSON_FIELD_IP_ID:
+                if ( p && p->iph )
+                    JsonWriter_UInt(json, "ip_id", ntohs(p->iph->ip_id));
+                break;
+
+            case JSON_FIELD_IP_LEN:
+                if ( p && p->iph )
+                    JsonWriter_UInt(json, "ip_len", ntohs(p->iph->ip_len));
+                break;
+
+            case JSON_FIELD_TCP_FLAGS:
+                if ( p && p->tcph )
+                {
+                    CreateTCPFlagString(p, tcpFlags);
+                    JsonWriter_String(json, "tcp_flags", tcpFlags);
+                }
+                break;
+
+            case JSON_FIELD_TCP_SEQ:
+                if ( p && p->tcph )
+                    JsonWriter_UInt(json, "tcp_seq", ntohl(p->tcph->th_seq));
+                break;
+
+            case JSON_FIELD_TCP_ACK:
+                if ( p && p->tcph )
+                    JsonWriter_UInt(json, "tcp_ack", ntohl(p->tcph->th_ack));
+                break;
+
+            case JSON_FIELD_TCP_WIN:
+                if ( p && p->tcph )
+                    JsonWriter_UInt(json, "tcp_win", ntohs(p->tcph->th_win));
+                break;
+
+            case JSON_FIELD_ICMP_TYPE:
+                if ( p && p->icmph )
+                    JsonWriter_UInt(json, "icmp_type", p->icmph->type);
+                break;
+
+            case JSON_FIELD_ICMP_CODE:
+                if ( p && p->icmph )
+                    JsonWriter_UInt(json, "icmp_code", p->icmph->code);
+                break;
+
+            case JSON_FIELD_PAYLOAD:
+                if ( p && p->dsize )
+                    JsonWriter_Base64(json, "payload", p->data, p->dsize);
+                break;
+
+            case JSON_FIELD_PACKET:
+                if ( p && p->pkth && p->pkt )
+                    JsonWriter_Base64(json, "packet", p->pkt, p->pkth->caplen);
+                break;
+
+            case JSON_FIELD_INTERFACE:
+                JsonWriter_String(json, "interface", barnyard2_conf->interface ?
+                    barnyard2_conf->interface : "by2_no_interface_configured");
+                break;
+
+            case JSON_FIELD_HOSTNAME:
+                JsonWriter_String(json, "hostname", barnyard2_conf->hostname ?
+                    barnyard2_conf->hostname : "by2_no_hostname_configured");
+                break;
+
+            case JSON_FIELD_EXTRA:
+                if ( rec->attr_cnt )
+                    AlertJSONExtra(json, rec);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    JsonWriter_Close(json);
+}
+
+/* the formatted record onto the current buffer, buf_lock held */
+static void AlertJSONAppend(AlertJSONData *data)
+{
+    AlertJSONBuf *buf = &data->bufs[data->buf_prod];
+    size_t len = JsonWriter_Length(data->json);
+
+    if ( buf->len + len + 1 > data->buf_size )
+    {
+        AlertJSONSeal(data, 0);
+        buf = &data->bufs[data->buf_prod];
+    }
+
+    /* a record larger than a whole buffer gets one of its own */
+    if ( len + 1 > buf->size )
+    {
+        char *grown = (char *)realloc(buf->data, len + 1);
+
+        if ( grown == NULL )
+            FatalError("alert_json: unable to grow a buffer to %lu bytes\n",
+                (unsigned long)(len + 1));
+
+        buf->data = grown;
+        buf->size = len + 1;
+    }
+
+    memcpy(buf->data + buf->len, JsonWriter_Buffer(data->json), len);
+    buf->len += len;
+    buf->data[buf->len++] = '\n';
+    data->bytes_in += len + 1;
+}
+
+static void AlertJSON(Packet *p, void *event, uint32_t event_type, void *arg)
+{
+    AlertJSONData *data = (AlertJSONData *)arg;
+    AlertJSONRecord rec;
+    EventEP *eep = (EventEP *)event;
+    uint16_t i;
+
+    switch ( event_type )
+    {
+        case UNIFIED2_IDS_FLUSH:
+        case UNIFIED2_IDS_FLUSH_OUT:
+            /* a good moment to let the writer catch up */
+            if ( data->bufs != NULL )
+            {
+                pthread_mutex_lock(&data->buf_lock);
+                AlertJSONSeal(data, 0);
+                pthread_mutex_unlock(&data->buf_lock);
+            }
+            return;
+
+        case UNIFIED2_IDS_EVENT:
+        case UNIFIED2_IDS_EVENT_MPLS:
+        case UNIFIED2_IDS_EVENT_VLAN:
+        case UNIFIED2_IDS_EVENT_IPV6:
+        case UNIFIED2_IDS_EVENT_IPV6_MPLS:
+        case UNIFIED2_IDS_EVENT_IPV6_VLAN:
+        case UNIFIED2_PACKET:
+            break;
+
+        default:
+            return;
+    }
+
+    if ( eep == NULL || data->bufs == NULL )
+        return;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.p = p;
+
+    if ( event_type == UNIFIED2_PACKET )
+    {
+        Unified2Packet *u2p = (Unified2Packet *)eep->ep->data;
+
+        rec.event_id = eep->ep->event_id;
+        rec.sec = ntohl(u2p->packet_second);
+        rec.usec = ntohl(u2p->packet_microsecond);
+        data->packets++;
+    }
+    else
+    {
+        if ( event_type == UNIFIED2_IDS_EVENT_IPV6 ||
+             event_type == UNIFIED2_IDS_EVENT_IPV6_MPLS ||
+             event_type == UNIFIED2_IDS_EVENT_IPV6_VLAN )
+        {
+            rec.event6 = (Unified2IDSEventIPv6 *)eep->ee->data;
+            rec.sec = ntohl(rec.event6->event_second);
+            rec.usec = ntohl(rec.event6->event_microsecond);
+        }
+        else
+        {
+            rec.event = (Unified2IDSEvent *)eep->ee->data;
+            rec.sec = ntohl(rec.event->event_second);
+            rec.usec = ntohl(rec.event->event_microsecond);
+        }
+
+        rec.extended = event_type != UNIFIED2_IDS_EVENT &&
+            event_type != UNIFIED2_IDS_EVENT_IPV6;
+        rec.event_id = eep->ee->event_id;
+        rec.attr = eep->attr;
+        rec.attr_cnt = eep->attr_cnt;
+        data->events++;
+    }
+
+    pthread_mutex_lock(&data->buf_lock);
+
+    AlertJSONFormat(data, &rec);
+    AlertJSONAppend(data);
+
+    /* the rest of the event's packets follow it in the same buffer */
+    if ( event_type != UNIFIED2_PACKET )
+    {
+        for ( i = 0; i < eep->ex_cnt; i++ )
+        {
+            Unified2Packet *u2p;
+
+            if ( eep->ex[i]->type != UNIFIED2_PACKET )
+                continue;
+
+            u2p = (Unified2Packet *)eep->ex[i]->data;
+            memset(&rec, 0, sizeof(rec));
+            rec.p = eep->ex[i]->s_pkt;
+            rec.event_id = eep->ex[i]->event_id;
+            rec.sec = ntohl(u2p->packet_second);
+            rec.usec = ntohl(u2p->packet_microsecond);
+            data->packets++;
+
+            AlertJSONFormat(data, &rec);
+            AlertJSONAppend(data);
+        }
+    }
+
+    pthread_mutex_unlock(&data->buf_lock);
+}
+
+static void AlertJSONCleanup(int signal, void *arg, const char* msg)
+{
+    AlertJSONData *data = (AlertJSONData *)arg;
+    uint32_t i;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG,"%s\n", msg););
+
+    if ( data == NULL )
+        return;
+
+    if ( data->writer_on )
+    {
+        pthread_mutex_lock(&data->buf_lock);
+        AlertJSONSeal(data, 0);
+        data->writer_stop = 1;
+        pthread_cond_signal(&data->buf_full);
+        pthread_mutex_unlock(&data->buf_lock);
+
+        pthread_join(data->writer_tid, NULL);
+
+        pthread_cond_destroy(&data->buf_free);
+        pthread_cond_destroy(&data->buf_full);
+        pthread_mutex_destroy(&data->buf_lock);
+
+        LogMessage("alert_json: %llu events, %llu packets, %llu bytes (%llu written) in %u files\n",
+            (unsigned long long)data->events, (unsigned long long)data->packets,
+            (unsigned long long)data->bytes_in, (unsigned long long)data->bytes_out,
+            data->files);
+    }
+
+    if ( data->fd >= 0 )
+    {
+        AlertJSONOutput(data, NULL, 0, 2);
+        close(data->fd);
+    }
+
+#ifdef HAVE_LIBZSTD
+    if ( data->zcctx )
+        ZSTD_freeCCtx(data->zcctx);
+#endif
+
+    if ( data->bufs )
+    {
+        for ( i = 0; i < data->buf_cnt; i++ )
+            free(data->bufs[i].data);
+        free(data->bufs);
+    }
+
+    if ( data->zbuf ) free(data->zbuf);
+    JsonWriter_Term(data->json);
+    free(data->file);
+    free(data->base);
+    free(data);
+}
+
+static void AlertJSONCleanExit(int signal, void *arg)
+{
+    AlertJSONCleanup(signal, arg, "AlertJSONCleanExit");
+}
+
+static void AlertJSONRestart(int signal, void *arg)
+{
+    AlertJSONCleanup(signal, arg, "AlertJSONRestart");
+}
+
@@ -516,6 +516,7 @@ void dbEventQueueClean(uint8_t q_ins)
 {
     spo_db_event_queue[q_ins]->ele_cnt = 0;
     spo_db_event_queue[q_ins]->ele_exp_cnt = 0;
+    spo_db_event_queue[q_ins]->ele_ext_cnt = 0;
 
     //Set free flag from input_rings
     if ( NULL != spo_db_event_queue[q_ins]->ele_rtOct ) {
@@ -664,6 +665,9 @@ void DatabasePluginPrintData(DatabaseData *data) {
 		LogMessage("database:     ignore_bpf = %s\n", KEYWORD_IGNOREBPF_NO);
 	}
 
+	if (data->cache_snapshot != NULL)
+		LogMessage("database: cache_snapshot = %s\n", data->cache_snapshot);
+
 #ifdef ENABLE_MYSQL
 	if (data->dbRH[data->dbtype_id].ssl_key != NULL)
 		LogMessage("database:        ssl_key = %s\n",
@@ -771,7 +775,11 @@ void DatabaseInit(char *args)
 		AddFuncToOutputList(Spo_Database, OUTPUT_TYPE__ALERT, data);
 	}
 
+	SetOutputFuncGroups(Spo_Database, data);
 	AddFuncToOutputList(Spo_Database, OUTPUT_TYPE__FLUSH, data);
+	SetOutputFuncHolds(Spo_Database, data);
+
+	MetricsRegister(DatabaseMetrics, data);
 
 	AddFuncToRestartList(SpoDatabaseCleanExitFunction, data);
 	AddFuncToCleanExitList(SpoDatabaseCleanExitFunction, data);
@@ -1018,6 +1026,37 @@ exit_funct:
 	return retval;
 }
 
+/*******************************************************************************
+ * Function: DatabaseMetrics(MetricsBuf *, void *)
+ *
+ * Purpose: Transaction size and latency histograms for the metrics listener.
+ *          Observed by the query threads only while metrics are served.
+ *
+ ******************************************************************************/
+void DatabaseMetrics(MetricsBuf *buf, void *arg)
+{
+	DatabaseData *data = (DatabaseData *)arg;
+
+	MetricsHeader(buf, "squirrel_db_batch_events", "histogram",
+			"Events written per database transaction.");
+	MetricsHistogramSample(buf, "squirrel_db_batch_events", NULL,
+			&data->batch_events, 1);
+
+	MetricsHeader(buf, "squirrel_db_transaction_seconds", "histogram",
+			"Time from begin to the end of commit of each transaction.");
+	MetricsHistogramSample(buf, "squirrel_db_transaction_seconds", NULL,
+			&data->trans_usecs, 1e-6);
+
+	MetricsHeader(buf, "squirrel_db_commit_seconds", "histogram",
+			"Time spent in the commit of each transaction.");
+	MetricsHistogramSample(buf, "squirrel_db_commit_seconds", NULL,
+			&data->commit_usecs, 1e-6);
+
+	MetricsHeader(buf, "squirrel_db_records_dropped_total", "counter",
+			"Packets and extra data dropped for want of room in the batch or its queries.");
+	MetricsSample(buf, "squirrel_db_records_dropped_total", NULL, data->dropped);
+}
+
 void DatabaseInitFinalize(int unused, void *arg)
 {
     uint8_t i;
@@ -1280,6 +1319,10 @@ void ParseDatabaseArgs(DatabaseData *data) {
 				strlen(KEYWORD_DISABLE_SIGREFTABLE))) {
 			data->dbRH[data->dbtype_id].disablesigref = 1;
 		}
+		else if (!strncasecmp(dbarg, KEYWORD_CACHE_SNAPSHOT,
+				strlen(KEYWORD_CACHE_SNAPSHOT))) {
+			data->cache_snapshot = a1;
+		}
 
 #ifdef ENABLE_MYSQL
 		/* Option declared here should be forced to dbRH[DB_MYSQL] */
@@ -1503,6 +1546,7 @@ int dbProcessSignatureInformation(DatabaseData *data, void *event,
 		/*u_int32_t event_type, */u_int32_t *psig_id, uint8_t q_sock) {
 	cacheSignatureObj unInitSig;
 	dbSignatureObj sigInsertObj = { 0 };
+	SigNode *sn = NULL;
 	dbSignatureHashKey sigHashKey;
 	dbSignatureObj *psigObj;
 	cacheSignatureObj* pcacheSig;
@@ -1517,6 +1561,7 @@ int dbProcessSignatureInformation(DatabaseData *data, void *event,
 	u_int32_t sigMsgLen = 0;
 	uint32_t ha_idx;
 	u_int8_t reuseSigMsg = 0;
+	u_int8_t mapSigMsg = 0;
 
 	if ((data == NULL) || (event == NULL) || (psig_id == NULL)) {
 		return 1;
@@ -1707,7 +1752,24 @@ int dbProcessSignatureInformation(DatabaseData *data, void *event,
 					ntohl(((Unified2EventCommon *) event)->event_id), gid, sid,
 					revision, db_classification_id, priority);*/
 
-			if (SnortSnprintf(sigInsertObj.message, SIG_MSG_LEN,
+			/* the maps may have learnt it since startup, on a SIGHUP reload;
+			 * this is the query thread, outside the outputs' read section */
+			MapReadLock();
+			if (((sn = MapSigFind(gid, sid, revision)) != NULL) && (sn->msg != NULL)) {
+				strncpy(sigInsertObj.message, sn->msg, SIG_MSG_LEN);
+				sigInsertObj.message[SIG_MSG_LEN - 1] = '\0';
+				mapSigMsg = 1;
+			}
+			MapReadUnlock();
+
+#ifdef ENABLE_MYSQL
+			if (mapSigMsg && (snort_escape_string_STATIC(sigInsertObj.message,
+					data->sanitize_buffer[q_sock], SIG_MSG_LEN, data))) {
+				mapSigMsg = 0;
+			}
+#endif
+
+			if (!mapSigMsg && SnortSnprintf(sigInsertObj.message, SIG_MSG_LEN,
 					"Snort Alert [%u:%u:%u]", gid, sid, revision)) {
 				return 1;
 			}
@@ -1758,6 +1820,8 @@ func_err:
 int dbProcessEventInformation(DatabaseData *data, Packet *p, void *event,
 		u_int32_t event_type, u_int32_t i_sig_id) {
 	char *SQLQueryPtr = NULL;
+	char *payload = NULL;
+	u_int32_t payload_len = 0;
 	int i = 0;
 
 	if ((data == NULL) || (p == NULL) || (event == NULL)) {
@@ -2253,10 +2317,11 @@ int dbProcessEventInformation(DatabaseData *data, Packet *p, void *event,
 							goto bad_query;
 						}
 
+						/* the encoders return the length, no strlen() */
 						if (data->encoding == ENCODING_BASE64) {
-							//packet_data_not_escaped = base64(p->data, p->dsize);
-							if (base64_STATIC(p->data, p->dsize,
-									data->PacketDataNotEscaped[0])) {
+							if (EncodeBase64(p->data, p->dsize,
+									data->PacketDataNotEscaped[0], MAX_QUERY_LENGTH,
+									&payload_len)) {
 								/* XXX */
 								goto bad_query;
 							}
@@ -2267,22 +2332,31 @@ int dbProcessEventInformation(DatabaseData *data, Packet *p, void *event,
 								/* XXX */
 								goto bad_query;
 							}
-
+							payload_len = strlen(data->PacketDataNotEscaped[0]);
 						} else {
-							//packet_data_not_escaped = fasthex(p->data, p->dsize);
-							if ((fasthex_STATIC(p->data, p->dsize,
-									data->PacketDataNotEscaped[0]))) {
+							if (EncodeHex(p->data, p->dsize,
+									data->PacketDataNotEscaped[0], MAX_QUERY_LENGTH,
+									&payload_len)) {
 								/* XXX */
 								goto bad_query;
 							}
-
 						}
 
-						//packet_data = snort_escape_string(packet_data_not_escaped, data);
-						if (snort_escape_string_STATIC(data->PacketDataNotEscaped[0], data->sanitize_buffer[0],
-								strlen(data->PacketDataNotEscaped[0]) + 1, data)) {
-							/* XXX */
-							goto bad_query;
+						/* Hex and base64 are only [0-9A-Za-z+/] and newlines,
+						 * which every database takes as they are inside quotes,
+						 * so only ascii goes through the escape.
+						 */
+						if (data->encoding == ENCODING_ASCII) {
+							if (snort_escape_buffer(data->PacketDataNotEscaped[0],
+									payload_len, data->sanitize_buffer[0],
+									DATABASE_MAX_ESCAPE_STATIC_BUFFER_LEN,
+									&payload_len, data)) {
+								/* XXX */
+								goto bad_query;
+							}
+							payload = data->sanitize_buffer[0];
+						} else {
+							payload = data->PacketDataNotEscaped[0];
 						}
 
 						switch (data->dbtype_id) {
@@ -2312,7 +2386,7 @@ int dbProcessEventInformation(DatabaseData *data, Packet *p, void *event,
 											"VALUES (%u,%u,'%s');", data->sid,
 									data->cid[0],
 									//packet_data))  != SNORT_SNPRINTF_SUCCESS)
-									data->sanitize_buffer[0]))
+									payload))
 									!= SNORT_SNPRINTF_SUCCESS) {
 								goto bad_query;
 							}
@@ -2381,6 +2455,7 @@ int dbProcessMultiEventInfo(DatabaseData *data, SQLEventQueue *e_queue, uint8_t
 	SQLQueryEle *ProtoTCPtr = NULL;
 	SQLQueryEle *ProtoUDPPtr = NULL;
 	SQLQueryEle *SQLQuery = NULL;
+	SQLQueryEle *SQLQueryNext = NULL;
 	us_cid_t event_id;
 	uint8_t ret;
 	uint8_t rid;
@@ -2603,10 +2678,59 @@ int dbProcessMultiEventInfo(DatabaseData *data, SQLEventQueue *e_queue, uint8_t
 	    ins_cnt++;
 	SQL_EVENT_FOR_EACH_END(SQLQueryPtr, sl_buf, MAX_SQL_QUERY_LENGTH)
 
-    if ( 0 == ins_cnt )
+    if ( 0 == ins_cnt ) {
         SQLQuery->valid = 0;
-    else
+    }
+    else {
         strncat(SQLQueryPtr, ";", MAX_SQL_QUERY_LENGTH);
+    }
+
+	/*** Build the query for the extra data ***/
+	if ( 0 < e_queue->ele_ext_cnt ) {
+		if ( NULL == (SQLQuery=SQL_GetNextQuery(data, ele_que_ins)) ) {
+			goto bad_query;
+		}
+
+		if ( !dbEventInfoFm_extra(SQLQuery->string, MAX_SQL_QUERY_LENGTH) )
+			goto bad_query;
+		SQLQuery->slen = strlen(SQLQuery->string);
+
+		sl_separator = ' ';
+		for (i=0; i<e_queue->ele_ext_cnt; i++) {
+			if ( dbEventInfoFm_extradata(data, SQLQuery, MAX_SQL_QUERY_LENGTH,
+					data->sid, &(e_queue->ele_extra[i]), sl_separator, ele_que_ins) ) {
+				sl_separator = ',';
+				continue;
+			}
+
+			/* no room left, the rows so far make one INSERT and this
+			 * one starts the next */
+			if ( ',' == sl_separator
+					&& NULL != (SQLQueryNext = SQL_GetNextQuery(data, ele_que_ins))
+					&& dbEventInfoFm_extra(SQLQueryNext->string, MAX_SQL_QUERY_LENGTH) ) {
+				memcpy(SQLQuery->string + SQLQuery->slen, ";", 2);
+				SQLQuery = SQLQueryNext;
+				SQLQuery->slen = strlen(SQLQuery->string);
+				sl_separator = ' ';
+				if ( dbEventInfoFm_extradata(data, SQLQuery, MAX_SQL_QUERY_LENGTH,
+						data->sid, &(e_queue->ele_extra[i]), sl_separator, ele_que_ins) ) {
+					sl_separator = ',';
+					continue;
+				}
+			}
+
+			__sync_fetch_and_add(&data->dropped, 1);
+			LogMessage("database: extra data(rid: %d, event_id: %lu, type: %u, len: %u) "
+					"does not fit in a query, dropped\n", e_queue->ele_extra[i].rid,
+					e_queue->ele_extra[i].event_id, e_queue->ele_extra[i].attr.type,
+					e_queue->ele_extra[i].attr.len);
+		}
+
+		if ( ',' == sl_separator )
+			memcpy(SQLQuery->string + SQLQuery->slen, ";", 2);
+		else
+			SQLQuery->valid = 0;
+	}
 
 	/*** If is detailed ***/
 	if (!data->detail) {
@@ -2723,6 +2847,7 @@ void Spo_ProcQuery(void *arg)
     SQLEventQueue *lQ_queue;
     SQLEvent *lQ_ele;
     us_cid_t tsp_up_cid[BY_MUL_TR_DEFAULT];
+    struct timespec t_begin, t_commit, t_done;
 /*    struct timespec t_elapse;
 
     t_elapse.tv_sec = 0;
@@ -2731,6 +2856,11 @@ void Spo_ProcQuery(void *arg)
     ele_que_ins = lQ_ins;
     lQ_queue = spo_db_event_queue[ele_que_ins];
 
+#ifdef IF_SPO_QUERY_IN_THREAD
+    TRACE_THREAD("db-query");
+    SetThreadName("db-query");
+#endif
+
     //Proceed
     qe2qr_r = spo_data->lEleQue_ins[ele_que_ins].pipe_queue2query[0];
     qr2qe_w = spo_data->lEleQue_ins[ele_que_ins].pipe_query2queue[1];
@@ -2832,6 +2962,9 @@ void Spo_ProcQuery(void *arg)
                  */
 
                 DEBUG_U_WRAP_SP_QUERY(LogMessage("%s_%d: BeginTransection [%d]\n", __func__, lQ_ins, ele_que_ins));
+                TRACE_BEGIN(TRACE_DB_TRANSACTION, lQ_ins);
+                if ( metrics_enabled )
+                    clock_gettime(CLOCK_MONOTONIC, &t_begin);
                 if (BeginTransaction(spo_data, lQ_ins)) {
                     FatalError("database [%s()]: Failed to Initialize transaction, bailing ... \n",
                             __FUNCTION__);
@@ -2955,6 +3088,9 @@ void Spo_ProcQuery(void *arg)
                     spo_data->refresh_mcid = 0;
                 }
 
+                if ( metrics_enabled )
+                    clock_gettime(CLOCK_MONOTONIC, &t_commit);
+                TRACE_BEGIN(TRACE_DB_COMMIT, lQ_ins);
                 if (CommitTransaction(spo_data, lQ_ins)) {
                     ErrorMessage("ERROR database: [%s()]: Error commiting transaction \n",
                             __FUNCTION__);
@@ -2963,6 +3099,19 @@ void Spo_ProcQuery(void *arg)
                 } else {
                     resetTransactionState(&spo_data->m_dbins[lQ_ins]);
                 }
+                TRACE_END(TRACE_DB_COMMIT, lQ_ins);
+                TRACE_END(TRACE_DB_TRANSACTION, lQ_ins);
+
+                if ( metrics_enabled ) {
+                    clock_gettime(CLOCK_MONOTONIC, &t_done);
+                    MetricsObserve(&spo_data->batch_events, lQ_queue->ele_cnt);
+                    MetricsObserve(&spo_data->commit_usecs,
+                            (t_done.tv_sec - t_commit.tv_sec) * 1000000
+                            + (t_done.tv_nsec - t_commit.tv_nsec) / 1000);
+                    MetricsObserve(&spo_data->trans_usecs,
+                            (t_done.tv_sec - t_begin.tv_sec) * 1000000
+                            + (t_done.tv_nsec - t_begin.tv_nsec) / 1000);
+                }
 
                 DEBUG_U_WRAP_SP_QUERY(LogMessage("%s_%d: CommitTransaction [%d]\n", __func__, lQ_ins, ele_que_ins));
                 /* Clean the query */
@@ -3203,6 +3352,46 @@ enc_endloop:
  * Returns: void function
  *
  ******************************************************************************/
+/* a data row for the query thread, ep->event_id holds its event's cid */
+static void DatabaseQueuePacket(SQLEventQueue *queue, uint8_t rid, EventRecordNode *ep, Packet *p)
+{
+    SQLPkt *ad = &(queue->ele_expkt[queue->ele_exp_cnt++]);
+    Unified2Packet *pdata = (Unified2Packet *)ep->data;
+
+    ad->rid = rid;
+    ad->event_id = ep->event_id;
+    ad->p = p;
+    ad->u2raw_data = pdata->packet_data;
+    ad->u2raw_datalen = ntohl(pdata->packet_length);
+}
+
+/* room in the queue for an event and all of its packets and extra data */
+static int DatabaseQueueFits(SQLEventQueue *queue, EventEP *eep, uint32_t event_type)
+{
+    uint32_t pkts = 1;
+    int i;
+
+    if ( UNIFIED2_PACKET == event_type )
+        return queue->ele_exp_cnt < SQL_PKT_QUEUE_LEN;
+
+    for ( i=0; i<eep->ex_cnt; i++ ) {
+        if ( UNIFIED2_PACKET == eep->ex[i]->type )
+            pkts++;
+    }
+
+    return queue->ele_cnt < SQL_EVENT_QUEUE_LEN
+            && queue->ele_exp_cnt + pkts <= SQL_PKT_QUEUE_LEN
+            && queue->ele_ext_cnt + eep->attr_cnt <= SQL_EXTRA_QUEUE_LEN;
+}
+
+/* a record the batch had no room for */
+static void DatabaseQueueDrop(DatabaseData *data, uint8_t rid, us_cid_t event_id, uint32_t type)
+{
+    __sync_fetch_and_add(&data->dropped, 1);
+    LogMessage("database: no room in the batch for record(rid: %d, type: %u, event_id: %lu), dropped\n",
+            rid, type, event_id);
+}
+
 void Spo_Database(Packet *p, void *event, uint32_t event_type, void *arg)
 {
     uint8_t rid;
@@ -3213,7 +3402,8 @@ void Spo_Database(Packet *p, void *event, uint32_t event_type, void *arg)
     int da2qe_w;//, qe2da_r;
 	us_cid_t event_id;
     DatabaseData *data = (DatabaseData *) arg;
-    Unified2Packet *pdata;
+    EventRecordNode *ex;
+    SQLExtra *ext;
     struct timespec t_elapse;
 
 	if ( NULL == data ) {
@@ -3286,12 +3476,12 @@ void Spo_Database(Packet *p, void *event, uint32_t event_type, void *arg)
         {
             if ( (0 == spo_db_event_queue[q_ins]->ele_cnt)
                     &&  (0 == spo_db_event_queue[q_ins]->ele_exp_cnt) ) {
-                LogMessage( "%s: Event Queue is empty, Flush Out All queues\n", __func__ );
+                DEBUG_U_WRAP_SP_DB(LogMessage( "%s: Event Queue is empty, Flush Out All queues\n", __func__ ));
                 q_flushout = LF_SET_EMPTY;
             }
             else {
-                LogMessage("%s: flush out event_queue[%d], proceed, %d, %d\n", __func__, q_ins,
-                        spo_db_event_queue[q_ins]->ele_cnt, spo_db_event_queue[q_ins]->ele_exp_cnt);
+                DEBUG_U_WRAP_SP_DB(LogMessage("%s: flush out event_queue[%d], proceed, %d, %d\n", __func__, q_ins,
+                        spo_db_event_queue[q_ins]->ele_cnt, spo_db_event_queue[q_ins]->ele_exp_cnt));
                 q_flushout = LF_SET;
             }
         }
@@ -3300,15 +3490,15 @@ void Spo_Database(Packet *p, void *event, uint32_t event_type, void *arg)
 	    {
 	        if ( (0 == spo_db_event_queue[q_ins]->ele_cnt)
 	        		&&  (0 == spo_db_event_queue[q_ins]->ele_exp_cnt) ) {
-	            LogMessage( "%s: Event Queue is empty\n", __func__ );
+	            DEBUG_U_WRAP_SP_DB(LogMessage( "%s: Event Queue is empty\n", __func__ ));
 	            if ( NULL != event ) {
 	                ((RingTopOct*)event)->r_flag = 0;
 	            }
 	            return;
 	        }
 
-	        LogMessage("%s: flush event_queue[%d], proceed, %d, %d\n", __func__, q_ins,
-	                spo_db_event_queue[q_ins]->ele_cnt, spo_db_event_queue[q_ins]->ele_exp_cnt);
+	        DEBUG_U_WRAP_SP_DB(LogMessage("%s: flush event_queue[%d], proceed, %d, %d\n", __func__, q_ins,
+	                spo_db_event_queue[q_ins]->ele_cnt, spo_db_event_queue[q_ins]->ele_exp_cnt));
 	        q_flushout = LF_CUR;
 
 	        if ( NULL != event ) {
@@ -3325,17 +3515,25 @@ void Spo_Database(Packet *p, void *event, uint32_t event_type, void *arg)
 	            return;
 	        }
 
-	        spo_db_event_queue[q_ins]->ele_expkt[spo_db_event_queue[q_ins]->ele_exp_cnt].rid = ((EventEP*)event)->rid;
-	        spo_db_event_queue[q_ins]->ele_expkt[spo_db_event_queue[q_ins]->ele_exp_cnt].event_id =
-	                ((EventEP*)event)->ep->event_id;
-	        spo_db_event_queue[q_ins]->ele_expkt[spo_db_event_queue[q_ins]->ele_exp_cnt].p = p;
+	        /* an event's group goes into one batch.  Only the output
+	         * thread's flush hands a batch over, with the ring tops it
+	         * covers, and the queues are sized for its largest batch; a
+	         * group that still won't fit is dropped */
+	        if ( !DatabaseQueueFits(spo_db_event_queue[q_ins], (EventEP*)event, event_type) ) {
+	            DatabaseQueueDrop(data, ((EventEP*)event)->rid,
+	                    ((EventEP*)event)->ee->event_id, event_type);
+	            if ( ((EventEP*)event)->ep != ((EventEP*)event)->ee )
+	                DatabaseQueueDrop(data, ((EventEP*)event)->rid,
+	                        ((EventEP*)event)->ee->event_id, UNIFIED2_PACKET);
+	            for ( i=0; i<((EventEP*)event)->ex_cnt; i++ ) {
+	                DatabaseQueueDrop(data, ((EventEP*)event)->rid,
+	                        ((EventEP*)event)->ee->event_id, ((EventEP*)event)->ex[i]->type);
+	            }
+	            return;
+	        }
 
-	        pdata = (Unified2Packet *)((EventEP*)event)->ep->data;
-	        spo_db_event_queue[q_ins]->ele_expkt[spo_db_event_queue[q_ins]->ele_exp_cnt].u2raw_data =
-	                pdata->packet_data;
-	        spo_db_event_queue[q_ins]->ele_expkt[spo_db_event_queue[q_ins]->ele_exp_cnt].u2raw_datalen =
-	                ntohl(pdata->packet_length);
-	        spo_db_event_queue[q_ins]->ele_exp_cnt++;
+	        DatabaseQueuePacket(spo_db_event_queue[q_ins], ((EventEP*)event)->rid,
+	                ((EventEP*)event)->ep, p);
 
 	        if ( UNIFIED2_PACKET != event_type ) {
 	            event_id = ((EventEP*)event)->ee->event_id;
@@ -3346,17 +3544,42 @@ void Spo_Database(Packet *p, void *event, uint32_t event_type, void *arg)
                 spo_db_event_queue[q_ins]->ele[spo_db_event_queue[q_ins]->ele_cnt].rid = ((EventEP*)event)->rid;
                 spo_db_event_queue[q_ins]->ele[spo_db_event_queue[q_ins]->ele_cnt].p = p;
                 spo_db_event_queue[q_ins]->ele_cnt++;
+
+                /* the rest of the event's packets go into the same batch */
+                for ( i=0; i<((EventEP*)event)->ex_cnt; i++ ) {
+                    ex = ((EventEP*)event)->ex[i];
+                    if ( UNIFIED2_PACKET != ex->type )
+                        continue;
+                    if ( spo_db_event_queue[q_ins]->ele_exp_cnt >= SQL_PKT_QUEUE_LEN ) {
+                        DatabaseQueueDrop(data, ((EventEP*)event)->rid, event_id, ex->type);
+                        continue;
+                    }
+                    DatabaseQueuePacket(spo_db_event_queue[q_ins], ((EventEP*)event)->rid,
+                            ex, ex->s_pkt);
+                }
+
+                /* and its extra data, a row each in the extra table */
+                for ( i=0; i<((EventEP*)event)->attr_cnt; i++ ) {
+                    /* keyed on the type, the first of a type goes in */
+                    for ( n=0; n<i; n++ ) {
+                        if ( ((EventEP*)event)->attr[n].type == ((EventEP*)event)->attr[i].type )
+                            break;
+                    }
+                    if ( n < i )
+                        continue;
+                    if ( spo_db_event_queue[q_ins]->ele_ext_cnt >= SQL_EXTRA_QUEUE_LEN ) {
+                        DatabaseQueueDrop(data, ((EventEP*)event)->rid, event_id, UNIFIED2_EXTRA_DATA);
+                        continue;
+                    }
+                    ext = &(spo_db_event_queue[q_ins]->ele_extra[spo_db_event_queue[q_ins]->ele_ext_cnt++]);
+                    ext->rid = ((EventEP*)event)->rid;
+                    ext->event_id = event_id;
+                    ext->attr = ((EventEP*)event)->attr[i];
+                }
             }
 
-	        if ( spo_db_event_queue[q_ins]->ele_exp_cnt >= SQL_PKT_QUEUE_LEN
-	                || spo_db_event_queue[q_ins]->ele_cnt >= SQL_EVENT_QUEUE_LEN ) {
-	            //Shouldn't be, well controlled by Output process/thread.
-	            DEBUG_U_WRAP_DEEP(LogMessage("%s: event queue is full, proceed\n", __func__));
-	        }
-	        else {
-	            DEBUG_U_WRAP_DEEP(LogMessage("%s: save pkt into event queue\n", __func__));
-	            return;
-	        }
+	        DEBUG_U_WRAP_DEEP(LogMessage("%s: save pkt into event queue\n", __func__));
+	        return;
 	    }
 	    break;
 	}
@@ -3595,211 +3818,148 @@ char * snort_escape_string(char * from, DatabaseData * data) {
 	return (char *) to_start;
 }
 
+/* What snort_escape_buffer() escapes for each database.  '%' and '_'
+ * only need escaping in a SELECT...LIKE, which never occurs here.
+ */
+#if defined(ENABLE_MYSQL) || defined(ENABLE_ODBC)
+static const EncodeEscapeMap escape_mysql = {
+	9, { 0, '\n', '\r', '\t', '\\', '/', '\'', '"', '\032' },
+	{ [0] = "\\0", ['\n'] = "\\n", ['\r'] = "\\r", ['\t'] = "\\t",
+	  ['\\'] = "\\\\", ['/'] = "\\/", ['\''] = "\\'", ['"'] = "\\\"",
+	  ['\032'] = "\\Z" /* Ctrl-Z (Win32 EOF) */ }
+};
+
+/* as MySQL but Ctrl-Z is copied */
+static const EncodeEscapeMap escape_odbc = {
+	8, { 0, '\n', '\r', '\t', '\\', '/', '\'', '"' },
+	{ [0] = "\\0", ['\n'] = "\\n", ['\r'] = "\\r", ['\t'] = "\\t",
+	  ['\\'] = "\\\\", ['/'] = "\\/", ['\''] = "\\'", ['"'] = "\\\"" }
+};
+#endif /* defined(ENABLE_MYSQL) || defined(ENABLE_ODBC) */
+
+#ifdef ENABLE_ORACLE
+static const EncodeEscapeMap escape_oracle = {
+	2, { '\'', '\032' },
+	{ ['\''] = "''", ['\032'] = "\\Z" }
+};
+#endif /* ENABLE_ORACLE */
+
+#ifdef ENABLE_MSSQL
+static const EncodeEscapeMap escape_mssql = {
+	1, { '\'' },
+	{ ['\''] = "''" }
+};
+#endif /* ENABLE_MSSQL */
+
+static const EncodeEscapeMap escape_default = {
+	2, { '\'', '\\' },
+	{ ['\''] = "''", ['\\'] = "\\\\" }
+};
+
 /*
- Same function as above but will work on a static buffer, slightly different arguments...
+ Escape from_len bytes of from into to, which holds to_size bytes, for
+ the database in use.  *to_len gets the escaped length.
  */
-u_int32_t snort_escape_string_STATIC(char *from, char *buff_esc, u_int32_t buffer_max_len,
-		DatabaseData *data) {
+u_int32_t snort_escape_buffer(const char *from, u_int32_t from_len, char *to,
+		u_int32_t to_size, u_int32_t *to_len, DatabaseData *data) {
+	const EncodeEscapeMap *map = &escape_default;
 
 #if defined(ENABLE_POSTGRESQL)
 	int error = 0;
 	size_t write_len = 0;
 #endif /* defined(ENABLE_POSRGRESQL) */
 
-	char * to = NULL;
-	char * to_start = NULL;
-	char * end = NULL;
-	char * from_start = NULL;
-	int from_length = 0;
-
-	if ((from == NULL) || (data == NULL)) {
+	if ((from == NULL) || (to == NULL) || (data == NULL)) {
 		/* XXX */
 		return 1;
 	}
 
-	if ((buffer_max_len > (DATABASE_MAX_ESCAPE_STATIC_BUFFER_LEN - 1))
-			|| ((strlen(from) + 1) > buffer_max_len) || (buffer_max_len == 0)) {
-		/* XXX */
-		FatalError(
-				"database [%s()]: Edit source code and change the value of the #define  DATABASE_MAX_ESCAPE_STATIC_BUFFER_LEN in spo_database.h to something greater than [%u] \n",
-				__FUNCTION__, buffer_max_len);
-	}
-
-	memset(buff_esc, '\0', DATABASE_MAX_ESCAPE_STATIC_BUFFER_LEN);
-
-	if ((from_length = strlen(from)) == 1) {
-		/* Nothing to escape */
-		return 0;
-	}
-
-	from_start = from;
-	to = buff_esc;
-	to_start = to;
-
 	switch (data->dbtype_id) {
 #ifdef ENABLE_ORACLE
 	case DB_ORACLE:
-	for (end=from+from_length; from != end; from++)
-	{
-		switch(*from)
-		{
-			case '\'': /*  '  -->  '' */
-			*to++= '\'';
-			*to++= '\'';
-			break;
-			case '\032': /* Ctrl-Z (Win32 EOF)  -->  \\Z */
-			*to++= '\\'; /* This gives problems on Win32 */
-			*to++= 'Z';
-			break;
-			default: /* copy character directly */
-			*to++= *from;
-		}
-	}
-	break;
+		map = &escape_oracle;
+		break;
 #endif
 
 #ifdef ENABLE_MSSQL
 	case DB_MSSQL:
-
-	for (end=from+from_length; from != end; from++)
-	{
-		switch(*from)
-		{
-			case '\'': /*  '  -->  '' */
-			*to++= '\'';
-			*to++= '\'';
-			break;
-			default: /* copy character directly */
-			*to++= *from;
-		}
-	}
-	break;
+		map = &escape_mssql;
+		break;
 #endif
-	/* Historically these were together in a common "else".
-	 * Keeping it that way until somebody complains...
-	 */
 
 #if  defined( ENABLE_MYSQL ) || defined (ENABLE_ODBC)
-//#ifdef ENABLE_MYSQL
 	case DB_ODBC:
-	case DB_MYSQL:
-		for (end = from + from_length; from != end; from++) {
-			switch (*from) {
-			/*
-			 * Only need to escape '%' and '_' characters
-			 * when querying a SELECT...LIKE, which never
-			 * occurs in Snort.  Excluding these checks
-			 * for that reason.
-			 */
-			/*
-			 case '%':            * %  -->  \% *
-			 *to++= '\\';
-			 *to++= '%';
-			 break;
-			 case '_':            * _  -->  \_  *
-			 *to++= '\\';
-			 *to++= '_';
-			 break;
-			 */
+		map = &escape_odbc;
+		break;
 
-			case 0: /* NULL  -->  \\0  (probably never encountered due to strlen() above) */
-				*to++ = '\\'; /* Must be escaped for 'mysql' */
-				*to++ = '0';
-				break;
-			case '\n': /* \n  -->  \\n */
-				*to++ = '\\'; /* Must be escaped for logs */
-				*to++ = 'n';
-				break;
-			case '\r': /* \r  -->  \\r */
-				*to++ = '\\';
-				*to++ = 'r';
-				break;
-			case '\t': /* \t  -->  \\t */
-				*to++ = '\\';
-				*to++ = 't';
-				break;
-			case '\\': /* \  -->  \\ */
-				*to++ = '\\';
-				*to++ = '\\';
-				break;
-			case '/':
-				*to++ = '\\'; /* / --> \/ */
-				*to++ = '/';
-				break;
-			case '\'': /* '  -->  \' */
-				*to++ = '\\';
-				*to++ = '\'';
-				break;
-			case '"': /* "  -->  \" */
-				*to++ = '\\'; /* Better safe than sorry */
-				*to++ = '"';
-				break;
-			case '\032': /* Ctrl-Z (Win32 EOF)  -->  \\Z */
-				if (data->dbtype_id == DB_MYSQL) {
-					*to++ = '\\'; /* This gives problems on Win32 */
-					*to++ = 'Z';
-				} else {
-					*to++ = *from;
-				}
-				break;
-			default: /* copy character directly */
-				*to++ = *from;
-			}
-		}
+	case DB_MYSQL:
+		map = &escape_mysql;
 		break;
 #endif /* defined( ENABLE_MYSQL ) || defined (ENABLE_ODBC) */
 
 #ifdef ENABLE_POSTGRESQL
-		case DB_POSTGRESQL:
-
-		if( (write_len = PQescapeStringConn(data->p_connection,
-								data->sanitize_buffer,
-								from,
-								buffer_max_len,&error)) == 0)
-		{
+	case DB_POSTGRESQL:
+		if (((u_int64_t) from_len * 2 + 1) > to_size) {
 			/* XXX */
 			return 1;
 		}
 
-		if(error != 1)
-		{
-			memcpy(from_start,data->sanitize_buffer,write_len+1);
-		}
-		else
-		{
+		write_len = PQescapeStringConn(data->p_connection, to, from, from_len,
+				&error);
+		if (error != 0) {
 			/* XXX */
 			return 1;
 		}
 
+		if (to_len)
+			*to_len = write_len;
 		return 0;
-		break;
 #endif /* ENABLE_POSTGRESQL*/
+
 	default:
-		for (end = from + from_length; from != end; from++) {
-			switch (*from) {
-			case '\'': /*  '  -->  '' */
-				*to++ = '\'';
-				*to++ = '\'';
-				break;
-			case '\\': /* \  -->  \\ */
-				*to++ = '\\';
-				*to++ = '\\';
-				break;
-			default: /* copy character directly */
-				*to++ = *from;
-			}
-		}
 		break;
 	}
 
-	*to = '\0';
+	return EncodeEscape(from, from_len, to, to_size, map, to_len);
+}
+
+/*
+ Same function as above but will work on a static buffer, slightly different arguments...
+ from is escaped in place, buffer_max_len is what it holds and buff_esc
+ is left holding the escaped string too.
+ */
+u_int32_t snort_escape_string_STATIC(char *from, char *buff_esc, u_int32_t buffer_max_len,
+		DatabaseData *data) {
+	u_int32_t from_length = 0;
+	u_int32_t esc_length = 0;
+
+	if ((from == NULL) || (buff_esc == NULL) || (data == NULL)) {
+		/* XXX */
+		return 1;
+	}
+
+	from_length = strlen(from);
+
+	if ((buffer_max_len > (DATABASE_MAX_ESCAPE_STATIC_BUFFER_LEN - 1))
+			|| ((from_length + 1) > buffer_max_len) || (buffer_max_len == 0)) {
+		/* XXX */
+		FatalError(
+				"database [%s()]: Edit source code and change the value of the #define  DATABASE_MAX_ESCAPE_STATIC_BUFFER_LEN in spo_database.h to something greater than [%u] \n",
+				__FUNCTION__, buffer_max_len);
+	}
+
+	if (snort_escape_buffer(from, from_length, buff_esc,
+			DATABASE_MAX_ESCAPE_STATIC_BUFFER_LEN, &esc_length, data)) {
+		/* XXX */
+		return 1;
+	}
 
-	if (strlen(to_start) > buffer_max_len) {
+	if ((esc_length + 1) > buffer_max_len) {
 		/* XXX */
 		return 1;
 	}
 
-	memcpy(from_start, to_start, strlen(to_start));
+	memcpy(from, buff_esc, esc_length + 1);
 	return 0;
 }
 
@@ -53,6 +53,8 @@
 #include "rules.h"
 #include "unified2.h"
 #include "util.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include "output-plugins/spo_database_cache.h"
 
@@ -112,8 +114,11 @@ typedef SQLCHAR ODBC_SQLCHAR;
 #define MAX_SQL_QUERY_LENGTH_ADDATA   (0x4000000)//(0x800000)
 
 #define SQL_PKT_BUF_LEN         0x10000
-#define SQL_EVENT_QUEUE_LEN     1000
-#define SQL_PKT_QUEUE_LEN       1000
+/* a whole output batch fits: the output thread flushes before SPOOLER_BATCH_MAX
+ * records, and one more record off a ring sends out SPOOLER_BATCH_STEP at most */
+#define SQL_EVENT_QUEUE_LEN     (SPOOLER_BATCH_MAX + SPOOLER_BATCH_STEP)
+#define SQL_PKT_QUEUE_LEN       (SPOOLER_BATCH_MAX + SPOOLER_BATCH_STEP)
+#define SQL_EXTRA_QUEUE_LEN     (SPOOLER_BATCH_MAX + SPOOLER_BATCH_STEP)
 
 //#define IF_SPO_QUERY_IN_THREAD        //If start Query Separate Threads
 
@@ -160,6 +165,41 @@ typedef enum db_types_en dbtype_t;
 #define MAX_SIG_HASHSZ          4096
 #define SIG_HASHSZ_MASK         (MAX_SIG_HASHSZ-1)
 
+/* ------------------------------------------
+ * HASH INDEX
+ * Used by the cache synchronization to join database rows against
+ * the cache lists, entries point to the cached objects.
+ ------------------------------------------ */
+#define CACHE_INDEX_MIN         256
+#define CACHE_INDEX_MAX         (1 << 20)
+#define CACHE_INDEX_CHUNK       4096
+
+typedef struct _cacheIndexEntry {
+	void *obj;
+	u_int32_t hash;
+	struct _cacheIndexEntry *next;
+
+} cacheIndexEntry;
+
+typedef struct _cacheIndexChunk {
+	struct _cacheIndexChunk *next;
+	u_int32_t used;
+	cacheIndexEntry entry[CACHE_INDEX_CHUNK];
+
+} cacheIndexChunk;
+
+typedef struct _cacheIndex {
+	cacheIndexEntry **bucket;
+	cacheIndexChunk *chunk; /* oldest first, rebuilt in that order on growth */
+	cacheIndexChunk *last;
+	u_int32_t mask;
+	u_int32_t count;
+
+} cacheIndex;
+/* ------------------------------------------
+ * HASH INDEX
+ ------------------------------------------ */
+
 /* ------------------------------------------
  * REFERENCE OBJ 
  ------------------------------------------ */
@@ -302,6 +342,7 @@ typedef struct _masterCache {
 	cacheSystemObj *cacheSystemHead;
 	cacheSignatureReferenceObj *cacheSigReferenceHead;
 	cacheSignatureObj *cacheSigHashMap[MAX_SIG_HASHSZ];
+	cacheIndex cacheRefIndex; /* system and tag to reference, while converting */
 	plgSignatureObj plgSigCompare[MAX_SIGLOOKUP]; /* Used by spo_database when querying the cache for signature match */
 
 } MasterCache;
@@ -446,14 +487,23 @@ typedef struct __SQLEvent {
     Packet *p;
 }SQLEvent;
 
+/* an event's extra data, its bytes still in the ring slot */
+typedef struct __SQLExtra {
+    uint8_t rid;
+    us_cid_t event_id;
+    EventAttr attr;
+}SQLExtra;
+
 typedef struct __SQLEventQueue {
     uint16_t ele_cnt;
     uint16_t ele_exp_cnt;
+    uint16_t ele_ext_cnt;
     RingTopOct *ele_rtOct;
 //    uint8_t event_id_1_cnt[BY_MUL_TR_DEFAULT];
     char ele_pktbuf[SQL_PKT_BUF_LEN];
     SQLEvent ele[SQL_EVENT_QUEUE_LEN];
     SQLPkt ele_expkt[SQL_PKT_QUEUE_LEN];
+    SQLExtra ele_extra[SQL_EXTRA_QUEUE_LEN];
 }SQLEventQueue;
 
 /*  Databse Reliability  */
@@ -652,6 +702,14 @@ typedef struct _DatabaseData
 /*  Databse Reliability  */
 
 	uint64_t cpuset_bm;     //Support Maximum 64 cores
+
+	char *cache_snapshot;   //synchronized cache snapshot, "none" to disable
+
+	/* shared by the query threads, see DatabaseMetrics() */
+	MetricsHistogram batch_events;  //events per committed transaction
+	MetricsHistogram trans_usecs;   //BeginTransaction to commit done
+	MetricsHistogram commit_usecs;  //CommitTransaction alone
+	uint64_t dropped;               //records with no room left in the batch
 } DatabaseData;
 
 /******** Constants  ***************************************************/
@@ -683,6 +741,8 @@ typedef struct _DatabaseData
 #define KEYWORD_CONNECTION_LIMIT "connection_limit"
 #define KEYWORD_RECONNECT_SLEEP_TIME "reconnect_sleep_time"
 #define KEYWORD_DISABLE_SIGREFTABLE "disable_signature_reference_table"
+#define KEYWORD_CACHE_SNAPSHOT "cache_snapshot"
+#define KEYWORD_CACHE_SNAPSHOT_NONE "none"
 
 #define KEYWORD_MYSQL_RECONNECT "mysql_reconnect"
 
@@ -739,9 +799,12 @@ DatabaseData *InitDatabaseData(char *args);
 char *snort_escape_string(char *, DatabaseData *);
 u_int32_t snort_escape_string_STATIC(char *from, char *buff_esc, u_int32_t buffer_max_len,
 		DatabaseData *data);
+u_int32_t snort_escape_buffer(const char *from, u_int32_t from_len, char *to,
+		u_int32_t to_size, u_int32_t *to_len, DatabaseData *data);
 
 void DatabaseInit(char *);
 void DatabaseInitFinalize(int unused, void *arg);
+void DatabaseMetrics(MetricsBuf *, void *);
 void ParseDatabaseArgs(DatabaseData *data);
 void *Spo_EncodeSql(void *);
 #ifdef IF_SPO_QUERY_IN_THREAD
@@ -801,6 +864,10 @@ u_int32_t dbSignatureReferenceLookup(dbSignatureReferenceObj *iLookup,
 u_int32_t dbReferenceLookup(dbReferenceObj *iLookup, cacheReferenceObj *iHead);
 u_int32_t dbSystemLookup(dbSystemObj *iLookup, cacheSystemObj *iHead);
 u_int32_t dbSignatureLookup(dbSignatureObj *iLookup, cacheSignatureObj *iHead);
+u_int32_t dbSignatureHashLookup(dbSignatureObj *iLookup,
+        cacheSignatureObj **iHashMap);
+u_int32_t cacheSignatureHashLookup(dbSignatureObj *iLookup,
+        cacheSignatureObj **iHashMap);
 u_int32_t dbClassificationLookup(dbClassificationObj *iLookup,
         cacheClassificationObj *iHead);
 /* LOOKUP FUNCTIONS */
@@ -820,14 +887,14 @@ u_int32_t ClassificationCacheSynchronize(DatabaseData *data,
 u_int32_t SignatureCacheUpdateDBid(DatabaseData *data, dbSignatureObj *iDBList,
         u_int32_t array_length, cacheSignatureObj **cacheHead);
 u_int32_t SignaturePullDataStore(DatabaseData *data, dbSignatureObj **iArrayPtr,
-        u_int32_t *array_length);
+        u_int32_t *array_length, u_int32_t from_id);
 u_int32_t SignatureCacheSynchronize(DatabaseData *data,
         cacheSignatureObj **cacheHead);
 /* SIGNATURE FUNCTIONS */
 
 /* REFERENCE FUNCTIONS */
 u_int32_t ReferencePullDataStore(DatabaseData *data, dbReferenceObj **iArrayPtr,
-        u_int32_t *array_length);
+        u_int32_t *array_length, u_int32_t from_id);
 u_int32_t ReferenceCacheUpdateDBid(dbReferenceObj *iDBList,
         u_int32_t array_length, cacheSystemObj **cacheHead);
 u_int32_t ReferencePopulateDatabase(DatabaseData *data,
@@ -870,6 +937,12 @@ u_int32_t ConvertSignatureCache(SigNode **iHead, MasterCache *iMasterCache,
 //u_int32_t CacheSynchronize(DatabaseData *data);
 /* Init FUNCTIONS */
 
+/* Snapshot FUNCTIONS */
+u_int64_t CacheFingerprint(DatabaseData *data);
+u_int32_t CacheSnapshotLoad(DatabaseData *data, u_int64_t fingerprint);
+u_int32_t CacheSnapshotSave(DatabaseData *data, u_int64_t fingerprint);
+/* Snapshot FUNCTIONS */
+
 /* Destructor */
 void MasterCacheFlush(DatabaseData *data, u_int32_t flushFlag);
 /* Destructor */
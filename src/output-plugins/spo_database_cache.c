@@ -29,6 +29,9 @@
  *
  */
 
+#include <ctype.h>
+#include <stdio.h>
+
 #include "jhash.h"
 #include "output-plugins/spo_database.h"
 #include "output-plugins/spo_database_cache.h"
@@ -75,6 +78,130 @@ u_int32_t inserted_classification_object_count = 0;
 u_int32_t inserted_sigref_object_count = 0;
 #endif
 
+/**
+ * Hash index helpers, the synchronization joins each database row and each
+ * signature against the cache through these instead of walking whole lists.
+ *
+ * Entries sharing a hash are returned newest first, the same order a walk
+ * of a list built by prepending would find them in.
+ */
+static void cacheIndexInit(cacheIndex *idx, u_int32_t hint) {
+	u_int32_t size = CACHE_INDEX_MIN;
+
+	while ((size < hint) && (size < CACHE_INDEX_MAX)) {
+		size <<= 1;
+	}
+
+	memset(idx, '\0', sizeof(cacheIndex));
+	idx->bucket = SnortAlloc(sizeof(cacheIndexEntry *) * size);
+	idx->mask = size - 1;
+}
+
+static void cacheIndexGrow(cacheIndex *idx) {
+	cacheIndexEntry **bucket = NULL;
+	cacheIndexChunk *cChunk = NULL;
+	cacheIndexEntry *e = NULL;
+	u_int32_t mask = ((idx->mask + 1) << 1) - 1;
+	u_int32_t x = 0;
+
+	bucket = SnortAlloc(sizeof(cacheIndexEntry *) * (mask + 1));
+
+	/* Oldest first so each chain keeps newest first */
+	for (cChunk = idx->chunk; cChunk != NULL; cChunk = cChunk->next) {
+		for (x = 0; x < cChunk->used; x++) {
+			e = &cChunk->entry[x];
+			e->next = bucket[e->hash & mask];
+			bucket[e->hash & mask] = e;
+		}
+	}
+
+	free(idx->bucket);
+	idx->bucket = bucket;
+	idx->mask = mask;
+}
+
+static void cacheIndexAdd(cacheIndex *idx, u_int32_t hash, void *obj) {
+	cacheIndexChunk *cChunk = idx->last;
+	cacheIndexEntry *e = NULL;
+
+	if (idx->bucket == NULL) {
+		cacheIndexInit(idx, 0);
+	}
+
+	if ((cChunk == NULL) || (cChunk->used == CACHE_INDEX_CHUNK)) {
+		cChunk = SnortAlloc(sizeof(cacheIndexChunk));
+
+		if (idx->last != NULL) {
+			idx->last->next = cChunk;
+		} else {
+			idx->chunk = cChunk;
+		}
+		idx->last = cChunk;
+	}
+
+	e = &cChunk->entry[cChunk->used++];
+	e->obj = obj;
+	e->hash = hash;
+	e->next = idx->bucket[hash & idx->mask];
+	idx->bucket[hash & idx->mask] = e;
+
+	if ((++idx->count > ((idx->mask + 1) << 1))
+			&& ((idx->mask + 1) < CACHE_INDEX_MAX)) {
+		cacheIndexGrow(idx);
+	}
+}
+
+static cacheIndexEntry *cacheIndexNext(cacheIndexEntry *e, u_int32_t hash) {
+	while ((e != NULL) && (e->hash != hash)) {
+		e = e->next;
+	}
+
+	return e;
+}
+
+static cacheIndexEntry *cacheIndexFirst(cacheIndex *idx, u_int32_t hash) {
+	if (idx->bucket == NULL) {
+		return NULL;
+	}
+
+	return cacheIndexNext(idx->bucket[hash & idx->mask], hash);
+}
+
+static void cacheIndexFree(cacheIndex *idx) {
+	cacheIndexChunk *cChunk = idx->chunk;
+	cacheIndexChunk *next = NULL;
+
+	while (cChunk != NULL) {
+		next = cChunk->next;
+		free(cChunk);
+		cChunk = next;
+	}
+
+	if (idx->bucket != NULL) {
+		free(idx->bucket);
+	}
+
+	memset(idx, '\0', sizeof(cacheIndex));
+}
+
+/* Case insensitive, as the lookups compare with strncasecmp() */
+static u_int32_t cacheIndexHashString(const char *str, u_int32_t initval) {
+	char lower[SIG_MSG_LEN];
+	u_int32_t len = 0;
+
+	while ((str[len] != '\0') && (len < sizeof(lower))) {
+		lower[len] = tolower((unsigned char) str[len]);
+		len++;
+	}
+
+	return jhash(lower, len, initval);
+}
+
+static u_int32_t cacheIndexHashReference(cacheSystemObj *system,
+		const char *ref_tag) {
+	return cacheIndexHashString(ref_tag, (u_int32_t) (uintptr_t) system);
+}
+
 /** 
  * Lookup for dbSignatureReferenceObj in cacheSignatureReferenceObj 
  *
@@ -554,6 +681,105 @@ u_int32_t dbSignatureLookup(dbSignatureObj *iLookup, cacheSignatureObj *iHead) {
 
 }
 
+static u_int32_t cacheSignatureHashIndex(u_int32_t gid, u_int32_t sid) {
+	dbSignatureHashKey sigHashKey;
+
+	sigHashKey.gid = gid;
+	sigHashKey.sid = sid;
+
+	return jhash(&sigHashKey, sizeof(sigHashKey), 0) & SIG_HASHSZ_MASK;
+}
+
+/**
+ * dbSignatureLookup() over the gid/sid hash map instead of the whole list.
+ * @note the chains are built in the same order as the list, so the same
+ *       node is found.
+ *
+ * @param iLookup
+ * @param iHashMap
+ *
+ * @return
+ * 0 NOT FOUND
+ * 1 FOUND
+ */
+u_int32_t dbSignatureHashLookup(dbSignatureObj *iLookup,
+		cacheSignatureObj **iHashMap) {
+	cacheSignatureObj *iHead = NULL;
+
+	if ((iLookup == NULL) || (iHashMap == NULL)) {
+		/* XXX */
+		FatalError(
+				"database [%s()], Called with dbSignatureObj[0x%x] cacheSignatureObj **[0x%x] \n",
+				__FUNCTION__, iLookup, iHashMap);
+	}
+
+	iHead = iHashMap[cacheSignatureHashIndex(iLookup->gid, iLookup->sid)];
+
+	while (iHead != NULL) {
+		if ((iLookup->sid == iHead->obj.sid) && (iLookup->gid == iHead->obj.gid)
+				&& (strncasecmp(iLookup->message, iHead->obj.message,
+						glsl(iLookup->message, iHead->obj.message)) == 0)) {
+
+			/* Same revision rules as dbSignatureLookup() */
+			if (iHead->obj.rev == 0) {
+				iHead->obj.rev = iLookup->rev;
+			} else if (iHead->obj.rev != iLookup->rev) {
+				iHead = iHead->next_ham;
+				continue;
+			}
+
+			iHead->flag |= CACHE_DATABASE;
+
+			iHead->obj.db_id = iLookup->db_id;
+			iHead->obj.class_id = iLookup->class_id;
+			iHead->obj.priority_id = iLookup->priority_id;
+			return 1;
+		}
+
+		iHead = iHead->next_ham;
+	}
+
+	return 0;
+}
+
+/**
+ * cacheSignatureLookup() over the gid/sid hash map instead of the whole list.
+ *
+ * @param iLookup
+ * @param iHashMap
+ *
+ * @return
+ * 0 NOT FOUND
+ * 1 FOUND
+ */
+u_int32_t cacheSignatureHashLookup(dbSignatureObj *iLookup,
+		cacheSignatureObj **iHashMap) {
+	cacheSignatureObj *iHead = NULL;
+
+	if ((iLookup == NULL) || (iHashMap == NULL)) {
+		/* XXX */
+		FatalError(
+				"database [%s()], Called with dbSignatureObj[0x%x] cacheSignatureObj **[0x%x] \n",
+				__FUNCTION__, iLookup, iHashMap);
+	}
+
+	iHead = iHashMap[cacheSignatureHashIndex(iLookup->gid, iLookup->sid)];
+
+	while (iHead != NULL) {
+		if ((iLookup->sid == iHead->obj.sid) && (iLookup->gid == iHead->obj.gid)
+				&& (iLookup->rev == iHead->obj.rev)
+				&& (strncasecmp(iLookup->message, iHead->obj.message,
+						glsl(iLookup->message, iHead->obj.message)) == 0)) {
+			/* Found */
+			return 1;
+		}
+
+		iHead = iHead->next_ham;
+	}
+
+	return 0;
+}
+
 /**
  * Lookup for dbClassificationObj in cacheClassificationObj
  * @note Used in context db->internaCache lookup (if found remove CACHE_INTERNAL_ONLY and set CACHE_BOTH flag)
@@ -599,6 +825,53 @@ u_int32_t dbClassificationLookup(dbClassificationObj *iLookup,
 	return 0;
 }
 
+/**
+ * Lookup for a reference by system and tag in a reference index.
+ *
+ * @param idx
+ * @param system
+ * @param ref_tag
+ *
+ * @return
+ * NULL           NOT FOUND
+ * Valid POINTER  FOUND
+ */
+static cacheReferenceObj *cacheReferenceIndexLookup(cacheIndex *idx,
+		cacheSystemObj *system, const char *ref_tag) {
+	cacheReferenceObj *cRef = NULL;
+	cacheIndexEntry *e = NULL;
+	u_int32_t hash = cacheIndexHashReference(system, ref_tag);
+
+	for (e = cacheIndexFirst(idx, hash); e != NULL;
+			e = cacheIndexNext(e->next, hash)) {
+		cRef = (cacheReferenceObj *) e->obj;
+
+		if ((cRef->obj.parent == system)
+				&& (strcasecmp(ref_tag, cRef->obj.ref_tag) == 0)) {
+			return cRef;
+		}
+	}
+
+	return NULL;
+}
+
+/* Index every reference of every system, keyed on system and tag */
+static void cacheReferenceIndexBuild(cacheIndex *idx, cacheSystemObj *iHead,
+		u_int32_t hint) {
+	cacheReferenceObj *cRef = NULL;
+
+	cacheIndexInit(idx, hint);
+
+	while (iHead != NULL) {
+		for (cRef = iHead->obj.refList; cRef != NULL; cRef = cRef->next) {
+			cacheIndexAdd(idx,
+					cacheIndexHashReference(cRef->obj.parent, cRef->obj.ref_tag),
+					cRef);
+		}
+		iHead = iHead->next;
+	}
+}
+
 /*
 
  iHead->system == lookup for system obj
@@ -646,6 +919,11 @@ u_int32_t ConvertReferenceCache(ReferenceNode *iHead, MasterCache *iMasterCache,
 		return 0;
 	}
 
+	if (iMasterCache->cacheRefIndex.bucket == NULL) {
+		cacheReferenceIndexBuild(&iMasterCache->cacheRefIndex,
+				iMasterCache->cacheSystemHead, 0);
+	}
+
 	cNode = iHead;
 
 	while (cNode != NULL) {
@@ -724,8 +1002,9 @@ u_int32_t ConvertReferenceCache(ReferenceNode *iHead, MasterCache *iMasterCache,
 #endif
 
 			/* Lookup Reference node */
-			if ((cacheReferenceLookup(&ref_LobjNode,
-					sysRetCacheNode->obj.refList, &retRefLookupNode) == 0)) {
+			if ((retRefLookupNode = cacheReferenceIndexLookup(
+					&iMasterCache->cacheRefIndex, sysRetCacheNode,
+					ref_LobjNode.ref_tag)) == NULL) {
 				if ((ref_TobjNode = SnortAlloc(sizeof(cacheReferenceObj)))
 						== NULL) {
 					/* XXX */
@@ -746,6 +1025,10 @@ u_int32_t ConvertReferenceCache(ReferenceNode *iHead, MasterCache *iMasterCache,
 
 				ref_TobjNode->obj.parent = sysRetCacheNode;
 
+				cacheIndexAdd(&iMasterCache->cacheRefIndex,
+						cacheIndexHashReference(sysRetCacheNode,
+								ref_TobjNode->obj.ref_tag), ref_TobjNode);
+
 				if (cSobj->obj.ref_count < MAX_REF_OBJ) {
 					cSobj->obj.ref[cSobj->obj.ref_count] = ref_TobjNode;
 					cSobj->obj.ref_count++;
@@ -878,7 +1161,7 @@ u_int32_t ConvertSignatureCache(SigNode **iHead, MasterCache *iMasterCache,
 		}
 
 		//Do not allow duplicate to exist
-		if ((cacheSignatureLookup(&lookupNode, iMasterCache->cacheSignatureHead)
+		if ((cacheSignatureHashLookup(&lookupNode, iMasterCache->cacheSigHashMap)
 				== 0)) {
 			if ((TobjNode = SnortAlloc(sizeof(cacheSignatureObj))) == NULL) {
 				/* XXX */
@@ -923,6 +1206,9 @@ u_int32_t ConvertSignatureCache(SigNode **iHead, MasterCache *iMasterCache,
 		cNode = cNode->next;
 	}
 
+	/* Only needed while converting */
+	cacheIndexFree(&iMasterCache->cacheRefIndex);
+
 	return 0;
 }
 
@@ -1728,6 +2014,66 @@ u_int32_t ClassificationCacheSynchronize(DatabaseData *data,
 #ifdef ENABLE_MYSQL
 /***********************************************************************************************SIGNATURE API*/
 
+/**
+ * Multi-row INSERT helpers.
+ *
+ * Rows are appended to data->SQL_INSERT[q_sock] behind the statement prefix
+ * until the next one would not fit in MAX_QUERY_LENGTH, then the statement
+ * is sent.  first_id, when not NULL and still 0, is set to the first auto
+ * increment id of the first statement sent; every id generated by later
+ * statements is above it.
+ *
+ * @return
+ * 0 OK
+ * 1 ERROR
+ */
+static u_int32_t BulkInsertFlush(DatabaseData *data, u_int32_t *len,
+		u_int32_t *first_id, uint8_t q_sock) {
+	if (*len == 0) {
+		return 0;
+	}
+
+	data->SQL_INSERT[q_sock][(*len)++] = ';';
+	data->SQL_INSERT[q_sock][*len] = '\0';
+	*len = 0;
+
+	if (Insert(data->SQL_INSERT[q_sock], data, 1, q_sock)) {
+		/* XXX */
+		return 1;
+	}
+
+	if ((first_id != NULL) && (*first_id == 0)) {
+		*first_id = mysql_insert_id(data->m_dbins[q_sock].m_sock);
+	}
+
+	return 0;
+}
+
+static u_int32_t BulkInsertRow(DatabaseData *data, u_int32_t *len,
+		const char *prefix, const char *row, u_int32_t *first_id,
+		uint8_t q_sock) {
+	u_int32_t row_len = strlen(row);
+
+	/* room for the separator, ';' and the terminating NUL */
+	if ((*len != 0) && ((*len + row_len + 3) > MAX_QUERY_LENGTH)) {
+		if (BulkInsertFlush(data, len, first_id, q_sock)) {
+			return 1;
+		}
+	}
+
+	if (*len == 0) {
+		*len = strlen(prefix);
+		memcpy(data->SQL_INSERT[q_sock], prefix, *len);
+	} else {
+		data->SQL_INSERT[q_sock][(*len)++] = ',';
+	}
+
+	memcpy(data->SQL_INSERT[q_sock] + *len, row, row_len + 1);
+	*len += row_len;
+
+	return 0;
+}
+
 /** 
  * Lookup the database for a specific signature, without looking for signature message.
  * 
@@ -1808,9 +2154,57 @@ u_int32_t SignatureLookupDatabase(DatabaseData *data, dbSignatureObj *sObj, uint
 	return 0;
 }
 
+/**
+ * Signatures that are never inserted, see SignaturePopulateDatabase().
+ */
+static int SignatureInsertSkip(cacheSignatureObj *cNode) {
+	/* This condition block is a shortcut in the signature insertion code.
+	 ** Preventing signature that have not been under "revision" (rev == 0) to be inserted in the database.
+	 ** It will also prevent the code to take wrong execution path downstream.
+	 */
+	return ((1 == cNode->obj.gid || 3 == cNode->obj.gid)
+			&& (0 == cNode->obj.rev));
+}
+
+/**
+ * Give a database row's id to the signature inserted for it, matching
+ * gid, sid, revision and message through the hash map.
+ *
+ * @return
+ * 0 NOT FOUND
+ * 1 FOUND
+ */
+static u_int32_t SignatureCacheAssignDBid(cacheSignatureObj **iHashMap,
+		dbSignatureObj *iLookup) {
+	cacheSignatureObj *iHead = NULL;
+
+	iHead = iHashMap[cacheSignatureHashIndex(iLookup->gid, iLookup->sid)];
+
+	while (iHead != NULL) {
+		if (!(iHead->flag & CACHE_DATABASE) && !SignatureInsertSkip(iHead)
+				&& (iLookup->sid == iHead->obj.sid)
+				&& (iLookup->gid == iHead->obj.gid)
+				&& (iLookup->rev == iHead->obj.rev)
+				&& (strncasecmp(iLookup->message, iHead->obj.message,
+						glsl(iLookup->message, iHead->obj.message)) == 0)) {
+			iHead->obj.db_id = iLookup->db_id;
+			iHead->flag |= CACHE_DATABASE;
+			return 1;
+		}
+
+		iHead = iHead->next_ham;
+	}
+
+	return 0;
+}
+
 /**
  *  Populate the signature table with record that are not present in the database.
  *
+ * @note Missing signatures go in multi-row INSERTs, their ids then come back
+ *       in one SELECT of the rows above the first id generated and are
+ *       joined on the hash map, so cacheHead must be data->mc's list.
+ *
  * @param data
  * @param cacheHead
  *
@@ -1821,7 +2215,14 @@ u_int32_t SignatureLookupDatabase(DatabaseData *data, dbSignatureObj *sObj, uint
 u_int32_t SignaturePopulateDatabase(DatabaseData *data,
 		cacheSignatureObj *cacheHead, int inTransac, uint8_t q_sock)
 {
-	u_int32_t db_sig_id = 0;
+	cacheSignatureObj *cNode = NULL;
+	dbSignatureObj *dbSigArray = NULL;
+	char row[SQL_BULK_ROW_LEN];
+	u_int32_t array_length = 0;
+	u_int32_t first_id = 0;
+	u_int32_t inserted = 0;
+	u_int32_t len = 0;
+	u_int32_t x = 0;
 
 	if ((data == NULL) || (cacheHead == NULL)) {
 		return 1;
@@ -1845,77 +2246,68 @@ u_int32_t SignaturePopulateDatabase(DatabaseData *data,
 		}
 	}
 
-	while (cacheHead != NULL) {
-
-		/* This condition block is a shortcut in the signature insertion code.
-		 ** Preventing signature that have not been under "revision" (rev == 0) to be inserted in the database.
-		 ** It will also prevent the code to take wrong execution path downstream.
-		 */
-		if ( !(cacheHead->flag&CACHE_DATABASE) ) {
-			/* This condition block is a shortcut in the signature insertion code.
-			 ** Preventing signature that have not been under "revision" (rev == 0) to be inserted in the database.
-			 ** It will also prevent the code to take wrong execution path downstream.
-			 */
-			// && (((cacheHead->obj.gid != 1 && cacheHead->obj.gid != 3)) || )
-			if ( (1 == cacheHead->obj.gid || 3 == cacheHead->obj.gid)
-					&& (0 == cacheHead->obj.rev) ) {
-			    cacheHead = cacheHead->next;
-				continue;
-			}
+	for (cNode = cacheHead; cNode != NULL; cNode = cNode->next) {
+		if ((cNode->flag & CACHE_DATABASE) || SignatureInsertSkip(cNode)) {
+			continue;
+		}
 
 #if DEBUG
-			inserted_signature_object_count++;
+		inserted_signature_object_count++;
 #endif
-			/* DONE at object Insertion
-			 if( (snort_escape_string_STATIC(cacheHead->obj.message,SIG_MSG_LEN,data)))
-			 {
-			 FatalError("database [%s()], Failed a call to snort_escape_string_STATIC() for string : \n"
-			 "[%s], Exiting. \n",
-			 __FUNCTION__,
-			 cacheHead->obj.message);
-			 }
-			 */
+		/* Message was escaped at object insertion */
+		if ((SnortSnprintf(row, sizeof(row), SQL_INSERT_SIGNATURE_ROW,
+				cNode->obj.sid, cNode->obj.gid, cNode->obj.rev,
+				cNode->obj.class_id, cNode->obj.priority_id,
+				cNode->obj.message)) != SNORT_SNPRINTF_SUCCESS) {
+			goto TransactionFail;
+		}
 
-			DatabaseCleanInsert(data, q_sock);
+		if (BulkInsertRow(data, &len, SQL_INSERT_SIGNATURE_BULK, row,
+				&first_id, q_sock)) {
+			goto TransactionFail;
+		}
 
-			if ((SnortSnprintf(data->SQL_INSERT[q_sock], MAX_QUERY_LENGTH,
-			SQL_INSERT_SIGNATURE, cacheHead->obj.sid, cacheHead->obj.gid,
-					cacheHead->obj.rev, cacheHead->obj.class_id,
-					cacheHead->obj.priority_id, cacheHead->obj.message))
-					!= SNORT_SNPRINTF_SUCCESS) {
-				goto TransactionFail;
-			}
+		inserted++;
+	}
 
-/*			DatabaseCleanSelect(data, q_sock);
+	if (BulkInsertFlush(data, &len, &first_id, q_sock)) {
+		goto TransactionFail;
+	}
 
-			if ((SnortSnprintf(data->SQL_SELECT[q_sock], MAX_QUERY_LENGTH,
-			SQL_SELECT_SPECIFIC_SIGNATURE, cacheHead->obj.sid,
-					cacheHead->obj.gid, cacheHead->obj.rev,
-					cacheHead->obj.class_id, cacheHead->obj.priority_id,
-					cacheHead->obj.message)) != SNORT_SNPRINTF_SUCCESS) {
-				goto TransactionFail;
-			}*/
+	if (inserted > 0) {
+		if (SignaturePullDataStore(data, &dbSigArray, &array_length, first_id)) {
+			goto TransactionFail;
+		}
 
-			if (Insert(data->SQL_INSERT[q_sock], data, 1, q_sock)) {
-				goto TransactionFail;
-			}
+		for (x = 0; x < array_length; x++) {
+			SignatureCacheAssignDBid(data->mc.cacheSigHashMap, &dbSigArray[x]);
+		}
 
-/*			if (Select(data->SQL_SELECT, data, &db_sig_id)) {
-				goto TransactionFail;
-			}*/
+		if (dbSigArray != NULL) {
+			free(dbSigArray);
+			dbSigArray = NULL;
+		}
 
-#ifdef ENABLE_MYSQL
-			db_sig_id = mysql_insert_id(data->m_dbins[q_sock].m_sock);
-#endif
-			LogMessage("%s: Last query auto_increament id %d\n", __func__, db_sig_id);
+		/* Whatever the join missed (a message stored differently than it
+		 was sent) is looked up on its own */
+		for (cNode = cacheHead; cNode != NULL; cNode = cNode->next) {
+			if ((cNode->flag & CACHE_DATABASE) || SignatureInsertSkip(cNode)) {
+				continue;
+			}
 
-			cacheHead->obj.db_id = db_sig_id;
+			if (SignatureLookupDatabase(data, &cNode->obj, q_sock)) {
+				LogMessage(
+						"[%s()]: No id for inserted signature gid [%u] sid [%u] rev [%u] \n",
+						__FUNCTION__, cNode->obj.gid, cNode->obj.sid,
+						cNode->obj.rev);
+				goto TransactionFail;
+			}
 
-			//cacheHead->flag ^= (CACHE_INTERNAL_ONLY | CACHE_BOTH);
-			cacheHead->flag |= CACHE_DATABASE;
+			cNode->flag |= CACHE_DATABASE;
 		}
 
-		cacheHead = cacheHead->next;
+		LogMessage("database: inserted %u signatures from id %u\n", inserted,
+				first_id);
 	}
 
 	if (inTransac == 0) {
@@ -1961,7 +2353,7 @@ u_int32_t SignatureCacheUpdateDBid(DatabaseData *data, dbSignatureObj *iDBList,
 	for (x = 0; x < array_length; x++) {
 		cObj = &iDBList[x];
 
-		if ((dbSignatureLookup(cObj, *cacheHead)) == 0) {
+		if ((dbSignatureHashLookup(cObj, data->mc.cacheSigHashMap)) == 0) {
 			/* Element not found, add the db entry to the list. */
 			if ((TobjNode = SnortAlloc(sizeof(cacheSignatureObj))) == NULL) {
 				/* XXX */
@@ -1999,13 +2391,14 @@ u_int32_t SignatureCacheUpdateDBid(DatabaseData *data, dbSignatureObj *iDBList,
  * @param data
  * @param iArrayPtr
  * @param array_length
+ * @param from_id only rows with this id or above, 0 for all
  *
  * @return
  * 0 OK
  * 1 ERROR
  */
 u_int32_t SignaturePullDataStore(DatabaseData *data, dbSignatureObj **iArrayPtr,
-		u_int32_t *array_length) {
+		u_int32_t *array_length, u_int32_t from_id) {
 
 #if  (defined(ENABLE_MYSQL) || defined(ENABLE_POSTGRESQL) || defined(ENABLE_ODBC))
 	u_int32_t curr_row = 0;
@@ -2042,8 +2435,11 @@ u_int32_t SignaturePullDataStore(DatabaseData *data, dbSignatureObj **iArrayPtr,
 	}
 
 	DatabaseCleanSelect(data, SPO_DB_DEF_INS);
-	if ((SnortSnprintf(data->SQL_SELECT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
-	SQL_SELECT_ALL_SIGNATURE) != SNORT_SNPRINTF_SUCCESS)) {
+	if (((from_id == 0) ?
+			SnortSnprintf(data->SQL_SELECT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
+			SQL_SELECT_ALL_SIGNATURE) :
+			SnortSnprintf(data->SQL_SELECT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
+			SQL_SELECT_SIGNATURE_FROM, from_id)) != SNORT_SNPRINTF_SUCCESS) {
 		FatalError(
 				"database [%s()], Unable to allocate memory for query, bailing ...\n",
 				__FUNCTION__);
@@ -2581,19 +2977,39 @@ u_int32_t SignaturePullDataStore(DatabaseData *data, dbSignatureObj **iArrayPtr,
 u_int32_t SignatureReferencePreGenerate(cacheSignatureObj *iHead) {
 	cacheSignatureObj *cObj = NULL;
 	cacheSignatureObj *searchObj = NULL;
+	cacheIndexEntry *e = NULL;
+	cacheIndex sigIndex;
+	u_int32_t sig_count = 0;
+	u_int32_t hash = 0;
+
 	if (iHead == NULL) {
 		/* XXX */
 		return 1;
 	}
 
+	/* Siblings share sid and gid, index on those instead of searching the list for each */
+	for (cObj = iHead; cObj != NULL; cObj = cObj->next) {
+		sig_count++;
+	}
+
+	cacheIndexInit(&sigIndex, sig_count);
+
+	for (cObj = iHead; cObj != NULL; cObj = cObj->next) {
+		cacheIndexAdd(&sigIndex, jhash_2words(cObj->obj.sid, cObj->obj.gid, 0),
+				cObj);
+	}
+
 	cObj = iHead;
 
 	while (cObj != NULL) {
 		if ((cObj->flag & CACHE_BOTH) && (cObj->obj.rev != 0)
 				&& (cObj->obj.ref_count > 0)) {
-			searchObj = iHead;
+			hash = jhash_2words(cObj->obj.sid, cObj->obj.gid, 0);
+
+			for (e = cacheIndexFirst(&sigIndex, hash); e != NULL;
+					e = cacheIndexNext(e->next, hash)) {
+				searchObj = (cacheSignatureObj *) e->obj;
 
-			while (searchObj != NULL) {
 				if ((searchObj != cObj) && (cObj->obj.sid == searchObj->obj.sid)
 						&& (cObj->obj.gid == searchObj->obj.gid) &&
 						/* Only set lesser revision rule with refs */
@@ -2602,14 +3018,14 @@ u_int32_t SignatureReferencePreGenerate(cacheSignatureObj *iHead) {
 					memcpy(searchObj->obj.ref, cObj->obj.ref,
 							(sizeof(cacheReferenceObj *) * MAX_REF_OBJ));
 				}
-
-				searchObj = searchObj->next;
 			}
 		}
 
 		cObj = cObj->next;
 	}
 
+	cacheIndexFree(&sigIndex);
+
 	return 0;
 
 }
@@ -2638,7 +3054,7 @@ u_int32_t SignatureCacheSynchronize(DatabaseData *data,
 		return 1;
 	}
 
-	if ((SignaturePullDataStore(data, &dbSigArray, &array_length))) {
+	if ((SignaturePullDataStore(data, &dbSigArray, &array_length, 0))) {
 		/* XXX */
 		return 1;
 	}
@@ -2705,13 +3121,14 @@ u_int32_t SignatureCacheSynchronize(DatabaseData *data,
  * @param data
  * @param iArrayPtr
  * @param array_length
+ * @param from_id only rows with this id or above, 0 for all
  *
  * @return
  * 0 OK
  * 1 ERROR
  */
 u_int32_t ReferencePullDataStore(DatabaseData *data, dbReferenceObj **iArrayPtr,
-		u_int32_t *array_length) {
+		u_int32_t *array_length, u_int32_t from_id) {
 
 #if  (defined(ENABLE_MYSQL) || defined(ENABLE_POSTGRESQL) || defined(ENABLE_ODBC))
 	u_int32_t curr_row = 0;
@@ -2747,8 +3164,11 @@ u_int32_t ReferencePullDataStore(DatabaseData *data, dbReferenceObj **iArrayPtr,
 	}
 
 	DatabaseCleanSelect(data, SPO_DB_DEF_INS);
-	if ((SnortSnprintf(data->SQL_SELECT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
-	SQL_SELECT_ALL_REF) != SNORT_SNPRINTF_SUCCESS)) {
+	if (((from_id == 0) ?
+			SnortSnprintf(data->SQL_SELECT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
+			SQL_SELECT_ALL_REF) :
+			SnortSnprintf(data->SQL_SELECT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
+			SQL_SELECT_REF_FROM, from_id)) != SNORT_SNPRINTF_SUCCESS) {
 		FatalError(
 				"database [%s()], Unable to allocate memory for query, bailing ...\n",
 				__FUNCTION__);
@@ -3746,7 +4166,9 @@ u_int32_t ReferenceCacheUpdateDBid(dbReferenceObj *iDBList,
 		u_int32_t array_length, cacheSystemObj **cacheHead) {
 	cacheSystemObj *systemHead = NULL;
 	cacheReferenceObj *TobjNode = NULL;
+	cacheReferenceObj *cRef = NULL;
 	dbReferenceObj *cObj = NULL;
+	cacheIndex refIndex;
 
 	int x = 0;
 
@@ -3755,6 +4177,8 @@ u_int32_t ReferenceCacheUpdateDBid(dbReferenceObj *iDBList,
 		return 1;
 	}
 
+	cacheReferenceIndexBuild(&refIndex, *cacheHead, array_length);
+
 	/* Set CACHE_BOTH if matches */
 
 	systemHead = *cacheHead;
@@ -3763,9 +4187,16 @@ u_int32_t ReferenceCacheUpdateDBid(dbReferenceObj *iDBList,
 			cObj = &iDBList[x];
 
 			if (cObj->system_id == systemHead->obj.db_ref_system_id) {
-				if ((dbReferenceLookup(cObj, systemHead->obj.refList)) == 0) {
+				if ((cRef = cacheReferenceIndexLookup(&refIndex, systemHead,
+						cObj->ref_tag)) != NULL) {
+					/* Same as dbReferenceLookup() */
+					cRef->flag |= CACHE_DATABASE;
+					cRef->obj.ref_id = cObj->ref_id;
+					cRef->obj.system_id = systemHead->obj.db_ref_system_id;
+				} else {
 					if ((TobjNode = SnortAlloc(sizeof(cacheReferenceObj)))
 							== NULL) {
+						cacheIndexFree(&refIndex);
 						return 1;
 					}
 
@@ -3777,12 +4208,18 @@ u_int32_t ReferenceCacheUpdateDBid(dbReferenceObj *iDBList,
 					TobjNode->next = systemHead->obj.refList;
 
 					systemHead->obj.refList = TobjNode;
+
+					cacheIndexAdd(&refIndex,
+							cacheIndexHashReference(systemHead,
+									TobjNode->obj.ref_tag), TobjNode);
 				}
 			}
 		}
 
 		systemHead = systemHead->next;
 	}
+
+	cacheIndexFree(&refIndex);
 	return 0;
 }
 
@@ -3790,6 +4227,9 @@ u_int32_t ReferenceCacheUpdateDBid(dbReferenceObj *iDBList,
 /**
  *  Populate the reference table with record that are not present in the database.
  *
+ * @note cacheHead is one system's reference list, missing references go in
+ *       multi-row INSERTs and their ids come back in one SELECT.
+ *
  * @param data
  * @param cacheHead
  *
@@ -3799,6 +4239,17 @@ u_int32_t ReferenceCacheUpdateDBid(dbReferenceObj *iDBList,
  */
 u_int32_t ReferencePopulateDatabase(DatabaseData *data,
 		cacheReferenceObj *cacheHead) {
+	cacheSystemObj *systemNode = NULL;
+	cacheReferenceObj *cNode = NULL;
+	cacheReferenceObj *cRef = NULL;
+	dbReferenceObj *dbRefArray = NULL;
+	cacheIndex refIndex;
+	char row[SQL_BULK_ROW_LEN];
+	u_int32_t array_length = 0;
+	u_int32_t first_id = 0;
+	u_int32_t inserted = 0;
+	u_int32_t len = 0;
+	u_int32_t x = 0;
 	u_int32_t db_ref_id;
 
 	if ((data == NULL) || (cacheHead == NULL)) {
@@ -3820,38 +4271,74 @@ u_int32_t ReferencePopulateDatabase(DatabaseData *data,
 				__FUNCTION__, data->SQL_SELECT[SPO_DB_DEF_INS]);
 	}
 
+	systemNode = cacheHead->obj.parent;
+	memset(&refIndex, '\0', sizeof(cacheIndex));
+
 	BeginTransaction(data, SPO_DB_DEF_INS);
 
-	while (cacheHead != NULL) {
-		if ( !(cacheHead->flag & CACHE_DATABASE) ) {
+	for (cNode = cacheHead; cNode != NULL; cNode = cNode->next) {
+		if (cNode->flag & CACHE_DATABASE) {
+			continue;
+		}
 
 #if DEBUG
-			inserted_reference_object_count++;
+		inserted_reference_object_count++;
 #endif
 
-			/* Removed the escaping because we live escaped in the cache */
+		/* Removed the escaping because we live escaped in the cache */
+		if ((SnortSnprintf(row, sizeof(row), SQL_INSERT_REF_ROW,
+				systemNode->obj.db_ref_system_id, cNode->obj.ref_tag))
+				!= SNORT_SNPRINTF_SUCCESS) {
+			/* XXX */
+			goto TransactionFail;
+		}
 
-			DatabaseCleanInsert(data, SPO_DB_DEF_INS);
+		if (BulkInsertRow(data, &len, SQL_INSERT_REF_BULK, row, &first_id,
+				SPO_DB_DEF_INS)) {
+			/* XXX */
+			goto TransactionFail;
+		}
 
-			if ((SnortSnprintf(data->SQL_INSERT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
-			SQL_INSERT_SPECIFIC_REF,
-					cacheHead->obj.parent->obj.db_ref_system_id,
-					cacheHead->obj.ref_tag)) != SNORT_SNPRINTF_SUCCESS) {
-				/* XXX */
-				goto TransactionFail;
+		cacheIndexAdd(&refIndex,
+				cacheIndexHashReference(systemNode, cNode->obj.ref_tag), cNode);
+		inserted++;
+	}
+
+	if (BulkInsertFlush(data, &len, &first_id, SPO_DB_DEF_INS)) {
+		/* XXX */
+		goto TransactionFail;
+	}
+
+	if (inserted > 0) {
+		if (ReferencePullDataStore(data, &dbRefArray, &array_length, first_id)) {
+			/* XXX */
+			goto TransactionFail;
+		}
+
+		for (x = 0; x < array_length; x++) {
+			if (dbRefArray[x].system_id != systemNode->obj.db_ref_system_id) {
+				continue;
 			}
 
-			DatabaseCleanSelect(data, SPO_DB_DEF_INS);
+			if (((cRef = cacheReferenceIndexLookup(&refIndex, systemNode,
+					dbRefArray[x].ref_tag)) != NULL)
+					&& !(cRef->flag & CACHE_DATABASE)) {
+				cRef->obj.ref_id = dbRefArray[x].ref_id;
+				cRef->flag |= CACHE_DATABASE;
+			}
+		}
 
-			if ((SnortSnprintf(data->SQL_SELECT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
-			SQL_SELECT_SPECIFIC_REF,
-					cacheHead->obj.parent->obj.db_ref_system_id,
-					cacheHead->obj.ref_tag)) != SNORT_SNPRINTF_SUCCESS) {
-				/* XXX */
-				goto TransactionFail;
+		/* Whatever the join missed is looked up on its own */
+		for (cNode = cacheHead; cNode != NULL; cNode = cNode->next) {
+			if (cNode->flag & CACHE_DATABASE) {
+				continue;
 			}
 
-			if (Insert(data->SQL_INSERT[SPO_DB_DEF_INS], data, 1, SPO_DB_DEF_INS)) {
+			DatabaseCleanSelect(data, SPO_DB_DEF_INS);
+
+			if ((SnortSnprintf(data->SQL_SELECT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
+			SQL_SELECT_SPECIFIC_REF, systemNode->obj.db_ref_system_id,
+					cNode->obj.ref_tag)) != SNORT_SNPRINTF_SUCCESS) {
 				/* XXX */
 				goto TransactionFail;
 			}
@@ -3861,21 +4348,30 @@ u_int32_t ReferencePopulateDatabase(DatabaseData *data,
 				goto TransactionFail;
 			}
 
-			cacheHead->obj.ref_id = db_ref_id;
-			cacheHead->obj.system_id =
-					cacheHead->obj.parent->obj.db_ref_system_id;
-			//cacheHead->flag ^= (CACHE_INTERNAL_ONLY | CACHE_BOTH); /* Remove it */
-			cacheHead->flag |= CACHE_DATABASE;
+			cNode->obj.ref_id = db_ref_id;
+			cNode->flag |= CACHE_DATABASE;
 		}
+	}
 
-		cacheHead = cacheHead->next;
+	for (cNode = cacheHead; cNode != NULL; cNode = cNode->next) {
+		cNode->obj.system_id = systemNode->obj.db_ref_system_id;
+	}
+
+	if (dbRefArray != NULL) {
+		free(dbRefArray);
 	}
+	cacheIndexFree(&refIndex);
 
 	CommitTransaction(data, SPO_DB_DEF_INS);
 
 	return 0;
 
 	TransactionFail: RollbackTransaction(data, SPO_DB_DEF_INS);
+
+	if (dbRefArray != NULL) {
+		free(dbRefArray);
+	}
+	cacheIndexFree(&refIndex);
 	return 1;
 }
 
@@ -4033,7 +4529,7 @@ u_int32_t SystemCacheSynchronize(DatabaseData *data, cacheSystemObj **cacheHead)
 	/* Reset for re-use */
 	array_length = 0;
 
-	if ((ReferencePullDataStore(data, &dbRefArray, &array_length))) {
+	if ((ReferencePullDataStore(data, &dbRefArray, &array_length, 0))) {
 		/* XXX */
 		LogMessage("[%s()], Call to ReferencePullDataStore() failed. \n",
 				__FUNCTION__);
@@ -4128,15 +4624,28 @@ u_int32_t SystemCacheSynchronize(DatabaseData *data, cacheSystemObj **cacheHead)
 u_int32_t GenerateSigRef(cacheSignatureReferenceObj **iHead,
 		cacheSignatureObj *sigHead) {
 	cacheSignatureReferenceObj *newNode = NULL;
+	cacheSignatureReferenceObj *cNode = NULL;
 	dbSignatureReferenceObj lookupNode = { 0 };
+	cacheIndexEntry *e = NULL;
+	cacheIndex sigRefIndex;
 
 	u_int32_t node_count = 0; //could be short eh!.
+	u_int32_t hash = 0;
 
 	if ((iHead == NULL) || (sigHead == NULL)) {
 		/* XXX */
 		return 1;
 	}
 
+	/* Keyed on reference and signature id, the same pair cacheSignatureReferenceLookup() compares */
+	memset(&sigRefIndex, '\0', sizeof(cacheIndex));
+
+	for (cNode = *iHead; cNode != NULL; cNode = cNode->next) {
+		cacheIndexAdd(&sigRefIndex,
+				jhash_2words(cNode->obj.db_ref_id, cNode->obj.db_sig_id, 0),
+				cNode);
+	}
+
 	while (sigHead != NULL) {
 		/* Do not generate sig_ref for internal sig, since they are not inserted,
 		 db_id is 0 and this is corrupting the process  */
@@ -4148,10 +4657,23 @@ u_int32_t GenerateSigRef(cacheSignatureReferenceObj **iHead,
 				lookupNode.db_sig_id = sigHead->obj.db_id;
 				lookupNode.ref_seq = (node_count + 1);
 
-				if ((cacheSignatureReferenceLookup(&lookupNode, *iHead)) == 0) {
+				hash = jhash_2words(lookupNode.db_ref_id, lookupNode.db_sig_id, 0);
+
+				for (e = cacheIndexFirst(&sigRefIndex, hash); e != NULL;
+						e = cacheIndexNext(e->next, hash)) {
+					cNode = (cacheSignatureReferenceObj *) e->obj;
+
+					if ((cNode->obj.db_ref_id == lookupNode.db_ref_id)
+							&& (cNode->obj.db_sig_id == lookupNode.db_sig_id)) {
+						break;
+					}
+				}
+
+				if (e == NULL) {
 					if ((newNode = SnortAlloc(
 							sizeof(cacheSignatureReferenceObj))) == NULL) {
 						/* XXX */
+						cacheIndexFree(&sigRefIndex);
 						return 1;
 					}
 
@@ -4162,6 +4684,7 @@ u_int32_t GenerateSigRef(cacheSignatureReferenceObj **iHead,
 
 					newNode->next = *iHead;
 					*iHead = newNode;
+					cacheIndexAdd(&sigRefIndex, hash, newNode);
 #if DEBUG
 					file_sigref_object_count++;
 #endif
@@ -4171,6 +4694,8 @@ u_int32_t GenerateSigRef(cacheSignatureReferenceObj **iHead,
 		sigHead = sigHead->next;
 	}
 
+	cacheIndexFree(&sigRefIndex);
+
 	return 0;
 }
 
@@ -4703,7 +5228,8 @@ cacheReferenceObj *cacheGetReferenceNodeUsingDBid(cacheSystemObj *iHead,
 /**
  *  Merge internal SignatureReference cache with database data, detect difference, tag known node for database update
  *
- * @note This function cost alot but its the price to pay to sync and make sure we respect the db constraint
+ * @note Database rows are indexed on (ref_seq, sig_id) to drop duplicates and on
+ *       (ref_id, sig_id) to match the cache against, so the merge is linear.
  *
  * @param iDBList
  * @param array_length
@@ -4719,17 +5245,19 @@ u_int32_t SignatureReferenceCacheUpdateDBid(dbSignatureReferenceObj *iDBList,
 		u_int32_t array_length, cacheSignatureReferenceObj **cacheHead,
 		cacheSignatureObj *sigCacheHead, cacheSystemObj *systemCacheHead) {
 
-	cacheSignatureReferenceObj *cCheck = NULL;
 	cacheSignatureReferenceObj *cacheLookup = NULL;
 	cacheSignatureReferenceObj *tempCache = NULL;
 	cacheSignatureReferenceObj *tNode = NULL;
 	cacheSignatureReferenceObj *rNode = NULL;
 	dbSignatureReferenceObj *cObj = NULL;
+	cacheIndexEntry *e = NULL;
+	cacheIndex seqIndex;
+	cacheIndex refIndex;
 
 	u_int32_t databasemaxSeq = 0;
-	u_int32_t sigRefFound = 0;
 	u_int32_t sigSeq = 0;
 	u_int32_t sigRefArr[MAX_REF_OBJ] = { 0 };
+	u_int32_t hash = 0;
 
 	int x = 0;
 
@@ -4739,63 +5267,73 @@ u_int32_t SignatureReferenceCacheUpdateDBid(dbSignatureReferenceObj *iDBList,
 		return 1;
 	}
 
-	if ((iDBList == NULL)) {
-		/* XXX */
-		/* No reference */
-		return 0;
-	}
+	cacheIndexInit(&seqIndex, array_length);
+	cacheIndexInit(&refIndex, array_length);
 
 	/* Build a temporary list from db records */
 	for (x = 0; x < array_length; x++) {
 		cObj = &iDBList[x];
+		hash = jhash_2words(cObj->ref_seq, cObj->db_sig_id, 0);
 
-		if (tempCache != NULL) {
-			if ((dbSignatureReferenceLookup(cObj, tempCache, &rNode, 0) == 0)) {
-				if ((tNode = SnortAlloc(sizeof(cacheSignatureReferenceObj)))
-						== NULL) {
-					/* XXX */
-					goto f_err;
-				}
-
-				memcpy(&tNode->obj, cObj, sizeof(dbSignatureReferenceObj));
-				//tNode->flag ^= CACHE_DATABASE_ONLY;
-				tNode->flag = CACHE_DATABASE;
+		for (e = cacheIndexFirst(&seqIndex, hash); e != NULL;
+				e = cacheIndexNext(e->next, hash)) {
+			rNode = (cacheSignatureReferenceObj *) e->obj;
 
-				tNode->next = tempCache;
-				tempCache = tNode;
-			} else {
-				LogMessage(
-						"Warning [%s()] : sig_id [%u] ref_id [%u] ref_seq [%u] Duplicate found in database with database constraint? Ignoring element in temporary cache \n",
-						cObj->db_sig_id, cObj->db_ref_id, cObj->ref_seq);
+			if ((rNode->obj.ref_seq == cObj->ref_seq)
+					&& (rNode->obj.db_sig_id == cObj->db_sig_id)) {
+				break;
 			}
-		} else {
-			if ((tNode = SnortAlloc(sizeof(cacheSignatureReferenceObj))) == NULL) {
-				/* XXX */
-				goto f_err;
-			}
-			memcpy(&tNode->obj, cObj, sizeof(dbSignatureReferenceObj));
-			//tNode->flag ^= CACHE_DATABASE_ONLY;
-			tNode->flag = CACHE_DATABASE;
+		}
 
-			tNode->next = tempCache;
-			tempCache = tNode;
+		if (e != NULL) {
+			LogMessage(
+					"Warning [%s()] : sig_id [%u] ref_id [%u] ref_seq [%u] Duplicate found in database with database constraint? Ignoring element in temporary cache \n",
+					__FUNCTION__, cObj->db_sig_id, cObj->db_ref_id,
+					cObj->ref_seq);
+			continue;
+		}
 
+		if ((tNode = SnortAlloc(sizeof(cacheSignatureReferenceObj))) == NULL) {
+			/* XXX */
+			goto f_err;
 		}
+
+		memcpy(&tNode->obj, cObj, sizeof(dbSignatureReferenceObj));
+		//tNode->flag ^= CACHE_DATABASE_ONLY;
+		tNode->flag = CACHE_DATABASE;
+
+		tNode->next = tempCache;
+		tempCache = tNode;
+
+		cacheIndexAdd(&seqIndex, hash, tNode);
+		cacheIndexAdd(&refIndex,
+				jhash_2words(tNode->obj.db_ref_id, tNode->obj.db_sig_id, 0),
+				tNode);
 	}
 
 	cacheLookup = *cacheHead;
 
 	while (cacheLookup != NULL) {
-		sigRefFound = 0;
-
 		if (sigSeq != cacheLookup->obj.db_sig_id) {
 			sigSeq = cacheLookup->obj.db_sig_id;
 			databasemaxSeq = 0;
-			memset(sigRefArr, '\0', MAX_REF_OBJ);
+			memset(sigRefArr, '\0', sizeof(sigRefArr));
+		}
+
+		hash = jhash_2words(cacheLookup->obj.db_ref_id,
+				cacheLookup->obj.db_sig_id, 0);
+
+		for (e = cacheIndexFirst(&refIndex, hash); e != NULL;
+				e = cacheIndexNext(e->next, hash)) {
+			rNode = (cacheSignatureReferenceObj *) e->obj;
+
+			if ((rNode->obj.db_ref_id == cacheLookup->obj.db_ref_id)
+					&& (rNode->obj.db_sig_id == cacheLookup->obj.db_sig_id)) {
+				break;
+			}
 		}
 
-		if (dbSignatureReferenceLookup(&cacheLookup->obj, tempCache, &rNode,
-				1)) {
+		if (e != NULL) {
 			if ((cacheLookup->obj.ref_seq != rNode->obj.ref_seq)) {
 				cacheLookup->obj.ref_seq = rNode->obj.ref_seq;
 
@@ -4814,65 +5352,35 @@ u_int32_t SignatureReferenceCacheUpdateDBid(dbSignatureReferenceObj *iDBList,
 				}
 			}
 			//cacheLookup->flag ^= (CACHE_BOTH | CACHE_INTERNAL_ONLY);
-			cacheLookup->flag |= CACHE_INTERNAL;
+			/* The row is already there, populate has nothing to insert for it */
+			cacheLookup->flag |= (CACHE_INTERNAL | CACHE_DATABASE);
 		} else {
-			/* Validate against value in database */
-			cCheck = tempCache;
-
-			while (cCheck != NULL) {
-				if ((cCheck->obj.db_sig_id == cacheLookup->obj.db_sig_id)
-						&& (cCheck->obj.db_ref_id == cacheLookup->obj.db_ref_id)) {
-
-					cacheLookup->obj.ref_seq = cCheck->obj.ref_seq;
+			if (sigRefArr[cacheLookup->obj.ref_seq]) {
+				cacheLookup->obj.ref_seq = (databasemaxSeq + 1);
 
-					if (cacheLookup->obj.ref_seq > MAX_REF_OBJ) {
-						FatalError(
-								"[%s()], can't process reference_sequence of [%d] for signature [%d] reference [%d] \n",
-								__FUNCTION__, cacheLookup->obj.ref_seq,
-								cacheLookup->obj.db_sig_id,
-								cacheLookup->obj.db_ref_id);
-					}
-
-					sigRefArr[cacheLookup->obj.ref_seq] = 1;
-					sigRefFound = 1;
-
-					if (databasemaxSeq < cacheLookup->obj.ref_seq) {
-						databasemaxSeq = cacheLookup->obj.ref_seq;
-						break;
-					}
+				if (cacheLookup->obj.ref_seq > MAX_REF_OBJ) {
+					FatalError(
+							"[%s()], can't process reference_sequence of [%d] for signature [%d] reference [%d] \n",
+							__FUNCTION__, cacheLookup->obj.ref_seq,
+							cacheLookup->obj.db_sig_id,
+							cacheLookup->obj.db_ref_id);
 				}
 
-				cCheck = cCheck->next;
-			}
-
-			if (!sigRefFound) {
-				if (sigRefArr[cacheLookup->obj.ref_seq]) {
-					cacheLookup->obj.ref_seq = (databasemaxSeq + 1);
+				databasemaxSeq = cacheLookup->obj.ref_seq;
+				sigRefArr[cacheLookup->obj.ref_seq] = 1;
+			} else {
+				if (cacheLookup->obj.ref_seq > MAX_REF_OBJ) {
+					FatalError(
+							"[%s()], can't process reference_sequence of [%d] for signature [%d] reference [%d] \n",
+							__FUNCTION__, cacheLookup->obj.ref_seq,
+							cacheLookup->obj.db_sig_id,
+							cacheLookup->obj.db_ref_id);
+				}
 
-					if (cacheLookup->obj.ref_seq > MAX_REF_OBJ) {
-						FatalError(
-								"[%s()], can't process reference_sequence of [%d] for signature [%d] reference [%d] \n",
-								__FUNCTION__, cacheLookup->obj.ref_seq,
-								cacheLookup->obj.db_sig_id,
-								cacheLookup->obj.db_ref_id);
-					}
+				sigRefArr[cacheLookup->obj.ref_seq] = 1;
 
+				if (databasemaxSeq < cacheLookup->obj.ref_seq) {
 					databasemaxSeq = cacheLookup->obj.ref_seq;
-					sigRefArr[cacheLookup->obj.ref_seq] = 1;
-				} else {
-					if (cacheLookup->obj.ref_seq > MAX_REF_OBJ) {
-						FatalError(
-								"[%s()], can't process reference_sequence of [%d] for signature [%d] reference [%d] \n",
-								__FUNCTION__, cacheLookup->obj.ref_seq,
-								cacheLookup->obj.db_sig_id,
-								cacheLookup->obj.db_ref_id);
-					}
-
-					sigRefArr[cacheLookup->obj.ref_seq] = 1;
-
-					if (databasemaxSeq < cacheLookup->obj.ref_seq) {
-						databasemaxSeq = cacheLookup->obj.ref_seq;
-					}
 				}
 			}
 		}
@@ -4880,6 +5388,9 @@ u_int32_t SignatureReferenceCacheUpdateDBid(dbSignatureReferenceObj *iDBList,
 		cacheLookup = cacheLookup->next;
 	}
 
+	cacheIndexFree(&seqIndex);
+	cacheIndexFree(&refIndex);
+
 	while (tempCache != NULL) {
 		tNode = tempCache->next;
 		free(tempCache);
@@ -4887,7 +5398,10 @@ u_int32_t SignatureReferenceCacheUpdateDBid(dbSignatureReferenceObj *iDBList,
 	}
 	return 0;
 
-	f_err: while (tempCache != NULL) {
+	f_err: cacheIndexFree(&seqIndex);
+	cacheIndexFree(&refIndex);
+
+	while (tempCache != NULL) {
 		tNode = tempCache->next;
 		free(tempCache);
 		tempCache = tNode;
@@ -4900,7 +5414,8 @@ u_int32_t SignatureReferenceCacheUpdateDBid(dbSignatureReferenceObj *iDBList,
 /** 
  *  Populate the sig_reference table with record that are not present in the database.
  * 
- * @note  Transaction isolation is done at row level to prevent possible race condition with an other starting process
+ * @note  Rows go out in multi-row INSERT IGNORE statements, a row another
+ *        starting process inserted first is left as it is.
  * @param data
  * @param cacheHead 
  * 
@@ -4910,7 +5425,9 @@ u_int32_t SignatureReferenceCacheUpdateDBid(dbSignatureReferenceObj *iDBList,
  */
 u_int32_t SignatureReferencePopulateDatabase(DatabaseData *data,
 		cacheSignatureReferenceObj *cacheHead) {
-	u_int32_t row_validate = 0;
+	cacheSignatureReferenceObj *cNode = NULL;
+	char row[SQL_BULK_ROW_LEN];
+	u_int32_t len = 0;
 
 	if ((data == NULL)) {
 		return 1;
@@ -4936,67 +5453,33 @@ u_int32_t SignatureReferencePopulateDatabase(DatabaseData *data,
 	    return 1;
 	}
 
-	while (cacheHead != NULL) {
-		if ( !(cacheHead->flag & CACHE_DATABASE) ) {
-			row_validate = 0;
+	for (cNode = cacheHead; cNode != NULL; cNode = cNode->next) {
+		if (cNode->flag & CACHE_DATABASE) {
+			continue;
+		}
+
 #if DEBUG
-			inserted_sigref_object_count++;
+		inserted_sigref_object_count++;
 #endif
 
-			DatabaseCleanInsert(data, SPO_DB_DEF_INS);
-			if ((SnortSnprintf(data->SQL_INSERT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
-			SQL_INSERT_SIGREF, cacheHead->obj.db_ref_id,
-					cacheHead->obj.db_sig_id, cacheHead->obj.ref_seq))
-					!= SNORT_SNPRINTF_SUCCESS) {
-				goto TransactionFail;
-				//goto f_exit;
-			}
-
-			DatabaseCleanSelect(data, SPO_DB_DEF_INS);
-			if ((SnortSnprintf(data->SQL_SELECT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
-			SQL_SELECT_SPECIFIC_SIGREF, cacheHead->obj.db_ref_id,
-					cacheHead->obj.db_sig_id, cacheHead->obj.ref_seq))
-					!= SNORT_SNPRINTF_SUCCESS) {
-				goto TransactionFail;
-				//goto f_exit;
-			}
-
-			/* Prevent race.. */
-			usleep(100);
-
-			if (Select(data->SQL_SELECT[SPO_DB_DEF_INS], data, &row_validate, SPO_DB_DEF_INS)) {
-				/* Entry was not found */
-				if (row_validate == 0) {
-					//BeginTransaction(data);
-
-					if (Insert(data->SQL_INSERT[SPO_DB_DEF_INS], data, 1, SPO_DB_DEF_INS)) {
-						goto TransactionFail;
-					}
-
-					row_validate = 0;
-
-					if (Select(data->SQL_SELECT[SPO_DB_DEF_INS], data, &row_validate, SPO_DB_DEF_INS)) {
-						goto TransactionFail;
-					}
+		if ((SnortSnprintf(row, sizeof(row), SQL_INSERT_SIGREF_ROW,
+				cNode->obj.db_ref_id, cNode->obj.db_sig_id,
+				cNode->obj.ref_seq)) != SNORT_SNPRINTF_SUCCESS) {
+			goto TransactionFail;
+		}
 
-					if (row_validate != cacheHead->obj.db_ref_id) {
-						LogMessage(
-								"[%s()]: Couldn't validate insertion of values inserted INSERTED[%u], RECEIVED[%u] this is inconsistance and we quit.\n",
-								__FUNCTION__, cacheHead->obj.db_ref_id,
-								row_validate);
+		if (BulkInsertRow(data, &len, SQL_INSERT_SIGREF_BULK, row, NULL,
+				SPO_DB_DEF_INS)) {
+			goto TransactionFail;
+		}
+	}
 
-						goto TransactionFail;
-					}
-					//CommitTransaction(data);
-				}
-			}
+	if (BulkInsertFlush(data, &len, NULL, SPO_DB_DEF_INS)) {
+		goto TransactionFail;
+	}
 
-			/*if (cacheHead->flag & CACHE_INTERNAL_ONLY) {
-				cacheHead->flag ^= (CACHE_INTERNAL_ONLY | CACHE_BOTH);
-			}*/
-			cacheHead->flag |= CACHE_DATABASE;
-		}
-		cacheHead = cacheHead->next;
+	for (cNode = cacheHead; cNode != NULL; cNode = cNode->next) {
+		cNode->flag |= CACHE_DATABASE;
 	}
 
 	if (CommitTransaction(data, SPO_DB_DEF_INS)) {
@@ -5007,7 +5490,6 @@ u_int32_t SignatureReferencePopulateDatabase(DatabaseData *data,
 
 TransactionFail:
     RollbackTransaction(data, SPO_DB_DEF_INS);
-/*f_exit:*/
     return 1;
 }
 
@@ -5230,11 +5712,409 @@ void MasterCacheFlush(DatabaseData *data, u_int32_t flushFlag) {
 		data->mc.cacheSystemHead = NULL;
 	}
 
+	if (flushFlag & CACHE_FLUSH_SYSTEM_REF) {
+		cacheIndexFree(&data->mc.cacheRefIndex);
+	}
+
 	return;
 
 }
 
 #ifdef ENABLE_MYSQL
+/***********************************************************************************************SNAPSHOT API*/
+/*
+ ** A restart with the same rule set and an untouched signature table loads
+ ** the synchronized classification and signature caches from a local file
+ ** instead of pulling and reconciling them with the database again.
+ */
+#define CACHE_SNAPSHOT_MAGIC "SQCACHE"
+#define CACHE_SNAPSHOT_VERSION 1
+
+typedef struct _cacheSnapshotHeader {
+	char magic[8];
+	u_int32_t version;
+	u_int32_t max_sig_id;
+	u_int64_t fingerprint;
+	u_int32_t class_count;
+	u_int32_t sig_count;
+} cacheSnapshotHeader;
+
+typedef struct _cacheSnapshotClassification {
+	dbClassificationObj obj;
+	u_int32_t flag;
+} cacheSnapshotClassification;
+
+typedef struct _cacheSnapshotSignature {
+	u_int32_t db_id;
+	u_int32_t sid;
+	u_int32_t gid;
+	u_int32_t rev;
+	u_int32_t class_id;
+	u_int32_t priority_id;
+	u_int32_t flag;
+	char message[SIG_MSG_LEN];
+} cacheSnapshotSignature;
+
+static u_int64_t fnv1a(u_int64_t h, const void *buf, size_t len) {
+	const u_int8_t *p = buf;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static u_int64_t fnv1aString(u_int64_t h, const char *str) {
+	if (str == NULL) {
+		return fnv1a(h, "", 1);
+	}
+
+	return fnv1a(h, str, strlen(str) + 1);
+}
+
+static u_int64_t fnv1aInt(u_int64_t h, u_int32_t val) {
+	return fnv1a(h, &val, sizeof(val));
+}
+
+/**
+ * Fingerprint of what the synchronization works from: the database it talks
+ * to and the classification, signature and reference caches built from the
+ * map files.  Must be called before anything is synchronized.
+ *
+ * @param data
+ *
+ * @return fingerprint
+ */
+u_int64_t CacheFingerprint(DatabaseData *data) {
+	cacheClassificationObj *cClass = NULL;
+	cacheSignatureObj *cSig = NULL;
+	cacheReferenceObj *cRef = NULL;
+	u_int64_t h = 0xcbf29ce484222325ULL;
+	u_int32_t x = 0;
+
+	if (data == NULL) {
+		/* XXX */
+		return 0;
+	}
+
+	h = fnv1aInt(h, CACHE_SNAPSHOT_VERSION);
+	h = fnv1aInt(h, data->dbtype_id);
+	h = fnv1aString(h, data->host);
+	h = fnv1aString(h, data->port);
+	h = fnv1aString(h, data->dbname);
+	h = fnv1aInt(h, data->DBschema_version);
+	h = fnv1aInt(h, data->dbRH[data->dbtype_id].disablesigref);
+
+	for (cClass = data->mc.cacheClassificationHead; cClass != NULL;
+			cClass = cClass->next) {
+		h = fnv1aInt(h, cClass->obj.sig_class_id);
+		h = fnv1aString(h, cClass->obj.sig_class_name);
+	}
+
+	for (cSig = data->mc.cacheSignatureHead; cSig != NULL; cSig = cSig->next) {
+		h = fnv1aInt(h, cSig->obj.gid);
+		h = fnv1aInt(h, cSig->obj.sid);
+		h = fnv1aInt(h, cSig->obj.rev);
+		h = fnv1aInt(h, cSig->obj.class_id);
+		h = fnv1aInt(h, cSig->obj.priority_id);
+		h = fnv1aString(h, cSig->obj.message);
+		h = fnv1aInt(h, cSig->obj.ref_count);
+
+		for (x = 0; (x < cSig->obj.ref_count) && (x < MAX_REF_OBJ); x++) {
+			if ((cRef = cSig->obj.ref[x]) == NULL) {
+				continue;
+			}
+
+			if (cRef->obj.parent != NULL) {
+				h = fnv1aString(h, cRef->obj.parent->obj.ref_system_name);
+				h = fnv1aString(h, cRef->obj.parent->obj.ref_system_url);
+			}
+			h = fnv1aString(h, cRef->obj.ref_tag);
+		}
+	}
+
+	return h;
+}
+
+/**
+ * Snapshot path, <log_dir>/squirrel.cache.<host>.<dbname> unless the
+ * cache_snapshot option gives one.
+ *
+ * @return
+ * 0 OK
+ * 1 disabled or does not fit
+ */
+static u_int32_t CacheSnapshotPath(DatabaseData *data, char *path, size_t len) {
+	if (data->cache_snapshot != NULL) {
+		if (!strcasecmp(data->cache_snapshot, KEYWORD_CACHE_SNAPSHOT_NONE)) {
+			return 1;
+		}
+
+		return (SnortSnprintf(path, len, "%s", data->cache_snapshot)
+				!= SNORT_SNPRINTF_SUCCESS);
+	}
+
+	return (SnortSnprintf(path, len, "%s/squirrel.cache.%s.%s",
+			(barnyard2_conf->log_dir != NULL) ? barnyard2_conf->log_dir : ".",
+			(data->host != NULL) ? data->host : "localhost",
+			(data->dbname != NULL) ? data->dbname : "none")
+			!= SNORT_SNPRINTF_SUCCESS);
+}
+
+/* Highest signature id, any insert since the snapshot was saved moves it */
+static u_int32_t CacheSnapshotMaxSigId(DatabaseData *data, u_int32_t *max_sig_id) {
+	DatabaseCleanSelect(data, SPO_DB_DEF_INS);
+
+	if ((SnortSnprintf(data->SQL_SELECT[SPO_DB_DEF_INS], MAX_QUERY_LENGTH,
+	SQL_SELECT_MAX_SIGNATURE_ID)) != SNORT_SNPRINTF_SUCCESS) {
+		/* XXX */
+		return 1;
+	}
+
+	*max_sig_id = 0;
+
+	return Select(data->SQL_SELECT[SPO_DB_DEF_INS], data, max_sig_id,
+			SPO_DB_DEF_INS);
+}
+
+/**
+ * Replace the classification and signature caches with the snapshot, if it
+ * was saved for the same fingerprint against the same signature table.
+ *
+ * @note Everything is read and checked before the caches are touched.
+ *
+ * @param data
+ * @param fingerprint
+ *
+ * @return
+ * 0 LOADED
+ * 1 NOT LOADED (full synchronization needed)
+ */
+u_int32_t CacheSnapshotLoad(DatabaseData *data, u_int64_t fingerprint) {
+	cacheSnapshotHeader header;
+	cacheSnapshotClassification *classArray = NULL;
+	cacheSnapshotSignature *sigArray = NULL;
+	cacheClassificationObj *cClass = NULL;
+	cacheSignatureObj *cSig = NULL;
+	dbSignatureObj sigObj;
+	char path[PATH_MAX];
+	FILE *fp = NULL;
+	u_int32_t max_sig_id = 0;
+	u_int32_t x = 0;
+
+	if ((data == NULL) || (CacheSnapshotPath(data, path, sizeof(path)))) {
+		return 1;
+	}
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		return 1;
+	}
+
+	if ((fread(&header, sizeof(header), 1, fp) != 1)
+			|| (memcmp(header.magic, CACHE_SNAPSHOT_MAGIC,
+					sizeof(CACHE_SNAPSHOT_MAGIC)) != 0)
+			|| (header.version != CACHE_SNAPSHOT_VERSION)
+			|| (header.fingerprint != fingerprint)) {
+		LogMessage("database: cache snapshot [%s] does not match, synchronizing\n",
+				path);
+		goto f_err;
+	}
+
+	if ((CacheSnapshotMaxSigId(data, &max_sig_id))
+			|| (max_sig_id != header.max_sig_id)) {
+		LogMessage("database: signature table changed since cache snapshot [%s], synchronizing\n",
+				path);
+		goto f_err;
+	}
+
+	classArray = SnortAlloc(
+			sizeof(cacheSnapshotClassification) * (header.class_count + 1));
+	sigArray = SnortAlloc(sizeof(cacheSnapshotSignature) * (header.sig_count + 1));
+
+	if ((fread(classArray, sizeof(cacheSnapshotClassification),
+			header.class_count, fp) != header.class_count)
+			|| (fread(sigArray, sizeof(cacheSnapshotSignature), header.sig_count,
+					fp) != header.sig_count) || (fgetc(fp) != EOF)) {
+		LogMessage("database: cache snapshot [%s] is truncated, synchronizing\n",
+				path);
+		goto f_err;
+	}
+
+	fclose(fp);
+	fp = NULL;
+
+	MasterCacheFlush(data, CACHE_FLUSH_ALL);
+
+	/* Saved in list order, prepend from the end to get the same lists back */
+	for (x = header.class_count; x > 0; x--) {
+		cClass = SnortAlloc(sizeof(cacheClassificationObj));
+		memcpy(&cClass->obj, &classArray[x - 1].obj, sizeof(dbClassificationObj));
+		cClass->obj.sig_class_name[CLASS_NAME_LEN - 1] = '\0';
+		cClass->flag = classArray[x - 1].flag;
+
+		cClass->next = data->mc.cacheClassificationHead;
+		data->mc.cacheClassificationHead = cClass;
+	}
+
+	for (x = header.sig_count; x > 0; x--) {
+		memset(&sigObj, '\0', sizeof(dbSignatureObj));
+		sigObj.db_id = sigArray[x - 1].db_id;
+		sigObj.sid = sigArray[x - 1].sid;
+		sigObj.gid = sigArray[x - 1].gid;
+		sigObj.rev = sigArray[x - 1].rev;
+		sigObj.class_id = sigArray[x - 1].class_id;
+		sigObj.priority_id = sigArray[x - 1].priority_id;
+		memcpy(sigObj.message, sigArray[x - 1].message, SIG_MSG_LEN);
+		sigObj.message[SIG_MSG_LEN - 1] = '\0';
+
+		if ((cSig = SignatureCacheInsertObj(&sigObj, &data->mc, 0,
+				cacheSignatureHashIndex(sigObj.gid, sigObj.sid))) == NULL) {
+			FatalError("database [%s()]: unable to rebuild the signature cache\n",
+					__FUNCTION__);
+		}
+		cSig->flag = sigArray[x - 1].flag;
+	}
+
+	free(classArray);
+	free(sigArray);
+
+	LogMessage("database: loaded %u classifications and %u signatures from cache snapshot [%s]\n",
+			header.class_count, header.sig_count, path);
+
+	return 0;
+
+f_err:
+	if (fp != NULL) {
+		fclose(fp);
+	}
+
+	if (classArray != NULL) {
+		free(classArray);
+	}
+
+	if (sigArray != NULL) {
+		free(sigArray);
+	}
+
+	return 1;
+}
+
+/**
+ * Save the synchronized classification and signature caches, written to a
+ * temporary file then renamed over the snapshot.
+ *
+ * @param data
+ * @param fingerprint
+ *
+ * @return
+ * 0 OK
+ * 1 ERROR
+ */
+u_int32_t CacheSnapshotSave(DatabaseData *data, u_int64_t fingerprint) {
+	cacheSnapshotHeader header;
+	cacheSnapshotClassification classRec;
+	cacheSnapshotSignature sigRec;
+	cacheClassificationObj *cClass = NULL;
+	cacheSignatureObj *cSig = NULL;
+	char path[PATH_MAX];
+	char tmp[PATH_MAX];
+	FILE *fp = NULL;
+
+	if ((data == NULL) || (CacheSnapshotPath(data, path, sizeof(path)))) {
+		return 0;
+	}
+
+	if (SnortSnprintf(tmp, sizeof(tmp), "%s.tmp", path) != SNORT_SNPRINTF_SUCCESS) {
+		/* XXX */
+		return 1;
+	}
+
+	memset(&header, '\0', sizeof(header));
+	memcpy(header.magic, CACHE_SNAPSHOT_MAGIC, sizeof(CACHE_SNAPSHOT_MAGIC));
+	header.version = CACHE_SNAPSHOT_VERSION;
+	header.fingerprint = fingerprint;
+
+	if (CacheSnapshotMaxSigId(data, &header.max_sig_id)) {
+		/* XXX */
+		return 1;
+	}
+
+	for (cClass = data->mc.cacheClassificationHead; cClass != NULL;
+			cClass = cClass->next) {
+		header.class_count++;
+	}
+
+	for (cSig = data->mc.cacheSignatureHead; cSig != NULL; cSig = cSig->next) {
+		header.sig_count++;
+	}
+
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		LogMessage("database: unable to write cache snapshot [%s]: %s\n", tmp,
+				strerror(errno));
+		return 1;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+		goto f_err;
+	}
+
+	for (cClass = data->mc.cacheClassificationHead; cClass != NULL;
+			cClass = cClass->next) {
+		memset(&classRec, '\0', sizeof(classRec));
+		memcpy(&classRec.obj, &cClass->obj, sizeof(dbClassificationObj));
+		classRec.flag = cClass->flag;
+
+		if (fwrite(&classRec, sizeof(classRec), 1, fp) != 1) {
+			goto f_err;
+		}
+	}
+
+	for (cSig = data->mc.cacheSignatureHead; cSig != NULL; cSig = cSig->next) {
+		memset(&sigRec, '\0', sizeof(sigRec));
+		sigRec.db_id = cSig->obj.db_id;
+		sigRec.sid = cSig->obj.sid;
+		sigRec.gid = cSig->obj.gid;
+		sigRec.rev = cSig->obj.rev;
+		sigRec.class_id = cSig->obj.class_id;
+		sigRec.priority_id = cSig->obj.priority_id;
+		sigRec.flag = cSig->flag;
+		memcpy(sigRec.message, cSig->obj.message, SIG_MSG_LEN);
+
+		if (fwrite(&sigRec, sizeof(sigRec), 1, fp) != 1) {
+			goto f_err;
+		}
+	}
+
+	if (fclose(fp) != 0) {
+		fp = NULL;
+		goto f_err;
+	}
+	fp = NULL;
+
+	if (rename(tmp, path) != 0) {
+		goto f_err;
+	}
+
+	LogMessage("database: saved %u classifications and %u signatures to cache snapshot [%s]\n",
+			header.class_count, header.sig_count, path);
+
+	return 0;
+
+f_err:
+	LogMessage("database: unable to write cache snapshot [%s]: %s\n", tmp,
+			strerror(errno));
+
+	if (fp != NULL) {
+		fclose(fp);
+	}
+
+	unlink(tmp);
+	return 1;
+}
+/***********************************************************************************************SNAPSHOT API*/
+
 /** 
  * Synchronize caches (internal from files and cache from database
  * 
@@ -5245,11 +6125,20 @@ void MasterCacheFlush(DatabaseData *data, u_int32_t flushFlag) {
  * 1 ERROR
  */
 u_int32_t CacheSynchronize(DatabaseData *data) {
+	u_int64_t fingerprint = 0;
+
 	if (data == NULL) {
 		/* XXX */
 		return 1;
 	}
 
+	/* Taken before synchronization changes the caches it covers */
+	fingerprint = CacheFingerprint(data);
+
+	if (CacheSnapshotLoad(data, fingerprint) == 0) {
+		return 0;
+	}
+
 	//Classification Synchronize
 	if ((ClassificationCacheSynchronize(data, &data->mc.cacheClassificationHead))) {
 		/* XXX */
@@ -5341,6 +6230,9 @@ u_int32_t CacheSynchronize(DatabaseData *data) {
 
 	LogMessage("%s: MasterCacheFlush\n", __func__);
 
+	/* A snapshot that could not be written only costs the next start a full synchronization */
+	CacheSnapshotSave(data, fingerprint);
+
 	return 0;
 }
 #endif
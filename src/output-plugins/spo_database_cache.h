@@ -149,6 +149,19 @@
 #define SQL_SELECT_ALL_REF "SELECT ref_id, ref_system_id, ref_tag FROM reference; "
 #define SQL_SELECT_ALL_CLASSIFICATION "SELECT sig_class_id, sig_class_name FROM sig_class ORDER BY sig_class_id ASC; "
 #define SQL_SELECT_ALL_SIGNATURE "SELECT sig_id, sig_sid, sig_gid,sig_rev, sig_class_id, sig_priority, sig_name FROM signature;"
+#define SQL_SELECT_SIGNATURE_FROM "SELECT sig_id, sig_sid, sig_gid,sig_rev, sig_class_id, sig_priority, sig_name FROM signature WHERE sig_id >= '%u';"
+#define SQL_SELECT_REF_FROM "SELECT ref_id, ref_system_id, ref_tag FROM reference WHERE ref_id >= '%u'; "
+#define SQL_SELECT_MAX_SIGNATURE_ID "SELECT MAX(sig_id) FROM signature;"
+
+/* Multi-row inserts: the statement, then one row per object joined by ',' */
+#define SQL_INSERT_SIGNATURE_BULK "INSERT INTO signature (sig_sid, sig_gid, sig_rev, sig_class_id, sig_priority, sig_name) VALUES "
+#define SQL_INSERT_SIGNATURE_ROW "('%u','%u','%u','%u','%u','%s')"
+#define SQL_INSERT_REF_BULK "INSERT INTO reference (ref_system_id,ref_tag) VALUES "
+#define SQL_INSERT_REF_ROW "('%u','%s')"
+#define SQL_INSERT_SIGREF_BULK "INSERT IGNORE INTO sig_reference (ref_id,sig_id,ref_seq) VALUES "
+#define SQL_INSERT_SIGREF_ROW "('%u','%u','%u')"
+#define SQL_BULK_ROW_LEN 1024
+
 #define SQL_UPDATE_SPECIFIC_SIGNATURE "UPDATE signature SET "		\
     "sig_class_id = '%u',"						\
     "sig_priority = '%u',"						\
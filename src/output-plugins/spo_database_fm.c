@@ -673,5 +673,69 @@ uint8_t dbEventInfoFm_rawdata(DatabaseData *data,
     return 1;
 }
 
+uint8_t dbEventInfoFm_extra(char *buf, int slen)
+{
+    if ( SnortSnprintf(buf, slen,
+            "INSERT INTO "
+            "extra (sid,bid,cid,type,datatype,len,data) VALUES ") != SNORT_SNPRINTF_SUCCESS ) {
+        LogMessage("%s: Failed\n", __func__);
+        return 0;
+    }
+
+    return 1;
+}
+
+uint8_t dbEventInfoFm_extradata(DatabaseData *data,
+        SQLQueryEle *squery,
+        int slen,
+        int sid,
+        SQLExtra *ext,
+        char sl_separator,
+        uint8_t q_ins)
+{
+    char sl_buf[256];
+    char addr[INET6_ADDRSTRLEN];
+    unsigned long esc_len;
+    size_t hlen;
+
+    /* escaping may double the data */
+    if ((uint64_t)ext->attr.len * 2 + 1 > sizeof(data->sanitize_buffer[q_ins]))
+        return 0;
 
+    /* addresses as text, everything else escaped straight from the ring */
+    switch (ext->attr.type) {
+    case EVENT_INFO_XFF_IPV4:
+    case EVENT_INFO_XFF_IPV6:
+    case EVENT_INFO_IPV6_SRC:
+    case EVENT_INFO_IPV6_DST:
+        esc_len = dbProcessEscapeRaw(data, addr,
+                EventAttrPrint(&ext->attr, addr, sizeof(addr)), q_ins);
+        break;
+    default:
+        esc_len = dbProcessEscapeRaw(data, (void *)ext->attr.data, ext->attr.len, q_ins);
+        break;
+    }
 
+    if ((SnortSnprintf(sl_buf, sizeof(sl_buf),
+            "%c(%u,%u,%lu,%u,%u,%u,'", sl_separator,
+            sid, ext->rid, ext->event_id, ext->attr.type, EVENT_DATA_TYPE_BLOB,
+            ext->attr.len))
+            != SNORT_SNPRINTF_SUCCESS) {
+        LogMessage("%s: SnortSnprintf Failed\n", __func__);
+        return 0;
+    }
+
+    /* the row, its "')" and room to close the query with ";" */
+    hlen = strlen(sl_buf);
+    if (squery->slen + hlen + esc_len + 2 + 2 > (size_t)slen)
+        return 0;
+
+    memcpy(squery->string + squery->slen, sl_buf, hlen);
+    squery->slen += hlen;
+    memcpy(squery->string + squery->slen, data->sanitize_buffer[q_ins], esc_len);
+    squery->slen += esc_len;
+    memcpy(squery->string + squery->slen, "')", 3);
+    squery->slen += 2;
+
+    return 1;
+}
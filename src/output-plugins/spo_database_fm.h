@@ -26,5 +26,7 @@ uint8_t dbEventInfoFm_payload(char *buf, int slen);
 uint8_t dbEventInfoFm_payloaddata(DatabaseData*, char*, int, int, uint8_t, us_cid_t, Packet*, char, uint8_t);
 uint8_t dbEventInfoFm_raw(char *buf, int slen);
 uint8_t dbEventInfoFm_rawdata(DatabaseData*, char*, int, int, uint8_t, us_cid_t, SQLPkt*, char, uint8_t);
+uint8_t dbEventInfoFm_extra(char *buf, int slen);
+uint8_t dbEventInfoFm_extradata(DatabaseData*, SQLQueryEle*, int, int, SQLExtra*, char, uint8_t);
 
 #endif	/* __SPO_DATABASE_FM_H__ */
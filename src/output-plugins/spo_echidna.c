@@ -41,6 +41,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
 #include <libwebsockets.h>
 #include <curl/curl.h>
 #include <json/json.h>
@@ -56,8 +59,51 @@
 #include "strlcpyu.h"
 #include "unified2.h"
 #include "util.h"
+#include "sf_json.h"
 
 
+/* a batch of serialized events making up one request body */
+typedef struct _EchidnaBatch
+{
+    struct _EchidnaBatch *next;
+
+    char *body;
+    size_t len;
+    size_t size;
+
+    u_int32_t events;
+    u_int32_t tries;
+    struct timeval ready;       /* first event appended / next retry due */
+} EchidnaBatch;
+
+typedef struct _EchidnaSubmitter
+{
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t space;       /* signalled whenever queued bytes drop */
+
+    EchidnaBatch *fill;         /* batch being appended to */
+    EchidnaBatch *head;         /* batches ready to be sent */
+    EchidnaBatch *tail;
+    EchidnaBatch *retry_head;   /* failed batches, in order of retry time */
+    EchidnaBatch *retry_tail;
+
+    size_t queued_bytes;        /* bodies held anywhere in the submitter */
+
+    CURLM *multi;
+    CURL **easy;
+    EchidnaBatch **inflight;
+    struct curl_slist *headers;
+
+    int running;
+    int stop;
+
+    u_int64_t events_sent;
+    u_int64_t batches_sent;
+    u_int64_t batches_retried;
+    u_int64_t events_dropped;
+} EchidnaSubmitter;
+
 typedef struct _SpoEchidnaData
 {
     char *agent_name;
@@ -73,9 +119,17 @@ typedef struct _SpoEchidnaData
 
     int use_ssl;
 
+    /* batching */
+    u_int32_t batch_events;
+    u_int32_t batch_ms;
+    u_int32_t streams;
+    size_t max_queue;
+    int format;
 
+    /* event serializer, only used by the output thread */
+    JsonWriter *json;
 
-    CURL *curl;
+    EchidnaSubmitter sub;
 } SpoEchidnaData;
 
 static int session_state = 0;
@@ -96,9 +150,27 @@ enum echidna_protocols {
 #define KEYWORD_NODEPORT      "port"
 #define KEYWORD_NODENAME      "name"
 #define KEYWORD_USESSL        "ssl"
+#define KEYWORD_BATCH         "batch"
+#define KEYWORD_FLUSH         "flush"
+#define KEYWORD_STREAMS       "streams"
+#define KEYWORD_QUEUE         "queue"
+#define KEYWORD_FORMAT        "format"
 
 #define DEFAULT_NODEADDRESS   "127.0.0.1"
 #define DEFAULT_NODEPORT      6968
+#define DEFAULT_BATCH         100
+#define DEFAULT_FLUSH_MS      500
+#define DEFAULT_STREAMS       4
+#define DEFAULT_QUEUE         (16 * 1024 * 1024)
+
+#define MAX_STREAMS           32
+#define MAX_RETRY_SECS        15
+#define DRAIN_SECS            5
+#define CONNECT_SECS          5
+#define REQUEST_SECS          30
+
+#define FORMAT_NDJSON         0
+#define FORMAT_ARRAY          1
 
 #define MAX_MSG_LEN       2048
 #define TMP_BUFFER        128
@@ -119,14 +191,18 @@ void Echidna(Packet *, void *, u_int32_t, void *);
 
 int EchidnaNodeConnect(SpoEchidnaData *);
 
-char *EchidnaTimestamp(u_int32_t, u_int32_t);
+void EchidnaTimestamp(u_int32_t, u_int32_t, char *, size_t);
 
-int EchidnaEventIPHeaderDataAppend(json_object *, Packet *);
-int EchidnaEventICMPDataAppend(json_object *, Packet *);
-int EchidnaEventTCPDataAppend(json_object *, Packet *);
-int EchidnaEventUDPDataAppend(json_object *, Packet *);
+int EchidnaEventIPHeaderDataAppend(JsonWriter *, Packet *);
+int EchidnaEventICMPDataAppend(JsonWriter *, Packet *);
+int EchidnaEventTCPDataAppend(JsonWriter *, Packet *);
+int EchidnaEventUDPDataAppend(JsonWriter *, Packet *);
 
-void EchidnaEventSubmit(SpoEchidnaData *, json_object *);
+void EchidnaEventSubmit(SpoEchidnaData *, const char *, size_t);
+
+void EchidnaSubmitterStart(SpoEchidnaData *);
+void EchidnaSubmitterStop(SpoEchidnaData *);
+static void *EchidnaSubmitter_T(void *);
 
 
 
@@ -383,6 +459,10 @@ void EchidnaInitFinalize(int unused, void *arg)
     /* in windows, this will init the winsock stuff */
     curl_global_init(CURL_GLOBAL_ALL);
 
+    /* hand events over to the background submitter */
+    spd_data->json = JsonWriter_Init(MAX_MSG_LEN);
+    EchidnaSubmitterStart(spd_data);
+
     /* set the preprocessor function into the function list */
     AddFuncToOutputList(Echidna, OUTPUT_TYPE__ALERT, spd_data);
     AddFuncToCleanExitList(EchidnaCleanExitFunc, spd_data);
@@ -391,11 +471,9 @@ void EchidnaInitFinalize(int unused, void *arg)
 
 void Echidna(Packet *p, void *event, u_int32_t event_type, void *arg)
 {
-    json_object *json;
-
-    char *timestamp;
+    JsonWriter *json;
 
-    char *data_msg;
+    char timestamp[TMP_BUFFER];
 
     char id_hash_text[512] = {0};
     char evt_corr_id_hash_text[512] = {0};
@@ -405,21 +483,15 @@ void Echidna(Packet *p, void *event, u_int32_t event_type, void *arg)
     uint8_t evt_corr_id_hash[SHA256_DIGEST_LENGTH];
     uint8_t ssn_corr_id_hash[SHA256_DIGEST_LENGTH];
 
-    char id_hash_hex[64];
-    char evt_corr_id_hash_hex[64];
-    char ssn_corr_id_hash_hex[64];
+    char sip[INET6_ADDRSTRLEN];
+    char dip[INET6_ADDRSTRLEN];
+    uint16_t sport = 0;
+    uint16_t dport = 0;
+    uint8_t protocol = 0;
+    int version = 0;
 
     SHA256_CTX ctx;
 
-    char sip4[INET_ADDRSTRLEN];
-    char dip4[INET_ADDRSTRLEN];
-    char sip6[INET6_ADDRSTRLEN];
-    char dip6[INET6_ADDRSTRLEN];
-    uint16_t sport;
-    uint16_t dport;
-
-    int i;
-
     SpoEchidnaData *data;
     SigNode *sn = NULL;
     ClassType *cn = NULL;
@@ -428,10 +500,12 @@ void Echidna(Packet *p, void *event, u_int32_t event_type, void *arg)
         return;
 
     data = (SpoEchidnaData *)arg;
+    json = data->json;
 
-    timestamp = EchidnaTimestamp(
+    EchidnaTimestamp(
         ntohl(((Unified2EventCommon *)event)->event_second),
-        ntohl(((Unified2EventCommon *)event)->event_microsecond)
+        ntohl(((Unified2EventCommon *)event)->event_microsecond),
+        timestamp, sizeof(timestamp)
     );
 
     /* grab the appropriate signature and classification information */
@@ -442,69 +516,67 @@ void Echidna(Packet *p, void *event, u_int32_t event_type, void *arg)
             );
     cn = ClassTypeLookupById(barnyard2_conf, ntohl(((Unified2EventCommon *)event)->classification_id));
 
-    /* initialise our json object */
-    json = json_object_new_object();
-
-
-    json_object_object_add(json, "node_id", json_object_new_string(node_id));
-
-    /* not yet classified */
-    json_object_object_add(json, "classification", json_object_new_int(0));
-
-    json_object_object_add(json, "meta_u2_event_id", json_object_new_int( ntohl(((Unified2EventCommon *)event)->event_id) ));
-
     /* IP version, addresses, ports and protocol */
     switch( event_type )
     {
         case UNIFIED2_IDS_EVENT:
         case UNIFIED2_IDS_EVENT_MPLS:
         case UNIFIED2_IDS_EVENT_VLAN:
-            inet_ntop(AF_INET, &((Unified2IDSEvent*)event)->ip_source, sip4, INET_ADDRSTRLEN);
-            inet_ntop(AF_INET, &((Unified2IDSEvent*)event)->ip_destination, dip4, INET_ADDRSTRLEN);
+            inet_ntop(AF_INET, &((Unified2IDSEvent*)event)->ip_source, sip, INET6_ADDRSTRLEN);
+            inet_ntop(AF_INET, &((Unified2IDSEvent*)event)->ip_destination, dip, INET6_ADDRSTRLEN);
             sport = ntohs(((Unified2IDSEvent *)event)->sport_itype);
             dport = ntohs(((Unified2IDSEvent *)event)->dport_icode);
-
-            json_object_object_add(json, "net_version", json_object_new_int( 4 ));
-            json_object_object_add(json, "net_src_ip", json_object_new_string( sip4 ));
-            json_object_object_add(json, "net_src_port", json_object_new_int( sport ));
-            json_object_object_add(json, "net_dst_ip", json_object_new_string( dip4 ));
-            json_object_object_add(json, "net_dst_port", json_object_new_int( dport ));
-            json_object_object_add(json, "net_protocol", json_object_new_int(  ((Unified2IDSEvent *)event)->protocol));
-
-            SnortSnprintfAppend(ssn_corr_id_hash_text, 512, "%s%d%s%d%d", sip4, sport, dip4, dport, ((Unified2IDSEvent *)event)->protocol);
+            protocol = ((Unified2IDSEvent *)event)->protocol;
+            version = 4;
             break;
         case UNIFIED2_IDS_EVENT_IPV6:
         case UNIFIED2_IDS_EVENT_IPV6_MPLS:
         case UNIFIED2_IDS_EVENT_IPV6_VLAN:
-            inet_ntop(AF_INET6, &((Unified2IDSEventIPv6 *)event)->ip_source, sip6, INET6_ADDRSTRLEN);
-            inet_ntop(AF_INET6, &((Unified2IDSEventIPv6 *)event)->ip_destination, dip6, INET6_ADDRSTRLEN);
+            inet_ntop(AF_INET6, &((Unified2IDSEventIPv6 *)event)->ip_source, sip, INET6_ADDRSTRLEN);
+            inet_ntop(AF_INET6, &((Unified2IDSEventIPv6 *)event)->ip_destination, dip, INET6_ADDRSTRLEN);
             sport = ntohs(((Unified2IDSEventIPv6 *)event)->sport_itype);
             dport = ntohs(((Unified2IDSEventIPv6 *)event)->dport_icode);
+            protocol = ((Unified2IDSEventIPv6 *)event)->protocol;
+            version = 6;
+            break;
+    }
 
-            json_object_object_add(json, "net_version", json_object_new_int( 6 ));
-            json_object_object_add(json, "net_src_ip", json_object_new_string( sip6 ));
-            json_object_object_add(json, "net_src_port", json_object_new_int( sport ));
-            json_object_object_add(json, "net_dst_ip", json_object_new_string( dip6 ));
-            json_object_object_add(json, "net_dst_port", json_object_new_int( dport ));
-            json_object_object_add(json, "net_protocol", json_object_new_int( ((Unified2IDSEventIPv6 *)event)->protocol ));
+    /* start a fresh document in the reusable buffer */
+    JsonWriter_Reset(json);
+    JsonWriter_Open(json, NULL);
 
-            SnortSnprintfAppend(ssn_corr_id_hash_text, 512, "%s%d%s%d%d", sip6, sport, dip6, dport, ((Unified2IDSEventIPv6 *)event)->protocol);
-            break;
+    JsonWriter_String(json, "node_id", node_id);
+
+    /* not yet classified */
+    JsonWriter_Int(json, "classification", 0);
+
+    JsonWriter_UInt(json, "meta_u2_event_id", ntohl(((Unified2EventCommon *)event)->event_id));
+
+    if( version != 0 )
+    {
+        JsonWriter_Int(json, "net_version", version);
+        JsonWriter_String(json, "net_src_ip", sip);
+        JsonWriter_UInt(json, "net_src_port", sport);
+        JsonWriter_String(json, "net_dst_ip", dip);
+        JsonWriter_UInt(json, "net_dst_port", dport);
+        JsonWriter_UInt(json, "net_protocol", protocol);
+
+        SnortSnprintfAppend(ssn_corr_id_hash_text, 512, "%s%d%s%d%d", sip, sport, dip, dport, protocol);
     }
 
     /* snort event reference time */
-    json_object_object_add(json, "timestamp", json_object_new_string( timestamp ));
+    JsonWriter_String(json, "timestamp", timestamp);
 
     SnortSnprintfAppend(id_hash_text, 512, "%s%s", ssn_corr_id_hash_text, timestamp);
 
     /* generator ID */
-    json_object_object_add(json, "sig_type", json_object_new_int( ntohl(((Unified2EventCommon *)event)->generator_id) ));
+    JsonWriter_UInt(json, "sig_type", ntohl(((Unified2EventCommon *)event)->generator_id));
 
     /* signature ID */
-    json_object_object_add(json, "sig_id", json_object_new_int( ntohl(((Unified2EventCommon *)event)->signature_id) ));
+    JsonWriter_UInt(json, "sig_id", ntohl(((Unified2EventCommon *)event)->signature_id));
 
     /* signature revision */
-    json_object_object_add(json, "sig_revision", json_object_new_int( ntohl(((Unified2EventCommon *)event)->signature_revision) ));
+    JsonWriter_UInt(json, "sig_revision", ntohl(((Unified2EventCommon *)event)->signature_revision));
 
     SnortSnprintfAppend(evt_corr_id_hash_text, 512, "%s%d%d%d",
         ssn_corr_id_hash_text,
@@ -514,44 +586,13 @@ void Echidna(Packet *p, void *event, u_int32_t event_type, void *arg)
       );
 
     /* signature message */
-    json_object_object_add(json, "sig_message", json_object_new_string( sn->msg ));
+    JsonWriter_String(json, "sig_message", sn->msg);
 
     /* alert priority */
-    json_object_object_add(json, "sig_priority", json_object_new_int( ntohl(((Unified2EventCommon *)event)->priority_id) ));
+    JsonWriter_UInt(json, "sig_priority", ntohl(((Unified2EventCommon *)event)->priority_id));
 
     /* alert classification */
-    json_object_object_add(json, "sig_category", json_object_new_string(  cn != NULL ? cn->type : "unknown" ));
-
-    /* IP version, addresses, ports and protocol */
-    switch( event_type )
-    {
-        case UNIFIED2_IDS_EVENT:
-        case UNIFIED2_IDS_EVENT_MPLS:
-        case UNIFIED2_IDS_EVENT_VLAN:
-            inet_ntop(AF_INET, &((Unified2IDSEvent*)event)->ip_source, sip4, INET_ADDRSTRLEN);
-            inet_ntop(AF_INET, &((Unified2IDSEvent*)event)->ip_destination, dip4, INET_ADDRSTRLEN);
-
-            json_object_object_add(json, "net_version", json_object_new_int( 4 ));
-            json_object_object_add(json, "net_src_ip", json_object_new_string( sip4 ));
-            json_object_object_add(json, "net_src_port", json_object_new_int( ntohs(((Unified2IDSEvent *)event)->sport_itype) ));
-            json_object_object_add(json, "net_dst_ip", json_object_new_string( sip4 ));
-            json_object_object_add(json, "net_dst_port", json_object_new_int( ntohs(((Unified2IDSEvent *)event)->dport_icode) ));
-            json_object_object_add(json, "net_protocol", json_object_new_int( ((Unified2IDSEvent *)event)->protocol ));
-            break;
-        case UNIFIED2_IDS_EVENT_IPV6:
-        case UNIFIED2_IDS_EVENT_IPV6_MPLS:
-        case UNIFIED2_IDS_EVENT_IPV6_VLAN:
-            inet_ntop(AF_INET6, &((Unified2IDSEventIPv6 *)event)->ip_source, sip6, INET6_ADDRSTRLEN);
-            inet_ntop(AF_INET6, &((Unified2IDSEventIPv6 *)event)->ip_destination, dip6, INET6_ADDRSTRLEN);
-
-            json_object_object_add(json, "net_version", json_object_new_int( 6 ));
-            json_object_object_add(json, "net_src_ip", json_object_new_string( sip6 ));
-            json_object_object_add(json, "net_src_port", json_object_new_int( ntohs(((Unified2IDSEventIPv6 *)event)->sport_itype) ));
-            json_object_object_add(json, "net_dst_ip", json_object_new_string( sip6 ));
-            json_object_object_add(json, "net_dst_port", json_object_new_int( ntohs(((Unified2IDSEventIPv6 *)event)->dport_icode) ));
-            json_object_object_add(json, "net_protocol", json_object_new_int( ((Unified2IDSEventIPv6 *)event)->protocol ));
-            break;
-    }
+    JsonWriter_String(json, "sig_category", cn != NULL ? cn->type : "unknown");
 
     /* pull decoded info from the packet */
     if( p != NULL )
@@ -586,80 +627,50 @@ void Echidna(Packet *p, void *event, u_int32_t event_type, void *arg)
 
         /* add payload data */
         if( p->dsize )
-        {
-            data_msg = fasthex(p->data, p->dsize);
-            if( data_msg != NULL )
-            {
-                json_object_object_add(json, "payload", json_object_new_string( data_msg ));
-                free(data_msg);
-            }
-        }
+            JsonWriter_Hex(json, "payload", p->data, p->dsize);
     }
 
     /* construct id hash */
     SHA256_Init(&ctx);
     SHA256_Update(&ctx, id_hash_text, strlen(id_hash_text));
     SHA256_Final(id_hash, &ctx);
-    for( i=0; i<SHA256_DIGEST_LENGTH; i++)
-    {
-      sprintf(id_hash_hex+(i*2), "%02x", id_hash[i]);
-    }
-    json_object_object_add(json, "id", json_object_new_string(id_hash_hex));
+    JsonWriter_Hex(json, "id", id_hash, SHA256_DIGEST_LENGTH);
 
     /* construct session correlation id hash */
     SHA256_Init(&ctx);
     SHA256_Update(&ctx, ssn_corr_id_hash_text, strlen(ssn_corr_id_hash_text));
     SHA256_Final(ssn_corr_id_hash, &ctx);
-    for( i=0; i<SHA256_DIGEST_LENGTH; i++)
-    {
-      sprintf(ssn_corr_id_hash_hex+(i*2), "%02x", ssn_corr_id_hash[i]);
-    }
-
-    json_object_object_add(json, "ssn_corr_id", json_object_new_string(ssn_corr_id_hash_hex));
+    JsonWriter_Hex(json, "ssn_corr_id", ssn_corr_id_hash, SHA256_DIGEST_LENGTH);
 
     /* construct event correlation id hash */
     SHA256_Init(&ctx);
     SHA256_Update(&ctx, evt_corr_id_hash_text, strlen(evt_corr_id_hash_text));
     SHA256_Final(evt_corr_id_hash, &ctx);
-    for( i=0; i<SHA256_DIGEST_LENGTH; i++)
-    {
-      sprintf(evt_corr_id_hash_hex+(i*2), "%02x", evt_corr_id_hash[i]);
-    }
-    json_object_object_add(json, "evt_corr_id", json_object_new_string(evt_corr_id_hash_hex));
+    JsonWriter_Hex(json, "evt_corr_id", evt_corr_id_hash, SHA256_DIGEST_LENGTH);
 
-    /* send msg to sensor_agent */
-    EchidnaEventSubmit(data, json);
-    json_object_put( json );
+    JsonWriter_Close(json);
 
-    free(timestamp);
+    /* send msg to sensor_agent */
+    EchidnaEventSubmit(data, JsonWriter_Buffer(json), JsonWriter_Length(json));
 }
 
-int EchidnaEventIPHeaderDataAppend(json_object *json, Packet *p)
+int EchidnaEventIPHeaderDataAppend(JsonWriter *json, Packet *p)
 {
-    json_object_object_add(json, "ip_hdr_hlen", json_object_new_int( IP_HLEN(p->iph) ));
-    json_object_object_add(json, "ip_hdr_tos", json_object_new_int( p->iph->ip_tos ));
-    json_object_object_add(json, "ip_hdr_len", json_object_new_int( p->iph->ip_len ));
-    json_object_object_add(json, "ip_hdr_id", json_object_new_int( p->iph->ip_id ));
-
-#if defined(WORDS_BIGENDIAN)
-    json_object_object_add(json, "ip_hdr_id", json_object_new_int( ((p->iph->ip_off & 0xe000) >> 13) ));
-    json_object_object_add(json, "ip_hdr_id", json_object_new_int( htons(p->iph->ip_off & 0x1fff) ));
-#else
-    json_object_object_add(json, "ip_hdr_id", json_object_new_int( ((p->iph->ip_off & 0x00e0) >> 5) ));
-    json_object_object_add(json, "ip_hdr_id", json_object_new_int( htons(p->iph->ip_off & 0xff1f) ));
-#endif
-
-    json_object_object_add(json, "ip_hdr_ttl", json_object_new_int( p->iph->ip_ttl) );
-    json_object_object_add(json, "ip_hdr_csum", json_object_new_int( htons(p->iph->ip_csum) ));
+    JsonWriter_UInt(json, "ip_hdr_hlen", IP_HLEN(p->iph));
+    JsonWriter_UInt(json, "ip_hdr_tos", p->iph->ip_tos);
+    JsonWriter_UInt(json, "ip_hdr_len", ntohs(p->iph->ip_len));
+    JsonWriter_UInt(json, "ip_hdr_id", ntohs(p->iph->ip_id));
+    JsonWriter_UInt(json, "ip_hdr_ttl", p->iph->ip_ttl);
+    JsonWriter_UInt(json, "ip_hdr_csum", ntohs(p->iph->ip_csum));
 
     return 0;
 }
 
-int EchidnaEventICMPDataAppend(json_object *json, Packet *p)
+int EchidnaEventICMPDataAppend(JsonWriter *json, Packet *p)
 {
     {
         /* ICMP checksum */
-        json_object_object_add(json, "icmp_csum", json_object_new_int( ntohs(p->icmph->csum) ));
+        JsonWriter_UInt(json, "icmp_csum", ntohs(p->icmph->csum));
 
         /* Append other ICMP data if we have it */
         if( p->icmph->type == ICMP_ECHOREPLY || p->icmph->type == ICMP_ECHO ||
@@ -667,34 +678,34 @@ int EchidnaEventICMPDataAppend(json_object *json, Packet *p)
             p->icmph->type == ICMP_INFO_REQUEST || p->icmph->type == ICMP_INFO_REPLY )
         {
             /* ICMP ID */
-            json_object_object_add(json, "icmp_id", json_object_new_int( htonl(p->icmph->icmp_hun.idseq.id) ));
+            JsonWriter_UInt(json, "icmp_id", ntohs(p->icmph->icmp_hun.idseq.id));
 
             /* ICMP sequence */
-            json_object_object_add(json, "icmp_seq", json_object_new_int( htonl(p->icmph->icmp_hun.idseq.id) ));
+            JsonWriter_UInt(json, "icmp_seq", ntohs(p->icmph->icmp_hun.idseq.seq));
         }
     }
 
     return 0;
 }
 
-int EchidnaEventTCPDataAppend(json_object *json, Packet *p)
+int EchidnaEventTCPDataAppend(JsonWriter *json, Packet *p)
 {
-    json_object_object_add(json, "tcp_seq", json_object_new_int( ntohl(p->tcph->th_seq) ));
-    json_object_object_add(json, "tcp_ack", json_object_new_int( ntohl(p->tcph->th_ack) ));
-    json_object_object_add(json, "tcp_off", json_object_new_int( TCP_OFFSET(p->tcph) ));
-    json_object_object_add(json, "tcp_x2", json_object_new_int( TCP_X2(p->tcph) ));
-    json_object_object_add(json, "tcp_flags", json_object_new_int( p->tcph->th_flags ));
-    json_object_object_add(json, "tcp_win", json_object_new_int( ntohl(p->tcph->th_win) ));
-    json_object_object_add(json, "tcp_sum", json_object_new_int( ntohl(p->tcph->th_sum) ));
-    json_object_object_add(json, "tcp_urp", json_object_new_int( ntohl(p->tcph->th_urp) ));
+    JsonWriter_UInt(json, "tcp_seq", ntohl(p->tcph->th_seq));
+    JsonWriter_UInt(json, "tcp_ack", ntohl(p->tcph->th_ack));
+    JsonWriter_UInt(json, "tcp_off", TCP_OFFSET(p->tcph));
+    JsonWriter_UInt(json, "tcp_x2", TCP_X2(p->tcph));
+    JsonWriter_UInt(json, "tcp_flags", p->tcph->th_flags);
+    JsonWriter_UInt(json, "tcp_win", ntohs(p->tcph->th_win));
+    JsonWriter_UInt(json, "tcp_sum", ntohs(p->tcph->th_sum));
+    JsonWriter_UInt(json, "tcp_urp", ntohs(p->tcph->th_urp));
 
     return 0;
 }
 
-int EchidnaEventUDPDataAppend(json_object *json, Packet *p)
+int EchidnaEventUDPDataAppend(JsonWriter *json, Packet *p)
 {
-    json_object_object_add(json, "udp_len", json_object_new_int( ntohs(p->udph->uh_len) ));
-    json_object_object_add(json, "udp_chk", json_object_new_int( ntohs(p->udph->uh_chk) ));
+    JsonWriter_UInt(json, "udp_len", ntohs(p->udph->uh_len));
+    JsonWriter_UInt(json, "udp_chk", ntohs(p->udph->uh_chk));
 
     return 0;
 }
@@ -780,62 +791,484 @@ size_t _curl_dummy_write(char *ptr, size_t size, size_t nmemb, void *userdata)
      return size * nmemb;
 }
 
+static u_int64_t EchidnaElapsedMs(struct timeval *since, struct timeval *now)
+{
+    if( timercmp(now, since, <) )
+        return 0;
+
+    return (u_int64_t)(now->tv_sec - since->tv_sec) * 1000 +
+           (now->tv_usec - since->tv_usec) / 1000;
+}
+
+static void EchidnaBatchFree(EchidnaBatch *batch)
+{
+    free(batch->body);
+    free(batch);
+}
+
 /*
- * Function: void EchidnaEventSubmit(SpoEchidnaData *spd_data, char *msg)
+ * Function: EchidnaBatchSeal(SpoEchidnaData *)
  *
- * Purpose: Submit the JSON event structure to the REST node.
+ * Purpose: Close the batch being filled and append it to the ready queue.
+ *          Must be called with the submitter lock held.
+ */
+static void EchidnaBatchSeal(SpoEchidnaData *spd_data)
+{
+    EchidnaSubmitter *sub = &spd_data->sub;
+    EchidnaBatch *batch = sub->fill;
+
+    if( batch == NULL )
+        return;
+
+    if( spd_data->format == FORMAT_ARRAY )
+        batch->body[batch->len++] = ']';
+
+    batch->body[batch->len] = '\0';
+
+    sub->fill = NULL;
+
+    if( sub->tail != NULL )
+        sub->tail->next = batch;
+    else
+        sub->head = batch;
+
+    sub->tail = batch;
+}
+
+/*
+ * Function: void EchidnaEventSubmit(SpoEchidnaData *spd_data, const char *msg, size_t len)
  *
- * Arguments: args => argument list
+ * Purpose: Queue the JSON event structure for submission to the REST node.
+ *          Events are serialized into the current batch body; the output
+ *          thread only blocks when the submitter already holds max_queue
+ *          bytes which the node hasn't accepted yet.
+ *
+ * Arguments: spd_data => plugin data
+ *            msg => the serialized event
+ *            len => length of msg
  *
  * Returns: void function
  *
  */
-void EchidnaEventSubmit(SpoEchidnaData *spd_data, json_object *json)
+void EchidnaEventSubmit(SpoEchidnaData *spd_data, const char *msg, size_t len)
 {
-    CURLcode res;
-    char uri[2048];
-    long rc = 0;
+    EchidnaSubmitter *sub = &spd_data->sub;
+    EchidnaBatch *batch;
+    size_t need;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "submitting: %s\n", msg););
+
+    pthread_mutex_lock(&sub->lock);
+
+    /* a single event larger than the queue still gets through on its own */
+    while( sub->queued_bytes > 0 && sub->queued_bytes + len + 2 > spd_data->max_queue && !sub->stop )
+        pthread_cond_wait(&sub->space, &sub->lock);
+
+    if( sub->stop )
+    {
+        sub->events_dropped++;
+        pthread_mutex_unlock(&sub->lock);
+        return;
+    }
+
+    batch = sub->fill;
+
+    /* separator + event + closing bracket + nul */
+    need = len + 3;
+
+    if( batch == NULL )
+    {
+        batch = (EchidnaBatch *)SnortAlloc(sizeof(EchidnaBatch));
+        batch->size = need + 1 > 4096 ? need + 1 : 4096;
+        batch->body = (char *)SnortAlloc(batch->size);
+        gettimeofday(&batch->ready, NULL);
+
+        if( spd_data->format == FORMAT_ARRAY )
+            batch->body[batch->len++] = '[';
+
+        sub->fill = batch;
+    }
+    else if( batch->len + need > batch->size )
+    {
+        size_t size = batch->size * 2;
+        char *body;
+
+        while( batch->len + need > size )
+            size *= 2;
+
+        body = (char *)realloc(batch->body, size);
+        if( body == NULL )
+            FatalError("echidna: unable to grow batch to %lu bytes\n", (unsigned long)size);
+
+        batch->body = body;
+        batch->size = size;
+    }
+
+    if( spd_data->format == FORMAT_ARRAY && batch->events > 0 )
+        batch->body[batch->len++] = ',';
+
+    memcpy(batch->body + batch->len, msg, len);
+    batch->len += len;
+
+    if( spd_data->format == FORMAT_NDJSON )
+        batch->body[batch->len++] = '\n';
+
+    batch->events++;
+    sub->queued_bytes += len + 1;
+
+    if( batch->events >= spd_data->batch_events )
+        EchidnaBatchSeal(spd_data);
+
+    pthread_mutex_unlock(&sub->lock);
+}
+
+/*
+ * Function: EchidnaBatchNext(EchidnaSubmitter *, struct timeval *)
+ *
+ * Purpose: Pick the next batch to send, retries which are due go first.
+ *          Must be called with the submitter lock held.
+ */
+static EchidnaBatch *EchidnaBatchNext(EchidnaSubmitter *sub, struct timeval *now)
+{
+    EchidnaBatch *batch;
+
+    if( sub->retry_head != NULL && !timercmp(now, &sub->retry_head->ready, <) )
+    {
+        batch = sub->retry_head;
+        sub->retry_head = batch->next;
+        if( sub->retry_head == NULL )
+            sub->retry_tail = NULL;
+    }
+    else if( sub->head != NULL )
+    {
+        batch = sub->head;
+        sub->head = batch->next;
+        if( sub->head == NULL )
+            sub->tail = NULL;
+    }
+    else
+        return NULL;
+
+    batch->next = NULL;
+    return batch;
+}
+
+/*
+ * Function: EchidnaBatchRetry(EchidnaSubmitter *, EchidnaBatch *)
+ *
+ * Purpose: Insert a failed batch into the retry queue, which is kept in
+ *          order of retry time so a long back-off doesn't hold up batches
+ *          due before it.  Must be called with the submitter lock held.
+ */
+static void EchidnaBatchRetry(EchidnaSubmitter *sub, EchidnaBatch *batch)
+{
+    EchidnaBatch **prev = &sub->retry_head;
+
+    while( *prev != NULL && !timercmp(&batch->ready, &(*prev)->ready, <) )
+        prev = &(*prev)->next;
+
+    batch->next = *prev;
+    *prev = batch;
+
+    if( batch->next == NULL )
+        sub->retry_tail = batch;
+}
 
-    if( spd_data->curl == NULL )
+/*
+ * Function: EchidnaBatchDone(SpoEchidnaData *, u_int32_t, long)
+ *
+ * Purpose: Account for a finished request; failed batches go back on the
+ *          retry queue with an exponential back-off.
+ */
+static void EchidnaBatchDone(SpoEchidnaData *spd_data, u_int32_t slot, long rc)
+{
+    EchidnaSubmitter *sub = &spd_data->sub;
+    EchidnaBatch *batch = sub->inflight[slot];
+    u_int32_t delay;
+
+    sub->inflight[slot] = NULL;
+    sub->running--;
+
+    pthread_mutex_lock(&sub->lock);
+
+    if( rc >= 200 && rc < 300 )
     {
-        spd_data->curl = curl_easy_init();
+        sub->events_sent += batch->events;
+        sub->batches_sent++;
+        sub->queued_bytes -= batch->len - (spd_data->format == FORMAT_ARRAY ? 1 : 0);
+
+        pthread_cond_broadcast(&sub->space);
+        pthread_mutex_unlock(&sub->lock);
+
+        EchidnaBatchFree(batch);
+        return;
+    }
+
+    if( rc == 403 )
+    {
+        DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "forbidden. TODO: request new session key\n"););
+    }
+
+    delay = batch->tries < 4 ? 1 << batch->tries : MAX_RETRY_SECS;
+    if( delay > MAX_RETRY_SECS )
+        delay = MAX_RETRY_SECS;
+
+    batch->tries++;
+    gettimeofday(&batch->ready, NULL);
+    batch->ready.tv_sec += delay;
+
+    EchidnaBatchRetry(sub, batch);
+    sub->batches_retried++;
+
+    pthread_mutex_unlock(&sub->lock);
+}
+
+/*
+ * Function: EchidnaBatchDrop(EchidnaSubmitter *, EchidnaBatch **)
+ *
+ * Purpose: Discard a list of batches which couldn't be delivered in time.
+ */
+static void EchidnaBatchDrop(EchidnaSubmitter *sub, EchidnaBatch **list)
+{
+    EchidnaBatch *batch;
+
+    while( (batch = *list) != NULL )
+    {
+        *list = batch->next;
+        sub->events_dropped += batch->events;
+        EchidnaBatchFree(batch);
+    }
+}
 
-        if( spd_data->curl )
+/*
+ * Function: EchidnaSubmitter_T(void *)
+ *
+ * Purpose: Background thread driving up to "streams" concurrent POSTs
+ *          through a curl multi handle.  The easy handles are reused so
+ *          their connections stay alive between requests.
+ */
+static void *EchidnaSubmitter_T(void *arg)
+{
+    SpoEchidnaData *spd_data = (SpoEchidnaData *)arg;
+    EchidnaSubmitter *sub = &spd_data->sub;
+    EchidnaBatch *batch;
+    struct timeval now;
+    struct timeval stop_time;
+    CURLMsg *msg;
+    sigset_t set;
+    u_int32_t slot;
+    long rc;
+    int left;
+    int numfds;
+
+    sigemptyset(&set);
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    timerclear(&stop_time);
+
+    while( 1 )
+    {
+        gettimeofday(&now, NULL);
+
+        pthread_mutex_lock(&sub->lock);
+
+        /* time based flush of a partial batch */
+        if( sub->fill != NULL &&
+            ( sub->stop || EchidnaElapsedMs(&sub->fill->ready, &now) >= spd_data->batch_ms ) )
+            EchidnaBatchSeal(spd_data);
+
+        if( sub->stop )
         {
-            snprintf(uri, 2048, "%s?session=%s", session_uri, session_key);
+            if( !timerisset(&stop_time) )
+                stop_time = now;
+
+            if( sub->running == 0 && sub->head == NULL && sub->retry_head == NULL )
+            {
+                pthread_mutex_unlock(&sub->lock);
+                break;
+            }
+
+            /* give up on whatever the node doesn't take in time */
+            if( now.tv_sec - stop_time.tv_sec >= DRAIN_SECS )
+            {
+                for( slot = 0; slot < spd_data->streams; slot++ )
+                {
+                    if( sub->inflight[slot] == NULL )
+                        continue;
+
+                    curl_multi_remove_handle(sub->multi, sub->easy[slot]);
+                    sub->inflight[slot]->next = sub->head;
+                    sub->head = sub->inflight[slot];
+                    sub->inflight[slot] = NULL;
+                    sub->running--;
+                }
 
-            curl_easy_setopt(spd_data->curl, CURLOPT_URL, uri);
-            curl_easy_setopt(spd_data->curl, CURLOPT_WRITEFUNCTION, &_curl_dummy_write);
+                EchidnaBatchDrop(sub, &sub->head);
+                EchidnaBatchDrop(sub, &sub->retry_head);
+                sub->tail = sub->retry_tail = NULL;
+                pthread_mutex_unlock(&sub->lock);
+                break;
+            }
         }
-        else
+
+        /* fill the idle streams */
+        for( slot = 0; slot < spd_data->streams; slot++ )
         {
-            FatalError("echidna: unable to allocate a CURL structure.\n");
+            if( sub->inflight[slot] != NULL )
+                continue;
+
+            if( (batch = EchidnaBatchNext(sub, &now)) == NULL )
+                break;
+
+            sub->inflight[slot] = batch;
+            sub->running++;
+
+            curl_easy_setopt(sub->easy[slot], CURLOPT_POSTFIELDS, batch->body);
+            curl_easy_setopt(sub->easy[slot], CURLOPT_POSTFIELDSIZE, (long)batch->len);
+            curl_multi_add_handle(sub->multi, sub->easy[slot]);
         }
-    }
 
-    DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "submitting: %s\n", json_object_to_json_string( json )););
+        pthread_mutex_unlock(&sub->lock);
 
-    curl_easy_setopt(spd_data->curl, CURLOPT_POSTFIELDS, json_object_to_json_string( json ) );
+        curl_multi_perform(sub->multi, &left);
 
-    while( rc != 200 )
-    {
-        if( ( res = curl_easy_perform(spd_data->curl) ) == CURLE_OK )
+        while( (msg = curl_multi_info_read(sub->multi, &left)) != NULL )
         {
-            curl_easy_getinfo(spd_data->curl, CURLINFO_RESPONSE_CODE, &rc);
-            DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "RC: %lu\n", rc););
+            if( msg->msg != CURLMSG_DONE )
+                continue;
 
-            if( rc == 403 )
+            for( slot = 0; slot < spd_data->streams; slot++ )
             {
-                DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "forbidden. TODO: request new session key\n"););
-                sleep(15);
+                if( sub->easy[slot] == msg->easy_handle )
+                    break;
             }
-            else if( rc != 200 )
+
+            rc = 0;
+            if( msg->data.result == CURLE_OK )
             {
-                DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res)););
-                sleep(15);
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &rc);
+                DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "RC: %lu\n", rc););
             }
+            else
+            {
+                DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "curl request failed: %s\n",
+                    curl_easy_strerror(msg->data.result)););
+            }
+
+            curl_multi_remove_handle(sub->multi, msg->easy_handle);
+
+            if( slot < spd_data->streams )
+                EchidnaBatchDone(spd_data, slot, rc);
         }
+
+        curl_multi_wait(sub->multi, NULL, 0, sub->running ? 100 : 50, &numfds);
     }
+
+    return NULL;
+}
+
+/*
+ * Function: EchidnaSubmitterStart(SpoEchidnaData *)
+ *
+ * Purpose: Prepare the reusable easy handles and start the submitter.
+ */
+void EchidnaSubmitterStart(SpoEchidnaData *spd_data)
+{
+    EchidnaSubmitter *sub = &spd_data->sub;
+    char uri[2048];
+    u_int32_t i;
+    int ret;
+
+    snprintf(uri, 2048, "%s?session=%s", session_uri, session_key);
+
+    sub->multi = curl_multi_init();
+    if( sub->multi == NULL )
+        FatalError("echidna: unable to allocate a CURL multi structure.\n");
+
+    sub->headers = curl_slist_append(NULL, spd_data->format == FORMAT_ARRAY ?
+            "Content-Type: application/json" : "Content-Type: application/x-ndjson");
+
+    sub->easy = (CURL **)SnortAlloc(sizeof(CURL *) * spd_data->streams);
+    sub->inflight = (EchidnaBatch **)SnortAlloc(sizeof(EchidnaBatch *) * spd_data->streams);
+
+    for( i = 0; i < spd_data->streams; i++ )
+    {
+        sub->easy[i] = curl_easy_init();
+
+        if( sub->easy[i] == NULL )
+            FatalError("echidna: unable to allocate a CURL structure.\n");
+
+        curl_easy_setopt(sub->easy[i], CURLOPT_URL, uri);
+        curl_easy_setopt(sub->easy[i], CURLOPT_WRITEFUNCTION, &_curl_dummy_write);
+        curl_easy_setopt(sub->easy[i], CURLOPT_HTTPHEADER, sub->headers);
+        curl_easy_setopt(sub->easy[i], CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(sub->easy[i], CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(sub->easy[i], CURLOPT_CONNECTTIMEOUT, (long)CONNECT_SECS);
+        curl_easy_setopt(sub->easy[i], CURLOPT_TIMEOUT, (long)REQUEST_SECS);
+    }
+
+    pthread_mutex_init(&sub->lock, NULL);
+    pthread_cond_init(&sub->space, NULL);
+
+    if( (ret = pthread_create(&sub->tid, NULL, &EchidnaSubmitter_T, spd_data)) != 0 )
+        FatalError("echidna: Can't create submitter thread: [%s]\n", strerror(ret));
+
+    if( ! BcLogQuiet() )
+    {
+        LogMessage("echidna: batch = %u events / %u ms (%s)\n", spd_data->batch_events,
+            spd_data->batch_ms, spd_data->format == FORMAT_ARRAY ? "array" : "ndjson");
+        LogMessage("echidna: streams = %u, queue = %lu KB\n", spd_data->streams,
+            (unsigned long)(spd_data->max_queue >> 10));
+    }
+}
+
+/*
+ * Function: EchidnaSubmitterStop(SpoEchidnaData *)
+ *
+ * Purpose: Flush what the node accepts within DRAIN_SECS and release the
+ *          submitter.
+ */
+void EchidnaSubmitterStop(SpoEchidnaData *spd_data)
+{
+    EchidnaSubmitter *sub = &spd_data->sub;
+    u_int32_t i;
+
+    if( sub->multi == NULL )
+        return;
+
+    pthread_mutex_lock(&sub->lock);
+    sub->stop = 1;
+    pthread_cond_broadcast(&sub->space);
+    pthread_mutex_unlock(&sub->lock);
+
+    pthread_join(sub->tid, NULL);
+
+    for( i = 0; i < spd_data->streams; i++ )
+    {
+        if( sub->inflight[i] != NULL )
+        {
+            curl_multi_remove_handle(sub->multi, sub->easy[i]);
+            EchidnaBatchFree(sub->inflight[i]);
+        }
+
+        curl_easy_cleanup(sub->easy[i]);
+    }
+
+    curl_multi_cleanup(sub->multi);
+    curl_slist_free_all(sub->headers);
+
+    free(sub->easy);
+    free(sub->inflight);
+
+    pthread_cond_destroy(&sub->space);
+    pthread_mutex_destroy(&sub->lock);
+
+    LogMessage("echidna: %llu events in %llu requests, %llu retries, %llu events dropped\n",
+        (unsigned long long)sub->events_sent, (unsigned long long)sub->batches_sent,
+        (unsigned long long)sub->batches_retried, (unsigned long long)sub->events_dropped);
+
+    sub->multi = NULL;
 }
 
 
@@ -861,6 +1294,11 @@ void ParseEchidnaArgs(SpoEchidnaData *spd_data)
     /* initialise appropariate values to defaults */
     spd_data->node_port = DEFAULT_NODEPORT;
     spd_data->use_ssl = 0;
+    spd_data->batch_events = DEFAULT_BATCH;
+    spd_data->batch_ms = DEFAULT_FLUSH_MS;
+    spd_data->streams = DEFAULT_STREAMS;
+    spd_data->max_queue = DEFAULT_QUEUE;
+    spd_data->format = FORMAT_NDJSON;
 
     if( spd_data->args == NULL )
     {
@@ -903,6 +1341,44 @@ void ParseEchidnaArgs(SpoEchidnaData *spd_data)
             else
                 LogMessage("echidna: agent_name error\n");
         }
+        else if( !strncasecmp(stoks[0], KEYWORD_BATCH, strlen(KEYWORD_BATCH)) )
+        {
+            if( num_stoks > 1 && atoi(stoks[1]) > 0 )
+                spd_data->batch_events = atoi(stoks[1]);
+            else
+                LogMessage("echidna: batch error\n");
+        }
+        else if( !strncasecmp(stoks[0], KEYWORD_FLUSH, strlen(KEYWORD_FLUSH)) )
+        {
+            if( num_stoks > 1 && atoi(stoks[1]) >= 0 )
+                spd_data->batch_ms = atoi(stoks[1]);
+            else
+                LogMessage("echidna: flush error\n");
+        }
+        else if( !strncasecmp(stoks[0], KEYWORD_STREAMS, strlen(KEYWORD_STREAMS)) )
+        {
+            if( num_stoks > 1 && atoi(stoks[1]) > 0 && atoi(stoks[1]) <= MAX_STREAMS )
+                spd_data->streams = atoi(stoks[1]);
+            else
+                LogMessage("echidna: streams error, must be 1-%d\n", MAX_STREAMS);
+        }
+        else if( !strncasecmp(stoks[0], KEYWORD_QUEUE, strlen(KEYWORD_QUEUE)) )
+        {
+            /* in KB */
+            if( num_stoks > 1 && atoi(stoks[1]) > 0 )
+                spd_data->max_queue = (size_t)atoi(stoks[1]) * 1024;
+            else
+                LogMessage("echidna: queue error\n");
+        }
+        else if( !strncasecmp(stoks[0], KEYWORD_FORMAT, strlen(KEYWORD_FORMAT)) )
+        {
+            if( num_stoks > 1 && !strcasecmp(stoks[1], "array") )
+                spd_data->format = FORMAT_ARRAY;
+            else if( num_stoks > 1 && !strcasecmp(stoks[1], "ndjson") )
+                spd_data->format = FORMAT_NDJSON;
+            else
+                LogMessage("echidna: format error, must be ndjson or array\n");
+        }
         else
         {
             FatalError("echidna: unrecognised plugin argument \"%s\"!\n", index);
@@ -916,24 +1392,19 @@ void ParseEchidnaArgs(SpoEchidnaData *spd_data)
     mSplitFree(&toks, num_toks);
 }
 
-char *EchidnaTimestamp(u_int32_t sec, u_int32_t usec)
+void EchidnaTimestamp(u_int32_t sec, u_int32_t usec, char *buf, size_t len)
 {
-    struct tm *lt;  /* localtime */
-    char *buf;
+    struct tm tm;
     time_t time = sec;
 
-    buf = (char *)SnortAlloc(TMP_BUFFER * sizeof(char));
-
     if( BcOutputUseUtc() )
-        lt = gmtime(&time);
+        gmtime_r(&time, &tm);
     else
-        lt = localtime(&time);
+        localtime_r(&time, &tm);
 
-    SnortSnprintf(buf, TMP_BUFFER, "%04i-%02i-%02i %02i:%02i:%02i.%06i",
-          1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-          lt->tm_hour, lt->tm_min, lt->tm_sec, usec);
-
-    return buf;
+    SnortSnprintf(buf, len, "%04i-%02i-%02i %02i:%02i:%02i.%06i",
+          1900 + tm.tm_year, tm.tm_mon + 1, tm.tm_mday,
+          tm.tm_hour, tm.tm_min, tm.tm_sec, usec);
 }
 
 void EchidnaClose(void *arg)
@@ -949,8 +1420,9 @@ void EchidnaClose(void *arg)
         if( spd_data->args )
             free(spd_data->args);
 
-        if( spd_data->curl )
-            curl_easy_cleanup(spd_data->curl);
+        EchidnaSubmitterStop(spd_data);
+
+        JsonWriter_Term(spd_data->json);
 
         free(spd_data);
     }
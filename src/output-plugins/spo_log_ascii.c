@@ -30,24 +30,32 @@
  * This output module provides the default packet logging funtionality
  *
  * Arguments:
- *   
- * None.
+ *
+ * open_files=<n>   keep at most n log files open (default 128)
+ * idle=<secs>      close log files not written to for secs (default 60)
  *
  * Effect:
  *
- * None.
+ * Packets are logged to per host directories under the log directory.
  *
  * Comments:
  *
+ * Log files are kept open between packets in a small LRU cache, and the
+ * host directories already created are remembered, so a packet normally
+ * costs a write instead of a mkdir/open/close.  Each packet is still
+ * flushed as it is logged.
+ *
  */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 #include <sys/types.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
@@ -68,15 +76,59 @@
 #include "plugbase.h"
 #include "unified2.h"
 #include "util.h"
+#include "mstring.h"
 #include "ipv6_port.h"
 
+#define DEFAULT_OPEN_FILES  128
+#define DEFAULT_IDLE_SECS   60
+#define LOG_ASCII_ROWS      1024    /* open files hash, the dir set grows */
+
+typedef struct _LogAsciiFile
+{
+    char *path;
+    FILE *fh;
+    time_t last_used;
+    struct _LogAsciiFile *hnext;    /* hash row */
+    struct _LogAsciiFile *prev;     /* lru list, most recently used first */
+    struct _LogAsciiFile *next;
+} LogAsciiFile;
+
+typedef struct _LogAsciiDir
+{
+    char *path;
+    struct _LogAsciiDir *hnext;
+} LogAsciiDir;
+
+typedef struct _LogAsciiData
+{
+    LogAsciiFile *files[LOG_ASCII_ROWS];
+    LogAsciiFile *mru;
+    LogAsciiFile *lru;
+    unsigned int open_files;
+    unsigned int max_open;
+    unsigned int idle_secs;
+    time_t last_sweep;
+
+    LogAsciiDir **dirs;             /* host directories known to exist */
+    unsigned int dir_rows;
+    unsigned int dir_count;
+
+    unsigned long writes;
+    unsigned long opens;
+    unsigned long idle_closes;
+    unsigned long lru_closes;
+    unsigned long mkdirs;
+} LogAsciiData;
+
 /* internal functions */
 void LogAsciiInit(char *args);
 void LogAscii(Packet *, void *, uint32_t, void *);
 void LogAsciiCleanExit(int signal, void *arg);
 void LogAsciiRestart(int signal, void *arg);
 char *IcmpFileName(Packet * p);
-static FILE *OpenLogFile(int mode, Packet * p);
+static FILE *OpenLogFile(LogAsciiData *, int mode, Packet * p);
+static LogAsciiData *ParseLogAsciiArgs(char *);
+static void LogAsciiCloseAll(LogAsciiData *);
 
 
 #define DUMP              1
@@ -96,16 +148,65 @@ void LogAsciiSetup(void)
 
 void LogAsciiInit(char *args)
 {
+    LogAsciiData *data;
+
     DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "Output: Ascii logging initialized\n"););
 
+    data = ParseLogAsciiArgs(args);
+
     /* Set the preprocessor function into the function list */
-    AddFuncToOutputList(LogAscii, OUTPUT_TYPE__LOG, NULL);
-    AddFuncToCleanExitList(LogAsciiCleanExit, NULL);
-    AddFuncToRestartList(LogAsciiRestart, NULL);
+    AddFuncToOutputList(LogAscii, OUTPUT_TYPE__LOG, data);
+    AddFuncToCleanExitList(LogAsciiCleanExit, data);
+    AddFuncToRestartList(LogAsciiRestart, data);
+}
+
+static LogAsciiData *ParseLogAsciiArgs(char *args)
+{
+    LogAsciiData *data;
+    char **toks;
+    int num_toks;
+    int i;
+
+    data = (LogAsciiData *) SnortAlloc(sizeof(LogAsciiData));
+    data->max_open = DEFAULT_OPEN_FILES;
+    data->idle_secs = DEFAULT_IDLE_SECS;
+    data->dir_rows = LOG_ASCII_ROWS;
+    data->dirs = (LogAsciiDir **) SnortAlloc(sizeof(LogAsciiDir *) * data->dir_rows);
+
+    if ( args == NULL )
+        return data;
+
+    toks = mSplit(args, " \t", 0, &num_toks, '\\');
+
+    for ( i = 0; i < num_toks; i++ )
+    {
+        if ( !strncasecmp(toks[i], "open_files=", 11) )
+        {
+            data->max_open = strtoul(toks[i] + 11, NULL, 10);
+
+            if ( data->max_open < 1 )
+                FatalError("log_ascii: open_files must be at least 1\n");
+        }
+        else if ( !strncasecmp(toks[i], "idle=", 5) )
+        {
+            data->idle_secs = strtoul(toks[i] + 5, NULL, 10);
+        }
+        else
+        {
+            FatalError("log_ascii: unknown argument '%s'\n", toks[i]);
+        }
+    }
+    mSplitFree(&toks, num_toks);
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "log_ascii: open_files=%u idle=%u\n",
+        data->max_open, data->idle_secs););
+
+    return data;
 }
 
 void LogAscii(Packet *p, void *event, uint32_t event_type, void *arg)
 {
+    LogAsciiData *data = (LogAsciiData *)arg;
     FILE *log_ptr = NULL;
 	SigNode				*sn = NULL;
 
@@ -123,16 +224,16 @@ void LogAscii(Packet *p, void *event, uint32_t event_type, void *arg)
     if(p)
     { 
         if(IPH_IS_VALID(p))
-            log_ptr = OpenLogFile(0, p);
+            log_ptr = OpenLogFile(data, 0, p);
 #ifndef NO_NON_ETHER_DECODER
         else if(p->ah)
-            log_ptr = OpenLogFile(ARP, p);
+            log_ptr = OpenLogFile(data, ARP, p);
 #endif
         else
-            log_ptr = OpenLogFile(NON_IP, p);
+            log_ptr = OpenLogFile(data, NON_IP, p);
     }
     else
-        log_ptr = OpenLogFile(GENERIC_LOG, p);
+        log_ptr = OpenLogFile(data, GENERIC_LOG, p);
 
     if(!log_ptr)
         FatalError("Unable to open packet log file\n");
@@ -160,19 +261,296 @@ void LogAscii(Packet *p, void *event, uint32_t event_type, void *arg)
             PrintArpHeader(log_ptr, p);
 #endif
     }
-    if(log_ptr)
-        fclose(log_ptr);
+    /* keep the file open, but don't keep what we wrote back */
+    fflush(log_ptr);
+    data->writes++;
 }
 
 
 void LogAsciiCleanExit(int signal, void *arg)
 {
-    return;
+    LogAsciiData *data = (LogAsciiData *)arg;
+    unsigned int i;
+
+    if ( data == NULL )
+        return;
+
+    LogAsciiCloseAll(data);
+
+    LogMessage("log_ascii: %lu packets, %lu opens, %lu idle closes, %lu lru closes, "
+        "%lu directories created, %u known\n", data->writes, data->opens,
+        data->idle_closes, data->lru_closes, data->mkdirs, data->dir_count);
+
+    for ( i = 0; i < data->dir_rows; i++ )
+    {
+        while ( data->dirs[i] )
+        {
+            LogAsciiDir *dir = data->dirs[i];
+
+            data->dirs[i] = dir->hnext;
+            free(dir->path);
+            free(dir);
+        }
+    }
+    free(data->dirs);
+    free(data);
 }
 
 void LogAsciiRestart(int signal, void *arg)
 {
-    return;
+    LogAsciiCleanExit(signal, arg);
+}
+
+/* FNV-1a */
+static unsigned int LogAsciiHash(const char *s)
+{
+    unsigned int h = 2166136261u;
+
+    while ( *s )
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+
+    return h;
+}
+
+static void LogAsciiUnlinkFile(LogAsciiData *data, LogAsciiFile *f)
+{
+    LogAsciiFile **pp = &data->files[LogAsciiHash(f->path) % LOG_ASCII_ROWS];
+
+    while ( *pp != f )
+        pp = &(*pp)->hnext;
+    *pp = f->hnext;
+
+    if ( f->prev )
+        f->prev->next = f->next;
+    else
+        data->mru = f->next;
+
+    if ( f->next )
+        f->next->prev = f->prev;
+    else
+        data->lru = f->prev;
+
+    data->open_files--;
+}
+
+static void LogAsciiCloseFile(LogAsciiData *data, LogAsciiFile *f)
+{
+    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Closing file: %s\n", f->path););
+
+    LogAsciiUnlinkFile(data, f);
+    fclose(f->fh);
+    free(f->path);
+    free(f);
+}
+
+static void LogAsciiCloseAll(LogAsciiData *data)
+{
+    while ( data->lru )
+        LogAsciiCloseFile(data, data->lru);
+}
+
+/* close what hasn't been written to for a while; at most once a second */
+static void LogAsciiCloseIdle(LogAsciiData *data, time_t now)
+{
+    if ( now == data->last_sweep )
+        return;
+
+    data->last_sweep = now;
+
+    while ( data->lru && now - data->lru->last_used >= (time_t)data->idle_secs )
+    {
+        LogAsciiCloseFile(data, data->lru);
+        data->idle_closes++;
+    }
+}
+
+/*
+ * LogAsciiMkdir: creates a host directory unless we already know it is
+ * there.  Returns 0 if it was known, 1 if it had to be checked.
+ */
+static int LogAsciiMkdir(LogAsciiData *data, const char *log_path)
+{
+    LogAsciiDir *dir;
+    unsigned int h = LogAsciiHash(log_path);
+
+    for ( dir = data->dirs[h % data->dir_rows]; dir; dir = dir->hnext )
+    {
+        if ( !strcmp(dir->path, log_path) )
+            return 0;
+    }
+
+    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Creating directory: %s\n", log_path););
+
+    /* build the log directory */
+    if(mkdir(log_path, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH))
+    {
+
+        if(errno != EEXIST)
+        {
+            FatalError("OpenLogFile() => mkdir(%s) log directory: %s\n",
+                       log_path, strerror(errno));
+        }
+    }
+    else
+        data->mkdirs++;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Directory Created!\n"););
+
+    /* keep the chains short as hosts keep coming */
+    if ( data->dir_count >= data->dir_rows * 2 )
+    {
+        unsigned int rows = data->dir_rows * 2;
+        LogAsciiDir **dirs = (LogAsciiDir **) SnortAlloc(sizeof(LogAsciiDir *) * rows);
+        unsigned int i;
+
+        for ( i = 0; i < data->dir_rows; i++ )
+        {
+            while ( (dir = data->dirs[i]) )
+            {
+                unsigned int row = LogAsciiHash(dir->path) % rows;
+
+                data->dirs[i] = dir->hnext;
+                dir->hnext = dirs[row];
+                dirs[row] = dir;
+            }
+        }
+        free(data->dirs);
+        data->dirs = dirs;
+        data->dir_rows = rows;
+    }
+
+    dir = (LogAsciiDir *) SnortAlloc(sizeof(LogAsciiDir));
+    dir->path = SnortStrdup(log_path);
+    dir->hnext = data->dirs[h % data->dir_rows];
+    data->dirs[h % data->dir_rows] = dir;
+    data->dir_count++;
+
+    return 1;
+}
+
+/* forget a host directory, e.g. one removed behind our back */
+static void LogAsciiForgetDir(LogAsciiData *data, const char *log_path)
+{
+    LogAsciiDir **pp = &data->dirs[LogAsciiHash(log_path) % data->dir_rows];
+
+    while ( *pp )
+    {
+        LogAsciiDir *dir = *pp;
+
+        if ( !strcmp(dir->path, log_path) )
+        {
+            *pp = dir->hnext;
+            free(dir->path);
+            free(dir);
+            data->dir_count--;
+            return;
+        }
+        pp = &dir->hnext;
+    }
+}
+
+/*
+ * LogAsciiGetFile: returns the open log file for log_file, opening it
+ * (and making room for it) if it isn't open yet.  log_path is the host
+ * directory it lives in, or NULL if it goes straight into the log dir.
+ */
+static FILE *LogAsciiGetFile(LogAsciiData *data, const char *log_path, const char *log_file)
+{
+    LogAsciiFile *f;
+    unsigned int row = LogAsciiHash(log_file) % LOG_ASCII_ROWS;
+    time_t now = time(NULL);
+    FILE *fh;
+
+    LogAsciiCloseIdle(data, now);
+
+    for ( f = data->files[row]; f; f = f->hnext )
+    {
+        if ( !strcmp(f->path, log_file) )
+            break;
+    }
+
+    if ( f )
+    {
+        /* move to the front of the lru list */
+        if ( f != data->mru )
+        {
+            f->prev->next = f->next;
+
+            if ( f->next )
+                f->next->prev = f->prev;
+            else
+                data->lru = f->prev;
+
+            f->prev = NULL;
+            f->next = data->mru;
+            data->mru->prev = f;
+            data->mru = f;
+        }
+        f->last_used = now;
+        return f->fh;
+    }
+
+    if ( log_path )
+        LogAsciiMkdir(data, log_path);
+
+    if ( data->open_files >= data->max_open )
+    {
+        LogAsciiCloseFile(data, data->lru);
+        data->lru_closes++;
+    }
+
+    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Opening file: %s\n", log_file););
+
+    /* finally open the log file */
+    while ( !(fh = fopen(log_file, "a")) )
+    {
+        if ( (errno == EMFILE || errno == ENFILE) && data->lru )
+        {
+            /* we're not the only ones with open files, give some back */
+            LogAsciiCloseFile(data, data->lru);
+            data->lru_closes++;
+        }
+        else if ( errno == ENOENT && log_path )
+        {
+            /* the directory went away (log cleanup?), make it again */
+            LogAsciiForgetDir(data, log_path);
+
+            if ( !LogAsciiMkdir(data, log_path) )
+                break;
+
+            log_path = NULL;
+        }
+        else
+            break;
+    }
+
+    if ( !fh )
+    {
+        FatalError("OpenLogFile() => fopen(%s) log file: %s\n",
+                   log_file, strerror(errno));
+    }
+
+    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "File opened...\n"););
+
+    f = (LogAsciiFile *) SnortAlloc(sizeof(LogAsciiFile));
+    f->path = SnortStrdup(log_file);
+    f->fh = fh;
+    f->last_used = now;
+
+    f->hnext = data->files[row];
+    data->files[row] = f;
+
+    f->next = data->mru;
+    if ( data->mru )
+        data->mru->prev = f;
+    else
+        data->lru = f;
+    data->mru = f;
+
+    data->open_files++;
+    data->opens++;
+
+    return fh;
 }
 
 static char *logfile[] =
@@ -181,21 +559,22 @@ static char *logfile[] =
 /*
  * Function: OpenLogFile()
  *
- * Purpose: Create the log directory and file to put the packet log into.
- *          This function sucks, I've got to find a better way to do this
- *          this stuff.
+ * Purpose: Works out the log directory and file to put the packet log
+ *          into and returns it from the cache of open files, creating
+ *          and opening them if needed.
  *
- * Arguments: None.
+ * Arguments: data => plugin data
+ *            mode => log file type
+ *            p    => packet
  *
  * Returns: FILE pointer on success, else NULL
  */
-FILE *OpenLogFile(int mode, Packet * p)
+static FILE *OpenLogFile(LogAsciiData *data, int mode, Packet * p)
 {
     char log_path[STD_BUF]; /* path to log file */
     char log_file[STD_BUF]; /* name of log file */
     char proto[5];      /* logged packet protocol */
     char suffix[5];     /* filename suffix */
-    FILE *log_ptr = NULL;
 #ifdef SUP_IP6
     snort_ip_p ip;
 #endif
@@ -216,14 +595,7 @@ FILE *OpenLogFile(int mode, Packet * p)
     {
         SnortSnprintf(log_file, STD_BUF, "%s/%s", barnyard2_conf->log_dir, logfile[mode]);
 
-        log_ptr = fopen(log_file, "a");
-        if (!log_ptr)
-        {
-            FatalError("OpenLogFile() => fopen(%s) log file: %s\n",
-                       log_file, strerror(errno));
-        }
-
-        return log_ptr;
+        return LogAsciiGetFile(data, NULL, log_file);
     }
 
 #ifdef SUP_IP6
@@ -283,21 +655,6 @@ FILE *OpenLogFile(int mode, Packet * p)
         }
     }
 
-    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Creating directory: %s\n", log_path););
-
-    /* build the log directory */
-    if(mkdir(log_path, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH))
-    {
-
-        if(errno != EEXIST)
-        {
-            FatalError("OpenLogFile() => mkdir(%s) log directory: %s\n",
-                       log_path, strerror(errno));
-        }
-    }
-
-    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Directory Created!\n"););
-
     /* build the log filename */
     if(GET_IPH_PROTO(p) == IPPROTO_TCP ||
             GET_IPH_PROTO(p) == IPPROTO_UDP)
@@ -351,18 +708,7 @@ FILE *OpenLogFile(int mode, Packet * p)
         }
     }
 
-    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Opening file: %s\n", log_file););
-
-    /* finally open the log file */
-    log_ptr = fopen(log_file, "a");
-    if (!log_ptr)
-    {
-        FatalError("OpenLogFile() => fopen(%s) log file: %s\n",
-                   log_file, strerror(errno));
-    }
-
-    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "File opened...\n"););
-    return log_ptr;
+    return LogAsciiGetFile(data, log_path, log_file);
 }
 
 
@@ -39,6 +39,16 @@
  *
  * First logger...
  *
+ * Records are formatted straight into large page aligned buffers owned
+ * by the plugin.  Full buffers (or a partially filled one once the flush
+ * interval expires) are handed to a writer thread which pushes them out
+ * with writev() and rolls the file on size, age or linktype change, so
+ * the output thread never blocks on the disk.
+ *
+ * With the "pcapng" option the file is written as pcapng and every new
+ * linktype seen gets its own interface description block, so mixed
+ * linktype traffic ends up in one file instead of forcing a roll.
+ *
  */
 
 #ifdef HAVE_CONFIG_H
@@ -52,13 +62,19 @@
 #endif
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <pcap.h>
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "decode.h"
 #include "mstring.h"
@@ -72,11 +88,19 @@
 #include "squirrel.h"
 
 /* For the traversal of reassembled packets */
+#define K_BYTES (1024)
 #define M_BYTES (1024*1024)
 
 #define DEFAULT_FILE  "barnyard2.tcpdump.log"
 #define DEFAULT_LIMIT (128*M_BYTES)
 
+#define DEFAULT_BUF_SIZE    (1*M_BYTES)
+#define MIN_BUF_SIZE        (128*K_BYTES)   /* must hold the biggest record */
+#define DEFAULT_BUF_CNT     8
+#define DEFAULT_FLUSH_MS    1000
+#define PCAP_BUF_ALIGN      4096
+#define PCAP_IOV_MAX        64
+
 /*
  * <pcap file> ::= <pcap file hdr> [<pcap pkt hdr> <packet>]*
  * on 64 bit systems, some fields in the <pcap * hdr> are 8 bytes
@@ -87,12 +111,36 @@
 
 #define PCAP_FILE_HDR_SZ (24)
 #define PCAP_PKT_HDR_SZ  (16)
+#define PCAP_MAGIC       0xa1b2c3d4
+
+/*
+ * <pcapng file> ::= <SHB> <IDB>* [<IDB> | <EPB>]*
+ * interface ids are assigned in the order linktypes are first seen
+ * and stay valid across rolls since every new file re-declares them.
+ */
+#define PCAPNG_SHB_TYPE     0x0A0D0D0A
+#define PCAPNG_IDB_TYPE     0x00000001
+#define PCAPNG_EPB_TYPE     0x00000006
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+#define PCAPNG_SHB_SZ       (28)
+#define PCAPNG_IDB_SZ       (20)
+#define PCAPNG_EPB_HDR_SZ   (32)
+#define PCAPNG_MAX_IF       16
+
+#define PCAP_PAD4(len)      (((len) + 3) & ~3)
+
+typedef struct _PcapBuf
+{
+    uint8_t             *data;
+    size_t              len;
+    uint32_t            if_base;    /* pcapng interfaces declared before this buffer */
+    int                 linktype;   /* linktype of a classic file opened for it */
+    uint8_t             roll;       /* start a new file before writing it */
+} PcapBuf;
 
 typedef struct _LogTcpdumpData
 {
     char                *filename;
-    pcap_t              *pd;	       /* pcap handle */
-    pcap_dumper_t       *dumpd;
     time_t              lastTime;
     size_t              size;
     size_t              limit;
@@ -100,6 +148,34 @@ typedef struct _LogTcpdumpData
 
     int                 autolink;
     int                 linktype;
+
+    /* output engine */
+    int                 fd;
+    int                 pcapng;
+    uint32_t            roll_secs;      /* 0, roll on size only */
+    uint32_t            flush_ms;
+    size_t              buf_size;
+    uint32_t            buf_cnt;
+    PcapBuf             *bufs;
+    uint32_t            buf_prod;       /* buffer being filled */
+    uint32_t            buf_cons;       /* next buffer to be written */
+    struct timeval      buf_sealed;     /* last time a buffer was handed over */
+    uint32_t            roll_seq;
+
+    int                 if_linktype[PCAPNG_MAX_IF];
+    uint32_t            if_cnt;
+
+    uint8_t             writer_on;
+    uint8_t             writer_stop;
+    pthread_t           writer_tid;
+    pthread_mutex_t     buf_lock;
+    pthread_cond_t      buf_full;
+    pthread_cond_t      buf_free;
+
+    uint64_t            pkts;
+    uint64_t            bytes;
+    uint64_t            writes;
+    uint32_t            files;
 } LogTcpdumpData;
 
 /* list of function prototypes for this preprocessor */
@@ -108,11 +184,14 @@ static LogTcpdumpData *ParseTcpdumpArgs(char *);
 static void LogTcpdump(Packet *, void *, uint32_t, void *);
 static void TcpdumpInitLogFileFinalize(int unused, void *arg);
 static void TcpdumpInitLogFile(LogTcpdumpData *, int);
-static void TcpdumpRollLogFile(LogTcpdumpData*);
+static void TcpdumpRollLogFile(LogTcpdumpData *, PcapBuf *);
 static void SpoLogTcpdumpCleanExitFunc(int, void *);
 static void SpoLogTcpdumpRestartFunc(int, void *);
 static void LogTcpdumpSingle(Packet *, void *, uint32_t, void *);
 static void LogTcpdumpStream(Packet *, void *, uint32_t, void *);
+static void TcpdumpAppend(LogTcpdumpData *, const struct timeval *,
+        uint32_t, uint32_t, const uint8_t *, int);
+static void *TcpdumpWriter_T(void *);
 
 
 /* If you need to instantiate the plugin's data structure, do it here */
@@ -170,12 +249,42 @@ static void LogTcpdumpInit(char *args)
     AddFuncToRestartList(SpoLogTcpdumpRestartFunc, data);
 }
 
+/*
+ * Function: ParseTcpdumpSize(const char *)
+ *
+ * Purpose: Convert <number>('G'|'M'|K') into bytes
+ */
+static size_t ParseTcpdumpSize(const char *tok)
+{
+    char *end;
+    size_t value = strtol(tok, &end, 10);
+
+    if ( tok == end )
+        FatalError("log_tcpdump error in %s(%i): %s\n",
+            file_name, file_line, tok);
+
+    if ( end && toupper(*end) == 'G' )
+        value <<= 30; /* GB */
+
+    else if ( end && toupper(*end) == 'M' )
+        value <<= 20; /* MB */
+
+    else if ( end && toupper(*end) == 'K' )
+        value <<= 10; /* KB */
+
+    return value;
+}
+
 /*
  * Function: ParseTcpdumpArgs(char *)
  *
  * Purpose: Process positional args, if any.  Syntax is:
- * output log_tcpdump: [<logpath> [<limit>]]
+ * output log_tcpdump: [<logpath> [<limit> [<linktype>]]] [<option>]*
  * limit ::= <number>('G'|'M'|K')
+ * option ::= "pcapng" | "buffer="<limit> | "buffers="<number>
+ *          | "flush="<msec> | "roll="<sec>
+ *
+ * Options may appear anywhere, they do not count as positional args.
  *
  * Arguments: args => argument list
  *
@@ -186,7 +295,7 @@ static LogTcpdumpData *ParseTcpdumpArgs(char *args)
     char **toks;
     int num_toks;
     LogTcpdumpData *data;
-    int i;
+    int i, pos;
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG, "ParseTcpdumpArgs: %s\n", args););
     data = (LogTcpdumpData *) SnortAlloc(sizeof(LogTcpdumpData));
@@ -197,6 +306,10 @@ static LogTcpdumpData *ParseTcpdumpArgs(char *args)
     }
     data->filename = NULL;
     data->limit = DEFAULT_LIMIT;
+    data->fd = -1;
+    data->buf_size = DEFAULT_BUF_SIZE;
+    data->buf_cnt = DEFAULT_BUF_CNT;
+    data->flush_ms = DEFAULT_FLUSH_MS;
 
     /* by default we will auto adapt to the link type and assume ethernet */
     data->linktype = DLT_EN10MB;
@@ -207,32 +320,44 @@ static LogTcpdumpData *ParseTcpdumpArgs(char *args)
 
     toks = mSplit((char*)args, " \t", 0, &num_toks, '\\');
 
-    for (i = 0; i < num_toks; i++)
+    for (i = 0, pos = 0; i < num_toks; i++)
     {
         const char* tok = toks[i];
-        char *end;
 
-        switch (i)
+        if ( !strcasecmp(tok, "pcapng") )
+        {
+            data->pcapng = 1;
+            continue;
+        }
+        else if ( !strncasecmp(tok, "buffer=", 7) )
+        {
+            data->buf_size = ParseTcpdumpSize(tok + 7);
+            continue;
+        }
+        else if ( !strncasecmp(tok, "buffers=", 8) )
+        {
+            data->buf_cnt = strtoul(tok + 8, NULL, 10);
+            continue;
+        }
+        else if ( !strncasecmp(tok, "flush=", 6) )
+        {
+            data->flush_ms = strtoul(tok + 6, NULL, 10);
+            continue;
+        }
+        else if ( !strncasecmp(tok, "roll=", 5) )
+        {
+            data->roll_secs = strtoul(tok + 5, NULL, 10);
+            continue;
+        }
+
+        switch (pos++)
         {
             case 0:
                 data->filename = SnortStrdup(tok);
                 break;
 
             case 1:
-                data->limit = strtol(tok, &end, 10);
-
-                if ( tok == end )
-                    FatalError("log_tcpdump error in %s(%i): %s\n",
-                        file_name, file_line, tok);
-
-                if ( end && toupper(*end) == 'G' )
-                    data->limit <<= 30; /* GB */
-
-                else if ( end && toupper(*end) == 'M' )
-                    data->limit <<= 20; /* MB */
-
-                else if ( end && toupper(*end) == 'K' )
-                    data->limit <<= 10; /* KB */
+                data->limit = ParseTcpdumpSize(tok);
                 break;
 
             case 2:
@@ -325,6 +450,16 @@ static LogTcpdumpData *ParseTcpdumpArgs(char *args)
     if ( data->filename == NULL )
         data->filename = SnortStrdup(DEFAULT_FILE);
 
+    if ( data->buf_size < MIN_BUF_SIZE )
+        data->buf_size = MIN_BUF_SIZE;
+
+    if ( data->buf_cnt < 2 )
+        data->buf_cnt = 2;
+
+    /* a roll has to leave room for at least one full buffer */
+    if ( data->limit < data->buf_size )
+        data->limit = data->buf_size;
+
     DEBUG_WRAP(DebugMessage(
         DEBUG_INIT, "log_tcpdump: '%s' %ld\n", data->filename, data->limit
     ););
@@ -358,100 +493,268 @@ static void LogTcpdump(Packet *p, void *event, uint32_t event_type, void *arg)
     }
 }
 
-static INLINE size_t SizeOf_pcaphdr (const struct pcap_pkthdr *pkth)
+static void LogTcpdumpSingle(Packet *p, void *event, uint32_t event_type, void *arg)
 {
-    return PCAP_PKT_HDR_SZ + pkth->caplen;
+    LogTcpdumpData *data = (LogTcpdumpData *)arg;
+
+    if ( p->pkth == NULL || p->pkt == NULL )
+        return;
+
+    TcpdumpAppend(data, &p->pkth->ts, p->pkth->caplen, p->pkth->pktlen,
+            p->pkt, p->linktype);
 }
 
-static inline size_t SizeOf (const DAQ_PktHdr_t *pkth)
+static void LogTcpdumpStream(Packet *p, void *event, uint32_t event_type, void *arg)
 {
-    return PCAP_PKT_HDR_SZ + pkth->caplen;
+    /* reassembled segments are only reachable through the stream api,
+     * which barnyard2 doesn't have, so there is nothing to write here */
+
+//    if (stream_api)
+//        stream_api->traverse_reassembled(p, LogTcpdumpStreamCallback, data);
 }
 
-static void LogTcpdumpSingle(Packet *p, void *event, uint32_t event_type, void *arg)
+/*
+ * Function: TcpdumpSeal(LogTcpdumpData *)
+ *
+ * Purpose: Hand the buffer being filled over to the writer thread and start
+ *          filling the next one, waiting for the writer if all buffers are
+ *          in flight.  Must be called with buf_lock held.
+ */
+static void TcpdumpSeal(LogTcpdumpData *data)
 {
-    LogTcpdumpData *data = (LogTcpdumpData *)arg;
-    size_t dumpSize = SizeOf(p->pkth);
-
-    /* roll log file packet linktype is different to the dump linktype and in automode */
-
-//    if ( data->linktype != p->linktype )
-//    {
-//        if ( data->autolink == 1)
-//        {
-//            data->linktype = p->linktype;
-//            TcpdumpRollLogFile(data);
-//        }
-        /* otherwise alert that the results will not be as expected */
-//        else
-//        {
-//            LogMessage("tcpdump:  packet linktype is not compatible with dump linktype.\n");
-//        }
-//    }
-
-    /* roll log file if size limit is exceeded */
-//    else if ( data->size + dumpSize > data->limit )
-//        TcpdumpRollLogFile(data);
-
-    pcap_dump((u_char *)data->dumpd, (struct pcap_pkthdr *)p->pkth, p->pkt);
-    data->size += dumpSize;
-
-    if (!BcLineBufferedLogging())
-    { 
-#ifdef WIN32
-        fflush( NULL );  /* flush all open output streams */
-#else
-        /* we happen to know that pcap_dumper_t* is really just a FILE* */
-        fflush( (FILE*) data->dumpd );
-#endif
+    PcapBuf *buf = &data->bufs[data->buf_prod];
+    uint32_t next;
+
+    if ( buf->len == 0 )
+        return;
+
+    next = (data->buf_prod + 1) % data->buf_cnt;
+
+    while ( next == data->buf_cons && data->writer_on )
+        pthread_cond_wait(&data->buf_free, &data->buf_lock);
+
+    if ( !data->writer_on )
+    {
+        buf->len = 0;
+        return;
+    }
+
+    data->buf_prod = next;
+
+    buf = &data->bufs[next];
+    buf->len = 0;
+    buf->roll = 0;
+    buf->linktype = data->linktype;
+    buf->if_base = data->if_cnt;
+
+    gettimeofday(&data->buf_sealed, NULL);
+    pthread_cond_signal(&data->buf_full);
+}
+
+/*
+ * Function: TcpdumpReserve(LogTcpdumpData *, size_t)
+ *
+ * Purpose: Return room for a record of len bytes in the current buffer,
+ *          sealing it first when the record doesn't fit.  Must be called
+ *          with buf_lock held.
+ */
+static uint8_t *TcpdumpReserve(LogTcpdumpData *data, size_t len)
+{
+    PcapBuf *buf = &data->bufs[data->buf_prod];
+    uint8_t *rec;
+
+    if ( buf->len + len > data->buf_size )
+    {
+        TcpdumpSeal(data);
+        buf = &data->bufs[data->buf_prod];
     }
+
+    rec = buf->data + buf->len;
+    buf->len += len;
+
+    return rec;
 }
 
-static void LogTcpdumpStream(Packet *p, void *event, uint32_t event_type, void *arg)
+/*
+ * Function: TcpdumpAppend()
+ *
+ * Purpose: Format one packet record straight into the current buffer.
+ *          For pcapng an interface description block is emitted first
+ *          whenever a new linktype shows up; for classic pcap a linktype
+ *          change in autolink mode rolls the file.
+ */
+static void TcpdumpAppend(LogTcpdumpData *data, const struct timeval *ts,
+        uint32_t caplen, uint32_t pktlen, const uint8_t *pkt, int linktype)
 {
-    LogTcpdumpData *data = (LogTcpdumpData *)arg;
-    size_t dumpSize = 0;
+    uint8_t *rec;
+    uint32_t *hdr;
+    uint32_t if_id;
+    uint64_t usec;
+    size_t max_cap;
 
-//    if (stream_api)
-//        stream_api->traverse_reassembled(p, SizeOfCallback, &dumpSize);
+    if ( data == NULL || data->bufs == NULL )
+        return;
 
-    if ( data->size + dumpSize > data->limit )
-        TcpdumpRollLogFile(data);
+    pthread_mutex_lock(&data->buf_lock);
 
-//    if (stream_api)
-//        stream_api->traverse_reassembled(p, LogTcpdumpStreamCallback, data);
+    if ( data->pcapng )
+    {
+        for ( if_id = 0; if_id < data->if_cnt; if_id++ )
+        {
+            if ( data->if_linktype[if_id] == linktype )
+                break;
+        }
 
-    data->size += dumpSize;
+        if ( if_id == data->if_cnt )
+        {
+            if ( data->if_cnt == PCAPNG_MAX_IF )
+            {
+                pthread_mutex_unlock(&data->buf_lock);
+                return;
+            }
+
+            hdr = (uint32_t *)TcpdumpReserve(data, PCAPNG_IDB_SZ);
+            hdr[0] = PCAPNG_IDB_TYPE;
+            hdr[1] = PCAPNG_IDB_SZ;
+            hdr[2] = (uint32_t)(linktype & 0xffff);  /* reserved half is zero */
+            hdr[3] = PKT_SNAPLEN;
+            hdr[4] = PCAPNG_IDB_SZ;
+
+            data->if_linktype[data->if_cnt++] = linktype;
+        }
 
-    if (!BcLineBufferedLogging())
-    { 
-#ifdef WIN32
-        fflush( NULL );  /* flush all open output streams */
-#else
-        /* we happen to know that pcap_dumper_t* is really just a FILE* */
-        fflush( (FILE*) data->dumpd );
-#endif
+        max_cap = data->buf_size - PCAPNG_EPB_HDR_SZ;
+        if ( caplen > max_cap )
+            caplen = max_cap & ~3;
+
+        rec = TcpdumpReserve(data, PCAPNG_EPB_HDR_SZ + PCAP_PAD4(caplen));
+        hdr = (uint32_t *)rec;
+        usec = (uint64_t)ts->tv_sec * 1000000 + ts->tv_usec;
+
+        hdr[0] = PCAPNG_EPB_TYPE;
+        hdr[1] = PCAPNG_EPB_HDR_SZ + PCAP_PAD4(caplen);
+        hdr[2] = if_id;
+        hdr[3] = (uint32_t)(usec >> 32);
+        hdr[4] = (uint32_t)usec;
+        hdr[5] = caplen;
+        hdr[6] = pktlen;
+        memcpy(rec + 28, pkt, caplen);
+        memset(rec + 28 + caplen, 0, PCAP_PAD4(caplen) - caplen);
+        *(uint32_t *)(rec + 28 + PCAP_PAD4(caplen)) = hdr[1];
+    }
+    else
+    {
+        /* roll log file packet linktype is different to the dump linktype and in automode */
+        if ( data->linktype != linktype && data->autolink == 1 )
+        {
+            data->linktype = linktype;
+            TcpdumpSeal(data);
+            data->bufs[data->buf_prod].roll = 1;
+            data->bufs[data->buf_prod].linktype = linktype;
+        }
+
+        max_cap = data->buf_size - PCAP_PKT_HDR_SZ;
+        if ( caplen > max_cap )
+            caplen = max_cap;
+
+        rec = TcpdumpReserve(data, PCAP_PKT_HDR_SZ + caplen);
+        hdr = (uint32_t *)rec;
+
+        hdr[0] = (uint32_t)ts->tv_sec;
+        hdr[1] = (uint32_t)ts->tv_usec;
+        hdr[2] = caplen;
+        hdr[3] = pktlen;
+        memcpy(rec + PCAP_PKT_HDR_SZ, pkt, caplen);
     }
+
+    data->pkts++;
+
+    pthread_mutex_unlock(&data->buf_lock);
 }
 
-static void TcpdumpInitLogFileFinalize(int unused, void *arg)
+/*
+ * Function: TcpdumpWriteHeader()
+ *
+ * Purpose: Write the file header for a buffer which starts a new file; the
+ *          pcapng header re-declares every interface the buffer refers to
+ *          but doesn't declare itself.
+ */
+static int TcpdumpWriteHeader(LogTcpdumpData *data, int linktype, uint32_t if_base)
 {
-    TcpdumpInitLogFile((LogTcpdumpData *)arg, BcNoOutputTimestamp());
+    uint32_t hdr[(PCAPNG_SHB_SZ + PCAPNG_MAX_IF * PCAPNG_IDB_SZ) / 4];
+    size_t len;
+    uint32_t i;
+    ssize_t ret;
+
+    if ( data->pcapng )
+    {
+        hdr[0] = PCAPNG_SHB_TYPE;
+        hdr[1] = PCAPNG_SHB_SZ;
+        hdr[2] = PCAPNG_BYTE_ORDER;
+        hdr[3] = 1;                 /* major 1, minor 0 */
+        hdr[4] = 0xffffffff;        /* section length unknown */
+        hdr[5] = 0xffffffff;
+        hdr[6] = PCAPNG_SHB_SZ;
+        len = PCAPNG_SHB_SZ;
+
+        for ( i = 0; i < if_base; i++ )
+        {
+            uint32_t *idb = &hdr[len / 4];
+
+            idb[0] = PCAPNG_IDB_TYPE;
+            idb[1] = PCAPNG_IDB_SZ;
+            idb[2] = (uint32_t)(data->if_linktype[i] & 0xffff);
+            idb[3] = PKT_SNAPLEN;
+            idb[4] = PCAPNG_IDB_SZ;
+            len += PCAPNG_IDB_SZ;
+        }
+    }
+    else
+    {
+        hdr[0] = PCAP_MAGIC;
+        hdr[1] = 2 | (4 << 16);     /* version 2.4 */
+        hdr[2] = 0;                 /* thiszone */
+        hdr[3] = 0;                 /* sigfigs */
+        hdr[4] = PKT_SNAPLEN;
+        hdr[5] = (uint32_t)linktype;
+        len = PCAP_FILE_HDR_SZ;
+    }
+
+    do
+    {
+        ret = write(data->fd, hdr, len);
+    } while ( ret < 0 && errno == EINTR );
+
+    if ( ret != (ssize_t)len )
+    {
+        LogMessage("log_tcpdump: unable to write header to \"%s\": %s\n",
+                data->logdir, strerror(errno));
+        return -1;
+    }
+
+    data->size = len;
+    data->bytes += len;
+
+    return 0;
 }
 
 /*
- * Function: TcpdumpInitLogFile()
+ * Function: TcpdumpOpenLogFile()
  *
- * Purpose: Initialize the tcpdump log file header
- *
- * Arguments: data => pointer to the plugin's reference data struct 
- *
- * Returns: void function
+ * Purpose: Build the next file name and open it.  Time stamped names get a
+ *          sequence suffix when more than one file is opened per second.
  */
-static void TcpdumpInitLogFile(LogTcpdumpData *data, int nostamps)
+static int TcpdumpOpenLogFile(LogTcpdumpData *data, int nostamps)
 {
     int value;
-    data->lastTime = time(NULL);
+    time_t now = time(NULL);
+
+    if ( now <= data->lastTime )
+        data->roll_seq++;
+    else
+        data->roll_seq = 0;
+
+    data->lastTime = now > data->lastTime ? now : data->lastTime;
 
     if (nostamps)
     {
@@ -461,7 +764,7 @@ static void TcpdumpInitLogFile(LogTcpdumpData *data, int nostamps)
             value = SnortSnprintf(data->logdir, STD_BUF, "%s/%s", barnyard2_conf->log_dir, 
                                   data->filename);
     }
-    else 
+    else if ( data->roll_seq == 0 )
     {
         if(data->filename[0] == '/')
             value = SnortSnprintf(data->logdir, STD_BUF, "%s.%lu", data->filename, 
@@ -470,53 +773,317 @@ static void TcpdumpInitLogFile(LogTcpdumpData *data, int nostamps)
             value = SnortSnprintf(data->logdir, STD_BUF, "%s/%s.%lu", barnyard2_conf->log_dir, 
                                   data->filename, (uint32_t)data->lastTime);
     }
+    else
+    {
+        if(data->filename[0] == '/')
+            value = SnortSnprintf(data->logdir, STD_BUF, "%s.%lu.%u", data->filename, 
+                                  (uint32_t)data->lastTime, data->roll_seq);
+        else
+            value = SnortSnprintf(data->logdir, STD_BUF, "%s/%s.%lu.%u", barnyard2_conf->log_dir, 
+                                  data->filename, (uint32_t)data->lastTime, data->roll_seq);
+    }
 
     if(value != SNORT_SNPRINTF_SUCCESS)
         FatalError("log file logging path and file name are too long\n");
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG, "Opening %s\n", data->logdir););
 
-    if(!BcTestMode())
+    data->fd = open(data->logdir, O_WRONLY | O_CREAT | O_TRUNC,
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    data->size = 0;
+
+    if ( data->fd < 0 )
+        return -1;
+
+    data->files++;
+
+    return 0;
+}
+
+/*
+ * Function: TcpdumpInitLogFile()
+ *
+ * Purpose: Initialize the tcpdump log file header, the output buffers and
+ *          the writer thread
+ *
+ * Arguments: data => pointer to the plugin's reference data struct 
+ *
+ * Returns: void function
+ */
+static void TcpdumpInitLogFile(LogTcpdumpData *data, int nostamps)
+{
+    uint32_t i;
+    int err;
+
+    if(BcTestMode())
+        return;
+
+    if ( TcpdumpOpenLogFile(data, nostamps) )
     {
-        data->pd = pcap_open_dead(data->linktype, PKT_SNAPLEN);
-        data->dumpd = pcap_dump_open(data->pd, data->logdir);
+        FatalError("log_tcpdump: Failed to open log file \"%s\": %s\n",
+                   data->logdir, strerror(errno));
+    }
+
+    if ( TcpdumpWriteHeader(data, data->linktype, 0) )
+        FatalError("log_tcpdump: Failed to initialize log file \"%s\"\n",
+                   data->logdir);
+
+    data->bufs = (PcapBuf *)SnortAlloc(sizeof(PcapBuf) * data->buf_cnt);
 
-        if(data->dumpd == NULL)
+    for ( i = 0; i < data->buf_cnt; i++ )
+    {
+        if ( posix_memalign((void **)&data->bufs[i].data, PCAP_BUF_ALIGN,
+                    data->buf_size) )
         {
-            FatalError("log_tcpdump: Failed to open log file \"%s\": %s\n",
-                       data->logdir, strerror(errno));
+            FatalError("log_tcpdump: unable to allocate %u output buffers of %lu bytes\n",
+                       data->buf_cnt, (unsigned long)data->buf_size);
         }
     }
 
-    data->size = PCAP_FILE_HDR_SZ;
+    data->buf_prod = 0;
+    data->buf_cons = 0;
+    data->bufs[0].linktype = data->linktype;
+    gettimeofday(&data->buf_sealed, NULL);
+
+    pthread_mutex_init(&data->buf_lock, NULL);
+    pthread_cond_init(&data->buf_full, NULL);
+    pthread_cond_init(&data->buf_free, NULL);
+
+    data->writer_on = 1;
+    err = pthread_create(&data->writer_tid, NULL, &TcpdumpWriter_T, data);
+    if ( 0 != err )
+    {
+        FatalError("log_tcpdump: Can't create writer thread: [%s]\n",
+                   strerror(err));
+    }
+
+    LogMessage("log_tcpdump: %s \"%s\", %u buffers of %lu KB, flush %u ms, roll %lu MB/%u s\n",
+            data->pcapng ? "pcapng" : "pcap", data->logdir, data->buf_cnt,
+            (unsigned long)(data->buf_size >> 10), data->flush_ms,
+            (unsigned long)(data->limit >> 20), data->roll_secs);
 }
 
-static void TcpdumpRollLogFile(LogTcpdumpData* data)
+static void TcpdumpInitLogFileFinalize(int unused, void *arg)
 {
-    time_t now = time(NULL);
+    TcpdumpInitLogFile((LogTcpdumpData *)arg, BcNoOutputTimestamp());
+}
 
-    /* don't roll over any sooner than resolution
-     * of filename discriminator
-     */
-    if ( now <= data->lastTime ) return;
+/*
+ * Function: TcpdumpRollLogFile()
+ *
+ * Purpose: Start a new file before writing buf, called on the writer thread.
+ *          A file which didn't get any packet yet is simply rewritten.
+ */
+static void TcpdumpRollLogFile(LogTcpdumpData* data, PcapBuf *buf)
+{
+    size_t hdr_size = data->pcapng ? PCAPNG_SHB_SZ : PCAP_FILE_HDR_SZ;
 
-    /* close the output file */
-    if( data->dumpd != NULL )
+    if ( data->fd >= 0 && data->size <= hdr_size && !data->pcapng )
     {
-        pcap_dump_close(data->dumpd);
-        data->dumpd = NULL;
-        data->size = 0;
+        if ( ftruncate(data->fd, 0) == 0 && lseek(data->fd, 0, SEEK_SET) == 0 )
+        {
+            TcpdumpWriteHeader(data, buf->linktype, buf->if_base);
+            return;
+        }
     }
 
-    /* close the pcap */
-    if (data->pd != NULL)
+    /* close the output file */
+    if ( data->fd >= 0 )
     {
-        pcap_close(data->pd);
-        data->pd = NULL;
+        close(data->fd);
+        data->fd = -1;
     }
 
     /* Have to add stamps now to distinguish files */
-    TcpdumpInitLogFile(data, 0);
+    if ( TcpdumpOpenLogFile(data, 0) )
+    {
+        LogMessage("log_tcpdump: Failed to open log file \"%s\": %s\n",
+                   data->logdir, strerror(errno));
+        return;
+    }
+
+    TcpdumpWriteHeader(data, buf->linktype, buf->if_base);
+}
+
+/*
+ * Function: TcpdumpWritev()
+ *
+ * Purpose: Push a batch of buffers out, dealing with short writes
+ */
+static void TcpdumpWritev(LogTcpdumpData *data, struct iovec *iov, int cnt)
+{
+    ssize_t ret;
+
+    if ( data->fd < 0 )
+        return;
+
+    while ( cnt > 0 )
+    {
+        ret = writev(data->fd, iov, cnt);
+
+        if ( ret < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            LogMessage("log_tcpdump: write to \"%s\" failed: %s\n",
+                    data->logdir, strerror(errno));
+            return;
+        }
+
+        data->size += ret;
+        data->bytes += ret;
+
+        while ( cnt > 0 && (size_t)ret >= iov->iov_len )
+        {
+            ret -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+
+        if ( cnt > 0 )
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    data->writes++;
+}
+
+/* the buffer being filled has waited flush_ms since the last seal */
+static int TcpdumpFlushDue(LogTcpdumpData *data, struct timeval *now)
+{
+    return (int64_t)(now->tv_sec - data->buf_sealed.tv_sec) * 1000
+            + (now->tv_usec - data->buf_sealed.tv_usec) / 1000
+            >= (int64_t)data->flush_ms;
+}
+
+/*
+ * Function: TcpdumpWriter_T()
+ *
+ * Purpose: Writer thread.  Waits for sealed buffers, seals a partially
+ *          filled one once the flush interval expired, rolls the file on
+ *          size/age/linktype and writes as many buffers as possible with
+ *          a single writev().
+ */
+static void *TcpdumpWriter_T(void *arg)
+{
+    LogTcpdumpData *data = (LogTcpdumpData *)arg;
+    struct iovec iov[PCAP_IOV_MAX];
+    struct timeval now;
+    struct timespec deadline;
+    sigset_t set;
+    PcapBuf *buf;
+    uint32_t idx;
+    size_t total;
+    uint8_t roll;
+    int cnt;
+
+    sigemptyset(&set);
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    pthread_mutex_lock(&data->buf_lock);
+
+    while ( 1 )
+    {
+        if ( data->buf_cons == data->buf_prod )
+        {
+            if ( data->writer_stop )
+                break;
+
+            gettimeofday(&now, NULL);
+            if ( data->flush_ms )
+            {
+                /* an empty buffer has nothing to age, the interval starts
+                 * over from now; buf_sealed stays put until it fills */
+                if ( data->bufs[data->buf_prod].len > 0 )
+                {
+                    if ( TcpdumpFlushDue(data, &now) )
+                    {
+                        TcpdumpSeal(data);
+                        continue;
+                    }
+                    now = data->buf_sealed;
+                }
+                deadline.tv_sec = now.tv_sec + data->flush_ms / 1000;
+                deadline.tv_nsec = (now.tv_usec
+                        + (data->flush_ms % 1000) * 1000) * 1000;
+            }
+            else
+            {
+                deadline.tv_sec = now.tv_sec + 1;
+                deadline.tv_nsec = now.tv_usec * 1000;
+            }
+
+            if ( deadline.tv_nsec >= 1000000000 )
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+
+            pthread_cond_timedwait(&data->buf_full, &data->buf_lock, &deadline);
+
+            if ( data->buf_cons == data->buf_prod && data->flush_ms
+                    && data->bufs[data->buf_prod].len > 0 )
+            {
+                gettimeofday(&now, NULL);
+                if ( TcpdumpFlushDue(data, &now) )
+                    TcpdumpSeal(data);
+            }
+            continue;
+        }
+
+        /* collect the sealed buffers, a buffer which starts a new file
+         * always comes first in a batch */
+        idx = data->buf_cons;
+        buf = &data->bufs[idx];
+        roll = buf->roll;
+
+        if ( !roll && data->size > (data->pcapng ? PCAPNG_SHB_SZ : PCAP_FILE_HDR_SZ) )
+        {
+            if ( data->size + buf->len > data->limit )
+                roll = 1;
+            else if ( data->roll_secs
+                    && time(NULL) - data->lastTime >= (time_t)data->roll_secs )
+                roll = 1;
+        }
+
+        total = 0;
+        cnt = 0;
+
+        while ( idx != data->buf_prod && cnt < PCAP_IOV_MAX )
+        {
+            buf = &data->bufs[idx];
+
+            if ( cnt > 0 && (buf->roll
+                        || (roll ? 0 : data->size) + total + buf->len > data->limit) )
+                break;
+
+            iov[cnt].iov_base = buf->data;
+            iov[cnt].iov_len = buf->len;
+            total += buf->len;
+            cnt++;
+            idx = (idx + 1) % data->buf_cnt;
+        }
+
+        buf = &data->bufs[data->buf_cons];
+        pthread_mutex_unlock(&data->buf_lock);
+
+        if ( roll )
+            TcpdumpRollLogFile(data, buf);
+
+        TcpdumpWritev(data, iov, cnt);
+
+        pthread_mutex_lock(&data->buf_lock);
+        data->buf_cons = idx;
+        pthread_cond_signal(&data->buf_free);
+    }
+
+    pthread_mutex_unlock(&data->buf_lock);
+
+    return NULL;
 }
 
 /*
@@ -533,21 +1100,45 @@ static void SpoLogTcpdumpCleanup(int signal, void *arg, const char* msg)
 {
     /* cast the arg pointer to the proper type */
     LogTcpdumpData *data = (LogTcpdumpData *) arg;
+    uint32_t i;
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"%s\n", msg););
 
+    /* drain whatever is still buffered and stop the writer */
+    if ( data->writer_on )
+    {
+        pthread_mutex_lock(&data->buf_lock);
+        TcpdumpSeal(data);
+        data->writer_stop = 1;
+        pthread_cond_signal(&data->buf_full);
+        pthread_mutex_unlock(&data->buf_lock);
+
+        pthread_join(data->writer_tid, NULL);
+        data->writer_on = 0;
+
+        pthread_cond_destroy(&data->buf_free);
+        pthread_cond_destroy(&data->buf_full);
+        pthread_mutex_destroy(&data->buf_lock);
+
+        LogMessage("log_tcpdump: %lu packets, %lu bytes in %lu writes to %u files\n",
+                data->pkts, data->bytes, data->writes, data->files);
+    }
+
     /* close the output file */
-    if( data->dumpd != NULL )
+    if ( data->fd >= 0 )
     {
-        pcap_dump_close(data->dumpd);
-        data->dumpd = NULL;
+        close(data->fd);
+        data->fd = -1;
     }
 
-    /* close the pcap */
-    if (data->pd != NULL)
+    if ( data->bufs != NULL )
     {
-        pcap_close(data->pd);
-        data->pd = NULL;
+        for ( i = 0; i < data->buf_cnt; i++ )
+        {
+            if ( data->bufs[i].data != NULL )
+                free(data->bufs[i].data);
+        }
+        free(data->bufs);
     }
 
     /* 
@@ -589,20 +1180,23 @@ static void SpoLogTcpdumpRestartFunc(int signal, void *arg)
 
 void LogTcpdumpReset(void)
 {
-    TcpdumpRollLogFile(log_tcpdump_ptr);
+    LogTcpdumpData *data = log_tcpdump_ptr;
+
+    if ( data == NULL || data->bufs == NULL )
+        return;
+
+    /* the writer starts a new file with the next buffer */
+    pthread_mutex_lock(&data->buf_lock);
+    TcpdumpSeal(data);
+    data->bufs[data->buf_prod].roll = 1;
+    pthread_mutex_unlock(&data->buf_lock);
 }
 
 void DirectLogTcpdump(struct pcap_pkthdr *ph, uint8_t *pkt)
 {
-    size_t dumpSize = SizeOf_pcaphdr(ph);
-
-    if ( log_tcpdump_ptr->size + dumpSize > log_tcpdump_ptr->limit )
-        TcpdumpRollLogFile(log_tcpdump_ptr);
-
     pc.log_pkts++;
-    pcap_dump((u_char *)log_tcpdump_ptr->dumpd, ph, pkt);
-
-    log_tcpdump_ptr->size += dumpSize;
+    TcpdumpAppend(log_tcpdump_ptr, &ph->ts, ph->caplen, ph->len, pkt,
+            log_tcpdump_ptr->linktype);
 }
 
 #endif /* HAVE_LIBPCAP */
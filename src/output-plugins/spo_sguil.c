@@ -62,10 +62,19 @@
 #include "unified2.h"
 #include "util.h"
 
-/* Yeah TCL! */
-#ifdef ENABLE_TCL
-#include <tcl.h>
-#endif
+/* constants */
+#define MAX_MSG_LEN             2048
+#define TMP_BUFFER              128
+
+/** a formatted RTEVENT waiting for its Confirm; the buffer is reused
+ *  for every event that lands in this slot. */
+typedef struct _SguilMsg
+{
+    u_int32_t			event_id;
+    char				*buf;
+    size_t				len;
+    size_t				size;
+} SguilMsg;
 
 typedef struct _SpoSguilData
 {
@@ -74,25 +83,46 @@ typedef struct _SpoSguilData
     char				*passwd;
     u_int16_t			sensor_id;
     /** lowest event_id we submitted, but that wasn't confirmed yet,
-     *  should only be lower than event_id_max on server timeouts. */
+     *  equals event_id_max when nothing is in flight. */
     u_int32_t			event_id_min;
-    /** higest event_id sent to the server, normally we expect a confirm for
-     *  this id. */
+    /** next event_id to send to the server */
     u_int32_t			event_id_max;
     u_int16_t			agent_port;
     int					agent_sock;
 
+    /* events sent but not confirmed, oldest at window_head */
+    SguilMsg			*window;
+    u_int32_t			window_size;
+    u_int32_t			window_head;
+    u_int32_t			window_cnt;
+
+    /* "RTEVENT 0 <sid>" and " <sensor name>", encoded once */
+    char				*rt_prefix;
+    size_t				rt_prefix_len;
+    char				*rt_sensor;
+    size_t				rt_sensor_len;
+
+    /* last timestamp element, sguil only has second resolution */
+    u_int32_t			ts_sec;
+    char				ts_elem[TMP_BUFFER];
+    size_t				ts_elem_len;
+
+    /* partial lines from the agent */
+    char				rcv_buf[MAX_MSG_LEN];
+    size_t				rcv_len;
+
 	char				*args;
 } SpoSguilData;
 
-/* constants */
 #define KEYWORD_AGENTPORT       "agent_port"
 #define KEYWORD_SENSORNAME      "sensor_name"
 #define KEYWORD_TAGPATH         "tag_path"
 #define KEYWORD_PASSWORD        "passwd"
+#define KEYWORD_PIPELINE        "pipeline"
 
-#define MAX_MSG_LEN             2048
-#define TMP_BUFFER              128
+#define DEFAULT_PIPELINE        16
+#define MAX_PIPELINE            1024
+#define AGENT_TIMEOUT           15
 
 /* output plug-in API functions */
 void SguilInit(char *args);
@@ -110,20 +140,26 @@ void Sguil(Packet *, void *, uint32_t, void *);
 
 int SguilSensorAgentConnect(SpoSguilData *);
 int SguilSensorAgentInit(SpoSguilData *);
-int SguilRTEventMsg(SpoSguilData *, char *);
-int SguilSendAgentMsg(SpoSguilData *, char *);
-int SguilRecvAgentMsg(SpoSguilData *, char *);
-
-char *SguilTimestamp(u_int32_t);
-
-#ifdef ENABLE_TCL
-int SguilAppendIPHdrDataEVT(Tcl_DString *, void *);
-int SguilAppendIPHdrData(Tcl_DString *, Packet *);
-int SguilAppendICMPData(Tcl_DString *, Packet *);
-int SguilAppendTCPData(Tcl_DString *, Packet *);
-int SguilAppendUDPData(Tcl_DString *, Packet *);
-int SguilAppendPayloadData(Tcl_DString *, Packet *);
-#endif
+int SguilSendAgentMsg(SpoSguilData *, const char *, size_t);
+int SguilRecvAgentMsg(SpoSguilData *, char *, int);
+
+static void SguilWaitConfirm(SpoSguilData *, int);
+static void SguilSendWindow(SpoSguilData *, u_int32_t);
+
+/* RT event encoder */
+static void SguilQuoteMapInit(void);
+static void SguilEncodeRTEvent(SpoSguilData *, SguilMsg *, Packet *,
+        Unified2IDSEvent *, uint32_t);
+static void SguilAppendElement(SguilMsg *, const char *, size_t);
+static void SguilAppendUInt(SguilMsg *, u_int32_t);
+static void SguilAppendEmpty(SguilMsg *, int);
+static void SguilAppendAddr(SguilMsg *, u_int32_t);
+static void SguilAppendTimestamp(SpoSguilData *, SguilMsg *, u_int32_t);
+static void SguilAppendIPHdrData(SguilMsg *, Packet *);
+static void SguilAppendICMPData(SguilMsg *, Packet *);
+static void SguilAppendTCPData(SguilMsg *, Packet *);
+static void SguilAppendUDPData(SguilMsg *, Packet *);
+static void SguilAppendPayloadData(SguilMsg *, Packet *);
 
 /* init routine makes this processor available for dataprocessor directives */
 void SguilSetup()
@@ -141,16 +177,6 @@ void SguilInit(char *args)
 
     DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "Output: Sguil initialized\n"););
 
-#ifndef ENABLE_TCL
-    ErrorMessage("sguil: Tcl support is not compiled into this build of barnyard2\n\n");
-    FatalError("If this build of barnyard was obtained as a binary distribution (e.g., rpm,\n"
-               "or Windows), then check for alternate builds that contains the necessary Tcl\n"
-               "support.\n\n"
-               "If this build of barnyard was compiled by you, then re-run the ./configure\n"
-               "script using the '--with-tcl' switch to specify the location of the\n"
-			   "tclConfig.sh for your system.\n\n");
-#endif
-
 	/* parse the argument list from the rules file`*/
 	ssd_data = InitSguilData(args);
 
@@ -179,6 +205,7 @@ SpoSguilData *InitSguilData(char *args)
 void SguilInitFinalize(int unused, void *arg)
 {
 	SpoSguilData		*ssd_data = (SpoSguilData *)arg;
+    SguilMsg			fmt;
 
 	if (!ssd_data)
 	{
@@ -186,6 +213,7 @@ void SguilInitFinalize(int unused, void *arg)
 	}
 
 	ParseSguilArgs(ssd_data);
+    SguilQuoteMapInit();
 
     /* identify the sensor_name */
     if(ssd_data->sensor_name == NULL)
@@ -204,8 +232,11 @@ void SguilInitFinalize(int unused, void *arg)
     {
         LogMessage("sguil:  sensor name = %s\n", ssd_data->sensor_name);
         LogMessage("sguil:  agent port =  %u\n", ssd_data->agent_port);
+        LogMessage("sguil:  pipeline =    %u\n", ssd_data->window_size);
     }
 
+    ssd_data->window = (SguilMsg *)SnortAlloc(sizeof(SguilMsg) * ssd_data->window_size);
+
 	/* connect to sensor_agent */
     SguilSensorAgentConnect(ssd_data);
 
@@ -220,6 +251,22 @@ void SguilInitFinalize(int unused, void *arg)
             break;
     } while (1);
 
+    /* the parts of every RT event that only change on reconfiguration */
+    memset(&fmt, 0, sizeof(fmt));
+    SguilAppendElement(&fmt, "RTEVENT", 7);
+    SguilAppendElement(&fmt, "0", 1);
+    SguilAppendUInt(&fmt, ssd_data->sensor_id);
+    ssd_data->rt_prefix = fmt.buf;
+    ssd_data->rt_prefix_len = fmt.len;
+
+    /* a leading non-empty element so the sensor name gets its separator */
+    memset(&fmt, 0, sizeof(fmt));
+    SguilAppendElement(&fmt, "0", 1);
+    SguilAppendElement(&fmt, ssd_data->sensor_name, strlen(ssd_data->sensor_name));
+    ssd_data->rt_sensor = SnortStrndup(fmt.buf + 1, fmt.len - 1);
+    ssd_data->rt_sensor_len = fmt.len - 1;
+    free(fmt.buf);
+
     /* set the preprocessor function into the function list */
     AddFuncToOutputList(Sguil, OUTPUT_TYPE__ALERT, ssd_data);
     AddFuncToCleanExitList(SguilCleanExitFunc, ssd_data);
@@ -228,21 +275,29 @@ void SguilInitFinalize(int unused, void *arg)
 
 void Sguil(Packet *p, void *event, uint32_t event_type, void *arg)
 {
-#ifdef ENABLE_TCL
-    char				*timestamp_string;
-    char				buffer[TMP_BUFFER];
 	SpoSguilData		*data;
-	SigNode				*sn = NULL;
-    ClassType			*cn = NULL;
-    Tcl_DString			list;
-
-    memset(buffer, 0, TMP_BUFFER); /* bzero() deprecated, replaced by memset() */
+    SguilMsg			*msg;
 
 	if ( event == NULL || arg == NULL )
 	{
 		return;
 	}
 
+    switch (event_type)
+    {
+        case UNIFIED2_IDS_EVENT:
+        case UNIFIED2_IDS_EVENT_MPLS:
+        case UNIFIED2_IDS_EVENT_VLAN:
+        case UNIFIED2_IDS_EVENT_IPV6:
+        case UNIFIED2_IDS_EVENT_IPV6_MPLS:
+        case UNIFIED2_IDS_EVENT_IPV6_VLAN:
+            break;
+
+        default:
+            /* packets and spooler notifications */
+            return;
+    }
+
     if(p != NULL)
     {
         if(p->ip6h != NULL)
@@ -255,123 +310,459 @@ void Sguil(Packet *p, void *event, uint32_t event_type, void *arg)
 
     data = (SpoSguilData *)arg;
 
+    /* keep at most window_size events unconfirmed */
+    if (data->window_cnt == data->window_size)
+    {
+        SguilWaitConfirm(data, 1);
+
+        /* still full when the wait was cut short by exit */
+        if (data->window_cnt == data->window_size)
+            return;
+    }
+
+    msg = &data->window[(data->window_head + data->window_cnt) % data->window_size];
+    msg->event_id = data->event_id_max;
+
+    SguilEncodeRTEvent(data, msg, p,
+            (Unified2IDSEvent *)((EventEP *)event)->ee->data, event_type);
+
+    data->window_cnt++;
+
+    /* send msg to sensor_agent */
+    if (SguilSendAgentMsg(data, msg->buf, msg->len))
+    {
+        /* reconnected, everything in flight went with the old socket */
+        SguilSendWindow(data, 0);
+    }
+
+    /* bump the event id */
+    data->event_id_max++;
+
+    /* pick up whatever confirms have already arrived */
+    SguilWaitConfirm(data, 0);
+}
+
+static unsigned int sguil_agent_setup_timeouts = 0;
+
+/*
+ * Function: SguilSendWindow(SpoSguilData *, u_int32_t)
+ *
+ * Purpose: (Re)send the unconfirmed events starting at the from'th,
+ *          starting over if the connection has to be re-established
+ *          on the way.
+ */
+static void SguilSendWindow(SpoSguilData *data, u_int32_t from)
+{
+    SguilMsg *msg;
+    u_int32_t i;
+
+    for (i = from; i < data->window_cnt && exit_signal == 0; i++)
+    {
+        msg = &data->window[(data->window_head + i) % data->window_size];
+
+        if (SguilSendAgentMsg(data, msg->buf, msg->len))
+            i = (u_int32_t)-1;
+    }
+}
+
+/*
+ * Function: SguilConfirm(SpoSguilData *, u_int32_t, const char *)
+ *
+ * Purpose: The agent confirms in order, so a Confirm covers every event
+ *          up to and including its cid.
+ */
+static void SguilConfirm(SpoSguilData *data, u_int32_t event_id, const char *line)
+{
+    if (data->window_cnt == 0 || event_id < data->event_id_min)
+    {
+        /* confirms for events we resent after a timeout */
+        if (BcLogVerbose())
+            LogMessage("sguil: processed delayed Confirm: %s\n", line);
+        return;
+    }
+
+    if (event_id >= data->event_id_max)
+    {
+        FatalError("sguil: Expected Confirm %u and got: %s\n", data->event_id_min, line);
+    }
+
+    while (data->window_cnt > 0 &&
+           data->window[data->window_head].event_id <= event_id)
+    {
+        data->window_head = (data->window_head + 1) % data->window_size;
+        data->window_cnt--;
+    }
+
+    data->event_id_min = event_id + 1;
+}
+
+/*
+ * Function: SguilWaitConfirm(SpoSguilData *, int)
+ *
+ * Purpose: Process responses from the agent.  When block is set this
+ *          returns once the window has room again, resending it on
+ *          every timeout; otherwise only what is already queued on the
+ *          socket is read.
+ */
+static void SguilWaitConfirm(SpoSguilData *data, int block)
+{
+    char tmpRecvMsg[MAX_MSG_LEN];
+    char **toks;
+    int num_toks;
+    int ret;
+
+    while (exit_signal == 0)
+    {
+        if (block && data->window_cnt < data->window_size)
+            return;
+
+        ret = SguilRecvAgentMsg(data, tmpRecvMsg, block ? AGENT_TIMEOUT : 0);
+
+        if (ret == 2)
+        {
+            SguilSendWindow(data, 0);
+            continue;
+        }
+
+        if (ret == 1)
+        {
+            if (!block)
+                return;
+
+            if (BcLogVerbose())
+                LogMessage("sguil: Retrying\n");
+
+            SguilSendWindow(data, 0);
+            continue;
+        }
+
+        if (BcLogVerbose())
+            LogMessage("sguil: Received: %s\n", tmpRecvMsg);
+
+        /* Parse the response */
+        toks = mSplit(tmpRecvMsg, " ", 2, &num_toks, 0);
+
+        if (num_toks == 0)
+        {
+            mSplitFree(&toks, num_toks);
+            continue;
+        }
+
+        /* if the agent registration timed out once or several times we can
+         * receive unexpected SidCidResponse messages. */
+        if (sguil_agent_setup_timeouts > 0 && strcasecmp("SidCidResponse", toks[0]) == 0)
+        {
+            sguil_agent_setup_timeouts--;
+
+            if (BcLogVerbose())
+                LogMessage("sguil: Ignored: %s\n", tmpRecvMsg);
+        }
+        else if (strcasecmp("Confirm", toks[0]) == 0 && num_toks == 2 && isdigit((int)toks[1][0]))
+        {
+            SguilConfirm(data, strtoul(toks[1], NULL, 10), tmpRecvMsg);
+        }
+        else
+        {
+            FatalError("sguil: Malformed response, expected \"Confirm %u\", got: %s\n",
+                    data->event_id_min, tmpRecvMsg);
+        }
+
+        mSplitFree(&toks, num_toks);
+    }
+}
+
+/*
+ * RT event encoder
+ *
+ * Elements are written straight into the slot's buffer, quoted the way
+ * a Tcl list parser reads them back: as is when there is nothing to
+ * quote, in braces when there are only separators or substitution
+ * characters, otherwise with backslashes.
+ */
+
+#define SGUIL_QUOTE_BRACE       1
+#define SGUIL_QUOTE_BACKSLASH   2
+
+static u_int8_t sguil_quote_map[256];
+
+static const char sguil_empty[] =
+    " {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {}"
+    " {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {}";
+
+static void SguilQuoteMapInit(void)
+{
+    const char *c;
+
+    for (c = " \t\n\r\v\f;$[]\""; *c; c++)
+        sguil_quote_map[(u_int8_t)*c] = SGUIL_QUOTE_BRACE;
+
+    for (c = "{}\\"; *c; c++)
+        sguil_quote_map[(u_int8_t)*c] = SGUIL_QUOTE_BACKSLASH;
+}
+
+static inline char *SguilReserve(SguilMsg *msg, size_t len)
+{
+    if (msg->len + len + 1 > msg->size)
+    {
+        size_t size = msg->size ? msg->size : MAX_MSG_LEN;
+
+        while (msg->len + len + 1 > size)
+            size *= 2;
+
+        msg->buf = (char *)realloc(msg->buf, size);
+
+        if (msg->buf == NULL)
+            FatalError("sguil: Unable to grow RT event buffer to %lu\n", (unsigned long)size);
+
+        msg->size = size;
+    }
+
+    return msg->buf + msg->len;
+}
+
+static void SguilAppendElement(SguilMsg *msg, const char *str, size_t len)
+{
+    const u_int8_t *s = (const u_int8_t *)str;
+    char *out;
+    int quote = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        quote |= sguil_quote_map[s[i]];
+
+    /* a leading '#' would read back as a comment */
+    if (len > 0 && s[0] == '#')
+        quote |= SGUIL_QUOTE_BRACE;
+
+    /* worst case: separator plus every byte escaped */
+    out = SguilReserve(msg, len * 2 + 3);
+
+    if (msg->len > 0)
+        *out++ = ' ';
+
+    if (len == 0)
+    {
+        *out++ = '{';
+        *out++ = '}';
+    }
+    else if (quote == 0)
+    {
+        memcpy(out, str, len);
+        out += len;
+    }
+    else if (!(quote & SGUIL_QUOTE_BACKSLASH))
+    {
+        *out++ = '{';
+        memcpy(out, str, len);
+        out += len;
+        *out++ = '}';
+    }
+    else
+    {
+        for (i = 0; i < len; i++)
+        {
+            if (!sguil_quote_map[s[i]] && (i > 0 || s[i] != '#'))
+            {
+                *out++ = s[i];
+                continue;
+            }
+
+            *out++ = '\\';
+
+            switch (s[i])
+            {
+                case '\t': *out++ = 't'; break;
+                case '\n': *out++ = 'n'; break;
+                case '\r': *out++ = 'r'; break;
+                case '\v': *out++ = 'v'; break;
+                case '\f': *out++ = 'f'; break;
+                default:   *out++ = s[i]; break;
+            }
+        }
+    }
+
+    msg->len = out - msg->buf;
+}
+
+static void SguilAppendUInt(SguilMsg *msg, u_int32_t val)
+{
+    char tmp[16];
+    char *p = tmp + sizeof(tmp);
+    char *out;
+    size_t len;
+
+    do
+    {
+        *--p = '0' + (val % 10);
+        val /= 10;
+    } while (val);
+
+    len = tmp + sizeof(tmp) - p;
+    out = SguilReserve(msg, len + 1);
+
+    if (msg->len > 0)
+        *out++ = ' ';
+
+    memcpy(out, p, len);
+    msg->len = out + len - msg->buf;
+}
+
+/* n empty elements */
+static void SguilAppendEmpty(SguilMsg *msg, int n)
+{
+    memcpy(SguilReserve(msg, n * 3), sguil_empty, n * 3);
+    msg->len += n * 3;
+}
+
+/* {ip (dec)} {ip (string)}, addr in network order */
+static void SguilAppendAddr(SguilMsg *msg, u_int32_t addr)
+{
+    const u_int8_t *a = (const u_int8_t *)&addr;
+    char dotted[16];
+    char *p = dotted;
+    int i;
+
+    SguilAppendUInt(msg, ntohl(addr));
+
+    for (i = 0; i < 4; i++)
+    {
+        if (a[i] >= 100)
+            *p++ = '0' + a[i] / 100;
+        if (a[i] >= 10)
+            *p++ = '0' + (a[i] / 10) % 10;
+        *p++ = '0' + a[i] % 10;
+        *p++ = '.';
+    }
+
+    SguilAppendElement(msg, dotted, p - dotted - 1);
+}
+
+static void SguilAppendTimestamp(SpoSguilData *data, SguilMsg *msg, u_int32_t sec)
+{
+    if (sec != data->ts_sec || data->ts_elem_len == 0)
+    {
+        struct tm tm;
+        time_t Time = sec;
+
+        if (BcOutputUseUtc())
+            gmtime_r(&Time, &tm);
+        else
+            localtime_r(&Time, &tm);
+
+        /* contains a space, so always braced */
+        data->ts_elem_len = strftime(data->ts_elem, sizeof(data->ts_elem),
+                " {%Y-%m-%d %H:%M:%S}", &tm);
+        data->ts_sec = sec;
+    }
+
+    memcpy(SguilReserve(msg, data->ts_elem_len), data->ts_elem, data->ts_elem_len);
+    msg->len += data->ts_elem_len;
+}
+
+/*
+ * Function: SguilEncodeRTEvent()
+ *
+ * Purpose: Here we build our RT event to send to sguild. The event is
+ *          built with a proper tcl list format and ends in a newline.
+ *
+ * RT FORMAT:
+ * 
+ *     0      1    2     3          4            5                  6                7
+ * {RTEVENT} {0} {sid} {cid} {sensor name} {snort event_id} {snort event_ref} {snort ref_time} 
+ *
+ *     8         9      10      11         12         13          14
+ * {sig_gen} {sig id} {rev} {message} {timestamp} {priority} {class_type} 
+ *
+ *      15            16           17           18           19       20        21
+ * {sip (dec)} {sip (string)} {dip (dec)} {dip (string)} {ip proto} {ip ver} {ip hlen}
+ *
+ *    22       23      24        25        26       27       28
+ * {ip tos} {ip len} {ip id} {ip flags} {ip off} {ip ttl} {ip csum}
+ *
+ *      29         30           31        32         33
+ * {icmp type} {icmp code} {icmp csum} {icmp id} {icmp seq}
+ * 
+ *     34         35
+ * {src port} {dst port}
+ *
+ *     36        37        38        39        40         41        42          43
+ * {tcp seq} {tcp ack} {tcp off} {tcp res} {tcp flags} {tcp win} {tcp csum} {tcp urp}
+ *
+ *     44        45
+ * {udp len} {udp csum}
+ *
+ *      46
+ * {data payload}
+ */
+static void SguilEncodeRTEvent(SpoSguilData *data, SguilMsg *msg, Packet *p,
+        Unified2IDSEvent *event, uint32_t event_type)
+{
+	SigNode				*sn = NULL;
+    ClassType			*cn = NULL;
+    u_int32_t			event_second;
+
 	/* grab the appropriate signature and classification information */
-	sn = GetSigByGidSid(ntohl(((Unified2EventCommon *)event)->generator_id),
-			    ntohl(((Unified2EventCommon *)event)->signature_id),
-			    ntohl(((Unified2EventCommon *)event)->signature_revision));
-
-	cn = ClassTypeLookupById(barnyard2_conf, ntohl(((Unified2EventCommon *)event)->classification_id));
-
-    /* Here we build our RT event to send to sguild. The event is built with a
-    ** proper tcl list format. 
-    ** RT FORMAT:
-    ** 
-    **     0      1    2     3          4            5                  6                7
-    ** {RTEVENT} {0} {sid} {cid} {sensor name} {snort event_id} {snort event_ref} {snort ref_time} 
-    **
-    **     8         9      10      11         12         13          14
-    ** {sig_gen} {sig id} {rev} {message} {timestamp} {priority} {class_type} 
-    **
-    **      15            16           17           18           19       20        21
-    ** {sip (dec)} {sip (string)} {dip (dec)} {dip (string)} {ip proto} {ip ver} {ip hlen}
-    **
-    **    22       23      24        25        26       27       28
-    ** {ip tos} {ip len} {ip id} {ip flags} {ip off} {ip ttl} {ip csum}
-    **
-    **      29         30           31        32         33
-    ** {icmp type} {icmp code} {icmp csum} {icmp id} {icmp seq}
-    ** 
-    **     34         35
-    ** {src port} {dst port}
-    **
-    **     36        37        38        39        40         41        42          43
-    ** {tcp seq} {tcp ack} {tcp off} {tcp res} {tcp flags} {tcp win} {tcp csum} {tcp urp}
-    **
-    **     44        45
-    ** {udp len} {udp csum}
-    **
-    **      46
-    ** {data payload}
-    */
-
-    Tcl_DStringInit(&list);
-
-    /* RTEVENT */
-    Tcl_DStringAppendElement(&list, "RTEVENT");
-
-    /* Status - 0 */
-    Tcl_DStringAppendElement(&list, "0");
-
-    /* Sensor ID  (sid) */
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", data->sensor_id);
-    Tcl_DStringAppendElement(&list, buffer);
+	sn = GetSigByGidSid(ntohl(event->generator_id),
+			    ntohl(event->signature_id),
+			    ntohl(event->signature_revision));
+
+	cn = ClassTypeLookupById(barnyard2_conf, ntohl(event->classification_id));
+
+    msg->len = 0;
+
+    /* RTEVENT, Status - 0, Sensor ID (sid) */
+    memcpy(SguilReserve(msg, data->rt_prefix_len), data->rt_prefix, data->rt_prefix_len);
+    msg->len = data->rt_prefix_len;
 
     /* Event ID (cid) */
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", data->event_id_max);
-    Tcl_DStringAppendElement(&list, buffer);
+    SguilAppendUInt(msg, msg->event_id);
 
     /* Sensor Name */
-    Tcl_DStringAppendElement(&list, data->sensor_name);
+    memcpy(SguilReserve(msg, data->rt_sensor_len), data->rt_sensor, data->rt_sensor_len);
+    msg->len += data->rt_sensor_len;
 
-    /* Snort Event ID */
-    SnortSnprintf(buffer, TMP_BUFFER, "%u",
-			ntohl(((Unified2EventCommon *)event)->event_id));
-    Tcl_DStringAppendElement(&list, buffer);
-
-    /* Snort Event Ref */
-    SnortSnprintf(buffer, TMP_BUFFER, "%u",
-			ntohl(((Unified2EventCommon *)event)->event_id));
-    Tcl_DStringAppendElement(&list, buffer);
+    /* Snort Event ID, Snort Event Ref */
+    SguilAppendUInt(msg, ntohl(event->event_id));
+    SguilAppendUInt(msg, ntohl(event->event_id));
 
     /* Snort Event Ref Time */
-	timestamp_string = SguilTimestamp(ntohl(((Unified2EventCommon *)event)->event_second));
+    event_second = ntohl(event->event_second);
 
-	if(ntohl(((Unified2EventCommon *)event)->event_second) == 0)
-        Tcl_DStringAppendElement(&list, "");
+	if(event_second == 0)
+        SguilAppendEmpty(msg, 1);
     else
-        Tcl_DStringAppendElement(&list, timestamp_string);
-
-    /* Generator ID */
-    SnortSnprintf(buffer, TMP_BUFFER, "%d",
-			ntohl(((Unified2EventCommon *)event)->generator_id));
-    Tcl_DStringAppendElement(&list, buffer);
+        SguilAppendTimestamp(data, msg, event_second);
 
-    /* Signature ID */
-    SnortSnprintf(buffer, TMP_BUFFER, "%d",
-			ntohl(((Unified2EventCommon *)event)->signature_id));
-    Tcl_DStringAppendElement(&list, buffer);
-
-    /* Signature Revision */
-    SnortSnprintf(buffer, TMP_BUFFER, "%d",
-			ntohl(((Unified2EventCommon *)event)->signature_revision));
-    Tcl_DStringAppendElement(&list, buffer);
+    /* Generator ID, Signature ID, Signature Revision */
+    SguilAppendUInt(msg, ntohl(event->generator_id));
+    SguilAppendUInt(msg, ntohl(event->signature_id));
+    SguilAppendUInt(msg, ntohl(event->signature_revision));
 
     /* Signature Msg */
-    Tcl_DStringAppendElement(&list, sn->msg);
+    if (sn != NULL && sn->msg != NULL)
+        SguilAppendElement(msg, sn->msg, strlen(sn->msg));
+    else
+        SguilAppendEmpty(msg, 1);
 
     /* Packet Timestamp = Event Timestamp*/
-    Tcl_DStringAppendElement(&list, timestamp_string);
+    SguilAppendTimestamp(data, msg, event_second);
 
     /* Alert Priority */
-    SnortSnprintf(buffer, TMP_BUFFER, "%u",
-			ntohl(((Unified2EventCommon *)event)->priority_id));
-    Tcl_DStringAppendElement(&list, buffer);
+    SguilAppendUInt(msg, ntohl(event->priority_id));
 
     /* Alert Classification */
     if (cn == NULL)
-        Tcl_DStringAppendElement(&list, "unknown");
+        SguilAppendElement(msg, "unknown", 7);
     else
-        Tcl_DStringAppendElement(&list, cn->type);
+        SguilAppendElement(msg, cn->type, strlen(cn->type));
 
     /* Pull decoded info from the packet */
     if(p != NULL)
     {
         if(p->iph)
         {
-            int i;
-
             /* add IP header */
-            SguilAppendIPHdrData(&list, p);
+            SguilAppendIPHdrData(msg, p);
 
             /* add ICMP || UDP || TCP data */
             if ( !(p->packet_flags & PKT_REBUILT_FRAG) )
@@ -379,145 +770,56 @@ void Sguil(Packet *p, void *event, uint32_t event_type, void *arg)
                 switch(p->iph->ip_proto)
                 {
                     case IPPROTO_ICMP:
-                        SguilAppendICMPData(&list, p);
+                        SguilAppendICMPData(msg, p);
                         break;
 
                     case IPPROTO_TCP:
-                        SguilAppendTCPData(&list, p);
+                        SguilAppendTCPData(msg, p);
                         break;
 
                     case IPPROTO_UDP:
-                        SguilAppendUDPData(&list, p);
+                        SguilAppendUDPData(msg, p);
                         break;
 
                     default:
-                        for(i = 0; i < 17; ++i)
-                            Tcl_DStringAppendElement(&list, "");
+                        SguilAppendEmpty(msg, 17);
                         break;
                 }
             }
             else
             {
                 /* null out TCP/UDP/ICMP fields */
-                for(i = 0; i < 17; ++i)
-                    Tcl_DStringAppendElement(&list, "");
+                SguilAppendEmpty(msg, 17);
             }
         }
         else
         {
             /* no IP Header. */
-            int i;
-            for(i = 0; i < 31; ++i)
-                Tcl_DStringAppendElement(&list, "");
+            SguilAppendEmpty(msg, 31);
         }
 
         /* add payload data */
-        SguilAppendPayloadData(&list, p);
+        SguilAppendPayloadData(msg, p);
     }
-    else
+    else if ( event_type == UNIFIED2_IDS_EVENT ||
+              event_type == UNIFIED2_IDS_EVENT_MPLS ||
+              event_type == UNIFIED2_IDS_EVENT_VLAN )
     {
         /* ack! an event without a packet. Append IP data from event struct and append
         27 fillers */
-        if ( (event_type == UNIFIED2_IDS_EVENT_VLAN)||
-                (event_type == UNIFIED2_IDS_EVENT_MPLS) ||
-                (event_type == UNIFIED2_IDS_EVENT_VLAN)){
-            SguilAppendIPHdrDataEVT(&list, event);
-            int i;
-            for(i = 0; i < 27; ++i)
-            Tcl_DStringAppendElement(&list, "");
-        } else {
-        /* ack! an event without a packet. and no IP Data in eventAppend 32 fillers */
-            int i;
-            for(i = 0; i < 32; ++i)
-            Tcl_DStringAppendElement(&list, "");
-        }
-
-    }
-
-    /* send msg to sensor_agent */
-    if (SguilRTEventMsg(data, Tcl_DStringValue(&list)))
-        FatalError("Unable to send RT Events to sensor agent.\n");
-
-    /* free the mallocs! */
-    Tcl_DStringFree(&list);
-	free(timestamp_string);
-
-    /* bump the event id */
-    data->event_id_max++;
-#endif
-}
-
-static unsigned int sguil_agent_setup_timeouts = 0;
-
-int SguilRTEventMsg(SpoSguilData *data, char *msg)
-{
-
-    char tmpRecvMsg[MAX_MSG_LEN];
-
-    /* Send Msg */
-    SguilSendAgentMsg(data, msg);
-
-    /* Get confirmation */
-    memset(tmpRecvMsg, 0x0, MAX_MSG_LEN);
-    if (SguilRecvAgentMsg(data, tmpRecvMsg) == 1)
-    {
-        if (BcLogVerbose())
-            LogMessage("sguil: Retrying\n");
-
-        SguilRTEventMsg(data, msg);
+        SguilAppendAddr(msg, event->ip_source);
+        SguilAppendAddr(msg, event->ip_destination);
+        SguilAppendUInt(msg, event->protocol);
+        SguilAppendEmpty(msg, 27);
     }
     else
     {
-        char **toks;
-        int num_toks;
-
-        if (BcLogVerbose())
-            LogMessage("sguil: Received: %s", tmpRecvMsg);
-
-        /* Parse the response */
-        toks = mSplit(tmpRecvMsg, " ", 2, &num_toks, 0);
-
-        /* if the agent registration timed out once or several times we can
-         * receive unexpected SidCidResponse messages. */
-        if (sguil_agent_setup_timeouts > 0 && strcasecmp("SidCidResponse", toks[0]) == 0)
-        {
-            sguil_agent_setup_timeouts--;
-
-	    if (BcLogVerbose())
-		    LogMessage("sguil: Ignored: %s", tmpRecvMsg);
-        }
-        else
-        {
-            int event_id = atoi(toks[1]);
-            if (event_id < 0)
-            {
-                FatalError("sguil: Malformed response, expected \"Confirm %u\", got: %s\n",
-                        data->event_id_max, tmpRecvMsg);
-            }
-
-            if(strcasecmp("Confirm", toks[0]) != 0) {
-
-                if ((uint)event_id != data->event_id_max) {
-                    if ((uint)event_id == data->event_id_min) {
-                        if (BcLogVerbose())
-                            LogMessage("sguil: processed delayed Confirm: %s", tmpRecvMsg);
-                    }
-                    else
-                    {
-                        FatalError("sguil: Expected Confirm %u and got: %s\n", data->event_id_max, tmpRecvMsg);
-                    }
-                }
-
-                /* either we are in sync or the confirm we got confirmed
-                 * event_id_min. Either way, we can increment it */
-                data->event_id_min++;
-            }
-        }
-
-        mSplitFree(&toks, num_toks);
+        /* ack! an event without a packet. and no IP Data in event. Append 32 fillers */
+        SguilAppendEmpty(msg, 32);
     }
 
-    return 0;
+    *SguilReserve(msg, 1) = '\n';
+    msg->len++;
 }
 
 /*
@@ -548,6 +850,7 @@ void ParseSguilArgs(SpoSguilData *ssd_data)
 
 	/* initialise appropariate values to 0 */
 	ssd_data->agent_port = 0;
+	ssd_data->window_size = DEFAULT_PIPELINE;
 
     /* parse out your args */
     toks = mSplit(ssd_data->args, ", ", 31, &num_toks, '\\');
@@ -590,6 +893,16 @@ void ParseSguilArgs(SpoSguilData *ssd_data)
             else
                 LogMessage("sguil: passwd error\n");
         }
+        else if ( !strncasecmp(stoks[0], KEYWORD_PIPELINE, strlen(KEYWORD_PIPELINE)) )
+        {
+            if(num_stoks > 1 && atoi(stoks[1]) > 0)
+                ssd_data->window_size = atoi(stoks[1]);
+            else
+                LogMessage("sguil: pipeline error\n");
+
+            if(ssd_data->window_size > MAX_PIPELINE)
+                ssd_data->window_size = MAX_PIPELINE;
+        }
         else
         {
 			LogMessage("sguil: unrecognised argument = %s\n", index);
@@ -607,156 +920,38 @@ void ParseSguilArgs(SpoSguilData *ssd_data)
 		ssd_data->agent_port = 7735;
 }
 
-#ifdef ENABLE_TCL
-int SguilAppendIPHdrDataEVT(Tcl_DString *list, void *event)
-{
-    char buffer[TMP_BUFFER];
-
-    memset(buffer, 0, TMP_BUFFER); /* bzero() deprecated, replaced by memset() */
-
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohl(((Unified2IDSEvent *)event)->ip_source));
-    Tcl_DStringAppendElement(list, buffer);
-#if defined(WORDS_BIGENDIAN)
-    SnortSnprintf(buffer, TMP_BUFFER, "%u.%u.%u.%u",
-           (((Unified2IDSEvent *)event)->ip_source & 0xff000000) >> 24,
-           (((Unified2IDSEvent *)event)->ip_source & 0x00ff0000) >> 16,
-           (((Unified2IDSEvent *)event)->ip_source & 0x0000ff00) >> 8,
-           (((Unified2IDSEvent *)event)->ip_source & 0x000000ff));
-#else
-    SnortSnprintf(buffer, TMP_BUFFER, "%u.%u.%u.%u",
-           (((Unified2IDSEvent *)event)->ip_source & 0x000000ff),
-           (((Unified2IDSEvent *)event)->ip_source & 0x0000ff00) >> 8,
-           (((Unified2IDSEvent *)event)->ip_source & 0x00ff0000) >> 16,
-           (((Unified2IDSEvent *)event)->ip_source & 0xff000000) >> 24);
-#endif
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohl(((Unified2IDSEvent *)event)->ip_destination));
-    Tcl_DStringAppendElement(list, buffer);
-#if defined(WORDS_BIGENDIAN)
-    SnortSnprintf(buffer, TMP_BUFFER, "%u.%u.%u.%u",
-           (((Unified2IDSEvent *)event)->ip_destination & 0xff000000) >> 24,
-           (((Unified2IDSEvent *)event)->ip_destination & 0x00ff0000) >> 16,
-           (((Unified2IDSEvent *)event)->ip_destination & 0x0000ff00) >> 8,
-           (((Unified2IDSEvent *)event)->ip_destination & 0x000000ff));
-#else
-    SnortSnprintf(buffer, TMP_BUFFER, "%u.%u.%u.%u",
-           (((Unified2IDSEvent *)event)->ip_destination & 0x000000ff),
-           (((Unified2IDSEvent *)event)->ip_destination & 0x0000ff00) >> 8,
-           (((Unified2IDSEvent *)event)->ip_destination & 0x00ff0000) >> 16,
-           (((Unified2IDSEvent *)event)->ip_destination & 0xff000000) >> 24);
-#endif
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", ((Unified2IDSEvent *)event)->protocol);
-    Tcl_DStringAppendElement(list, buffer);
-
-    return 0;
-}
-#endif
-
-#ifdef ENABLE_TCL
-int SguilAppendIPHdrData(Tcl_DString *list, Packet *p)
+static void SguilAppendIPHdrData(SguilMsg *msg, Packet *p)
 {
-    char buffer[TMP_BUFFER];
-
-    memset(buffer, 0, TMP_BUFFER); /* bzero() deprecated, replaced by memset() */
-
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohl(p->iph->ip_src.s_addr));
-    Tcl_DStringAppendElement(list, buffer);
-#if defined(WORDS_BIGENDIAN)
-    SnortSnprintf(buffer, TMP_BUFFER, "%u.%u.%u.%u",
-           (p->iph->ip_src.s_addr & 0xff000000) >> 24,
-           (p->iph->ip_src.s_addr & 0x00ff0000) >> 16,
-           (p->iph->ip_src.s_addr & 0x0000ff00) >> 8,
-           (p->iph->ip_src.s_addr & 0x000000ff));
-#else
-    SnortSnprintf(buffer, TMP_BUFFER, "%u.%u.%u.%u",
-           (p->iph->ip_src.s_addr & 0x000000ff),
-           (p->iph->ip_src.s_addr & 0x0000ff00) >> 8,
-           (p->iph->ip_src.s_addr & 0x00ff0000) >> 16,
-           (p->iph->ip_src.s_addr & 0xff000000) >> 24);
-#endif
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohl(p->iph->ip_dst.s_addr));
-    Tcl_DStringAppendElement(list, buffer);
-#if defined(WORDS_BIGENDIAN)
-    SnortSnprintf(buffer, TMP_BUFFER, "%u.%u.%u.%u",
-           (p->iph->ip_dst.s_addr & 0xff000000) >> 24,
-           (p->iph->ip_dst.s_addr & 0x00ff0000) >> 16,
-           (p->iph->ip_dst.s_addr & 0x0000ff00) >> 8,
-           (p->iph->ip_dst.s_addr & 0x000000ff));
-#else
-    SnortSnprintf(buffer, TMP_BUFFER, "%u.%u.%u.%u",
-           (p->iph->ip_dst.s_addr & 0x000000ff),
-           (p->iph->ip_dst.s_addr & 0x0000ff00) >> 8,
-           (p->iph->ip_dst.s_addr & 0x00ff0000) >> 16,
-           (p->iph->ip_dst.s_addr & 0xff000000) >> 24);
-#endif
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", p->iph->ip_proto);
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", IP_VER(p->iph));
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", IP_HLEN(p->iph));
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", p->iph->ip_tos);
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohs(p->iph->ip_len));
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohs(p->iph->ip_id));
-    Tcl_DStringAppendElement(list, buffer);
-
-#if defined(WORDS_BIGENDIAN)
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", ((p->iph->ip_off & 0xE000) >> 13));
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", htons(p->iph->ip_off & 0x1FFF));
-    Tcl_DStringAppendElement(list, buffer);
-#else
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", ((p->iph->ip_off & 0x00E0) >> 5));
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", htons(p->iph->ip_off & 0xFF1F));
-    Tcl_DStringAppendElement(list, buffer);
-#endif
-
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", p->iph->ip_ttl);
-    Tcl_DStringAppendElement(list, buffer);
-    SnortSnprintf(buffer, TMP_BUFFER, "%u", htons(p->iph->ip_csum));
-    Tcl_DStringAppendElement(list, buffer);
-
-    return 0;
+    SguilAppendAddr(msg, p->iph->ip_src.s_addr);
+    SguilAppendAddr(msg, p->iph->ip_dst.s_addr);
+    SguilAppendUInt(msg, p->iph->ip_proto);
+    SguilAppendUInt(msg, IP_VER(p->iph));
+    SguilAppendUInt(msg, IP_HLEN(p->iph));
+    SguilAppendUInt(msg, p->iph->ip_tos);
+    SguilAppendUInt(msg, ntohs(p->iph->ip_len));
+    SguilAppendUInt(msg, ntohs(p->iph->ip_id));
+
+    /* flags and fragment offset */
+    SguilAppendUInt(msg, ntohs(p->iph->ip_off) >> 13);
+    SguilAppendUInt(msg, ntohs(p->iph->ip_off) & 0x1FFF);
+
+    SguilAppendUInt(msg, p->iph->ip_ttl);
+    SguilAppendUInt(msg, htons(p->iph->ip_csum));
 }
-#endif
 
-#ifdef ENABLE_TCL
-int SguilAppendICMPData(Tcl_DString *list, Packet *p)
+static void SguilAppendICMPData(SguilMsg *msg, Packet *p)
 {
-
-    int i;
-    char buffer[TMP_BUFFER];
-
-    memset(buffer, 0, TMP_BUFFER); /* bzero() deprecated, replaced by memset() */
-
     if (!p->icmph)
     {
-
         /* Null out ICMP fields */
-        for(i=0; i < 5; i++)
-            Tcl_DStringAppendElement(list, "");
-
+        SguilAppendEmpty(msg, 5);
     }
     else
     {
-
-        /* ICMP type */
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", p->icmph->type);
-        Tcl_DStringAppendElement(list, buffer);
-
-        /* ICMP code */
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", p->icmph->code);
-        Tcl_DStringAppendElement(list, buffer);
-
-        /* ICMP CSUM */
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohs(p->icmph->csum));
-        Tcl_DStringAppendElement(list, buffer);
+        /* ICMP type, code and CSUM */
+        SguilAppendUInt(msg, p->icmph->type);
+        SguilAppendUInt(msg, p->icmph->code);
+        SguilAppendUInt(msg, ntohs(p->icmph->csum));
 
         /* Append other ICMP data if we have it */
         if (p->icmph->type == ICMP_ECHOREPLY ||
@@ -766,174 +961,106 @@ int SguilAppendICMPData(Tcl_DString *list, Packet *p)
                 p->icmph->type == ICMP_INFO_REQUEST ||
                 p->icmph->type == ICMP_INFO_REPLY)
         {
-
-            /* ICMP ID */
-            SnortSnprintf(buffer, TMP_BUFFER, "%u", htons(p->icmph->icmp_hun.idseq.id));
-            Tcl_DStringAppendElement(list, buffer);
-
-            /* ICMP Seq */
-            SnortSnprintf(buffer, TMP_BUFFER, "%u", htons(p->icmph->icmp_hun.idseq.seq));
-            Tcl_DStringAppendElement(list, buffer);
-
+            /* ICMP ID and Seq */
+            SguilAppendUInt(msg, htons(p->icmph->icmp_hun.idseq.id));
+            SguilAppendUInt(msg, htons(p->icmph->icmp_hun.idseq.seq));
         }
         else
         {
-
             /* Add two empty elements */
-            for(i=0; i < 2; i++)
-                Tcl_DStringAppendElement(list, "");
-
+            SguilAppendEmpty(msg, 2);
         }
-
     }
 
     /* blank out 12 elements */
-    for(i = 0; i < 12; i++)
-        Tcl_DStringAppendElement(list, "");
-
-    return 0;
-
+    SguilAppendEmpty(msg, 12);
 }
-#endif
 
-#ifdef ENABLE_TCL
-int SguilAppendTCPData(Tcl_DString *list, Packet *p)
+static void SguilAppendTCPData(SguilMsg *msg, Packet *p)
 {
-    /*
-    **     33        34        35        36        37         38        39          40
-    ** {tcp seq} {tcp ack} {tcp off} {tcp res} {tcp flags} {tcp win} {tcp csum} {tcp urp}
-    **
-    */
-
-    int i;
-    char buffer[TMP_BUFFER];
-
-    memset(buffer, 0, TMP_BUFFER); /* bzero() deprecated, replaced by memset() */
-
     /* empty elements for icmp data */
-    for(i=0; i < 5; i++)
-        Tcl_DStringAppendElement(list, "");
+    SguilAppendEmpty(msg, 5);
 
     if (!p->tcph)
     {
         /* Null out TCP fields */
-        for(i=0; i < 10; i++)
-            Tcl_DStringAppendElement(list, "");
+        SguilAppendEmpty(msg, 10);
     }
     else
     {
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", p->sp);
-        Tcl_DStringAppendElement(list, buffer);
-
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", p->dp);
-        Tcl_DStringAppendElement(list, buffer);
-
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohl(p->tcph->th_seq));
-        Tcl_DStringAppendElement(list, buffer);
-
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohl(p->tcph->th_ack));
-        Tcl_DStringAppendElement(list, buffer);
-
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", TCP_OFFSET(p->tcph));
-        Tcl_DStringAppendElement(list, buffer);
-
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", TCP_X2(p->tcph));
-        Tcl_DStringAppendElement(list, buffer);
-
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", p->tcph->th_flags);
-        Tcl_DStringAppendElement(list, buffer);
-
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohs(p->tcph->th_win));
-        Tcl_DStringAppendElement(list, buffer);
-
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohs(p->tcph->th_sum));
-        Tcl_DStringAppendElement(list, buffer);
-
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohs(p->tcph->th_urp));
-        Tcl_DStringAppendElement(list, buffer);
-
+        SguilAppendUInt(msg, p->sp);
+        SguilAppendUInt(msg, p->dp);
+        SguilAppendUInt(msg, ntohl(p->tcph->th_seq));
+        SguilAppendUInt(msg, ntohl(p->tcph->th_ack));
+        SguilAppendUInt(msg, TCP_OFFSET(p->tcph));
+        SguilAppendUInt(msg, TCP_X2(p->tcph));
+        SguilAppendUInt(msg, p->tcph->th_flags);
+        SguilAppendUInt(msg, ntohs(p->tcph->th_win));
+        SguilAppendUInt(msg, ntohs(p->tcph->th_sum));
+        SguilAppendUInt(msg, ntohs(p->tcph->th_urp));
     }
 
     /* empty elements for UDP data */
-    for(i=0; i < 2; i++)
-        Tcl_DStringAppendElement(list, "");
-
-    return 0;
-
+    SguilAppendEmpty(msg, 2);
 }
-#endif
 
-#ifdef ENABLE_TCL
-int SguilAppendUDPData(Tcl_DString *list, Packet *p)
+static void SguilAppendUDPData(SguilMsg *msg, Packet *p)
 {
-
-    int i;
-    char buffer[TMP_BUFFER];
-
-    memset(buffer, 0, TMP_BUFFER); /* bzero() deprecated, replaced by memset() */
-
     /* empty elements for ICMP data */
-    for(i=0; i < 5; i++)
-        Tcl_DStringAppendElement(list, "");
+    SguilAppendEmpty(msg, 5);
 
     if (!p->udph)
     {
         /* null out port info */
-        for(i=0; i < 2; i++)
-            Tcl_DStringAppendElement(list, "");
+        SguilAppendEmpty(msg, 2);
     }
     else
     {
         /* source and dst port */
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", p->sp);
-        Tcl_DStringAppendElement(list, buffer);
-
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", p->dp);
-        Tcl_DStringAppendElement(list, buffer);
-
+        SguilAppendUInt(msg, p->sp);
+        SguilAppendUInt(msg, p->dp);
     }
 
     /* empty elements for TCP data */
-    for(i=0; i < 8; i++)
-        Tcl_DStringAppendElement(list, "");
+    SguilAppendEmpty(msg, 8);
 
     if (!p->udph)
     {
         /* null out UDP info */
-        for(i=0; i < 2; i++)
-            Tcl_DStringAppendElement(list, "");
+        SguilAppendEmpty(msg, 2);
     }
     else
     {
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohs(p->udph->uh_len));
-        Tcl_DStringAppendElement(list, buffer);
-
-        SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohs(p->udph->uh_chk));
-        Tcl_DStringAppendElement(list, buffer);
+        SguilAppendUInt(msg, ntohs(p->udph->uh_len));
+        SguilAppendUInt(msg, ntohs(p->udph->uh_chk));
     }
-
-    return 0;
-
 }
-#endif
 
-#ifdef ENABLE_TCL
-int SguilAppendPayloadData(Tcl_DString *list, Packet *p)
+/* upper case hex like fasthex(), written in place */
+static void SguilAppendPayloadData(SguilMsg *msg, Packet *p)
 {
-    char *hex_payload;
+    static const char conv[] = "0123456789ABCDEF";
+    const u_char *index;
+    const u_char *end;
+    char *out;
 
-    if (p->dsize)
+    if (!p->dsize)
     {
-        hex_payload = fasthex(p->data, p->dsize);
-        Tcl_DStringAppendElement(list, hex_payload);
-        free(hex_payload);
-    } else {
-        Tcl_DStringAppendElement(list, "");
+        SguilAppendEmpty(msg, 1);
+        return;
     }
 
-    return 0;
+    out = SguilReserve(msg, p->dsize * 2 + 1);
+    *out++ = ' ';
+
+    for (index = p->data, end = p->data + p->dsize; index < end; index++)
+    {
+        *out++ = conv[*index >> 4];
+        *out++ = conv[*index & 0x0F];
+    }
+
+    msg->len = out - msg->buf;
 }
-#endif
 
 int SguilSensorAgentConnect(SpoSguilData *ssd_data)
 {
@@ -980,6 +1107,7 @@ int SguilSensorAgentConnect(SpoSguilData *ssd_data)
         else
         {
             ssd_data->agent_sock = sockfd;
+            ssd_data->rcv_len = 0;
             LogMessage("sguil:  Connected to localhost on %u.\n",
                         ssd_data->agent_port);
             return 0;
@@ -999,13 +1127,13 @@ int SguilSensorAgentInit(SpoSguilData *ssd_data)
     char tmpRecvMsg[MAX_MSG_LEN];
 
     /* Send our Request */
-    snprintf(tmpSendMsg, MAX_MSG_LEN, "SidCidRequest %s", ssd_data->sensor_name);
-    SguilSendAgentMsg(ssd_data, tmpSendMsg);
+    snprintf(tmpSendMsg, MAX_MSG_LEN, "SidCidRequest %s\n", ssd_data->sensor_name);
+    SguilSendAgentMsg(ssd_data, tmpSendMsg, strlen(tmpSendMsg));
 
     /* Get the Results */
     memset(tmpRecvMsg,0x0,MAX_MSG_LEN);
 
-    if ( SguilRecvAgentMsg(ssd_data, tmpRecvMsg) == 1 )
+    if ( SguilRecvAgentMsg(ssd_data, tmpRecvMsg, AGENT_TIMEOUT) != 0 )
     {
         if (BcLogVerbose())
 	        LogMessage("sguil: Agent registration timed out, retrying\n");
@@ -1025,7 +1153,7 @@ int SguilSensorAgentInit(SpoSguilData *ssd_data)
         /* parse the response */
         toks = mSplit(tmpRecvMsg, " ", 3, &num_toks, 0);
 
-        if ( strcasecmp("SidCidResponse", toks[0]) == 0 )
+        if ( num_toks == 3 && strcasecmp("SidCidResponse", toks[0]) == 0 )
         {
             ssd_data->sensor_id = atoi(toks[1]);
             ssd_data->event_id_min = ssd_data->event_id_max = atoi(toks[2]);
@@ -1049,166 +1177,139 @@ int SguilSensorAgentInit(SpoSguilData *ssd_data)
     return 0;
 }
 
-int SguilSendAgentMsg(SpoSguilData *data, char *msg)
+/**
+ *  \brief Send a newline terminated message to the agent
+ *  \retval 1 when the connection was lost and re-established and
+ *          the message was not sent
+ */
+int SguilSendAgentMsg(SpoSguilData *data, const char *msg, size_t len)
 {
-    int					schars;
-    size_t				len;
-    char				*tmpMsg;
+    const char			*ptr = msg;
+    size_t				left = len;
+    ssize_t				schars;
+    int					flags = 0;
 
-    len = strlen(msg)+2;
-    tmpMsg = SnortAlloc(len);
-    snprintf(tmpMsg, len, "%s\n", msg);
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG, "sguil: sending \"%.*s\"", (int)len, msg););
 
-    if ( (schars = send(data->agent_sock, tmpMsg, sizeof(char)*strlen(tmpMsg), 0)) < 0 )
+    while (left > 0)
     {
-        if(BcLogVerbose())
-		    LogMessage("sguil: Lost connection to sensor_agent.\n");
+        schars = send(data->agent_sock, ptr, left, flags);
 
-        /* resend our message */
-        SguilSendAgentMsg(data, msg);
-    }
+        if (schars < 0)
+        {
+            if (errno == EINTR)
+                continue;
 
-    DEBUG_WRAP(DebugMessage(DEBUG_LOG, "sguil: sending \"%s\"", tmpMsg););
+            if(BcLogVerbose())
+                LogMessage("sguil: Lost connection to sensor_agent.\n");
 
-    free(tmpMsg);
+            close(data->agent_sock);
+            SguilSensorAgentConnect(data);
+            return 1;
+        }
+
+        ptr += schars;
+        left -= schars;
+    }
 
     return 0;
 }
 
 /**
- *  \brief Receive a message from the Sguil server
+ *  \brief Receive a line from the agent, without the newline
+ *  \param timeout seconds to wait, 0 only returns lines already received
+ *  \retval 0 on success
  *  \retval 1 on timeout
+ *  \retval 2 if the connection was lost and re-established
  */
-
-/* I love google. http://pont.net/socket/prog/tcpServer.c */
-int SguilRecvAgentMsg(SpoSguilData *ssd_data, char *line_to_return)
+int SguilRecvAgentMsg(SpoSguilData *ssd_data, char *line_to_return, int timeout)
 {
-	static int			rcv_ptr = 0;
-	static char			rcv_msg[MAX_MSG_LEN];
-	static int			n;
 	struct timeval		tv;
 	fd_set				read_fds;
-	int					offset;
-
-	offset=0;
+    char				*eol;
+    size_t				len;
+    ssize_t				n;
 
-	/* wait up to 15 secs for our response */
-	tv.tv_sec = 15;
+	/* wait up to timeout secs for our response */
+	tv.tv_sec = timeout;
 	tv.tv_usec = 0;
 
-	FD_ZERO(&read_fds);
-	FD_SET(ssd_data->agent_sock, &read_fds);
-
     /* loop listening for external signals */
 	while (exit_signal == 0)
 	{
+        /* another line is still in the buffer */
+        eol = memchr(ssd_data->rcv_buf, 0x0A, ssd_data->rcv_len);
+
+        if (eol != NULL)
+        {
+            len = eol - ssd_data->rcv_buf;
+            memcpy(line_to_return, ssd_data->rcv_buf, len);
+            line_to_return[len] = '\0';
+
+            ssd_data->rcv_len -= len + 1;
+            memmove(ssd_data->rcv_buf, eol + 1, ssd_data->rcv_len);
+            return 0;
+        }
+
+        if (ssd_data->rcv_len == MAX_MSG_LEN - 1)
+        {
+            LogMessage("sguil: Discarding overlong response from sensor_agent.\n");
+            ssd_data->rcv_len = 0;
+        }
+
+		FD_ZERO(&read_fds);
+		FD_SET(ssd_data->agent_sock, &read_fds);
 
 		/* wait for response from sguild */
-		select(ssd_data->agent_sock+1, &read_fds, NULL, NULL, &tv);
+		if (select(ssd_data->agent_sock+1, &read_fds, NULL, NULL, &tv) < 0 && errno == EINTR)
+            continue;
 
 		if ( !(FD_ISSET(ssd_data->agent_sock, &read_fds)) )
 		{
 			/* timed out */
-			if (BcLogVerbose())
+			if (timeout && BcLogVerbose())
 				LogMessage("sguil: Timed out waiting for response.\n");
 
 			return 1;
 		}
-		else
-		{
-			if (rcv_ptr == 0)
-			{
-				memset(rcv_msg,0x0,MAX_MSG_LEN);
-				n = recv(ssd_data->agent_sock, rcv_msg, MAX_MSG_LEN, 0);
-				if (n < 0)
-				{
-					LogMessage("ERROR: Unable to read data.\n");
-
-					/* reconnect to sensor_agent */
-					SguilSensorAgentConnect(ssd_data);
-				}
-				else if (n == 0)
-				{
-					LogMessage("ERROR: Connecton closed by client\n");
-					close(ssd_data->agent_sock);
-
-					/* reconnect to sensor_agent */
-					SguilSensorAgentConnect(ssd_data);
-				}
-			}
-
-			/* if new data read on socket */
-			/* OR */
-			/* if another line is still in buffer */
-
-			/* copy line into 'line_to_return' */
-			while (*(rcv_msg+rcv_ptr) != 0x0A && rcv_ptr < n )
-			{
-				memcpy(line_to_return+offset,rcv_msg+rcv_ptr,1);
-				offset++;
-				rcv_ptr++;
-			}
 
-			/* end of line + end of buffer => return line */
-			if (rcv_ptr == (n - 1))
-			{
-				/* set last byte to END_LINE */
-				*(line_to_return + offset) = 0x0A;
-				rcv_ptr = 0;
+        n = recv(ssd_data->agent_sock, ssd_data->rcv_buf + ssd_data->rcv_len,
+                MAX_MSG_LEN - 1 - ssd_data->rcv_len, 0);
 
-				return ++offset;
-			}
+        if (n <= 0)
+        {
+            if (n < 0)
+                LogMessage("ERROR: Unable to read data.\n");
+            else
+                LogMessage("ERROR: Connecton closed by client\n");
 
-			/* end of line but still some data in buffer => return line */
-			if (rcv_ptr < (n - 1))
-			{
-				/* set last byte to END_LINE */
-		        *(line_to_return+offset) = 0x0A;
-			    rcv_ptr++;
+            close(ssd_data->agent_sock);
 
-				return ++offset;
-			}
+            /* reconnect to sensor_agent */
+            SguilSensorAgentConnect(ssd_data);
+            return 2;
+        }
 
-			/* end of buffer but line is not ended => */
-			/*  wait for more data to arrive on socket */
-			if (rcv_ptr == n)
-			{
-				rcv_ptr = 0;
-			}
-		}
+        ssd_data->rcv_len += n;
 	}
 
-	return 0;
-}
-
-char *SguilTimestamp(u_int32_t sec)
-{
-    struct tm           *lt;  /* localtime */
-    char                *buf;
-    time_t              Time = sec;
-
-    buf = (char *)SnortAlloc(TMP_BUFFER * sizeof(char));
-
-	if (BcOutputUseUtc())
-		lt = gmtime(&Time);
-	else
-		lt = localtime(&Time);
-
-    SnortSnprintf(buf, TMP_BUFFER, "%04i-%02i-%02i %02i:%02i:%02i",
-					1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-					lt->tm_hour, lt->tm_min, lt->tm_sec);
-  return buf;
+	return 1;
 }
 
-void SguilCleanExitFunc(int signal, void *arg)
+static void SguilCleanup(SpoSguilData *ssd_data)
 {
-    SpoSguilData *ssd_data = (SpoSguilData *)arg;
-
-    DEBUG_WRAP(DebugMessage(DEBUG_LOG,"SguilCleanExitFunc\n"););
+    u_int32_t i;
 
     /* free allocated memory from SpoSguilData */
 	if (ssd_data)
 	{
+	    if (ssd_data->window_cnt > 0 && BcLogVerbose())
+	        LogMessage("sguil: %u events were not confirmed by sensor_agent\n",
+	                ssd_data->window_cnt);
 
 	    if(ssd_data->agent_sock > 0)
 	    {
@@ -1216,7 +1317,19 @@ void SguilCleanExitFunc(int signal, void *arg)
 		ssd_data->agent_sock = -1;
 	    }
 	    
-	    
+	    if (ssd_data->window)
+	    {
+		for (i = 0; i < ssd_data->window_size; i++)
+		    free(ssd_data->window[i].buf);
+		free(ssd_data->window);
+	    }
+
+	    if (ssd_data->rt_prefix)
+		free(ssd_data->rt_prefix);
+
+	    if (ssd_data->rt_sensor)
+		free(ssd_data->rt_sensor);
+
 	    if (ssd_data->sensor_name)
 		free(ssd_data->sensor_name);
 	    
@@ -1231,39 +1344,18 @@ void SguilCleanExitFunc(int signal, void *arg)
 	    
 	    free(ssd_data);
 	}
-
 }
 
-void SguilRestartFunc(int signal, void *arg)
+void SguilCleanExitFunc(int signal, void *arg)
 {
-    SpoSguilData *ssd_data = (SpoSguilData *)arg;
-
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"SguilCleanExitFunc\n"););
 
-    /* free allocated memory from SpoSguilData */
-	if (ssd_data)
-	{
-
-	    if(ssd_data->agent_sock > 0)
-	    {
-		close(ssd_data->agent_sock);
-		ssd_data->agent_sock = -1;
-	    }
-	    
-	    if (ssd_data->sensor_name)
-		free(ssd_data->sensor_name);
-	    
-	    if (ssd_data->tag_path)
-		free(ssd_data->tag_path);
-	    
-	    if (ssd_data->passwd)
-		free(ssd_data->passwd);
-	    
-	    if (ssd_data->args)
-		free(ssd_data->args);
-	    
-	    free(ssd_data);
-	}
+    SguilCleanup((SpoSguilData *)arg);
 }
 
+void SguilRestartFunc(int signal, void *arg)
+{
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG,"SguilRestartFunc\n"););
 
+    SguilCleanup((SpoSguilData *)arg);
+}
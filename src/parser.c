@@ -194,6 +194,7 @@ static const ConfigFunc config_opts[] =
     { CONFIG_OPT__ALERT_ON_EACH_PACKET_IN_STREAM, 0, 1, ConfigAlertOnEachPacketInStream },
     { CONFIG_OPT__ALERT_WITH_IFACE_NAME, 0, 1, ConfigAlertWithInterfaceName },
     { CONFIG_OPT__ARCHIVE_DIR, 1, 1, ConfigArchiveDir },
+    { CONFIG_OPT__BATCH_MAX_DELAY, 1, 1, ConfigBatchMaxDelay },
     { CONFIG_OPT__CHROOT_DIR, 1, 1, ConfigChrootDir },
     { CONFIG_OPT__CLASSIFICATION, 1, 0, ConfigClassification },
     { CONFIG_OPT__CLASSIFICATION_FILE, 1, 0, ConfigClassificationFile },
@@ -206,6 +207,8 @@ static const ConfigFunc config_opts[] =
     { CONFIG_OPT__HOSTNAME, 1, 0, ConfigHostname },
     { CONFIG_OPT__INTERFACE, 1, 1, ConfigInterface },
     { CONFIG_OPT__LOG_DIR, 1, 1, ConfigLogDir },
+    { CONFIG_OPT__LOG_RATE_LIMIT, 1, 1, ConfigLogRateLimit },
+    { CONFIG_OPT__METRICS, 1, 1, ConfigMetrics },
     { CONFIG_OPT__SPOOL_DIR, 1, 0, ConfigSpoolDirectory },
     { CONFIG_OPT__SPOOL_FILEBASE, 1, 1, ConfigSpoolFilebase },
     { CONFIG_OPT__OBFUSCATE, 0, 1, ConfigObfuscate },
@@ -331,15 +334,14 @@ Barnyard2Config * ParseBarnyard2Conf(void)
 
 void ParseInput(Barnyard2Config *bc, char *args)
 {
-    char **toks;
+    MSpan toks[2];
     int num_toks;
-    char *opts = NULL;
     InputConfig *config;
 
-    toks = mSplit(args, ":", 2, &num_toks, '\\');
-
-    if (num_toks > 1)
-        opts = toks[1];
+    /* args may be a literal, the tokens are copied out */
+    num_toks = mSplitSpan(args, strlen(args), ":", 2, toks, 2, '\\', 0);
+    if (num_toks < 1)
+        ParseError("Missing input plugin name.");
 
     config = (InputConfig *)SnortAlloc(sizeof(InputConfig));
 
@@ -357,9 +359,9 @@ void ParseInput(Barnyard2Config *bc, char *args)
         tmp->next = config;
     }
 
-    config->keyword = SnortStrdup(toks[0]);
-    if (opts != NULL)
-        config->opts = SnortStrdup(opts);
+    config->keyword = mSpanDup(&toks[0], ":", '\\');
+    if (num_toks > 1)
+        config->opts = SnortStrndup(toks[1].ptr, toks[1].len);
 
     /* This could come from parsing the command line */
     if (file_name != NULL)
@@ -367,8 +369,6 @@ void ParseInput(Barnyard2Config *bc, char *args)
         config->file_name = SnortStrdup(file_name);
         config->file_line = file_line;
     }
-
-    mSplitFree(&toks, num_toks);
 }
 
 void ConfigureInputPlugins(Barnyard2Config *bc)
@@ -404,15 +404,14 @@ void ConfigureInputPlugins(Barnyard2Config *bc)
 
 void ParseOutput(Barnyard2Config *bc, char *args)
 {
-    char **toks;
+    MSpan toks[2];
     int num_toks;
-    char *opts = NULL;
     OutputConfig *config;
 
-    toks = mSplit(args, ":", 2, &num_toks, '\\');
-
-    if (num_toks > 1)
-        opts = toks[1];
+    /* args may be a literal, the tokens are copied out */
+    num_toks = mSplitSpan(args, strlen(args), ":", 2, toks, 2, '\\', 0);
+    if (num_toks < 1)
+        ParseError("Missing output plugin name.");
 
     config = (OutputConfig *)SnortAlloc(sizeof(OutputConfig));
 
@@ -430,9 +429,9 @@ void ParseOutput(Barnyard2Config *bc, char *args)
         tmp->next = config;
     }
 
-    config->keyword = SnortStrdup(toks[0]);
-    if (opts != NULL)
-        config->opts = SnortStrdup(opts);
+    config->keyword = mSpanDup(&toks[0], ":", '\\');
+    if (num_toks > 1)
+        config->opts = SnortStrndup(toks[1].ptr, toks[1].len);
 
     /* This could come from parsing the command line */
     if (file_name != NULL)
@@ -440,8 +439,6 @@ void ParseOutput(Barnyard2Config *bc, char *args)
         config->file_name = SnortStrdup(file_name);
         config->file_line = file_line;
     }
-
-    mSplitFree(&toks, num_toks);
 }
 
 static void TransferOutputConfigs(OutputConfig *from_list, OutputConfig **to_list)
@@ -612,7 +609,9 @@ void ConfigureOutputPlugins(Barnyard2Config *bc)
         if (func == NULL)
             ParseError("Unknown output plugin: \"%s\"", config->keyword);
 
+        SetOutputPluginName(config->keyword);
         func(config->opts);
+        SetOutputPluginName(NULL);
     }
 
     /* Reset these since we're done with configuring dynamic preprocessors */
@@ -1291,27 +1290,28 @@ char * ProcessFileOption(Barnyard2Config *bc, const char *filespec)
 
 static void ParseConfig(Barnyard2Config *bc, char *args)
 {
-    char **toks;
+    MSpan toks[2];
     int num_toks;
     char *opts = NULL;
     int i;
 
     DEBUG_WRAP(DebugMessage(DEBUG_CONFIGRULES,"Rule file config\n"););
 
-    toks = mSplit(args, ":", 2, &num_toks, 0);
+    num_toks = mSplitSpan(args, strlen(args), ":", 2, toks, 2, 0, MSPLIT_TERMINATE);
+    if (num_toks < 1)
+        ParseError("Unknown config directive: %s.", args);
 
-    DEBUG_WRAP(DebugMessage(DEBUG_CONFIGRULES,"Opt: %s\n", toks[0]););
+    DEBUG_WRAP(DebugMessage(DEBUG_CONFIGRULES,"Opt: %s\n", toks[0].ptr););
 
     if (num_toks > 1)
     {
-  
-        opts = SnortStrdup(toks[1]);
+        opts = toks[1].ptr;
         DEBUG_WRAP(DebugMessage(DEBUG_CONFIGRULES,"Args: %s\n", opts););
     }
 
     for (i = 0; config_opts[i].name != NULL; i++)
     {
-        if (strcasecmp(toks[0], config_opts[i].name) == 0)
+        if (strcasecmp(toks[0].ptr, config_opts[i].name) == 0)
         {
             if (config_opts[i].only_once && config_opt_configured[i])
             {
@@ -1319,13 +1319,13 @@ static void ParseConfig(Barnyard2Config *bc, char *args)
                  * This array is reset for each policy read in so this is
                  * on a per policy basis */
                 ParseError("Config option \"%s\" can only be "
-                           "configured once.", toks[0]);
+                           "configured once.", toks[0].ptr);
             }
 
             if (config_opts[i].args_required && (opts == NULL))
             {
                 /* Need arguments and there are none */
-                 ParseError("Config option \"%s\" requires arguments.", toks[0]);
+                 ParseError("Config option \"%s\" requires arguments.", toks[0].ptr);
             }
 
             config_opts[i].parse_func(bc, opts);
@@ -1337,16 +1337,8 @@ static void ParseConfig(Barnyard2Config *bc, char *args)
     if (config_opts[i].name == NULL)
     {
         /* Didn't find a matching config option */
-        ParseError("Unknown config directive: %s.", toks[0]);
+        ParseError("Unknown config directive: %s.", toks[0].ptr);
     }
-
-    mSplitFree(&toks, num_toks);
-
-    if(opts)
-    {
-	free(opts);
-    }
-
 }
 
 /*
@@ -1484,7 +1476,7 @@ static void ParseConfigFile(Barnyard2Config *bc, char *fname)
          * if it's there we need to get the next line in the file */
         if (ContinuationCheck(index) == 0) 
         {
-            char **toks;
+            MSpan toks[2];
             int num_toks;
             char *keyword;
             char *args;
@@ -1493,20 +1485,20 @@ static void ParseConfigFile(Barnyard2Config *bc, char *fname)
             DEBUG_WRAP(DebugMessage(DEBUG_CONFIGRULES,
                                     "[*] Processing keyword: %s\n", index););
 
-            /* Get the keyword and args */
-            toks = mSplit(index, " \t", 2, &num_toks, 0);
+            /* Get the keyword and args, terminated in the line */
+            num_toks = mSplitSpan(index, strlen(index), " \t", 2, toks, 2, 0, MSPLIT_TERMINATE);
             if (num_toks != 2)
                 ParseError("Invalid configuration line: %s", index);
 
-            keyword = SnortStrdup(ExpandVars(bc, toks[0]));
-            args = toks[1];
+            keyword = SnortStrdup(ExpandVars(bc, toks[0].ptr));
+            args = toks[1].ptr;
 
             for (i = 0; barnyard2_conf_keywords[i].name != NULL; i++)
             {
                 if (strcasecmp(keyword, barnyard2_conf_keywords[i].name) == 0)
                 {
                     if (barnyard2_conf_keywords[i].expand_vars)
-                        args = SnortStrdup(ExpandVars(bc, toks[1]));
+                        args = SnortStrdup(ExpandVars(bc, toks[1].ptr));
 
                     barnyard2_conf_keywords[i].parse_func(bc, args);
 
@@ -1514,11 +1506,10 @@ static void ParseConfigFile(Barnyard2Config *bc, char *fname)
                 }
             }
 
-            if (args != toks[1])
+            if (args != toks[1].ptr)
                 free(args);
 
             free(keyword);
-            mSplitFree(&toks, num_toks);
 
             if(new_line != NULL)
             {
@@ -1602,6 +1593,27 @@ void ConfigSetEventCacheSize(Barnyard2Config *bc, char *args)
     return;
 }
 
+/* log_rate_limit: <messages per second per call site>[, <burst>] */
+void ConfigLogRateLimit(Barnyard2Config *bc, char *args)
+{
+    char *endp;
+
+    if ((bc == NULL) || (args == NULL))
+        return;
+
+    bc->log_rate = strtoul(args, &endp, 10);
+    if (endp == args)
+        ParseError("log_rate_limit: expected a number, got \"%s\"", args);
+
+    while ((*endp == ',') || isspace((int)*endp))
+        endp++;
+
+    if (*endp != '\0')
+        bc->log_burst = strtoul(endp, NULL, 10);
+    else if (bc->log_burst < bc->log_rate)
+        bc->log_burst = bc->log_rate;
+}
+
 void ConfigDisableAlertOnEachPacketInStream(Barnyard2Config *bc, char *args)
 {
     if (bc == NULL)
@@ -1618,6 +1630,27 @@ void ConfigArchiveDir(Barnyard2Config *bc, char *args)
     bc->archive_dir = SnortStrdup(args);
 }
 
+/* batch_max_delay: <msecs a batch of records may wait to be flushed> */
+void ConfigBatchMaxDelay(Barnyard2Config *bc, char *args)
+{
+    char *endp;
+
+    if ((bc == NULL) || (args == NULL))
+        return;
+
+    bc->batch_max_delay = strtoul(args, &endp, 10);
+    if ((endp == args) || (bc->batch_max_delay == 0))
+        ParseError("batch_max_delay: expected a number of msecs above 0, got \"%s\"", args);
+}
+
+void ConfigMetrics(Barnyard2Config *bc, char *args)
+{
+    if ((args == NULL) || (bc == NULL) || (bc->metrics_listen != NULL))
+        return;
+
+    bc->metrics_listen = SnortStrdup(args);
+}
+
 void ConfigAlertWithInterfaceName(Barnyard2Config *bc, char *args)
 {
     if (bc == NULL)
@@ -1641,7 +1674,7 @@ void ConfigChrootDir(Barnyard2Config *bc, char *args)
 
 void ConfigClassification(Barnyard2Config *bc, char *args)
 {
-    char **toks;
+    MSpan toks[3];
     int num_toks;
     char *endptr;
     ClassType *new_node, *current;
@@ -1650,21 +1683,25 @@ void ConfigClassification(Barnyard2Config *bc, char *args)
     if ((args == NULL) || (bc == NULL))
         return;
 
-    toks = mSplit(args, ",", 0, &num_toks, '\\');
+    /* views, args is left as it is for the errors */
+    num_toks = mSplitSpan(args, strlen(args), ",", 0, toks, 3, '\\', 0);
     if (num_toks != 3)
         ParseError("Invalid classification config: %s.", args);
 
     /* create the new node */
     new_node = (ClassType *)SnortAlloc(sizeof(ClassType));
 
-    new_node->type = SnortStrdup(toks[0]);
-    new_node->name = SnortStrdup(toks[1]);
+    new_node->type = mSpanDup(&toks[0], ",", '\\');
+    new_node->name = mSpanDup(&toks[1], ",", '\\');
 
-    new_node->priority = strtol(toks[2], &endptr, 0);
-    if ((errno == ERANGE) || (*endptr != '\0') || (new_node->priority <= 0))
+    /* the last tok ends where args does, less trailing whitespace */
+    new_node->priority = strtol(toks[2].ptr, &endptr, 0);
+    if ((errno == ERANGE) || (endptr != toks[2].ptr + toks[2].len) ||
+        (new_node->priority <= 0))
     {
         ParseError("Invalid argument for classification priority "
-                   "configuration: %s.  Must be a positive integer.", toks[2]);
+                   "configuration: %.*s.  Must be a positive integer.",
+                   (int)toks[2].len, toks[2].ptr);
     }
 
     current = bc->classifications;
@@ -1691,7 +1728,6 @@ void ConfigClassification(Barnyard2Config *bc, char *args)
         free(new_node->name);
         free(new_node->type);
         free(new_node);
-        mSplitFree(&toks, num_toks);
         return;
     }
 
@@ -1699,8 +1735,6 @@ void ConfigClassification(Barnyard2Config *bc, char *args)
     new_node->id = max_id + 1;
     new_node->next = bc->classifications;
     bc->classifications = new_node;
-
-    mSplitFree(&toks, num_toks);
 }
 
 void ConfigClassificationFile(Barnyard2Config *bc, char *args)
@@ -1833,8 +1867,8 @@ void ConfigObfuscationMask(Barnyard2Config *bc, char *args)
 {
 #ifndef SUP_IP6
     struct in_addr net;       /* place to stick the local network data */
-    char **toks;              /* dbl ptr to store mSplit return data in */
-    int num_toks;             /* number of tokens mSplit returns */
+    MSpan toks[2];            /* address and CIDR, terminated in args */
+    int num_toks;             /* number of tokens mSplitSpan returns */
     int nmask;                /* temporary netmask storage */
 # ifdef DEBUG
     struct in_addr sin;
@@ -1851,12 +1885,12 @@ void ConfigObfuscationMask(Barnyard2Config *bc, char *args)
     bc->output_flags |= OUTPUT_FLAG__OBFUSCATE;
 #else
     /* break out the CIDR notation from the IP address */
-    toks = mSplit(args, "/", 2, &num_toks, 0);
+    num_toks = mSplitSpan(args, strlen(args), "/", 2, toks, 2, 0, MSPLIT_TERMINATE);
 
     if(num_toks > 1)
     {
         /* convert the CIDR notation into a real live netmask */
-        nmask = atoi(toks[1]);
+        nmask = atoi(toks[1].ptr);
 
         if((nmask > 0) && (nmask < 33))
         {
@@ -1864,8 +1898,8 @@ void ConfigObfuscationMask(Barnyard2Config *bc, char *args)
         }
         else
         {
-            ParseError("Bad CIDR block (%s) in obfuscation mask %s. "
-                       "1 to 32 please!", toks[1], args);
+            ParseError("Bad CIDR block (%s) in obfuscation mask %s/%s. "
+                       "1 to 32 please!", toks[1].ptr, toks[0].ptr, toks[1].ptr);
         }
     }
     else
@@ -1877,8 +1911,8 @@ void ConfigObfuscationMask(Barnyard2Config *bc, char *args)
                             bc->obfuscation_mask););
 
     /* convert the IP addr into its 32-bit value */
-    if((net.s_addr = inet_addr(toks[0])) == INADDR_NONE)
-        ParseError("Obfuscation mask (%s) didn't translate.", toks[0]);
+    if((net.s_addr = inet_addr(toks[0].ptr)) == INADDR_NONE)
+        ParseError("Obfuscation mask (%s) didn't translate.", toks[0].ptr);
 
     DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Obfuscation Net = %s (%X)\n", 
                             inet_ntoa(net), net.s_addr););
@@ -1894,8 +1928,6 @@ void ConfigObfuscationMask(Barnyard2Config *bc, char *args)
 
     bc->obfuscation_mask = ~bc->obfuscation_mask;
     bc->output_flags |= OUTPUT_FLAG__OBFUSCATE;
-
-    mSplitFree(&toks, num_toks);
 #endif
 }
 
@@ -1924,28 +1956,26 @@ void ConfigQuiet(Barnyard2Config *bc, char *args)
 
 void ConfigReference(Barnyard2Config *bc, char *args)
 {
-    char **toks;
+    MSpan toks[2];
     int num_toks;
     char *url = NULL;
 
     if ((bc == NULL) || (args == NULL))
         return;
 
-    /* 2 tokens: name <url> */
-    toks = mSplit(args, " \t", 0, &num_toks, 0);
+    /* 2 tokens: name <url>, -1 for more */
+    num_toks = mSplitSpan(args, strlen(args), " \t", 0, toks, 2, 0, MSPLIT_TERMINATE);
 
-    if (num_toks > 2)
+    if ((num_toks < 1) || (num_toks > 2))
     {
         ParseError("Reference config requires at most two arguments: "
                    "\"name [<url>]\".");
     }
 
     if (num_toks == 2)
-        url = toks[1];
+        url = toks[1].ptr;
     
-    ReferenceSystemAdd(&bc->references, toks[0], url);
-
-    mSplitFree(&toks, num_toks);
+    ReferenceSystemAdd(&bc->references, toks[0].ptr, url);
 }
 
 void ConfigReferenceFile(Barnyard2Config *bc, char *args)
@@ -1953,6 +1983,11 @@ void ConfigReferenceFile(Barnyard2Config *bc, char *args)
     if ((args == NULL) || (bc == NULL) )
         return;
 
+    /* kept for the SIGHUP reload */
+    if (bc->reference_file != NULL)
+        free(bc->reference_file);
+    bc->reference_file = SnortStrdup(args);
+
     ReadReferenceFile(bc, args);
 }
 
@@ -1970,8 +2005,8 @@ void ConfigReferenceNet(Barnyard2Config *bc, char *args)
 {
 #ifndef SUP_IP6
     struct in_addr net;    /* place to stick the local network data */
-    char **toks;           /* dbl ptr to store mSplit return data in */
-    int num_toks;          /* number of tokens mSplit returns */
+    MSpan toks[2];         /* address and CIDR, terminated in args */
+    int num_toks;          /* number of tokens mSplitSpan returns */
     int nmask;             /* temporary netmask storage */
 # ifdef DEBUG
     struct in_addr sin;
@@ -1986,12 +2021,12 @@ void ConfigReferenceNet(Barnyard2Config *bc, char *args)
 #else
 
     /* break out the CIDR notation from the IP address */
-    toks = mSplit(args, "/", 2, &num_toks, 0);
+    num_toks = mSplitSpan(args, strlen(args), "/", 2, toks, 2, 0, MSPLIT_TERMINATE);
 
     if(num_toks > 1)
     {
         /* convert the CIDR notation into a real live netmask */
-        nmask = atoi(toks[1]);
+        nmask = atoi(toks[1].ptr);
 
         if((nmask > 0) && (nmask < 33))
         {
@@ -1999,8 +2034,8 @@ void ConfigReferenceNet(Barnyard2Config *bc, char *args)
         }
         else
         {
-            ParseError("Bad CIDR block (%s) in obfuscation mask %s. "
-                       "1 to 32 please!", toks[1], args);
+            ParseError("Bad CIDR block (%s) in obfuscation mask %s/%s. "
+                       "1 to 32 please!", toks[1].ptr, toks[0].ptr, toks[1].ptr);
         }
     }
     else
@@ -2012,8 +2047,8 @@ void ConfigReferenceNet(Barnyard2Config *bc, char *args)
                             bc->netmask););
 
     /* convert the IP addr into its 32-bit value */
-    if((net.s_addr = inet_addr(toks[0])) == INADDR_NONE)
-        ParseError("Homenet (%s) didn't translate", toks[0]);
+    if((net.s_addr = inet_addr(toks[0].ptr)) == INADDR_NONE)
+        ParseError("Homenet (%s) didn't translate", toks[0].ptr);
 
     DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Net = %s (%X)\n",
                             inet_ntoa(net), net.s_addr););
@@ -2026,8 +2061,6 @@ void ConfigReferenceNet(Barnyard2Config *bc, char *args)
     DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Homenet = %s (%X)\n",
                             inet_ntoa(sin), sin.s_addr););
 # endif
-
-    mSplitFree(&toks, num_toks);
 #endif
 }
 
@@ -2585,16 +2618,17 @@ int SigSuppressAddElement(SigSuppress_list **sHead,SigSuppress_list *sElement)
 
 void ConfigSigSuppress(Barnyard2Config *bc, char *args)
 {
-    char **toks = NULL;
+    MSpan *toks = NULL;
     int num_toks = 0;
     int ptoks = 0;
+    char *p;
     
     char gid_string[256] = {0};
 
-    char **range_toks = NULL;
+    MSpan range_toks[2];
     int range_num_toks = 0;
     
-    char **gid_toks = NULL;
+    MSpan gid_toks[2];
     char *gid_sup_toks = NULL;
     int gid_num_toks = 0;
     
@@ -2605,24 +2639,40 @@ void ConfigSigSuppress(Barnyard2Config *bc, char *args)
 	return;
     }
 
-    toks = mSplit(args, ",", 0, &num_toks, 0);
+    /* a tok per comma at most, terminated in args */
+    for(p = args, num_toks = 1; *p != '\0'; p++)
+    {
+	if(*p == ',')
+	    num_toks++;
+    }
+
+    toks = (MSpan *)SnortAlloc(num_toks * sizeof(MSpan));
+    num_toks = mSplitSpan(args, strlen(args), ",", 0, toks, num_toks, 0, MSPLIT_TERMINATE);
     
     while(ptoks < num_toks)
     {
 	memset(gid_string,'\0',256);
 	
-	gid_toks = mSplit(toks[ptoks], ":", 2, &gid_num_toks, 0);
+	/* views, the gid only goes to gid_string */
+	gid_num_toks = mSplitSpan(toks[ptoks].ptr, toks[ptoks].len, ":", 2, gid_toks, 2, 0, 0);
 	
 	if(gid_num_toks == 1)
 	{
 	    DEBUG_WRAP(DebugMessage(DEBUG_SID_SUPPRESS_PARSE,"Defaulting gid 1 for toks [%s]\n",
-				    toks[ptoks]););
+				    toks[ptoks].ptr););
 	    t_supp_elem.gid = 1;    
-	    gid_sup_toks = toks[ptoks];
+	    gid_sup_toks = toks[ptoks].ptr;
 	}
 	else if(gid_num_toks == 2)
 	{
-	    memcpy(gid_string,gid_toks[0],strlen(gid_toks[0]));
+	    if(gid_toks[0].len >= sizeof(gid_string))
+	    {
+		FatalError("[%s()]: Invalid gid for [%s]\n",
+			   __FUNCTION__,
+			   toks[ptoks].ptr);
+	    }
+
+	    memcpy(gid_string,gid_toks[0].ptr,gid_toks[0].len);
 	    
 	    if( BY2Strtoul(gid_string,&t_supp_elem.gid))
 	    {
@@ -2631,18 +2681,20 @@ void ConfigSigSuppress(Barnyard2Config *bc, char *args)
 	    
 	    DEBUG_WRAP(DebugMessage(DEBUG_SID_SUPPRESS_PARSE,"Using gid [%d] for toks [%s]\n",
 				    t_supp_elem.gid,
-				    toks[ptoks]););
+				    toks[ptoks].ptr););
 	    
-	    gid_sup_toks = gid_toks[1];
+	    /* the rest of toks[ptoks], so NUL terminated already */
+	    gid_sup_toks = gid_toks[1].ptr;
 	}
 	else
 	{
 	    FatalError("[%s()]: Invalid gid split value for [%s]\n",
 		       __FUNCTION__,
-		       toks[ptoks]);
+		       toks[ptoks].ptr);
 	}
 	
-	range_toks = mSplit(gid_sup_toks, "-", 0, &range_num_toks, 0);
+	/* -1 for more than two */
+	range_num_toks = mSplitSpan(gid_sup_toks, strlen(gid_sup_toks), "-", 0, range_toks, 2, 0, MSPLIT_TERMINATE);
 	
 	if(range_num_toks == 1)
 	{
@@ -2661,35 +2713,36 @@ void ConfigSigSuppress(Barnyard2Config *bc, char *args)
 	}
 	else if(range_num_toks == 2)
 	{
-	    DEBUG_WRAP(DebugMessage(DEBUG_SID_SUPPRESS_PARSE,"Got range [%s] : [%s] [%s] \n",
-				    gid_sup_toks,
-				    range_toks[0],
-				    range_toks[1]););
+	    DEBUG_WRAP(DebugMessage(DEBUG_SID_SUPPRESS_PARSE,"Got range [%s] [%s] \n",
+				    range_toks[0].ptr,
+				    range_toks[1].ptr););
 	    
 	    t_supp_elem.ss_type = SS_RANGE;
 	    
-	    if( BY2Strtoul(range_toks[0],&t_supp_elem.ss_min))
+	    if( BY2Strtoul(range_toks[0].ptr,&t_supp_elem.ss_min))
             {
                 FatalError("[%s] \n",__FUNCTION__);
             }
 	    
-	    if( BY2Strtoul(range_toks[1],&t_supp_elem.ss_max))
+	    if( BY2Strtoul(range_toks[1].ptr,&t_supp_elem.ss_max))
             {
                 FatalError("[%s] \n",__FUNCTION__);
             }
 	    
 	    if(t_supp_elem.ss_min > t_supp_elem.ss_max)
 	    {
-		FatalError("[%s()], Min greater than max, invalid range [%s] \n",
+		FatalError("[%s()], Min greater than max, invalid range [%s-%s] \n",
 			   __FUNCTION__,
-			   gid_sup_toks);
+			   range_toks[0].ptr,
+			   range_toks[1].ptr);
 	    }
 	    
 	    if(t_supp_elem.ss_min == t_supp_elem.ss_max)
 	    {
-		FatalError("[%s()], Min equal than max, invalid range [%s] \n",
+		FatalError("[%s()], Min equal than max, invalid range [%s-%s] \n",
 			   __FUNCTION__,
-			   gid_sup_toks);
+			   range_toks[0].ptr,
+			   range_toks[1].ptr);
 	    }
 	}
 	else
@@ -2697,8 +2750,6 @@ void ConfigSigSuppress(Barnyard2Config *bc, char *args)
 	    FatalError("element[%s] is an invalid range \n",gid_sup_toks);
 	}
 	
-       	mSplitFree(&range_toks, range_num_toks);
-	mSplitFree(&gid_toks, gid_num_toks);
 	
 	if(SigSuppressAddElement(BCGetSigSuppressHead(),&t_supp_elem))
 	{
@@ -2709,7 +2760,7 @@ void ConfigSigSuppress(Barnyard2Config *bc, char *args)
 	ptoks++;
     }
     
-    mSplitFree(&toks, num_toks);
+    free(toks);
     return;
 }
 
@@ -2773,15 +2824,16 @@ void ConfigMplsPayloadType(Barnyard2Config *bc, char *args)
 #ifdef SUP_IP6
 static void ParseIpVar(Barnyard2Config *bc, char *args)
 {
-    char **toks;
+    MSpan toks[2];
     int num_toks;
 
     DEBUG_WRAP(DebugMessage(DEBUG_CONFIGRULES, "IpVar\n"););
 
-    toks = mSplit(args, " \t", 0, &num_toks, 0);
+    /* name and value, terminated in args; -1 for more */
+    num_toks = mSplitSpan(args, strlen(args), " \t", 0, toks, 2, 0, MSPLIT_TERMINATE);
     if (num_toks != 2)
     {
-        ParseError("Missing argument to %s", toks[0]);
+        ParseError("Missing argument to %s", args);
     }
 
     /* Check command line variables to see if this has already
@@ -2793,9 +2845,8 @@ static void ParseIpVar(Barnyard2Config *bc, char *args)
         while (tmp != NULL)
         {
             /* Already defined this via command line */
-            if (strcasecmp(toks[0], tmp->name) == 0)
+            if (strcasecmp(toks[0].ptr, tmp->name) == 0)
             {
-                mSplitFree(&toks, num_toks);
                 return;
             }
 
@@ -2803,10 +2854,9 @@ static void ParseIpVar(Barnyard2Config *bc, char *args)
         }
     }
 
-    DisallowCrossTableDuplicateVars(bc, toks[0], VAR_TYPE__IPVAR);
-    sfvt_define(bc->ip_vartable, toks[0], toks[1]);
+    DisallowCrossTableDuplicateVars(bc, toks[0].ptr, VAR_TYPE__IPVAR);
+    sfvt_define(bc->ip_vartable, toks[0].ptr, toks[1].ptr);
 
-    mSplitFree(&toks, num_toks);
 }
 #else
 static void ParseIpVar(Barnyard2Config *bc, char *args)
@@ -2817,15 +2867,16 @@ static void ParseIpVar(Barnyard2Config *bc, char *args)
 
 static void ParseVar(Barnyard2Config *bc, char *args)
 {
-    char **toks;
+    MSpan toks[2];
     int num_toks;
 
     DEBUG_WRAP(DebugMessage(DEBUG_CONFIGRULES,"Variable\n"););
 
-    toks = mSplit(args, " \t", 0, &num_toks, 0);
+    /* name and value, terminated in args; -1 for more */
+    num_toks = mSplitSpan(args, strlen(args), " \t", 0, toks, 2, 0, MSPLIT_TERMINATE);
     if (num_toks != 2)
     {
-        ParseError("Missing argument to %s", toks[0]);
+        ParseError("Missing argument to %s", args);
     }
 
     /* Check command line variables to see if this has already
@@ -2837,9 +2888,8 @@ static void ParseVar(Barnyard2Config *bc, char *args)
         while (tmp != NULL)
         {
            // Already defined this via command line 
-            if (strcasecmp(toks[0], tmp->name) == 0)
+            if (strcasecmp(toks[0].ptr, tmp->name) == 0)
             {
-                mSplitFree(&toks, num_toks);
                 return;
             }
 
@@ -2847,8 +2897,7 @@ static void ParseVar(Barnyard2Config *bc, char *args)
         }
     } 
 
-    AddVarToTable(bc, toks[0], toks[1]);
-    mSplitFree(&toks, num_toks);
+    AddVarToTable(bc, toks[0].ptr, toks[1].ptr);
 }
 
 static void AddVarToTable(Barnyard2Config *bc, char *name, char *value)
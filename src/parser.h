@@ -48,6 +48,7 @@
 #define CONFIG_OPT__ALERT_ON_EACH_PACKET_IN_STREAM  "alert_on_each_packet_in_stream"
 #define CONFIG_OPT__ALERT_WITH_IFACE_NAME           "alert_with_interface_name"
 #define CONFIG_OPT__ARCHIVE_DIR                     "archivedir"
+#define CONFIG_OPT__BATCH_MAX_DELAY                 "batch_max_delay"
 #define CONFIG_OPT__CHROOT_DIR                      "chroot"
 #define CONFIG_OPT__CLASSIFICATION                  "classification"
 #define CONFIG_OPT__CLASSIFICATION_FILE             "classification_file"
@@ -60,6 +61,8 @@
 #define CONFIG_OPT__HOSTNAME                        "hostname"
 #define CONFIG_OPT__INTERFACE                       "interface"
 #define CONFIG_OPT__LOG_DIR                         "logdir"
+#define CONFIG_OPT__LOG_RATE_LIMIT                  "log_rate_limit"
+#define CONFIG_OPT__METRICS                         "metrics"
 #define CONFIG_OPT__SPOOL_DIR                       "spooldir"
 #define CONFIG_OPT__SPOOL_FILEBASE                  "spoolfilebase"
 #define CONFIG_OPT__OBFUSCATE                       "obfuscate"
@@ -116,6 +119,7 @@ void ConfigDisableAlertOnEachPacketInStream(Barnyard2Config *, char *);
 void ConfigAlertOnEachPacketInStream(Barnyard2Config *, char *);
 void ConfigAlertWithInterfaceName(Barnyard2Config *, char *);
 void ConfigArchiveDir(Barnyard2Config *, char *);
+void ConfigBatchMaxDelay(Barnyard2Config *, char *);
 void ConfigChrootDir(Barnyard2Config *, char *);
 void ConfigClassification(Barnyard2Config *, char *);
 void ConfigClassificationFile(Barnyard2Config *, char *);
@@ -129,6 +133,8 @@ void ConfigGenFile(Barnyard2Config *, char *);
 void ConfigHostname(Barnyard2Config *, char *);
 void ConfigInterface(Barnyard2Config *, char *);
 void ConfigLogDir(Barnyard2Config *, char *);
+void ConfigLogRateLimit(Barnyard2Config *, char *);
+void ConfigMetrics(Barnyard2Config *, char *);
 void ConfigNoLoggingTimestamps(Barnyard2Config *, char *);
 void ConfigObfuscate(Barnyard2Config *, char *);
 void ConfigObfuscationMask(Barnyard2Config *, char *);
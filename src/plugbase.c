@@ -50,6 +50,8 @@
 #include "squirrel.h"
 #include "debug.h"
 #include "util.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include "unified2.h"
 
@@ -61,6 +63,7 @@
 #include "output-plugins/spo_alert_bro.h"
 #include "output-plugins/spo_alert_cef.h"
 #include "output-plugins/spo_alert_csv.h"
+#include "output-plugins/spo_alert_json.h"
 #include "output-plugins/spo_alert_fast.h"
 #include "output-plugins/spo_alert_full.h"
 #include "output-plugins/spo_alert_fwsam.h"
@@ -322,10 +325,16 @@ int InputFuncNodeConfigured(InputFuncNode *ifn)
 extern OutputConfigFuncNode *output_config_funcs;
 
 static void AppendOutputFuncList(OutputFunc, void *, OutputFuncNode **);
+static void OutputPluginMetrics(MetricsBuf *, void *);
+
+/* keyword of the output being configured, names its OutputFuncNodes */
+static const char *output_plugin_name = NULL;
 
 void RegisterOutputPlugins(void)
 {
     LogMessage("Initializing Output Plugins!\n");
+
+    MetricsRegister(OutputPluginMetrics, NULL);
     
     AlertCEFSetup();
     AlertSyslogSetup();
@@ -347,6 +356,7 @@ void RegisterOutputPlugins(void)
     AlertUnixSockSetup();
 #endif /* !WIN32 */
     AlertCSVSetup();
+    AlertJSONSetup();
     LogNullSetup();
     LogAsciiSetup();
 
@@ -539,6 +549,7 @@ void FreeOutputList(OutputFuncNode *list)
 
 	if(tmp != NULL)
 	{
+	    free(tmp->name);
 	    free(tmp);
 	}
     }
@@ -594,6 +605,63 @@ void AddFuncToOutputList(OutputFunc func, OutputType type, void *arg)
     }
 }
 
+/*
+ * func, already added with arg, wants the rest of an event's packets and
+ * extra data in the same call as the event (EventEP ex[]) instead of a LOG
+ * call per packet.
+ */
+void SetOutputFuncGroups(OutputFunc func, void *arg)
+{
+    OutputFuncNode *idx;
+
+    for (idx = AlertList; idx != NULL; idx = idx->next)
+    {
+        if (idx->func == func && idx->arg == arg)
+            idx->groups = 1;
+    }
+
+    for (idx = LogList; idx != NULL; idx = idx->next)
+    {
+        if (idx->func == func && idx->arg == arg)
+            idx->groups = 1;
+    }
+}
+
+/*
+ * func, already added to the flush list with arg, keeps the RingTopOct of
+ * a UNIFIED2_IDS_FLUSH and clears its r_flag once the batch is written.
+ * Flush functions that don't are done with a batch when they return.
+ */
+void SetOutputFuncHolds(OutputFunc func, void *arg)
+{
+    OutputFuncNode *idx;
+
+    for (idx = FlushList; idx != NULL; idx = idx->next)
+    {
+        if (idx->func == func && idx->arg == arg)
+            idx->holds = 1;
+    }
+}
+
+/* whether any flush function keeps batches */
+int OutputFuncHolds(void)
+{
+    OutputFuncNode *idx;
+
+    for (idx = FlushList; idx != NULL; idx = idx->next)
+    {
+        if (idx->holds)
+            return 1;
+    }
+
+    return 0;
+}
+
+void SetOutputPluginName(const char *name)
+{
+    output_plugin_name = name;
+}
+
 void AppendOutputFuncList(OutputFunc func, void *arg, OutputFuncNode **list)
 {
     OutputFuncNode *node;
@@ -619,6 +687,70 @@ void AppendOutputFuncList(OutputFunc func, void *arg, OutputFuncNode **list)
 
     node->func = func;
     node->arg = arg;
+    node->name = SnortStrdup(output_plugin_name ? output_plugin_name : "internal");
+    node->trace_id = TRACE_NAME(node->name);
+}
+
+static void OutputListMetrics(MetricsBuf *buf, OutputFuncNode *idx, const char *list, int secs)
+{
+    char lbl[160];
+    int slot = 0;
+
+    for (; idx != NULL; idx = idx->next, slot++)
+    {
+        snprintf(lbl, sizeof(lbl), "plugin=\"%s\",list=\"%s\",slot=\"%d\"",
+                 idx->name, list, slot);
+
+        if (secs)
+            MetricsSampleDouble(buf, "squirrel_output_seconds_total", lbl,
+                                (double)idx->nsecs / 1e9);
+        else
+            MetricsSample(buf, "squirrel_output_calls_total", lbl, idx->calls);
+    }
+}
+
+static void OutputPluginMetrics(MetricsBuf *buf, void *arg)
+{
+    int secs;
+
+    for (secs = 0; secs < 2; secs++)
+    {
+        if (secs)
+            MetricsHeader(buf, "squirrel_output_seconds_total", "counter",
+                          "Time spent in each output function.");
+        else
+            MetricsHeader(buf, "squirrel_output_calls_total", "counter",
+                          "Calls to each output function.");
+
+        OutputListMetrics(buf, AlertList, "alert", secs);
+        OutputListMetrics(buf, LogList, "log", secs);
+        OutputListMetrics(buf, FlushList, "flush", secs);
+    }
+}
+
+/* time the call while the metrics listener is up, else just make it */
+static inline void CallOutputFunc(OutputFuncNode *idx, Packet *packet, void *event, uint32_t event_type)
+{
+    struct timespec t0, t1;
+
+    TRACE_BEGIN(idx->trace_id, event_type);
+
+    if (!metrics_enabled)
+    {
+        idx->func(packet, event, event_type, idx->arg);
+        TRACE_END(idx->trace_id, event_type);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    idx->func(packet, event, event_type, idx->arg);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    idx->calls++;
+    idx->nsecs += (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL
+                  + t1.tv_nsec - t0.tv_nsec;
+
+    TRACE_END(idx->trace_id, event_type);
 }
 
 int pbCheckSignatureSuppression(void *event)
@@ -688,18 +820,22 @@ void CallOutputPlugins(OutputType out_type, Packet *packet, void *event, uint32_
 			return;
 	}
 
+	/* a SIGHUP reload may swap the maps, keep ours until the outputs return */
+	MapReadLock();
+	TRACE_BEGIN(TRACE_OUTPUT, out_type);
+
 	switch ( out_type ) {
 	case OUTPUT_TYPE__SPECIAL:
 		{
 			idx = AlertList;
 			while (idx != NULL) {
-				idx->func(packet, event, event_type, idx->arg);
+				CallOutputFunc(idx, packet, event, event_type);
 				idx = idx->next;
 			}
 
 			idx = LogList;
 			while (idx != NULL) {
-				idx->func(packet, event, event_type, idx->arg);
+				CallOutputFunc(idx, packet, event, event_type);
 				idx = idx->next;
 			}
 		}
@@ -711,13 +847,30 @@ void CallOutputPlugins(OutputType out_type, Packet *packet, void *event, uint32_
 			//Iterate Log and Alert.
 			idx = LogList;
 			while (idx != NULL) {
-				idx->func(packet, event, event_type, idx->arg);
+				CallOutputFunc(idx, packet, event, event_type);
+				idx = idx->next;
+			}
+
+			idx = AlertList;
+			while (idx != NULL) {
+				CallOutputFunc(idx, packet, event, event_type);
+				idx = idx->next;
+			}
+		}
+		break;
+	case OUTPUT_TYPE__LOG_UNGROUPED:
+		{
+			idx = LogList;
+			while (idx != NULL) {
+				if (!idx->groups)
+					CallOutputFunc(idx, packet, event, event_type);
 				idx = idx->next;
 			}
 
 			idx = AlertList;
 			while (idx != NULL) {
-				idx->func(packet, event, event_type, idx->arg);
+				if (!idx->groups)
+					CallOutputFunc(idx, packet, event, event_type);
 				idx = idx->next;
 			}
 		}
@@ -726,7 +879,7 @@ void CallOutputPlugins(OutputType out_type, Packet *packet, void *event, uint32_
 		{
 			idx = FlushList;
 			while (idx != NULL) {
-				idx->func(packet, event, event_type, idx->arg);
+				CallOutputFunc(idx, packet, event, event_type);
 				idx = idx->next;
 			}
 		}
@@ -734,6 +887,9 @@ void CallOutputPlugins(OutputType out_type, Packet *packet, void *event, uint32_
 	default:
 		break;
 	}
+
+	TRACE_END(TRACE_OUTPUT, out_type);
+	MapReadUnlock();
 }
 
 
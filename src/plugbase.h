@@ -88,6 +88,7 @@ typedef enum _OutputType
     OUTPUT_TYPE__LOG,
 	OUTPUT_TYPE__SPECIAL,
 	OUTPUT_TYPE__FLUSH,
+	OUTPUT_TYPE__LOG_UNGROUPED,     /* a packet of a group, for plugins that do not take groups */
     OUTPUT_TYPE__MAX
 
 } OutputType;
@@ -158,6 +159,12 @@ typedef struct _OutputFuncNode
 {
     void *arg;
     OutputFunc func;
+    char *name;          /* output keyword that added it */
+    uint64_t calls;      /* counted only while metrics are served */
+    uint64_t nsecs;
+    uint16_t trace_id;   /* probe id of name */
+    uint8_t groups;      /* takes an event's whole group, see SetOutputFuncGroups() */
+    uint8_t holds;       /* keeps flushed batches, see SetOutputFuncHolds() */
     struct _OutputFuncNode *next;
 
 } OutputFuncNode;
@@ -168,6 +175,10 @@ OutputConfigFunc GetOutputConfigFunc(char *);
 int GetOutputTypeFlags(char *);
 void DumpOutputPlugins(void);
 void AddFuncToOutputList(OutputFunc, OutputType, void *);
+void SetOutputFuncGroups(OutputFunc, void *);
+void SetOutputFuncHolds(OutputFunc, void *);
+int OutputFuncHolds(void);
+void SetOutputPluginName(const char *);
 void FreeOutputConfigFuncs(void);
 void FreeOutputList(OutputFuncNode *);
 void CallOutputPlugins(OutputType, Packet *, void *, uint32_t);
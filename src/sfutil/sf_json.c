@@ -0,0 +1,407 @@
+/****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/**
+ * @file   sf_json.c
+ *
+ * @brief  implements a streaming JSON writer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sf_json.h"
+#include "util.h"
+
+/* some reasonable minimums */
+#define MIN_BUF  (1024)
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* 0: copy, 1: \u00XX, other: two character escape */
+static const char escape_map[256] =
+{
+    1,   1,   1,   1,   1,   1,   1,   1,  'b', 't', 'n',  1,  'f', 'r',  1,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+    0,   0,  '"',  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0, '\\',  0,   0,   0,
+};
+
+/*-------------------------------------------------------------------
+ * JsonWriter_Init: constructor
+ *-------------------------------------------------------------------
+ */
+JsonWriter* JsonWriter_Init (size_t maxBuf)
+{
+    JsonWriter* this;
+
+    if ( maxBuf < MIN_BUF ) maxBuf = MIN_BUF;
+
+    this = (JsonWriter*)SnortAlloc(sizeof(JsonWriter));
+    this->buf = (char*)malloc(maxBuf);
+
+    if ( !this->buf )
+    {
+        FatalError("Unable to allocate a JsonWriter(%lu)!\n", (unsigned long)maxBuf);
+    }
+    this->maxBuf = maxBuf;
+    JsonWriter_Reset(this);
+
+    return this;
+}
+
+/*-------------------------------------------------------------------
+ * JsonWriter_Term: destructor
+ *-------------------------------------------------------------------
+ */
+void JsonWriter_Term (JsonWriter* this)
+{
+    if ( !this ) return;
+
+    free(this->buf);
+    free(this);
+}
+
+/*-------------------------------------------------------------------
+ * JsonWriter_Reserve: make room for len more bytes plus the nul;
+ * the buffer only grows, so steady state is allocation free
+ *-------------------------------------------------------------------
+ */
+static inline char* JsonWriter_Reserve (JsonWriter* this, size_t len)
+{
+    if ( this->pos + len + 1 > this->maxBuf )
+    {
+        size_t size = this->maxBuf * 2;
+        char* buf;
+
+        while ( this->pos + len + 1 > size )
+            size *= 2;
+
+        buf = (char*)realloc(this->buf, size);
+
+        if ( !buf )
+        {
+            FatalError("Unable to grow a JsonWriter to %lu!\n", (unsigned long)size);
+        }
+        this->buf = buf;
+        this->maxBuf = size;
+    }
+    return this->buf + this->pos;
+}
+
+static inline void JsonWriter_Put (JsonWriter* this, const char* s, size_t len)
+{
+    memcpy(JsonWriter_Reserve(this, len), s, len);
+    this->pos += len;
+    this->buf[this->pos] = '\0';
+}
+
+/*-------------------------------------------------------------------
+ * JsonWriter_Escape: append str as a quoted JSON string
+ *-------------------------------------------------------------------
+ */
+static void JsonWriter_Escape (JsonWriter* this, const char* str, size_t len)
+{
+    const uint8_t* s = (const uint8_t*)str;
+    const uint8_t* end = s + len;
+    char* out;
+
+    /* worst case every byte turns into \u00XX */
+    out = JsonWriter_Reserve(this, len * 6 + 2);
+    *out++ = '"';
+
+    while ( s < end )
+    {
+        const uint8_t* run = s;
+
+        while ( s < end && !escape_map[*s] )
+            s++;
+
+        if ( s > run )
+        {
+            memcpy(out, run, s - run);
+            out += s - run;
+        }
+        if ( s == end )
+            break;
+
+        *out++ = '\\';
+
+        if ( escape_map[*s] == 1 )
+        {
+            *out++ = 'u';
+            *out++ = '0';
+            *out++ = '0';
+            *out++ = hex_digits[*s >> 4];
+            *out++ = hex_digits[*s & 0x0f];
+        }
+        else
+            *out++ = escape_map[*s];
+
+        s++;
+    }
+    *out++ = '"';
+    *out = '\0';
+
+    this->pos = out - this->buf;
+}
+
+/*-------------------------------------------------------------------
+ * JsonWriter_Member: separator and key for the next value
+ *-------------------------------------------------------------------
+ */
+static void JsonWriter_Member (JsonWriter* this, const char* key)
+{
+    uint32_t bit = 1u << this->depth;
+
+    if ( this->nonEmpty & bit )
+        JsonWriter_Put(this, ",", 1);
+    else
+        this->nonEmpty |= bit;
+
+    if ( key )
+    {
+        size_t len = strlen(key);
+        char* out = JsonWriter_Reserve(this, len + 3);
+
+        /* keys come from the code, not the data, so are not escaped */
+        *out++ = '"';
+        memcpy(out, key, len);
+        out += len;
+        *out++ = '"';
+        *out++ = ':';
+        *out = '\0';
+
+        this->pos += len + 3;
+    }
+}
+
+static void JsonWriter_Push (JsonWriter* this, const char* key, char c)
+{
+    if ( this->depth > 0 )
+        JsonWriter_Member(this, key);
+    else if ( this->nonEmpty & 1 )
+        /* several top level documents, e.g. NDJSON */
+        JsonWriter_Put(this, "\n", 1);
+
+    if ( this->depth + 1 < JSON_MAX_DEPTH )
+        this->depth++;
+    else
+        this->overflow++;
+
+    this->nonEmpty &= ~(1u << this->depth);
+    JsonWriter_Put(this, &c, 1);
+}
+
+static void JsonWriter_Pop (JsonWriter* this, char c)
+{
+    JsonWriter_Put(this, &c, 1);
+
+    if ( this->overflow > 0 )
+        this->overflow--;
+    else if ( this->depth > 0 )
+        this->depth--;
+
+    this->nonEmpty |= 1u << this->depth;
+}
+
+/*-------------------------------------------------------------------
+ * containers; key is ignored at the top level and inside arrays
+ *-------------------------------------------------------------------
+ */
+void JsonWriter_Open (JsonWriter* this, const char* key)
+{
+    JsonWriter_Push(this, key, '{');
+}
+
+void JsonWriter_Close (JsonWriter* this)
+{
+    JsonWriter_Pop(this, '}');
+}
+
+void JsonWriter_OpenArray (JsonWriter* this, const char* key)
+{
+    JsonWriter_Push(this, key, '[');
+}
+
+void JsonWriter_CloseArray (JsonWriter* this)
+{
+    JsonWriter_Pop(this, ']');
+}
+
+/*-------------------------------------------------------------------
+ * members; pass a NULL key for array elements
+ *-------------------------------------------------------------------
+ */
+void JsonWriter_StringN (JsonWriter* this, const char* key, const char* str, size_t len)
+{
+    JsonWriter_Member(this, key);
+    JsonWriter_Escape(this, str, len);
+}
+
+void JsonWriter_String (JsonWriter* this, const char* key, const char* str)
+{
+    if ( !str )
+    {
+        JsonWriter_Null(this, key);
+        return;
+    }
+    JsonWriter_StringN(this, key, str, strlen(str));
+}
+
+void JsonWriter_UInt (JsonWriter* this, const char* key, uint64_t val)
+{
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+
+    JsonWriter_Member(this, key);
+
+    do
+    {
+        *--p = '0' + (val % 10);
+        val /= 10;
+    } while ( val );
+
+    JsonWriter_Put(this, p, tmp + sizeof(tmp) - p);
+}
+
+void JsonWriter_Int (JsonWriter* this, const char* key, int64_t val)
+{
+    char tmp[21];
+    char* p = tmp + sizeof(tmp);
+    uint64_t mag = val < 0 ? -(uint64_t)val : (uint64_t)val;
+
+    JsonWriter_Member(this, key);
+
+    do
+    {
+        *--p = '0' + (mag % 10);
+        mag /= 10;
+    } while ( mag );
+
+    if ( val < 0 )
+        *--p = '-';
+
+    JsonWriter_Put(this, p, tmp + sizeof(tmp) - p);
+}
+
+void JsonWriter_Bool (JsonWriter* this, const char* key, int val)
+{
+    JsonWriter_Member(this, key);
+
+    if ( val )
+        JsonWriter_Put(this, "true", 4);
+    else
+        JsonWriter_Put(this, "false", 5);
+}
+
+void JsonWriter_Null (JsonWriter* this, const char* key)
+{
+    JsonWriter_Member(this, key);
+    JsonWriter_Put(this, "null", 4);
+}
+
+/*-------------------------------------------------------------------
+ * JsonWriter_Hex: binary data as a lower case hex string,
+ * e.g. packet payloads, without going through fasthex()
+ *-------------------------------------------------------------------
+ */
+void JsonWriter_Hex (JsonWriter* this, const char* key, const uint8_t* data, size_t len)
+{
+    char* out;
+    size_t i;
+
+    JsonWriter_Member(this, key);
+
+    out = JsonWriter_Reserve(this, len * 2 + 2);
+    *out++ = '"';
+
+    for ( i = 0; i < len; i++ )
+    {
+        *out++ = hex_digits[data[i] >> 4];
+        *out++ = hex_digits[data[i] & 0x0f];
+    }
+    *out++ = '"';
+    *out = '\0';
+
+    this->pos = out - this->buf;
+}
+
+/*-------------------------------------------------------------------
+ * JsonWriter_Base64: binary data as a base64 string (RFC 4648,
+ * padded, no line breaks), e.g. raw packets
+ *-------------------------------------------------------------------
+ */
+void JsonWriter_Base64 (JsonWriter* this, const char* key, const uint8_t* data, size_t len)
+{
+    static const char alpha[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char* out;
+    size_t i;
+
+    JsonWriter_Member(this, key);
+
+    out = JsonWriter_Reserve(this, (len + 2) / 3 * 4 + 2);
+    *out++ = '"';
+
+    for ( i = 0; i + 2 < len; i += 3 )
+    {
+        uint32_t bits = (data[i] << 16) | (data[i+1] << 8) | data[i+2];
+
+        *out++ = alpha[bits >> 18];
+        *out++ = alpha[(bits >> 12) & 0x3f];
+        *out++ = alpha[(bits >> 6) & 0x3f];
+        *out++ = alpha[bits & 0x3f];
+    }
+
+    if ( i < len )
+    {
+        uint32_t bits = data[i] << 16;
+
+        if ( i + 1 < len )
+            bits |= data[i+1] << 8;
+
+        *out++ = alpha[bits >> 18];
+        *out++ = alpha[(bits >> 12) & 0x3f];
+        *out++ = i + 1 < len ? alpha[(bits >> 6) & 0x3f] : '=';
+        *out++ = '=';
+    }
+    *out++ = '"';
+    *out = '\0';
+
+    this->pos = out - this->buf;
+}
+
+/*-------------------------------------------------------------------
+ * JsonWriter_Raw: splice in an already serialized value
+ *-------------------------------------------------------------------
+ */
+void JsonWriter_Raw (JsonWriter* this, const char* key, const char* json, size_t len)
+{
+    JsonWriter_Member(this, key);
+    JsonWriter_Put(this, json, len);
+}
+
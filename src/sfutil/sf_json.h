@@ -0,0 +1,107 @@
+/****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/**
+ * @file   sf_json.h
+ *
+ * @brief  declares a streaming JSON writer
+ *
+ * Declares a JsonWriter_*() api which formats JSON straight into a
+ * buffer owned by the writer.  Nothing is allocated per document; the
+ * buffer only grows when a document doesn't fit and is reused after
+ * JsonWriter_Reset().  Commas and nesting are tracked by the writer so
+ * callers just open/close containers and add members.
+ *
+ * String values are escaped per RFC 8259: quote, backslash and
+ * control characters; everything else, including UTF-8 sequences, is
+ * copied through unchanged.  Keys are expected to be plain literals
+ * and are written as is.
+ */
+
+#ifndef _SF_JSON_H
+#define _SF_JSON_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define JSON_MAX_DEPTH  32
+
+/*
+ * DO NOT ACCESS STRUCT MEMBERS DIRECTLY
+ * EXCEPT FROM WITHIN THE IMPLEMENTATION!
+ */
+typedef struct _JsonWriter
+{
+/* private: */
+    char* buf;
+    size_t pos;
+    size_t maxBuf;
+
+    /* one bit per level, set once the container has a member */
+    uint32_t nonEmpty;
+    unsigned int depth;
+    /* levels opened past JSON_MAX_DEPTH, these share the top bit */
+    unsigned int overflow;
+} JsonWriter;
+
+JsonWriter* JsonWriter_Init(size_t maxBuf);
+void JsonWriter_Term(JsonWriter*);
+
+void JsonWriter_Open(JsonWriter*, const char* key);
+void JsonWriter_Close(JsonWriter*);
+void JsonWriter_OpenArray(JsonWriter*, const char* key);
+void JsonWriter_CloseArray(JsonWriter*);
+
+void JsonWriter_String(JsonWriter*, const char* key, const char* str);
+void JsonWriter_StringN(JsonWriter*, const char* key, const char* str, size_t len);
+void JsonWriter_Int(JsonWriter*, const char* key, int64_t val);
+void JsonWriter_UInt(JsonWriter*, const char* key, uint64_t val);
+void JsonWriter_Bool(JsonWriter*, const char* key, int val);
+void JsonWriter_Null(JsonWriter*, const char* key);
+void JsonWriter_Hex(JsonWriter*, const char* key, const uint8_t* data, size_t len);
+void JsonWriter_Base64(JsonWriter*, const char* key, const uint8_t* data, size_t len);
+void JsonWriter_Raw(JsonWriter*, const char* key, const char* json, size_t len);
+
+/*-------------------------------------------------------------------
+  * helper functions
+  *-------------------------------------------------------------------
+  */
+static inline void JsonWriter_Reset (JsonWriter* this)
+{
+    this->pos = 0;
+    this->depth = 0;
+    this->overflow = 0;
+    this->nonEmpty = 0;
+    this->buf[0] = '\0';
+}
+
+/* the document so far, always nul terminated */
+static inline const char* JsonWriter_Buffer (JsonWriter* this)
+{
+    return this->buf;
+}
+
+static inline size_t JsonWriter_Length (JsonWriter* this)
+{
+    return this->pos;
+}
+
+#endif /* _SF_JSON_H */
+
@@ -0,0 +1,246 @@
+/****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/**
+ * @file   sf_json_bench.c
+ *
+ * @brief  compares the JsonWriter with a json-c object tree
+ *
+ * Serializes an event shaped like the echidna output (network tuple,
+ * signature, IP/TCP header fields, hex payload and three hash ids)
+ * a number of times with each serializer and reports events/sec.
+ * The json-c side is only built when echidna (and so libjson) is
+ * enabled.
+ *
+ *   make -C src/sfutil sf_json_bench && src/sfutil/sf_json_bench [events]
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef ENABLE_PLUGIN_ECHIDNA
+#include <json/json.h>
+#endif
+
+#include "sf_json.h"
+
+#define DEFAULT_EVENTS  1000000
+#define PAYLOAD_LEN     256
+
+static uint8_t payload[PAYLOAD_LEN];
+static uint8_t hash[32];
+
+/* sf_json only needs these two from util.c */
+void* SnortAlloc (unsigned long size)
+{
+    void* p = calloc(1, size);
+
+    if ( !p )
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+void FatalError (const char* format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    exit(1);
+}
+
+static double Now (void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static size_t WriterEvent (JsonWriter* json, uint32_t i)
+{
+    JsonWriter_Reset(json);
+    JsonWriter_Open(json, NULL);
+    JsonWriter_String(json, "node_id", "node-00000001");
+    JsonWriter_Int(json, "classification", 0);
+    JsonWriter_UInt(json, "meta_u2_event_id", i);
+    JsonWriter_Int(json, "net_version", 4);
+    JsonWriter_String(json, "net_src_ip", "192.168.100.21");
+    JsonWriter_UInt(json, "net_src_port", 51234);
+    JsonWriter_String(json, "net_dst_ip", "10.0.0.1");
+    JsonWriter_UInt(json, "net_dst_port", 80);
+    JsonWriter_UInt(json, "net_protocol", 6);
+    JsonWriter_String(json, "timestamp", "2014-01-01 12:00:00.000000");
+    JsonWriter_UInt(json, "sig_type", 1);
+    JsonWriter_UInt(json, "sig_id", 2000000 + (i & 0xff));
+    JsonWriter_UInt(json, "sig_revision", 3);
+    JsonWriter_String(json, "sig_message", "ET POLICY \"suspicious\" user-agent\tseen");
+    JsonWriter_UInt(json, "sig_priority", 2);
+    JsonWriter_String(json, "sig_category", "policy-violation");
+    JsonWriter_UInt(json, "ip_hdr_hlen", 5);
+    JsonWriter_UInt(json, "ip_hdr_tos", 0);
+    JsonWriter_UInt(json, "ip_hdr_len", 296);
+    JsonWriter_UInt(json, "ip_hdr_id", i & 0xffff);
+    JsonWriter_UInt(json, "ip_hdr_ttl", 64);
+    JsonWriter_UInt(json, "ip_hdr_csum", 0xbeef);
+    JsonWriter_UInt(json, "tcp_seq", 0x80000000u + i);
+    JsonWriter_UInt(json, "tcp_ack", 12345678);
+    JsonWriter_UInt(json, "tcp_off", 5);
+    JsonWriter_UInt(json, "tcp_x2", 0);
+    JsonWriter_UInt(json, "tcp_flags", 0x18);
+    JsonWriter_UInt(json, "tcp_win", 65535);
+    JsonWriter_UInt(json, "tcp_sum", 0x1234);
+    JsonWriter_UInt(json, "tcp_urp", 0);
+    JsonWriter_Hex(json, "payload", payload, PAYLOAD_LEN);
+    JsonWriter_Hex(json, "id", hash, sizeof(hash));
+    JsonWriter_Hex(json, "ssn_corr_id", hash, sizeof(hash));
+    JsonWriter_Hex(json, "evt_corr_id", hash, sizeof(hash));
+    JsonWriter_Close(json);
+
+    return JsonWriter_Length(json);
+}
+
+#ifdef ENABLE_PLUGIN_ECHIDNA
+static char* HexString (const uint8_t* data, size_t len)
+{
+    static const char digits[] = "0123456789abcdef";
+    char* out = (char*)malloc(len * 2 + 1);
+    size_t i;
+
+    for ( i = 0; i < len; i++ )
+    {
+        out[i*2] = digits[data[i] >> 4];
+        out[i*2+1] = digits[data[i] & 0x0f];
+    }
+    out[len*2] = '\0';
+    return out;
+}
+
+/* mirrors what the echidna plugin did per event before JsonWriter */
+static size_t JsonCEvent (uint32_t i)
+{
+    json_object* json = json_object_new_object();
+    char* hex;
+    size_t len;
+
+    json_object_object_add(json, "node_id", json_object_new_string("node-00000001"));
+    json_object_object_add(json, "classification", json_object_new_int(0));
+    json_object_object_add(json, "meta_u2_event_id", json_object_new_int(i));
+    json_object_object_add(json, "net_version", json_object_new_int(4));
+    json_object_object_add(json, "net_src_ip", json_object_new_string("192.168.100.21"));
+    json_object_object_add(json, "net_src_port", json_object_new_int(51234));
+    json_object_object_add(json, "net_dst_ip", json_object_new_string("10.0.0.1"));
+    json_object_object_add(json, "net_dst_port", json_object_new_int(80));
+    json_object_object_add(json, "net_protocol", json_object_new_int(6));
+    json_object_object_add(json, "timestamp", json_object_new_string("2014-01-01 12:00:00.000000"));
+    json_object_object_add(json, "sig_type", json_object_new_int(1));
+    json_object_object_add(json, "sig_id", json_object_new_int(2000000 + (i & 0xff)));
+    json_object_object_add(json, "sig_revision", json_object_new_int(3));
+    json_object_object_add(json, "sig_message", json_object_new_string("ET POLICY \"suspicious\" user-agent\tseen"));
+    json_object_object_add(json, "sig_priority", json_object_new_int(2));
+    json_object_object_add(json, "sig_category", json_object_new_string("policy-violation"));
+    json_object_object_add(json, "ip_hdr_hlen", json_object_new_int(5));
+    json_object_object_add(json, "ip_hdr_tos", json_object_new_int(0));
+    json_object_object_add(json, "ip_hdr_len", json_object_new_int(296));
+    json_object_object_add(json, "ip_hdr_id", json_object_new_int(i & 0xffff));
+    json_object_object_add(json, "ip_hdr_ttl", json_object_new_int(64));
+    json_object_object_add(json, "ip_hdr_csum", json_object_new_int(0xbeef));
+    json_object_object_add(json, "tcp_seq", json_object_new_int(0x80000000u + i));
+    json_object_object_add(json, "tcp_ack", json_object_new_int(12345678));
+    json_object_object_add(json, "tcp_off", json_object_new_int(5));
+    json_object_object_add(json, "tcp_x2", json_object_new_int(0));
+    json_object_object_add(json, "tcp_flags", json_object_new_int(0x18));
+    json_object_object_add(json, "tcp_win", json_object_new_int(65535));
+    json_object_object_add(json, "tcp_sum", json_object_new_int(0x1234));
+    json_object_object_add(json, "tcp_urp", json_object_new_int(0));
+
+    hex = HexString(payload, PAYLOAD_LEN);
+    json_object_object_add(json, "payload", json_object_new_string(hex));
+    free(hex);
+
+    hex = HexString(hash, sizeof(hash));
+    json_object_object_add(json, "id", json_object_new_string(hex));
+    json_object_object_add(json, "ssn_corr_id", json_object_new_string(hex));
+    json_object_object_add(json, "evt_corr_id", json_object_new_string(hex));
+    free(hex);
+
+    len = strlen(json_object_to_json_string(json));
+    json_object_put(json);
+
+    return len;
+}
+#endif
+
+int main (int argc, char** argv)
+{
+    uint32_t events = DEFAULT_EVENTS;
+    JsonWriter* json;
+    size_t bytes = 0;
+    double start, secs;
+    uint32_t i;
+
+    if ( argc > 1 && atoi(argv[1]) > 0 )
+        events = atoi(argv[1]);
+
+    for ( i = 0; i < PAYLOAD_LEN; i++ )
+        payload[i] = (uint8_t)(i * 7);
+
+    for ( i = 0; i < sizeof(hash); i++ )
+        hash[i] = (uint8_t)(i * 13);
+
+    json = JsonWriter_Init(4096);
+
+    start = Now();
+    for ( i = 0; i < events; i++ )
+        bytes += WriterEvent(json, i);
+    secs = Now() - start;
+
+    printf("JsonWriter: %u events in %.3f s, %.0f events/s, %.1f MB/s\n",
+        events, secs, events / secs, bytes / secs / 1e6);
+
+    JsonWriter_Term(json);
+
+#ifdef ENABLE_PLUGIN_ECHIDNA
+    bytes = 0;
+
+    start = Now();
+    for ( i = 0; i < events; i++ )
+        bytes += JsonCEvent(i);
+    secs = Now() - start;
+
+    printf("json-c:     %u events in %.3f s, %.0f events/s, %.1f MB/s\n",
+        events, secs, events / secs, bytes / secs / 1e6);
+#else
+    printf("json-c:     not built, configure with --enable-plugin-echidna\n");
+#endif
+
+    return 0;
+}
+
@@ -47,6 +47,7 @@
 #include "spooler.h"
 #include "unified2.h"
 #include "util.h"
+#include "metrics.h"
 
 
 by_mul_tread_para bmt_para;
@@ -980,6 +981,264 @@ static int spooler_echo_msg(EventSpoMR *eve_sp)
 }
 #endif  /*End of SPO_MPOOL_RING*/
 
+/* rings are only scraped between thread start and teardown */
+static pthread_mutex_t spool_metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static int spool_metrics_live = 0;
+
+/* event timestamp to the return from the outputs, in usecs */
+static MetricsHistogram spool_output_lag;
+
+/* why an output batch was flushed */
+#define SPOOLER_FLUSH_NONE      (-1)
+#define SPOOLER_FLUSH_SIZE      0   //reached its target
+#define SPOOLER_FLUSH_DELAY     1   //open batch_max_delay
+#define SPOOLER_FLUSH_IDLE      2   //the rings went quiet
+#define SPOOLER_FLUSH_REASONS   3
+
+static const char *spool_flush_reason[SPOOLER_FLUSH_REASONS] = { "size", "delay", "idle" };
+
+/* Output batch sizing.  Written by the output thread alone; what the
+ * metrics listener reads is stored and loaded atomically. */
+typedef struct _SpoolBatch
+{
+    uint64_t open_us;           //first record of the open batch, 0 for none
+    uint64_t last_us;           //last record out
+    uint64_t flush_us;          //last flush
+    uint64_t max_delay_us;
+    uint32_t target;            //records per flush
+    uint32_t rate;              //records a second, smoothed
+    uint32_t commit_us;         //flush to the outputs done with it, smoothed
+    uint64_t flushes[SPOOLER_FLUSH_REASONS];
+    MetricsHistogram records;   //per flush
+} SpoolBatch;
+
+static SpoolBatch spool_batch;
+
+/*
+ * Function: spoolerObserveLag(EventRecordNode *)
+ *
+ * Purpose: Count how long after it was raised an event got through the
+ *          output plugins.  Only meaningful while the spool is being
+ *          written as the events happen; replayed spool files show up
+ *          as their age.
+ */
+static void spoolerObserveLag(EventRecordNode *ee)
+{
+    Unified2EventCommon *ev = (Unified2EventCommon *)ee->data;
+    struct timespec now;
+    int64_t usecs;
+
+    if ( !metrics_enabled )
+        return;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    usecs = ((int64_t)now.tv_sec - ntohl(ev->event_second)) * 1000000
+            + now.tv_nsec / 1000 - ntohl(ev->event_microsecond);
+
+    MetricsObserve(&spool_output_lag, usecs > 0 ? (uint64_t)usecs : 0);
+}
+
+typedef struct _SpoolRingStats
+{
+    uint8_t rid;
+    uint16_t depth;
+    uint16_t pending_files;
+    uint64_t read_cnt;
+    uint64_t out_cnt;
+    uint64_t orphan_cnt;
+    uint64_t orphan_drop_cnt;
+    uint32_t waldo_ts;
+    uint32_t waldo_idx;
+    uint32_t newest_ts;
+} SpoolRingStats;
+
+/*
+ * Function: spoolerMetrics(MetricsBuf *, void *)
+ *
+ * Purpose: Per ring depth, throughput and waldo lag for the metrics
+ *          listener.  Waldo lag in records is what the reader has put on
+ *          the ring and the outputs have not yet taken off; in seconds it
+ *          is how far the waldo's spool file lags the newest spool file
+ *          seen for that ring.
+ */
+static void spoolerMetrics(MetricsBuf *buf, void *arg)
+{
+    by_mul_tread_para *bmt = (by_mul_tread_para *)arg;
+    SpoolRingStats st[BY_MUL_TR_DEFAULT];
+    spooler_r_para *sr_para;
+    char lbl[32];
+    int i, n = 0;
+
+    pthread_mutex_lock(&spool_metrics_lock);
+    if ( !spool_metrics_live ) {
+        pthread_mutex_unlock(&spool_metrics_lock);
+        return;
+    }
+
+    for (i = 0; i < BY_MUL_TR_DEFAULT; i++) {
+        if ( !(bmt->trbit_valid&(0x01<<i)) )
+            continue;
+
+        sr_para = &(bmt->s_para[i]);
+        st[n].rid = i;
+
+        pthread_mutex_lock(&sr_para->lock_ring);
+        st[n].depth = sr_para->sring->event_cnt;
+        st[n].read_cnt = sr_para->read_cnt;
+        st[n].out_cnt = sr_para->out_cnt;
+        st[n].orphan_cnt = sr_para->orphan_cnt;
+        st[n].orphan_drop_cnt = sr_para->orphan_drop_cnt;
+        pthread_mutex_unlock(&sr_para->lock_ring);
+
+        pthread_mutex_lock(&sr_para->waldo->lock_waldo);
+        st[n].waldo_ts = sr_para->waldo->data.timestamp;
+        st[n].waldo_idx = sr_para->waldo->data.record_idx;
+        pthread_mutex_unlock(&sr_para->waldo->lock_waldo);
+
+        st[n].newest_ts = sr_para->watch_cts;
+        pthread_mutex_lock(&sr_para->swatch.t_lock);
+        st[n].pending_files = sr_para->swatch.ns_cnt;
+        if ( sr_para->swatch.ns_cnt
+                && SPOOLER_WATCH_NS_T(sr_para->swatch) > st[n].newest_ts )
+            st[n].newest_ts = SPOOLER_WATCH_NS_T(sr_para->swatch);
+        pthread_mutex_unlock(&sr_para->swatch.t_lock);
+
+        n++;
+    }
+
+    MetricsHeader(buf, "squirrel_ring_depth", "gauge",
+            "Records waiting on the ring for the output thread.");
+    for (i = 0; i < n; i++) {
+        snprintf(lbl, sizeof(lbl), "ring=\"%u\"", st[i].rid);
+        MetricsSample(buf, "squirrel_ring_depth", lbl, st[i].depth);
+    }
+
+    MetricsHeader(buf, "squirrel_ring_capacity", "gauge",
+            "Ring size in records.");
+    for (i = 0; i < n; i++) {
+        snprintf(lbl, sizeof(lbl), "ring=\"%u\"", st[i].rid);
+        MetricsSample(buf, "squirrel_ring_capacity", lbl, SPOOLER_RING_SIZE);
+    }
+
+    MetricsHeader(buf, "squirrel_ring_records_read_total", "counter",
+            "Records the reader thread put on the ring.");
+    for (i = 0; i < n; i++) {
+        snprintf(lbl, sizeof(lbl), "ring=\"%u\"", st[i].rid);
+        MetricsSample(buf, "squirrel_ring_records_read_total", lbl, st[i].read_cnt);
+    }
+
+    MetricsHeader(buf, "squirrel_ring_records_output_total", "counter",
+            "Records the output thread took off the ring.");
+    for (i = 0; i < n; i++) {
+        snprintf(lbl, sizeof(lbl), "ring=\"%u\"", st[i].rid);
+        MetricsSample(buf, "squirrel_ring_records_output_total", lbl, st[i].out_cnt);
+    }
+
+    MetricsHeader(buf, "squirrel_ring_records_held_total", "counter",
+            "Packets and extra data read ahead of their event and held for it.");
+    for (i = 0; i < n; i++) {
+        snprintf(lbl, sizeof(lbl), "ring=\"%u\"", st[i].rid);
+        MetricsSample(buf, "squirrel_ring_records_held_total", lbl, st[i].orphan_cnt);
+    }
+
+    MetricsHeader(buf, "squirrel_ring_records_dropped_total", "counter",
+            "Records dropped, held for an event never read or extra data after its event went out.");
+    for (i = 0; i < n; i++) {
+        snprintf(lbl, sizeof(lbl), "ring=\"%u\"", st[i].rid);
+        MetricsSample(buf, "squirrel_ring_records_dropped_total", lbl, st[i].orphan_drop_cnt);
+    }
+
+    MetricsHeader(buf, "squirrel_waldo_lag_records", "gauge",
+            "Records read but not yet past the waldo.");
+    for (i = 0; i < n; i++) {
+        snprintf(lbl, sizeof(lbl), "ring=\"%u\"", st[i].rid);
+        MetricsSample(buf, "squirrel_waldo_lag_records", lbl,
+                st[i].read_cnt - st[i].out_cnt);
+    }
+
+    MetricsHeader(buf, "squirrel_waldo_lag_seconds", "gauge",
+            "Newest spool file timestamp minus the waldo's spool file timestamp.");
+    for (i = 0; i < n; i++) {
+        snprintf(lbl, sizeof(lbl), "ring=\"%u\"", st[i].rid);
+        MetricsSample(buf, "squirrel_waldo_lag_seconds", lbl,
+                st[i].newest_ts > st[i].waldo_ts ? st[i].newest_ts - st[i].waldo_ts : 0);
+    }
+
+    MetricsHeader(buf, "squirrel_waldo_timestamp", "gauge",
+            "Spool file timestamp recorded in the waldo.");
+    for (i = 0; i < n; i++) {
+        snprintf(lbl, sizeof(lbl), "ring=\"%u\"", st[i].rid);
+        MetricsSample(buf, "squirrel_waldo_timestamp", lbl, st[i].waldo_ts);
+    }
+
+    MetricsHeader(buf, "squirrel_waldo_record", "gauge",
+            "Record index recorded in the waldo.");
+    for (i = 0; i < n; i++) {
+        snprintf(lbl, sizeof(lbl), "ring=\"%u\"", st[i].rid);
+        MetricsSample(buf, "squirrel_waldo_record", lbl, st[i].waldo_idx);
+    }
+
+    MetricsHeader(buf, "squirrel_spool_pending_files", "gauge",
+            "New spool files seen but not yet opened.");
+    for (i = 0; i < n; i++) {
+        snprintf(lbl, sizeof(lbl), "ring=\"%u\"", st[i].rid);
+        MetricsSample(buf, "squirrel_spool_pending_files", lbl, st[i].pending_files);
+    }
+
+    MetricsHeader(buf, "squirrel_event_output_lag_seconds", "histogram",
+            "Event timestamp to the outputs returning for that event.");
+    MetricsHistogramSample(buf, "squirrel_event_output_lag_seconds", NULL,
+            &spool_output_lag, 1e-6);
+
+    MetricsHeader(buf, "squirrel_batch_target_records", "gauge",
+            "Records the output thread collects before flushing them.");
+    MetricsSample(buf, "squirrel_batch_target_records", NULL,
+            __atomic_load_n(&spool_batch.target, __ATOMIC_RELAXED));
+
+    MetricsHeader(buf, "squirrel_batch_arrival_records_per_second", "gauge",
+            "Records output per second between flushes, smoothed.");
+    MetricsSample(buf, "squirrel_batch_arrival_records_per_second", NULL,
+            __atomic_load_n(&spool_batch.rate, __ATOMIC_RELAXED));
+
+    MetricsHeader(buf, "squirrel_batch_commit_seconds", "gauge",
+            "Flush to the outputs being done with the batch, smoothed.");
+    MetricsSampleDouble(buf, "squirrel_batch_commit_seconds", NULL,
+            __atomic_load_n(&spool_batch.commit_us, __ATOMIC_RELAXED) / 1e6);
+
+    MetricsHeader(buf, "squirrel_batch_max_delay_seconds", "gauge",
+            "Longest a batch is kept open, config batch_max_delay.");
+    MetricsSampleDouble(buf, "squirrel_batch_max_delay_seconds", NULL,
+            spool_batch.max_delay_us / 1e6);
+
+    MetricsHeader(buf, "squirrel_batch_flushes_total", "counter",
+            "Batches flushed, by what made them due.");
+    for (i = 0; i < SPOOLER_FLUSH_REASONS; i++) {
+        snprintf(lbl, sizeof(lbl), "reason=\"%s\"", spool_flush_reason[i]);
+        MetricsSample(buf, "squirrel_batch_flushes_total", lbl,
+                __atomic_load_n(&spool_batch.flushes[i], __ATOMIC_RELAXED));
+    }
+
+    MetricsHeader(buf, "squirrel_batch_records", "histogram",
+            "Records per flushed batch.");
+    MetricsHistogramSample(buf, "squirrel_batch_records", NULL,
+            &spool_batch.records, 1);
+
+#ifdef SPO_MPOOL_RING
+    if ( n ) {
+        struct rte_mempool *mp = bmt->s_para[st[0].rid].eNodeMpool;
+
+        MetricsHeader(buf, "squirrel_mpool_buffers", "gauge",
+                "Event buffers in the shared mempool.");
+        MetricsSample(buf, "squirrel_mpool_buffers", "state=\"available\"",
+                rte_mempool_avail_count(mp));
+        MetricsSample(buf, "squirrel_mpool_buffers", "state=\"in_use\"",
+                rte_mempool_in_use_count(mp));
+    }
+#endif
+
+    pthread_mutex_unlock(&spool_metrics_lock);
+}
+
 int ProcessContinuousWithWaldo(Barnyard2Config *bc)
 {
 #ifndef SPOOLER_DUAL_THREAD
@@ -1151,14 +1410,13 @@ int ProcessContinuousWithWaldo(Barnyard2Config *bc)
         bmt_para.s_para[i].eNodeRingRet = eveSpoR.ring_ret;
 #endif
 
+        /* cids carry on after both the last one written and the last one
+         * handed out, whichever is ahead */
         ret_mcid.rid = i;
         CallOutputPlugins(OUTPUT_TYPE__FLUSH, NULL, &ret_mcid, UNIFIED2_IDS_GET_MCID);
-        bmt_para.s_para[i].sring->base_eventid = ret_mcid.ms_cid;
-        bmt_para.s_para[i].sring->rollon_cid = ret_mcid.cid;
-        if ( 0 == bmt_para.s_para[i].waldo->data.record_idx ) {     //Start from begining of file, try to recognize previous event_id.
-            bmt_para.s_para[i].sring->prev_eventid = (ret_mcid.cid>ret_mcid.ms_cid) ? (ret_mcid.cid-ret_mcid.ms_cid):0;
-        }
-        LogMessage("%s: start with ms_cid=%lu\n", __func__, ret_mcid.ms_cid);
+        bmt_para.s_para[i].sring->next_cid =
+                (ret_mcid.cid > ret_mcid.ms_cid) ? ret_mcid.cid : ret_mcid.ms_cid;
+        LogMessage("%s: start after cid=%lu\n", __func__, bmt_para.s_para[i].sring->next_cid);
 
         bmt_para.trbit_valid |= (0x01<<i);
         bmt_para.by_conf = bc;
@@ -1194,6 +1452,7 @@ int ProcessContinuousWithWaldo(Barnyard2Config *bc)
 
     /* NOTE: This "i" is following previous state */
     //bmt_para.trbit_valid = bc->trbit_valid;
+    spool_batch.max_delay_us = (uint64_t)bc->batch_max_delay * 1000;
     err = pthread_create(&tid_o[0], NULL, &spoolerRecordOutput_T, &bmt_para);
     if (0 != err) {
         LogMessage("Can't create thread 2: [%s]\n", strerror(err));
@@ -1207,6 +1466,11 @@ int ProcessContinuousWithWaldo(Barnyard2Config *bc)
             handle_error_en(err, "pthread_setaffinity_np");
     }
 
+    pthread_mutex_lock(&spool_metrics_lock);
+    spool_metrics_live = 1;
+    pthread_mutex_unlock(&spool_metrics_lock);
+    MetricsRegister(spoolerMetrics, &bmt_para);
+
     //Thread Join
     ptid = tid_o;
     for (i=0; i<BY_MUL_TR_DEFAULT; i++) {
@@ -1249,6 +1513,10 @@ int ProcessContinuousWithWaldo(Barnyard2Config *bc)
     LogMessage("pthreads finished!\n");
 
 pexit:
+    pthread_mutex_lock(&spool_metrics_lock);
+    spool_metrics_live = 0;
+    pthread_mutex_unlock(&spool_metrics_lock);
+
     for (i = 0; i < BY_MUL_TR_DEFAULT; i++) {
         if (NULL != bmt_para.s_para[i].sring) {
 #ifdef SPO_MPOOL_RING
@@ -1262,9 +1530,9 @@ pexit:
 #endif
 
             ret_mcid.rid = i;
-            ret_mcid.ms_cid = bmt_para.s_para[i].sring->base_eventid;
+            ret_mcid.ms_cid = bmt_para.s_para[i].sring->next_cid;
             CallOutputPlugins(OUTPUT_TYPE__FLUSH, NULL, &ret_mcid, UNIFIED2_IDS_SET_MCID);
-            LogMessage("%s: end with ms_cid=%lu\n", __func__, ret_mcid.ms_cid);
+            LogMessage("%s: end with cid=%lu\n", __func__, ret_mcid.ms_cid);
 
             free(bmt_para.s_para[i].sring);
             pthread_mutex_destroy(&bmt_para.s_para[i].lock_ring);
@@ -1494,7 +1762,7 @@ void spoolerProcessRecord(Spooler *spooler, int fire_output)
             barnyard2_conf->waldos[0].data.record_idx = spooler->record_idx;
             spoolerWriteWaldo(&(barnyard2_conf->waldos[0]), 0);
         }
-        LogMessage("%s: Extra_data, skipped\n", __func__);
+        DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"Extra_data, skipped\n"););
     } else {
         LogMessage("%s: Unknown type, skipped\n", __func__);
         /* fire the cached event only if not already used (ie dirty) */
@@ -1667,11 +1935,17 @@ void* spoolerRecordRead_T(void * arg)
     EventRecordNode *ernCache;
     Spooler *spooler = NULL;
     Spooler *spooler_new = NULL;
+    char tname[16];
 
     sigemptyset(&set);
     sigfillset(&set);
     pthread_sigmask(SIG_SETMASK, &set, NULL);
 
+    PacketCountRegister();
+    TRACE_THREAD("spool-read");
+    snprintf(tname, sizeof(tname), "spool-read-%u", sr_para->rid);
+    SetThreadName(tname);
+
     waldo = sr_para->waldo;
     dirpath = waldo->data.spool_dir;
     timestamp = waldo->data.timestamp;
@@ -1705,13 +1979,6 @@ void* spoolerRecordRead_T(void * arg)
     if ( NULL != spooler && waldo_timestamp==timestamp ) {
     	spooler->skip_offset = waldo->data.record_idx;
     	spooler->state = SPOOLER_RECORD_SKIP;
-    	sr_para->sring->r_switch = RING_OFF;
-    	if ( 0 == spooler->skip_offset )
-    		sr_para->sring->r_switch = RING_PRE_ON;
-    }
-    else{
-    	//spooler->skip_offset = 0;
-    	sr_para->sring->r_switch = RING_PRE_ON;
     }
 
     sr_para->watch_start = 1;
@@ -1769,10 +2036,12 @@ void* spoolerRecordRead_T(void * arg)
         sr_para->sring->i_sleep_cnt = 0;
 
         //Read
+        TRACE_BEGIN(TRACE_RECORD_READ, sr_para->rid);
         read_rtn = spooler->ifn->readRecordHeader(spooler);
         if (BARNYARD2_SUCCESS == read_rtn) {
             read_rtn = spooler->ifn->readRecord(spooler);
         }
+        TRACE_END(TRACE_RECORD_READ, sr_para->rid);
 
         //Read Result Check
         switch(read_rtn) {
@@ -1793,10 +2062,8 @@ void* spoolerRecordRead_T(void * arg)
             	DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER, "Skipping due to record start offset (%lu)...\n",
             			(long unsigned)spooler->skip_offset));
             	spooler->skip_offset--;
-            	if ( 0 == spooler->skip_offset ) {
-            		sr_para->sring->r_switch = RING_PRE_ON;
+            	if ( 0 == spooler->skip_offset )
             		spooler->state = SPOOLER_RECORD_SKIP_DONE;
-            	}
             }
             else if ( UNIFIED2_INVALID_REC != ernCache->type ){
                 DEBUG_U_WRAP(LogMessage("%s: Process record, idx: %d\n", __func__, spooler->record_idx));
@@ -1888,6 +2155,625 @@ Packet * spoolerRetrievePktData(Packet *sp_pkt, uint8_t *pPktData)
     return sp_pkt;
 }
 
+/* first extra data attribute of that type, NULL if the event has none */
+const EventAttr *EventAttrFind(const EventEP *eep, uint32_t type)
+{
+    uint16_t i;
+
+    for ( i=0; i<eep->attr_cnt; i++ ) {
+        if ( eep->attr[i].type == type )
+            return &(eep->attr[i]);
+    }
+
+    return NULL;
+}
+
+static const char *event_attr_names[EVENT_INFO_MAX] =
+{
+    NULL, "xff", "xff", "reviewed_by", "gzip_data",
+    "smtp_filename", "smtp_mailfrom", "smtp_rcptto", "smtp_email_hdrs",
+    "http_uri", "http_hostname", "ipv6_src", "ipv6_dst", "jsnorm_data",
+};
+
+const char *EventAttrName(uint32_t type)
+{
+    if ( type >= EVENT_INFO_MAX || NULL == event_attr_names[type] )
+        return "unknown";
+
+    return event_attr_names[type];
+}
+
+/*
+ * An attribute as text into buf, addresses in presentation form and the
+ * rest as they were logged; returns its length, 0 if it did not fit.
+ */
+size_t EventAttrPrint(const EventAttr *attr, char *buf, size_t size)
+{
+    size_t len;
+
+    if ( 0 == size )
+        return 0;
+
+    switch ( attr->type ) {
+    case EVENT_INFO_XFF_IPV4:
+        if ( NULL == inet_ntop(AF_INET, attr->data, buf, size) )
+            break;
+        return strlen(buf);
+    case EVENT_INFO_XFF_IPV6:
+    case EVENT_INFO_IPV6_SRC:
+    case EVENT_INFO_IPV6_DST:
+        if ( NULL == inet_ntop(AF_INET6, attr->data, buf, size) )
+            break;
+        return strlen(buf);
+    default:
+        len = attr->len < size - 1 ? attr->len : size - 1;
+        memcpy(buf, attr->data, len);
+        buf[len] = '\0';
+        return len;
+    }
+
+    buf[0] = '\0';
+    return 0;
+}
+
+/*
+ * Event id translation.  Each ring hands out its own cids in the order its
+ * events come off the ring and remembers the most recent ones by (sensor
+ * event id, event second), so a packet finds its event's cid whichever
+ * order the two were written in.
+ */
+static INLINE spooler_xlate *spoolerXlateSet(spooler_ring *sring, uint32_t event_id,
+        uint32_t event_second)
+{
+    return sring->xlate[(event_id ^ (event_second * 2654435761U)) & SPOOLER_XLATE_MASK];
+}
+
+static us_cid_t spoolerXlateFind(spooler_ring *sring, uint32_t event_id, uint32_t event_second)
+{
+    spooler_xlate *set = spoolerXlateSet(sring, event_id, event_second);
+    int i;
+
+    for ( i=0; i<SPOOLER_XLATE_WAYS; i++ ) {
+        if ( set[i].cid && set[i].event_id == event_id
+                && set[i].event_second == event_second )
+            return set[i].cid;
+    }
+
+    return 0;
+}
+
+/* next cid for an event, the oldest way of its set makes room */
+static us_cid_t spoolerXlateAdd(spooler_ring *sring, uint32_t event_id, uint32_t event_second)
+{
+    spooler_xlate *set = spoolerXlateSet(sring, event_id, event_second);
+    spooler_xlate *x = &set[0];
+    int i;
+
+    for ( i=0; i<SPOOLER_XLATE_WAYS; i++ ) {
+        if ( set[i].cid && set[i].event_id == event_id
+                && set[i].event_second == event_second ) {
+            x = &set[i];
+            break;
+        }
+        if ( set[i].cid < x->cid )
+            x = &set[i];
+    }
+
+    x->event_id = event_id;
+    x->event_second = event_second;
+    x->cid = ++sring->next_cid;
+
+    return x->cid;
+}
+
+/*
+ * Oldest slot the output thread still holds, in an open event's group or
+ * waiting for its event, else event_top.  The reader may not fill past it.
+ */
+static uint16_t spoolerRingHold(spooler_ring *sring)
+{
+    uint16_t hold = sring->event_top;
+    uint8_t i;
+
+    for ( i=0; i<sring->win_cnt; i++ ) {
+        if ( SPOOLER_RING_BEHIND(sring, sring->window[i].first) > SPOOLER_RING_BEHIND(sring, hold) )
+            hold = sring->window[i].first;
+    }
+    if ( sring->orphan_cnt && SPOOLER_RING_BEHIND(sring, sring->orphan[0])
+            > SPOOLER_RING_BEHIND(sring, hold) )
+        hold = sring->orphan[0];
+
+    return hold;
+}
+
+/*
+ * The waldo follows the last record off the ring, but stays in front of
+ * anything still held so that a restart reads it again.
+ */
+static void spoolerRingWaldo(spooler_r_para *sr_para)
+{
+    spooler_ring *sring = sr_para->sring;
+    uint16_t hold = spoolerRingHold(sring);
+    EventRecordNode *node;
+
+    if ( hold != sring->event_top ) {
+        node = &(sring->event_cache[hold]);
+        SPOOLER_WALDO_SET_REC(sr_para->waldo, node->timestamp, node->record_idx - 1);
+    }
+    else {
+        node = &(sring->event_cache[(sring->event_top - 1) & SPOOLER_RING_BITMASK]);
+        SPOOLER_WALDO_SET_REC(sr_para->waldo, node->timestamp, node->record_idx);
+    }
+}
+
+#ifdef SPO_MPOOL_RING
+/* packets the outputs took may be on their way to the master already */
+static void spoolerRecordPut(spooler_r_para *sr_para, EventRecordNode *node, uint8_t output_pkt)
+{
+    if ( output_pkt ) {
+        sr_para->sring->mr_flag = 1;
+#ifndef SPO_MPOOL_DEBUG
+        if ( !node->mbuf_turn2base )
+            return;
+#endif
+    }
+    rte_mempool_put(sr_para->eNodeMpool, node->mbuf_data);
+}
+#else
+#define spoolerRecordPut(sr_para, node, output_pkt)
+#endif
+
+static uint64_t spoolerNowMs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint64_t spoolerNowUs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* smoothed as TCP smooths its rtt, a new sample weighs an eighth */
+static uint32_t spoolerBatchSmooth(uint32_t avg, uint64_t sample)
+{
+    if ( sample > UINT32_MAX )
+        sample = UINT32_MAX;
+    if ( 0 == avg )
+        return (uint32_t)sample;
+    return (uint32_t)((int64_t)avg + ((int64_t)sample - (int64_t)avg) / 8);
+}
+
+/*
+ * Function: spoolerBatchTarget(void)
+ *
+ * Purpose: Size the next batches as the records expected to arrive while
+ *          one flush is being committed, so a batch fills while the one
+ *          before it is written.  Slow commits or a fast spool make for
+ *          fewer, larger transactions; a quiet spool for small ones that
+ *          go out soon.  The wait never counts for more than
+ *          batch_max_delay.
+ */
+static void spoolerBatchTarget(void)
+{
+    uint64_t wait_us = spool_batch.commit_us;
+    uint64_t target;
+
+    if ( wait_us > spool_batch.max_delay_us )
+        wait_us = spool_batch.max_delay_us;
+
+    target = (uint64_t)spool_batch.rate * wait_us / 1000000;
+    if ( target < SPOOLER_BATCH_MIN )
+        target = SPOOLER_BATCH_MIN;
+    else if ( target > SPOOLER_BATCH_MAX )
+        target = SPOOLER_BATCH_MAX;
+
+    __atomic_store_n(&spool_batch.target, (uint32_t)target, __ATOMIC_RELAXED);
+}
+
+/* a flushed batch came back from the outputs after usecs */
+static void spoolerBatchCommitted(uint64_t usecs)
+{
+    __atomic_store_n(&spool_batch.commit_us,
+            spoolerBatchSmooth(spool_batch.commit_us, usecs), __ATOMIC_RELAXED);
+    spoolerBatchTarget();
+}
+
+/* the records since the last flush are being flushed */
+static void spoolerBatchFlushed(uint32_t records, int why, uint64_t now)
+{
+    uint64_t elapsed = now - spool_batch.flush_us;
+
+    if ( elapsed )
+        __atomic_store_n(&spool_batch.rate,
+                spoolerBatchSmooth(spool_batch.rate, (uint64_t)records * 1000000 / elapsed),
+                __ATOMIC_RELAXED);
+
+    spool_batch.flush_us = now;
+    spool_batch.open_us = 0;
+    __atomic_add_fetch(&spool_batch.flushes[why], 1, __ATOMIC_RELAXED);
+    MetricsObserve(&spool_batch.records, records);
+    spoolerBatchTarget();
+}
+
+/*
+ * Function: spoolerBatchDue(uint32_t, uint64_t)
+ *
+ * Purpose: Whether the open batch of records has to be flushed now,
+ *          while there are records on the rings to go on with.
+ *
+ * Returns: SPOOLER_FLUSH_SIZE or SPOOLER_FLUSH_DELAY, or
+ *          SPOOLER_FLUSH_NONE to keep it open
+ */
+static int spoolerBatchDue(uint32_t records, uint64_t now)
+{
+    if ( 0 == records )
+        return SPOOLER_FLUSH_NONE;
+    if ( records >= spool_batch.target )
+        return SPOOLER_FLUSH_SIZE;
+    if ( spool_batch.open_us && now - spool_batch.open_us >= spool_batch.max_delay_us )
+        return SPOOLER_FLUSH_DELAY;
+    return SPOOLER_FLUSH_NONE;
+}
+
+/*
+ * Function: spoolerBatchIdle(uint64_t)
+ *
+ * Purpose: Whether the rings have been quiet long enough for what the
+ *          outputs hold to be flushed out.  Twice the time records have
+ *          been arriving apart, so a spool being written slowly is not
+ *          mistaken for an idle one, within SPOOLER_BATCH_QUIET_US and
+ *          batch_max_delay.
+ */
+static int spoolerBatchIdle(uint64_t now)
+{
+    uint64_t quiet_us = SPOOLER_BATCH_QUIET_US;
+
+    if ( spool_batch.rate )
+        quiet_us = 2000000 / spool_batch.rate;
+    if ( quiet_us < SPOOLER_BATCH_QUIET_US )
+        quiet_us = SPOOLER_BATCH_QUIET_US;
+    if ( quiet_us > spool_batch.max_delay_us )
+        quiet_us = spool_batch.max_delay_us;
+
+    return now - spool_batch.last_us >= quiet_us;
+}
+
+/* a packet on its own, its event already out: LOG style */
+static void spoolerRecordLog(spooler_r_para *sr_para, EventRecordNode *ep, OutputType out_type)
+{
+    EventEP eep;
+
+    eep.rid = sr_para->rid;
+    eep.ee = ep;
+    eep.ep = ep;
+    eep.ex_cnt = 0;
+    eep.attr_cnt = 0;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"Firing LOG style (Packet)\n"););
+    CallOutputPlugins(out_type, ep->s_pkt, &eep, ep->type);
+    spoolerRecordPut(sr_para, ep, 1);
+}
+
+/*
+ * The attribute view of an extra data record, its blob left in place.
+ * The blob has to fit the record and an address its family's size.
+ */
+static int spoolerExtraAttr(EventRecordNode *rec, EventAttr *attr)
+{
+    Unified2ExtraData *xd = (Unified2ExtraData *)(rec->data + sizeof(Unified2ExtraDataHdr));
+    uint32_t rec_len = ntohl(((Unified2RecordHeader *)rec->header)->length);
+    uint32_t off = sizeof(Unified2ExtraDataHdr) + sizeof(Unified2ExtraData);
+    uint32_t blob_len = ntohl(xd->blob_length);
+
+    attr->type = ntohl(xd->type);
+    if ( attr->type == 0 || attr->type >= EVENT_INFO_MAX
+            || ntohl(xd->data_type) != EVENT_DATA_TYPE_BLOB )
+        return 0;
+
+    /* blob_length counts itself and data_type */
+    if ( blob_len < 2 * sizeof(uint32_t) || blob_len - 2 * sizeof(uint32_t) > rec_len - off )
+        return 0;
+
+    attr->len = blob_len - 2 * sizeof(uint32_t);
+    attr->data = rec->data + off;
+
+    switch ( attr->type ) {
+    case EVENT_INFO_XFF_IPV4:
+        return attr->len == 4;
+    case EVENT_INFO_XFF_IPV6:
+    case EVENT_INFO_IPV6_SRC:
+    case EVENT_INFO_IPV6_DST:
+        return attr->len == 16;
+    default:
+        return 1;
+    }
+}
+
+/*
+ * Hand an event to the output plugins with everything it gathered in one
+ * call, SPECIAL style with its first packet, else ALERT style.  Plugins
+ * that do not take groups get the rest of its packets as LOG calls, as
+ * they would have had them on their own.  Returns the records output.
+ */
+static uint32_t spoolerGroupEmit(spooler_r_para *sr_para, spooler_group *g)
+{
+    spooler_ring *sring = sr_para->sring;
+    EventRecordNode *ee = &(sring->event_cache[g->ev]);
+    EventRecordNode *ep = &(sring->event_cache[g->ep]);
+    EventEP eep;
+    uint16_t i;
+
+    eep.rid = sr_para->rid;
+    eep.ee = ee;
+    eep.ep = ep;
+    eep.ex_cnt = g->ex_cnt;
+    eep.attr_cnt = 0;
+    for ( i=0; i<g->ex_cnt; i++ ) {
+        eep.ex[i] = &(sring->event_cache[g->ex[i]]);
+        if ( UNIFIED2_EXTRA_DATA == eep.ex[i]->type
+                && spoolerExtraAttr(eep.ex[i], &eep.attr[eep.attr_cnt]) )
+            eep.attr_cnt++;
+    }
+
+    if ( ep != ee ) {
+        DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"Firing SPECIAL style (Packet+Event)\n"););
+        CallOutputPlugins(OUTPUT_TYPE__SPECIAL, ep->s_pkt, &eep, ee->type);
+    }
+    else {
+        DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"Firing ALERT style (Event only)\n"););
+        CallOutputPlugins(OUTPUT_TYPE__ALERT, NULL, &eep, ee->type);
+    }
+    spoolerObserveLag(ee);
+
+    for ( i=0; i<g->ex_cnt; i++ ) {
+        if ( UNIFIED2_PACKET == eep.ex[i]->type )
+            spoolerRecordLog(sr_para, eep.ex[i], OUTPUT_TYPE__LOG_UNGROUPED);
+        else
+            spoolerRecordPut(sr_para, eep.ex[i], 0);
+    }
+
+    spoolerRecordPut(sr_para, ee, 0);
+    if ( ep != ee )
+        spoolerRecordPut(sr_para, ep, 1);
+
+    return 1 + (ep != ee) + g->ex_cnt;
+}
+
+/* open event of that cid, -1 when it went out already */
+static int spoolerWindowFind(spooler_ring *sring, us_cid_t cid)
+{
+    int i;
+
+    for ( i=0; i<sring->win_cnt; i++ ) {
+        if ( sring->event_cache[sring->window[i].ev].event_id == cid )
+            return i;
+    }
+
+    return -1;
+}
+
+static uint32_t spoolerWindowClose(spooler_r_para *sr_para, int i)
+{
+    spooler_ring *sring = sr_para->sring;
+    spooler_group g = sring->window[i];
+
+    sring->win_cnt--;
+    memmove(&(sring->window[i]), &(sring->window[i+1]),
+            (sring->win_cnt - i) * sizeof(sring->window[0]));
+
+    return spoolerGroupEmit(sr_para, &g);
+}
+
+static void spoolerOrphanRemove(spooler_ring *sring, uint16_t i)
+{
+    sring->orphan_cnt--;
+    memmove(&(sring->orphan[i]), &(sring->orphan[i+1]),
+            (sring->orphan_cnt - i) * sizeof(sring->orphan[0]));
+    memmove(&(sring->orphan_ms[i]), &(sring->orphan_ms[i+1]),
+            (sring->orphan_cnt - i) * sizeof(sring->orphan_ms[0]));
+}
+
+static void spoolerRecordDrop(spooler_r_para *sr_para, EventRecordNode *node)
+{
+    spoolerRecordPut(sr_para, node, 0);
+
+    pthread_mutex_lock(&sr_para->lock_ring);
+    sr_para->orphan_drop_cnt++;
+    pthread_mutex_unlock(&sr_para->lock_ring);
+}
+
+/* the oldest record waiting for its event gives up */
+static void spoolerOrphanDrop(spooler_r_para *sr_para)
+{
+    spooler_ring *sring = sr_para->sring;
+    EventRecordNode *node = &(sring->event_cache[sring->orphan[0]]);
+
+    LogMessage("%s: no event for record(rid: %d, type: %u, event_id: %lu, second: %u), dropped\n",
+            __func__, sr_para->rid, node->type, node->event_id, node->event_second);
+
+    spoolerOrphanRemove(sring, 0);
+    spoolerRecordDrop(sr_para, node);
+}
+
+/*
+ * A packet or extra data record whose event already has its cid (in
+ * event_id) joins the event's group, the first packet as the event's
+ * packet.  A full group goes out first.  Once the event is out a packet
+ * goes out LOG style on its own; extra data has nowhere to go.  Returns
+ * the records output.
+ */
+static uint32_t spoolerGroupJoin(spooler_r_para *sr_para, uint16_t pos)
+{
+    spooler_ring *sring = sr_para->sring;
+    EventRecordNode *node = &(sring->event_cache[pos]);
+    spooler_group *g;
+    uint32_t out = 0;
+    int i;
+
+    if ( (i = spoolerWindowFind(sring, node->event_id)) >= 0 ) {
+        g = &(sring->window[i]);
+        if ( UNIFIED2_PACKET == node->type && g->ep == g->ev )
+            g->ep = pos;
+        else if ( g->ex_cnt < SPOOLER_GROUP_MAX )
+            g->ex[g->ex_cnt++] = pos;
+        else
+            g = NULL;
+
+        if ( NULL != g ) {
+            if ( SPOOLER_RING_BEHIND(sring, pos) > SPOOLER_RING_BEHIND(sring, g->first) )
+                g->first = pos;
+            return 0;
+        }
+        out = spoolerWindowClose(sr_para, i);
+    }
+
+    if ( UNIFIED2_PACKET == node->type ) {
+        DEBUG_U_WRAP_DEEP(LogMessage("%s: this is additional packet for previous event\n", __func__));
+        spoolerRecordLog(sr_para, node, OUTPUT_TYPE__LOG);
+        return out + 1;
+    }
+
+    /* counted in the dropped records, no log line per record */
+    DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"extra data after its event(rid: %d, cid: %lu), dropped\n",
+            sr_para->rid, node->event_id););
+    spoolerRecordDrop(sr_para, node);
+
+    return out;
+}
+
+/*
+ * An event off the ring gets the next cid and opens a group in the ring's
+ * window, taking in the records already read for it; the oldest open
+ * event goes out when the window is full.  Returns the records output.
+ */
+static uint32_t spoolerRingEvent(spooler_r_para *sr_para, uint16_t pos)
+{
+    spooler_ring *sring = sr_para->sring;
+    EventRecordNode *ee = &(sring->event_cache[pos]), *op;
+    uint32_t event_id = (uint32_t)ee->event_id;
+    uint32_t out = 0;
+    spooler_group *g;
+    uint16_t i, slot;
+
+    sring->win_idle_ms = 0;
+    if ( sring->win_cnt >= SPOOLER_WINDOW_MAX )
+        out += spoolerWindowClose(sr_para, 0);
+
+    ee->event_id = spoolerXlateAdd(sring, event_id, ee->event_second);
+
+    g = &(sring->window[sring->win_cnt++]);
+    g->ev = pos;
+    g->ep = pos;
+    g->first = pos;
+    g->ex_cnt = 0;
+
+    for ( i=0; i<sring->orphan_cnt; ) {
+        slot = sring->orphan[i];
+        op = &(sring->event_cache[slot]);
+        if ( op->event_id != event_id || op->event_second != ee->event_second ) {
+            i++;
+            continue;
+        }
+
+        spoolerOrphanRemove(sring, i);
+        op->event_id = ee->event_id;
+        out += spoolerGroupJoin(sr_para, slot);
+    }
+
+    return out;
+}
+
+/*
+ * A packet or extra data record off the ring: it joins its event, or is
+ * held until the event is read.  Returns the records output.
+ */
+static uint32_t spoolerRingRecord(spooler_r_para *sr_para, uint16_t pos)
+{
+    spooler_ring *sring = sr_para->sring;
+    EventRecordNode *node = &(sring->event_cache[pos]);
+    us_cid_t cid;
+
+    sring->win_idle_ms = 0;
+
+    cid = spoolerXlateFind(sring, (uint32_t)node->event_id, node->event_second);
+    if ( cid ) {
+        node->event_id = cid;
+        return spoolerGroupJoin(sr_para, pos);
+    }
+
+    if ( sring->orphan_cnt >= SPOOLER_ORPHAN_MAX )
+        spoolerOrphanDrop(sr_para);
+
+    sring->orphan[sring->orphan_cnt] = pos;
+    sring->orphan_ms[sring->orphan_cnt] = 0;
+    sring->orphan_cnt++;
+
+    pthread_mutex_lock(&sr_para->lock_ring);
+    sr_para->orphan_cnt++;
+    pthread_mutex_unlock(&sr_para->lock_ring);
+
+    return 0;
+}
+
+#define SPOOLER_EXPIRE_HELD     0   //held too far behind top
+#define SPOOLER_EXPIRE_IDLE     1   //and waited out on an idle ring
+#define SPOOLER_EXPIRE_ALL      2
+
+/*
+ * Let go of what a ring holds: open events go out as they are, records
+ * without an event are dropped.  Waits are timed from when the ring is
+ * first seen idle, so a backlog never times out.  Returns the records
+ * output.
+ */
+static uint32_t spoolerRingExpire(spooler_r_para *sr_para, int how)
+{
+    spooler_ring *sring = sr_para->sring;
+    uint64_t now = 0;
+    uint32_t out = 0;
+    uint8_t done = 0;
+    uint16_t i;
+
+    if ( !sring->win_cnt && !sring->orphan_cnt )
+        return 0;
+
+    if ( SPOOLER_EXPIRE_IDLE == how ) {
+        now = spoolerNowMs();
+        if ( sring->win_cnt && 0 == sring->win_idle_ms )
+            sring->win_idle_ms = now;
+        for ( i=0; i<sring->orphan_cnt; i++ ) {
+            if ( 0 == sring->orphan_ms[i] )
+                sring->orphan_ms[i] = now;
+        }
+    }
+
+    while ( sring->win_cnt
+            && ( SPOOLER_EXPIRE_ALL == how
+                || SPOOLER_RING_BEHIND(sring, sring->window[0].first) > SPOOLER_HOLD_MAX
+                || (SPOOLER_EXPIRE_IDLE == how && now - sring->win_idle_ms >= SPOOLER_EVENT_WAIT_MS) ) ) {
+        out += spoolerWindowClose(sr_para, 0);
+        done = 1;
+    }
+
+    while ( sring->orphan_cnt
+            && ( SPOOLER_EXPIRE_ALL == how
+                || SPOOLER_RING_BEHIND(sring, sring->orphan[0]) > SPOOLER_HOLD_MAX
+                || (SPOOLER_EXPIRE_IDLE == how && now - sring->orphan_ms[0] >= SPOOLER_ORPHAN_WAIT_MS) ) ) {
+        spoolerOrphanDrop(sr_para);
+        done = 1;
+    }
+
+    if ( done )
+        spoolerRingWaldo(sr_para);
+
+    return out;
+}
+
 /*
  * */
 void spoolerRingTopSave(by_mul_tread_para *pbmt_para, RingTopOct *ele_rt)
@@ -1899,9 +2785,10 @@ void spoolerRingTopSave(by_mul_tread_para *pbmt_para, RingTopOct *ele_rt)
             DEBUG_U_WRAP_DEEP(LogMessage("%s: save ring[%d] top %d, ele_rt %d\n", __func__,
                     i, pbmt_para->s_para[i].sring->event_top,
                     ele_rt->r_id));
-            ele_rt->r_top[i] = pbmt_para->s_para[i].sring->event_top;
+            ele_rt->r_top[i] = spoolerRingHold(pbmt_para->s_para[i].sring);
         }
     }
+    ele_rt->r_us = spoolerNowUs();
     ele_rt->r_flag = 1;
 }
 
@@ -1911,6 +2798,7 @@ void spoolerRingTopSync(by_mul_tread_para *pbmt_para, EventRingTopOcts *ele_rto)
 {
     uint8_t i;
     uint8_t sync = 0, mque_fi_prev = 0;
+    uint64_t now = 0;
 
     while ( ele_rto->mque_fo != ele_rto->mque_fi ) {
 #ifndef SPO_MPOOL_RING
@@ -1920,6 +2808,10 @@ void spoolerRingTopSync(by_mul_tread_para *pbmt_para, EventRingTopOcts *ele_rto)
         }
 #endif
 
+        if ( 0 == now )
+            now = spoolerNowUs();
+        spoolerBatchCommitted(now - ele_rto->rings2mque[ele_rto->mque_fo].r_us);
+
         //Proceed To Next
         mque_fi_prev = ele_rto->mque_fo;
         ele_rto->mque_fo = SPOOLER_ELEQUE_RTO_PLUS_ONE(ele_rto->mque_fo);
@@ -1945,50 +2837,80 @@ void spoolerRingTopReset(EventRingTopOcts *ele_rto)
     memset(ele_rto, 0, sizeof(EventRingTopOcts));
 }
 
+/*
+ * Function: spoolerBatchHandover(by_mul_tread_para *, uint32_t, int, uint64_t, int)
+ *
+ * Purpose: Hand the open batch over to the outputs, with the ring tops it
+ *          covers.  This is the only flush a batch goes out with: a batch
+ *          is due before it reaches SPOOLER_BATCH_MAX records and no
+ *          record off a ring sends out more than SPOOLER_BATCH_STEP, so
+ *          an output sized for both never has to let go of one early.
+ */
+static void spoolerBatchHandover(by_mul_tread_para *pbmt_para, uint32_t records,
+        int why, uint64_t now, int holds)
+{
+    uint8_t mque_fi_next;
+    struct timespec t_elapse;
+
+    t_elapse.tv_sec = 0;
+    t_elapse.tv_nsec = 10;
+
+    spoolerBatchFlushed(records, why, now);
+    event_rto.rings2mque[event_rto.mque_fi].r_id = event_rto.mque_fi;
+    spoolerRingTopSave(pbmt_para, &(event_rto.rings2mque[event_rto.mque_fi]));
+    CallOutputPlugins(OUTPUT_TYPE__FLUSH, NULL, &(event_rto.rings2mque[event_rto.mque_fi]), UNIFIED2_IDS_FLUSH);
+    //No output keeps the batch, it is done with already
+    if ( !holds )
+        event_rto.rings2mque[event_rto.mque_fi].r_flag = 0;
+    //If mque is all used
+    mque_fi_next = SPOOLER_ELEQUE_RTO_PLUS_ONE(event_rto.mque_fi);
+    do {
+        if ( mque_fi_next == event_rto.mque_fo ) {
+            spoolerRingTopSync(pbmt_para, &event_rto);
+            nanosleep(&t_elapse, NULL);
+        }
+        else {
+            event_rto.mque_fi = mque_fi_next;
+            spoolerRingTopSync(pbmt_para, &event_rto);
+            break;
+        }
+    } while ( 1 );
+}
+
 /*
  ** RECORD PROCESSING EVENTS, as thread
  */
 void* spoolerRecordOutput_T(void * arg) //, int fire_output)
 {
-    uint8_t pbmt_idx = 0, mque_fi_next, i;
-    uint16_t pktpos;
-    uint32_t type;
+    uint8_t pbmt_idx = 0, i;
+    uint16_t pos;
+    uint32_t type, out;
     uint32_t cur_event_cnt = 0;
-    uint32_t record_idx; // current record number
-    EventEP enCaChe;
-    OutputType opt;
-#ifdef BY_FAKE_DATA_RE_CNT
-    uint32_t repeat_cnt[BY_MUL_TR_DEFAULT];
-#endif
-    time_t timestamp;
-    us_cid_t cur_eventid[BY_MUL_TR_DEFAULT];
+    uint64_t now;
+    int why, holds;
 
     sigset_t s_set;
     spooler_r_para *sr_para = NULL;
     by_mul_tread_para *pbmt_para = (by_mul_tread_para *) arg;
     struct timespec t_elapse;
     EventGMCid ret_mcid;
-#ifdef SPO_MPOOL_RING
-#ifdef SPO_MPOOL_DEBUG_LOG
-    uint64_t mbuf_check_int = 0;
-#endif
-    uint64_t mbuf_evn_cnt = 0, mbuf_put_cnt = 0;
-#endif
 
     sigemptyset(&s_set);
     sigfillset(&s_set);
     pthread_sigmask(SIG_SETMASK, &s_set, NULL);
 
+    PacketCountRegister();
+    TRACE_THREAD("spool-output");
+    SetThreadName("spool-output");
+
     t_elapse.tv_sec = 0;
     t_elapse.tv_nsec = 10;
     nanosleep(&t_elapse, NULL);   //switch to read threads
 
-    memset(cur_eventid, 0, sizeof(cur_eventid));
     spoolerRingTopReset(&event_rto);
-
-#ifdef BY_FAKE_DATA_RE_CNT
-    memset(repeat_cnt, 0, sizeof(repeat_cnt));
-#endif
+    holds = OutputFuncHolds();
+    spool_batch.flush_us = spool_batch.last_us = spoolerNowUs();
+    spoolerBatchTarget();
 
     while (0 == exit_signal)
     {
@@ -1998,31 +2920,50 @@ void* spoolerRecordOutput_T(void * arg) //, int fire_output)
         sr_para = &(pbmt_para->s_para[pbmt_idx]);
         pbmt_idx++;
 
-#ifdef SPO_MPOOL_DEBUG_LOG
-        if ( ((mbuf_check_int++&0x3fff)==0x2000) )
-            LogMessage("%s: mbuf_evn_cnt %lu, mbuf_put_cnt %lu\n", __func__,
-                    mbuf_evn_cnt, mbuf_put_cnt);
-#endif
-
         if (SPOOLER_RING_EMPTY(sr_para->sring)) {
             //LogMessage("%s: Spooler Ring is empty.\n", __func__);
-            if (sr_para->sring->r_flag) {
-                if (sr_para->sring->o_sleep_cnt++ > 1000) {
-                    sr_para->sring->r_flag = 0;
-                    sr_para->sring->o_sleep_cnt = 0;
-                    CallOutputPlugins(OUTPUT_TYPE__FLUSH, NULL, NULL, UNIFIED2_IDS_FLUSH_OUT);
-                    //sr_para->sring->event_coms = sr_para->sring->event_top;
-                    for ( i=0; i<BY_MUL_TR_DEFAULT; i++ ) {
-                        if ( pbmt_para->trbit_valid & (0x01<<i) ) {
-                            pbmt_para->s_para[i].sring->event_coms = pbmt_para->s_para[i].sring->event_top;
-                        }
-                    }
-                    spoolerRingTopReset(&event_rto);
-
+            if ( (out = spoolerRingExpire(sr_para, SPOOLER_EXPIRE_IDLE)) ) {
+                cur_event_cnt += out;
+                sr_para->sring->r_flag = 1;
+                spool_batch.last_us = spoolerNowUs();
+                if ( !spool_batch.open_us )
+                    spool_batch.open_us = spool_batch.last_us;
+                /* the other rings may let go of theirs next, keep the
+                 * batch within one step past its target */
+                if ( SPOOLER_FLUSH_NONE != (why = spoolerBatchDue(cur_event_cnt, spool_batch.last_us)) ) {
+                    spoolerBatchHandover(pbmt_para, cur_event_cnt, why, spool_batch.last_us, holds);
                     cur_event_cnt = 0;
-
-                    ret_mcid.rid = sr_para->rid;
-                    ret_mcid.ms_cid = sr_para->sring->base_eventid;
+                }
+            }
+            if ( sr_para->sring->r_flag
+                    && spoolerBatchIdle((now = spoolerNowUs())) ) {
+                /* only packets held for their event since the last flush:
+                 * nothing went out, nothing to learn the batch size from */
+                if ( cur_event_cnt )
+                    spoolerBatchFlushed(cur_event_cnt, SPOOLER_FLUSH_IDLE, now);
+                else
+                    spool_batch.open_us = 0;
+                CallOutputPlugins(OUTPUT_TYPE__FLUSH, NULL, NULL, UNIFIED2_IDS_FLUSH_OUT);
+                if ( holds && cur_event_cnt )
+                    spoolerBatchCommitted(spoolerNowUs() - now);
+                for ( i=0; i<BY_MUL_TR_DEFAULT; i++ ) {
+                    if ( pbmt_para->trbit_valid & (0x01<<i) ) {
+                        pbmt_para->s_para[i].sring->event_coms =
+                                spoolerRingHold(pbmt_para->s_para[i].sring);
+                    }
+                }
+                spoolerRingTopReset(&event_rto);
+
+                cur_event_cnt = 0;
+
+                /* all of them went out, not only this ring's */
+                for ( i=0; i<BY_MUL_TR_DEFAULT; i++ ) {
+                    if ( !(pbmt_para->trbit_valid & (0x01<<i))
+                            || !pbmt_para->s_para[i].sring->r_flag )
+                        continue;
+                    pbmt_para->s_para[i].sring->r_flag = 0;
+                    ret_mcid.rid = pbmt_para->s_para[i].rid;
+                    ret_mcid.ms_cid = pbmt_para->s_para[i].sring->next_cid;
                     CallOutputPlugins(OUTPUT_TYPE__FLUSH, NULL, &ret_mcid, UNIFIED2_IDS_UPD_MCID);
                 }
             }
@@ -2030,26 +2971,9 @@ void* spoolerRecordOutput_T(void * arg) //, int fire_output)
             continue;
         }
 
-        if ( cur_event_cnt >= 800 ) {
-            event_rto.rings2mque[event_rto.mque_fi].r_id = event_rto.mque_fi;
-            spoolerRingTopSave(pbmt_para, &(event_rto.rings2mque[event_rto.mque_fi]));
-            CallOutputPlugins(OUTPUT_TYPE__FLUSH, NULL, &(event_rto.rings2mque[event_rto.mque_fi]), UNIFIED2_IDS_FLUSH);
-            //If mque is all used
-            mque_fi_next = SPOOLER_ELEQUE_RTO_PLUS_ONE(event_rto.mque_fi);
-            do {
-                if ( mque_fi_next == event_rto.mque_fo ) {
-                    spoolerRingTopSync(pbmt_para, &event_rto);
-                    nanosleep(&t_elapse, NULL);
-                }
-                else {
-                    event_rto.mque_fi = mque_fi_next;
-                    spoolerRingTopSync(pbmt_para, &event_rto);
-                    break;
-                }
-            } while ( 1 );
-
-            //SPOOLER_RING_COMS_N_DEC(sr_para, cur_event_cnt);
-            //sr_para->sring->event_coms = sr_para->sring->event_top;
+        now = spoolerNowUs();
+        if ( SPOOLER_FLUSH_NONE != (why = spoolerBatchDue(cur_event_cnt, now)) ) {
+            spoolerBatchHandover(pbmt_para, cur_event_cnt, why, now, holds);
             cur_event_cnt = 0;
         }
         else {
@@ -2057,37 +2981,18 @@ void* spoolerRecordOutput_T(void * arg) //, int fire_output)
         }
 
         sr_para->sring->r_flag = 1;
-        sr_para->sring->o_sleep_cnt = 0;
+        spool_batch.last_us = now;
+        if ( !spool_batch.open_us )
+            spool_batch.open_us = now;
 
         /* convert type once */
-        enCaChe.rid = sr_para->rid;
-        //LogMessage("%s: rid %d\n", __func__, enCaChe.rid);
-        enCaChe.ee = &(sr_para->sring->event_cache[sr_para->sring->event_top]);
-
-#ifdef SPO_MPOOL_RING
-#if 0//def SPO_MPOOL_DEBUG
-        SPOOLER_RING_DEC(sr_para);
-        sr_para->sring->mr_flag = 1;
-        rte_mempool_put(sr_para->eNodeMpool, enCaChe.ee->mbuf_data);
-        continue;
-#endif
-#endif
-
-        type = ntohl(((Unified2RecordHeader *) enCaChe.ee->header)->type);
-
-        record_idx = enCaChe.ee->record_idx;
-        timestamp = enCaChe.ee->timestamp;
-
-        opt = OUTPUT_TYPE__NONE;
+        pos = sr_para->sring->event_top;
+        type = ntohl(((Unified2RecordHeader *) sr_para->sring->event_cache[pos].header)->type);
 
         switch (type) {
         case UNIFIED2_PACKET:
-            {
-                enCaChe.ep = enCaChe.ee;
-                //pPktData = enCaChe.ep->data;
-                opt = OUTPUT_TYPE__LOG;
-                pc.total_packets++;
-            }
+            pc.total_packets++;
+            cur_event_cnt += spoolerRingRecord(sr_para, pos);
             break;
         case UNIFIED2_IDS_EVENT: /* check if it's an event of known sorts */
         case UNIFIED2_IDS_EVENT_IPV6:
@@ -2095,175 +3000,42 @@ void* spoolerRecordOutput_T(void * arg) //, int fire_output)
         case UNIFIED2_IDS_EVENT_IPV6_MPLS:
         case UNIFIED2_IDS_EVENT_VLAN:
         case UNIFIED2_IDS_EVENT_IPV6_VLAN:
-            {
-                if (sr_para->sring->event_cnt < 2) {
-                    nanosleep(&t_elapse, NULL);     //Sleep 1ns
-                    if ( !sr_para->sring->rlog_wp ) {
-                        LogMessage("%s[%d]: wait for packet appear\n", __func__, sr_para->rid);
-                        sr_para->sring->rlog_wp = 1;
-                    }
-                    continue;                       //Continue with next ring, or not ?
-                }
-
-                sr_para->sring->rlog_wp = 0;
-                pc.total_events++;
-
-                //pEventData = enCaChe.ee->data;
-                opt = OUTPUT_TYPE__ALERT;
-
-                if (sr_para->sring->event_cnt > 1) {
-                    pktpos = SPOOLER_RING_PLUSONE(sr_para->sring->event_top);
-                    enCaChe.ep = &(sr_para->sring->event_cache[pktpos]);
-                    if (UNIFIED2_PACKET == ntohl(((Unified2RecordHeader*) enCaChe.ep->header)->type)) {
-                        //pPktData = enCaChe.ep->data;
-                        record_idx = enCaChe.ep->record_idx;
-                        timestamp = enCaChe.ep->timestamp;
-                        opt = OUTPUT_TYPE__SPECIAL;
-                        pc.total_packets++;
-#ifdef SPO_MPOOL_RING
-                        mbuf_evn_cnt++;
-#endif
-                    }
-                } else {
-                    LogMessage("%s: event_cnt is %d\n", __func__, sr_para->sring->event_cnt);
-                }
-            }
+            pc.total_events++;
+            cur_event_cnt += spoolerRingEvent(sr_para, pos);
             break;
         case UNIFIED2_EXTRA_DATA:
-            LogMessage("%s: Extra_data, skipped\n", __func__);
-            pc.total_unknown++;
+            pc.total_extra_data++;
+            cur_event_cnt += spoolerRingRecord(sr_para, pos);
             break;
         default:
+            LogMessage("%s: Unknown type, skipped\n", __func__);
             pc.total_unknown++;
+            spoolerRecordPut(sr_para, &(sr_para->sring->event_cache[pos]), 0);
+            cur_event_cnt++;
             break;
         }
         /* increment the stats */
         pc.total_records++;
-#ifdef SPO_MPOOL_RING
-        mbuf_evn_cnt++;
-#endif
 
-        switch (opt) {
-        case OUTPUT_TYPE__LOG: /* call output plugins with a "LOG" format (Packet information only) */
-        {
-            DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"Firing LOG style (Packet)\n"););
-            DEBUG_U_WRAP_DEEP(LogMessage("%s: Firing LOG style (Packet only), dsize %d\n",
-                    __func__, enCaChe.ep->s_pkt[0].dsize));
-            //enCaChe.ee = &(sr_para->sring->event_cache[sr_para->sring->event_top]);
-            //spoolerRetrievePktData(enCaChe.ee->s_pkt, pPktData);
-            if (enCaChe.ep->event_id <= cur_eventid[enCaChe.rid]) {
-                DEBUG_U_WRAP_DEEP(LogMessage("%s: this is additional packet for previous event\n", __func__));
-                CallOutputPlugins(OUTPUT_TYPE__LOG, enCaChe.ep->s_pkt,
-                        &enCaChe, enCaChe.ep->type);
-#ifdef SPO_MPOOL_RING
-                sr_para->sring->mr_flag = 1;
-#ifndef SPO_MPOOL_DEBUG
-                if ( enCaChe.ep->mbuf_turn2base )
-#endif
-                    rte_mempool_put(sr_para->eNodeMpool, enCaChe.ep->mbuf_data);
-#endif
-            }
-            else {
-                LogMessage("%s: this is wild packet(rid: %d, pkt: %lu, cur: %lu), skip it!\n", __func__,
-                        enCaChe.rid, enCaChe.ep->event_id, cur_eventid[enCaChe.rid]);
-/*                CallOutputPlugins(OUTPUT_TYPE__LOG, enCaChe.ep->s_pkt,
-                        NULL, 0);*/
-#ifdef SPO_MPOOL_RING
-                rte_mempool_put(sr_para->eNodeMpool, enCaChe.ep->mbuf_data);
-                mbuf_put_cnt++;
-#endif
-            }
-            SPOOLER_RING_DEC(sr_para);
-            cur_event_cnt++;
-            break;
-        }
-        case OUTPUT_TYPE__ALERT: /* call output plugins with an "ALERT" format (cached Event information only) */
-        {
-            DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"Firing ALERT style (Event only)\n"););
-            LogMessage("%s: Firing ALERT style (Event only)\n", __func__);
-            //enCaChe.ee = &(sr_para->sring->event_cache[sr_para->sring->event_top]);
-            CallOutputPlugins(OUTPUT_TYPE__ALERT, NULL,
-                    &enCaChe, enCaChe.ee->type);
-            SPOOLER_RING_DEC(sr_para);
-            cur_event_cnt++;
-            cur_eventid[enCaChe.rid] = enCaChe.ee->event_id;
-#ifdef SPO_MPOOL_RING
-            rte_mempool_put(sr_para->eNodeMpool, enCaChe.ee->mbuf_data);
-            mbuf_put_cnt++;
-#endif
-            break;
-        }
-        case OUTPUT_TYPE__SPECIAL: {
-            DEBUG_WRAP(LogMessage("%s: Firing SPECIAL style, top %d\n", __func__, sr_para->sring->event_top));
-/*            event_id = 0x0000ffff & ntohl(((Unified2CacheCommon *) pEventData)->event_id);
-            event_second = ntohl(((Unified2CacheCommon *) pEventData)->event_second);
-            pevent_id = 0x0000ffff & ntohl(((Unified2CacheCommon *) pPktData)->event_id);
-            pevent_second = ntohl(((Unified2CacheCommon *) pPktData)->event_second);
-            if (event_id != pevent_id || event_second != pevent_second) {
-                SPOOLER_RING_EVENT_DEC(sr_para);
-                break;
-            }*/
-
-            /*			LogMessage("%s: event_cur %d, event_top %d, event_cnt %d\n", __func__,
-             spooler->event_cur, spooler->event_top, spooler->event_cnt);
-             */
-            //enCaChe.ee = &(sr_para->sring->event_cache[sr_para->sring->event_top]);
-            //spoolerRetrievePktData(s_pkt, pPktData);
-
-            /* call output plugins with a "SPECIAL" alert format (both Event and Packet information) */
-            DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"Firing SPECIAL style (Packet+Event)\n"););
-
-#ifdef BY_FAKE_DATA_RE_CNT
-            if ( 0 == repeat_cnt[sr_para->rid] ){
-                enCaChe.ee->event_id = (((enCaChe.ee->event_id>0) ? (enCaChe.ee->event_id-1):0)<<BY_FAKE_DATA_RE_BITS);
-            }
-            else{
-                enCaChe.ee->event_id++;
-            }
-#endif
-
-            if (1){//BcAlertOnEachPacketInStream()) {
-                //LogMessage("%s: out put to database, event_id %d\n", __func__, event_id);
-                CallOutputPlugins(OUTPUT_TYPE__SPECIAL, enCaChe.ep->s_pkt,
-                        &enCaChe, enCaChe.ee->type);
-            }
-#ifdef BY_FAKE_DATA_RE_CNT
-            if ( repeat_cnt[sr_para->rid]++ >= BY_FAKE_DATA_RE_CNT ) {
-                SPOOLER_RING_EVENT_DEC(sr_para);
-                repeat_cnt[sr_para->rid] = 0;
-            }
-#else
-            SPOOLER_RING_EVENT_DEC(sr_para);
-            cur_event_cnt += 2;
-#endif
-
-            cur_eventid[enCaChe.rid] = enCaChe.ee->event_id;
-#ifdef SPO_MPOOL_RING
-            rte_mempool_put(sr_para->eNodeMpool, enCaChe.ee->mbuf_data);
-            mbuf_put_cnt++;
-            sr_para->sring->mr_flag = 1;
-#ifndef SPO_MPOOL_DEBUG
-            if ( enCaChe.ep->mbuf_turn2base )
-#endif
-                rte_mempool_put(sr_para->eNodeMpool, enCaChe.ep->mbuf_data);
-#endif
-            break;
-        }
-        default:
-            LogMessage("%s: Unknown type, skipped\n", __func__);
-            SPOOLER_RING_DEC(sr_para)
-            cur_event_cnt++;
-#ifdef SPO_MPOOL_RING
-            rte_mempool_put(sr_para->eNodeMpool, enCaChe.ee->mbuf_data);
-            mbuf_put_cnt++;
-#endif
-            break;
-        }
+        SPOOLER_RING_DEC(sr_para);
+        cur_event_cnt += spoolerRingExpire(sr_para, SPOOLER_EXPIRE_HELD);
 
         if (0 != exit_signal)
             LogMessage("%s: get lock in exiting， rid %d\n", __func__, sr_para->rid);
         /* waldo operations occur after the output plugins are called */
-        SPOOLER_WALDO_SET_REC(sr_para->waldo, timestamp, record_idx);
+        spoolerRingWaldo(sr_para);
+    }
+
+    /* Whatever the rings still hold goes out, or is dropped, before the last flush */
+    for ( i=0; i<BY_MUL_TR_DEFAULT; i++ ) {
+        if ( !(pbmt_para->trbit_valid & (0x01<<i)) )
+            continue;
+        cur_event_cnt += spoolerRingExpire(&(pbmt_para->s_para[i]), SPOOLER_EXPIRE_ALL);
+        now = spoolerNowUs();
+        if ( SPOOLER_FLUSH_NONE != (why = spoolerBatchDue(cur_event_cnt, now)) ) {
+            spoolerBatchHandover(pbmt_para, cur_event_cnt, why, now, holds);
+            cur_event_cnt = 0;
+        }
     }
 
 #ifdef SPO_MPOOL_RING
@@ -2274,10 +3046,6 @@ void* spoolerRecordOutput_T(void * arg) //, int fire_output)
     CallOutputPlugins(OUTPUT_TYPE__FLUSH, NULL, NULL, UNIFIED2_IDS_SPO_EXIT);
 #endif
 
-#ifdef SPO_MPOOL_DEBUG_LOG
-    LogMessage("%s: mbuf_evn_cnt %lu, mbuf_put_cnt %lu\n", __func__,
-            mbuf_evn_cnt, mbuf_put_cnt);
-#endif
     LogMessage("%s:  -----> exiting\n", __func__);
 
     return NULL;
@@ -60,6 +60,7 @@
 #include "sp_mpool.h"
 #endif
 #include "plugbase.h"
+#include "trace.h"
 
 
 //Definition of bit length for event id
@@ -123,6 +124,8 @@ typedef enum
 										pthread_mutex_lock(&para->lock_ring);	\
 										(para->sring->event_prod) = ((para->sring->event_prod)+1) & SPOOLER_RING_BITMASK;	\
 										para->sring->event_cnt++;	\
+										para->read_cnt++;	\
+										TRACE_INSTANT(TRACE_RING_ENQ, para->rid);	\
 										pthread_mutex_unlock(&para->lock_ring);	\
 										}while(0);
 
@@ -130,16 +133,11 @@ typedef enum
 										pthread_mutex_lock(&para->lock_ring);	\
 										(para->sring->event_top) = ((para->sring->event_top)+1) & SPOOLER_RING_BITMASK;	\
 										para->sring->event_cnt--;	\
+										para->out_cnt++;	\
+										TRACE_INSTANT(TRACE_RING_DEQ, para->rid);	\
 										pthread_mutex_unlock(&para->lock_ring);	\
 										}while(0);
 
-#define SPOOLER_RING_EVENT_DEC(para)		do{ \
-												pthread_mutex_lock(&para->lock_ring);	\
-												(para->sring->event_top) = ((para->sring->event_top)+2) & SPOOLER_RING_BITMASK;	\
-												para->sring->event_cnt -= 2;	\
-												pthread_mutex_unlock(&para->lock_ring);	\
-											}while(0);
-
 #define SPOOLER_RING_COMS_N_DEC(para, num)	do{ \
 												pthread_mutex_lock(&para->lock_ring);	\
 												(para->sring->event_coms) = ((para->sring->event_coms)+num) & SPOOLER_RING_BITMASK;	\
@@ -171,6 +169,26 @@ typedef enum
 #define SPOOLER_RING_FULL(ring)			( SPOOLER_RING_SIZE <= (ring)->event_cnt )
 #define SPOOLER_RING_EMPTY(ring)		( 0 == (ring)->event_cnt )
 #define SPOOLER_RING_PROCEED(ring)		( (((ring)->event_prod+1)&SPOOLER_RING_BITMASK) != (ring)->event_coms )
+#define SPOOLER_RING_BEHIND(ring, pos)	( ((ring)->event_top - (pos)) & SPOOLER_RING_BITMASK )
+
+/* Event id translation: (sensor event id, event second) to cid, per ring */
+#define SPOOLER_XLATE_SETS      (0x400)
+#define SPOOLER_XLATE_MASK      (SPOOLER_XLATE_SETS-1)
+#define SPOOLER_XLATE_WAYS      4
+
+/* Records held back off the ring until they can go out together */
+#define SPOOLER_WINDOW_MAX      8           //events open for their packets and extra data
+#define SPOOLER_GROUP_MAX       16          //records joining an event besides its first packet
+#define SPOOLER_ORPHAN_MAX      64          //records read ahead of their event
+#define SPOOLER_HOLD_MAX        (SPOOLER_RING_SIZE>>2)  //records behind top before a hold is let go
+#define SPOOLER_EVENT_WAIT_MS   100         //idle ring, open events go out as they are
+#define SPOOLER_ORPHAN_WAIT_MS  2000        //idle ring, record dropped without its event
+
+/* Output batches, sized from arrivals and flush latency, see spoolerBatchTarget() */
+#define SPOOLER_BATCH_MIN       8           //records per flush at the least
+#define SPOOLER_BATCH_MAX       SPOOLER_HOLD_MAX    //and at the most
+#define SPOOLER_BATCH_STEP      ((SPOOLER_WINDOW_MAX+1)*(SPOOLER_GROUP_MAX+2) + SPOOLER_ORPHAN_MAX + 1)  //records one record off a ring can send out, past the target
+#define SPOOLER_BATCH_QUIET_US  1000        //rings idle this long at the least before an idle flush
 
 
 //#####USI Set up end##################
@@ -223,11 +241,30 @@ typedef struct _EventRecordNode
 #endif
 } EventRecordNode;
 
+/* one extra data record of an event, pointing into its ring slot */
+typedef struct __EventAttr
+{
+    uint32_t type;              /* EventInfoEnum */
+    uint32_t len;
+    const uint8_t *data;        /* 4 or 16 bytes for the address types */
+}EventAttr;
+
+/*
+ * What the output plugins get for an event: the event, its first packet
+ * (the event itself when it has none) and, for plugins registered with
+ * SetOutputFuncGroups(), the rest of its packets and extra data in the
+ * order they were read.  Every plugin gets the extra data in attr[],
+ * valid for the length of the call.
+ */
 typedef struct __EventEP
 {
     uint8_t rid;
     EventRecordNode *ee;
     EventRecordNode *ep;
+    uint16_t ex_cnt;
+    EventRecordNode *ex[SPOOLER_GROUP_MAX];
+    uint16_t attr_cnt;
+    EventAttr attr[SPOOLER_GROUP_MAX];
 }EventEP;
 
 typedef struct __EventGMCid
@@ -248,12 +285,21 @@ typedef struct __EventSpoRings
 } EventSpoMR;
 #endif
 
-typedef enum
+typedef struct __spooler_group
+{
+    uint16_t                ev;             //slot of the event
+    uint16_t                first;          //oldest slot of the group
+    uint16_t                ep;             //slot of its first packet, ep == ev if none yet
+    uint16_t                ex_cnt;
+    uint16_t                ex[SPOOLER_GROUP_MAX];
+}spooler_group;
+
+typedef struct __spooler_xlate
 {
-	RING_ON,
-	RING_OFF,
-	RING_PRE_ON,
-}ring_swatch;
+    uint32_t                event_id;       //sensor event id
+    uint32_t                event_second;
+    us_cid_t                cid;            //0, way unused
+}spooler_xlate;
 
 typedef struct __spooler_ring
 {
@@ -263,16 +309,19 @@ typedef struct __spooler_ring
     uint16_t                event_coms;
     uint16_t                event_cnt;
     uint8_t                 r_flag;
-    uint8_t                 rlog_wp;//log for wait packet after event.
 #ifdef SPO_MPOOL_RING
     uint16_t                mr_flag;
 #endif
     uint32_t                i_sleep_cnt;
-    uint32_t                o_sleep_cnt;
-    us_cid_t                base_eventid;
-    us_cid_t                prev_eventid;
-    us_cid_t                rollon_cid;
-    ring_swatch             r_switch;
+    /* output thread only */
+    us_cid_t                next_cid;       //last cid handed out
+    spooler_xlate           xlate[SPOOLER_XLATE_SETS][SPOOLER_XLATE_WAYS];
+    uint8_t                 win_cnt;        //open events, oldest first
+    spooler_group           window[SPOOLER_WINDOW_MAX];
+    uint64_t                win_idle_ms;    //ring first seen idle with events open
+    uint16_t                orphan_cnt;     //records waiting for their event, oldest first
+    uint16_t                orphan[SPOOLER_ORPHAN_MAX];
+    uint64_t                orphan_ms[SPOOLER_ORPHAN_MAX];
 }spooler_ring;
 
 typedef struct _WaldoData
@@ -371,6 +420,10 @@ typedef struct __spooler_r_para
     spooler_ring            *sring;
     Waldo                   *waldo;
     pthread_t               *ptid_join;
+    uint64_t                read_cnt;   //records into the ring, under lock_ring
+    uint64_t                out_cnt;    //records out of the ring, under lock_ring
+    uint64_t                orphan_cnt; //records held for their event, under lock_ring
+    uint64_t                orphan_drop_cnt;    //records dropped without an event, under lock_ring
 #ifdef SPO_MPOOL_RING
     struct rte_mempool      *eNodeMpool;
     struct rte_ring         *eNodeRing;
@@ -425,6 +478,9 @@ void* spoolerRecordRead_T(void * arg);
 void* spoolerRecordOutput_T(void * arg);
 
 Packet * spoolerRetrievePktData(Packet *, uint8_t *);
+const EventAttr *EventAttrFind(const EventEP *, uint32_t);
+const char *EventAttrName(uint32_t);
+size_t EventAttrPrint(const EventAttr *, char *, size_t);
 
 int spoolerReadWaldo(Waldo *);
 void spoolerEventCacheFlush(Spooler *);
@@ -88,6 +88,8 @@
 #include "strlcpyu.h"
 #include "output-plugins/spo_log_tcpdump.h"
 #include "heartbeat.h"
+#include "metrics.h"
+#include "trace.h"
 
 #ifdef HAVE_LIBPRELUDE
 # include "output-plugins/spo_alert_prelude.h"
@@ -110,7 +112,7 @@ typedef enum _GetOptArgType {
 } GetOptArgType;
 
 /* Globals ********************************************************************/
-PacketCount pc; /* packet count information */
+__thread PacketCount pc __attribute__((aligned(64))); /* packet count information */
 
 unsigned short stat_dropped = 0;
 uint32_t *netmasks = NULL; /* precalculated netmask array */
@@ -130,7 +132,6 @@ VarNode *cmd_line_var_list = NULL;
 int exit_signal = 0;
 
 static int usr_signal = 0;
-static volatile int hup_signal = 0;
 volatile int barnyard2_initializing = 1;
 
 InputConfigFuncNode *input_config_funcs = NULL;
@@ -251,7 +252,11 @@ static void SigHupHandler(int);
  *
  * Returns: 0 => normal exit, 1 => exit on error
  *
+ * SQUIRREL_NO_MAIN leaves it out, for programs linked against the
+ * squirrel objects (bench/microbench).
+ *
  */
+#ifndef SQUIRREL_NO_MAIN
 int main(int argc, char *argv[])
 {
     barnyard2_argc = argc;
@@ -282,6 +287,7 @@ int main(int argc, char *argv[])
 
     return SquirrelMain(barnyard2_argc, barnyard2_argv);
 }
+#endif /* SQUIRREL_NO_MAIN */
 
 uint8_t by_openlock(const char *l_file, int *pfd)
 {
@@ -1082,8 +1088,8 @@ static void SigHupHandler(int signal)
     if (exit_signal != 0)
         return;
 
-    exit_signal = 1;
-    hup_signal = 1;
+    /* picked up by the map-reload thread, the spoolers keep going */
+    MapReloadRequest();
 
     return;
 }
@@ -1134,6 +1140,11 @@ static void Barnyard2Cleanup(int exit_val, int exit_needed)
 
     barnyard2_initializing = 0; /* just in case we cut out early */
 
+    /* sources point into plugin data freed below */
+    MetricsStop();
+    TRACE_STOP();
+    MapReloadStop();
+
     if (BcContinuousMode() || BcBatchMode()) {
         /* Do some post processing on any incomplete Plugin Data */
         idxPlugin = plugin_clean_exit_funcs;
@@ -1194,6 +1205,10 @@ static void Barnyard2Cleanup(int exit_val, int exit_needed)
         plugin_clean_exit_funcs = NULL;
     }
 
+    /* the exit statistics are written synchronously and not rate limited;
+     * the writer reads barnyard2_conf, so this comes before that goes too */
+    LogAsyncStop();
+
     /* Print Statistics */
     if (!BcTestMode() && !BcVersionMode()) {
         if (!stat_dropped) {
@@ -1260,6 +1275,9 @@ static void Barnyard2Cleanup(int exit_val, int exit_needed)
         barnyard2_conf = NULL;
     }
 
+    /* the published maps, no output runs any more */
+    MapSnapshotsFree();
+
     FreeOutputList(AlertList);
     FreeOutputList(LogList);
     FreeOutputList(FlushList);
@@ -1412,22 +1430,13 @@ int SignalCheck(void)
 
     usr_signal = 0;
 
-    if (hup_signal) {
-        ErrorMessage("*** Caught Hup-Signal\n");
-        DropStats(0);
-        stat_dropped = 1;
-        ErrorMessage("*** Resetting Stats\n");
-        memset(&pc, '\0', sizeof(PacketCount));
-        hup_signal = 0;
-        return 1;
-    }
-
     return 0;
 }
 
 static void InitGlobals(void)
 {
     memset(&pc, 0, sizeof(PacketCount));
+    PacketCountRegister();
     InitNetmasks();
     InitProtoNames();
 }
@@ -1451,6 +1460,10 @@ Barnyard2Config * Barnyard2ConfNew(void)
     bc->user_id = -1;
     bc->group_id = -1;
 
+    bc->log_rate = LOG_RATE_DEFAULT;
+    bc->log_burst = LOG_BURST_DEFAULT;
+    bc->batch_max_delay = BATCH_MAX_DELAY_DEFAULT;
+
     return bc;
 }
 
@@ -1484,6 +1497,11 @@ void Barnyard2ConfFree(Barnyard2Config *bc)
         bc->archive_dir = NULL;
     }
 
+    if (bc->metrics_listen != NULL) {
+        free(bc->metrics_listen);
+        bc->metrics_listen = NULL;
+    }
+
     if (bc->config_file != NULL) {
         free(bc->config_file);
         bc->config_file = NULL;
@@ -1534,7 +1552,8 @@ void Barnyard2ConfFree(Barnyard2Config *bc)
     }
 
     FreeSigSuppression(&bc->ssHead);
-    FreeSigNodes(&bc->sigHead);
+    bc->sigHead = NULL;
+    MapArenaFree(&bc->map_arena);
     FreeClassifications(&bc->classifications);
     FreeReferences(&bc->references);
 
@@ -1944,14 +1963,16 @@ static void Barnyard2Init(int argc, char **argv)
 
         DisplaySigSuppress(BCGetSigSuppressHead());
 
-        if (ReadSidFile(barnyard2_conf)) {
-            FatalError("[%s()], failed while processing [%s] \n", __FUNCTION__,
-                    bc->sid_msg_file);
-        }
+        switch (ReadMapFiles(barnyard2_conf)) {
+            case SOURCE_SID_MSG:
+                FatalError("[%s()], failed while processing [%s] \n", __FUNCTION__,
+                        bc->sid_msg_file);
+                break;
 
-        if (ReadGenFile(barnyard2_conf)) {
-            FatalError("[%s()], failed while processing [%s] \n", __FUNCTION__,
-                    bc->gen_msg_file);
+            case SOURCE_GEN_MSG:
+                FatalError("[%s()], failed while processing [%s] \n", __FUNCTION__,
+                        bc->gen_msg_file);
+                break;
         }
 
         if (barnyard2_conf->event_cache_size == 0) {
@@ -2015,14 +2036,27 @@ static void Barnyard2Init(int argc, char **argv)
 
 static void Barnyard2PostInit(void)
 {
+    /* before chroot and setuid, the socket may need either */
+    MetricsStart(barnyard2_conf->metrics_listen);
+
     InitPidChrootAndPrivs();
 
+    TRACE_START();
+
+    /* from here on the hot paths may log, take the I/O off them */
+    LogAsyncStart(barnyard2_conf->log_rate, barnyard2_conf->log_burst);
+
 #ifdef HAVE_LIBPRELUDE
     AlertPreludeSetupAfterSetuid();
 #endif
 
     PostConfigInitPlugins(barnyard2_conf->plugin_post_config_funcs);
 
+    /* the plugins have taken what they need from the lists, the outputs
+     * read the published maps from here on and SIGHUP reloads them */
+    MapPublish(barnyard2_conf);
+    MapReloadStart();
+
 #ifdef DEBUG
     DumpInputPlugins();
     DumpOutputPlugins();
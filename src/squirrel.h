@@ -67,6 +67,11 @@
 
 #define STD_BUF  1024
 
+#define LOG_RATE_DEFAULT   10       /* messages a second per call site */
+#define LOG_BURST_DEFAULT  50
+
+#define BATCH_MAX_DELAY_DEFAULT  200    /* msecs an output batch may stay open */
+
 #define MAX_PIDFILE_SUFFIX 11 /* uniqueness extension to PID file, see '-R' */
 
 #ifndef WIN32
@@ -148,9 +153,6 @@
 #define BY_MUL_TR_BITMASK       (BY_MUL_TR_DEFAULT-1)
 #define BY_MUK_TR_PLUSONE(num)  (((num)+1)&BY_MUL_TR_BITMASK)
 
-//#define BY_FAKE_DATA_RE_CNT     0x1FFFF
-//#define BY_FAKE_DATA_RE_BITS    17
-
 //DB Output Setup
 #define SQL_ELEQUE_INS_MAX                   (1<<3)
 #define SQL_ELEQUE_INS_MASK                  (SQL_ELEQUE_INS_MAX-1)   //Corresponding to MAX
@@ -411,6 +413,9 @@ typedef struct _Barnyard2Config
     int usr_signal;
     int cant_hup_signal;
     unsigned int event_cache_size;
+    uint32_t log_rate;              /* config log_rate_limit, per call site */
+    uint32_t log_burst;
+    uint32_t batch_max_delay;       /* config batch_max_delay, msecs */
     uint8_t verbose;                /* -v */
     uint8_t localtime;
 
@@ -425,6 +430,7 @@ typedef struct _Barnyard2Config
     ClassType *classifications;
     ReferenceSystemNode *references;
     SigNode *sigHead;  /* Signature list Head */
+    MapArena *map_arena;       /* sigHead lives in it */
     
     /* plugin active flags*/
     InputConfig *input_configs;
@@ -449,6 +455,7 @@ typedef struct _Barnyard2Config
     char *bpf_filter;          /* config bpf_filter */
     char **batch_filelist;
     char *archive_dir;
+    char *metrics_listen;      /* config metrics */
 
     Spooler *spooler[BY_MUL_TR_DEFAULT]; /* Used to know if we need to call spoolerClose */
 
@@ -466,6 +473,7 @@ typedef struct __RingTopOct
     uint8_t r_id;
     uint8_t r_flag;                     //1, handling; 0, process done
     uint16_t r_top[BY_MUL_TR_DEFAULT];
+    uint64_t r_us;                      //flushed at, monotonic usecs
 }RingTopOct;
 
 typedef struct __EventRingTopOcts
@@ -475,12 +483,14 @@ typedef struct __EventRingTopOcts
     RingTopOct rings2mque[SPOOLER_ELEQUE_RTO_MAX];
 }EventRingTopOcts;
 
-/* struct to collect packet statistics */
+/* struct to collect packet statistics; all members are uint64_t so shards
+ * can be summed as an array, see PacketCountSnapshot() */
 typedef struct _PacketCount
 {
     uint64_t total_records;
     uint64_t total_events;
     uint64_t total_packets;
+    uint64_t total_extra_data;
     uint64_t total_processed;
     uint64_t total_unknown;
     uint64_t total_suppressed;
@@ -608,7 +618,10 @@ typedef struct _SnortPacketHeader
 /*  E X T E R N S  ************************************************************/
 extern Barnyard2Config *barnyard2_conf;
 extern int datalink;          /* the datalink value */
-extern PacketCount pc;        /* packet count information */
+/* packet count information, one shard per thread: a thread only ever
+ * increments its own copy and calls PacketCountRegister() so the shards
+ * can be summed by PacketCountSnapshot() */
+extern __thread PacketCount pc;
 extern char **protocol_names;
 
 
@@ -0,0 +1,316 @@
+/****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/**
+ * @file   trace.c
+ *
+ * @brief  per-thread trace rings and the SIGUSR2 Chrome trace dump
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "trace.h"
+
+#ifdef ENABLE_TRACE
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "squirrel.h"
+#include "util.h"
+
+#define TRACE_RINGS_MAX     64      /* threads traced, later ones are not */
+#define TRACE_POLL_MS       200
+
+__thread TraceRing *trace_ring = NULL;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceRing *trace_rings = NULL;
+static int trace_ring_cnt = 0;
+
+static const char *trace_names[TRACE_NAME_MAX] =
+{
+    "record_read",
+    "ring_enqueue",
+    "ring_dequeue",
+    "output",
+    "db_transaction",
+    "db_commit",
+};
+static int trace_name_cnt = TRACE_PROBE_MAX;
+
+static pthread_t trace_tid;
+static int trace_running = 0;
+static volatile int trace_stop = 0;
+static volatile sig_atomic_t trace_dump_pending = 0;
+static uint64_t trace_epoch = 0;        /* time 0 in every dump */
+
+/*-------------------------------------------------------------------
+ * TraceRingGet: first probe on a thread, give it a ring
+ *-------------------------------------------------------------------
+ */
+TraceRing *TraceRingGet (void)
+{
+    TraceRing *r;
+
+    pthread_mutex_lock(&trace_lock);
+    if ( trace_ring_cnt >= TRACE_RINGS_MAX )
+    {
+        pthread_mutex_unlock(&trace_lock);
+        return NULL;
+    }
+    trace_ring_cnt++;
+    pthread_mutex_unlock(&trace_lock);
+
+    r = (TraceRing *)SnortAlloc(sizeof(TraceRing));
+    r->tid = (uint32_t)syscall(SYS_gettid);
+    snprintf(r->name, sizeof(r->name), "thread-%u", r->tid);
+
+    pthread_mutex_lock(&trace_lock);
+    r->next = trace_rings;
+    trace_rings = r;
+    pthread_mutex_unlock(&trace_lock);
+
+    trace_ring = r;
+    return r;
+}
+
+/*-------------------------------------------------------------------
+ * TraceThreadName: label the calling thread in the dump
+ *-------------------------------------------------------------------
+ */
+void TraceThreadName (const char *name)
+{
+    TraceRing *r = trace_ring;
+
+    if ( r == NULL && (r = TraceRingGet()) == NULL )
+        return;
+
+    pthread_mutex_lock(&trace_lock);
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/*-------------------------------------------------------------------
+ * TraceName: probe id for a name, the same name always gets the same
+ * id.  Names live until exit so ids survive a restart.
+ *-------------------------------------------------------------------
+ */
+uint16_t TraceName (const char *name)
+{
+    uint16_t id;
+    int i;
+
+    pthread_mutex_lock(&trace_lock);
+    for ( i = 0; i < trace_name_cnt; i++ )
+    {
+        if ( strcmp(trace_names[i], name) == 0 )
+        {
+            pthread_mutex_unlock(&trace_lock);
+            return (uint16_t)i;
+        }
+    }
+
+    if ( trace_name_cnt < TRACE_NAME_MAX )
+    {
+        trace_names[trace_name_cnt] = SnortStrdup(name);
+        id = (uint16_t)trace_name_cnt++;
+    }
+    else
+        id = TRACE_OUTPUT;
+    pthread_mutex_unlock(&trace_lock);
+
+    return id;
+}
+
+/*-------------------------------------------------------------------
+ * TraceDumpRing: write what is left of one ring.  Records older than
+ * a ring's length behind the head may be overwritten while we copy,
+ * so the head is loaded again after the copy and those are dropped.
+ *-------------------------------------------------------------------
+ */
+static int TraceDumpRing (FILE *fp, TraceRing *r, TraceRecord *copy, int first)
+{
+    uint64_t head, tail, i, j, done;
+    TraceRecord *rec;
+    pid_t pid = getpid();
+    char name[32];
+
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    tail = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+    for ( i = tail; i < head; i++ )
+        copy[i & TRACE_RING_MASK] = r->rec[i & TRACE_RING_MASK];
+
+    done = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if ( done > TRACE_RING_SIZE && done - TRACE_RING_SIZE > tail )
+        tail = done - TRACE_RING_SIZE;
+
+    pthread_mutex_lock(&trace_lock);
+    memcpy(name, r->name, sizeof(name));
+    pthread_mutex_unlock(&trace_lock);
+
+    fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+            "\"args\":{\"name\":\"%s\"}}", first ? "" : ",", (int)pid, r->tid, name);
+
+    for ( j = tail; j < head; j++ )
+    {
+        rec = &copy[j & TRACE_RING_MASK];
+
+        if ( rec->probe >= trace_name_cnt )
+            continue;
+
+        fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u%s"
+                "\"args\":{\"arg\":%u}}",
+                trace_names[rec->probe], rec->ph, ((double)rec->ts - (double)trace_epoch) / 1000.0,
+                (int)pid, r->tid, rec->ph == TRACE_PH_INSTANT ? ",\"s\":\"t\"," : ",",
+                rec->arg);
+    }
+
+    return 0;
+}
+
+/*-------------------------------------------------------------------
+ * TraceDump: every ring into <logdir>/squirrel.trace.<pid>.<time>.json
+ *-------------------------------------------------------------------
+ */
+static void TraceDump (void)
+{
+    TraceRecord *copy;
+    TraceRing *r, *rings;
+    char path[PATH_MAX];
+    FILE *fp;
+    int first = 1;
+
+    snprintf(path, sizeof(path), "%s/squirrel.trace.%d.%lu.json",
+             barnyard2_conf && barnyard2_conf->log_dir ? barnyard2_conf->log_dir : ".",
+             (int)getpid(), (unsigned long)time(NULL));
+
+    if ( (fp = fopen(path, "w")) == NULL )
+    {
+        ErrorMessage("trace: unable to open %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    copy = (TraceRecord *)SnortAlloc(sizeof(TraceRecord) * TRACE_RING_SIZE);
+
+    /* rings are never unlinked, the list head is all we need */
+    pthread_mutex_lock(&trace_lock);
+    rings = trace_rings;
+    pthread_mutex_unlock(&trace_lock);
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for ( r = rings; r; r = r->next )
+    {
+        TraceDumpRing(fp, r, copy, first);
+        first = 0;
+    }
+    fprintf(fp, "\n]}\n");
+
+    free(copy);
+
+    if ( fclose(fp) != 0 )
+        ErrorMessage("trace: error writing %s: %s\n", path, strerror(errno));
+    else
+        LogMessage("trace: wrote %s\n", path);
+}
+
+static void TraceSigHandler (int signal)
+{
+    trace_dump_pending = 1;
+}
+
+static void *TraceThread (void *arg)
+{
+    struct timespec t = { 0, TRACE_POLL_MS * 1000000 };
+    sigset_t mask;
+
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    while ( !trace_stop )
+    {
+        nanosleep(&t, NULL);
+
+        if ( trace_dump_pending )
+        {
+            trace_dump_pending = 0;
+            TraceDump();
+        }
+    }
+
+    return NULL;
+}
+
+/*-------------------------------------------------------------------
+ * TraceStart: install the SIGUSR2 handler and start the dump thread
+ *-------------------------------------------------------------------
+ */
+void TraceStart (void)
+{
+    struct timespec now;
+
+    if ( trace_running )
+        return;
+
+    if ( trace_epoch == 0 )
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        trace_epoch = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    }
+
+    trace_stop = 0;
+
+    if ( pthread_create(&trace_tid, NULL, TraceThread, NULL) )
+    {
+        ErrorMessage("trace: unable to start the dump thread\n");
+        return;
+    }
+
+    trace_running = 1;
+    signal(SIGUSR2, TraceSigHandler);
+
+    TraceThreadName("main");
+    LogMessage("trace: %d records per thread, SIGUSR2 writes them to %s\n",
+               TRACE_RING_SIZE, barnyard2_conf->log_dir);
+}
+
+void TraceStop (void)
+{
+    if ( !trace_running )
+        return;
+
+    signal(SIGUSR2, SIG_IGN);
+
+    trace_stop = 1;
+    pthread_join(trace_tid, NULL);
+    trace_running = 0;
+}
+
+#endif /* ENABLE_TRACE */
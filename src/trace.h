@@ -0,0 +1,133 @@
+/****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/**
+ * @file   trace.h
+ *
+ * @brief  hot path trace probes (configure --enable-trace)
+ *
+ * Every thread that hits a probe gets its own ring of fixed size binary
+ * records (timestamp, probe, phase, one argument).  Writing one is a
+ * clock read and a few stores, with no lock and no formatting.  SIGUSR2
+ * asks a background thread to write the rings out as Chrome trace JSON
+ * (loadable in chrome://tracing or ui.perfetto.dev) into the log
+ * directory.
+ *
+ * Without ENABLE_TRACE every TRACE_*() macro is empty and trace.c
+ * compiles to nothing.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/* fixed probes, names in trace.c; output plugins get ids after these */
+typedef enum _TraceProbe
+{
+    TRACE_RECORD_READ = 0,  /* spool record read, arg ring */
+    TRACE_RING_ENQ,         /* record put on a ring, arg ring */
+    TRACE_RING_DEQ,         /* record taken off a ring, arg ring */
+    TRACE_OUTPUT,           /* one output pass over the plugins, arg type */
+    TRACE_DB_TRANSACTION,   /* database transaction, arg query thread */
+    TRACE_DB_COMMIT,        /* database commit, arg query thread */
+    TRACE_PROBE_MAX
+} TraceProbe;
+
+#ifdef ENABLE_TRACE
+
+#include <stdint.h>
+#include <time.h>
+
+#define TRACE_RING_SIZE     (1<<16)     /* records per thread */
+#define TRACE_RING_MASK     (TRACE_RING_SIZE-1)
+#define TRACE_NAME_MAX      256         /* probe and plugin names */
+
+#define TRACE_PH_BEGIN      'B'
+#define TRACE_PH_END        'E'
+#define TRACE_PH_INSTANT    'i'
+
+typedef struct _TraceRecord
+{
+    uint64_t ts;            /* CLOCK_MONOTONIC nsecs */
+    uint32_t arg;
+    uint16_t probe;
+    uint8_t  ph;
+    uint8_t  pad;
+} TraceRecord;
+
+typedef struct _TraceRing
+{
+    uint64_t head;          /* records ever written, published last */
+    uint32_t tid;
+    char name[32];
+    struct _TraceRing *next;
+    TraceRecord rec[TRACE_RING_SIZE];
+} TraceRing;
+
+extern __thread TraceRing *trace_ring;
+
+TraceRing *TraceRingGet(void);
+void TraceThreadName(const char *);
+uint16_t TraceName(const char *);
+void TraceStart(void);
+void TraceStop(void);
+
+static inline void TraceRecordPut (uint16_t probe, uint8_t ph, uint32_t arg)
+{
+    TraceRing *r = trace_ring;
+    TraceRecord *rec;
+    struct timespec ts;
+    uint64_t head;
+
+    if ( r == NULL && (r = TraceRingGet()) == NULL )
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    head = r->head;
+    rec = &r->rec[head & TRACE_RING_MASK];
+    rec->ts = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->arg = arg;
+    rec->probe = probe;
+    rec->ph = ph;
+
+    /* the dumper only reads records below a head it loaded */
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#define TRACE_BEGIN(probe, arg)     TraceRecordPut((probe), TRACE_PH_BEGIN, (arg))
+#define TRACE_END(probe, arg)       TraceRecordPut((probe), TRACE_PH_END, (arg))
+#define TRACE_INSTANT(probe, arg)   TraceRecordPut((probe), TRACE_PH_INSTANT, (arg))
+#define TRACE_THREAD(name)          TraceThreadName(name)
+#define TRACE_NAME(name)            TraceName(name)
+#define TRACE_START()               TraceStart()
+#define TRACE_STOP()                TraceStop()
+
+#else
+
+#define TRACE_BEGIN(probe, arg)     do { } while (0)
+#define TRACE_END(probe, arg)       do { } while (0)
+#define TRACE_INSTANT(probe, arg)   do { } while (0)
+#define TRACE_THREAD(name)          do { } while (0)
+#define TRACE_NAME(name)            0
+#define TRACE_START()               do { } while (0)
+#define TRACE_STOP()                do { } while (0)
+
+#endif /* ENABLE_TRACE */
+
+#endif /* __TRACE_H__ */
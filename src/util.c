@@ -42,6 +42,16 @@
 #include <time.h>
 #include <signal.h>
 #include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+/* vector payload encoders, see EncodeHex() */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ENCODE_X86
+#include <immintrin.h>
+#endif
 
 #ifndef WIN32
 #include <grp.h>
@@ -407,6 +417,343 @@ void strip(char *data) {
 	}
 }
 
+/*
+ * Logging is asynchronous once LogAsyncStart() has run: LogMessage and
+ * ErrorMessage format into a queue owned by the calling thread (one
+ * producer, so no lock) and a writer thread does the syslog()/stderr
+ * I/O.  A full queue drops the message and counts it rather than block.
+ *
+ * Every call site, told apart by its format string, also has a token
+ * bucket (config log_rate_limit) so one message repeated per event
+ * cannot flood the log; the writer reports what each site suppressed
+ * once a second.  Before LogAsyncStart and after LogAsyncStop messages
+ * are written synchronously as before.
+ */
+#define LOG_QUEUE_SIZE		64		/* messages per thread */
+#define LOG_QUEUE_MASK		(LOG_QUEUE_SIZE-1)
+#define LOG_MAX_QUEUES		64
+#define LOG_SITES		1024
+#define LOG_SITE_PROBE		8
+#define LOG_IDLE_NS		2000000		/* writer poll when idle */
+
+#define LOG_PRIO_NOTICE		(LOG_DAEMON | LOG_NOTICE)
+#define LOG_PRIO_ERR		(LOG_CONS | LOG_DAEMON | LOG_ERR)
+
+typedef struct _LogEntry
+{
+	int prio;
+	char msg[STD_BUF + 1];
+} LogEntry;
+
+typedef struct _LogQueue
+{
+	volatile uint32_t head;		/* written by the owning thread */
+	volatile uint32_t tail;		/* written under log_drain_lock */
+	uint32_t dropped;
+	struct _LogQueue *next;
+	LogEntry ent[LOG_QUEUE_SIZE];
+} LogQueue;
+
+typedef struct _LogSite
+{
+	const char *fmt;
+	volatile int lock;
+	uint32_t suppressed;
+	uint64_t tokens;		/* in 1/1000 messages */
+	uint64_t last;			/* ns of the last refill */
+} LogSite;
+
+static __thread LogQueue *log_queue = NULL;
+static LogQueue *log_queues = NULL;
+static int log_queue_cnt = 0;
+static pthread_mutex_t log_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t log_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static LogSite log_sites[LOG_SITES];
+static uint32_t log_rate = 0;		/* per site per second, 0 is no limit */
+static uint32_t log_burst = 0;
+
+static pthread_t log_tid;
+static volatile int log_async = 0;
+static volatile int log_stop = 0;
+static int log_to_syslog = 0;		/* decided at start, conf may go away */
+
+static uint64_t LogNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void LogWrite(int prio, int to_syslog, const char *msg)
+{
+	if (to_syslog)
+		syslog(prio, "%s", msg);
+	else
+		fputs(msg, stderr);
+}
+
+/* take a token from the call site's bucket, 0 if it is empty */
+static int LogSiteAllow(const char *fmt)
+{
+	LogSite *site = NULL;
+	uint64_t now, refill;
+	uintptr_t h = (uintptr_t)fmt;
+	int i, allow;
+
+	if (log_rate == 0)
+		return 1;
+
+	h = (h >> 3) ^ (h >> 13);
+	for (i = 0; i < LOG_SITE_PROBE; i++) {
+		LogSite *s = &log_sites[(h + i) & (LOG_SITES - 1)];
+
+		/* claim an empty slot; losing the race to the same site is fine */
+		if (s->fmt == fmt
+				|| (s->fmt == NULL && __sync_bool_compare_and_swap(&s->fmt, NULL, fmt))
+				|| s->fmt == fmt) {
+			site = s;
+			break;
+		}
+	}
+
+	/* table full around this slot, let it through */
+	if (site == NULL)
+		return 1;
+
+	now = LogNow();
+
+	while (__sync_lock_test_and_set(&site->lock, 1))
+		;
+
+	if (site->last == 0) {
+		site->tokens = (uint64_t)log_burst * 1000;
+		site->last = now;
+	} else {
+		refill = (now - site->last) * log_rate / 1000000;
+		site->tokens += refill;
+		if (site->tokens >= (uint64_t)log_burst * 1000) {
+			site->tokens = (uint64_t)log_burst * 1000;
+			site->last = now;
+		} else {
+			/* only the time turned into tokens, the rest counts next call */
+			site->last += refill * 1000000 / log_rate;
+		}
+	}
+
+	if (site->tokens >= 1000) {
+		site->tokens -= 1000;
+		allow = 1;
+	} else {
+		site->suppressed++;
+		allow = 0;
+	}
+
+	__sync_lock_release(&site->lock);
+
+	return allow;
+}
+
+static int LogDrain(void);
+
+static LogQueue *LogQueueGet(void)
+{
+	LogQueue *q;
+
+	pthread_mutex_lock(&log_queue_lock);
+	if (log_queue_cnt >= LOG_MAX_QUEUES) {
+		pthread_mutex_unlock(&log_queue_lock);
+		return NULL;
+	}
+	log_queue_cnt++;
+	pthread_mutex_unlock(&log_queue_lock);
+
+	q = (LogQueue *)SnortAlloc(sizeof(LogQueue));
+
+	pthread_mutex_lock(&log_queue_lock);
+	q->next = log_queues;
+	log_queues = q;
+	pthread_mutex_unlock(&log_queue_lock);
+
+	log_queue = q;
+	return q;
+}
+
+static void LogVPost(int prio, const char *format, va_list ap)
+{
+	LogQueue *q;
+	LogEntry *e;
+	uint32_t head;
+
+	if (!LogSiteAllow(format))
+		return;
+
+	if ((q = log_queue) == NULL && (q = LogQueueGet()) == NULL) {
+		/* more threads than queues, this one logs for itself */
+		char buf[STD_BUF + 1];
+
+		vsnprintf(buf, STD_BUF, format, ap);
+		buf[STD_BUF] = '\0';
+		LogWrite(prio, log_to_syslog, buf);
+		return;
+	}
+
+	head = q->head;
+	if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= LOG_QUEUE_SIZE) {
+		/* the writer is behind, write out the queues here, in order */
+		LogDrain();
+		if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= LOG_QUEUE_SIZE) {
+			__sync_fetch_and_add(&q->dropped, 1);
+			return;
+		}
+	}
+
+	e = &q->ent[head & LOG_QUEUE_MASK];
+	e->prio = prio;
+	vsnprintf(e->msg, STD_BUF, format, ap);
+	e->msg[STD_BUF] = '\0';
+
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* write out everything queued so far, returns the number of messages */
+static int LogDrain(void)
+{
+	LogQueue *q;
+	uint32_t head, tail, dropped;
+	char buf[64];
+	int n = 0;
+
+	pthread_mutex_lock(&log_drain_lock);
+
+	pthread_mutex_lock(&log_queue_lock);
+	q = log_queues;
+	pthread_mutex_unlock(&log_queue_lock);
+
+	for (; q != NULL; q = q->next) {
+		head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+		for (tail = q->tail; tail != head; tail++, n++) {
+			LogEntry *e = &q->ent[tail & LOG_QUEUE_MASK];
+
+			LogWrite(e->prio, log_to_syslog, e->msg);
+			__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+		}
+
+		if (q->dropped && (dropped = __sync_lock_test_and_set(&q->dropped, 0))) {
+			snprintf(buf, sizeof(buf), "log queue full, %u messages dropped\n", dropped);
+			LogWrite(LOG_PRIO_ERR, log_to_syslog, buf);
+		}
+	}
+
+	if (!log_to_syslog)
+		fflush(stderr);
+
+	pthread_mutex_unlock(&log_drain_lock);
+
+	return n;
+}
+
+/* one line per call site that had messages suppressed since last time */
+static void LogSuppressedReport(void)
+{
+	char buf[STD_BUF + 1];
+	uint32_t n;
+	int i, len;
+
+	for (i = 0; i < LOG_SITES; i++) {
+		LogSite *site = &log_sites[i];
+
+		if (site->fmt == NULL || site->suppressed == 0)
+			continue;
+
+		while (__sync_lock_test_and_set(&site->lock, 1))
+			;
+		n = site->suppressed;
+		site->suppressed = 0;
+		__sync_lock_release(&site->lock);
+
+		len = snprintf(buf, sizeof(buf), "suppressed %u messages like: %s", n, site->fmt);
+		if (len > 0 && len < (int)sizeof(buf) && buf[len - 1] != '\n')
+			strncat(buf, "\n", sizeof(buf) - len - 1);
+
+		LogWrite(LOG_PRIO_NOTICE, log_to_syslog, buf);
+	}
+}
+
+static void *LogWriterThread(void *arg)
+{
+	struct timespec idle = { 0, LOG_IDLE_NS };
+	uint64_t next_report = LogNow() + 1000000000ULL;
+	sigset_t mask;
+
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	while (!log_stop) {
+		if (LogDrain() == 0)
+			nanosleep(&idle, NULL);
+
+		if (LogNow() >= next_report) {
+			LogSuppressedReport();
+			next_report = LogNow() + 1000000000ULL;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Function: LogAsyncStart(uint32_t, uint32_t)
+ *
+ * Purpose: Hand log output to a writer thread, rate limiting each call
+ *          site to rate messages a second with bursts of burst.
+ *
+ * Arguments: rate => messages per second per call site, 0 for no limit
+ *            burst => messages a site may log at once
+ *
+ * Returns: void function
+ */
+void LogAsyncStart(uint32_t rate, uint32_t burst) {
+	if (log_async || barnyard2_conf == NULL)
+		return;
+
+	log_rate = rate;
+	log_burst = burst > 0 ? burst : 1;
+	log_to_syslog = BcDaemonMode() || BcLogSyslog();
+	memset(log_sites, 0, sizeof(log_sites));
+
+	log_stop = 0;
+	if (pthread_create(&log_tid, NULL, LogWriterThread, NULL)) {
+		ErrorMessage("Unable to start the log writer thread, logging synchronously\n");
+		return;
+	}
+
+	log_async = 1;
+}
+
+/*
+ * Function: LogAsyncStop(void)
+ *
+ * Purpose: Write out anything queued and go back to synchronous logging.
+ *          Must be called before barnyard2_conf is freed.
+ *
+ * Returns: void function
+ */
+void LogAsyncStop(void) {
+	if (!log_async)
+		return;
+
+	log_async = 0;
+	log_stop = 1;
+	pthread_join(log_tid, NULL);
+
+	/* anything posted while the writer was stopping */
+	LogDrain();
+	LogSuppressedReport();
+}
+
 /*
  * Function: ErrorMessage(const char *, ...)
  *
@@ -426,10 +773,12 @@ void ErrorMessage(const char *format, ...) {
 
 	va_start(ap, format);
 
-	if (BcDaemonMode() || BcLogSyslog()) {
+	if (log_async) {
+		LogVPost(LOG_PRIO_ERR, format, ap);
+	} else if (BcDaemonMode() || BcLogSyslog()) {
 		vsnprintf(buf, STD_BUF, format, ap);
 		buf[STD_BUF] = '\0';
-		syslog(LOG_CONS | LOG_DAEMON | LOG_ERR, "%s", buf);
+		syslog(LOG_PRIO_ERR, "%s", buf);
 	} else {
 		vfprintf(stderr, format, ap);
 	}
@@ -458,10 +807,12 @@ void LogMessage(const char *format, ...) {
 
 	va_start(ap, format);
 
-	if (BcDaemonMode() || BcLogSyslog()) {
+	if (log_async) {
+		LogVPost(LOG_PRIO_NOTICE, format, ap);
+	} else if (BcDaemonMode() || BcLogSyslog()) {
 		vsnprintf(buf, STD_BUF, format, ap);
 		buf[STD_BUF] = '\0';
-		syslog(LOG_DAEMON | LOG_NOTICE, "%s", buf);
+		syslog(LOG_PRIO_NOTICE, "%s", buf);
 	} else {
 		vfprintf(stderr, format, ap);
 	}
@@ -533,6 +884,10 @@ NORETURN void FatalError(const char *format, ...) {
 
 	buf[STD_BUF] = '\0';
 
+	/* what led up to this goes out first */
+	if (log_async)
+		LogDrain();
+
 	if ((barnyard2_conf != NULL) && (BcDaemonMode() || BcLogSyslog())) {
 		syslog(LOG_CONS | LOG_DAEMON | LOG_ERR, "FATAL ERROR: %s", buf);
 	} else {
@@ -762,148 +1117,255 @@ void SetUidGid(int user_id, int group_id) {
 #endif  /* WIN32 */
 }
 
+/*
+ * Packet counters are sharded per thread (pc is thread local, see
+ * squirrel.h) so the decoders never write to a cache line another thread
+ * is counting on.  Each thread registers its shard here; reading the
+ * totals sums the shards without stopping or locking out the writers,
+ * which is as exact as any unlocked read of a counter being incremented.
+ */
+#define PC_MAX_SHARDS 64
+#define PC_FIELDS (sizeof(PacketCount) / sizeof(uint64_t))
+
+static pthread_mutex_t pc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pc_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pc_key;
+static PacketCount *pc_shards[PC_MAX_SHARDS];
+static int pc_shard_cnt = 0;
+static PacketCount pc_retired;  /* counts of threads that have exited */
+
+static void PacketCountAdd(PacketCount *sum, const PacketCount *shard)
+{
+	const volatile uint64_t *src = (const volatile uint64_t *)shard;
+	uint64_t *dst = (uint64_t *)sum;
+	size_t i;
+
+	for (i = 0; i < PC_FIELDS; i++)
+		dst[i] += src[i];
+}
+
+/* key destructor: fold an exiting thread's shard into the retired counts */
+static void PacketCountRetire(void *arg)
+{
+	PacketCount *shard = (PacketCount *)arg;
+	int i;
+
+	pthread_mutex_lock(&pc_lock);
+
+	PacketCountAdd(&pc_retired, shard);
+
+	for (i = 0; i < pc_shard_cnt; i++) {
+		if (pc_shards[i] == shard) {
+			pc_shards[i] = pc_shards[--pc_shard_cnt];
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&pc_lock);
+}
+
+static void PacketCountInit(void)
+{
+	pthread_key_create(&pc_key, PacketCountRetire);
+}
+
+/* call once at the start of every thread that increments pc */
+void PacketCountRegister(void)
+{
+	pthread_once(&pc_once, PacketCountInit);
+
+	if (pthread_getspecific(pc_key) != NULL)
+		return;
+
+	pthread_mutex_lock(&pc_lock);
+
+	if (pc_shard_cnt == PC_MAX_SHARDS) {
+		pthread_mutex_unlock(&pc_lock);
+		ErrorMessage("Too many threads for the packet counters, "
+				"this thread's counts will be missing\n");
+		return;
+	}
+
+	pc_shards[pc_shard_cnt++] = &pc;
+	pthread_setspecific(pc_key, &pc);
+
+	pthread_mutex_unlock(&pc_lock);
+}
+
+static void PacketCountTotal(PacketCount *total)
+{
+	int i;
+
+	memcpy(total, &pc_retired, sizeof(PacketCount));
+
+	for (i = 0; i < pc_shard_cnt; i++)
+		PacketCountAdd(total, pc_shards[i]);
+}
+
+/* totals of all threads since start up */
+void PacketCountSnapshot(PacketCount *snap)
+{
+	pthread_mutex_lock(&pc_lock);
+	PacketCountTotal(snap);
+	pthread_mutex_unlock(&pc_lock);
+}
+
+/* name the calling thread for top -H and /proc/<pid>/task/<tid>/comm,
+ * the kernel keeps the first 15 characters */
+void SetThreadName(const char *name)
+{
+#ifdef __linux__
+	prctl(PR_SET_NAME, (unsigned long)name, 0, 0, 0);
+#endif
+}
+
 /* exiting should be 0 for if not exiting and 1 if exiting */
 void DropStats(int exiting) {
+	PacketCount stats;
 	uint64_t total = 0;
 
+	PacketCountSnapshot(&stats);
+
 	LogMessage("================================================"
 			"===============================\n");
 
 	LogMessage("Record Totals:\n");
-	LogMessage("   Records:" FMTu64("12") "\n", pc.total_records);
-	LogMessage("   Events:" FMTu64("12") " (%.3f%%)\n", pc.total_events,
-			CalcPct(pc.total_events, pc.total_records));
-	LogMessage("   Packets:" FMTu64("12") " (%.3f%%)\n", pc.total_packets,
-			CalcPct(pc.total_packets, pc.total_records));
-	LogMessage("   Unknown:" FMTu64("12") " (%.3f%%)\n", pc.total_unknown,
-			CalcPct(pc.total_unknown, pc.total_records));
-	LogMessage("   Suppressed:" FMTu64("12") " (%.3f%%)\n", pc.total_suppressed,
-			CalcPct(pc.total_suppressed, pc.total_records));
-
-	total = pc.total_packets;
+	LogMessage("   Records:" FMTu64("12") "\n", stats.total_records);
+	LogMessage("   Events:" FMTu64("12") " (%.3f%%)\n", stats.total_events,
+			CalcPct(stats.total_events, stats.total_records));
+	LogMessage("   Packets:" FMTu64("12") " (%.3f%%)\n", stats.total_packets,
+			CalcPct(stats.total_packets, stats.total_records));
+	LogMessage("   Extra data:" FMTu64("12") " (%.3f%%)\n", stats.total_extra_data,
+			CalcPct(stats.total_extra_data, stats.total_records));
+	LogMessage("   Unknown:" FMTu64("12") " (%.3f%%)\n", stats.total_unknown,
+			CalcPct(stats.total_unknown, stats.total_records));
+	LogMessage("   Suppressed:" FMTu64("12") " (%.3f%%)\n", stats.total_suppressed,
+			CalcPct(stats.total_suppressed, stats.total_records));
+
+	total = stats.total_packets;
 
 	LogMessage("================================================"
 			"===============================\n");
 
 	LogMessage("Packet breakdown by protocol (includes rebuilt packets):\n");
 
-	LogMessage("      ETH: " FMTu64("-10") " (%.3f%%)\n", pc.eth,
-			CalcPct(pc.eth, total));
-	LogMessage("  ETHdisc: " FMTu64("-10") " (%.3f%%)\n", pc.ethdisc,
-			CalcPct(pc.ethdisc, total));
+	LogMessage("      ETH: " FMTu64("-10") " (%.3f%%)\n", stats.eth,
+			CalcPct(stats.eth, total));
+	LogMessage("  ETHdisc: " FMTu64("-10") " (%.3f%%)\n", stats.ethdisc,
+			CalcPct(stats.ethdisc, total));
 #ifdef GIDS
 #ifndef IPFW
 	LogMessage(" IPTables: " FMTu64("-10") " (%.3f%%)\n",
-			pc.iptables, CalcPct(pc.iptables, total));
+			stats.iptables, CalcPct(stats.iptables, total));
 #else
 	LogMessage("     IPFW: " FMTu64("-10") " (%.3f%%)\n",
-			pc.ipfw, CalcPct(pc.ipfw, total));
+			stats.ipfw, CalcPct(stats.ipfw, total));
 #endif  /* IPFW */
 #endif  /* GIDS */
-	LogMessage("     VLAN: " FMTu64("-10") " (%.3f%%)\n", pc.vlan,
-			CalcPct(pc.vlan, total));
-
-	if (pc.nested_vlan != 0)
-		LogMessage("Nested VLAN: " FMTu64("-10") " (%.3f%%)\n", pc.nested_vlan,
-				CalcPct(pc.nested_vlan, total));
-
-	LogMessage("     IPV6: " FMTu64("-10") " (%.3f%%)\n", pc.ipv6,
-			CalcPct(pc.ipv6, total));
-	LogMessage("  IP6 EXT: " FMTu64("-10") " (%.3f%%)\n", pc.ip6ext,
-			CalcPct(pc.ip6ext, total));
-	LogMessage("  IP6opts: " FMTu64("-10") " (%.3f%%)\n", pc.ipv6opts,
-			CalcPct(pc.ipv6opts, total));
-	LogMessage("  IP6disc: " FMTu64("-10") " (%.3f%%)\n", pc.ipv6disc,
-			CalcPct(pc.ipv6disc, total));
-
-	LogMessage("      IP4: " FMTu64("-10") " (%.3f%%)\n", pc.ip,
-			CalcPct(pc.ip, total));
-	LogMessage("  IP4disc: " FMTu64("-10") " (%.3f%%)\n", pc.ipdisc,
-			CalcPct(pc.ipdisc, total));
-
-	LogMessage("    TCP 6: " FMTu64("-10") " (%.3f%%)\n", pc.tcp6,
-			CalcPct(pc.tcp6, total));
-	LogMessage("    UDP 6: " FMTu64("-10") " (%.3f%%)\n", pc.udp6,
-			CalcPct(pc.udp6, total));
-	LogMessage("    ICMP6: " FMTu64("-10") " (%.3f%%)\n", pc.icmp6,
-			CalcPct(pc.icmp6, total));
-	LogMessage("  ICMP-IP: " FMTu64("-10") " (%.3f%%)\n", pc.embdip,
-			CalcPct(pc.embdip, total));
-
-	LogMessage("      TCP: " FMTu64("-10") " (%.3f%%)\n", pc.tcp,
-			CalcPct(pc.tcp, total));
-	LogMessage("      UDP: " FMTu64("-10") " (%.3f%%)\n", pc.udp,
-			CalcPct(pc.udp, total));
-	LogMessage("     ICMP: " FMTu64("-10") " (%.3f%%)\n", pc.icmp,
-			CalcPct(pc.icmp, total));
-
-	LogMessage("  TCPdisc: " FMTu64("-10") " (%.3f%%)\n", pc.tdisc,
-			CalcPct(pc.tdisc, total));
-	LogMessage("  UDPdisc: " FMTu64("-10") " (%.3f%%)\n", pc.udisc,
-			CalcPct(pc.udisc, total));
-	LogMessage("  ICMPdis: " FMTu64("-10") " (%.3f%%)\n", pc.icmpdisc,
-			CalcPct(pc.icmpdisc, total));
-
-	LogMessage("     FRAG: " FMTu64("-10") " (%.3f%%)\n", pc.frags,
-			CalcPct(pc.frags, total));
-	LogMessage("   FRAG 6: " FMTu64("-10") " (%.3f%%)\n", pc.frag6,
-			CalcPct(pc.frag6, total));
-
-	LogMessage("      ARP: " FMTu64("-10") " (%.3f%%)\n", pc.arp,
-			CalcPct(pc.arp, total));
+	LogMessage("     VLAN: " FMTu64("-10") " (%.3f%%)\n", stats.vlan,
+			CalcPct(stats.vlan, total));
+
+	if (stats.nested_vlan != 0)
+		LogMessage("Nested VLAN: " FMTu64("-10") " (%.3f%%)\n", stats.nested_vlan,
+				CalcPct(stats.nested_vlan, total));
+
+	LogMessage("     IPV6: " FMTu64("-10") " (%.3f%%)\n", stats.ipv6,
+			CalcPct(stats.ipv6, total));
+	LogMessage("  IP6 EXT: " FMTu64("-10") " (%.3f%%)\n", stats.ip6ext,
+			CalcPct(stats.ip6ext, total));
+	LogMessage("  IP6opts: " FMTu64("-10") " (%.3f%%)\n", stats.ipv6opts,
+			CalcPct(stats.ipv6opts, total));
+	LogMessage("  IP6disc: " FMTu64("-10") " (%.3f%%)\n", stats.ipv6disc,
+			CalcPct(stats.ipv6disc, total));
+
+	LogMessage("      IP4: " FMTu64("-10") " (%.3f%%)\n", stats.ip,
+			CalcPct(stats.ip, total));
+	LogMessage("  IP4disc: " FMTu64("-10") " (%.3f%%)\n", stats.ipdisc,
+			CalcPct(stats.ipdisc, total));
+
+	LogMessage("    TCP 6: " FMTu64("-10") " (%.3f%%)\n", stats.tcp6,
+			CalcPct(stats.tcp6, total));
+	LogMessage("    UDP 6: " FMTu64("-10") " (%.3f%%)\n", stats.udp6,
+			CalcPct(stats.udp6, total));
+	LogMessage("    ICMP6: " FMTu64("-10") " (%.3f%%)\n", stats.icmp6,
+			CalcPct(stats.icmp6, total));
+	LogMessage("  ICMP-IP: " FMTu64("-10") " (%.3f%%)\n", stats.embdip,
+			CalcPct(stats.embdip, total));
+
+	LogMessage("      TCP: " FMTu64("-10") " (%.3f%%)\n", stats.tcp,
+			CalcPct(stats.tcp, total));
+	LogMessage("      UDP: " FMTu64("-10") " (%.3f%%)\n", stats.udp,
+			CalcPct(stats.udp, total));
+	LogMessage("     ICMP: " FMTu64("-10") " (%.3f%%)\n", stats.icmp,
+			CalcPct(stats.icmp, total));
+
+	LogMessage("  TCPdisc: " FMTu64("-10") " (%.3f%%)\n", stats.tdisc,
+			CalcPct(stats.tdisc, total));
+	LogMessage("  UDPdisc: " FMTu64("-10") " (%.3f%%)\n", stats.udisc,
+			CalcPct(stats.udisc, total));
+	LogMessage("  ICMPdis: " FMTu64("-10") " (%.3f%%)\n", stats.icmpdisc,
+			CalcPct(stats.icmpdisc, total));
+
+	LogMessage("     FRAG: " FMTu64("-10") " (%.3f%%)\n", stats.frags,
+			CalcPct(stats.frags, total));
+	LogMessage("   FRAG 6: " FMTu64("-10") " (%.3f%%)\n", stats.frag6,
+			CalcPct(stats.frag6, total));
+
+	LogMessage("      ARP: " FMTu64("-10") " (%.3f%%)\n", stats.arp,
+			CalcPct(stats.arp, total));
 #ifndef NO_NON_ETHER_DECODER
-	LogMessage("    EAPOL: " FMTu64("-10") " (%.3f%%)\n", pc.eapol,
-			CalcPct(pc.eapol, total));
+	LogMessage("    EAPOL: " FMTu64("-10") " (%.3f%%)\n", stats.eapol,
+			CalcPct(stats.eapol, total));
 #endif
-	LogMessage("  ETHLOOP: " FMTu64("-10") " (%.3f%%)\n", pc.ethloopback,
-			CalcPct(pc.ethloopback, total));
-	LogMessage("      IPX: " FMTu64("-10") " (%.3f%%)\n", pc.ipx,
-			CalcPct(pc.ipx, total));
+	LogMessage("  ETHLOOP: " FMTu64("-10") " (%.3f%%)\n", stats.ethloopback,
+			CalcPct(stats.ethloopback, total));
+	LogMessage("      IPX: " FMTu64("-10") " (%.3f%%)\n", stats.ipx,
+			CalcPct(stats.ipx, total));
 #ifdef GRE
 	LogMessage("IPv4/IPv4: " FMTu64("-10") " (%.3f%%)\n",
-			pc.ip4ip4, CalcPct(pc.ip4ip4, total));
+			stats.ip4ip4, CalcPct(stats.ip4ip4, total));
 	LogMessage("IPv4/IPv6: " FMTu64("-10") " (%.3f%%)\n",
-			pc.ip4ip6, CalcPct(pc.ip4ip6, total));
+			stats.ip4ip6, CalcPct(stats.ip4ip6, total));
 	LogMessage("IPv6/IPv4: " FMTu64("-10") " (%.3f%%)\n",
-			pc.ip6ip4, CalcPct(pc.ip6ip4, total));
+			stats.ip6ip4, CalcPct(stats.ip6ip4, total));
 	LogMessage("IPv6/IPv6: " FMTu64("-10") " (%.3f%%)\n",
-			pc.ip6ip6, CalcPct(pc.ip6ip6, total));
+			stats.ip6ip6, CalcPct(stats.ip6ip6, total));
 	LogMessage("      GRE: " FMTu64("-10") " (%.3f%%)\n",
-			pc.gre, CalcPct(pc.gre, total));
+			stats.gre, CalcPct(stats.gre, total));
 	LogMessage("  GRE ETH: " FMTu64("-10") " (%.3f%%)\n",
-			pc.gre_eth, CalcPct(pc.gre_eth, total));
+			stats.gre_eth, CalcPct(stats.gre_eth, total));
 	LogMessage(" GRE VLAN: " FMTu64("-10") " (%.3f%%)\n",
-			pc.gre_vlan, CalcPct(pc.gre_vlan, total));
+			stats.gre_vlan, CalcPct(stats.gre_vlan, total));
 	LogMessage(" GRE IPv4: " FMTu64("-10") " (%.3f%%)\n",
-			pc.gre_ip, CalcPct(pc.gre_ip, total));
+			stats.gre_ip, CalcPct(stats.gre_ip, total));
 	LogMessage(" GRE IPv6: " FMTu64("-10") " (%.3f%%)\n",
-			pc.gre_ipv6, CalcPct(pc.gre_ipv6, total));
+			stats.gre_ipv6, CalcPct(stats.gre_ipv6, total));
 	LogMessage("GRE IP6 E: " FMTu64("-10") " (%.3f%%)\n",
-			pc.gre_ipv6ext, CalcPct(pc.gre_ipv6ext, total));
+			stats.gre_ipv6ext, CalcPct(stats.gre_ipv6ext, total));
 	LogMessage(" GRE PPTP: " FMTu64("-10") " (%.3f%%)\n",
-			pc.gre_ppp, CalcPct(pc.gre_ppp, total));
+			stats.gre_ppp, CalcPct(stats.gre_ppp, total));
 	LogMessage("  GRE ARP: " FMTu64("-10") " (%.3f%%)\n",
-			pc.gre_arp, CalcPct(pc.gre_arp, total));
+			stats.gre_arp, CalcPct(stats.gre_arp, total));
 	LogMessage("  GRE IPX: " FMTu64("-10") " (%.3f%%)\n",
-			pc.gre_ipx, CalcPct(pc.gre_ipx, total));
+			stats.gre_ipx, CalcPct(stats.gre_ipx, total));
 	LogMessage(" GRE LOOP: " FMTu64("-10") " (%.3f%%)\n",
-			pc.gre_loopback, CalcPct(pc.gre_loopback, total));
+			stats.gre_loopback, CalcPct(stats.gre_loopback, total));
 #endif  /* GRE */
 #ifdef MPLS
 	LogMessage("     MPLS: " FMTu64("-10") " (%.3f%%)\n",
-			pc.mpls, CalcPct(pc.mpls, total));
+			stats.mpls, CalcPct(stats.mpls, total));
 #endif
-	LogMessage("    OTHER: " FMTu64("-10") " (%.3f%%)\n", pc.other,
-			CalcPct(pc.other, total));
-	LogMessage("  DISCARD: " FMTu64("-10") " (%.3f%%)\n", pc.discards,
-			CalcPct(pc.discards, total));
-	LogMessage("InvChkSum: " FMTu64("-10") " (%.3f%%)\n", pc.invalid_checksums,
-			CalcPct(pc.invalid_checksums, total));
-
-	LogMessage("   S5 G 1: " FMTu64("-10") " (%.3f%%)\n", pc.s5tcp1,
-			CalcPct(pc.s5tcp1, total));
-	LogMessage("   S5 G 2: " FMTu64("-10") " (%.3f%%)\n", pc.s5tcp2,
-			CalcPct(pc.s5tcp2, total));
+	LogMessage("    OTHER: " FMTu64("-10") " (%.3f%%)\n", stats.other,
+			CalcPct(stats.other, total));
+	LogMessage("  DISCARD: " FMTu64("-10") " (%.3f%%)\n", stats.discards,
+			CalcPct(stats.discards, total));
+	LogMessage("InvChkSum: " FMTu64("-10") " (%.3f%%)\n", stats.invalid_checksums,
+			CalcPct(stats.invalid_checksums, total));
+
+	LogMessage("   S5 G 1: " FMTu64("-10") " (%.3f%%)\n", stats.s5tcp1,
+			CalcPct(stats.s5tcp1, total));
+	LogMessage("   S5 G 2: " FMTu64("-10") " (%.3f%%)\n", stats.s5tcp2,
+			CalcPct(stats.s5tcp2, total));
 
 	LogMessage("    Total: " FMTu64("-10") "\n", total);
 
@@ -915,11 +1377,11 @@ void DropStats(int exiting) {
 		LogMessage("Wireless Stats:\n");
 		LogMessage("Breakdown by type:\n");
 		LogMessage("    Management Packets: " FMTu64("-10") " (%.3f%%)\n",
-				pc.wifi_mgmt, CalcPct(pc.wifi_mgmt, total));
+				stats.wifi_mgmt, CalcPct(stats.wifi_mgmt, total));
 		LogMessage("    Control Packets:    " FMTu64("-10") " (%.3f%%)\n",
-				pc.wifi_control, CalcPct(pc.wifi_control, total));
+				stats.wifi_control, CalcPct(stats.wifi_control, total));
 		LogMessage("    Data Packets:       " FMTu64("-10") " (%.3f%%)\n",
-				pc.wifi_data, CalcPct(pc.wifi_data, total));
+				stats.wifi_data, CalcPct(stats.wifi_data, total));
 	}
 #endif  /* DLT_IEEE802_11 */
 #endif  // NO_NON_ETHER_DECODER
@@ -2002,156 +2464,29 @@ u_int32_t GetCurrentTimestamp_STATIC(char *buf) {
  * Arguments: xdata  => pointer to data to base64 encode
  *            length => how much data to encode 
  *
- * Make sure you allocate memory for the output before you pass
- * the output pointer into this function. You should allocate 
- * (1.5 * length) bytes to be safe.
+ * The output is allocated here, ENCODE_BASE64_LEN(length) bytes.
  *
  * Returns: data base64 encoded as a char *
  *
  ***************************************************************************/
 char * base64(const u_char * xdata, int length) {
-	int count, cols, bits, c, char_count;
-	unsigned char alpha[] =
-			"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"; /* 64 bytes */
-	char * payloadptr;
-	char * output;
-	char_count = 0;
-	bits = 0;
-	cols = 0;
-
-	output = (char *) SnortAlloc(
-			((unsigned int) (length * 1.5 + 4)) * sizeof(char));
-
-	payloadptr = output;
-
-	for (count = 0; count < length; count++) {
-		c = xdata[count];
-
-		if (c > 255) {
-			ErrorMessage(
-					"plugbase.c->base64(): encountered char > 255 (decimal %d)\n If you see this error message a char is more than one byte on your machine\n This means your base64 results can not be trusted",
-					c);
-		}
+	char *output;
 
-		bits += c;
-		char_count++;
-
-		if (char_count == 3) {
-			*output = alpha[bits >> 18];
-			output++;
-			*output = alpha[(bits >> 12) & 0x3f];
-			output++;
-			*output = alpha[(bits >> 6) & 0x3f];
-			output++;
-			*output = alpha[bits & 0x3f];
-			output++;
-			cols += 4;
-			if (cols == 72) {
-				*output = '\n';
-				output++;
-				cols = 0;
-			}
-			bits = 0;
-			char_count = 0;
-		} else {
-			bits <<= 8;
-		}
-	}
+	if (length < 0)
+		length = 0;
 
-	if (char_count != 0) {
-		bits <<= 16 - (8 * char_count);
-		*output = alpha[bits >> 18];
-		output++;
-		*output = alpha[(bits >> 12) & 0x3f];
-		output++;
-		if (char_count == 1) {
-			*output = '=';
-			output++;
-			*output = '=';
-			output++;
-		} else {
-			*output = alpha[(bits >> 6) & 0x3f];
-			output++;
-			*output = '=';
-			output++;
-		}
-	}
-	*output = '\0';
-	return payloadptr;
+	output = (char *) SnortAlloc(ENCODE_BASE64_LEN(length));
+	EncodeBase64(xdata, length, output, ENCODE_BASE64_LEN(length), NULL);
+
+	return output;
 }
 
 /* Same as above but uses a static buffer provided as a 3rd argument to function.. */
 u_int32_t base64_STATIC(const u_char * xdata, int length, char *output) {
-	int count, cols, bits, c, char_count;
-	unsigned char alpha[] =
-			"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"; /* 64 bytes */
-
-	char_count = 0;
-	bits = 0;
-	cols = 0;
-
-	if (((length * 1.5) + 4) > MAX_QUERY_LENGTH) {
-		/* XXX */
+	if (length < 0)
 		return 1;
-	}
-
-	memset(output, '\0', MAX_QUERY_LENGTH);
-
-	for (count = 0; count < length; count++) {
-		c = xdata[count];
-
-		if (c > 255) {
-			ErrorMessage(
-					"plugbase.c->base64(): encountered char > 255 (decimal %d)\n If you see this error message a char is more than one byte on your machine\n This means your base64 results can not be trusted",
-					c);
-		}
 
-		bits += c;
-		char_count++;
-
-		if (char_count == 3) {
-			*output = alpha[bits >> 18];
-			output++;
-			*output = alpha[(bits >> 12) & 0x3f];
-			output++;
-			*output = alpha[(bits >> 6) & 0x3f];
-			output++;
-			*output = alpha[bits & 0x3f];
-			output++;
-			cols += 4;
-			if (cols == 72) {
-				*output = '\n';
-				output++;
-				cols = 0;
-			}
-			bits = 0;
-			char_count = 0;
-		} else {
-			bits <<= 8;
-		}
-	}
-
-	if (char_count != 0) {
-		bits <<= 16 - (8 * char_count);
-		*output = alpha[bits >> 18];
-		output++;
-		*output = alpha[(bits >> 12) & 0x3f];
-		output++;
-		if (char_count == 1) {
-			*output = '=';
-			output++;
-			*output = '=';
-			output++;
-		} else {
-			*output = alpha[(bits >> 6) & 0x3f];
-			output++;
-			*output = '=';
-			output++;
-		}
-	}
-	*output = '\0';
-
-	return 0;
+	return EncodeBase64(xdata, length, output, MAX_QUERY_LENGTH, NULL);
 }
 
 /****************************************************************************
@@ -2244,8 +2579,6 @@ u_int32_t ascii_STATIC(const u_char *xdata, int length, char *ret_val) {
 		return 1;
 	}
 
-	memset(ret_val, '\0', MAX_QUERY_LENGTH);
-
 	d_ptr = ret_val;
 
 	for (i = 0; i < length; i++) {
@@ -2311,52 +2644,491 @@ char *hex(const u_char *xdata, int length) {
 }
 
 char *fasthex(const u_char *xdata, int length) {
-	char conv[] = "0123456789ABCDEF";
-	char *retbuf = NULL;
-	const u_char *index;
-	const u_char *end;
-	char *ridx;
+	char *retbuf;
 
-	index = xdata;
-	end = xdata + length;
-	retbuf = (char *) SnortAlloc(((length * 2) + 1) * sizeof(char));
-	ridx = retbuf;
+	if (length < 0)
+		length = 0;
 
-	while (index < end) {
-		*ridx++ = conv[((*index & 0xFF) >> 4)];
-		*ridx++ = conv[((*index & 0xFF) & 0x0F)];
-		index++;
-	}
+	retbuf = (char *) SnortAlloc(ENCODE_HEX_LEN(length));
+	EncodeHex(xdata, length, retbuf, ENCODE_HEX_LEN(length), NULL);
 
 	return retbuf;
 }
 
 /* same as above but working with a static buffer */
 u_int32_t fasthex_STATIC(const u_char *xdata, int length, char *retbuf) {
-	char conv[] = "0123456789ABCDEF";
-	const u_char *index;
-	const u_char *end;
-	char *ridx;
+	if (length < 0)
+		return 1;
 
-	if ((xdata == NULL) || (retbuf == NULL)
-			|| (((length * 2) + 1) > MAX_QUERY_LENGTH)) {
-		/* XXX */
+	return EncodeHex(xdata, length, retbuf, MAX_QUERY_LENGTH, NULL);
+}
+
+/****************************************************************************
+ *
+ * Payload encoders that track their output length.  They write exactly
+ * the encoded bytes and a terminating NUL, never the rest of the output
+ * buffer, and report the length so the caller need not strlen() it.
+ *
+ * On x86 with gcc or clang each has SSE2 (SSSE3 for base64) and AVX2
+ * versions next to the scalar one, picked once from cpuid.
+ *
+ ***************************************************************************/
+
+static const char *encode_simd_names[] = { "scalar", "sse2", "ssse3", "avx2" };
+static int encode_simd_max = ENCODE_SIMD_AVX2;
+static int encode_simd = -1;
+
+/* what the cpu supports, capped by EncodeSimdSet() */
+static int EncodeSimd(void) {
+	int level = ENCODE_SIMD_SCALAR;
+
+	if (encode_simd >= 0)
+		return encode_simd;
+
+#ifdef ENCODE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		level = ENCODE_SIMD_AVX2;
+	else if (__builtin_cpu_supports("ssse3"))
+		level = ENCODE_SIMD_SSSE3;
+	else if (__builtin_cpu_supports("sse2"))
+		level = ENCODE_SIMD_SSE2;
+#endif
+
+	if (level > encode_simd_max)
+		level = encode_simd_max;
+
+	encode_simd = level;
+	return level;
+}
+
+/* Limit the encoders to scalar, sse2, ssse3 or avx2, -1 if unknown */
+int EncodeSimdSet(const char *name) {
+	int i;
+
+	for (i = 0; i <= ENCODE_SIMD_AVX2; i++) {
+		if (strcasecmp(name, encode_simd_names[i]) == 0) {
+			encode_simd_max = i;
+			encode_simd = -1;
+			return EncodeSimd();
+		}
+	}
+
+	return -1;
+}
+
+const char *EncodeSimdName(void) {
+	return encode_simd_names[EncodeSimd()];
+}
+
+#ifdef ENCODE_X86
+/* nibbles 0..15 to '0'..'9','A'..'F' */
+#define HEX_SSE2(n) \
+	_mm_add_epi8(_mm_add_epi8((n), _mm_set1_epi8('0')), \
+			_mm_and_si128(_mm_cmpgt_epi8((n), _mm_set1_epi8(9)), \
+					_mm_set1_epi8('A' - '0' - 10)))
+#define HEX_AVX2(n) \
+	_mm256_add_epi8(_mm256_add_epi8((n), _mm256_set1_epi8('0')), \
+			_mm256_and_si256(_mm256_cmpgt_epi8((n), _mm256_set1_epi8(9)), \
+					_mm256_set1_epi8('A' - '0' - 10)))
+
+__attribute__((target("sse2")))
+static u_int32_t EncodeHexSSE2(const u_char *src, u_int32_t len, char *dst) {
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	__m128i v, hi, lo;
+	u_int32_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *) (src + i));
+		hi = HEX_SSE2(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+		lo = HEX_SSE2(_mm_and_si128(v, mask));
+		_mm_storeu_si128((__m128i *) (dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *) (dst + 2 * i + 16),
+				_mm_unpackhi_epi8(hi, lo));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static u_int32_t EncodeHexAVX2(const u_char *src, u_int32_t len, char *dst) {
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	__m256i v, hi, lo, a, b;
+	u_int32_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *) (src + i));
+		hi = HEX_AVX2(_mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+		lo = HEX_AVX2(_mm256_and_si256(v, mask));
+		/* the unpacks work per 128 bit lane, put the lanes back in order */
+		a = _mm256_unpacklo_epi8(hi, lo);
+		b = _mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256((__m256i *) (dst + 2 * i),
+				_mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *) (dst + 2 * i + 32),
+				_mm256_permute2x128_si256(a, b, 0x31));
+	}
+
+	return i;
+}
+#endif /* ENCODE_X86 */
+
+/****************************************************************************
+ *
+ * Function: EncodeHex(const u_char *src, u_int32_t len, char *dst,
+ *                     u_int32_t dstlen, u_int32_t *outlen)
+ *
+ * Purpose: upper case hex of src, no spaces
+ *
+ * Arguments: dst must hold 2 * len + 1 bytes, *outlen gets 2 * len
+ *
+ * Returns: 0 on success, 1 if dst is too small
+ *
+ ***************************************************************************/
+u_int32_t EncodeHex(const u_char *src, u_int32_t len, char *dst,
+		u_int32_t dstlen, u_int32_t *outlen) {
+	static const char conv[] = "0123456789ABCDEF";
+	u_int32_t i = 0;
+	int simd = EncodeSimd();
+
+	if ((src == NULL) || (dst == NULL) || (ENCODE_HEX_LEN(len) > dstlen))
 		return 1;
+
+#ifdef ENCODE_X86
+	if (simd == ENCODE_SIMD_AVX2)
+		i = EncodeHexAVX2(src, len, dst);
+	if (simd >= ENCODE_SIMD_SSE2)
+		i += EncodeHexSSE2(src + i, len - i, dst + 2 * i);
+#endif
+
+	for (; i < len; i++) {
+		dst[2 * i] = conv[src[i] >> 4];
+		dst[2 * i + 1] = conv[src[i] & 0x0f];
 	}
+	dst[2 * len] = '\0';
 
-	index = xdata;
-	end = xdata + length;
+	if (outlen)
+		*outlen = 2 * len;
 
-	memset(retbuf, '\0', MAX_QUERY_LENGTH);
+	return 0;
+}
 
-	ridx = retbuf;
+#ifdef ENCODE_X86
+/*
+ * 12 input bytes in the low bytes of v to 16 base64 characters.  The
+ * shuffle puts each 3 byte group in a 32 bit word, the multiplies move
+ * its four 6 bit fields into separate bytes and the lookup maps them to
+ * ranges of the alphabet (Mula and Lemire, "Faster Base64 Encoding and
+ * Decoding using AVX2 Instructions").
+ */
+__attribute__((target("ssse3")))
+static inline __m128i Base64Chars128(__m128i v) {
+	const __m128i groups = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7,
+			10, 9, 11, 10);
+	const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	__m128i in, idx, r;
+
+	in = _mm_shuffle_epi8(v, groups);
+	idx = _mm_or_si128(
+			_mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+					_mm_set1_epi32(0x04000040)),
+			_mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+					_mm_set1_epi32(0x01000010)));
+
+	/* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+	r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+	r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx),
+			_mm_set1_epi8(13)));
+
+	return _mm_add_epi8(_mm_shuffle_epi8(shift, r), idx);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Base64Chars256(__m256i v) {
+	const __m256i groups = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8,
+			7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i shift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0, 'a' - 26,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A',
+			0, 0);
+	__m256i in, idx, r;
+
+	in = _mm256_shuffle_epi8(v, groups);
+	idx = _mm256_or_si256(
+			_mm256_mulhi_epu16(
+					_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+					_mm256_set1_epi32(0x04000040)),
+			_mm256_mullo_epi16(
+					_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+					_mm256_set1_epi32(0x01000010)));
+
+	r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+	r = _mm256_or_si256(r,
+			_mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx),
+					_mm256_set1_epi8(13)));
+
+	return _mm256_add_epi8(_mm256_shuffle_epi8(shift, r), idx);
+}
+
+/* whole 12 byte blocks, each load reads 4 bytes past its block */
+__attribute__((target("ssse3")))
+static u_int32_t EncodeBase64SSSE3(const u_char *src, u_int32_t len, char *dst) {
+	u_int32_t i;
+
+	for (i = 0; i + 16 <= len; i += 12, dst += 16)
+		_mm_storeu_si128((__m128i *) dst,
+				Base64Chars128(_mm_loadu_si128((const __m128i *) (src + i))));
 
-	while (index < end) {
-		*ridx++ = conv[((*index & 0xFF) >> 4)];
-		*ridx++ = conv[((*index & 0xFF) & 0x0F)];
-		index++;
+	return i;
+}
+
+/* whole 24 byte blocks, a 12 byte block in each lane */
+__attribute__((target("avx2")))
+static u_int32_t EncodeBase64AVX2(const u_char *src, u_int32_t len, char *dst) {
+	__m256i v;
+	u_int32_t i;
+
+	for (i = 0; i + 28 <= len; i += 24, dst += 32) {
+		v = _mm256_inserti128_si256(
+				_mm256_castsi128_si256(
+						_mm_loadu_si128((const __m128i *) (src + i))),
+				_mm_loadu_si128((const __m128i *) (src + i + 12)), 1);
+		_mm256_storeu_si256((__m256i *) dst, Base64Chars256(v));
 	}
 
+	return i;
+}
+#endif /* ENCODE_X86 */
+
+#define BASE64_LINE	54	/* input bytes per 72 column line */
+
+/****************************************************************************
+ *
+ * Function: EncodeBase64(const u_char *src, u_int32_t len, char *dst,
+ *                        u_int32_t dstlen, u_int32_t *outlen)
+ *
+ * Purpose: base64 of src, a newline after every 72 columns as base64()
+ *          has always written
+ *
+ * Arguments: dst must hold ENCODE_BASE64_LEN(len) bytes, *outlen gets the
+ *            length written less the NUL
+ *
+ * Returns: 0 on success, 1 if dst is too small
+ *
+ ***************************************************************************/
+u_int32_t EncodeBase64(const u_char *src, u_int32_t len, char *dst,
+		u_int32_t dstlen, u_int32_t *outlen) {
+	static const char alpha[] =
+			"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	u_int32_t i = 0, j, n, bits;
+	int simd = EncodeSimd();
+	char *o = dst;
+
+	if ((src == NULL) || (dst == NULL) || (ENCODE_BASE64_LEN(len) > dstlen))
+		return 1;
+
+	while (len - i >= 3) {
+		n = len - i;
+		if (n > BASE64_LINE)
+			n = BASE64_LINE;
+		n -= n % 3;
+
+		j = 0;
+#ifdef ENCODE_X86
+		if (simd == ENCODE_SIMD_AVX2)
+			j = EncodeBase64AVX2(src + i, n, o);
+		if (simd >= ENCODE_SIMD_SSSE3)
+			j += EncodeBase64SSSE3(src + i + j, n - j, o + j / 3 * 4);
+#endif
+		for (; j < n; j += 3) {
+			bits = (src[i + j] << 16) | (src[i + j + 1] << 8) | src[i + j + 2];
+			o[j / 3 * 4] = alpha[bits >> 18];
+			o[j / 3 * 4 + 1] = alpha[(bits >> 12) & 0x3f];
+			o[j / 3 * 4 + 2] = alpha[(bits >> 6) & 0x3f];
+			o[j / 3 * 4 + 3] = alpha[bits & 0x3f];
+		}
+
+		o += n / 3 * 4;
+		i += n;
+		if (n == BASE64_LINE)
+			*o++ = '\n';
+	}
+
+	if (i < len) {
+		bits = src[i] << 16;
+		if (len - i == 2)
+			bits |= src[i + 1] << 8;
+		*o++ = alpha[bits >> 18];
+		*o++ = alpha[(bits >> 12) & 0x3f];
+		*o++ = (len - i == 2) ? alpha[(bits >> 6) & 0x3f] : '=';
+		*o++ = '=';
+	}
+	*o = '\0';
+
+	if (outlen)
+		*outlen = o - dst;
+
+	return 0;
+}
+
+#ifdef ENCODE_X86
+/*
+ * Whole 16 or 32 byte blocks while dst has room for any block; blocks
+ * with nothing to escape are stored as they are.  Returns the bytes
+ * consumed, *op is the output length.
+ */
+__attribute__((target("sse2")))
+static u_int32_t EncodeEscapeSSE2(const u_char *src, u_int32_t len, char *dst,
+		u_int32_t dstlen, const EncodeEscapeMap *map, u_int32_t *op) {
+	__m128i special[16], v, hit;
+	u_int32_t i, j, k, m, o = *op;
+
+	for (k = 0; k < map->special_cnt; k++)
+		special[k] = _mm_set1_epi8((char) map->special[k]);
+
+	for (i = 0; i + 16 <= len && o + 32 < dstlen; i += 16) {
+		v = _mm_loadu_si128((const __m128i *) (src + i));
+		hit = _mm_setzero_si128();
+		for (k = 0; k < map->special_cnt; k++)
+			hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, special[k]));
+
+		m = (u_int32_t) _mm_movemask_epi8(hit);
+
+		/* dense, byte by byte */
+		if (__builtin_popcount(m) > 4) {
+			for (j = i; j < i + 16; j++) {
+				if (map->esc[src[j]][0]) {
+					dst[o++] = map->esc[src[j]][0];
+					dst[o++] = map->esc[src[j]][1];
+				} else
+					dst[o++] = src[j];
+			}
+			continue;
+		}
+
+		/* sparse, copy up to each byte to escape then its escape */
+		for (j = 0; m; m &= m - 1) {
+			k = __builtin_ctz(m);
+			memcpy(dst + o, src + i + j, k - j);
+			o += k - j;
+			dst[o++] = map->esc[src[i + k]][0];
+			dst[o++] = map->esc[src[i + k]][1];
+			j = k + 1;
+		}
+		if (j == 0)
+			_mm_storeu_si128((__m128i *) (dst + o), v);
+		else
+			memcpy(dst + o, src + i + j, 16 - j);
+		o += 16 - j;
+	}
+
+	*op = o;
+	return i;
+}
+
+__attribute__((target("avx2")))
+static u_int32_t EncodeEscapeAVX2(const u_char *src, u_int32_t len, char *dst,
+		u_int32_t dstlen, const EncodeEscapeMap *map, u_int32_t *op) {
+	__m256i special[16], v, hit;
+	u_int32_t i, j, k, m, o = *op;
+
+	for (k = 0; k < map->special_cnt; k++)
+		special[k] = _mm256_set1_epi8((char) map->special[k]);
+
+	for (i = 0; i + 32 <= len && o + 64 < dstlen; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *) (src + i));
+		hit = _mm256_setzero_si256();
+		for (k = 0; k < map->special_cnt; k++)
+			hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, special[k]));
+
+		m = (u_int32_t) _mm256_movemask_epi8(hit);
+
+		/* dense, byte by byte */
+		if (__builtin_popcount(m) > 4) {
+			for (j = i; j < i + 32; j++) {
+				if (map->esc[src[j]][0]) {
+					dst[o++] = map->esc[src[j]][0];
+					dst[o++] = map->esc[src[j]][1];
+				} else
+					dst[o++] = src[j];
+			}
+			continue;
+		}
+
+		/* sparse, copy up to each byte to escape then its escape */
+		for (j = 0; m; m &= m - 1) {
+			k = __builtin_ctz(m);
+			memcpy(dst + o, src + i + j, k - j);
+			o += k - j;
+			dst[o++] = map->esc[src[i + k]][0];
+			dst[o++] = map->esc[src[i + k]][1];
+			j = k + 1;
+		}
+		if (j == 0)
+			_mm256_storeu_si256((__m256i *) (dst + o), v);
+		else
+			memcpy(dst + o, src + i + j, 32 - j);
+		o += 32 - j;
+	}
+
+	*op = o;
+	return i;
+}
+#endif /* ENCODE_X86 */
+
+/****************************************************************************
+ *
+ * Function: EncodeEscape(const char *src, u_int32_t len, char *dst,
+ *                        u_int32_t dstlen, const EncodeEscapeMap *map,
+ *                        u_int32_t *outlen)
+ *
+ * Purpose: copy src to dst replacing each byte map escapes with its two
+ *          byte escape.  Blocks with nothing to escape are found and
+ *          copied a vector at a time.
+ *
+ * Arguments: dst holds dstlen bytes, 2 * len + 1 is always enough,
+ *            *outlen gets the length written less the NUL
+ *
+ * Returns: 0 on success, 1 if dst is too small
+ *
+ ***************************************************************************/
+u_int32_t EncodeEscape(const char *src, u_int32_t len, char *dst,
+		u_int32_t dstlen, const EncodeEscapeMap *map, u_int32_t *outlen) {
+	const u_char *s = (const u_char *) src;
+	u_int32_t i = 0, o = 0;
+	int simd = EncodeSimd();
+
+	if ((src == NULL) || (dst == NULL) || (map == NULL) || (dstlen == 0))
+		return 1;
+
+#ifdef ENCODE_X86
+	if (simd == ENCODE_SIMD_AVX2)
+		i = EncodeEscapeAVX2(s, len, dst, dstlen, map, &o);
+	if (simd >= ENCODE_SIMD_SSE2)
+		i += EncodeEscapeSSE2(s + i, len - i, dst, dstlen, map, &o);
+#endif
+
+	for (; i < len; i++) {
+		if (map->esc[s[i]][0]) {
+			if (o + 2 >= dstlen)
+				return 1;
+			dst[o++] = map->esc[s[i]][0];
+			dst[o++] = map->esc[s[i]][1];
+		} else {
+			if (o + 1 >= dstlen)
+				return 1;
+			dst[o++] = s[i];
+		}
+	}
+	dst[o] = '\0';
+
+	if (outlen)
+		*outlen = o;
+
 	return 0;
 }
 
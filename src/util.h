@@ -82,6 +82,15 @@
 #define MAX_QUERY_LENGTH ((65536 * 2) + 4096) /* Lets add some space for payload decoding and query esaping..*/
 #endif  /* MAX_QUERY_LENGTH */
 
+#define ENCODE_SIMD_SCALAR  0
+#define ENCODE_SIMD_SSE2    1
+#define ENCODE_SIMD_SSSE3   2   /* base64 needs pshufb */
+#define ENCODE_SIMD_AVX2    3
+
+/* output EncodeHex() and EncodeBase64() need, with the NUL */
+#define ENCODE_HEX_LEN(len)     ((u_int64_t)(len) * 2 + 1)
+#define ENCODE_BASE64_LEN(len)  (((u_int64_t)(len) + 2) / 3 * 4 + (u_int64_t)(len) / 54 + 1)
+
 
 /* Externs ********************************************************************/
 extern uint32_t *netmasks;
@@ -89,6 +98,14 @@ extern uint32_t *netmasks;
 
 /* Data types *****************************************************************/
 
+/* Bytes EncodeEscape() replaces, and with what */
+typedef struct _EncodeEscapeMap
+{
+    u_int32_t special_cnt;
+    u_char special[16];         /* the bytes with an esc[] entry, for the vector scan */
+    char esc[256][2];           /* two byte escape, esc[c][0] == 0 copies c */
+} EncodeEscapeMap;
+
 /* Self preservation memory control struct */
 typedef struct _SPMemControl
 {
@@ -185,12 +202,18 @@ char *read_infile(char *);
 void CleanupProtoNames(void);
 void ErrorMessage(const char *, ...);
 void LogMessage(const char *, ...);
+void LogAsyncStart(uint32_t, uint32_t);
+void LogAsyncStop(void);
 NORETURN void FatalError(const char *, ...);
 void CreatePidFile(char *);
 void ClosePidFile(void);
 void SetUidGid(int, int);
 void SetChroot(char *, char **);
 void DropStats(int);
+struct _PacketCount;
+void PacketCountRegister(void);
+void PacketCountSnapshot(struct _PacketCount *);
+void SetThreadName(const char *);
 void *SPAlloc(unsigned long, struct _SPMemControl *);
 int SnortSnprintf(char *, size_t, const char *, ...);
 int SnortSnprintfAppend(char *, size_t, const char *, ...);
@@ -221,6 +244,13 @@ u_int32_t fasthex_STATIC(const u_char *xdata, int length,char *retbuf);
 u_int32_t base64_STATIC(const u_char * xdata, int length,char *output);
 u_int32_t ascii_STATIC(const u_char *xdata, int length,char *ret_val);
 
+int EncodeSimdSet(const char *);
+const char *EncodeSimdName(void);
+u_int32_t EncodeHex(const u_char *, u_int32_t, char *, u_int32_t, u_int32_t *);
+u_int32_t EncodeBase64(const u_char *, u_int32_t, char *, u_int32_t, u_int32_t *);
+u_int32_t EncodeEscape(const char *, u_int32_t, char *, u_int32_t,
+        const EncodeEscapeMap *, u_int32_t *);
+
 u_int32_t GetTimestampByComponent_STATIC(uint32_t sec, uint32_t usec, int tz,char *buf);
 u_int32_t GetTimestampByStruct_STATIC(register const struct timeval *tvp, int tz,char *buf);
 u_int32_t GetCurrentTimestamp_STATIC(char *buf);